@@ -8,6 +8,15 @@
 #include "Templates/UniquePtr.h"
 #include "Templates/SharedPointer.h"
 #include "Algo/Compare.h"
+#include "Async/ParallelFor.h"
+#include "Async/Async.h"
+#include "Misc/FileHelper.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/OutputDeviceHelper.h"
+#include "HAL/MemoryBase.h"
+#include "Serialization/JsonSerializer.h"
+#include "Policies/CondensedJsonPrintPolicy.h"
+#include "Runtime/Launch/Resources/Version.h"
 #include "sparklogs.h"
 
 template<typename T>
@@ -63,6 +72,7 @@ public:
             GConfig->Flush(false, StateIni);
             GConfig->Remove(StateIni);
             IFileManager::Get().Delete(*StateIni, false, false, true);
+            IFileManager::Get().Delete(*ITLGetProgressJournalPath(StateIni), false, false, true);
         }
     }
 
@@ -96,9 +106,11 @@ class FsparklogsStoreInMemPayloadProcessor : public IsparklogsPayloadProcessor
 {
 public:
     bool FailProcessing;
+    bool AcceptEnvelope;
     TArray<FString> Payloads;
     int LastOriginalPayloadLen;
-    FsparklogsStoreInMemPayloadProcessor() : FailProcessing(false) { }
+    FsparklogsStoreInMemPayloadProcessor() : FailProcessing(false), AcceptEnvelope(false) { }
+    virtual bool AcceptsCommonMetadataEnvelope() override { return AcceptEnvelope; }
     virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override
     {
         LastOriginalPayloadLen = OriginalPayloadLen;
@@ -143,6 +155,10 @@ static void SetupCompressionModes(TArray<FString>& OutBeautifiedNames, TArray <F
     OutTestCommands.Add(FString::FromInt((int)ITLCompressionMode::None));
     OutBeautifiedNames.Add(TEXT("LZ4"));
     OutTestCommands.Add(FString::FromInt((int)ITLCompressionMode::LZ4));
+    OutBeautifiedNames.Add(TEXT("LZ4 frame"));
+    OutTestCommands.Add(FString::FromInt((int)ITLCompressionMode::LZ4Frame));
+    OutBeautifiedNames.Add(TEXT("gzip"));
+    OutTestCommands.Add(FString::FromInt((int)ITLCompressionMode::Gzip));
 }
 
 IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestSkipByteMarker, "sparklogs.UnitTests.SkipByteMarker", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
@@ -745,144 +761,2347 @@ bool FsparklogsPluginUnitTestRetrySamePayloadSize::RunTest(const FString& Parame
     return true;
 }
 
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestPipelinedRetrySamePayloadSizes, "sparklogs.UnitTests.PipelinedRetrySamePayloadSizes", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestPipelinedRetrySamePayloadSizes::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestPipelinedRetrySamePayloadSizes::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    TArray<FString> ExpectedPayloads;
+
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nLine 2\r\nLine 3\r\nLine 4\r\nLine 5\r\n"));
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    // Each request can hold two lines, and keep two requests in flight.
+    Settings->BytesPerRequest = 20;
+    Settings->MaxInFlightRequests = 2;
+    constexpr double TestProcessingIntervalSecs = 0.1;
+    constexpr double TestRetryIntervalSecs = 0.1;
+    Settings->ProcessingIntervalSecs = TestProcessingIntervalSecs;
+    Settings->RetryIntervalSecs = TestRetryIntervalSecs;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+
+    // A single flush should ship the entire backlog across several requests
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 1\"},{\"message\":\"Line 2\"}]"));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 3\"},{\"message\":\"Line 4\"}]"));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 5\"}]"));
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[1] should succeed"), Streamer->FlushAndWait(1, false, false, false, TestProcessingIntervalSecs * 5, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[1] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[1] should capture everything"), FlushedEverything);
+
+    // Fail both in-flight requests, and make sure the sizes of both are remembered
+    PayloadProcessor->FailProcessing = true;
+    ITLWriteStringToFile(LogWriter, TEXT("Line 6\r\nLine 7\r\nLine 8\r\n"));
+    LogWriter->Flush();
+    TestFalse(TEXT("FlushAndWait[2] should fail because of failure to process"), Streamer->FlushAndWait(1, false, false, false, TestProcessingIntervalSecs * 5, FlushedEverything));
+    TestFalse(TEXT("FlushAndWait[2] should NOT capture everything"), FlushedEverything);
+    int64 ProgressMarker = 0;
+    int LastReadLen = 0;
+    TArray<uint8> IgnoreProgressState;
+    TArray<int> FollowingReadLens;
+    TestTrue(TEXT("ReadProgressMarker should succeed"), Streamer->ReadProgressMarker(ProgressMarker, LastReadLen, IgnoreProgressState, FollowingReadLens));
+    TestEqual(TEXT("Progress marker should stop at the first failed request"), ProgressMarker, (int64)40);
+    TestEqual(TEXT("Progress marker should remember the size of the first failed request"), LastReadLen, 20);
+    TestEqual(TEXT("Progress marker should remember the size of the following request"), FollowingReadLens.Num(), 1);
+    if (FollowingReadLens.Num() == 1)
+    {
+        TestEqual(TEXT("Progress marker following request size"), FollowingReadLens[0], 8);
+    }
+
+    // New data must not change the retried requests, and should ship after them
+    ITLWriteStringToFile(LogWriter, TEXT("Line 9\r\n"));
+    LogWriter->Flush();
+    PayloadProcessor->FailProcessing = false;
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 6\"},{\"message\":\"Line 7\"}]"));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 8\"}]"));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 9\"}]"));
+    FPlatformProcess::SleepNoStats(TestRetryIntervalSecs * 5);
+    TestTrue(TEXT("FlushAndWait[3] should succeed"), Streamer->FlushAndWait(1, true, false, false, TestRetryIntervalSecs * 10, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[3] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[3] should capture everything"), FlushedEverything);
+
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestParallelCatchUp, "sparklogs.UnitTests.ParallelCatchUp", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestParallelCatchUp::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestParallelCatchUp::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    TArray<FString> ExpectedPayloads;
+
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nLine 2\r\nLine 3\r\nLine 4\r\nLine 5\r\nLine 6\r\nLine 7\r\nLine 8\r\nLine 9\r\n"));
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    // Each request can hold two lines, and the backlog is prepared four requests at a time even though only one is ever in flight.
+    Settings->BytesPerRequest = 20;
+    Settings->MaxInFlightRequests = 1;
+    Settings->CatchUpParallelism = 4;
+    constexpr double TestProcessingIntervalSecs = 0.1;
+    constexpr double TestRetryIntervalSecs = 0.1;
+    Settings->ProcessingIntervalSecs = TestProcessingIntervalSecs;
+    Settings->RetryIntervalSecs = TestRetryIntervalSecs;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+
+    // Payloads prepared in parallel must still ship in order and only contain whole lines
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 1\"},{\"message\":\"Line 2\"}]"));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 3\"},{\"message\":\"Line 4\"}]"));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 5\"},{\"message\":\"Line 6\"}]"));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 7\"},{\"message\":\"Line 8\"}]"));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 9\"}]"));
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[1] should succeed"), Streamer->FlushAndWait(1, false, false, false, TestProcessingIntervalSecs * 5, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[1] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[1] should capture everything"), FlushedEverything);
+
+    // A failed catch-up payload must remember the size it was prepared with, so the retry sends exactly the same lines
+    PayloadProcessor->FailProcessing = true;
+    ITLWriteStringToFile(LogWriter, TEXT("Line A\r\nLine B\r\nLine C\r\nLine D\r\nLine E\r\n"));
+    LogWriter->Flush();
+    TestFalse(TEXT("FlushAndWait[2] should fail because of failure to process"), Streamer->FlushAndWait(1, false, false, false, TestProcessingIntervalSecs * 5, FlushedEverything));
+    TestFalse(TEXT("FlushAndWait[2] should NOT capture everything"), FlushedEverything);
+    int64 ProgressMarker = 0;
+    int LastReadLen = 0;
+    TArray<uint8> IgnoreProgressState;
+    TArray<int> FollowingReadLens;
+    TestTrue(TEXT("ReadProgressMarker should succeed"), Streamer->ReadProgressMarker(ProgressMarker, LastReadLen, IgnoreProgressState, FollowingReadLens));
+    TestEqual(TEXT("Progress marker should stop at the failed request"), ProgressMarker, (int64)72);
+    TestEqual(TEXT("Progress marker should remember the line-aligned size of the failed request"), LastReadLen, 16);
+
+    PayloadProcessor->FailProcessing = false;
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line A\"},{\"message\":\"Line B\"}]"));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line C\"},{\"message\":\"Line D\"}]"));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line E\"}]"));
+    FPlatformProcess::SleepNoStats(TestRetryIntervalSecs * 5);
+    TestTrue(TEXT("FlushAndWait[3] should succeed"), Streamer->FlushAndWait(1, true, false, false, TestRetryIntervalSecs * 10, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[3] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[3] should capture everything"), FlushedEverything);
+
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestWakeOnFlushRequest, "sparklogs.UnitTests.WakeOnFlushRequest", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestWakeOnFlushRequest::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestWakeOnFlushRequest::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    TArray<FString> ExpectedPayloads;
+
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\n"));
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    // The worker would sleep far longer than the test timeouts unless a flush request wakes it up.
+    Settings->ProcessingIntervalSecs = 60.0;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 1\"}]"));
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[1] should succeed"), Streamer->FlushAndWait(1, false, false, false, 5.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[1] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+
+    // The worker is now idle until the next processing interval
+    FPlatformProcess::SleepNoStats(0.2f);
+    ITLWriteStringToFile(LogWriter, TEXT("Line 2\r\n"));
+    LogWriter->Flush();
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 2\"}]"));
+    TestTrue(TEXT("FlushAndWait[2] should wake up the worker and succeed"), Streamer->FlushAndWait(1, false, false, false, 5.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[2] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[2] should capture everything"), FlushedEverything);
+    double Latency = Streamer->GetLastWakeToSendLatencySecs();
+    TestTrue(TEXT("Wake to send latency should be measured"), Latency >= 0.0);
+    TestTrue(TEXT("Wake to send latency should be well under the processing interval"), Latency < 5.0);
+
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+
+    Streamer.Reset();
+    return true;
+}
+
 IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestClearRetryTimer, "sparklogs.UnitTests.ClearRetryTimer", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
 void FsparklogsPluginUnitTestClearRetryTimer::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
 {
     SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
 }
-bool FsparklogsPluginUnitTestClearRetryTimer::RunTest(const FString& Parameters)
+bool FsparklogsPluginUnitTestClearRetryTimer::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    TArray<FString> ExpectedPayloads;
+
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nLine 2\r\n1234"));
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    // Setup so that we process success requests very quickly, but delay a long time after a failure
+    constexpr double TestProcessingIntervalSecs = 0.1;
+    constexpr double TestRetryIntervalSecs = 3.0;
+    Settings->ProcessingIntervalSecs = TestProcessingIntervalSecs;
+    Settings->RetryIntervalSecs = TestRetryIntervalSecs;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 1\"},{\"message\":\"Line 2\"}]"));
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[1] should succeed"), Streamer->FlushAndWait(1, false, false, false, TestProcessingIntervalSecs * 5, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[1] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestFalse(TEXT("FlushAndWait[1] should NOT capture everything"), FlushedEverything);
+
+    // Setup more data to log, but simulate failure of the payload processor
+    PayloadProcessor->FailProcessing = true;
+    ITLWriteStringToFile(LogWriter, TEXT("Line 3\r\nLine 4"));
+    LogWriter->Flush();
+    TestFalse(TEXT("FlushAndWait[2] should fail because of failure to process"), Streamer->FlushAndWait(1, false, false, false, TestProcessingIntervalSecs * 5, FlushedEverything));
+    TestFalse(TEXT("FlushAndWait[2] should NOT capture everything"), FlushedEverything);
+
+    // Make sure all manual flush requests have been processed
+    FPlatformProcess::SleepNoStats(TestProcessingIntervalSecs * 5);
+
+    // Even though processing the payload will no longer fail, we have to wait longer before a retry is allowed.
+    // HOWEVER, clear the retry timer in this attempt, so it should succeed immediately!
+    PayloadProcessor->FailProcessing = false;
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"1234Line 3\"}]"));
+    TestTrue(TEXT("FlushAndWait[3] should succeed because the retry timer was cleared"), Streamer->FlushAndWait(1, true, false, false, TestProcessingIntervalSecs * 5, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[3] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestFalse(TEXT("FlushAndWait[3] should NOT capture everything"), FlushedEverything);
+
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestFalse(TEXT("FlushAndWait[FINAL] should NOT capture everything"), FlushedEverything);
+
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestAppInstanceID, "sparklogs.UnitTests.AppInstanceID", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestAppInstanceID::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestAppInstanceID::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    TArray<FString> ExpectedPayloads;
+
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    const TCHAR* TestPayload1 = TEXT("Hello world");
+    ITLWriteStringToFile(LogWriter, *FString::Format(TEXT("{0}\r\n"), { TestPayload1 }));
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = false;
+    Settings->AddRandomAppInstanceID = true;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), TEXT("abcd_1234_EFGH"), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+    ExpectedPayloads.Add(FString::Format(TEXT("[{\"app_instance_id\": \"abcd_1234_EFGH\", \"app_instance_index\": {0},\"message\":\"{1}\"}]"), { TestInstanceIndex, TestPayload1 }));
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestAdditionalAttributes, "sparklogs.UnitTests.AdditionalAttributes", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestAdditionalAttributes::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestAdditionalAttributes::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    TArray<FString> ExpectedPayloads;
+
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    const TCHAR* TestPayload1 = TEXT("Hello world");
+    ITLWriteStringToFile(LogWriter, *FString::Format(TEXT("{0}\r\n"), { TestPayload1 }));
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TMap<FString, FString> AdditionalAttributes;
+    AdditionalAttributes.Add(TEXT("game_version"), TEXT("v1.2.3"));
+    AdditionalAttributes.Add(TEXT("game_name"), TEXT("hello world"));
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), &AdditionalAttributes));
+    Streamer->SetWeakThisPtr(Streamer);
+    ExpectedPayloads.Add(FString::Format(TEXT("[{\"game_version\":\"v1.2.3\",\"game_name\":\"hello world\",\"message\":\"{0}\"}]"), { TestPayload1 }));
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestDedupAfterCrash, "sparklogs.UnitTests.DedupAfterCrash", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestDedupAfterCrash::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestDedupAfterCrash::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    TArray<FString> ExpectedPayloads;
+
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nLine 2\r\n1234"));
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    // Setup so that we process success requests and retry requests very quickly.
+    constexpr double TestProcessingIntervalSecs = 0.1;
+    constexpr double TestRetryIntervalSecs = 0.1;
+    Settings->ProcessingIntervalSecs = TestProcessingIntervalSecs;
+    Settings->RetryIntervalSecs = TestRetryIntervalSecs;
+    Settings->IncludeCommonMetadata = false;
+    Settings->AddRandomAppInstanceID = true;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    // Force payload processing to fail
+    PayloadProcessor->FailProcessing = true;
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), TEXT("abcd_1234_EFGH"), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+    bool FlushedEverything = false;
+    TestFalse(TEXT("FlushAndWait[1-FINAL] should not succeed because of forced failure to process"), Streamer->FlushAndWait(2, true, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[1-FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestFalse(TEXT("FlushAndWait[1-FINAL] should NOT capture everything"), FlushedEverything);
+    
+    TArray<uint8> ExpectedProgressState;
+    Streamer->GetCommonEventJSON(ExpectedProgressState);
+
+    int64 ProgressMarker = 0;
+    int ProgressLastReadLen = 0;
+    TArray<uint8> ProgressState;
+    Streamer->ReadProgressMarker(ProgressMarker, ProgressLastReadLen, ProgressState);
+    TestEqual(TEXT("FlushAndWait[1-FINAL] progress marker should match"), ProgressMarker, (int64)0);
+    TestEqual(TEXT("FlushAndWait[1-FINAL] progress last read len should match"), ProgressLastReadLen, (int)20);
+    TestEqual(TEXT("FlushAndWait[1-FINAL] progress state should match"), ProgressState, ExpectedProgressState);
+    Streamer.Reset();
+
+    // When we resume, it should remember that we have not yet processed the first two lines and generate a payload with the first two lines.
+    // Also, even though we use a different game instance ID in this new streamer, it should still use the old progress state for this first processed payload!!
+    PayloadProcessor->FailProcessing = false;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor2(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer2 = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor2, 16 * 1024, FString(), TEXT("zzzz_yyyy_9876"), nullptr));
+    Streamer2->SetWeakThisPtr(Streamer2);
+    TArray<FString> ExpectedPayloads2;
+    ExpectedPayloads2.Add(FString::Format(TEXT("[{\"app_instance_id\": \"abcd_1234_EFGH\", \"app_instance_index\": {0},\"message\":\"{1}\"},{\"app_instance_id\": \"abcd_1234_EFGH\", \"app_instance_index\": {0},\"message\":\"{2}\"}]"), { TestInstanceIndex, TEXT("Line 1"), TEXT("Line 2") }));
+    TestTrue(TEXT("FlushAndWait[2-1] should succeed"), Streamer2->FlushAndWait(2, true, false, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[2-1] payloads should match"), ITLComparePayloads(this, PayloadProcessor2->Payloads, ExpectedPayloads2));
+    TestFalse(TEXT("FlushAndWait[2-1] should NOT capture everything"), FlushedEverything);
+
+    TArray<uint8> ExpectedProgressState2;
+    Streamer2->GetCommonEventJSON(ExpectedProgressState2);
+    Streamer2->ReadProgressMarker(ProgressMarker, ProgressLastReadLen, ProgressState);
+    TestEqual(TEXT("FlushAndWait[2-1] progress marker should match"), ProgressMarker, (int64)16);
+    TestEqual(TEXT("FlushAndWait[2-1] progress last read len should match"), ProgressLastReadLen, (int)0);
+    TestEqual(TEXT("FlushAndWait[2-1] progress state should match"), ProgressState, ExpectedProgressState2);
+
+    // finish the partial line and make sure it gets captured and nothing else
+    // also, make sure that this now uses the NEW progress state in the generated payload
+    ITLWriteStringToFile(LogWriter, TEXT("Line 3\r\nLine 4\r\nlast line\r\n"));
+    LogWriter->Flush();
+    ExpectedPayloads2.Add(FString::Format(TEXT("[{\"app_instance_id\": \"zzzz_yyyy_9876\", \"app_instance_index\": {0},\"message\":\"{1}\"},{\"app_instance_id\": \"zzzz_yyyy_9876\", \"app_instance_index\": {0},\"message\":\"{2}\"},{\"app_instance_id\": \"zzzz_yyyy_9876\", \"app_instance_index\": {0},\"message\":\"{3}\"}]"), { TestInstanceIndex, TEXT("1234Line 3"), TEXT("Line 4"), TEXT("last line")}));
+    TestTrue(TEXT("FlushAndWait[2-FINAL] should succeed"), Streamer2->FlushAndWait(2, true, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[2-FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor2->Payloads, ExpectedPayloads2));
+    TestTrue(TEXT("FlushAndWait[2-FINAL] should capture everything"), FlushedEverything);
+
+    Streamer2->ReadProgressMarker(ProgressMarker, ProgressLastReadLen, ProgressState);
+    TestEqual(TEXT("FlushAndWait[2-FINAL] progress marker should match"), ProgressMarker, (int64)47);
+    TestEqual(TEXT("FlushAndWait[2-FINAL] progress last read len should match"), ProgressLastReadLen, (int)0);
+    TestEqual(TEXT("FlushAndWait[2-FINAL] progress state should match"), ProgressState, ExpectedProgressState2);
+
+    Streamer2.Reset();
+    return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestCommonMetadataEnvelope, "sparklogs.UnitTests.CommonMetadataEnvelope", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestCommonMetadataEnvelope::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestCommonMetadataEnvelope::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nLine 2\r\n"));
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->ProcessingIntervalSecs = 0.1;
+    Settings->RetryIntervalSecs = 0.1;
+    Settings->IncludeCommonMetadata = false;
+    Settings->AddRandomAppInstanceID = true;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+
+    // Fail the first streamer so that its common event JSON is persisted in the progress state, just like after a crash
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    PayloadProcessor->FailProcessing = true;
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), TEXT("abcd_1234_EFGH"), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+    bool FlushedEverything = false;
+    TestFalse(TEXT("FlushAndWait[1-FINAL] should not succeed because of forced failure to process"), Streamer->FlushAndWait(2, true, true, false, 10.0, FlushedEverything));
+    Streamer.Reset();
+
+    // The resumed streamer retries the restored payload exactly as it was first sent (a plain array) even though the envelope is accepted now,
+    // then uses the envelope with its own common event JSON for new data
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor2(new FsparklogsStoreInMemPayloadProcessor());
+    PayloadProcessor2->AcceptEnvelope = true;
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer2 = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor2, 16 * 1024, FString(), TEXT("zzzz_yyyy_9876"), nullptr));
+    Streamer2->SetWeakThisPtr(Streamer2);
+    TArray<FString> ExpectedPayloads;
+    ExpectedPayloads.Add(FString::Format(TEXT("[{\"app_instance_id\": \"abcd_1234_EFGH\", \"app_instance_index\": {0},\"message\":\"{1}\"},{\"app_instance_id\": \"abcd_1234_EFGH\", \"app_instance_index\": {0},\"message\":\"{2}\"}]"), { TestInstanceIndex, TEXT("Line 1"), TEXT("Line 2") }));
+    TestTrue(TEXT("FlushAndWait[2-1] should succeed"), Streamer2->FlushAndWait(2, true, false, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[2-1] payloads should match"), ITLComparePayloads(this, PayloadProcessor2->Payloads, ExpectedPayloads));
+
+    ITLWriteStringToFile(LogWriter, TEXT("Line 3\r\n"));
+    LogWriter->Flush();
+    ExpectedPayloads.Add(FString::Format(TEXT("{\"common\":{\"app_instance_id\": \"zzzz_yyyy_9876\", \"app_instance_index\": {0}},\"events\":[{\"message\":\"{1}\"}]}"), { TestInstanceIndex, TEXT("Line 3") }));
+    TestTrue(TEXT("FlushAndWait[2-2] should succeed"), Streamer2->FlushAndWait(2, true, false, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[2-2] payloads should match"), ITLComparePayloads(this, PayloadProcessor2->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[2-2] should capture everything"), FlushedEverything);
+
+    // Fail a payload sent in the envelope, then make sure it is retried in the envelope after a restart even though it is no longer accepted
+    ITLWriteStringToFile(LogWriter, TEXT("Line 4\r\n"));
+    LogWriter->Flush();
+    PayloadProcessor2->FailProcessing = true;
+    TestFalse(TEXT("FlushAndWait[2-FINAL] should not succeed because of forced failure to process"), Streamer2->FlushAndWait(2, true, true, false, 10.0, FlushedEverything));
+    Streamer2.Reset();
+
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor3(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer3 = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor3, 16 * 1024, FString(), TEXT("xxxx_wwww_5432"), nullptr));
+    Streamer3->SetWeakThisPtr(Streamer3);
+    TArray<FString> ExpectedPayloads3;
+    ExpectedPayloads3.Add(FString::Format(TEXT("{\"common\":{\"app_instance_id\": \"zzzz_yyyy_9876\", \"app_instance_index\": {0}},\"events\":[{\"message\":\"{1}\"}]}"), { TestInstanceIndex, TEXT("Line 4") }));
+    TestTrue(TEXT("FlushAndWait[3-1] should succeed"), Streamer3->FlushAndWait(2, true, false, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[3-1] payloads should match"), ITLComparePayloads(this, PayloadProcessor3->Payloads, ExpectedPayloads3));
+
+    ITLWriteStringToFile(LogWriter, TEXT("Line 5\r\n"));
+    LogWriter->Flush();
+    ExpectedPayloads3.Add(FString::Format(TEXT("[{\"app_instance_id\": \"xxxx_wwww_5432\", \"app_instance_index\": {0},\"message\":\"{1}\"}]"), { TestInstanceIndex, TEXT("Line 5") }));
+    TestTrue(TEXT("FlushAndWait[3-FINAL] should succeed"), Streamer3->FlushAndWait(2, true, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[3-FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor3->Payloads, ExpectedPayloads3));
+    TestTrue(TEXT("FlushAndWait[3-FINAL] should capture everything"), FlushedEverything);
+
+    Streamer3.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestLogRingCapture, "sparklogs.UnitTests.LogRingCapture", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestLogRingCapture::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    constexpr int NumThreads = 6;
+    constexpr int MessagesPerThread = 2000;
+    {
+        FsparklogsOutputDeviceFile Device(*TestLogFile, nullptr);
+        // Use the smallest ring so that producers regularly wrap around and fill it up
+        TestTrue(TEXT("Ring capture should start"), Device.StartRingCapture(FsparklogsSettings::MinLogCaptureRingBytes));
+        const FName Category(TEXT("LogSparkLogsRingTest"));
+        ParallelFor(NumThreads, [&Device, &Category](int32 ThreadIndex)
+            {
+                for (int i = 0; i < MessagesPerThread; i++)
+                {
+                    // Some messages are too large to queue and must still be written in order
+                    int PadLen = (i % 500 == 0) ? 9000 : ((i * 37) % 200);
+                    FString Message = FString::Printf(TEXT("<T%d:M%d>"), ThreadIndex, i) + FString::ChrN(PadLen, TEXT('x'));
+                    Device.Serialize(*Message, ELogVerbosity::Log, Category, -1.0);
+                }
+            });
+        Device.Flush();
+        Device.TearDown();
+    }
+
+    FString Contents;
+    TestTrue(TEXT("Log file should be readable"), FFileHelper::LoadFileToString(Contents, *TestLogFile));
+    for (int ThreadIndex = 0; ThreadIndex < NumThreads; ThreadIndex++)
+    {
+        int SearchFrom = 0;
+        for (int i = 0; i < MessagesPerThread; i++)
+        {
+            FString Marker = FString::Printf(TEXT("<T%d:M%d>"), ThreadIndex, i);
+            int Found = Contents.Find(Marker, ESearchCase::CaseSensitive, ESearchDir::FromStart, SearchFrom);
+            if (Found == INDEX_NONE)
+            {
+                AddError(FString::Printf(TEXT("Message %s is missing or out of order"), *Marker));
+                return false;
+            }
+            SearchFrom = Found + Marker.Len();
+        }
+    }
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestLogRingThreadExit, "sparklogs.UnitTests.LogRingThreadExit", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestLogRingThreadExit::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    constexpr int NumThreads = 4;
+    {
+        FsparklogsOutputDeviceFile Device(*TestLogFile, nullptr);
+        TestTrue(TEXT("Ring capture should start"), Device.StartRingCapture(FsparklogsSettings::MinLogCaptureRingBytes));
+        const FName Category(TEXT("LogSparkLogsRingTest"));
+        TArray<TFuture<void>> Threads;
+        for (int ThreadIndex = 0; ThreadIndex < NumThreads; ThreadIndex++)
+        {
+            // Each runs on its own thread that exits right after logging
+            Threads.Add(Async(EAsyncExecution::Thread, [&Device, &Category, ThreadIndex]()
+                {
+                    Device.Serialize(*FString::Printf(TEXT("<EXITED%d>"), ThreadIndex), ELogVerbosity::Log, Category, -1.0);
+                }));
+        }
+        for (TFuture<void>& Thread : Threads)
+        {
+            Thread.Wait();
+        }
+        // The futures complete just before their threads exit
+        const double WaitStartTime = FPlatformTime::Seconds();
+        while (Device.GetNumRings() > 0 && FPlatformTime::Seconds() - WaitStartTime < 10.0)
+        {
+            FPlatformProcess::Sleep(0.05f);
+            Device.DrainRings();
+        }
+        TestEqual(TEXT("Rings of exited threads should be freed"), Device.GetNumRings(), 0);
+        Device.Flush();
+        FString Contents;
+        TestTrue(TEXT("Log file should be readable"), FFileHelper::LoadFileToString(Contents, *TestLogFile));
+        for (int ThreadIndex = 0; ThreadIndex < NumThreads; ThreadIndex++)
+        {
+            TestTrue(TEXT("Messages of exited threads should be written before their ring is freed"), Contents.Contains(FString::Printf(TEXT("<EXITED%d>"), ThreadIndex)));
+        }
+    }
+    return true;
+}
+
+#if ENGINE_MAJOR_VERSION >= 5
+/** Forwards to the real allocator and counts allocations made by the thread that enabled tracking. */
+class FITLCountingMalloc : public FMalloc
+{
+public:
+    explicit FITLCountingMalloc(FMalloc* InInner) : Inner(InInner), Allocations(0) { }
+
+    virtual void* Malloc(SIZE_T Count, uint32 Alignment) override { CountAllocation(); return Inner->Malloc(Count, Alignment); }
+    virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override { CountAllocation(); return Inner->Realloc(Original, Count, Alignment); }
+    virtual void Free(void* Original) override { Inner->Free(Original); }
+    virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return Inner->QuantizeSize(Count, Alignment); }
+    virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+    virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+    virtual const TCHAR* GetDescriptiveName() override { return Inner->GetDescriptiveName(); }
+
+    static thread_local bool TrackThisThread;
+    FMalloc* Inner;
+    std::atomic<int32> Allocations;
+
+protected:
+    void CountAllocation()
+    {
+        if (TrackThisThread)
+        {
+            Allocations.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+thread_local bool FITLCountingMalloc::TrackThisThread = false;
+
+/** Installs the counting allocator on first use. It stays installed and is never freed, because other threads call into it as soon as it is GMalloc. */
+static FITLCountingMalloc& ITLGetCountingMalloc()
+{
+    static FITLCountingMalloc* CountingMalloc = nullptr;
+    if (CountingMalloc == nullptr)
+    {
+        CountingMalloc = new FITLCountingMalloc(GMalloc);
+        GMalloc = CountingMalloc;
+    }
+    return *CountingMalloc;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestFormatLogLineTag, "sparklogs.UnitTests.FormatLogLineTag", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestFormatLogLineTag::RunTest(const FString& Parameters)
+{
+    // Time-independent formats must match the engine's formatter exactly
+    const FName Category(TEXT("LogSparkLogsTagTest"));
+    const ELogTimes::Type Formats[] = { ELogTimes::None, ELogTimes::SinceGStartTime };
+    const ELogVerbosity::Type Verbosities[] = { ELogVerbosity::Log, ELogVerbosity::Warning, ELogVerbosity::Error };
+    TArray<ANSICHAR> Tag;
+    Tag.SetNumUninitialized(NAME_SIZE * 4 + 96);
+    for (ELogTimes::Type Format : Formats)
+    {
+        for (ELogVerbosity::Type Verbosity : Verbosities)
+        {
+            FString Expected = FOutputDeviceHelper::FormatLogLine(Verbosity, Category, nullptr, Format, 12.345);
+            int32 TagLen = ITLFormatLogLineTagUTF8(Tag.GetData(), Verbosity, Category, Format, 12.345);
+            TestEqual(TEXT("Tag should match the engine formatter"), ITLConvertUTF8(Tag.GetData(), TagLen), Expected);
+        }
+    }
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestSerializeWithoutAllocating, "sparklogs.UnitTests.SerializeWithoutAllocating", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestSerializeWithoutAllocating::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    constexpr int NumMessages = 500;
+    TArray<FString> Messages;
+    for (int i = 0; i < NumMessages; i++)
+    {
+        Messages.Add(FString::Printf(TEXT("\r\nline <%d> caf\u00E9\r\nsecond line %s\n"), i, *FString::ChrN(i % 300, TEXT('x'))));
+    }
+    const FName Category(TEXT("LogSparkLogsAllocTest"));
+    int32 Allocations = 0;
+    {
+        FsparklogsOutputDeviceFile Device(*TestLogFile, nullptr);
+        // Warm up the writer and this thread's scratch buffer with the largest message
+        for (int i = 0; i < 10; i++)
+        {
+            Device.Serialize(*Messages.Last(), ELogVerbosity::Warning, Category, -1.0);
+        }
+        Device.Flush();
+
+        // Only allocations made by this thread are counted
+        FITLCountingMalloc& CountingMalloc = ITLGetCountingMalloc();
+        CountingMalloc.Allocations.store(0);
+        FITLCountingMalloc::TrackThisThread = true;
+        for (int i = 0; i < NumMessages; i++)
+        {
+            Device.Serialize(*Messages[i], (i % 2) ? ELogVerbosity::Log : ELogVerbosity::Display, Category, -1.0);
+        }
+        FITLCountingMalloc::TrackThisThread = false;
+        Allocations = CountingMalloc.Allocations.load();
+
+        Device.Flush();
+        Device.TearDown();
+    }
+    TestEqual(TEXT("Serializing a log line should not allocate"), Allocations, 0);
+
+    FString Contents;
+    TestTrue(TEXT("Log file should be readable"), FFileHelper::LoadFileToString(Contents, *TestLogFile));
+    TestTrue(TEXT("Log lines should have explicit severity"), Contents.Contains(TEXT("\x16\"severity\": \"Info\"\x17"), ESearchCase::CaseSensitive));
+    FString Expected = FString::Printf(TEXT("%s: line <1> caf\u00E9\x1Esecond line x\r\n"), *Category.ToString());
+    TestTrue(TEXT("Log line should be transformed to a single trimmed line"), Contents.Contains(Expected, ESearchCase::CaseSensitive));
+    return true;
+}
+#endif
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestLZ4FrameRoundTrip, "sparklogs.UnitTests.LZ4FrameRoundTrip", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestLZ4FrameRoundTrip::RunTest(const FString& Parameters)
+{
+    // Spans several blocks, with both compressible and incompressible blocks so that later blocks reference history from earlier ones
+    TArray<uint8> Original;
+    uint32 Seed = 12345;
+    for (int i = 0; i < 5 * FITLLZ4FrameCompressor::BlockSize + 1234; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        bool Incompressible = ((i / FITLLZ4FrameCompressor::BlockSize) % 3) == 1;
+        Original.Add(Incompressible ? (uint8)(Seed >> 16) : (uint8)("{\"message\":\"abc\"},"[(Seed >> 16) % 18]));
+    }
+
+    TArray<uint8> Compressed, Decompressed;
+    TestTrue(TEXT("LZ4 frame compression should succeed"), ITLCompressData(ITLCompressionMode::LZ4Frame, Original.GetData(), Original.Num(), Compressed));
+    TestTrue(TEXT("LZ4 frame should be smaller than original"), Compressed.Num() < Original.Num());
+    TestTrue(TEXT("LZ4 frame decompression should succeed"), ITLDecompressData(ITLCompressionMode::LZ4Frame, Compressed.GetData(), Compressed.Num(), Original.Num(), Decompressed));
+    TestTrue(TEXT("LZ4 frame should round trip"), Decompressed == Original);
+
+    // Compress incrementally through a staging buffer that is overwritten after each block, reusing the compressor for a second frame
+    FITLLZ4FrameCompressor Compressor;
+    for (int Frame = 0; Frame < 2; Frame++)
+    {
+        Compressor.BeginFrame(Compressed);
+        TArray<uint8> Staging;
+        for (int Offset = 0; Offset < Original.Num(); Offset += FITLLZ4FrameCompressor::BlockSize)
+        {
+            int Len = FMath::Min(FITLLZ4FrameCompressor::BlockSize, Original.Num() - Offset);
+            Staging.Reset();
+            Staging.Append(Original.GetData() + Offset, Len);
+            TestTrue(TEXT("LZ4 frame block compression should succeed"), Compressor.CompressBlock(Staging.GetData(), Staging.Num(), Compressed));
+            FMemory::Memzero(Staging.GetData(), Staging.Num());
+        }
+        Compressor.EndFrame(Compressed);
+        TestEqual(TEXT("LZ4 frame input len should match"), Compressor.GetFrameInputLen(), (int64)Original.Num());
+        TestTrue(TEXT("Incremental LZ4 frame decompression should succeed"), ITLDecompressData(ITLCompressionMode::LZ4Frame, Compressed.GetData(), Compressed.Num(), Original.Num(), Decompressed));
+        TestTrue(TEXT("Incremental LZ4 frame should round trip"), Decompressed == Original);
+    }
+
+    // Empty frame
+    TestTrue(TEXT("Empty LZ4 frame compression should succeed"), ITLCompressData(ITLCompressionMode::LZ4Frame, nullptr, 0, Compressed));
+    TestTrue(TEXT("Empty LZ4 frame decompression should succeed"), ITLDecompressData(ITLCompressionMode::LZ4Frame, Compressed.GetData(), Compressed.Num(), 0, Decompressed));
+    TestEqual(TEXT("Empty LZ4 frame should decompress to nothing"), Decompressed.Num(), 0);
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestGzipReuseContext, "sparklogs.UnitTests.GzipReuseContext", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestGzipReuseContext::RunTest(const FString& Parameters)
+{
+    TArray<uint8> Original;
+    for (int i = 0; i < 200000; i++)
+    {
+        Original.Add((uint8)("{\"message\":\"LogTemp: Display: hello\"},"[i % 38]));
+    }
+    // The same context must produce identical, independently decodable output every time it is reused
+    FITLGzipCompressor Compressor;
+    TArray<uint8> FirstCompressed, Compressed, Decompressed;
+    TestTrue(TEXT("gzip compression should succeed"), Compressor.Compress(Original.GetData(), Original.Num(), FirstCompressed));
+    TestTrue(TEXT("gzip should be smaller than original"), FirstCompressed.Num() < Original.Num());
+    for (int Iteration = 0; Iteration < 3; Iteration++)
+    {
+        TestTrue(TEXT("gzip compression with reused context should succeed"), Compressor.Compress(Original.GetData(), Original.Num(), Compressed));
+        TestTrue(TEXT("gzip compression with reused context should match"), Compressed == FirstCompressed);
+    }
+    TestTrue(TEXT("gzip decompression should succeed"), ITLDecompressData(ITLCompressionMode::Gzip, Compressed.GetData(), Compressed.Num(), Original.Num(), Decompressed));
+    TestTrue(TEXT("gzip should round trip"), Decompressed == Original);
+    TestTrue(TEXT("gzip empty compression should succeed"), Compressor.Compress(nullptr, 0, Compressed));
+    TestTrue(TEXT("gzip empty decompression should succeed"), ITLDecompressData(ITLCompressionMode::Gzip, Compressed.GetData(), Compressed.Num(), 0, Decompressed));
+    TestEqual(TEXT("gzip empty should decompress to nothing"), Decompressed.Num(), 0);
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestPayloadKernelBenchmark, "sparklogs.UnitTests.PayloadKernelBenchmark", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestPayloadKernelBenchmark::RunTest(const FString& Parameters)
+{
+    // Correctness: every byte value at every position around the vector block boundaries must match the reference implementation
+    TArray<uint8> Edge;
+    for (int Len = 0; Len <= 80; Len++)
+    {
+        for (int Special = 0; Special < 256; Special += 3)
+        {
+            Edge.Reset();
+            for (int i = 0; i < Len; i++)
+            {
+                Edge.Add((uint8)('a' + (i % 26)));
+            }
+            if (Len > 0)
+            {
+                Edge[(Special * 7) % Len] = (uint8)Special;
+            }
+            TITLJSONStringBuilder Expected, Actual;
+            ITLAppendUTF8AsEscapedJsonStringScalar(Expected, (const ANSICHAR*)Edge.GetData(), Edge.Num());
+            ITLAppendUTF8AsEscapedJsonString(Actual, (const ANSICHAR*)Edge.GetData(), Edge.Num());
+            if (Expected.GetArray() != Actual.GetArray())
+            {
+                AddError(FString::Printf(TEXT("Escaped JSON mismatch: len=%d special=%d expected=%s actual=%s"), Len, Special, *ITLConvertUTF8(Expected.GetData(), Expected.Len()), *ITLConvertUTF8(Actual.GetData(), Actual.Len())));
+                return false;
+            }
+            int ExpectedIndex = 0, ActualIndex = 0;
+            bool ExpectedFound = ITLFindFirstByteScalar(Edge.GetData(), (uint8)Special, Edge.Num(), ExpectedIndex);
+            bool ActualFound = ITLFindFirstByte(Edge.GetData(), (uint8)Special, Edge.Num(), ActualIndex);
+            if (ExpectedFound != ActualFound || ExpectedIndex != ActualIndex)
+            {
+                AddError(FString::Printf(TEXT("FindFirstByte mismatch: len=%d needle=%d expected=%d actual=%d"), Len, Special, ExpectedIndex, ActualIndex));
+                return false;
+            }
+        }
+    }
+
+    // Benchmark: a full payload worth of typical log lines
+    const char* SampleLines[] = {
+        "[2025.01.01-12.00.00:000][  0]LogInit: Display: Running engine for game: MyGame with a fairly typical amount of text",
+        "[2025.01.01-12.00.01:000][  1]LogNet: Warning: Connection \"127.0.0.1:7777\" timed out after 30.00 seconds\tretrying",
+        "[2025.01.01-12.00.02:000][  2]LogTemp: Path C:\\Games\\MyGame\\Saved\\Logs with UTF-8 text \xC3\xA9\xC3\xA8 \xE2\x9C\x93 done",
+    };
+    constexpr int BenchmarkBytes = 4 * 1024 * 1024;
+    TArray<uint8> Data;
+    Data.Reserve(BenchmarkBytes + 256);
+    for (int i = 0; Data.Num() < BenchmarkBytes; i++)
+    {
+        const char* Line = SampleLines[i % UE_ARRAY_COUNT(SampleLines)];
+        Data.Append((const uint8*)Line, FCStringAnsi::Strlen(Line));
+        Data.Add('\n');
+    }
+
+    auto BuildPayload = [&Data](TITLJSONStringBuilder& Builder, bool UseScalar)
+    {
+        Builder.Reset();
+        int Offset = 0;
+        while (Offset < Data.Num())
+        {
+            int FoundIndex = 0;
+            bool HaveLine = UseScalar
+                ? ITLFindFirstByteScalar(Data.GetData() + Offset, '\n', Data.Num() - Offset, FoundIndex)
+                : ITLFindFirstByte(Data.GetData() + Offset, '\n', Data.Num() - Offset, FoundIndex);
+            if (!HaveLine)
+            {
+                break;
+            }
+            if (UseScalar)
+            {
+                ITLAppendUTF8AsEscapedJsonStringScalar(Builder, (const ANSICHAR*)Data.GetData() + Offset, FoundIndex);
+            }
+            else
+            {
+                ITLAppendUTF8AsEscapedJsonString(Builder, (const ANSICHAR*)Data.GetData() + Offset, FoundIndex);
+            }
+            Offset += FoundIndex + 1;
+        }
+    };
+
+    constexpr int Iterations = 5;
+    TITLJSONStringBuilder ScalarPayload, VectorPayload;
+    double ScalarSecs = 0.0, VectorSecs = 0.0;
+    for (int i = 0; i < Iterations; i++)
+    {
+        double Start = FPlatformTime::Seconds();
+        BuildPayload(ScalarPayload, true);
+        double Mid = FPlatformTime::Seconds();
+        BuildPayload(VectorPayload, false);
+        double End = FPlatformTime::Seconds();
+        ScalarSecs += Mid - Start;
+        VectorSecs += End - Mid;
+    }
+    TestEqual(TEXT("Vectorized payload length should match the reference"), VectorPayload.Len(), ScalarPayload.Len());
+    TestTrue(TEXT("Vectorized payload should match the reference"), ScalarPayload.GetArray() == VectorPayload.GetArray());
+
+    // Only reported, since timings on a loaded build machine would make the test flaky
+    double TotalMB = (double)Data.Num() * Iterations / (1024.0 * 1024.0);
+    AddInfo(FString::Printf(TEXT("Payload kernel benchmark: kernel=%s, scalar=%.1lf MB/s, vectorized=%.1lf MB/s, speedup=%.2lfx"),
+        ITLGetPayloadKernelName(), TotalMB / ScalarSecs, TotalMB / VectorSecs, ScalarSecs / VectorSecs));
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestProgressJournal, "sparklogs.UnitTests.ProgressJournal", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestProgressJournal::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString JournalPath = FPaths::Combine(TempDir.GetTempDir(), TEXT("progress.journal"));
+
+    int64 Marker = 0;
+    int LastReadLen = 0;
+    TArray<uint8> State;
+    TArray<int> FollowingReadLens;
+    TArray<uint8> State1 = { 1, 2, 3, 4 };
+    TArray<int> Following1 = { 10, 20 };
+    int64 SlotSize = 0;
+    {
+        FsparklogsProgressJournal Journal(JournalPath);
+        TestFalse(TEXT("A new journal should have no record"), Journal.Read(Marker, LastReadLen, State, FollowingReadLens));
+        TestEqual(TEXT("A new journal should have no slots"), Journal.GetSlotSize(), (int64)0);
+        TestTrue(TEXT("Write should succeed"), Journal.Write(100, 0, &State1, nullptr));
+        TestTrue(TEXT("Write should succeed"), Journal.Write(150, 50, nullptr, &Following1));
+    }
+    {
+        FsparklogsProgressJournal Journal(JournalPath);
+        TestTrue(TEXT("A reopened journal should have a record"), Journal.Read(Marker, LastReadLen, State, FollowingReadLens));
+        TestEqual(TEXT("Latest marker should be read"), Marker, (int64)150);
+        TestEqual(TEXT("Latest read len should be read"), LastReadLen, 50);
+        TestTrue(TEXT("A null state should keep the previous state"), State == State1);
+        TestTrue(TEXT("Following read lens should be read"), FollowingReadLens == Following1);
+        TestTrue(TEXT("Write should succeed"), Journal.Write(200, 0, nullptr, &Following1));
+        SlotSize = Journal.GetSlotSize();
+        Journal.Close();
+    }
+    TestTrue(TEXT("Slots should be sized for the state"), SlotSize >= FsparklogsProgressJournal::RecordSize + State1.Num() && SlotSize <= FsparklogsProgressJournal::SlotAlignment);
+
+    // Tear the latest record (sequence 3, slot 1) and make sure the previous record is used instead
+    TArray<uint8> Contents;
+    TestTrue(TEXT("Journal should be readable"), FFileHelper::LoadFileToArray(Contents, *JournalPath));
+    TestEqual(TEXT("Journal should hold both slots"), (int64)Contents.Num(), 2 * SlotSize);
+    Contents[SlotSize + 20] ^= 0xFF;
+    TestTrue(TEXT("Journal should be writable"), FFileHelper::SaveArrayToFile(Contents, *JournalPath));
+    {
+        FsparklogsProgressJournal Journal(JournalPath);
+        TestTrue(TEXT("A torn journal should still have a record"), Journal.Read(Marker, LastReadLen, State, FollowingReadLens));
+        TestEqual(TEXT("Previous marker should be read"), Marker, (int64)150);
+        TestEqual(TEXT("Previous read len should be read"), LastReadLen, 50);
+        TestTrue(TEXT("Previous state should be read"), State == State1);
+
+        // A larger state grows the slots
+        TArray<uint8> LargeState;
+        LargeState.SetNumUninitialized(3000);
+        for (int i = 0; i < LargeState.Num(); i++)
+        {
+            LargeState[i] = (uint8)i;
+        }
+        TestTrue(TEXT("Write of a larger state should succeed"), Journal.Write(300, 0, &LargeState, nullptr));
+        TestTrue(TEXT("Slots should grow for a larger state"), Journal.GetSlotSize() >= FsparklogsProgressJournal::RecordSize + LargeState.Num());
+        TestTrue(TEXT("Write after growing should succeed"), Journal.Write(400, 0, nullptr, nullptr));
+        SlotSize = Journal.GetSlotSize();
+        Journal.Close();
+        FsparklogsProgressJournal Reopened(JournalPath);
+        TestTrue(TEXT("A grown journal should have a record"), Reopened.Read(Marker, LastReadLen, State, FollowingReadLens));
+        TestEqual(TEXT("Latest marker should be read after growing"), Marker, (int64)400);
+        TestTrue(TEXT("Larger state should be read"), State == LargeState);
+        TestEqual(TEXT("Grown journal slot size should be read back"), Reopened.GetSlotSize(), SlotSize);
+
+        // The payload format of the requests to retry is only kept along with their read lengths
+        bool RetryIsEnvelope = false;
+        TestTrue(TEXT("Write with the envelope format should succeed"), Reopened.Write(500, 60, nullptr, &Following1, true));
+        Reopened.Close();
+        FsparklogsProgressJournal Reopened2(JournalPath);
+        TestTrue(TEXT("A journal with the envelope format should have a record"), Reopened2.Read(Marker, LastReadLen, State, FollowingReadLens, RetryIsEnvelope));
+        TestTrue(TEXT("The envelope format of the requests to retry should be read"), RetryIsEnvelope);
+        TestTrue(TEXT("Write without a request to retry should succeed"), Reopened2.Write(600, 0, nullptr, nullptr, true));
+        TestTrue(TEXT("A journal without a request to retry should have a record"), Reopened2.Read(Marker, LastReadLen, State, FollowingReadLens, RetryIsEnvelope));
+        TestFalse(TEXT("The envelope format should not be kept without a request to retry"), RetryIsEnvelope);
+    }
+
+    // A crash while a resized journal is moved into place leaves the newest record only in the temporary file
+    const FString TempJournalPath = JournalPath + TEXT(".tmp");
+    TestTrue(TEXT("Journal should be copied"), IFileManager::Get().Copy(*TempJournalPath, *JournalPath) == COPY_OK);
+    TestTrue(TEXT("Journal should be deleted"), IFileManager::Get().Delete(*JournalPath));
+    {
+        FsparklogsProgressJournal Journal(JournalPath);
+        TestTrue(TEXT("An interrupted resize should be recovered"), Journal.Read(Marker, LastReadLen, State, FollowingReadLens));
+        TestEqual(TEXT("Latest marker should be recovered"), Marker, (int64)600);
+        TestEqual(TEXT("Recovered slot size should be read back"), Journal.GetSlotSize(), SlotSize);
+        TestTrue(TEXT("Recovered journal should be moved into place"), IFileManager::Get().FileExists(*JournalPath) && !IFileManager::Get().FileExists(*TempJournalPath));
+        TestTrue(TEXT("Write after recovery should succeed"), Journal.Write(700, 0, nullptr, nullptr));
+    }
+    // A temporary file older than the journal is left over from a resize that did not finish writing it
+    TestTrue(TEXT("Stale temporary journal should be written"), FFileHelper::SaveStringToFile(TEXT("stale"), *TempJournalPath));
+    {
+        FsparklogsProgressJournal Journal(JournalPath);
+        TestTrue(TEXT("Journal should have a record"), Journal.Read(Marker, LastReadLen, State, FollowingReadLens));
+        TestEqual(TEXT("Marker should not come from a stale temporary journal"), Marker, (int64)700);
+        TestFalse(TEXT("Stale temporary journal should be deleted"), IFileManager::Get().FileExists(*TempJournalPath));
+    }
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestProgressJournalMigration, "sparklogs.UnitTests.ProgressJournalMigration", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestProgressJournalMigration::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString StateIni = ITLGetIndexedStateFileINI(TestInstanceIndex);
+    FString JournalPath = ITLGetProgressJournalPath(StateIni);
+    if (JournalPath.IsEmpty())
+    {
+        AddInfo(TEXT("Progress is kept in the game user settings on this platform, nothing to migrate"));
+        return true;
+    }
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+    FString Contents = FString::ChrN(199, TEXT('x')) + TEXT("\n");
+    FFileHelper::SaveStringToFile(Contents, *TestLogFile);
+
+    // Progress left behind by an older version of the plugin, everything in the log was already shipped
+    GConfig->SetString(ITL_CONFIG_SECTION_NAME, FsparklogsReadAndStreamToCloud::ProgressMarkerValue, TEXT("200"), StateIni);
+    GConfig->Flush(false, StateIni);
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->ProcessingIntervalSecs = 1000.0;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+
+    int64 ProgressMarker = 0;
+    int ProgressLastReadLen = 0;
+    TArray<uint8> ProgressState;
+    TestTrue(TEXT("ReadProgressMarker should succeed"), Streamer->ReadProgressMarker(ProgressMarker, ProgressLastReadLen, ProgressState));
+    TestEqual(TEXT("Migrated progress marker should match"), ProgressMarker, (int64)200);
+    TestEqual(TEXT("Migrated last read len should match"), ProgressLastReadLen, 0);
+    Streamer.Reset();
+
+    FString LegacyValue;
+    TestFalse(TEXT("The INI progress marker should be removed after migration"), GConfig->GetString(ITL_CONFIG_SECTION_NAME, FsparklogsReadAndStreamToCloud::ProgressMarkerValue, LegacyValue, StateIni));
+    TestTrue(TEXT("The journal should exist after migration"), IFileManager::Get().FileExists(*JournalPath));
+    {
+        FsparklogsProgressJournal Journal(JournalPath);
+        TArray<int> FollowingReadLens;
+        TestTrue(TEXT("The journal should hold the migrated progress"), Journal.Read(ProgressMarker, ProgressLastReadLen, ProgressState, FollowingReadLens));
+        TestEqual(TEXT("Journal progress marker should match"), ProgressMarker, (int64)200);
+    }
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestAnalyticsStateWriteBehind, "sparklogs.UnitTests.AnalyticsStateWriteBehind", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestAnalyticsStateWriteBehind::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString StateIni = ITLGetIndexedStateFileINI(TestInstanceIndex);
+    constexpr const TCHAR* AttemptKey = TEXT("AnalyticsAttemptNumber_level1");
+    constexpr const TCHAR* TransactionKey = TEXT("AnalyticsTransactionNumber");
+    int Value = 0;
+    FString Str;
+    {
+        FsparklogsSettings Settings(TestInstanceIndex);
+        TestEqual(TEXT("First attempt"), Settings.GetAttemptNumber(TEXT("Level1"), true, false), 1);
+        TestEqual(TEXT("Second attempt"), Settings.GetAttemptNumber(TEXT("Level1"), true, false), 2);
+        TestEqual(TEXT("Third attempt"), Settings.GetAttemptNumber(TEXT("Level1"), true, false), 3);
+        TestTrue(TEXT("Attempt numbers should be written right away"), GConfig->GetInt(ITL_CONFIG_SECTION_NAME, AttemptKey, Value, StateIni) && Value == 3);
+        TestEqual(TEXT("First transaction"), Settings.GetTransactionNumber(false), 1);
+        TestTrue(TEXT("Transaction numbers should be reserved right away"), GConfig->GetInt(ITL_CONFIG_SECTION_NAME, TransactionKey, Value, StateIni) && Value == FsparklogsSettings::AnalyticsTransactionNumbersReserved);
+        TestFalse(TEXT("Nothing should be held in memory yet"), Settings.HasPendingAnalyticsState());
+        for (int i = 2; i <= FsparklogsSettings::AnalyticsTransactionNumbersReserved * 2 + 1; i++)
+        {
+            TestEqual(TEXT("Next transaction"), Settings.GetTransactionNumber(true), i);
+            TestTrue(TEXT("A transaction number should never be returned before it is reserved"), GConfig->GetInt(ITL_CONFIG_SECTION_NAME, TransactionKey, Value, StateIni) && Value >= i);
+        }
+
+        Settings.MarkLastWrittenAnalyticsEvent();
+        TestTrue(TEXT("Changes should be held in memory"), Settings.HasPendingAnalyticsState());
+        TestFalse(TEXT("Last written event should not be written yet"), GConfig->GetString(ITL_CONFIG_SECTION_NAME, FsparklogsSettings::AnalyticsLastWrittenKey, Str, StateIni));
+        Settings.FlushAnalyticsStateIfDue();
+        TestTrue(TEXT("Changes should not be due right away"), Settings.HasPendingAnalyticsState());
+        FPlatformProcess::Sleep((float)FsparklogsSettings::AnalyticsStateFlushIntervalSecs + 0.1f);
+        Settings.FlushAnalyticsStateIfDue();
+        TestFalse(TEXT("Changes should be written once due"), Settings.HasPendingAnalyticsState());
+        TestTrue(TEXT("Last written event should be written once due"), GConfig->GetString(ITL_CONFIG_SECTION_NAME, FsparklogsSettings::AnalyticsLastWrittenKey, Str, StateIni));
+
+        // A pending removal must win over the value still in the INI
+        TestEqual(TEXT("Completed attempt"), Settings.GetAttemptNumber(TEXT("Level1"), true, true), 4);
+        TestEqual(TEXT("Attempt after completion"), Settings.GetAttemptNumber(TEXT("Level1"), false, false), 0);
+        TestEqual(TEXT("Next attempt"), Settings.GetAttemptNumber(TEXT("Level2"), true, false), 1);
+        Settings.MarkStartOfAnalyticsSession(TEXT("session1"), FDateTime::UtcNow());
+        TestFalse(TEXT("Session boundaries should be written right away"), Settings.HasPendingAnalyticsState());
+        Settings.SetAnalyticsFirstPurchased(FDateTime::UtcNow());
+        TestFalse(TEXT("The first purchase should be written right away"), Settings.HasPendingAnalyticsState());
+        TestEqual(TEXT("Attempt before destruction"), Settings.GetAttemptNumber(TEXT("Level3"), true, false), 1);
+    }
+    {
+        FsparklogsSettings Settings(TestInstanceIndex);
+        TestEqual(TEXT("Attempt number should persist"), Settings.GetAttemptNumber(TEXT("Level1"), false, false), 0);
+        TestEqual(TEXT("Attempt number should persist"), Settings.GetAttemptNumber(TEXT("level2"), false, false), 1);
+        TestEqual(TEXT("Transaction number should persist without skipping the released reservation"), Settings.GetTransactionNumber(false), FsparklogsSettings::AnalyticsTransactionNumbersReserved * 2 + 1);
+        FString SessionID;
+        FDateTime SessionStarted;
+        Settings.GetLastAnalyticsSessionStartInfo(SessionID, SessionStarted);
+        TestEqual(TEXT("Session should persist"), SessionID, FString(TEXT("session1")));
+        TestTrue(TEXT("First purchase should persist"), Settings.GetAnalyticsFirstPurchased() != ITLEmptyDateTime);
+        TestEqual(TEXT("Attempt number should persist"), Settings.GetAttemptNumber(TEXT("level3"), false, false), 1);
+    }
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestJSONWriterUTF8, "sparklogs.UnitTests.JSONWriterUTF8", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestJSONWriterUTF8::RunTest(const FString& Parameters)
+{
+    // The typed analytics writers must produce exactly what the engine serializer produces from the equivalent FJsonObject
+    TSharedRef<FJsonObject> Nested(new FJsonObject());
+    Nested->SetBoolField(TEXT("yes"), true);
+    Nested->SetBoolField(TEXT("no"), false);
+    Nested->SetField(TEXT("nothing"), MakeShared<FJsonValueNull>());
+    TArray<TSharedPtr<FJsonValue>> Array;
+    Array.Add(MakeShared<FJsonValueString>(TEXT("")));
+    Array.Add(MakeShared<FJsonValueNumber>(-0.25));
+    Array.Add(MakeShared<FJsonValueObject>(Nested));
+    TSharedRef<FJsonObject> Object(new FJsonObject());
+    Object->SetStringField(TEXT("plain"), TEXT("hello world"));
+    Object->SetStringField(TEXT("escapes"), TEXT("quote\" backslash\\ slash/ \r\n\t\b\f \x01\x16\x17\x1E\x1F end"));
+    Object->SetStringField(TEXT("unicode"), TEXT("caf\u00E9 \u4F60\u597D \U0001F600"));
+    Object->SetStringField(TEXT("key \"quoted\"\n"), TEXT("value"));
+    Object->SetNumberField(TEXT("int"), 42);
+    Object->SetNumberField(TEXT("big"), 9007199254740993.0);
+    Object->SetNumberField(TEXT("fraction"), 0.1);
+    Object->SetNumberField(TEXT("negative"), -1234.5678);
+    Object->SetArrayField(TEXT("array"), Array);
+    Object->SetObjectField(TEXT("nested"), Nested);
+    Object->SetObjectField(TEXT("empty"), MakeShared<FJsonObject>());
+
+    FString ExpectedJSON;
+    TSharedRef<TJsonWriter<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>> JsonWriter = TJsonWriterFactory<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>::Create(&ExpectedJSON);
+    TestTrue(TEXT("Engine serializer should succeed"), FJsonSerializer::Serialize(Object, JsonWriter));
+    JsonWriter->Close();
+
+    TITLJSONStringBuilder Builder;
+    for (int Pass = 0; Pass < 2; Pass++)
+    {
+        // The second pass reuses the builder, which must be reset by the writer
+        FsparklogsJSONWriterUTF8 Writer(Builder);
+        Writer.BeginObject();
+        Writer.WriteJsonObjectFields(*Object);
+        Writer.EndObject();
+        TestEqual(TEXT("Writer output should match the engine serializer"), ITLConvertUTF8(Writer.GetData(), Writer.Len()), ExpectedJSON);
+    }
+
+    // Typed calls must match the generic ones
+    TITLJSONStringBuilder TypedBuilder;
+    FsparklogsJSONWriterUTF8 Typed(TypedBuilder);
+    Typed.BeginObject();
+    Typed.WriteString(TEXT("s"), TEXT("x\ny"));
+    Typed.WriteNumber(TEXT("n"), 3.0);
+    Typed.WriteStringArray(TEXT("parts"), TArray<FString>({ TEXT("a"), TEXT(""), TEXT("b") }), true);
+    Typed.WriteRawValue(TEXT("raw"), "{}", 2);
+    Typed.EndObject();
+    TestEqual(TEXT("Typed writes should be condensed JSON"), ITLConvertUTF8(Typed.GetData(), Typed.Len()), FString(TEXT("{\"s\":\"x\\ny\",\"n\":3,\"parts\":[\"a\",\"b\"],\"raw\":{}}")));
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestAnalyticsStateSnapshot, "sparklogs.UnitTests.AnalyticsStateSnapshot", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestAnalyticsStateSnapshot::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    FsparklogsAnalyticsProvider Provider(Settings);
+    const int32 BaseCount = Provider.GetDefaultEventAttributeCount();
+    TestTrue(TEXT("Default meta attributes should be published"), BaseCount > 0);
+
+    Provider.SetUserTags(TArray<FString>({ TEXT("vip"), TEXT("beta") }));
+    TArray<FString> Tags = Provider.GetUserTags();
+    TestTrue(TEXT("User tags should be published sorted"), Tags.Num() == 2 && Tags[0] == TEXT("beta") && Tags[1] == TEXT("vip"));
+    Provider.SetSessionNumber(7);
+    TestEqual(TEXT("Session number should be published"), Provider.GetSessionNumber(), 7);
+
+    // Readers always see a complete snapshot while meta attributes change underneath them
+    constexpr int NumWrites = 200;
+    std::atomic<bool> WentBackwards(false);
+    ParallelFor(5, [&](int32 Index)
+        {
+            if (Index == 0)
+            {
+                for (int i = 0; i < NumWrites; i++)
+                {
+                    Provider.SetMetaAttribute(FString::Printf(TEXT("snapshot_test_%d"), i), MakeShared<FJsonValueString>(TEXT("x")));
+                }
+                return;
+            }
+            int32 LastCount = 0;
+            for (int i = 0; i < 2000; i++)
+            {
+                const int32 Count = Provider.GetDefaultEventAttributesSafe().Num();
+                if (Count < LastCount)
+                {
+                    WentBackwards.store(true);
+                }
+                LastCount = Count;
+            }
+        });
+    TestFalse(TEXT("Readers should never observe an older snapshot after a newer one"), WentBackwards.load());
+    TestEqual(TEXT("Every meta attribute change should be published"), Provider.GetDefaultEventAttributeCount(), BaseCount + NumWrites);
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestAnalyticsBatch, "sparklogs.UnitTests.AnalyticsBatch", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestAnalyticsBatch::RunTest(const FString& Parameters)
+{
+    // Nested batches join the outermost one
+    TestNull(TEXT("No batch should be active"), FsparklogsAnalyticsBatch::GetActive());
+    {
+        FsparklogsAnalyticsBatch Outer;
+        TestTrue(TEXT("Outer batch should be active"), FsparklogsAnalyticsBatch::GetActive() == &Outer);
+        {
+            FsparklogsAnalyticsBatch Inner;
+            TestFalse(TEXT("Inner batch should join the outer batch"), Inner.IsOutermost());
+            TestTrue(TEXT("Outer batch should stay active"), FsparklogsAnalyticsBatch::GetActive() == &Outer);
+        }
+        TestTrue(TEXT("Outer batch should still be active"), FsparklogsAnalyticsBatch::GetActive() == &Outer);
+    }
+    TestNull(TEXT("No batch should be active after the scope"), FsparklogsAnalyticsBatch::GetActive());
+
+    // A batched write produces exactly what writing the events one at a time does
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString SingleLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-single-%d.log"), TestInstanceIndex));
+    FString BatchLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-batch-%d.log"), TestInstanceIndex));
+    const TCHAR* EventsJSON[] = { TEXT("\"a\":1"), TEXT("\"b\":\"caf\u00e9\""), TEXT("") };
+    const TCHAR* EventsMessage[] = { TEXT("first"), TEXT("second\nline"), TEXT("") };
+    TITLJSONStringBuilder BatchJSON;
+    TArray<int32> BatchJSONEnds;
+    TArray<TCHAR> BatchMessages;
+    TArray<int32> BatchMessageEnds;
+    {
+        FsparklogsOutputDeviceFile Device(*SingleLogFile, nullptr);
+        for (int i = 0; i < UE_ARRAY_COUNT(EventsJSON); i++)
+        {
+            TestTrue(TEXT("Single event should be written"), Device.AddRawEvent(EventsJSON[i], EventsMessage[i]));
+            FTCHARToUTF8 JSONUTF8(EventsJSON[i]);
+            BatchJSON.Append(JSONUTF8.Get(), JSONUTF8.Length());
+            BatchJSONEnds.Add(BatchJSON.Len());
+            BatchMessages.Append(EventsMessage[i], FCString::Strlen(EventsMessage[i]));
+            BatchMessageEnds.Add(BatchMessages.Num());
+        }
+        Device.TearDown();
+    }
+    {
+        FsparklogsOutputDeviceFile Device(*BatchLogFile, nullptr);
+        TestTrue(TEXT("Batch should be written"), Device.AddRawEventsUTF8(BatchJSONEnds.Num(), BatchJSON.GetData(), BatchJSONEnds.GetData(), BatchMessages.GetData(), BatchMessageEnds.GetData()));
+        Device.TearDown();
+    }
+    TArray<uint8> SingleContents;
+    TArray<uint8> BatchContents;
+    TestTrue(TEXT("Single log file should be readable"), FFileHelper::LoadFileToArray(SingleContents, *SingleLogFile));
+    TestTrue(TEXT("Batch log file should be readable"), FFileHelper::LoadFileToArray(BatchContents, *BatchLogFile));
+    TestTrue(TEXT("Batched events should be written"), BatchContents.Num() > 0);
+    TestTrue(TEXT("Batched write should match single writes"), SingleContents == BatchContents);
+    return true;
+}
+
+/** A batch whose events can be thrown away instead of being written to the analytics logfile of the running engine. */
+class FsparklogsDiscardableAnalyticsBatch : public FsparklogsAnalyticsBatch
+{
+public:
+    void Discard() { Reset(); }
+};
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestAnalyticsProviderBatch, "sparklogs.UnitTests.AnalyticsProviderBatch", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestAnalyticsProviderBatch::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->AnalyticsGameID = TEXT("batch-test-game");
+    FsparklogsAnalyticsProvider Provider(Settings);
+    Provider.SetSessionID(TEXT("batch-test-session"));
+    Provider.SetMetaAttribute(TEXT("batch_test"), MakeShared<FJsonValueString>(TEXT("before")));
+    auto GetStampedAttribute = [&Provider]()
+    {
+        TSharedPtr<FJsonObject> Object;
+        Provider.FinalizeAnalyticsEvent(FsparklogsAnalyticsProvider::EventTypeDesign, nullptr, Object);
+        const TSharedPtr<FJsonObject>* Meta = nullptr;
+        if (!Object.IsValid() || !Object->TryGetObjectField(FsparklogsAnalyticsProvider::StandardFieldMeta, Meta))
+        {
+            return FString();
+        }
+        return (*Meta)->GetStringField(TEXT("batch_test"));
+    };
+    TestEqual(TEXT("Event without a batch should be stamped with the latest state"), GetStampedAttribute(), FString(TEXT("before")));
+
+    {
+        FsparklogsDiscardableAnalyticsBatch Batch;
+        TestEqual(TEXT("First event in the batch should be stamped with the latest state"), GetStampedAttribute(), FString(TEXT("before")));
+        Async(EAsyncExecution::Thread, [&Provider]() { Provider.SetMetaAttribute(TEXT("batch_test"), MakeShared<FJsonValueString>(TEXT("other thread"))); }).Wait();
+        TestEqual(TEXT("Changes made by other threads should not split the batch"), GetStampedAttribute(), FString(TEXT("before")));
+        Provider.SetSessionNumber(2);
+        TestEqual(TEXT("Changes made by the batching thread should apply to its later events"), GetStampedAttribute(), FString(TEXT("other thread")));
+        Batch.Discard();
+    }
+    TestEqual(TEXT("Event after the batch should be stamped with the latest state"), GetStampedAttribute(), FString(TEXT("other thread")));
+
+    // A blueprint batch opened while a batch is active joins it, and counts the events recorded since it began
+    {
+        FsparklogsDiscardableAnalyticsBatch Outer;
+        const char* EventJSON = "{\"a\":1}";
+        Outer.Add(EventJSON, FCStringAnsi::Strlen(EventJSON), TEXT("before the blueprint batch"));
+        UsparklogsAnalytics::BeginBatch();
+        TestTrue(TEXT("Blueprint batch should join the active batch"), FsparklogsAnalyticsBatch::GetActive() == &Outer);
+        Outer.Add(EventJSON, FCStringAnsi::Strlen(EventJSON), TEXT("first"));
+        Outer.Add(EventJSON, FCStringAnsi::Strlen(EventJSON), TEXT("second"));
+        TestEqual(TEXT("Joined blueprint batch should count the events recorded since it began"), UsparklogsAnalytics::CommitBatch(), 2);
+        TestTrue(TEXT("Active batch should stay active after the joined blueprint batch commits"), FsparklogsAnalyticsBatch::GetActive() == &Outer);
+        TestEqual(TEXT("Active batch should still hold the events"), Outer.Num(), 3);
+        Outer.Discard();
+    }
+    // A joined batch that ended is not mistaken for a later batch that took its address
+    {
+        TOptional<FsparklogsDiscardableAnalyticsBatch> Outer;
+        Outer.Emplace();
+        const FsparklogsAnalyticsBatch* FirstAddress = Outer.GetPtrOrNull();
+        const char* EventJSON = "{\"a\":1}";
+        Outer->Add(EventJSON, FCStringAnsi::Strlen(EventJSON), TEXT("before the blueprint batch"));
+        UsparklogsAnalytics::BeginBatch();
+        Outer->Discard();
+        Outer.Reset();
+        Outer.Emplace();
+        TestTrue(TEXT("Later batch should reuse the address of the joined batch"), Outer.GetPtrOrNull() == FirstAddress);
+        for (int i = 0; i < 3; i++)
+        {
+            Outer->Add(EventJSON, FCStringAnsi::Strlen(EventJSON), TEXT("later batch"));
+        }
+        TestEqual(TEXT("Joined blueprint batch that ended should not count the events of a later batch"), UsparklogsAnalytics::CommitBatch(), 0);
+        TestEqual(TEXT("Later batch should still hold its events"), Outer->Num(), 3);
+        Outer->Discard();
+    }
+    UsparklogsAnalytics::BeginBatch();
+    TestNotNull(TEXT("Blueprint batch should be active"), FsparklogsAnalyticsBatch::GetActive());
+    TestEqual(TEXT("Empty blueprint batch should write nothing"), UsparklogsAnalytics::CommitBatch(), 0);
+    TestNull(TEXT("No batch should be active after the blueprint batch commits"), FsparklogsAnalyticsBatch::GetActive());
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestTailReader, "sparklogs.UnitTests.TailReader", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestTailReader::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+    IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+    // Large enough that the backlog is mapped (where supported)
+    TArray<uint8> Expected;
+    Expected.SetNumUninitialized((int32)FsparklogsTailReader::MinRemapBytes * 2);
+    for (int32 i = 0; i < Expected.Num(); i++)
+    {
+        Expected[i] = (uint8)('a' + (i % 26));
+    }
+    TestTrue(TEXT("Logfile should be writable"), FFileHelper::SaveArrayToFile(Expected, *TestLogFile));
+
+    TArray<uint8> Buffer;
+    Buffer.SetNumUninitialized(Expected.Num());
+    FsparklogsTailReader Reader(TestLogFile, true);
+    int64 FileSize = 0;
+    TestTrue(TEXT("Reader should open the logfile"), Reader.Refresh(FileSize) == FsparklogsTailReader::EStatus::Ready);
+    TestEqual(TEXT("Reader should see the whole logfile"), FileSize, (int64)Expected.Num());
+    const uint8* Data = Reader.Read(100, 1000, Buffer.GetData());
+    TestTrue(TEXT("Backlog should be read correctly"), Data != nullptr && FMemory::Memcmp(Data, Expected.GetData() + 100, 1000) == 0);
+
+    // Data appended while the file is open is seen without reopening it
+    {
+        TUniquePtr<IFileHandle> Writer(PlatformFile.OpenWrite(*TestLogFile, true, true));
+        TestTrue(TEXT("Logfile should be appendable"), Writer.IsValid());
+        if (Writer.IsValid())
+        {
+            const uint8 More[] = { 'X', 'Y', 'Z' };
+            Writer->Write(More, sizeof(More));
+            Writer->Flush();
+        }
+    }
+    TestTrue(TEXT("Reader should refresh the logfile"), Reader.Refresh(FileSize) == FsparklogsTailReader::EStatus::Ready);
+    TestEqual(TEXT("Reader should see appended data"), FileSize, (int64)Expected.Num() + 3);
+    Data = Reader.Read(Expected.Num(), 3, Buffer.GetData());
+    TestTrue(TEXT("Appended data should be read correctly"), Data != nullptr && FMemory::Memcmp(Data, "XYZ", 3) == 0);
+
+    // Some platforms cannot truncate a mapped file, so follow the replaced file with a reader that never maps it
+    Reader.Close();
+    FsparklogsTailReader HandleReader(TestLogFile, false);
+    TestTrue(TEXT("Handle reader should open the logfile"), HandleReader.Refresh(FileSize) == FsparklogsTailReader::EStatus::Ready);
+    TestTrue(TEXT("Logfile should be replaceable"), FFileHelper::SaveStringToFile(TEXT("new"), *TestLogFile));
+    TestTrue(TEXT("Reader should reopen the logfile"), HandleReader.Refresh(FileSize) == FsparklogsTailReader::EStatus::Ready);
+    TestEqual(TEXT("Reader should see the replaced logfile"), FileSize, (int64)3);
+    Data = HandleReader.Read(0, 3, Buffer.GetData());
+    TestTrue(TEXT("Replaced data should be read correctly"), Data != nullptr && FMemory::Memcmp(Data, "new", 3) == 0);
+    TestFalse(TEXT("Handle reader should never map the logfile"), HandleReader.LastReadWasMapped());
+
+    HandleReader.Close();
+    PlatformFile.DeleteFile(*TestLogFile);
+    TestTrue(TEXT("Reader should report a missing logfile"), HandleReader.Refresh(FileSize) == FsparklogsTailReader::EStatus::Missing);
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestStreamLanes, "sparklogs.UnitTests.StreamLanes", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestStreamLanes::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+    FString TestAnalyticsFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-analytics-%d.log"), TestInstanceIndex));
+    FFileHelper::SaveStringToFile(FString(TEXT("Line 1\r\nLine 2\r\nLine 3\r\nLine 4\r\nLine 5\r\n")), *TestLogFile);
+    FFileHelper::SaveStringToFile(FString(TEXT("Event 1\r\nEvent 2\r\nEvent 3\r\n")), *TestAnalyticsFile);
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = ITLCompressionMode::None;
+    // Far smaller than the settings allow, so that a tiny logfile is already too much of a backlog
+    Settings->MaxLogBacklogBytes = 20;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> LogsProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> AnalyticsProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> LogsStreamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, LogsProcessor, 16 * 1024, FString(), FString(), nullptr));
+    LogsStreamer->SetWeakThisPtr(LogsStreamer);
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> AnalyticsStreamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestAnalyticsFile, Settings, AnalyticsProcessor, 16 * 1024, FString(), FString(), nullptr, ITLStreamLane::Analytics));
+    AnalyticsStreamer->SetWeakThisPtr(AnalyticsStreamer);
+
+    // The logs lane only ships the newest whole lines that fit in the backlog limit
+    TArray<FString> ExpectedLogs;
+    ExpectedLogs.Add(TEXT("[{\"message\":\"Line 4\"},{\"message\":\"Line 5\"}]"));
+    bool FlushedEverything = false;
+    TestTrue(TEXT("Logs lane flush should succeed"), LogsStreamer->FlushAndWait(1, false, false, false, 5.0, FlushedEverything));
+    TestTrue(TEXT("Logs lane payloads should match"), ITLComparePayloads(this, LogsProcessor->Payloads, ExpectedLogs));
+    TestEqual(TEXT("Logs lane should count the dropped bytes"), LogsStreamer->GetDroppedBacklogBytes(), (int64)24);
+
+    // The analytics lane never drops anything
+    TArray<FString> ExpectedEvents;
+    ExpectedEvents.Add(TEXT("[{\"message\":\"Event 1\"},{\"message\":\"Event 2\"},{\"message\":\"Event 3\"}]"));
+    TestTrue(TEXT("Analytics lane flush should succeed"), AnalyticsStreamer->FlushAndWait(1, false, false, false, 5.0, FlushedEverything));
+    TestTrue(TEXT("Analytics lane payloads should match"), ITLComparePayloads(this, AnalyticsProcessor->Payloads, ExpectedEvents));
+    TestEqual(TEXT("Analytics lane should not drop anything"), AnalyticsStreamer->GetDroppedBacklogBytes(), (int64)0);
+
+    // Both lanes share the same instance but keep their own progress
+    int64 ProgressMarker = 0;
+    int LastReadLen = 0;
+    TArray<uint8> IgnoreProgressState;
+    TestTrue(TEXT("Logs lane ReadProgressMarker should succeed"), LogsStreamer->ReadProgressMarker(ProgressMarker, LastReadLen, IgnoreProgressState));
+    TestEqual(TEXT("Logs lane progress marker"), ProgressMarker, (int64)40);
+    TestTrue(TEXT("Analytics lane ReadProgressMarker should succeed"), AnalyticsStreamer->ReadProgressMarker(ProgressMarker, LastReadLen, IgnoreProgressState));
+    TestEqual(TEXT("Analytics lane progress marker"), ProgressMarker, (int64)27);
+
+    TestTrue(TEXT("Logs lane FlushAndWait[FINAL] should succeed"), LogsStreamer->FlushAndWait(1, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("Analytics lane FlushAndWait[FINAL] should succeed"), AnalyticsStreamer->FlushAndWait(1, false, true, false, 10.0, FlushedEverything));
+    LogsStreamer->DeleteProgressMarker();
+    AnalyticsStreamer->DeleteProgressMarker();
+    LogsStreamer.Reset();
+    AnalyticsStreamer.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestParseRetryAfter, "sparklogs.UnitTests.ParseRetryAfter", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestParseRetryAfter::RunTest(const FString& Parameters)
+{
+    TestEqual(TEXT("Missing header"), ITLParseRetryAfterSecs(TEXT("")), 0.0);
+    TestEqual(TEXT("Seconds"), ITLParseRetryAfterSecs(TEXT(" 120 ")), 120.0);
+    TestEqual(TEXT("Invalid value"), ITLParseRetryAfterSecs(TEXT("soon")), 0.0);
+    TestEqual(TEXT("Date in the past"), ITLParseRetryAfterSecs(TEXT("Wed, 21 Oct 2015 07:28:00 GMT")), 0.0);
+    double FutureSecs = ITLParseRetryAfterSecs((FDateTime::UtcNow() + FTimespan::FromSeconds(90.0)).ToHttpDate());
+    TestTrue(TEXT("Date in the future"), FutureSecs > 80.0 && FutureSecs <= 90.0);
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestAdaptiveRequestSizing, "sparklogs.UnitTests.AdaptiveRequestSizing", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestAdaptiveRequestSizing::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+    constexpr int NumLines = 4000;
+    FString LogData;
+    for (int i = 0; i < NumLines; i++)
+    {
+        LogData += FString::Printf(TEXT("Line %05d %s\r\n"), i, *FString::ChrN(90, TEXT('x')));
+    }
+    FFileHelper::SaveStringToFile(LogData, *TestLogFile);
+
+    constexpr int TestBytesPerRequest = 256 * 1024;
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = ITLCompressionMode::None;
+    Settings->BytesPerRequest = TestBytesPerRequest;
+    Settings->MaxInFlightRequests = 1;
+    Settings->CatchUpParallelism = 1;
+    constexpr double TestRetryIntervalSecs = 0.1;
+    Settings->ProcessingIntervalSecs = 0.1;
+    Settings->RetryIntervalSecs = TestRetryIntervalSecs;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+    TestEqual(TEXT("Requests start at the full size"), Streamer->GetAdaptiveBytesPerRequest(), TestBytesPerRequest);
+
+    // Each failure halves the size of new requests down to the minimum, but the retry keeps its original size
+    PayloadProcessor->FailProcessing = true;
+    bool FlushedEverything = false;
+    for (int i = 0; i < 3; i++)
+    {
+        FPlatformProcess::SleepNoStats(TestRetryIntervalSecs * 5);
+        TestFalse(TEXT("FlushAndWait should fail because of failure to process"), Streamer->FlushAndWait(1, true, false, false, TestRetryIntervalSecs * 10, FlushedEverything));
+    }
+    TestEqual(TEXT("Failures should shrink new requests to the minimum"), Streamer->GetAdaptiveBytesPerRequest(), FsparklogsSettings::MinAdaptiveBytesPerRequest);
+    int64 ProgressMarker = 0;
+    int LastReadLen = 0;
+    TArray<uint8> IgnoreProgressState;
+    TestTrue(TEXT("ReadProgressMarker should succeed"), Streamer->ReadProgressMarker(ProgressMarker, LastReadLen, IgnoreProgressState));
+    TestEqual(TEXT("The retry should keep the size of the original request"), LastReadLen, TestBytesPerRequest);
+
+    // Once requests succeed again the retry ships at full size, then new requests start small and grow
+    PayloadProcessor->FailProcessing = false;
+    FPlatformProcess::SleepNoStats(TestRetryIntervalSecs * 5);
+    TestTrue(TEXT("FlushAndWait[retry] should succeed"), Streamer->FlushAndWait(1, true, false, false, TestRetryIntervalSecs * 10, FlushedEverything));
+    TestEqual(TEXT("One payload should be shipped"), PayloadProcessor->Payloads.Num(), 1);
+    TestTrue(TEXT("Success should grow new requests"), Streamer->GetAdaptiveBytesPerRequest() > FsparklogsSettings::MinAdaptiveBytesPerRequest);
+    TestTrue(TEXT("FlushAndWait[next] should succeed"), Streamer->FlushAndWait(1, false, false, false, 5.0, FlushedEverything));
+    TestEqual(TEXT("Two payloads should be shipped"), PayloadProcessor->Payloads.Num(), 2);
+    if (PayloadProcessor->Payloads.Num() == 2)
+    {
+        TestTrue(TEXT("The new request should be smaller than the retried one"), PayloadProcessor->Payloads[1].Len() < PayloadProcessor->Payloads[0].Len() / 2);
+    }
+
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(20, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+    int NumShippedLines = 0;
+    for (const FString& Payload : PayloadProcessor->Payloads)
+    {
+        for (int32 Pos = Payload.Find(TEXT("\"message\"")); Pos != INDEX_NONE; Pos = Payload.Find(TEXT("\"message\""), ESearchCase::CaseSensitive, ESearchDir::FromStart, Pos + 1))
+        {
+            NumShippedLines++;
+        }
+    }
+    TestEqual(TEXT("Every line should ship exactly once"), NumShippedLines, NumLines);
+    Streamer->DeleteProgressMarker();
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestLogSuppression, "sparklogs.UnitTests.LogSuppression", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestLogSuppression::RunTest(const FString& Parameters)
+{
+    FScopedValueSetter<ELogTimes::Type> DoNotPrintTimes(GPrintLogTimes, ELogTimes::None);
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+    const FName TestCategory(TEXT("LogTestSuppression"));
+    const FName StormCategory(TEXT("LogTestStorm"));
+
+    FsparklogsOutputDeviceFile OutputDevice(*TestLogFile, nullptr);
+    OutputDevice.SetLogSuppression(0.0, 1, true);
+    // A burst of 3 lines, then (practically) nothing more
+    OutputDevice.SetCategoryRateLimit(StormCategory, 0.001, 3);
+
+    // Repeats are folded into the first line
+    for (int i = 0; i < 5; i++)
+    {
+        OutputDevice.Serialize(TEXT("same warning"), ELogVerbosity::Warning, TestCategory);
+    }
+    OutputDevice.Serialize(TEXT("different message"), ELogVerbosity::Log, TestCategory);
+    // A line that repeats only once is written as is
+    OutputDevice.Serialize(TEXT("repeated once"), ELogVerbosity::Log, TestCategory);
+    OutputDevice.Serialize(TEXT("repeated once"), ELogVerbosity::Log, TestCategory);
+    OutputDevice.Serialize(TEXT("after single repeat"), ELogVerbosity::Log, TestCategory);
+    // Lines over the rate limit are dropped, even though they differ
+    for (int i = 0; i < 10; i++)
+    {
+        OutputDevice.Serialize(*FString::Printf(TEXT("storm %d"), i), ELogVerbosity::Warning, StormCategory);
+    }
+    // Fatal errors are never dropped
+    OutputDevice.Serialize(TEXT("storm fatal"), ELogVerbosity::Fatal, StormCategory);
+    OutputDevice.Flush();
+    // Flushing never reports a single repeat as a summary, e.g., with -FORCELOGFLUSH
+    OutputDevice.Serialize(TEXT("flushed repeat"), ELogVerbosity::Log, TestCategory);
+    OutputDevice.Serialize(TEXT("flushed repeat"), ELogVerbosity::Log, TestCategory);
+    OutputDevice.Flush();
+    TestEqual(TEXT("Suppressed line count"), OutputDevice.GetNumSuppressedLines(), (int64)(4 + 7));
+    OutputDevice.TearDown();
+
+    FString Contents;
+    TestTrue(TEXT("Logfile should be readable"), FFileHelper::LoadFileToString(Contents, *TestLogFile));
+    TArray<FString> Lines;
+    Contents.ParseIntoArrayLines(Lines);
+    TestEqual(TEXT("Number of lines written"), Lines.Num(), 1 + 1 + 1 + 3 + 3 + 1 + 1 + 2);
+    if (Lines.Num() == 13)
+    {
+        TestTrue(TEXT("First line is the repeated message"), Lines[0].EndsWith(TEXT("same warning")));
+        TestTrue(TEXT("Repeat summary has the count"), Lines[1].Contains(TEXT("\"log_repeat_count\": 4")) && Lines[1].Contains(TEXT("log_repeat_first_timestamp")) && Lines[1].Contains(TEXT("log_repeat_last_timestamp")));
+        TestTrue(TEXT("Repeat summary has the severity of the repeated line"), Lines[1].Contains(TEXT("\"severity\": \"Warning\"")));
+        TestTrue(TEXT("Different message follows the repeat summary"), Lines[2].EndsWith(TEXT("different message")));
+        TestTrue(TEXT("Single repeat is written as is"), Lines[3].EndsWith(TEXT("repeated once")) && Lines[4].EndsWith(TEXT("repeated once")) && Lines[5].EndsWith(TEXT("after single repeat")));
+        TestTrue(TEXT("Burst of storm lines is written"), Lines[6].EndsWith(TEXT("storm 0")) && Lines[8].EndsWith(TEXT("storm 2")));
+        TestTrue(TEXT("Fatal line is written despite the rate limit"), Lines[9].EndsWith(TEXT("storm fatal")));
+        TestTrue(TEXT("Rate limit summary has the count"), Lines[10].Contains(TEXT("\"log_suppressed_count\": 7")) && Lines[10].Contains(TEXT("LogTestStorm")));
+        TestTrue(TEXT("Single repeat is written as is when flushed"), Lines[11].EndsWith(TEXT("flushed repeat")) && Lines[12].EndsWith(TEXT("flushed repeat")));
+    }
+    TestFalse(TEXT("No summary for a single repeat"), Contents.Contains(TEXT("\"log_repeat_count\": 1,")));
+
+    // Consecutive means consecutive within one thread, so a line from another thread does not end a run of repeats
+    FString ThreadLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-threads-%d.log"), TestInstanceIndex));
+    FsparklogsOutputDeviceFile ThreadOutputDevice(*ThreadLogFile, nullptr);
+    ThreadOutputDevice.SetLogSuppression(0.0, 1, true);
+    ThreadOutputDevice.Serialize(TEXT("main thread repeat"), ELogVerbosity::Log, TestCategory);
+    ThreadOutputDevice.Serialize(TEXT("main thread repeat"), ELogVerbosity::Log, TestCategory);
+    Async(EAsyncExecution::Thread, [&ThreadOutputDevice, TestCategory]() { ThreadOutputDevice.Serialize(TEXT("other thread line"), ELogVerbosity::Log, TestCategory); }).Wait();
+    ThreadOutputDevice.Serialize(TEXT("main thread repeat"), ELogVerbosity::Log, TestCategory);
+    ThreadOutputDevice.Flush();
+    ThreadOutputDevice.TearDown();
+    TestTrue(TEXT("Logfile should be readable"), FFileHelper::LoadFileToString(Contents, *ThreadLogFile));
+    Contents.ParseIntoArrayLines(Lines);
+    TestEqual(TEXT("Number of lines written with another thread"), Lines.Num(), 3);
+    if (Lines.Num() == 3)
+    {
+        TestTrue(TEXT("First line is the repeated message"), Lines[0].EndsWith(TEXT("main thread repeat")));
+        TestTrue(TEXT("Line of the other thread is written"), Lines[1].EndsWith(TEXT("other thread line")));
+        TestTrue(TEXT("Repeats on both sides of the other thread's line are counted together"), Lines[2].Contains(TEXT("\"log_repeat_count\": 2")));
+    }
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestShipperStats, "sparklogs.UnitTests.ShipperStats", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestShipperStats::RunTest(const FString& Parameters)
+{
+    FScopedValueSetter<ELogTimes::Type> DoNotPrintTimes(GPrintLogTimes, ELogTimes::None);
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = false;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+
+    FsparklogsShipperStats Stats;
+    Streamer->GetShipperStats(Stats);
+    TestEqual(TEXT("No flushes before the first flush"), Stats.NumFlushes, 0);
+    TestTrue(TEXT("Time since last successful flush is not measured before the first flush"), Stats.SecsSinceLastSuccessfulFlush < 0.0);
+
+    FsparklogsOutputDeviceFile OutputDevice(*TestLogFile, Streamer);
+    OutputDevice.SetSuppressEventTag(false);
+    OutputDevice.Log(TEXT("line 1"));
+    OutputDevice.Log(TEXT("line 2"));
+    OutputDevice.Log(TEXT("line 3"));
+    OutputDevice.Flush();
+    TestEqual(TEXT("Lines written"), OutputDevice.GetNumLinesWritten(), (int64)3);
+    TestTrue(TEXT("Bytes written"), OutputDevice.GetNumBytesWritten() >= (int64)(3 * FCString::Strlen(TEXT("line 1"))));
+    OutputDevice.TearDown();
+
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait should capture everything"), FlushedEverything);
+    Stats = FsparklogsShipperStats();
+    Streamer->GetShipperStats(Stats);
+    OutputDevice.GetShipperStats(Stats);
+    TestEqual(TEXT("Nothing is left in the backlog"), Stats.BacklogBytes, (int64)0);
+    TestTrue(TEXT("Flushes succeeded"), Stats.NumSuccessfulFlushes >= 1 && Stats.NumSuccessfulFlushes <= Stats.NumFlushes);
+    TestFalse(TEXT("Last flush did not fail"), Stats.LastFlushFailed);
+    TestEqual(TEXT("No retries"), Stats.NumRetries, (int64)0);
+    TestEqual(TEXT("No dropped payloads"), Stats.NumDroppedPayloads, (int64)0);
+    TestTrue(TEXT("Time since last successful flush is measured"), Stats.SecsSinceLastSuccessfulFlush >= 0.0);
+    TestTrue(TEXT("Build time is measured"), Stats.LastBuildSecs >= 0.0);
+    TestEqual(TEXT("Lines written are part of the stats"), Stats.LinesWritten, (int64)3);
+
+    Streamer.Reset();
+    return true;
+}
+
+/** An HTTP payload processor whose acknowledgements can be simulated, since tests have no endpoint to send payloads to. */
+class FsparklogsTestHTTPPayloadProcessor : public FsparklogsWriteHTTPPayloadProcessor
+{
+public:
+    FsparklogsTestHTTPPayloadProcessor(const FString& InEndpointURI) : FsparklogsWriteHTTPPayloadProcessor(InEndpointURI, FString(), 5.0, false, FString()) { }
+    void SimulateAck(double RequestStartTime) { ConnectionState->RecordAck(RequestStartTime); }
+};
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestPreWarm, "sparklogs.UnitTests.PreWarm", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestPreWarm::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+    // Nothing listens on this port, so the pre-warm request fails quickly
+    TSharedRef<FsparklogsTestHTTPPayloadProcessor, ESPMode::ThreadSafe> Processor(new FsparklogsTestHTTPPayloadProcessor(TEXT("http://127.0.0.1:1/")));
+    TSharedRef<FsparklogsFanOutPayloadProcessor, ESPMode::ThreadSafe> FanOut(new FsparklogsFanOutPayloadProcessor(Processor));
+    TestTrue(TEXT("First ack latency is not measured before any payload is acknowledged"), Processor->GetFirstAckLatencySecs() < 0.0);
+    TestTrue(TEXT("Pre-warm time is not measured before any pre-warm"), Processor->GetPreWarmSecs() < 0.0);
+
+    // Only the first payload acknowledged since the processor was created is measured
+    Processor->SimulateAck(FPlatformTime::Seconds() - 0.25);
+    const double FirstAckLatencySecs = Processor->GetFirstAckLatencySecs();
+    TestTrue(TEXT("First ack latency is measured"), FirstAckLatencySecs >= 0.25 && FirstAckLatencySecs < 5.0);
+    Processor->SimulateAck(FPlatformTime::Seconds() - 10.0);
+    TestEqual(TEXT("Later acks do not change the first ack latency"), Processor->GetFirstAckLatencySecs(), FirstAckLatencySecs);
+    TestEqual(TEXT("Fan-out processor reports the first ack latency of the primary"), FanOut->GetFirstAckLatencySecs(), FirstAckLatencySecs);
+    {
+        TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+        TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, FanOut, 16 * 1024, FString(), FString(), nullptr));
+        Streamer->SetWeakThisPtr(Streamer);
+        FsparklogsShipperStats Stats;
+        Streamer->GetShipperStats(Stats);
+        TestEqual(TEXT("Shipper stats report the first ack latency"), Stats.FirstAckLatencySecs, FirstAckLatencySecs);
+        TestTrue(TEXT("Shipper stats do not report a pre-warm time before one succeeded"), Stats.PreWarmSecs < 0.0);
+        Streamer.Reset();
+    }
+
+    // Only one pre-warm request is in flight at a time, and each pre-warm (e.g., when the app returns to the foreground) measures the next ack again
+    FanOut->PreWarm();
+    TestTrue(TEXT("Pre-warm request should be in flight"), Processor->IsPreWarmInFlight());
+    FanOut->PreWarm();
+    TestEqual(TEXT("Pre-warming again while a request is in flight sends nothing"), Processor->GetNumPreWarmsSent(), (int64)1);
+    Processor->SimulateAck(FPlatformTime::Seconds() - 1.0);
+    TestTrue(TEXT("First ack after a pre-warm is measured again"), Processor->GetFirstAckLatencySecs() >= 1.0 && Processor->GetFirstAckLatencySecs() < 5.0);
+    const double Deadline = FPlatformTime::Seconds() + 30.0;
+    double LastTime = FPlatformTime::Seconds();
+    while (Processor->IsPreWarmInFlight() && FPlatformTime::Seconds() < Deadline)
+    {
+        const double Now = FPlatformTime::Seconds();
+        ITLTickGameThreadWhileWaiting(Now - LastTime);
+        LastTime = Now;
+        FPlatformProcess::SleepNoStats(0.01f);
+    }
+    TestFalse(TEXT("Pre-warm request should complete"), Processor->IsPreWarmInFlight());
+    TestTrue(TEXT("Failed pre-warm is not reported as a pre-warm time"), Processor->GetPreWarmSecs() < 0.0);
+    FanOut->PreWarm();
+    TestEqual(TEXT("Pre-warming after the request completed sends another one"), Processor->GetNumPreWarmsSent(), (int64)2);
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestStartupPreBuffer, "sparklogs.UnitTests.StartupPreBuffer", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestStartupPreBuffer::RunTest(const FString& Parameters)
+{
+    FScopedValueSetter<ELogTimes::Type> DoNotPrintTimes(GPrintLogTimes, ELogTimes::None);
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+    const FName Category(TEXT("LogSparkLogsPreBufferTest"));
+    {
+        FsparklogsOutputDeviceFile Device(*TestLogFile, nullptr);
+        Device.StartPreBuffer(FsparklogsSettings::DefaultStartupPreBufferBytes);
+        TestTrue(TEXT("Should be pre-buffering"), Device.IsPreBuffering());
+        Device.Serialize(TEXT("<early 1>"), ELogVerbosity::Log, Category, -1.0);
+        Device.Serialize(TEXT("<early 2>"), ELogVerbosity::Warning, Category, -1.0);
+        Device.Serialize(TEXT("<early 3>"), ELogVerbosity::Log, Category, -1.0);
+        TestEqual(TEXT("Nothing is written while pre-buffering"), Device.GetNumLinesWritten(), (int64)0);
+        TestEqual(TEXT("All held lines are written"), Device.EndPreBuffer(true), 3);
+        TestFalse(TEXT("Should no longer be pre-buffering"), Device.IsPreBuffering());
+        Device.Serialize(TEXT("<late 1>"), ELogVerbosity::Log, Category, -1.0);
+        TestEqual(TEXT("Lines after the pre-buffer are written directly"), Device.GetNumLinesWritten(), (int64)4);
+        TestEqual(TEXT("Nothing dropped"), Device.GetNumPreBufferDroppedLines(), (int64)0);
+        Device.Flush();
+        Device.TearDown();
+    }
+    FString Contents;
+    TestTrue(TEXT("Log file should be readable"), FFileHelper::LoadFileToString(Contents, *TestLogFile));
+    int SearchFrom = 0;
+    for (const TCHAR* Marker : { TEXT("<early 1>"), TEXT("<early 2>"), TEXT("<early 3>"), TEXT("<late 1>") })
+    {
+        int Found = Contents.Find(Marker, ESearchCase::CaseSensitive, ESearchDir::FromStart, SearchFrom);
+        if (Found == INDEX_NONE)
+        {
+            AddError(FString::Printf(TEXT("Line %s is missing or out of order"), Marker));
+            return false;
+        }
+        SearchFrom = Found + FCString::Strlen(Marker);
+    }
+
+    FString DiscardedLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-discarded-%d.log"), TestInstanceIndex));
+    {
+        FsparklogsOutputDeviceFile Device(*DiscardedLogFile, nullptr);
+        // Only room for a few lines
+        Device.StartPreBuffer(512);
+        for (int i = 0; i < 100; i++)
+        {
+            Device.Serialize(*FString::Printf(TEXT("<early %d>"), i), ELogVerbosity::Log, Category, -1.0);
+        }
+        TestTrue(TEXT("Lines over the budget are dropped"), Device.GetNumPreBufferDroppedLines() > 0);
+        TestTrue(TEXT("Not every line is dropped"), Device.GetNumPreBufferDroppedLines() < 100);
+        TestEqual(TEXT("Discarded lines are not written"), Device.EndPreBuffer(false), 0);
+        TestEqual(TEXT("Nothing was written"), Device.GetNumLinesWritten(), (int64)0);
+        Device.TearDown();
+    }
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestHostAgentInstances, "sparklogs.UnitTests.HostAgentInstances", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestHostAgentInstances::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString LockBasePath = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs-lock"));
+
+    // The leader takes a specific instance's lock to prove that the instance exited
+    {
+        FsparklogsIndexedLockFile InstanceLock(LockBasePath, 3);
+        TestTrue(TEXT("A specific lock index can be acquired"), InstanceLock.IsLocked());
+        TestEqual(TEXT("Lock index"), InstanceLock.GetLockIndex(), 3);
+        TestEqual(TEXT("Lockfile follows the indexed naming"), InstanceLock.GetAttemptedLockFile(), FsparklogsIndexedLockFile::GetLockFilename(LockBasePath, 3));
+        FsparklogsIndexedLockFile SearchedLock(5, LockBasePath);
+        TestEqual(TEXT("Searching still takes the lowest free index"), SearchedLock.GetLockIndex(), 1);
+    }
+    TestEqual(TEXT("Index 1 has no suffix"), FsparklogsIndexedLockFile::GetLockFilename(LockBasePath, 1), LockBasePath + TEXT(".lock"));
+    {
+        FsparklogsIndexedLockFile InstanceLock(LockBasePath, 3);
+        TestTrue(TEXT("A released lock index can be acquired again"), InstanceLock.IsLocked());
+    }
+
+    // The leader reports another instance's data with that instance's process and app instance IDs
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = true;
+    Settings->AddRandomAppInstanceID = true;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), TEXT("otherinstance"), nullptr, ITLStreamLane::Logs, 424242));
+    Streamer->SetWeakThisPtr(Streamer);
+    TArray<uint8> CommonEventJSONData;
+    Streamer->GetCommonEventJSON(CommonEventJSONData);
+    FUTF8ToTCHAR CommonEventJSONConverted((const ANSICHAR*)CommonEventJSONData.GetData(), CommonEventJSONData.Num());
+    FString CommonEventJSON(CommonEventJSONConverted.Length(), CommonEventJSONConverted.Get());
+    TestTrue(TEXT("Overridden process ID is reported"), CommonEventJSON.Contains(TEXT("\"pid\": 424242")));
+    TestTrue(TEXT("Other instance's app instance ID is reported"), CommonEventJSON.Contains(TEXT("\"app_instance_id\": \"otherinstance\"")));
+    bool FlushedEverything = false;
+    Streamer->FlushAndWait(1, false, true, false, 10.0, FlushedEverything);
+    Streamer.Reset();
+    return true;
+}
+
+/** A payload processor that keeps the payload in memory and that several streamers can share, like the one the host agent uses. */
+class FsparklogsSharedStoreInMemPayloadProcessor : public FsparklogsStoreInMemPayloadProcessor
+{
+public:
+    FCriticalSection PayloadsCriticalSection;
+    virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override
+    {
+        FScopeLock PayloadsLock(&PayloadsCriticalSection);
+        return FsparklogsStoreInMemPayloadProcessor::ProcessPayload(JSONPayloadInUTF8, PayloadLen, OriginalPayloadLen, CompressionMode, StreamerWeakPtr);
+    }
+    /** Returns the payload that holds Marker, or an empty string if none does. */
+    FString FindPayload(const TCHAR* Marker)
+    {
+        FScopeLock PayloadsLock(&PayloadsCriticalSection);
+        for (const FString& Payload : Payloads)
+        {
+            if (Payload.Contains(Marker))
+            {
+                return Payload;
+            }
+        }
+        return FString();
+    }
+};
+
+/** Requests flushes from the host agent until Done returns true or TimeoutSecs pass. Returns the last result of Done. */
+static bool ITLWaitForHostAgent(FsparklogsHostAgent& Agent, double TimeoutSecs, TFunctionRef<bool()> Done)
+{
+    const double WaitStartTime = FPlatformTime::Seconds();
+    while (!Done() && FPlatformTime::Seconds() - WaitStartTime < TimeoutSecs)
+    {
+        Agent.RequestFlush();
+        FPlatformProcess::Sleep(0.1f);
+    }
+    return Done();
+}
+
+static void ITLAppendToLogFile(const FString& LogFilePath, const TCHAR* Str)
+{
+    FFileHelper::SaveStringToFile(Str, *LogFilePath, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM, &IFileManager::Get(), FILEWRITE_Append);
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestHostAgentElection, "sparklogs.UnitTests.HostAgentElection", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestHostAgentElection::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    const int IndexA = TestInstanceIndex, IndexB = TestInstanceIndex + 1, IndexC = TestInstanceIndex + 2;
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), IndexA);
+    FITLTestTempDirectory TempDirB(TempDir.GetTempDir(), IndexB);
+    FITLTestTempDirectory TempDirC(TempDir.GetTempDir(), IndexC);
+    const FString HostDir = TempDir.GetTempDir();
+    // Every agent waits up to an election interval before it looks for new logfiles or takes over
+    const double WaitSecs = FsparklogsSettings::HostAgentElectionIntervalSecs * 4.0;
+    auto MakeSettings = [](int InstanceIndex)
+    {
+        TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(InstanceIndex));
+        Settings->IncludeCommonMetadata = true;
+        Settings->AddRandomAppInstanceID = true;
+        return Settings;
+    };
+    TMap<FString, FString> AttributesA, AttributesB, AttributesC;
+    AttributesA.Add(TEXT("test_member"), TEXT("member-a"));
+    AttributesB.Add(TEXT("test_member"), TEXT("member-b"));
+    AttributesC.Add(TEXT("test_member"), TEXT("member-c"));
+
+    // The first instance becomes the leader, the second one only publishes itself
+    TSharedRef<FsparklogsSharedStoreInMemPayloadProcessor, ESPMode::ThreadSafe> ProcessorA(new FsparklogsSharedStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsHostAgent> AgentA = MakeUnique<FsparklogsHostAgent>(IndexA, MakeSettings(IndexA), ProcessorA, nullptr, 16 * 1024, TEXT("computer-a"), TEXT("instance-a"), &AttributesA, HostDir);
+    // Each running instance holds the lock of its instance index, which tells the leader that it has not exited
+    TUniquePtr<FsparklogsIndexedLockFile> InstanceLockA = MakeUnique<FsparklogsIndexedLockFile>(AgentA->GetInstanceLockBasePath(), IndexA);
+    TUniquePtr<FsparklogsIndexedLockFile> InstanceLockB = MakeUnique<FsparklogsIndexedLockFile>(AgentA->GetInstanceLockBasePath(), IndexB);
+    TestTrue(TEXT("The first instance becomes the leader"), ITLWaitForHostAgent(*AgentA, WaitSecs, [&AgentA]() { return AgentA->IsLeader(); }));
+    TSharedRef<FsparklogsSharedStoreInMemPayloadProcessor, ESPMode::ThreadSafe> ProcessorB(new FsparklogsSharedStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsHostAgent> AgentB = MakeUnique<FsparklogsHostAgent>(IndexB, MakeSettings(IndexB), ProcessorB, nullptr, 16 * 1024, TEXT("computer-b"), TEXT("instance-b"), &AttributesB, HostDir);
+    TestTrue(TEXT("Each instance publishes itself"), IFileManager::Get().FileExists(*AgentB->GetMemberFilePath(IndexB)));
+    ITLAppendToLogFile(AgentA->GetLogFilePath(IndexA, ITLStreamLane::Logs), TEXT("<a line 1>\n"));
+    ITLAppendToLogFile(AgentB->GetLogFilePath(IndexB, ITLStreamLane::Logs), TEXT("<b line 1>\n"));
+    TestTrue(TEXT("The leader ships the logfile of every instance"), ITLWaitForHostAgent(*AgentA, WaitSecs, [&ProcessorA]() { return !ProcessorA->FindPayload(TEXT("<a line 1>")).IsEmpty() && !ProcessorA->FindPayload(TEXT("<b line 1>")).IsEmpty(); }));
+    TestFalse(TEXT("Only one instance is the leader"), AgentB->IsLeader());
+    TestEqual(TEXT("Nothing is shipped by an instance that is not the leader"), ProcessorB->Payloads.Num(), 0);
+    const FString PayloadA = ProcessorA->FindPayload(TEXT("<a line 1>"));
+    const FString PayloadB = ProcessorA->FindPayload(TEXT("<b line 1>"));
+    TestTrue(TEXT("The leader's data is reported with its own attributes"), PayloadA.Contains(TEXT("computer-a")) && PayloadA.Contains(TEXT("member-a")) && PayloadA.Contains(TEXT("instance-a")));
+    TestTrue(TEXT("Another instance's data is reported with its computer name"), PayloadB.Contains(TEXT("computer-b")));
+    TestTrue(TEXT("Another instance's data is reported with its additional attributes"), PayloadB.Contains(TEXT("member-b")));
+    TestTrue(TEXT("Another instance's data is reported with its app instance ID"), PayloadB.Contains(TEXT("instance-b")));
+    TestFalse(TEXT("Another instance's data is never reported with the leader's attributes"), PayloadB.Contains(TEXT("computer-a")) || PayloadB.Contains(TEXT("member-a")));
+
+    // An instance that restarts and reclaims its index is reported as the new process from then on
+    AgentB.Reset();
+    AgentB = MakeUnique<FsparklogsHostAgent>(IndexB, MakeSettings(IndexB), ProcessorB, nullptr, 16 * 1024, TEXT("computer-b"), TEXT("instance-b-restarted"), &AttributesB, HostDir);
+    // The leader notices the restart the next time it reads the member files
+    FPlatformProcess::Sleep((float)(FsparklogsSettings::HostAgentElectionIntervalSecs * 1.5));
+    ITLAppendToLogFile(AgentB->GetLogFilePath(IndexB, ITLStreamLane::Logs), TEXT("<b line restarted>\n"));
+    TestTrue(TEXT("The leader ships the logfile of a restarted instance"), ITLWaitForHostAgent(*AgentA, WaitSecs, [&ProcessorA]() { return !ProcessorA->FindPayload(TEXT("<b line restarted>")).IsEmpty(); }));
+    TestTrue(TEXT("A restarted instance's data is reported with its new app instance ID"), ProcessorA->FindPayload(TEXT("<b line restarted>")).Contains(TEXT("instance-b-restarted")));
+
+    // Once an instance has exited (no longer holds its instance lock) and everything from it shipped, the leader purges its logfiles
+    {
+        TUniquePtr<FsparklogsHostAgent> AgentC = MakeUnique<FsparklogsHostAgent>(IndexC, MakeSettings(IndexC), ProcessorA, nullptr, 16 * 1024, TEXT("computer-c"), TEXT("instance-c"), &AttributesC, HostDir);
+        ITLAppendToLogFile(AgentC->GetLogFilePath(IndexC, ITLStreamLane::Logs), TEXT("<c line 1>\n"));
+        AgentC->Shutdown(1.0);
+    }
+    const FString MemberFileC = AgentA->GetMemberFilePath(IndexC);
+    const FString LogFileC = AgentA->GetLogFilePath(IndexC, ITLStreamLane::Logs);
+    TestTrue(TEXT("The logfiles of an exited instance are purged"), ITLWaitForHostAgent(*AgentA, WaitSecs * 2.0, [&MemberFileC, &LogFileC]() { return !IFileManager::Get().FileExists(*MemberFileC) && !IFileManager::Get().FileExists(*LogFileC); }));
+    TestTrue(TEXT("The logfiles of an exited instance are shipped before they are purged"), ProcessorA->FindPayload(TEXT("<c line 1>")).Contains(TEXT("member-c")));
+    TestTrue(TEXT("A running instance is never purged"), IFileManager::Get().FileExists(*AgentA->GetMemberFilePath(IndexB)) && IFileManager::Get().FileExists(*AgentA->GetLogFilePath(IndexB, ITLStreamLane::Logs)));
+
+    // Once the leader exits, another instance takes over and continues from the progress the leader recorded
+    AgentA->Shutdown(5.0);
+    AgentA.Reset();
+    InstanceLockA.Reset();
+    TestTrue(TEXT("Another instance takes over once the leader exits"), ITLWaitForHostAgent(*AgentB, WaitSecs, [&AgentB]() { return AgentB->IsLeader(); }));
+    ITLAppendToLogFile(AgentB->GetLogFilePath(IndexB, ITLStreamLane::Logs), TEXT("<b line 2>\n"));
+    TestTrue(TEXT("The new leader ships what was logged since the takeover"), ITLWaitForHostAgent(*AgentB, WaitSecs, [&ProcessorB]() { return !ProcessorB->FindPayload(TEXT("<b line 2>")).IsEmpty(); }));
+    TestTrue(TEXT("The new leader never ships again what the old leader shipped"), ProcessorB->FindPayload(TEXT("<b line 1>")).IsEmpty());
+    TestTrue(TEXT("The new leader reports its own data with its own attributes"), ProcessorB->FindPayload(TEXT("<b line 2>")).Contains(TEXT("member-b")));
+    AgentB->Shutdown(5.0);
+    TestFalse(TEXT("The leader purges its own logfiles once everything shipped"), IFileManager::Get().FileExists(*AgentB->GetLogFilePath(IndexB, ITLStreamLane::Logs)));
+    AgentB.Reset();
+    InstanceLockB.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestSpooledLogfile, "sparklogs.UnitTests.SpooledLogfile", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestSpooledLogfile::RunTest(const FString& Parameters)
+{
+    FScopedValueSetter<ELogTimes::Type> DoNotPrintTimes(GPrintLogTimes, ELogTimes::None);
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+    TestEqual(TEXT("Segments are numbered next to the logfile"), FsparklogsSpool::GetSegmentPath(TestLogFile, 7), FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.seg00000007.log"), TestInstanceIndex)));
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = false;
+    // Smaller than the settings allow, so that a few lines fill a segment
+    Settings->SpoolSegmentBytes = 1024;
+    const FName Category(TEXT("LogSparkLogsSpoolTest"));
+    constexpr int NumLines = 100;
+    {
+        FsparklogsOutputDeviceFile Device(*TestLogFile, nullptr);
+        Device.StartSpool(Settings->SpoolSegmentBytes);
+        TestTrue(TEXT("Should be spooling"), Device.IsSpoolActive());
+        for (int i = 0; i < NumLines; i++)
+        {
+            Device.Serialize(*FString::Printf(TEXT("<spooled line %03d>"), i), ELogVerbosity::Log, Category, -1.0);
+        }
+        Device.AddRawEvent(TEXT("\"spool_test\": true"), TEXT("<spooled event>"));
+        Device.Flush();
+        Device.TearDown();
+    }
+    TArray<FsparklogsSpool::FSegment> Segments;
+    FsparklogsSpool::FindSegments(TestLogFile, Segments);
+    TestFalse(TEXT("The logfile itself is not written"), IFileManager::Get().FileExists(*TestLogFile));
+    TestTrue(TEXT("Lines are split into several segments"), Segments.Num() > 2);
+    if (Segments.Num() <= 2)
+    {
+        return false;
+    }
+    TestEqual(TEXT("Numbering starts at 1"), Segments[0].Number, (int64)1);
+    TestFalse(TEXT("A segment with only log lines is not protected"), Segments[0].Protected);
+    TestTrue(TEXT("The segment with the analytics event is protected"), Segments.Last().Protected || Segments[Segments.Num() - 2].Protected);
+
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+    // Each flush ships the rest of the oldest segment, then the next flush deletes it and moves on
+    bool FlushedEverything = false;
+    for (int i = 0; i < Segments.Num() * 2 && !FlushedEverything; i++)
+    {
+        TestTrue(TEXT("FlushAndWait should succeed"), Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything));
+    }
+    TestTrue(TEXT("Every segment is shipped"), FlushedEverything);
+    FString Shipped = FString::Join(PayloadProcessor->Payloads, TEXT(""));
+    int SearchFrom = 0;
+    for (int i = 0; i < NumLines; i++)
+    {
+        const FString Marker = FString::Printf(TEXT("<spooled line %03d>"), i);
+        int Found = Shipped.Find(Marker, ESearchCase::CaseSensitive, ESearchDir::FromStart, SearchFrom);
+        if (Found == INDEX_NONE)
+        {
+            AddError(FString::Printf(TEXT("Line %s is missing or out of order"), *Marker));
+            return false;
+        }
+        SearchFrom = Found + Marker.Len();
+    }
+    TestTrue(TEXT("The analytics event is shipped"), Shipped.Contains(TEXT("<spooled event>")));
+    FsparklogsShipperStats Stats;
+    Streamer->GetShipperStats(Stats);
+    TestEqual(TEXT("Nothing is left in the backlog"), Stats.BacklogBytes, (int64)0);
+    Streamer->FlushAndWait(1, false, true, false, 10.0, FlushedEverything);
+    Streamer.Reset();
+    FsparklogsSpool::FindSegments(TestLogFile, Segments);
+    TestEqual(TEXT("Only the newest segment is kept after shipping"), Segments.Num(), 1);
+
+    // Over the disk budget, unshipped segments are dropped oldest first, keeping the one being shipped, the newest, and any with analytics events
+    FString BudgetLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-budget-%d.log"), TestInstanceIndex));
+    {
+        FsparklogsOutputDeviceFile Device(*BudgetLogFile, nullptr);
+        Device.StartSpool(Settings->SpoolSegmentBytes);
+        for (int i = 0; i < NumLines; i++)
+        {
+            Device.Serialize(*FString::Printf(TEXT("<spooled line %03d>"), i), ELogVerbosity::Log, Category, -1.0);
+            if (i == NumLines / 2)
+            {
+                Device.AddRawEvent(TEXT("\"spool_test\": true"), TEXT("<spooled event>"));
+            }
+        }
+        Device.Flush();
+        Device.TearDown();
+    }
+    TArray<FsparklogsSpool::FSegment> BudgetSegments;
+    FsparklogsSpool::FindSegments(BudgetLogFile, BudgetSegments);
+    Settings->SpoolMaxDiskBytes = Settings->SpoolSegmentBytes * 2;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> FailingPayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    FailingPayloadProcessor->FailProcessing = true;
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> BudgetStreamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex + 1, *BudgetLogFile, Settings, FailingPayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+    BudgetStreamer->SetWeakThisPtr(BudgetStreamer);
+    BudgetStreamer->FlushAndWait(1, false, true, false, 10.0, FlushedEverything);
+    TestTrue(TEXT("Dropped segments are counted"), BudgetStreamer->GetDroppedBacklogBytes() > 0);
+    BudgetStreamer.Reset();
+    for (int i = 0; i < BudgetSegments.Num(); i++)
+    {
+        const bool MustBeKept = i == 0 || i == BudgetSegments.Num() - 1 || BudgetSegments[i].Protected;
+        if (MustBeKept)
+        {
+            TestTrue(FString::Printf(TEXT("Segment %lld is kept"), BudgetSegments[i].Number), IFileManager::Get().FileExists(*BudgetSegments[i].Path));
+        }
+    }
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestBinaryRecords, "sparklogs.UnitTests.BinaryRecords", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestBinaryRecords::RunTest(const FString& Parameters)
 {
+    FScopedValueSetter<ELogTimes::Type> DoNotPrintTimes(GPrintLogTimes, ELogTimes::None);
     int TestInstanceIndex = FMath::RandRange(1000, 10000);
     FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
-    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
-
-    TArray<FString> ExpectedPayloads;
-
-    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
-    ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nLine 2\r\n1234"));
-    LogWriter->Flush();
-
     TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
     Settings->IncludeCommonMetadata = false;
-    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
-    // Setup so that we process success requests very quickly, but delay a long time after a failure
-    constexpr double TestProcessingIntervalSecs = 0.1;
-    constexpr double TestRetryIntervalSecs = 3.0;
-    Settings->ProcessingIntervalSecs = TestProcessingIntervalSecs;
-    Settings->RetryIntervalSecs = TestRetryIntervalSecs;
-    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
-    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
-    Streamer->SetWeakThisPtr(Streamer);
-    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 1\"},{\"message\":\"Line 2\"}]"));
-    bool FlushedEverything = false;
-    TestTrue(TEXT("FlushAndWait[1] should succeed"), Streamer->FlushAndWait(1, false, false, false, TestProcessingIntervalSecs * 5, FlushedEverything));
-    TestTrue(TEXT("FlushAndWait[1] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
-    TestFalse(TEXT("FlushAndWait[1] should NOT capture everything"), FlushedEverything);
+    Settings->SpoolSegmentBytes = FsparklogsSettings::MinSpoolSegmentBytes;
+    const FName Category(TEXT("LogSparkLogsBinaryRecordsTest"));
 
-    // Setup more data to log, but simulate failure of the payload processor
-    PayloadProcessor->FailProcessing = true;
-    ITLWriteStringToFile(LogWriter, TEXT("Line 3\r\nLine 4"));
-    LogWriter->Flush();
-    TestFalse(TEXT("FlushAndWait[2] should fail because of failure to process"), Streamer->FlushAndWait(1, false, false, false, TestProcessingIntervalSecs * 5, FlushedEverything));
-    TestFalse(TEXT("FlushAndWait[2] should NOT capture everything"), FlushedEverything);
+    auto WriteLogfile = [&](const FString& LogFile, bool bBinaryRecords, const FString& LongMessage)
+    {
+        FsparklogsOutputDeviceFile Device(*LogFile, nullptr);
+        Device.StartSpool(Settings->SpoolSegmentBytes, bBinaryRecords);
+        if (!LongMessage.IsEmpty())
+        {
+            Device.Serialize(*LongMessage, ELogVerbosity::Log, Category, -1.0);
+        }
+        else
+        {
+            Device.Serialize(TEXT("hello world"), ELogVerbosity::Log, Category, -1.0);
+            Device.Serialize(TEXT("careful now"), ELogVerbosity::Warning, Category, -1.0);
+            Device.Serialize(TEXT("\r\nline one\nline \"two\"\twith a tab \\ and a \x01\n\n"), ELogVerbosity::Error, Category, -1.0);
+            Device.AddRawEvent(TEXT("\"binary_test\": true"), TEXT("<raw event>"));
+            Device.Serialize(TEXT("goodbye"), ELogVerbosity::Verbose, Category, -1.0);
+        }
+        Device.Flush();
+        Device.TearDown();
+    };
+    auto ShipLogfile = [&](int InstanceIndex, const FString& LogFile, FString& OutShipped)
+    {
+        TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+        TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(InstanceIndex, *LogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+        Streamer->SetWeakThisPtr(Streamer);
+        bool FlushedEverything = false;
+        TestTrue(TEXT("FlushAndWait should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+        TestTrue(TEXT("FlushAndWait should capture everything"), FlushedEverything);
+        Streamer.Reset();
+        OutShipped = FString::Join(PayloadProcessor->Payloads, TEXT(""));
+    };
+
+    // Shipping binary records gives exactly the same events as shipping the same lines written as text
+    FString TextLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-text-%d.log"), TestInstanceIndex));
+    FString BinaryLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-binary-%d.log"), TestInstanceIndex));
+    WriteLogfile(TextLogFile, false, FString());
+    WriteLogfile(BinaryLogFile, true, FString());
+    TArray<uint8> SegmentData;
+    TestTrue(TEXT("The binary segment can be read"), FFileHelper::LoadFileToArray(SegmentData, *FsparklogsSpool::GetSegmentPath(BinaryLogFile, 1)));
+    TestTrue(TEXT("The binary segment starts with its signature instead of a byte order marker"), SegmentData.Num() > 8 && SegmentData[0] == 0x89 && SegmentData[1] == 'S' && SegmentData[2] == 'L' && SegmentData[3] == 'R');
+    FString TextShipped, BinaryShipped;
+    ShipLogfile(TestInstanceIndex, TextLogFile, TextShipped);
+    ShipLogfile(TestInstanceIndex + 1, BinaryLogFile, BinaryShipped);
+    TestTrue(TEXT("The text logfile ships its lines"), TextShipped.Contains(TEXT("line one\\nline \\\"two\\\"\\twith a tab")));
+    TestEqual(TEXT("Binary records ship the same events as text"), BinaryShipped, TextShipped);
+
+    // A message too long for one record continues in the records that follow
+    constexpr int LongMessageLen = 150000;
+    FString LongLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-long-%d.log"), TestInstanceIndex));
+    WriteLogfile(LongLogFile, true, FString::ChrN(LongMessageLen, TEXT('z')));
+    FString LongShipped;
+    ShipLogfile(TestInstanceIndex + 2, LongLogFile, LongShipped);
+    int NumShippedChars = 0;
+    for (TCHAR c : LongShipped)
+    {
+        NumShippedChars += (c == TEXT('z')) ? 1 : 0;
+    }
+    TestEqual(TEXT("The whole long message is shipped"), NumShippedChars, LongMessageLen);
+    TestTrue(TEXT("The long message is split into several events"), LongShipped.Find(TEXT("\"message\":"), ESearchCase::CaseSensitive, ESearchDir::FromEnd) > LongShipped.Find(TEXT("\"message\":")));
+    return true;
+}
 
-    // Make sure all manual flush requests have been processed
-    FPlatformProcess::SleepNoStats(TestProcessingIntervalSecs * 5);
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestBinaryRecordsResync, "sparklogs.UnitTests.BinaryRecordsResync", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestBinaryRecordsResync::RunTest(const FString& Parameters)
+{
+    FScopedValueSetter<ELogTimes::Type> DoNotPrintTimes(GPrintLogTimes, ELogTimes::None);
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    Settings->IncludeCommonMetadata = false;
+    Settings->SpoolSegmentBytes = FsparklogsSettings::MinSpoolSegmentBytes;
+    const FName Category(TEXT("LogSparkLogsBinaryRecordsTest"));
 
-    // Even though processing the payload will no longer fail, we have to wait longer before a retry is allowed.
-    // HOWEVER, clear the retry timer in this attempt, so it should succeed immediately!
-    PayloadProcessor->FailProcessing = false;
-    ExpectedPayloads.Add(TEXT("[{\"message\":\"1234Line 3\"}]"));
-    TestTrue(TEXT("FlushAndWait[3] should succeed because the retry timer was cleared"), Streamer->FlushAndWait(1, true, false, false, TestProcessingIntervalSecs * 5, FlushedEverything));
-    TestTrue(TEXT("FlushAndWait[3] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
-    TestFalse(TEXT("FlushAndWait[3] should NOT capture everything"), FlushedEverything);
+    FString LogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-binary-%d.log"), TestInstanceIndex));
+    {
+        FsparklogsOutputDeviceFile Device(*LogFile, nullptr);
+        Device.StartSpool(Settings->SpoolSegmentBytes, true);
+        Device.Serialize(TEXT("first record"), ELogVerbosity::Log, Category, -1.0);
+        Device.Serialize(TEXT("damaged record"), ELogVerbosity::Log, Category, -1.0);
+        Device.Serialize(TEXT("third record"), ELogVerbosity::Log, Category, -1.0);
+        Device.Serialize(TEXT("last record"), ELogVerbosity::Log, Category, -1.0);
+        Device.Flush();
+        Device.TearDown();
+    }
 
-    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
-    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
-    TestFalse(TEXT("FlushAndWait[FINAL] should NOT capture everything"), FlushedEverything);
+    // Damage the magic of the second record, after the signature and the first record
+    const FString SegmentPath = FsparklogsSpool::GetSegmentPath(LogFile, 1);
+    TArray<uint8> SegmentData;
+    TestTrue(TEXT("The binary segment can be read"), FFileHelper::LoadFileToArray(SegmentData, *SegmentPath));
+    constexpr int SignatureLen = 8;
+    constexpr int HeaderLen = 24;
+    if (!TestTrue(TEXT("The binary segment holds the first record"), SegmentData.Num() > SignatureLen + HeaderLen))
+    {
+        return false;
+    }
+    uint32 FirstRecordLen = 0;
+    FMemory::Memcpy(&FirstRecordLen, SegmentData.GetData() + SignatureLen + 4, sizeof(FirstRecordLen));
+    const int DamagedOffset = SignatureLen + HeaderLen + (int)FirstRecordLen;
+    if (!TestTrue(TEXT("The binary segment holds the second record"), SegmentData.Num() > DamagedOffset + HeaderLen))
+    {
+        return false;
+    }
+    SegmentData[DamagedOffset] ^= 0xFF;
+    SegmentData[DamagedOffset + 1] ^= 0xFF;
+    TestTrue(TEXT("The damaged segment can be written"), FFileHelper::SaveArrayToFile(SegmentData, *SegmentPath));
 
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *LogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait should capture everything"), FlushedEverything);
     Streamer.Reset();
+    const FString Shipped = FString::Join(PayloadProcessor->Payloads, TEXT(""));
+    TestTrue(TEXT("The record before the damage is shipped"), Shipped.Contains(TEXT("first record")));
+    TestFalse(TEXT("The damaged record is skipped"), Shipped.Contains(TEXT("damaged record")));
+    TestTrue(TEXT("The record after the damage is shipped"), Shipped.Contains(TEXT("third record")));
+    TestTrue(TEXT("The rest of the logfile is shipped"), Shipped.Contains(TEXT("last record")));
     return true;
 }
 
-IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestAppInstanceID, "sparklogs.UnitTests.AppInstanceID", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
-void FsparklogsPluginUnitTestAppInstanceID::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
-{
-    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
-}
-bool FsparklogsPluginUnitTestAppInstanceID::RunTest(const FString& Parameters)
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestMemoryBudget, "sparklogs.UnitTests.MemoryBudget", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestMemoryBudget::RunTest(const FString& Parameters)
 {
+    FScopedValueSetter<ELogTimes::Type> DoNotPrintTimes(GPrintLogTimes, ELogTimes::None);
     int TestInstanceIndex = FMath::RandRange(1000, 10000);
     FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
     FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
-
-    TArray<FString> ExpectedPayloads;
-
-    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
-    const TCHAR* TestPayload1 = TEXT("Hello world");
-    ITLWriteStringToFile(LogWriter, *FString::Format(TEXT("{0}\r\n"), { TestPayload1 }));
-    LogWriter->Flush();
-
     TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
     Settings->IncludeCommonMetadata = false;
-    Settings->AddRandomAppInstanceID = true;
-    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    Settings->MemoryBudgetBytes = FsparklogsSettings::MinMemoryBudgetBytes;
+    Settings->MemoryBudgetIdleReleaseSecs = FsparklogsSettings::MinMemoryBudgetIdleReleaseSecs;
     TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
-    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), TEXT("abcd_1234_EFGH"), nullptr));
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
     Streamer->SetWeakThisPtr(Streamer);
-    ExpectedPayloads.Add(FString::Format(TEXT("[{\"app_instance_id\": \"abcd_1234_EFGH\", \"app_instance_index\": {0},\"message\":\"{1}\"}]"), { TestInstanceIndex, TestPayload1 }));
-    bool FlushedEverything = false;
-    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
-    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
-    TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+    TestEqual(TEXT("No buffers are allocated before there is anything to ship"), Streamer->GetBufferBytes(), (int64)0);
 
+    FsparklogsOutputDeviceFile OutputDevice(*TestLogFile, Streamer);
+    OutputDevice.Log(TEXT("hello world"));
+    OutputDevice.Log(TEXT("goodbye world"));
+    OutputDevice.Flush();
+    OutputDevice.TearDown();
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait should capture everything"), FlushedEverything);
+    TestTrue(TEXT("The payload is shipped"), FString::Join(PayloadProcessor->Payloads, TEXT("")).Contains(TEXT("goodbye world")));
+    FsparklogsShipperStats Stats;
+    Streamer->GetShipperStats(Stats);
+    TestTrue(TEXT("Buffers are allocated to ship the data"), Stats.BufferBytes > 0);
+    TestTrue(TEXT("Buffers are sized to the data that was read rather than the largest request"), Stats.BufferBytes < (int64)Settings->BytesPerRequest);
+
+    // Once idle, the buffers are released
+    const double WaitUntil = FPlatformTime::Seconds() + 10.0;
+    while (Streamer->GetBufferBytes() > 0 && FPlatformTime::Seconds() < WaitUntil)
+    {
+        FPlatformProcess::Sleep(0.1f);
+    }
+    TestEqual(TEXT("Idle buffers are released"), Streamer->GetBufferBytes(), (int64)0);
     Streamer.Reset();
     return true;
 }
 
-IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestAdditionalAttributes, "sparklogs.UnitTests.AdditionalAttributes", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
-void FsparklogsPluginUnitTestAdditionalAttributes::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestTimezoneHeader, "sparklogs.UnitTests.TimezoneHeader", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestTimezoneHeader::RunTest(const FString& Parameters)
 {
-    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+    TestEqual(TEXT("No offset"), ITLFormatTimezoneHeaderValue(FTimespan::Zero()), FString(TEXT("UTC+00:00")));
+    TestEqual(TEXT("Ahead of UTC"), ITLFormatTimezoneHeaderValue(FTimespan(5, 30, 0)), FString(TEXT("UTC+05:30")));
+    TestEqual(TEXT("Behind UTC"), ITLFormatTimezoneHeaderValue(-FTimespan(8, 0, 0)), FString(TEXT("UTC-08:00")));
+    TestEqual(TEXT("Rounds to the nearest minute"), ITLFormatTimezoneHeaderValue(FTimespan(0, 44, 59)), FString(TEXT("UTC+00:45")));
+    return true;
 }
-bool FsparklogsPluginUnitTestAdditionalAttributes::RunTest(const FString& Parameters)
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestFlushUntilDeadline, "sparklogs.UnitTests.FlushUntilDeadline", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestFlushUntilDeadline::RunTest(const FString& Parameters)
 {
+    FScopedValueSetter<ELogTimes::Type> DoNotPrintTimes(GPrintLogTimes, ELogTimes::None);
     int TestInstanceIndex = FMath::RandRange(1000, 10000);
     FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
-    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
-
-    TArray<FString> ExpectedPayloads;
-
-    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
-    const TCHAR* TestPayload1 = TEXT("Hello world");
-    ITLWriteStringToFile(LogWriter, *FString::Format(TEXT("{0}\r\n"), { TestPayload1 }));
-    LogWriter->Flush();
-
     TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
     Settings->IncludeCommonMetadata = false;
-    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    auto WriteLines = [&](const FString& LogFile, int NumLines)
+    {
+        FsparklogsOutputDeviceFile OutputDevice(*LogFile, nullptr);
+        for (int i = 0; i < NumLines; i++)
+        {
+            OutputDevice.Log(*FString::Printf(TEXT("deadline test line %d"), i));
+        }
+        OutputDevice.Flush();
+        OutputDevice.TearDown();
+    };
+
+    // Everything ships well within the deadline, and the worker stops afterwards
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-%d.log"), TestInstanceIndex));
+    WriteLines(TestLogFile, 100);
     TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
-    TMap<FString, FString> AdditionalAttributes;
-    AdditionalAttributes.Add(TEXT("game_version"), TEXT("v1.2.3"));
-    AdditionalAttributes.Add(TEXT("game_name"), TEXT("hello world"));
-    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), &AdditionalAttributes));
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
     Streamer->SetWeakThisPtr(Streamer);
-    ExpectedPayloads.Add(FString::Format(TEXT("[{\"game_version\":\"v1.2.3\",\"game_name\":\"hello world\",\"message\":\"{0}\"}]"), { TestPayload1 }));
+    TestTrue(TEXT("Everything is shipped before the deadline"), Streamer->FlushUntilDeadline(FPlatformTime::Seconds() + 10.0, true, false));
+    TestTrue(TEXT("The last line is shipped"), FString::Join(PayloadProcessor->Payloads, TEXT("")).Contains(TEXT("deadline test line 99")));
     bool FlushedEverything = false;
-    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
-    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
-    TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+    TestFalse(TEXT("The worker was stopped"), Streamer->FlushAndWait(1, false, false, false, 1.0, FlushedEverything));
+    Streamer.Reset();
 
+    // When the destination keeps failing, the flush gives up at the deadline and the data is left for next time
+    FString FailLogFile = FPaths::Combine(TempDir.GetTempDir(), *FString::Printf(TEXT("test-sparklogs-fail-%d.log"), TestInstanceIndex));
+    WriteLines(FailLogFile, 10);
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> FailPayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    FailPayloadProcessor->FailProcessing = true;
+    Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex + 1, *FailLogFile, Settings, FailPayloadProcessor, 16 * 1024, FString(), FString(), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+    const double StartTime = FPlatformTime::Seconds();
+    TestFalse(TEXT("Nothing is shipped"), Streamer->FlushUntilDeadline(StartTime + 1.0, true, false));
+    const double ElapsedSecs = FPlatformTime::Seconds() - StartTime;
+    TestTrue(TEXT("The flush does not run much past the deadline"), ElapsedSecs < 1.0 + FsparklogsSettings::MinStopWaitSecs + 1.0);
+    TestEqual(TEXT("Nothing was written to the destination"), FailPayloadProcessor->Payloads.Num(), 0);
+    int64 ProgressMarker = 0;
+    int LastReadLen = 0;
+    TArray<uint8> IgnoreProgressState;
+    Streamer->ReadProgressMarker(ProgressMarker, LastReadLen, IgnoreProgressState);
+    TestEqual(TEXT("Progress did not advance, so the data ships next time"), ProgressMarker, (int64)0);
     Streamer.Reset();
     return true;
 }
 
-IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestDedupAfterCrash, "sparklogs.UnitTests.DedupAfterCrash", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
-void FsparklogsPluginUnitTestDedupAfterCrash::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestAnalyticsAggregator, "sparklogs.UnitTests.AnalyticsAggregator", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestAnalyticsAggregator::RunTest(const FString& Parameters)
+{
+    auto MakeEvent = [](const TCHAR* SessionID, const TCHAR* EventID, double Amount)
+    {
+        FsparklogsAnalyticsAggregator::FRollup Event;
+        Event.EventType = FsparklogsAnalyticsProvider::EventTypeResource;
+        Event.SessionID = SessionID;
+        Event.EventID = EventID;
+        Event.HasValue = true;
+        Event.Sum = Amount;
+        Event.Count = 1;
+        return Event;
+    };
+
+    // Events with the same session and event ID are summed up into one rollup
+    FsparklogsAnalyticsAggregator Aggregator;
+    TArray<FsparklogsAnalyticsAggregator::FRollup> Due;
+    Aggregator.Add(MakeEvent(TEXT("s1"), TEXT("Sink:gold"), -3.0), 3600.0, 100, Due);
+    Aggregator.Add(MakeEvent(TEXT("s1"), TEXT("Sink:gold"), -4.0), 3600.0, 100, Due);
+    Aggregator.Add(MakeEvent(TEXT("s1"), TEXT("Source:gold"), 2.0), 3600.0, 100, Due);
+    Aggregator.Add(MakeEvent(TEXT("s2"), TEXT("Sink:gold"), -1.0), 3600.0, 100, Due);
+    TestEqual(TEXT("Nothing should be due within the window"), Due.Num(), 0);
+    TestEqual(TEXT("One rollup per session and event ID"), Aggregator.Num(), 3);
+    TArray<FsparklogsAnalyticsAggregator::FRollup> Rollups;
+    Aggregator.TakeAll(Rollups);
+    TestEqual(TEXT("All rollups should be taken"), Rollups.Num(), 3);
+    TestEqual(TEXT("Nothing should be pending after taking all"), Aggregator.Num(), 0);
+    const FsparklogsAnalyticsAggregator::FRollup* Sink = Rollups.FindByPredicate([](const FsparklogsAnalyticsAggregator::FRollup& R) { return R.SessionID == TEXT("s1") && R.EventID == TEXT("Sink:gold"); });
+    if (TestNotNull(TEXT("Summed rollup should exist"), Sink))
+    {
+        TestEqual(TEXT("Amounts should be summed"), Sink->Sum, -7.0);
+        TestEqual(TEXT("Events should be counted"), Sink->Count, (int64)2);
+        TestTrue(TEXT("Rollup should record when it started"), Sink->Started != ITLEmptyDateTime);
+    }
+
+    // Adding a new key to a full table ends the window early
+    Aggregator.Add(MakeEvent(TEXT("s1"), TEXT("a"), 1.0), 3600.0, 2, Due);
+    Aggregator.Add(MakeEvent(TEXT("s1"), TEXT("b"), 1.0), 3600.0, 2, Due);
+    Aggregator.Add(MakeEvent(TEXT("s1"), TEXT("a"), 1.0), 3600.0, 2, Due);
+    TestEqual(TEXT("An existing key should still fit in a full table"), Due.Num(), 0);
+    Aggregator.Add(MakeEvent(TEXT("s1"), TEXT("c"), 1.0), 3600.0, 2, Due);
+    TestEqual(TEXT("A new key in a full table should make the pending rollups due"), Due.Num(), 2);
+    TestEqual(TEXT("The new key should start the next window"), Aggregator.Num(), 1);
+
+    // Rollups become due at the first event after the window ends
+    Due.Reset();
+    FPlatformProcess::Sleep(0.05f);
+    Aggregator.Add(MakeEvent(TEXT("s1"), TEXT("c"), 1.0), 0.01, 100, Due);
+    TestEqual(TEXT("A rollup whose window ended should be due"), Due.Num(), 1);
+    if (Due.Num() == 1)
+    {
+        TestEqual(TEXT("A due rollup should not include the event that ended its window"), Due[0].Count, (int64)1);
+    }
+    TestEqual(TEXT("The event that ended the window should start the next one"), Aggregator.Num(), 1);
+
+    // Rollups also become due without another event, once the window has ended
+    Due.Reset();
+    Aggregator.TakeDue(3600.0, Due);
+    TestEqual(TEXT("A rollup whose window has not ended should not be due"), Due.Num(), 0);
+    FPlatformProcess::Sleep(0.05f);
+    Aggregator.TakeDue(0.01, Due);
+    TestEqual(TEXT("A rollup whose window ended should be taken"), Due.Num(), 1);
+    TestEqual(TEXT("Nothing should be pending after taking the due rollups"), Aggregator.Num(), 0);
+    return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestFanOutMirrors, "sparklogs.UnitTests.FanOutMirrors", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestFanOutMirrors::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
 {
     SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
 }
-bool FsparklogsPluginUnitTestDedupAfterCrash::RunTest(const FString& Parameters)
+bool FsparklogsPluginUnitTestFanOutMirrors::RunTest(const FString& Parameters)
 {
     int TestInstanceIndex = FMath::RandRange(1000, 10000);
     FITLTestTempDirectory TempDir(ITLGetTestDir(), TestInstanceIndex);
@@ -891,74 +3110,162 @@ bool FsparklogsPluginUnitTestDedupAfterCrash::RunTest(const FString& Parameters)
     TArray<FString> ExpectedPayloads;
 
     TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
-    ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nLine 2\r\n1234"));
+    ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nSecond line is longer\r\n"));
     LogWriter->Flush();
 
     TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
-    // Setup so that we process success requests and retry requests very quickly.
-    constexpr double TestProcessingIntervalSecs = 0.1;
-    constexpr double TestRetryIntervalSecs = 0.1;
-    Settings->ProcessingIntervalSecs = TestProcessingIntervalSecs;
-    Settings->RetryIntervalSecs = TestRetryIntervalSecs;
     Settings->IncludeCommonMetadata = false;
-    Settings->AddRandomAppInstanceID = true;
     Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    Settings->RetryIntervalSecs = 0.05;
     TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
-    // Force payload processing to fail
-    PayloadProcessor->FailProcessing = true;
-    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor, 16 * 1024, FString(), TEXT("abcd_1234_EFGH"), nullptr));
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> EncodedMirrorProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> UncompressedMirrorProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> FailingMirrorProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    FailingMirrorProcessor->FailProcessing = true;
+    // Each mirror records its progress next to the progress journal of the streamer
+    const TArray<FString> MirrorNames = { TEXT("encoded"), TEXT("uncompressed"), TEXT("failing") };
+    auto DeleteMirrorJournals = [&MirrorNames, TestInstanceIndex]()
+    {
+        for (const FString& Name : MirrorNames)
+        {
+            IFileManager::Get().Delete(*FPaths::ChangeExtension(ITLGetProgressJournalPath(ITLGetIndexedStateFileINI(TestInstanceIndex)), Name + TEXT(".journal")), false, false, true);
+        }
+    };
+    DeleteMirrorJournals();
+    TSharedPtr<FsparklogsFanOutPayloadProcessor, ESPMode::ThreadSafe> FanOut(new FsparklogsFanOutPayloadProcessor(PayloadProcessor));
+    FanOut->AddMirror(MakeUnique<FsparklogsPayloadMirror>(MirrorNames[0], EncodedMirrorProcessor, false, Settings));
+    FanOut->AddMirror(MakeUnique<FsparklogsPayloadMirror>(MirrorNames[1], UncompressedMirrorProcessor, true, Settings));
+    FanOut->AddMirror(MakeUnique<FsparklogsPayloadMirror>(MirrorNames[2], FailingMirrorProcessor, true, Settings));
+    TestTrue(TEXT("Fan-out should want the uncompressed payload for its uncompressed mirrors"), FanOut->WantsUncompressedPayload());
+    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, FanOut.ToSharedRef(), 16 * 1024, FString(), FString(), nullptr));
     Streamer->SetWeakThisPtr(Streamer);
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 1\"},{\"message\":\"Second line is longer\"}]"));
     bool FlushedEverything = false;
-    TestFalse(TEXT("FlushAndWait[1-FINAL] should not succeed because of forced failure to process"), Streamer->FlushAndWait(2, true, true, false, 10.0, FlushedEverything));
-    TestTrue(TEXT("FlushAndWait[1-FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
-    TestFalse(TEXT("FlushAndWait[1-FINAL] should NOT capture everything"), FlushedEverything);
-    
-    TArray<uint8> ExpectedProgressState;
-    Streamer->GetCommonEventJSON(ExpectedProgressState);
+    TestTrue(TEXT("FlushAndWait[FIRST] should succeed"), Streamer->FlushAndWait(2, false, false, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FIRST] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[FIRST] should capture everything"), FlushedEverything);
+
+    // A mirror that keeps failing only holds back itself
+    TestFalse(TEXT("Mirrors should not all be idle while one keeps failing"), FanOut->WaitForMirrors(0.5));
+    TestTrue(TEXT("Encoded mirror payloads should match"), ITLComparePayloads(this, EncodedMirrorProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("Uncompressed mirror payloads should match"), ITLComparePayloads(this, UncompressedMirrorProcessor->Payloads, ExpectedPayloads));
+    TArray<FsparklogsPayloadMirror::FStats> MirrorStats;
+    FanOut->GetMirrorStats(MirrorStats);
+    if (TestEqual(TEXT("Stats for every mirror"), MirrorStats.Num(), 3))
+    {
+        TestEqual(TEXT("Uncompressed mirror should deliver the payload"), MirrorStats[1].DeliveredPayloads, (int64)1);
+        TestEqual(TEXT("Uncompressed mirror should record the delivered bytes"), MirrorStats[1].DeliveredBytes, (int64)ExpectedPayloads[0].Len());
+        TestEqual(TEXT("Failing mirror should not deliver the payload"), MirrorStats[2].DeliveredPayloads, (int64)0);
+        TestTrue(TEXT("Failing mirror should retry"), MirrorStats[2].FailedAttempts > 1);
+        TestEqual(TEXT("Failing mirror should keep the payload queued"), MirrorStats[2].QueuedPayloads, 1);
+    }
 
-    int64 ProgressMarker = 0;
-    int ProgressLastReadLen = 0;
-    TArray<uint8> ProgressState;
-    Streamer->ReadProgressMarker(ProgressMarker, ProgressLastReadLen, ProgressState);
-    TestEqual(TEXT("FlushAndWait[1-FINAL] progress marker should match"), ProgressMarker, (int64)0);
-    TestEqual(TEXT("FlushAndWait[1-FINAL] progress last read len should match"), ProgressLastReadLen, (int)20);
-    TestEqual(TEXT("FlushAndWait[1-FINAL] progress state should match"), ProgressState, ExpectedProgressState);
-    Streamer.Reset();
+    // Mirrors do not wait for the primary, and keep getting new data while it is unavailable
+    const TArray<FString> PrimaryPayloads = ExpectedPayloads;
+    PayloadProcessor->FailProcessing = true;
+    ITLWriteStringToFile(LogWriter, TEXT("3\r\n"));
+    LogWriter->Flush();
+    TestFalse(TEXT("FlushAndWait[PRIMARY FAILED] should fail"), Streamer->FlushAndWait(1, true, false, false, 10.0, FlushedEverything));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"3\"}]"));
+    FanOut->WaitForMirrors(0.5);
+    TestTrue(TEXT("FlushAndWait[PRIMARY FAILED] encoded mirror should get the payload"), ITLComparePayloads(this, EncodedMirrorProcessor->Payloads, ExpectedPayloads));
+    ITLWriteStringToFile(LogWriter, TEXT("4\r\n"));
+    LogWriter->Flush();
+    TestFalse(TEXT("FlushAndWait[PRIMARY STILL FAILED] should fail"), Streamer->FlushAndWait(1, true, false, false, 10.0, FlushedEverything));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"4\"}]"));
+    FanOut->WaitForMirrors(0.5);
+    TestTrue(TEXT("FlushAndWait[PRIMARY STILL FAILED] encoded mirror should get the data that follows the retry, once"), ITLComparePayloads(this, EncodedMirrorProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[PRIMARY STILL FAILED] primary payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, PrimaryPayloads));
 
-    // When we resume, it should remember that we have not yet processed the first two lines and generate a payload with the first two lines.
-    // Also, even though we use a different game instance ID in this new streamer, it should still use the old progress state for this first processed payload!!
+    // The primary later gets exactly the payloads the mirrors got, and the mirrors do not get them again
     PayloadProcessor->FailProcessing = false;
-    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor2(new FsparklogsStoreInMemPayloadProcessor());
-    TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer2 = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, PayloadProcessor2, 16 * 1024, FString(), TEXT("zzzz_yyyy_9876"), nullptr));
-    Streamer2->SetWeakThisPtr(Streamer2);
-    TArray<FString> ExpectedPayloads2;
-    ExpectedPayloads2.Add(FString::Format(TEXT("[{\"app_instance_id\": \"abcd_1234_EFGH\", \"app_instance_index\": {0},\"message\":\"{1}\"},{\"app_instance_id\": \"abcd_1234_EFGH\", \"app_instance_index\": {0},\"message\":\"{2}\"}]"), { TestInstanceIndex, TEXT("Line 1"), TEXT("Line 2") }));
-    TestTrue(TEXT("FlushAndWait[2-1] should succeed"), Streamer2->FlushAndWait(2, true, false, false, 10.0, FlushedEverything));
-    TestTrue(TEXT("FlushAndWait[2-1] payloads should match"), ITLComparePayloads(this, PayloadProcessor2->Payloads, ExpectedPayloads2));
-    TestFalse(TEXT("FlushAndWait[2-1] should NOT capture everything"), FlushedEverything);
-
-    TArray<uint8> ExpectedProgressState2;
-    Streamer2->GetCommonEventJSON(ExpectedProgressState2);
-    Streamer2->ReadProgressMarker(ProgressMarker, ProgressLastReadLen, ProgressState);
-    TestEqual(TEXT("FlushAndWait[2-1] progress marker should match"), ProgressMarker, (int64)16);
-    TestEqual(TEXT("FlushAndWait[2-1] progress last read len should match"), ProgressLastReadLen, (int)0);
-    TestEqual(TEXT("FlushAndWait[2-1] progress state should match"), ProgressState, ExpectedProgressState2);
+    TestTrue(TEXT("FlushAndWait[RETRY] should succeed"), Streamer->FlushAndWait(1, true, false, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[RETRY] primary payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    FanOut->WaitForMirrors(0.5);
+    TestTrue(TEXT("FlushAndWait[RETRY] encoded mirror payloads should match"), ITLComparePayloads(this, EncodedMirrorProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[RETRY] uncompressed mirror payloads should match"), ITLComparePayloads(this, UncompressedMirrorProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[RETRY] should stop"), Streamer->FlushAndWait(1, false, true, false, 10.0, FlushedEverything));
+    Streamer.Reset();
+    FanOut.Reset();
 
-    // finish the partial line and make sure it gets captured and nothing else
-    // also, make sure that this now uses the NEW progress state in the generated payload
-    ITLWriteStringToFile(LogWriter, TEXT("Line 3\r\nLine 4\r\nlast line\r\n"));
-    LogWriter->Flush();
-    ExpectedPayloads2.Add(FString::Format(TEXT("[{\"app_instance_id\": \"zzzz_yyyy_9876\", \"app_instance_index\": {0},\"message\":\"{1}\"},{\"app_instance_id\": \"zzzz_yyyy_9876\", \"app_instance_index\": {0},\"message\":\"{2}\"},{\"app_instance_id\": \"zzzz_yyyy_9876\", \"app_instance_index\": {0},\"message\":\"{3}\"}]"), { TestInstanceIndex, TEXT("1234Line 3"), TEXT("Line 4"), TEXT("last line")}));
-    TestTrue(TEXT("FlushAndWait[2-FINAL] should succeed"), Streamer2->FlushAndWait(2, true, true, false, 10.0, FlushedEverything));
-    TestTrue(TEXT("FlushAndWait[2-FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor2->Payloads, ExpectedPayloads2));
-    TestTrue(TEXT("FlushAndWait[2-FINAL] should capture everything"), FlushedEverything);
+    // After a restart, each mirror gets what it had not delivered yet
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> RestartedPayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TArray<TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe>> RestartedMirrorProcessors;
+    FanOut = MakeShareable(new FsparklogsFanOutPayloadProcessor(RestartedPayloadProcessor));
+    for (int i = 0; i < MirrorNames.Num(); i++)
+    {
+        RestartedMirrorProcessors.Add(MakeShareable(new FsparklogsStoreInMemPayloadProcessor()));
+        FanOut->AddMirror(MakeUnique<FsparklogsPayloadMirror>(MirrorNames[i], RestartedMirrorProcessors[i], i > 0, Settings));
+    }
+    Streamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(TestInstanceIndex, *TestLogFile, Settings, FanOut.ToSharedRef(), 16 * 1024, FString(), FString(), nullptr));
+    Streamer->SetWeakThisPtr(Streamer);
+    TestTrue(TEXT("FlushAndWait[RESTART] should succeed"), Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[RESTART] mirrors should deliver what they missed"), FanOut->WaitForMirrors(5.0));
+    TestEqual(TEXT("FlushAndWait[RESTART] primary should not get anything again"), RestartedPayloadProcessor->Payloads.Num(), 0);
+    TestEqual(TEXT("FlushAndWait[RESTART] encoded mirror should not get anything again"), RestartedMirrorProcessors[0]->Payloads.Num(), 0);
+    TestEqual(TEXT("FlushAndWait[RESTART] uncompressed mirror should not get anything again"), RestartedMirrorProcessors[1]->Payloads.Num(), 0);
+    TArray<FString> MissedPayloads;
+    MissedPayloads.Add(TEXT("[{\"message\":\"Line 1\"},{\"message\":\"Second line is longer\"},{\"message\":\"3\"},{\"message\":\"4\"}]"));
+    TestTrue(TEXT("FlushAndWait[RESTART] failing mirror should get everything it missed"), ITLComparePayloads(this, RestartedMirrorProcessors[2]->Payloads, MissedPayloads));
+
+    Streamer->FlushAndWait(1, false, true, false, 10.0, FlushedEverything);
+    Streamer->DeleteProgressMarker();
+    Streamer.Reset();
+    FanOut.Reset();
+    DeleteMirrorJournals();
+    return true;
+}
 
-    Streamer2->ReadProgressMarker(ProgressMarker, ProgressLastReadLen, ProgressState);
-    TestEqual(TEXT("FlushAndWait[2-FINAL] progress marker should match"), ProgressMarker, (int64)47);
-    TestEqual(TEXT("FlushAndWait[2-FINAL] progress last read len should match"), ProgressLastReadLen, (int)0);
-    TestEqual(TEXT("FlushAndWait[2-FINAL] progress state should match"), ProgressState, ExpectedProgressState2);
+/** A payload processor whose requests never complete by themselves, like an HTTP request while nothing ticks the HTTP module. */
+class FsparklogsNeverCompletesPayloadProcessor : public IsparklogsPayloadProcessor
+{
+public:
+    std::atomic<int> NumBegun{ 0 };
+    virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override
+    {
+        return FinishProcessPayload(BeginProcessPayload(JSONPayloadInUTF8, PayloadLen, OriginalPayloadLen, CompressionMode, StreamerWeakPtr), StreamerWeakPtr);
+    }
+    virtual TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> BeginProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override
+    {
+        NumBegun++;
+        TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending(new FsparklogsPendingPayload());
+        Pending->StartTime = FPlatformTime::Seconds();
+        return Pending;
+    }
+    virtual bool FinishProcessPayload(TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override
+    {
+        // As long as the default HTTP request timeout
+        Pending->WaitForEnd(FsparklogsSettings::DefaultRequestTimeoutSecs);
+        return Pending->RequestEnded && Pending->RequestSucceeded;
+    }
+};
 
-    Streamer2.Reset();
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestFanOutStopCancelsMirrors, "sparklogs.UnitTests.FanOutStopCancelsMirrors", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestFanOutStopCancelsMirrors::RunTest(const FString& Parameters)
+{
+    int TestInstanceIndex = FMath::RandRange(1000, 10000);
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(TestInstanceIndex));
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TSharedRef<FsparklogsNeverCompletesPayloadProcessor, ESPMode::ThreadSafe> StuckMirrorProcessor(new FsparklogsNeverCompletesPayloadProcessor());
+    TSharedPtr<FsparklogsFanOutPayloadProcessor, ESPMode::ThreadSafe> FanOut(new FsparklogsFanOutPayloadProcessor(PayloadProcessor));
+    FanOut->AddMirror(MakeUnique<FsparklogsPayloadMirror>(TEXT("stuck"), StuckMirrorProcessor, false, Settings));
+
+    FTCHARToUTF8 Converter(TEXT("[{\"message\":\"Line 1\"}]"));
+    TArray<uint8> Payload((const uint8*)Converter.Get(), Converter.Length());
+    TestTrue(TEXT("Primary should process the payload"), FanOut->ProcessPayload(Payload, Payload.Num(), Payload.Num(), ITLCompressionMode::None, nullptr));
+    const double WaitStartTime = FPlatformTime::Seconds();
+    while (StuckMirrorProcessor->NumBegun.load() == 0 && FPlatformTime::Seconds() - WaitStartTime < 5.0)
+    {
+        FPlatformProcess::Sleep(0.01f);
+    }
+    TestEqual(TEXT("Mirror should start delivering the payload"), StuckMirrorProcessor->NumBegun.load(), 1);
+    TestFalse(TEXT("Mirror should not be idle while its request is stuck"), FanOut->WaitForMirrors(0.2));
+
+    // Stopping must cancel the stuck request instead of waiting for it to time out
+    const double StopStartTime = FPlatformTime::Seconds();
+    FanOut.Reset();
+    const double StopSecs = FPlatformTime::Seconds() - StopStartTime;
+    TestTrue(FString::Printf(TEXT("Stopping the mirrors should not wait for the stuck request (took %.3lf secs)"), StopSecs), StopSecs < 5.0);
     return true;
 }
 
@@ -1263,3 +3570,37 @@ bool FsparklogsPluginIntegrationTestAutoFlushRawEvent::RunTest(const FString& Pa
     Streamer.Reset();
     return true;
 }
+
+#if !UE_BUILD_SHIPPING
+// Takes much longer than the unit tests and depends on the machine, so it only runs with the performance tests
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginBenchmarkSuite, "sparklogs.Benchmarks.Suite", EAutomationTestFlags::EditorContext | EAutomationTestFlags::LowPriority | EAutomationTestFlags::PerfFilter)
+bool FsparklogsPluginBenchmarkSuite::RunTest(const FString& Parameters)
+{
+    // A small run of every scenario, mostly to make sure the harness itself keeps working
+    FsparklogsBenchmarkOptions Options;
+    Options.Parse(TEXT("threads=3 messages=400 largepct=5 unicodepct=10 seed=7"));
+    TestEqual(TEXT("Options should be parsed"), Options.NumThreads, 3);
+    TestEqual(TEXT("Options should be parsed"), Options.MessagesPerThread, 400);
+
+    TArray<FsparklogsBenchmarkResult> Results;
+    {
+        FsparklogsBenchmark Benchmark(Options, ITLGetTestDir());
+        TestTrue(TEXT("All benchmark scenarios should succeed"), Benchmark.Run(FsparklogsBenchmark::ScenarioAll, Results));
+        TestFalse(TEXT("Unknown scenarios should fail"), Benchmark.Run(TEXT("bogus"), Results));
+    }
+    // Some scenarios report one result per variant (e.g., compress_gzip), so only check that each one reported something
+    for (const TCHAR* Scenario : { FsparklogsBenchmark::ScenarioSerialize, FsparklogsBenchmark::ScenarioAnalytics, FsparklogsBenchmark::ScenarioPayload, FsparklogsBenchmark::ScenarioCompress, FsparklogsBenchmark::ScenarioEndToEnd })
+    {
+        TestTrue(FString::Printf(TEXT("%s should report a result"), Scenario), Results.ContainsByPredicate([Scenario](const FsparklogsBenchmarkResult& R) { return R.Scenario.StartsWith(Scenario); }));
+    }
+    for (const FsparklogsBenchmarkResult& Result : Results)
+    {
+        TestTrue(FString::Printf(TEXT("%s should measure something"), *Result.Scenario), Result.Operations > 0 && Result.Bytes > 0 && Result.Seconds > 0);
+        TestTrue(FString::Printf(TEXT("%s should measure latencies"), *Result.Scenario), Result.Scenario == FsparklogsBenchmark::ScenarioPayload || Result.P50Ms >= 0);
+    }
+    const FsparklogsBenchmarkResult* EndToEnd = Results.FindByPredicate([](const FsparklogsBenchmarkResult& R) { return R.Scenario == FsparklogsBenchmark::ScenarioEndToEnd; });
+    TestTrue(TEXT("End-to-end latency should be measured"), EndToEnd != nullptr && EndToEnd->P99Ms >= EndToEnd->P50Ms && EndToEnd->MaxMs >= EndToEnd->P99Ms);
+    AddInfo(FsparklogsBenchmark::ResultsToNDJSON(Results));
+    return true;
+}
+#endif
@@ -9,12 +9,44 @@
 #include "Misc/OutputDeviceFile.h"
 #include "Misc/OutputDeviceHelper.h"
 #include "Misc/SecureHash.h"
+#include "Misc/Crc.h"
 #include "Misc/Base64.h"
 #include "ISettingsModule.h"
 #include "Interfaces/IPluginManager.h"
 #include "HAL/ThreadManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/ScopeRWLock.h"
+#include "Async/ParallelFor.h"
+#include "Async/Async.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "ProfilingDebugging/CountersTrace.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Parse.h"
 #include "Runtime/Launch/Resources/Version.h"
 
+// Select the vectorized kernels used to build payloads
+#if PLATFORM_CPU_X86_FAMILY && defined(PLATFORM_ALWAYS_HAS_AVX_2) && PLATFORM_ALWAYS_HAS_AVX_2
+	#define ITL_PAYLOAD_KERNEL_AVX2 1
+	#include <immintrin.h>
+#elif PLATFORM_CPU_X86_FAMILY && PLATFORM_ENABLE_VECTORINTRINSICS
+	#define ITL_PAYLOAD_KERNEL_SSE2 1
+	#include <emmintrin.h>
+#elif PLATFORM_CPU_ARM_FAMILY && PLATFORM_ENABLE_VECTORINTRINSICS_NEON
+	#define ITL_PAYLOAD_KERNEL_NEON 1
+	#include <arm_neon.h>
+#endif
+#ifndef ITL_PAYLOAD_KERNEL_AVX2
+#define ITL_PAYLOAD_KERNEL_AVX2 0
+#endif
+#ifndef ITL_PAYLOAD_KERNEL_SSE2
+#define ITL_PAYLOAD_KERNEL_SSE2 0
+#endif
+#ifndef ITL_PAYLOAD_KERNEL_NEON
+#define ITL_PAYLOAD_KERNEL_NEON 0
+#endif
+
 #ifndef ALLOW_LOG_FILE
 #define ALLOW_LOG_FILE 1
 #endif
@@ -30,23 +62,144 @@
 #include "Trace/LZ4/lz4.c.inl"
 #undef LZ4_NAMESPACE
 
+THIRD_PARTY_INCLUDES_START
+#include "zlib.h"
+THIRD_PARTY_INCLUDES_END
+
 
 #define LOCTEXT_NAMESPACE "FsparklogsModule"
 
 DEFINE_LOG_CATEGORY(LogPluginSparkLogs);
 
+DECLARE_STATS_GROUP(TEXT("SparkLogs"), STATGROUP_SparkLogs, STATCAT_Advanced);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Wake To Send Latency (ms)"), STAT_SparkLogsWakeToSendLatencyMs, STATGROUP_SparkLogs);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Payload Compression Ratio"), STAT_SparkLogsPayloadCompressionRatio, STATGROUP_SparkLogs);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Payload Compress Time (ms)"), STAT_SparkLogsPayloadCompressTimeMs, STATGROUP_SparkLogs);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Payload Build Time (ms)"), STAT_SparkLogsPayloadBuildTimeMs, STATGROUP_SparkLogs);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("HTTP Request Time (ms)"), STAT_SparkLogsHttpRequestTimeMs, STATGROUP_SparkLogs);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Log Bytes Written/sec"), STAT_SparkLogsBytesWrittenPerSec, STATGROUP_SparkLogs);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Log Lines Written/sec"), STAT_SparkLogsLinesWrittenPerSec, STATGROUP_SparkLogs);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Log Backlog (KB)"), STAT_SparkLogsLogBacklogKB, STATGROUP_SparkLogs);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Analytics Backlog (KB)"), STAT_SparkLogsAnalyticsBacklogKB, STATGROUP_SparkLogs);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Successful Flushes"), STAT_SparkLogsSuccessfulFlushes, STATGROUP_SparkLogs);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Retried Flushes"), STAT_SparkLogsRetriedFlushes, STATGROUP_SparkLogs);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Dropped Payloads"), STAT_SparkLogsDroppedPayloads, STATGROUP_SparkLogs);
+DECLARE_MEMORY_STAT(TEXT("Streamer Buffer Memory"), STAT_SparkLogsStreamerBufferMemory, STATGROUP_SparkLogs);
+
+// Lets the shipping pipeline be isolated in Unreal Insights (e.g., -trace=cpu,counters,SparkLogs)
+UE_TRACE_CHANNEL_DEFINE(SparkLogsChannel);
+#define ITL_TRACE_SCOPE(Name) TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL(Name, SparkLogsChannel)
+TRACE_DECLARE_INT_COUNTER(SparkLogsLogBacklogBytes, TEXT("SparkLogs/Log Backlog Bytes"));
+TRACE_DECLARE_INT_COUNTER(SparkLogsAnalyticsBacklogBytes, TEXT("SparkLogs/Analytics Backlog Bytes"));
+TRACE_DECLARE_FLOAT_COUNTER(SparkLogsBytesWrittenPerSec, TEXT("SparkLogs/Bytes Written Per Sec"));
+TRACE_DECLARE_FLOAT_COUNTER(SparkLogsLinesWrittenPerSec, TEXT("SparkLogs/Lines Written Per Sec"));
+
 // =============== Globals ===============================================================================
 
 constexpr int GMaxLineLength = 512 * 1024;
+// The length of the window used to measure the rate of writes to the logfile
+constexpr double ITLWriteRateWindowSecs = 1.0;
 
 static uint8 UTF8ByteOrderMark[3] = {0xEF, 0xBB, 0xBF};
 constexpr uint8 CharInternalNewline = 0x1E; // Control code: RS (Record Separator)
 constexpr uint8 CharInternalJSONStart = 0x16; // Control code: SYN (Synchronous Idle)
 constexpr uint8 CharInternalJSONEnd = 0x17; // Control code: ETB (End of Transmission Block)
 static const TCHAR* StrCharInternalNewline = TEXT("\x1E");
+// Request header that identifies the payload format when it is not a plain array of events
+static const TCHAR* PayloadFormatHeader = TEXT("X-Payload-Format");
+// Response header that an endpoint uses to advertise which payload formats it accepts (comma-separated)
+static const TCHAR* AcceptPayloadFormatHeader = TEXT("X-Accept-Payload-Format");
+static const TCHAR* PayloadFormatCommonEnvelope = TEXT("common-envelope-v1");
 static const TCHAR* StrCharInternalJSONStart = TEXT("\x16");
 static const TCHAR* StrCharInternalJSONEnd = TEXT("\x17");
 
+// Starts a logfile written as binary records, in place of the UTF-8 byte order marker. Has no newline, so that it never completes a line of text.
+static uint8 ITLBinaryRecordSignature[8] = {0x89, 'S', 'L', 'R', 'E', 'C', 0x1A, 0x01};
+
+/** Header of one record in a logfile written as binary records (see FsparklogsSettings::SpoolBinaryRecords). It is followed by Length bytes with the
+  * fields of the event exactly as they go between the braces of its JSON object: the raw JSON fields and a comma (the first MessageOffset bytes),
+  * then "message": and the already escaped message. */
+struct FITLBinaryRecordHeader
+{
+	static constexpr uint16 MagicValue = 0x4C53;
+	/** Set on the records that continue a message too long for one record */
+	static constexpr uint8 FlagContinuation = 0x01;
+	/** Set if the raw JSON fields of the event did not fit in one record and were left out */
+	static constexpr uint8 FlagJSONDropped = 0x02;
+
+	uint16 Magic;
+	uint8 Flags;
+	/** The ELogVerbosity of a log message, or NoLogging for a raw event */
+	uint8 Severity;
+	uint32 Length;
+	uint32 MessageOffset;
+	uint32 Reserved;
+	/** When the record was written, in UTC FDateTime ticks */
+	int64 UTCTicks;
+};
+static_assert(sizeof(FITLBinaryRecordHeader) == 24, "FITLBinaryRecordHeader is written to the logfile as-is");
+
+// Every record (with its header) fits in the smallest read the streamer makes, so the next payload always has room for at least one whole record
+constexpr int32 ITLMaxBinaryRecordLen = FsparklogsSettings::MinAdaptiveBytesPerRequest;
+
+/** Copies the header of the record at the start of Data (which must have room for a header). Returns false if Data does not start with a valid record. */
+static FORCEINLINE bool ITLReadBinaryRecordHeader(const uint8* Data, FITLBinaryRecordHeader& OutHeader)
+{
+	FMemory::Memcpy(&OutHeader, Data, sizeof(OutHeader));
+	return OutHeader.Magic == FITLBinaryRecordHeader::MagicValue && OutHeader.Length <= (uint32)(ITLMaxBinaryRecordLen - sizeof(FITLBinaryRecordHeader)) && OutHeader.MessageOffset <= OutHeader.Length;
+}
+
+/** Returns where to resume reading after the damaged record at DamagedOffset in Data (DataLen bytes): the next signature or valid record header.
+  * Since a valid magic, length and message offset could also just be text, a header found this way must also have its reserved field zeroed.
+  * If there is none, returns the end of Data less the bytes that could still be the start of a header that was only partly read. */
+static int ITLResyncBinaryRecords(const uint8* Data, int DataLen, int DamagedOffset)
+{
+	int Offset = DamagedOffset + 1;
+	for (; Offset + (int)sizeof(FITLBinaryRecordHeader) <= DataLen; Offset++)
+	{
+		if (0 == std::memcmp(Data + Offset, ITLBinaryRecordSignature, sizeof(ITLBinaryRecordSignature)))
+		{
+			break;
+		}
+		FITLBinaryRecordHeader Header;
+		if (ITLReadBinaryRecordHeader(Data + Offset, Header) && Header.Reserved == 0)
+		{
+			break;
+		}
+	}
+	return Offset;
+}
+
+/** Whether the data at the start of Data (which must have room for a header) is neither a signature nor a valid record header. */
+static FORCEINLINE bool ITLIsDamagedBinaryRecord(const uint8* Data)
+{
+	FITLBinaryRecordHeader Header;
+	return 0 != std::memcmp(Data, ITLBinaryRecordSignature, sizeof(ITLBinaryRecordSignature)) && !ITLReadBinaryRecordHeader(Data, Header);
+}
+
+/** Returns how many bytes at the start of Data (DataLen bytes) are whole binary records and signatures, stopping at the first record that
+  * would end past MaxLen bytes or is damaged. Only reads the headers. */
+static int ITLMeasureBinaryRecords(const uint8* Data, int DataLen, int MaxLen)
+{
+	int Offset = 0;
+	const int Limit = FMath::Min(DataLen, MaxLen);
+	while (Offset < Limit)
+	{
+		if (Limit - Offset >= (int)sizeof(ITLBinaryRecordSignature) && 0 == std::memcmp(Data + Offset, ITLBinaryRecordSignature, sizeof(ITLBinaryRecordSignature)))
+		{
+			Offset += sizeof(ITLBinaryRecordSignature);
+			continue;
+		}
+		FITLBinaryRecordHeader Header;
+		if (Limit - Offset < (int)sizeof(Header) || !ITLReadBinaryRecordHeader(Data + Offset, Header) || (int)(sizeof(Header) + Header.Length) > Limit - Offset)
+		{
+			break;
+		}
+		Offset += sizeof(Header) + Header.Length;
+	}
+	return Offset;
+}
+
 #if !NO_LOGGING
 const FName SparkLogsCategoryName(LogPluginSparkLogs.GetCategoryName());
 #else
@@ -260,6 +413,45 @@ FString ITLParseHttpResponseCookies(FHttpResponsePtr Response)
 	return AllCookies;
 }
 
+double ITLParseRetryAfterSecs(const FString& HeaderValue)
+{
+	FString Value = HeaderValue.TrimStartAndEnd();
+	if (Value.IsEmpty())
+	{
+		return 0.0;
+	}
+	if (Value.IsNumeric())
+	{
+		return FMath::Max(0.0, FCString::Atod(*Value));
+	}
+	FDateTime RetryAt;
+	if (FDateTime::ParseHttpDate(Value, RetryAt))
+	{
+		return FMath::Max(0.0, (RetryAt - FDateTime::UtcNow()).GetTotalSeconds());
+	}
+	return 0.0;
+}
+
+FString ITLFormatTimezoneHeaderValue(const FTimespan& LocalOffset)
+{
+	int32 TotalMinutes = FMath::RoundToInt(LocalOffset.GetTotalMinutes());
+	int32 Hours = FMath::Abs(TotalMinutes) / 60;
+	int32 Minutes = FMath::Abs(TotalMinutes) % 60;
+	const TCHAR* Sign = (TotalMinutes >= 0) ? TEXT("+") : TEXT("-");
+	return FString::Printf(TEXT("UTC%s%02d:%02d"), Sign, Hours, Minutes);
+}
+
+void ITLTickGameThreadWhileWaiting(double DeltaTime)
+{
+	FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
+#if ENGINE_MAJOR_VERSION >= 5
+	FTSTicker::GetCoreTicker().Tick(DeltaTime);
+#else
+	FTicker::GetCoreTicker().Tick(DeltaTime);
+#endif
+	FThreadManager::Get().Tick();
+}
+
 FString ITLCalcUniqueFieldName(const TSharedPtr<FJsonObject> Object, const FString& BaseName, int HintStartingNum)
 {
 	if (HintStartingNum < 1)
@@ -423,6 +615,15 @@ FString GetITLPluginStateFilename(int InstanceIndex)
 	return Name;
 }
 
+// The most plugin instances that can run at once on the same host (each gets its own instance index)
+static constexpr int ITLMaxPluginInstances = 50;
+
+FString ITLGetIndexedLockBasePath()
+{
+	FString ParentDir = FPaths::GetPath(FPaths::ConvertRelativePathToFull(FGenericPlatformOutputDevices::GetAbsoluteLogFilename()));
+	return FPaths::Combine(ParentDir, GetITLLogFileName(TEXT("ops"), 0, false));
+}
+
 class FITLSparkLogsPluginIndexedLockInitializer
 {
 public:
@@ -431,9 +632,7 @@ public:
 	{
 		if (!IndexedLockFile)
 		{
-			FString ParentDir = FPaths::GetPath(FPaths::ConvertRelativePathToFull(FGenericPlatformOutputDevices::GetAbsoluteLogFilename()));
-			FString Path = FPaths::Combine(ParentDir, GetITLLogFileName(TEXT("ops"), 0, false));
-			IndexedLockFile = MakeUnique<FsparklogsIndexedLockFile>(50, Path);
+			IndexedLockFile = MakeUnique<FsparklogsIndexedLockFile>(ITLMaxPluginInstances, ITLGetIndexedLockBasePath());
 			return true;
 		}
 		else
@@ -500,6 +699,14 @@ FITLSparkLogsLogOutputDeviceFileInitializer& GetITLInternalGameLog(TSharedPtr<Fs
 	return Singleton;
 }
 
+FITLSparkLogsLogOutputDeviceFileInitializer& GetITLInternalAnalyticsLog(TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> CloudStreamer)
+{
+	static FITLSparkLogsLogOutputDeviceFileInitializer Singleton;
+	FString LogFileName = GetITLLogFileName(TEXT("analytics"), GetITLPluginIndexedLock().IndexedLockFile->GetLockIndex(), true);
+	Singleton.InitLogDevice(*LogFileName, CloudStreamer);
+	return Singleton;
+}
+
 FITLLogOutputDeviceFileInitializer& GetITLInternalOpsLog()
 {
 	static FITLLogOutputDeviceFileInitializer Singleton;
@@ -512,6 +719,274 @@ FITLLogOutputDeviceFileInitializer& GetITLInternalOpsLog()
 	return Singleton;
 }
 
+// LZ4 frame format constants (see the LZ4 frame format description, v1.6.x)
+static constexpr uint32 ITLLZ4FrameMagic = 0x184D2204;
+static constexpr uint8 ITLLZ4FrameFLGVersion = 0x40;
+static constexpr uint8 ITLLZ4FrameFLGBlockIndependence = 0x20;
+static constexpr uint8 ITLLZ4FrameFLGBlockChecksum = 0x10;
+static constexpr uint8 ITLLZ4FrameFLGContentSize = 0x08;
+static constexpr uint8 ITLLZ4FrameFLGContentChecksum = 0x04;
+static constexpr uint8 ITLLZ4FrameFLGDictID = 0x01;
+static constexpr uint8 ITLLZ4FrameBD64KB = 0x40;
+static constexpr uint32 ITLLZ4FrameUncompressedBlockFlag = 0x80000000U;
+static constexpr int ITLLZ4FrameMaxDictSize = 64 * 1024;
+
+static FORCEINLINE void ITLWriteLE32(uint8* Dest, uint32 Value)
+{
+	Dest[0] = (uint8)(Value & 0xFF);
+	Dest[1] = (uint8)((Value >> 8) & 0xFF);
+	Dest[2] = (uint8)((Value >> 16) & 0xFF);
+	Dest[3] = (uint8)((Value >> 24) & 0xFF);
+}
+
+static FORCEINLINE uint32 ITLReadLE32(const uint8* Src)
+{
+	return (uint32)Src[0] | ((uint32)Src[1] << 8) | ((uint32)Src[2] << 16) | ((uint32)Src[3] << 24);
+}
+
+static FORCEINLINE void ITLSetNumNoShrink(TArray<uint8>& Data, int32 NewNum)
+{
+#if (ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 4))
+	Data.SetNumUninitialized(NewNum, EAllowShrinking::No);
+#else
+	Data.SetNumUninitialized(NewNum, false);
+#endif
+}
+
+/** XXH32 with a seed of 0 for inputs shorter than 16 bytes, used for the LZ4 frame header checksum. */
+static uint32 ITLXXH32Short(const uint8* Data, int Len)
+{
+	constexpr uint32 Prime1 = 2654435761U, Prime2 = 2246822519U, Prime3 = 3266489917U, Prime4 = 668265263U, Prime5 = 374761393U;
+	check(Len < 16);
+	uint32 H = Prime5 + (uint32)Len;
+	int i = 0;
+	for (; i + 4 <= Len; i += 4)
+	{
+		H += ITLReadLE32(Data + i) * Prime3;
+		H = ((H << 17) | (H >> 15)) * Prime4;
+	}
+	for (; i < Len; i++)
+	{
+		H += Data[i] * Prime5;
+		H = ((H << 11) | (H >> 21)) * Prime1;
+	}
+	H ^= H >> 15;
+	H *= Prime2;
+	H ^= H >> 13;
+	H *= Prime3;
+	H ^= H >> 16;
+	return H;
+}
+
+FITLLZ4FrameCompressor::FITLLZ4FrameCompressor()
+	: Stream(ITLLZ4::LZ4_createStream())
+	, FrameInputLen(0)
+{
+	ITLSetNumNoShrink(Dictionary, ITLLZ4FrameMaxDictSize);
+}
+
+FITLLZ4FrameCompressor::~FITLLZ4FrameCompressor()
+{
+	if (Stream != nullptr)
+	{
+		ITLLZ4::LZ4_freeStream((ITLLZ4::LZ4_stream_t*)Stream);
+		Stream = nullptr;
+	}
+}
+
+void FITLLZ4FrameCompressor::BeginFrame(TArray<uint8>& OutData)
+{
+	if (Stream != nullptr)
+	{
+		ITLLZ4::LZ4_loadDict((ITLLZ4::LZ4_stream_t*)Stream, nullptr, 0);
+	}
+	FrameInputLen = 0;
+	// Linked blocks with no checksums or content size, since the original length is sent out-of-band.
+	uint8 Header[7];
+	ITLWriteLE32(Header, ITLLZ4FrameMagic);
+	Header[4] = ITLLZ4FrameFLGVersion;
+	Header[5] = ITLLZ4FrameBD64KB;
+	Header[6] = (uint8)((ITLXXH32Short(Header + 4, 2) >> 8) & 0xFF);
+	ITLSetNumNoShrink(OutData, 0);
+	OutData.Append(Header, UE_ARRAY_COUNT(Header));
+}
+
+bool FITLLZ4FrameCompressor::CompressBlock(const uint8* InData, int InDataLen, TArray<uint8>& OutData)
+{
+	if (InDataLen <= 0)
+	{
+		// no-op
+		return true;
+	}
+	if (Stream == nullptr || InDataLen > BlockSize)
+	{
+		return false;
+	}
+	const int BlockHeaderPos = OutData.Num();
+	const int CompressedBound = ITLLZ4::LZ4_compressBound(InDataLen);
+	ITLSetNumNoShrink(OutData, BlockHeaderPos + 4 + CompressedBound);
+	uint8* BlockData = OutData.GetData() + BlockHeaderPos + 4;
+	int CompressedSize = ITLLZ4::LZ4_compress_fast_continue((ITLLZ4::LZ4_stream_t*)Stream, (const char*)InData, (char*)BlockData, InDataLen, CompressedBound, 1);
+	if (CompressedSize <= 0)
+	{
+		ITLSetNumNoShrink(OutData, BlockHeaderPos);
+		return false;
+	}
+	uint32 BlockHeader = (uint32)CompressedSize;
+	if (CompressedSize >= InDataLen)
+	{
+		// Incompressible, store the block as-is. The decoder still uses it as history for the next block.
+		FMemory::Memcpy(BlockData, InData, InDataLen);
+		CompressedSize = InDataLen;
+		BlockHeader = (uint32)InDataLen | ITLLZ4FrameUncompressedBlockFlag;
+	}
+	ITLWriteLE32(OutData.GetData() + BlockHeaderPos, BlockHeader);
+	ITLSetNumNoShrink(OutData, BlockHeaderPos + 4 + CompressedSize);
+	// The caller may overwrite the input after this returns, so keep our own copy of the history.
+	ITLLZ4::LZ4_saveDict((ITLLZ4::LZ4_stream_t*)Stream, (char*)Dictionary.GetData(), Dictionary.Num());
+	FrameInputLen += InDataLen;
+	return true;
+}
+
+void FITLLZ4FrameCompressor::EndFrame(TArray<uint8>& OutData)
+{
+	const uint8 EndMark[4] = { 0, 0, 0, 0 };
+	OutData.Append(EndMark, UE_ARRAY_COUNT(EndMark));
+}
+
+/** Decompresses a single LZ4 frame. Supports the standard frame options, although FITLLZ4FrameCompressor only produces linked blocks without checksums. */
+static bool ITLDecompressLZ4Frame(const uint8* InData, int InDataLen, int InOriginalDataLen, TArray<uint8>& OutData)
+{
+	ITLSetNumNoShrink(OutData, FMath::Max(0, InOriginalDataLen));
+	if (InDataLen < 7 || ITLReadLE32(InData) != ITLLZ4FrameMagic)
+	{
+		return false;
+	}
+	const uint8 FLG = InData[4];
+	if ((FLG & 0xC0) != ITLLZ4FrameFLGVersion)
+	{
+		return false;
+	}
+	int Pos = 6 + ((FLG & ITLLZ4FrameFLGContentSize) ? 8 : 0) + ((FLG & ITLLZ4FrameFLGDictID) ? 4 : 0) + 1;
+	const bool bIndependentBlocks = (FLG & ITLLZ4FrameFLGBlockIndependence) != 0;
+	const int BlockChecksumLen = (FLG & ITLLZ4FrameFLGBlockChecksum) ? 4 : 0;
+	int OutPos = 0;
+	while (true)
+	{
+		if (Pos + 4 > InDataLen)
+		{
+			return false;
+		}
+		const uint32 BlockHeader = ITLReadLE32(InData + Pos);
+		Pos += 4;
+		if (BlockHeader == 0)
+		{
+			// End mark (any content checksum that follows is not verified)
+			break;
+		}
+		const int BlockLen = (int)(BlockHeader & ~ITLLZ4FrameUncompressedBlockFlag);
+		if (BlockLen > InDataLen - Pos)
+		{
+			return false;
+		}
+		int DecompressedBytes = 0;
+		if ((BlockHeader & ITLLZ4FrameUncompressedBlockFlag) != 0)
+		{
+			if (BlockLen > OutData.Num() - OutPos)
+			{
+				return false;
+			}
+			FMemory::Memcpy(OutData.GetData() + OutPos, InData + Pos, BlockLen);
+			DecompressedBytes = BlockLen;
+		}
+		else
+		{
+			const int DictStart = bIndependentBlocks ? OutPos : FMath::Max(0, OutPos - ITLLZ4FrameMaxDictSize);
+			DecompressedBytes = ITLLZ4::LZ4_decompress_safe_usingDict((const char*)(InData + Pos), (char*)(OutData.GetData() + OutPos), BlockLen, OutData.Num() - OutPos, (const char*)(OutData.GetData() + DictStart), OutPos - DictStart);
+			if (DecompressedBytes < 0)
+			{
+				return false;
+			}
+		}
+		OutPos += DecompressedBytes;
+		Pos += BlockLen + BlockChecksumLen;
+	}
+	ITLSetNumNoShrink(OutData, OutPos);
+	return true;
+}
+
+// Window bits for the zlib stream, plus 16 to use the gzip wrapper instead of the zlib wrapper
+static constexpr int ITLGzipWindowBits = 15 + 16;
+
+FITLGzipCompressor::FITLGzipCompressor(int InLevel)
+	: ZStream(new z_stream())
+	, ZStreamInitialized(false)
+	, Level(InLevel)
+{
+}
+
+FITLGzipCompressor::~FITLGzipCompressor()
+{
+	z_stream* Stream = (z_stream*)ZStream;
+	if (ZStreamInitialized)
+	{
+		deflateEnd(Stream);
+	}
+	delete Stream;
+	ZStream = nullptr;
+}
+
+bool FITLGzipCompressor::Compress(const uint8* InData, int InDataLen, TArray<uint8>& OutData)
+{
+	z_stream* Stream = (z_stream*)ZStream;
+	if (!ZStreamInitialized)
+	{
+		FMemory::Memzero(Stream, sizeof(z_stream));
+		if (deflateInit2(Stream, Level, Z_DEFLATED, ITLGzipWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			return false;
+		}
+		ZStreamInitialized = true;
+	}
+	else if (deflateReset(Stream) != Z_OK)
+	{
+		return false;
+	}
+	const int CompressedBound = (int)deflateBound(Stream, (uLong)InDataLen);
+	ITLSetNumNoShrink(OutData, CompressedBound);
+	Stream->next_in = (Bytef*)InData;
+	Stream->avail_in = (uInt)InDataLen;
+	Stream->next_out = (Bytef*)OutData.GetData();
+	Stream->avail_out = (uInt)CompressedBound;
+	if (deflate(Stream, Z_FINISH) != Z_STREAM_END)
+	{
+		ITLSetNumNoShrink(OutData, 0);
+		return false;
+	}
+	ITLSetNumNoShrink(OutData, (int32)Stream->total_out);
+	return true;
+}
+
+static bool ITLDecompressGzip(const uint8* InData, int InDataLen, int InOriginalDataLen, TArray<uint8>& OutData)
+{
+	// zlib rejects a null output pointer, so always have at least one byte of space
+	ITLSetNumNoShrink(OutData, FMath::Max(1, InOriginalDataLen));
+	z_stream Stream;
+	FMemory::Memzero(&Stream, sizeof(Stream));
+	if (inflateInit2(&Stream, ITLGzipWindowBits) != Z_OK)
+	{
+		return false;
+	}
+	Stream.next_in = (Bytef*)InData;
+	Stream.avail_in = (uInt)InDataLen;
+	Stream.next_out = (Bytef*)OutData.GetData();
+	Stream.avail_out = (uInt)OutData.Num();
+	int Result = inflate(&Stream, Z_FINISH);
+	ITLSetNumNoShrink(OutData, (int32)Stream.total_out);
+	inflateEnd(&Stream);
+	return Result == Z_STREAM_END;
+}
+
 bool ITLCompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen, TArray<uint8>& OutData)
 {
 	int32 CompressedBufSize = 0;
@@ -545,6 +1020,25 @@ bool ITLCompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen
 		OutData.SetNumUninitialized(CompressedSize, false);
 #endif
 		return true;
+	case ITLCompressionMode::LZ4Frame:
+	{
+		FITLLZ4FrameCompressor Compressor;
+		Compressor.BeginFrame(OutData);
+		for (int Offset = 0; Offset < InDataLen; Offset += FITLLZ4FrameCompressor::BlockSize)
+		{
+			if (!Compressor.CompressBlock(InData + Offset, FMath::Min(FITLLZ4FrameCompressor::BlockSize, InDataLen - Offset), OutData))
+			{
+				return false;
+			}
+		}
+		Compressor.EndFrame(OutData);
+		return true;
+	}
+	case ITLCompressionMode::Gzip:
+	{
+		FITLGzipCompressor Compressor;
+		return Compressor.Compress(InData, InDataLen, OutData);
+	}
 	case ITLCompressionMode::None:
 #if (ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 4))
 		OutData.SetNumUninitialized(0, EAllowShrinking::No);
@@ -585,6 +1079,10 @@ bool ITLDecompressData(ITLCompressionMode Mode, const uint8* InData, int InDataL
 		OutData.SetNumUninitialized(DecompressedBytes, false);
 #endif
 		return true;
+	case ITLCompressionMode::LZ4Frame:
+		return ITLDecompressLZ4Frame(InData, InDataLen, InOriginalDataLen, OutData);
+	case ITLCompressionMode::Gzip:
+		return ITLDecompressGzip(InData, InDataLen, InOriginalDataLen, OutData);
 	case ITLCompressionMode::None:
 #if (ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 4))
 		OutData.SetNumUninitialized(0, EAllowShrinking::No);
@@ -644,6 +1142,15 @@ FString ITLGetIndexedStateFileINI(int InstanceIndex)
 	}
 }
 
+FString ITLGetProgressJournalPath(const FString& StateFileINI, ITLStreamLane Lane)
+{
+	if (StateFileINI == GGameUserSettingsIni)
+	{
+		return FString();
+	}
+	return FPaths::ChangeExtension(StateFileINI, Lane == ITLStreamLane::Analytics ? TEXT("analytics.journal") : TEXT("journal"));
+}
+
 class FITLSparkLogsPluginCriticalSectionInitializer
 {
 public:
@@ -683,6 +1190,33 @@ FsparklogsSettings::FsparklogsSettings(int InInstanceIndex)
 	, BytesPerRequest(DefaultBytesPerRequest)
 	, ProcessingIntervalSecs(DefaultServerProcessingIntervalSecs)
 	, RetryIntervalSecs(DefaultRetryIntervalSecs)
+	, MaxInFlightRequests(DefaultMaxInFlightRequests)
+	, AdaptiveRequestSizing(DefaultAdaptiveRequestSizing)
+	, TargetRequestLatencySecs(DefaultTargetRequestLatencySecs)
+	, LogCaptureRingBytes(DefaultLogCaptureRingBytes)
+	, MapSourceLogFile(DefaultMapSourceLogFile)
+	, CatchUpParallelism(DefaultCatchUpParallelism)
+	, AnalyticsLane(DefaultAnalyticsLane)
+	, AnalyticsProcessingIntervalSecs(DefaultAnalyticsProcessingIntervalSecs)
+	, AnalyticsUnflushedBytesToAutoFlush(DefaultAnalyticsUnflushedBytesToAutoFlush)
+	, MaxLogBacklogBytes(DefaultMaxLogBacklogBytes)
+	, LogRateLimitLinesPerSec(DefaultLogRateLimitLinesPerSec)
+	, LogRateLimitBurstLines(DefaultLogRateLimitBurstLines)
+	, CoalesceRepeatedLogLines(DefaultCoalesceRepeatedLogLines)
+	, AsyncStartup(DefaultAsyncStartup)
+	, StartupPreBufferBytes(DefaultStartupPreBufferBytes)
+	, HostAgent(DefaultHostAgent)
+	, SpoolSegmentBytes(DefaultSpoolSegmentBytes)
+	, SpoolMaxDiskBytes(DefaultSpoolMaxDiskBytes)
+	, SpoolBinaryRecords(DefaultSpoolBinaryRecords)
+	, MemoryBudgetBytes(DefaultMemoryBudgetBytes)
+	, MemoryBudgetIdleReleaseSecs(DefaultMemoryBudgetIdleReleaseSecs)
+	, PreWarmConnection(DefaultPreWarmConnection)
+	, ShutdownFlushBudgetSecs(DefaultShutdownFlushBudgetSecs)
+	, BackgroundFlushBudgetSecs(DefaultBackgroundFlushBudgetSecs)
+	, AnalyticsAggregationWindowSecs(DefaultAnalyticsAggregationWindowSecs)
+	, AnalyticsAggregationMaxKeys(DefaultAnalyticsAggregationMaxKeys)
+	, MirrorMaxLagBytes(DefaultMirrorMaxLagBytes)
 	, UnflushedBytesToAutoFlush(DefaultUnflushedBytesToAutoFlush)
 	, IncludeCommonMetadata(DefaultIncludeCommonMetadata)
 	, DebugLogForAnalyticsEvents(DefaultServerDebugLogForAnalyticsEvents)
@@ -696,12 +1230,26 @@ FsparklogsSettings::FsparklogsSettings(int InInstanceIndex)
 	, CachedAnalyticsInstallTime(ITLEmptyDateTime)
 	, CachedAnalyticsSessionNumber(0)
 	, CachedAnalyticsTransactionNumber(0)
+	, ReservedAnalyticsTransactionNumber(0)
 	, CachedAnalyticsFirstPurchased(ITLEmptyDateTime)
 	, CachedAnalyticsLastEvent(ITLEmptyDateTime)
+	, AnalyticsStateFlushDeadline(0.0)
 {
 	InstanceSettingsIni = ITLGetIndexedStateFileINI(InstanceIndex);
 }
 
+FsparklogsSettings::~FsparklogsSettings()
+{
+	// Nothing written behind may be lost, e.g., when the final changes were made after the module stopped ticking
+	if (GConfig != nullptr)
+	{
+		FScopeLock WriteLock(&CachedCriticalSection);
+		ReleaseTransactionNumberReservation();
+		WriteLock.Unlock();
+		FlushAnalyticsState();
+	}
+}
+
 FString FsparklogsSettings::GetEffectiveHttpEndpointURI(const FString& OverrideHTTPEndpointURI)
 {
 	CloudRegion.TrimStartAndEndInline();
@@ -743,9 +1291,8 @@ FString FsparklogsSettings::GetEffectiveAnalyticsUserID()
 	}
 
 	// If we have previously calculated an ID (whether custom or auto-generated), reuse that same user ID from the previous game engine instance.
-	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-	FString NewID = GConfig->GetStr(ITL_CONFIG_SECTION_NAME, UserIDKey, InstanceSettingsIni);
-	ConfigLock1.Unlock();
+	FString NewID;
+	GetAnalyticsState(UserIDKey, NewID);
 	NewID.TrimStartAndEndInline();
 	if (!IsValidDeviceID(NewID))
 	{
@@ -758,23 +1305,22 @@ FString FsparklogsSettings::GetEffectiveAnalyticsUserID()
 	}
 	
 	// If another method hasn't given us a valid ID yet then generate and save a new one.
+	bool Generated = false;
 	if (!IsValidDeviceID(NewID))
 	{
 		NewID = ITLGenerateNewRandomID();
-		FScopeLock ConfigLock2(GetITLPluginConfigCriticalSection().CS.Get());
-		bool WasDisabled = GConfig->AreFileOperationsDisabled();
-		GConfig->EnableFileOperations();
-		GConfig->SetString(ITL_CONFIG_SECTION_NAME, UserIDKey, *NewID, InstanceSettingsIni);
-		GConfig->Flush(false, InstanceSettingsIni);
-		if (WasDisabled)
-		{
-			GConfig->DisableFileOperations();
-		}
+		QueueAnalyticsState(UserIDKey, &NewID);
+		Generated = true;
 	}
 	
 	CachedAnalyticsUserID = NewID;
 	// Whenever the user ID changes, the player ID must be recalculated...
 	CachedAnalyticsPlayerID.Reset();
+	WriteLock.Unlock();
+	if (Generated)
+	{
+		FlushAnalyticsState();
+	}
 	return NewID;
 }
 
@@ -814,28 +1360,26 @@ FDateTime FsparklogsSettings::GetEffectiveAnalyticsInstallTime()
 		return CachedAnalyticsInstallTime;
 	}
 	constexpr const TCHAR* InstallTimeKey = TEXT("AnalyticsInstallTime");
-	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get()); 
-	FString TimeStr = GConfig->GetStr(ITL_CONFIG_SECTION_NAME, InstallTimeKey, InstanceSettingsIni);
-	ConfigLock1.Unlock();
+	FString TimeStr;
+	GetAnalyticsState(InstallTimeKey, TimeStr);
 	TimeStr.TrimStartAndEndInline();
 	FDateTime InstallTime = ITLParseDateTime(TimeStr);
+	bool Changed = false;
 	if (InstallTime == ITLEmptyDateTime)
 	{
 		InstallTime = FDateTime::UtcNow();
 		int64 Ts = InstallTime.GetTicks();
 		TimeStr = FString::Printf(TEXT("%lld"), Ts);
-		FScopeLock ConfigLock2(GetITLPluginConfigCriticalSection().CS.Get()); 
-		bool WasDisabled = GConfig->AreFileOperationsDisabled();
-		GConfig->EnableFileOperations();
-		GConfig->SetString(ITL_CONFIG_SECTION_NAME, InstallTimeKey, *TimeStr, InstanceSettingsIni);
-		GConfig->Flush(false, InstanceSettingsIni);
-		if (WasDisabled)
-		{
-			GConfig->DisableFileOperations();
-		}
+		QueueAnalyticsState(InstallTimeKey, &TimeStr);
+		Changed = true;
 	}
 	
 	CachedAnalyticsInstallTime = InstallTime;
+	WriteLock1.Unlock();
+	if (Changed)
+	{
+		FlushAnalyticsState();
+	}
 	return InstallTime;
 }
 
@@ -844,15 +1388,9 @@ void FsparklogsSettings::SetUserID(const TCHAR* UserID)
 	FScopeLock WriteLock(&CachedCriticalSection);
 	CachedAnalyticsUserID = UserID;
 	CachedAnalyticsPlayerID.Reset();
-	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-	bool WasDisabled = GConfig->AreFileOperationsDisabled();
-	GConfig->EnableFileOperations();
-	GConfig->SetString(ITL_CONFIG_SECTION_NAME, UserIDKey, *CachedAnalyticsUserID, InstanceSettingsIni);
-	GConfig->Flush(false, InstanceSettingsIni);
-	if (WasDisabled)
-	{
-		GConfig->DisableFileOperations();
-	}
+	QueueAnalyticsState(UserIDKey, &CachedAnalyticsUserID);
+	WriteLock.Unlock();
+	FlushAnalyticsState();
 }
 
 int FsparklogsSettings::GetSessionNumber(bool Increment)
@@ -862,8 +1400,7 @@ int FsparklogsSettings::GetSessionNumber(bool Increment)
 	FScopeLock WriteLock(&CachedCriticalSection);
 	if (CachedAnalyticsSessionNumber <= 0)
 	{
-		FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-		if (!GConfig->GetInt(ITL_CONFIG_SECTION_NAME, Key, CachedAnalyticsSessionNumber, InstanceSettingsIni) || CachedAnalyticsSessionNumber <= 0)
+		if (!GetAnalyticsState(Key, CachedAnalyticsSessionNumber) || CachedAnalyticsSessionNumber <= 0)
 		{
 			CachedAnalyticsSessionNumber = 1;
 			Changed = true;
@@ -877,15 +1414,8 @@ int FsparklogsSettings::GetSessionNumber(bool Increment)
 	}
 	if (Changed)
 	{
-		FScopeLock ConfigLock2(GetITLPluginConfigCriticalSection().CS.Get());
-		bool WasDisabled = GConfig->AreFileOperationsDisabled();
-		GConfig->EnableFileOperations();
-		GConfig->SetInt(ITL_CONFIG_SECTION_NAME, Key, CachedAnalyticsSessionNumber, InstanceSettingsIni);
-		GConfig->Flush(false, InstanceSettingsIni);
-		if (WasDisabled)
-		{
-			GConfig->DisableFileOperations();
-		}
+		// Written along with the start of the session by MarkStartOfAnalyticsSession
+		QueueAnalyticsState(Key, CachedAnalyticsSessionNumber);
 	}
 	return CachedAnalyticsSessionNumber;
 }
@@ -893,36 +1423,45 @@ int FsparklogsSettings::GetSessionNumber(bool Increment)
 int FsparklogsSettings::GetTransactionNumber(bool Increment)
 {
 	constexpr const TCHAR* Key = TEXT("AnalyticsTransactionNumber");
-	bool Changed = false;
+	// Taken first, so that no other thread can return a number of a new reservation before it is written
+	FScopeLock FlushLock(&AnalyticsStateFlushCriticalSection);
 	FScopeLock WriteLock(&CachedCriticalSection);
 	if (CachedAnalyticsTransactionNumber <= 0)
 	{
-		FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-		if (!GConfig->GetInt(ITL_CONFIG_SECTION_NAME, Key, CachedAnalyticsTransactionNumber, InstanceSettingsIni) || CachedAnalyticsTransactionNumber <= 0)
+		ReservedAnalyticsTransactionNumber = 0;
+		if (!GetAnalyticsState(Key, CachedAnalyticsTransactionNumber) || CachedAnalyticsTransactionNumber <= 0)
 		{
 			CachedAnalyticsTransactionNumber = 1;
-			Changed = true;
 			Increment = false;
 		}
+		else
+		{
+			// After a crash this skips whatever was left of the reservation
+			ReservedAnalyticsTransactionNumber = CachedAnalyticsTransactionNumber;
+		}
 	}
 	if (Increment)
 	{
 		CachedAnalyticsTransactionNumber++;
-		Changed = true;
 	}
-	if (Changed)
+	const int TransactionNumber = CachedAnalyticsTransactionNumber;
+	if (TransactionNumber > ReservedAnalyticsTransactionNumber)
 	{
-		FScopeLock ConfigLock2(GetITLPluginConfigCriticalSection().CS.Get());
-		bool WasDisabled = GConfig->AreFileOperationsDisabled();
-		GConfig->EnableFileOperations();
-		GConfig->SetInt(ITL_CONFIG_SECTION_NAME, Key, CachedAnalyticsTransactionNumber, InstanceSettingsIni);
-		GConfig->Flush(false, InstanceSettingsIni);
-		if (WasDisabled)
-		{
-			GConfig->DisableFileOperations();
-		}
+		ReservedAnalyticsTransactionNumber = TransactionNumber + AnalyticsTransactionNumbersReserved - 1;
+		QueueAnalyticsState(Key, ReservedAnalyticsTransactionNumber);
+		WriteLock.Unlock();
+		FlushAnalyticsState();
+	}
+	return TransactionNumber;
+}
+
+void FsparklogsSettings::ReleaseTransactionNumberReservation()
+{
+	if (CachedAnalyticsTransactionNumber > 0 && ReservedAnalyticsTransactionNumber > CachedAnalyticsTransactionNumber)
+	{
+		ReservedAnalyticsTransactionNumber = CachedAnalyticsTransactionNumber;
+		QueueAnalyticsState(TEXT("AnalyticsTransactionNumber"), CachedAnalyticsTransactionNumber);
 	}
-	return CachedAnalyticsTransactionNumber;
 }
 
 FDateTime FsparklogsSettings::GetAnalyticsFirstPurchased()
@@ -932,9 +1471,8 @@ FDateTime FsparklogsSettings::GetAnalyticsFirstPurchased()
 	{
 		return CachedAnalyticsFirstPurchased;
 	}
-	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-	FString TimeStr = GConfig->GetStr(ITL_CONFIG_SECTION_NAME, AnalyticsFirstPurchasedKey, InstanceSettingsIni);
-	ConfigLock1.Unlock();
+	FString TimeStr;
+	GetAnalyticsState(AnalyticsFirstPurchasedKey, TimeStr);
 	TimeStr.TrimStartAndEndInline();
 	CachedAnalyticsFirstPurchased = ITLParseDateTime(TimeStr);
 	return CachedAnalyticsFirstPurchased;
@@ -945,16 +1483,11 @@ void FsparklogsSettings::SetAnalyticsFirstPurchased(FDateTime T)
 	FScopeLock WriteLock(&CachedCriticalSection);
 	int64 Ts = T.GetTicks();
 	FString TimeStr = FString::Printf(TEXT("%lld"), Ts);
-	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-	bool WasDisabled = GConfig->AreFileOperationsDisabled();
-	GConfig->EnableFileOperations();
-	GConfig->SetString(ITL_CONFIG_SECTION_NAME, AnalyticsFirstPurchasedKey, *TimeStr, InstanceSettingsIni);
-	GConfig->Flush(false, InstanceSettingsIni);
-	if (WasDisabled)
-	{
-		GConfig->DisableFileOperations();
-	}
+	QueueAnalyticsState(AnalyticsFirstPurchasedKey, &TimeStr);
 	CachedAnalyticsFirstPurchased = T;
+	WriteLock.Unlock();
+	// Otherwise a crash before it is written behind would report the next purchase as the first one again
+	FlushAnalyticsState();
 }
 
 int FsparklogsSettings::GetAttemptNumber(const FString& EventID, bool Increment, bool DeleteAfter)
@@ -967,8 +1500,7 @@ int FsparklogsSettings::GetAttemptNumber(const FString& EventID, bool Increment,
 	int* CachedValuePtr = CachedAnalyticsAttemptNumber.Find(MapKey);
 	if (CachedValuePtr == nullptr)
 	{
-		FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-		if (!GConfig->GetInt(ITL_CONFIG_SECTION_NAME, *Key, CachedValue, InstanceSettingsIni) || CachedValue <= 0)
+		if (!GetAnalyticsState(Key, CachedValue) || CachedValue <= 0)
 		{
 			CachedValue = 0;
 			Changed = true;
@@ -984,24 +1516,21 @@ int FsparklogsSettings::GetAttemptNumber(const FString& EventID, bool Increment,
 		CachedValue++;
 		Changed = true;
 	}
-	FScopeLock ConfigLock2(GetITLPluginConfigCriticalSection().CS.Get());
-	bool WasDisabled = GConfig->AreFileOperationsDisabled();
-	GConfig->EnableFileOperations();
 	if (DeleteAfter)
 	{
 		CachedAnalyticsAttemptNumber.Remove(MapKey);
-		GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, *Key, InstanceSettingsIni);
-		GConfig->Flush(false, InstanceSettingsIni);
+		QueueAnalyticsState(Key, nullptr);
 	}
 	else if (Changed)
 	{
 		CachedAnalyticsAttemptNumber.Emplace(MapKey, CachedValue);
-		GConfig->SetInt(ITL_CONFIG_SECTION_NAME, *Key, CachedValue, InstanceSettingsIni);
-		GConfig->Flush(false, InstanceSettingsIni);
+		QueueAnalyticsState(Key, CachedValue);
 	}
-	if (WasDisabled)
+	if (Increment || DeleteAfter)
 	{
-		GConfig->DisableFileOperations();
+		WriteLock.Unlock();
+		// Otherwise a crash before it is written behind would hand out the same attempt number again
+		FlushAnalyticsState();
 	}
 	return CachedValue;
 }
@@ -1013,9 +1542,8 @@ FDateTime FsparklogsSettings::GetEffectiveLastWrittenAnalyticsEvent()
 	{
 		return CachedAnalyticsLastEvent;
 	}
-	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-	FString TimeStr = GConfig->GetStr(ITL_CONFIG_SECTION_NAME, AnalyticsLastWrittenKey, InstanceSettingsIni);
-	ConfigLock1.Unlock();
+	FString TimeStr;
+	GetAnalyticsState(AnalyticsLastWrittenKey, TimeStr);
 	TimeStr.TrimStartAndEndInline();
 	FDateTime LastEvent = ITLParseDateTime(TimeStr);
 	CachedAnalyticsLastEvent = LastEvent;
@@ -1030,7 +1558,7 @@ void FsparklogsSettings::MarkLastWrittenAnalyticsEvent()
 	if (KnownLastEvent != ITLEmptyDateTime)
 	{
 		FTimespan Interval = Now - KnownLastEvent;
-		if (FMath::Abs(Interval.GetTotalSeconds()) < 5.0)
+		if (FMath::Abs(Interval.GetTotalSeconds()) < AnalyticsLastWrittenUpdateIntervalSecs)
 		{
 			// Only update this timestamp every few seconds for efficiency
 			return;
@@ -1039,33 +1567,18 @@ void FsparklogsSettings::MarkLastWrittenAnalyticsEvent()
 	CachedAnalyticsLastEvent = Now;
 	int64 Ts = Now.GetTicks();
 	FString TimeStr = FString::Printf(TEXT("%lld"), Ts);
-	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-	bool WasDisabled = GConfig->AreFileOperationsDisabled();
-	GConfig->EnableFileOperations();
-	GConfig->SetString(ITL_CONFIG_SECTION_NAME, AnalyticsLastWrittenKey, *TimeStr, InstanceSettingsIni);
-	GConfig->Flush(false, InstanceSettingsIni);
-	if (WasDisabled)
-	{
-		GConfig->DisableFileOperations();
-	}
+	QueueAnalyticsState(AnalyticsLastWrittenKey, &TimeStr);
 }
 
 void FsparklogsSettings::MarkEndOfAnalyticsSession()
 {
 	FScopeLock WriteLock(&CachedCriticalSection);
 	CachedAnalyticsLastEvent = ITLEmptyDateTime;
-
-	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-	bool WasDisabled = GConfig->AreFileOperationsDisabled();
-	GConfig->EnableFileOperations();
-	GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, AnalyticsLastWrittenKey, InstanceSettingsIni);
-	GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, AnalyticsLastSessionStarted, InstanceSettingsIni);
-	GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, AnalyticsLastSessionID, InstanceSettingsIni);
-	GConfig->Flush(false, InstanceSettingsIni);
-	if (WasDisabled)
-	{
-		GConfig->DisableFileOperations();
-	}
+	QueueAnalyticsState(AnalyticsLastWrittenKey, nullptr);
+	QueueAnalyticsState(AnalyticsLastSessionStarted, nullptr);
+	QueueAnalyticsState(AnalyticsLastSessionID, nullptr);
+	WriteLock.Unlock();
+	FlushAnalyticsState();
 }
 
 void FsparklogsSettings::MarkStartOfAnalyticsSession(const FString& SessionID, FDateTime SessionStarted)
@@ -1075,13 +1588,60 @@ void FsparklogsSettings::MarkStartOfAnalyticsSession(const FString& SessionID, F
 	FDateTime Now = FDateTime::UtcNow();
 	FString NowStr = FString::Printf(TEXT("%lld"), (int64)Now.GetTicks());
 	CachedAnalyticsLastEvent = Now;
+	QueueAnalyticsState(AnalyticsLastSessionID, &SessionID);
+	QueueAnalyticsState(AnalyticsLastSessionStarted, &SessionStartedStr);
+	QueueAnalyticsState(AnalyticsLastWrittenKey, &NowStr);
+	WriteLock.Unlock();
+	FlushAnalyticsState();
+}
+
+void FsparklogsSettings::GetLastAnalyticsSessionStartInfo(FString& OutSessionID, FDateTime& OutSessionStarted)
+{
+	FScopeLock ReadLock(&CachedCriticalSection);
+	OutSessionID.Reset();
+	GetAnalyticsState(AnalyticsLastSessionID, OutSessionID);
+	FString TimeStr;
+	GetAnalyticsState(AnalyticsLastSessionStarted, TimeStr);
+	ReadLock.Unlock();
+	TimeStr.TrimStartAndEndInline();
+	OutSessionStarted = ITLParseDateTime(TimeStr);
+}
+
+bool FsparklogsSettings::HasPendingAnalyticsState()
+{
+	FScopeLock ReadLock(&CachedCriticalSection);
+	return PendingAnalyticsState.Num() > 0;
+}
+
+void FsparklogsSettings::FlushAnalyticsState()
+{
+	// Serializes flushes so that an older batch can never be applied after a newer one
+	FScopeLock FlushLock(&AnalyticsStateFlushCriticalSection);
+	FScopeLock WriteLock(&CachedCriticalSection);
+	if (PendingAnalyticsState.Num() <= 0)
+	{
+		return;
+	}
+	TMap<FString, TOptional<FString>> Changes = MoveTemp(PendingAnalyticsState);
+	PendingAnalyticsState.Reset();
+	AnalyticsStateFlushDeadline.store(0.0);
+	WriteLock.Unlock();
 
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("SETTINGS|FlushAnalyticsState|inifile='%s'|NumChanges=%d"), *InstanceSettingsIni, Changes.Num());
 	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
 	bool WasDisabled = GConfig->AreFileOperationsDisabled();
 	GConfig->EnableFileOperations();
-	GConfig->SetString(ITL_CONFIG_SECTION_NAME, AnalyticsLastSessionID, *SessionID, InstanceSettingsIni);
-	GConfig->SetString(ITL_CONFIG_SECTION_NAME, AnalyticsLastSessionStarted, *SessionStartedStr, InstanceSettingsIni);
-	GConfig->SetString(ITL_CONFIG_SECTION_NAME, AnalyticsLastWrittenKey, *NowStr, InstanceSettingsIni);
+	for (const TPair<FString, TOptional<FString>>& Change : Changes)
+	{
+		if (Change.Value.IsSet())
+		{
+			GConfig->SetString(ITL_CONFIG_SECTION_NAME, *Change.Key, *Change.Value.GetValue(), InstanceSettingsIni);
+		}
+		else
+		{
+			GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, *Change.Key, InstanceSettingsIni);
+		}
+	}
 	GConfig->Flush(false, InstanceSettingsIni);
 	if (WasDisabled)
 	{
@@ -1089,18 +1649,102 @@ void FsparklogsSettings::MarkStartOfAnalyticsSession(const FString& SessionID, F
 	}
 }
 
-void FsparklogsSettings::GetLastAnalyticsSessionStartInfo(FString& OutSessionID, FDateTime& OutSessionStarted)
+void FsparklogsSettings::FlushAnalyticsStateIfDue()
+{
+	const double Deadline = AnalyticsStateFlushDeadline.load(std::memory_order_relaxed);
+	if (Deadline > 0.0 && FPlatformTime::Seconds() >= Deadline)
+	{
+		FlushAnalyticsState();
+	}
+}
+
+void FsparklogsSettings::QueueAnalyticsState(const FString& Key, const FString* Value)
+{
+	if (PendingAnalyticsState.Num() <= 0)
+	{
+		// The oldest pending change decides when they are all due
+		AnalyticsStateFlushDeadline.store(FPlatformTime::Seconds() + AnalyticsStateFlushIntervalSecs);
+	}
+	if (Value != nullptr)
+	{
+		PendingAnalyticsState.Emplace(Key, TOptional<FString>(*Value));
+	}
+	else
+	{
+		PendingAnalyticsState.Emplace(Key, TOptional<FString>());
+	}
+}
+
+void FsparklogsSettings::QueueAnalyticsState(const FString& Key, int Value)
+{
+	FString ValueStr = FString::FromInt(Value);
+	QueueAnalyticsState(Key, &ValueStr);
+}
+
+bool FsparklogsSettings::GetAnalyticsState(const FString& Key, FString& OutValue)
 {
+	// Changes that have not been written yet take precedence over what is in the INI
+	const TOptional<FString>* Pending = PendingAnalyticsState.Find(Key);
+	if (Pending != nullptr)
+	{
+		if (Pending->IsSet())
+		{
+			OutValue = Pending->GetValue();
+			return true;
+		}
+		return false;
+	}
 	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-	OutSessionID = GConfig->GetStr(ITL_CONFIG_SECTION_NAME, AnalyticsLastSessionID, InstanceSettingsIni);
-	FString TimeStr = GConfig->GetStr(ITL_CONFIG_SECTION_NAME, AnalyticsLastSessionStarted, InstanceSettingsIni);
-	ConfigLock1.Unlock();
-	TimeStr.TrimStartAndEndInline();
-	OutSessionStarted = ITLParseDateTime(TimeStr);
+	return GConfig->GetString(ITL_CONFIG_SECTION_NAME, *Key, OutValue, InstanceSettingsIni);
+}
+
+bool FsparklogsSettings::GetAnalyticsState(const FString& Key, int& OutValue)
+{
+	FString ValueStr;
+	if (!GetAnalyticsState(Key, ValueStr))
+	{
+		return false;
+	}
+	ValueStr.TrimStartAndEndInline();
+	OutValue = FCString::Atoi(*ValueStr);
+	return true;
+}
+
+void FsparklogsSettings::LoadStartupSettings()
+{
+	FString Section = ITL_CONFIG_SECTION_NAME;
+	FString SettingPrefix = GetITLINISettingPrefix();
+
+	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
+
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("AutoStart")), AutoStart, GEngineIni))
+	{
+		AutoStart = DefaultAutoStart;
+	}
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("AsyncStartup")), AsyncStartup, GEngineIni))
+	{
+		AsyncStartup = DefaultAsyncStartup;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("StartupPreBufferBytes")), StartupPreBufferBytes, GEngineIni))
+	{
+		StartupPreBufferBytes = DefaultStartupPreBufferBytes;
+	}
+	StartupPreBufferBytes = FMath::Clamp(StartupPreBufferBytes, MinStartupPreBufferBytes, MaxStartupPreBufferBytes);
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("HostAgent")), HostAgent, GEngineIni))
+	{
+		HostAgent = DefaultHostAgent;
+	}
 }
 
 void FsparklogsSettings::LoadSettings()
 {
+	// The cached analytics state is about to be reset, so anything held in memory must be in the INI first
+	{
+		FScopeLock WriteLock(&CachedCriticalSection);
+		ReleaseTransactionNumberReservation();
+	}
+	FlushAnalyticsState();
+
 	FString Section = ITL_CONFIG_SECTION_NAME;
 	FString SettingPrefix = GetITLINISettingPrefix();
 	
@@ -1191,6 +1835,104 @@ void FsparklogsSettings::LoadSettings()
 	{
 		RetryIntervalSecs = DefaultRetryIntervalSecs;
 	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("MaxInFlightRequests")), MaxInFlightRequests, GEngineIni))
+	{
+		MaxInFlightRequests = DefaultMaxInFlightRequests;
+	}
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("AdaptiveRequestSizing")), AdaptiveRequestSizing, GEngineIni))
+	{
+		AdaptiveRequestSizing = DefaultAdaptiveRequestSizing;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("TargetRequestLatencySecs")), TargetRequestLatencySecs, GEngineIni))
+	{
+		TargetRequestLatencySecs = DefaultTargetRequestLatencySecs;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("LogCaptureRingBytes")), LogCaptureRingBytes, GEngineIni))
+	{
+		LogCaptureRingBytes = DefaultLogCaptureRingBytes;
+	}
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("MapSourceLogFile")), MapSourceLogFile, GEngineIni))
+	{
+		MapSourceLogFile = DefaultMapSourceLogFile;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("CatchUpParallelism")), CatchUpParallelism, GEngineIni))
+	{
+		CatchUpParallelism = DefaultCatchUpParallelism;
+	}
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("AnalyticsLane")), AnalyticsLane, GEngineIni))
+	{
+		AnalyticsLane = DefaultAnalyticsLane;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("AnalyticsProcessingIntervalSecs")), AnalyticsProcessingIntervalSecs, GEngineIni))
+	{
+		AnalyticsProcessingIntervalSecs = DefaultAnalyticsProcessingIntervalSecs;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("AnalyticsUnflushedBytesToAutoFlush")), AnalyticsUnflushedBytesToAutoFlush, GEngineIni))
+	{
+		AnalyticsUnflushedBytesToAutoFlush = DefaultAnalyticsUnflushedBytesToAutoFlush;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("MaxLogBacklogBytes")), MaxLogBacklogBytes, GEngineIni))
+	{
+		MaxLogBacklogBytes = DefaultMaxLogBacklogBytes;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("SpoolSegmentBytes")), SpoolSegmentBytes, GEngineIni))
+	{
+		SpoolSegmentBytes = DefaultSpoolSegmentBytes;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("SpoolMaxDiskBytes")), SpoolMaxDiskBytes, GEngineIni))
+	{
+		SpoolMaxDiskBytes = DefaultSpoolMaxDiskBytes;
+	}
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("SpoolBinaryRecords")), SpoolBinaryRecords, GEngineIni))
+	{
+		SpoolBinaryRecords = DefaultSpoolBinaryRecords;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("MemoryBudgetBytes")), MemoryBudgetBytes, GEngineIni))
+	{
+		MemoryBudgetBytes = DefaultMemoryBudgetBytes;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("MemoryBudgetIdleReleaseSecs")), MemoryBudgetIdleReleaseSecs, GEngineIni))
+	{
+		MemoryBudgetIdleReleaseSecs = DefaultMemoryBudgetIdleReleaseSecs;
+	}
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("PreWarmConnection")), PreWarmConnection, GEngineIni))
+	{
+		PreWarmConnection = DefaultPreWarmConnection;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("ShutdownFlushBudgetSecs")), ShutdownFlushBudgetSecs, GEngineIni))
+	{
+		ShutdownFlushBudgetSecs = DefaultShutdownFlushBudgetSecs;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("BackgroundFlushBudgetSecs")), BackgroundFlushBudgetSecs, GEngineIni))
+	{
+		BackgroundFlushBudgetSecs = DefaultBackgroundFlushBudgetSecs;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("AnalyticsAggregationWindowSecs")), AnalyticsAggregationWindowSecs, GEngineIni))
+	{
+		AnalyticsAggregationWindowSecs = DefaultAnalyticsAggregationWindowSecs;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("AnalyticsAggregationMaxKeys")), AnalyticsAggregationMaxKeys, GEngineIni))
+	{
+		AnalyticsAggregationMaxKeys = DefaultAnalyticsAggregationMaxKeys;
+	}
+	MirrorHTTPEndpointURI = GConfig->GetStr(*Section, *(SettingPrefix + TEXT("MirrorHTTPEndpointURI")), GEngineIni);
+	MirrorNDJSONFilePath = GConfig->GetStr(*Section, *(SettingPrefix + TEXT("MirrorNDJSONFilePath")), GEngineIni);
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("MirrorMaxLagBytes")), MirrorMaxLagBytes, GEngineIni))
+	{
+		MirrorMaxLagBytes = DefaultMirrorMaxLagBytes;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("LogRateLimitLinesPerSec")), LogRateLimitLinesPerSec, GEngineIni))
+	{
+		LogRateLimitLinesPerSec = DefaultLogRateLimitLinesPerSec;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("LogRateLimitBurstLines")), LogRateLimitBurstLines, GEngineIni))
+	{
+		LogRateLimitBurstLines = DefaultLogRateLimitBurstLines;
+	}
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("CoalesceRepeatedLogLines")), CoalesceRepeatedLogLines, GEngineIni))
+	{
+		CoalesceRepeatedLogLines = DefaultCoalesceRepeatedLogLines;
+	}
 	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("UnflushedBytesToAutoFlush")), UnflushedBytesToAutoFlush, GEngineIni))
 	{
 		UnflushedBytesToAutoFlush = DefaultUnflushedBytesToAutoFlush;
@@ -1212,10 +1954,7 @@ void FsparklogsSettings::LoadSettings()
 	{
 		DebugLogRequests = DefaultDebugLogRequests;
 	}
-	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("AutoStart")), AutoStart, GEngineIni))
-	{
-		AutoStart = DefaultAutoStart;
-	}
+	LoadStartupSettings();
 	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("AddRandomAppInstanceID")), AddRandomAppInstanceID, GEngineIni))
 	{
 		AddRandomAppInstanceID = DefaultAddRandomAppInstanceID;
@@ -1230,6 +1969,14 @@ void FsparklogsSettings::LoadSettings()
 	{
 		CompressionMode = ITLCompressionMode::None;
 	}
+	else if (CompressionModeStr == TEXT("lz4frame"))
+	{
+		CompressionMode = ITLCompressionMode::LZ4Frame;
+	}
+	else if (CompressionModeStr == TEXT("gzip"))
+	{
+		CompressionMode = ITLCompressionMode::Gzip;
+	}
 	else
 	{
 		if (CompressionModeStr.Len() > 0)
@@ -1247,6 +1994,10 @@ void FsparklogsSettings::LoadSettings()
 	{
 		StressTestNumEntriesPerTick = 0;
 	}
+	if (!GConfig->GetString(*Section, *(SettingPrefix + TEXT("StressTestMessageOptions")), StressTestMessageOptions, GEngineIni))
+	{
+		StressTestMessageOptions = TEXT("");
+	}
 
 	ConfigLock1.Unlock();
 
@@ -1259,6 +2010,7 @@ void FsparklogsSettings::LoadSettings()
 	CachedAnalyticsInstallTime = ITLEmptyDateTime;
 	CachedAnalyticsSessionNumber = 0;
 	CachedAnalyticsTransactionNumber = 0;
+	ReservedAnalyticsTransactionNumber = 0;
 	CachedAnalyticsFirstPurchased = ITLEmptyDateTime;
 	CachedAnalyticsLastEvent = ITLEmptyDateTime;
 }
@@ -1297,6 +2049,104 @@ void FsparklogsSettings::EnforceConstraints()
 	{
 		RetryIntervalSecs = MaxRetryIntervalSecs;
 	}
+	if (MaxInFlightRequests < MinMaxInFlightRequests)
+	{
+		MaxInFlightRequests = MinMaxInFlightRequests;
+	}
+	if (MaxInFlightRequests > MaxMaxInFlightRequests)
+	{
+		MaxInFlightRequests = MaxMaxInFlightRequests;
+	}
+	if (TargetRequestLatencySecs < MinTargetRequestLatencySecs)
+	{
+		TargetRequestLatencySecs = MinTargetRequestLatencySecs;
+	}
+	if (LogCaptureRingBytes < 0)
+	{
+		LogCaptureRingBytes = 0;
+	}
+	if (LogCaptureRingBytes > 0 && LogCaptureRingBytes < MinLogCaptureRingBytes)
+	{
+		LogCaptureRingBytes = MinLogCaptureRingBytes;
+	}
+	if (LogCaptureRingBytes > MaxLogCaptureRingBytes)
+	{
+		LogCaptureRingBytes = MaxLogCaptureRingBytes;
+	}
+	if (CatchUpParallelism < MinCatchUpParallelism)
+	{
+		CatchUpParallelism = MinCatchUpParallelism;
+	}
+	if (CatchUpParallelism > MaxCatchUpParallelism)
+	{
+		CatchUpParallelism = MaxCatchUpParallelism;
+	}
+	if (MemoryBudgetBytes < 0)
+	{
+		MemoryBudgetBytes = 0;
+	}
+	if (MemoryBudgetBytes > 0)
+	{
+		if (MemoryBudgetBytes < MinMemoryBudgetBytes)
+		{
+			MemoryBudgetBytes = MinMemoryBudgetBytes;
+		}
+		// Every payload in flight holds its own buffers, so fewer and smaller payloads fit in the budget
+		MaxInFlightRequests = FMath::Clamp(MemoryBudgetBytes / (MemoryBudgetBytesPerReadByte * MinBytesPerRequest), MinMaxInFlightRequests, MaxInFlightRequests);
+		BytesPerRequest = FMath::Clamp(MemoryBudgetBytes / (MemoryBudgetBytesPerReadByte * MaxInFlightRequests), MinBytesPerRequest, BytesPerRequest);
+		// Payloads built in parallel would each need their own buffers too
+		CatchUpParallelism = 1;
+	}
+	if (MemoryBudgetIdleReleaseSecs < MinMemoryBudgetIdleReleaseSecs)
+	{
+		MemoryBudgetIdleReleaseSecs = MinMemoryBudgetIdleReleaseSecs;
+	}
+	ShutdownFlushBudgetSecs = FMath::Clamp(ShutdownFlushBudgetSecs, MinShutdownFlushBudgetSecs, MaxShutdownFlushBudgetSecs);
+	BackgroundFlushBudgetSecs = FMath::Clamp(BackgroundFlushBudgetSecs, 0.0, MaxBackgroundFlushBudgetSecs);
+	AnalyticsAggregationWindowSecs = FMath::Clamp(AnalyticsAggregationWindowSecs, 0.0, MaxAnalyticsAggregationWindowSecs);
+	AnalyticsAggregationMaxKeys = FMath::Clamp(AnalyticsAggregationMaxKeys, MinAnalyticsAggregationMaxKeys, MaxAnalyticsAggregationMaxKeys);
+	MirrorMaxLagBytes = FMath::Clamp(MirrorMaxLagBytes, MinMirrorMaxLagBytes, MaxMirrorMaxLagBytes);
+	if (AnalyticsProcessingIntervalSecs < MinAnalyticsProcessingIntervalSecs)
+	{
+		AnalyticsProcessingIntervalSecs = MinAnalyticsProcessingIntervalSecs;
+	}
+	if (AnalyticsUnflushedBytesToAutoFlush < MinAnalyticsUnflushedBytesToAutoFlush)
+	{
+		AnalyticsUnflushedBytesToAutoFlush = MinAnalyticsUnflushedBytesToAutoFlush;
+	}
+	if (MaxLogBacklogBytes < 0)
+	{
+		MaxLogBacklogBytes = 0;
+	}
+	if (MaxLogBacklogBytes > 0 && MaxLogBacklogBytes < MinMaxLogBacklogBytes)
+	{
+		MaxLogBacklogBytes = MinMaxLogBacklogBytes;
+	}
+	if (SpoolSegmentBytes < 0)
+	{
+		SpoolSegmentBytes = 0;
+	}
+	if (SpoolSegmentBytes > 0)
+	{
+		SpoolSegmentBytes = FMath::Clamp(SpoolSegmentBytes, MinSpoolSegmentBytes, MaxSpoolSegmentBytes);
+	}
+	if (SpoolMaxDiskBytes < 0)
+	{
+		SpoolMaxDiskBytes = 0;
+	}
+	if (SpoolMaxDiskBytes > 0 && SpoolMaxDiskBytes < SpoolSegmentBytes * 2)
+	{
+		// Always room for the segment being shipped and the one being written
+		SpoolMaxDiskBytes = SpoolSegmentBytes * 2;
+	}
+	if (LogRateLimitLinesPerSec < 0.0)
+	{
+		LogRateLimitLinesPerSec = 0.0;
+	}
+	if (LogRateLimitBurstLines < MinLogRateLimitBurstLines)
+	{
+		LogRateLimitBurstLines = MinLogRateLimitBurstLines;
+	}
 	if (UnflushedBytesToAutoFlush < MinUnflushedBytesToAutoFlush)
 	{
 		UnflushedBytesToAutoFlush = MinUnflushedBytesToAutoFlush;
@@ -1343,11 +2193,95 @@ bool FsparklogsSettings::IsValidDeviceID(const FString& deviceId)
 	return true;
 }
 
+// =============== FsparklogsPendingPayload ===============================================================================
+
+FsparklogsPendingPayload::FsparklogsPendingPayload()
+	: RequestEnded(false)
+	, RequestSucceeded(false)
+	, RetryableFailure(true)
+	, StartTime(0.0)
+	, EndTime(0.0)
+	, ResponseCode(0)
+	, RetryAfterSecs(0.0)
+	, Dropped(false)
+	, Cancelled(false)
+	, EndedEvent(FPlatformProcess::GetSynchEventFromPool(true))
+{
+}
+
+FsparklogsPendingPayload::~FsparklogsPendingPayload()
+{
+	FPlatformProcess::ReturnSynchEventToPool(EndedEvent);
+	EndedEvent = nullptr;
+}
+
+void FsparklogsPendingPayload::MarkEnded()
+{
+	EndTime = FPlatformTime::Seconds();
+	RequestEnded.AtomicSet(true);
+	EndedEvent->Trigger();
+}
+
+bool FsparklogsPendingPayload::WaitForEnd(double WaitSecs)
+{
+	if (!RequestEnded && WaitSecs > 0.0)
+	{
+		EndedEvent->Wait((uint32)FMath::CeilToInt(WaitSecs * 1000.0));
+	}
+	return RequestEnded;
+}
+
+void FsparklogsPendingPayload::Cancel()
+{
+	// The completion callback might still run after this (it owns a reference to the pending payload), so record the outcome first.
+	Cancelled.AtomicSet(true);
+	RequestSucceeded.AtomicSet(false);
+	RetryableFailure.AtomicSet(true);
+	MarkEnded();
+}
+
+// =============== IsparklogsPayloadProcessor ===============================================================================
+
+TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> IsparklogsPayloadProcessor::BeginProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending(new FsparklogsPendingPayload());
+	Pending->StartTime = FPlatformTime::Seconds();
+	Pending->RequestSucceeded.AtomicSet(ProcessPayload(JSONPayloadInUTF8, PayloadLen, OriginalPayloadLen, CompressionMode, StreamerWeakPtr));
+	Pending->MarkEnded();
+	return Pending;
+}
+
+bool IsparklogsPayloadProcessor::FinishProcessPayload(TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	return Pending->RequestEnded && Pending->RequestSucceeded;
+}
+
+TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> IsparklogsPayloadProcessor::BeginProcessSharedPayload(const FsparklogsSharedPayload& Payload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	// The processor may move from the buffer, and the shared payload must stay intact for retries and the other sinks
+	TArray<uint8> Buffer(*Payload.Data);
+	return BeginProcessPayload(Buffer, Buffer.Num(), Payload.OriginalPayloadLen, Payload.CompressionMode, StreamerWeakPtr);
+}
+
 // =============== FsparklogsWriteNDJSONPayloadProcessor ===============================================================================
 
 FsparklogsWriteNDJSONPayloadProcessor::FsparklogsWriteNDJSONPayloadProcessor(FString InOutputFilePath) : OutputFilePath(InOutputFilePath) { }
 
 bool FsparklogsWriteNDJSONPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	return WritePayload(JSONPayloadInUTF8.GetData(), PayloadLen, OriginalPayloadLen, CompressionMode);
+}
+
+TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> FsparklogsWriteNDJSONPayloadProcessor::BeginProcessSharedPayload(const FsparklogsSharedPayload& Payload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending(new FsparklogsPendingPayload());
+	Pending->StartTime = FPlatformTime::Seconds();
+	Pending->RequestSucceeded.AtomicSet(WritePayload(Payload.Data->GetData(), Payload.Data->Num(), Payload.OriginalPayloadLen, Payload.CompressionMode));
+	Pending->MarkEnded();
+	return Pending;
+}
+
+bool FsparklogsWriteNDJSONPayloadProcessor::WritePayload(const uint8* PayloadData, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode)
 {
 	TUniquePtr<IFileHandle> DebugJSONWriter;
 	DebugJSONWriter.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*OutputFilePath, true, true));
@@ -1355,13 +2289,20 @@ bool FsparklogsWriteNDJSONPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPa
 	{
 		return false;
 	}
+	const uint8* Data = PayloadData;
+	int DataLen = PayloadLen;
 	TArray<uint8> DecompressedData;
-	if (!ITLDecompressData(CompressionMode, JSONPayloadInUTF8.GetData(), PayloadLen, OriginalPayloadLen, DecompressedData))
+	if (CompressionMode != ITLCompressionMode::None)
 	{
-		UE_LOG(LogPluginSparkLogs, Warning, TEXT("WriteNDJSONPayloadProcessor: failed to decompress data in payload: mode=%d, len=%d, original_len=%d"), (int)CompressionMode, PayloadLen, OriginalPayloadLen);
-		return false;
+		if (!ITLDecompressData(CompressionMode, PayloadData, PayloadLen, OriginalPayloadLen, DecompressedData))
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("WriteNDJSONPayloadProcessor: failed to decompress data in payload: mode=%d, len=%d, original_len=%d"), (int)CompressionMode, PayloadLen, OriginalPayloadLen);
+			return false;
+		}
+		Data = DecompressedData.GetData();
+		DataLen = DecompressedData.Num();
 	}
-	if (!DebugJSONWriter->Write((const uint8*)DecompressedData.GetData(), DecompressedData.Num())
+	if (!DebugJSONWriter->Write(Data, DataLen)
 		|| !DebugJSONWriter->Write((const uint8*)("\r\n"), 2)
 		|| !DebugJSONWriter->Flush())
 	{
@@ -1378,8 +2319,19 @@ FsparklogsWriteHTTPPayloadProcessor::FsparklogsWriteHTTPPayloadProcessor(const F
 	, AuthorizationHeader(InAuthorizationHeader)
 	, TargetCurrency(InTargetCurrency)
 	, LogRequests(InLogRequests)
+	, ConnectionState(MakeShared<FConnectionState, ESPMode::ThreadSafe>())
 {
 	SetTimeoutSecs(InTimeoutSecs);
+	StaticHeaders.Emplace(TEXT("Content-Type"), TEXT("application/json; charset=UTF-8"));
+	if (!AuthorizationHeader.IsEmpty())
+	{
+		StaticHeaders.Emplace(TEXT("Authorization"), AuthorizationHeader);
+	}
+	if (!TargetCurrency.IsEmpty())
+	{
+		StaticHeaders.Emplace(TEXT("X-Target-Currency"), TargetCurrency);
+	}
+	StaticHeaders.Emplace(TEXT("X-Calc-GeoIP"), TEXT("true"));
 }
 
 void FsparklogsWriteHTTPPayloadProcessor::SetTimeoutSecs(double InTimeoutSecs)
@@ -1390,32 +2342,48 @@ void FsparklogsWriteHTTPPayloadProcessor::SetTimeoutSecs(double InTimeoutSecs)
 bool FsparklogsWriteHTTPPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
 {
 	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsWriteHTTPPayloadProcessor_ProcessPayload);
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|BEGIN"));
-	if (LogRequests)
-	{
-		UE_LOG(LogPluginSparkLogs, Log, TEXT("HTTPPayloadProcessor::ProcessPayload: BEGIN: len=%d, original_len=%d, timeout_millisec=%d"), PayloadLen, OriginalPayloadLen, (int)(TimeoutMillisec.GetValue()));
+	// Synchronously wait for the request to complete or fail
+	return FinishProcessPayload(BeginProcessPayload(JSONPayloadInUTF8, PayloadLen, OriginalPayloadLen, CompressionMode, StreamerWeakPtr), StreamerWeakPtr);
+}
+
+TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> FsparklogsWriteHTTPPayloadProcessor::BeginProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> PayloadStreamerPtr = StreamerWeakPtr.Pin();
+	const bool IsEnvelope = PayloadStreamerPtr.IsValid() && PayloadStreamerPtr->WorkerIsNextPayloadEnvelope();
+	PayloadStreamerPtr.Reset();
+	return BeginRequest(&JSONPayloadInUTF8, nullptr, PayloadLen, OriginalPayloadLen, CompressionMode, IsEnvelope);
+}
+
+TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> FsparklogsWriteHTTPPayloadProcessor::BeginProcessSharedPayload(const FsparklogsSharedPayload& Payload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	// The HTTP module keeps its own copy of the request body, so there is no need to copy the shared payload first
+	return BeginRequest(nullptr, Payload.Data.Get(), Payload.Data->Num(), Payload.OriginalPayloadLen, Payload.CompressionMode, Payload.IsEnvelope);
+}
+
+TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> FsparklogsWriteHTTPPayloadProcessor::BeginRequest(TArray<uint8>* OwnedContent, const TArray<uint8>* SharedContent, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, bool IsEnvelope)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsWriteHTTPPayloadProcessor_BeginProcessPayload);
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|BEGIN"));
+	if (LogRequests)
+	{
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("HTTPPayloadProcessor::ProcessPayload: BEGIN: len=%d, original_len=%d, timeout_millisec=%d"), PayloadLen, OriginalPayloadLen, (int)(TimeoutMillisec.GetValue()));
 	}
 	
-	FThreadSafeBool RequestEnded(false);
-	FThreadSafeBool RequestSucceeded(false);
-	FThreadSafeBool RetryableFailure(true);
+	TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending(new FsparklogsPendingPayload());
 	TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest = FHttpModule::Get().CreateRequest();
 	HttpRequest->SetURL(*EndpointURI);
 	HttpRequest->SetVerb(TEXT("POST"));
 	SetHTTPTimezoneHeader(HttpRequest);
-	HttpRequest->SetHeader(TEXT("Content-Type"), TEXT("application/json; charset=UTF-8"));
-	HttpRequest->SetHeader(TEXT("Authorization"), *AuthorizationHeader);
-	if (!TargetCurrency.IsEmpty())
+	for (const TPair<FString, FString>& Header : StaticHeaders)
 	{
-		HttpRequest->SetHeader(TEXT("X-Target-Currency"), *TargetCurrency);
+		HttpRequest->SetHeader(Header.Key, Header.Value);
 	}
 	FString LocalCookieHeader = GetDataCookieHeader();
 	if (LocalCookieHeader.Len() > 0)
 	{
 		HttpRequest->SetHeader(TEXT("Cookie"), LocalCookieHeader);
 	}
-	HttpRequest->SetHeader(TEXT("X-Calc-GeoIP"), TEXT("true"));
-	HttpRequest->SetHeader(TEXT("X-Client-Clock-Utc-Now"), *FString::Printf(TEXT("%lld"), (int64)(FDateTime::UtcNow().ToUnixTimestamp())));
+	HttpRequest->SetHeader(TEXT("X-Client-Clock-Utc-Now"), LexToString((int64)(FDateTime::UtcNow().ToUnixTimestamp())));
 	HttpRequest->SetTimeout((double)(TimeoutMillisec.GetValue()) / 1000.0);
 	switch (CompressionMode)
 	{
@@ -1423,28 +2391,52 @@ bool FsparklogsWriteHTTPPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPayl
 		HttpRequest->SetHeader(TEXT("Content-Encoding"), TEXT("lz4-block"));
 		HttpRequest->SetHeader(TEXT("X-Original-Content-Length"), FString::FromInt(OriginalPayloadLen));
 		break;
+	case ITLCompressionMode::LZ4Frame:
+		HttpRequest->SetHeader(TEXT("Content-Encoding"), TEXT("lz4-frame"));
+		HttpRequest->SetHeader(TEXT("X-Original-Content-Length"), FString::FromInt(OriginalPayloadLen));
+		break;
+	case ITLCompressionMode::Gzip:
+		HttpRequest->SetHeader(TEXT("Content-Encoding"), TEXT("gzip"));
+		HttpRequest->SetHeader(TEXT("X-Original-Content-Length"), FString::FromInt(OriginalPayloadLen));
+		break;
 	case ITLCompressionMode::None:
 		// no special header to set
 		break;
 	default:
 		UE_LOG(LogPluginSparkLogs, Log, TEXT("HTTPPayloadProcessor::ProcessPayload: unknown compression mode %d"), (int)CompressionMode);
-		return false;
+		Pending->MarkEnded();
+		return Pending;
+	}
+	if (IsEnvelope)
+	{
+		HttpRequest->SetHeader(PayloadFormatHeader, PayloadFormatCommonEnvelope);
+	}
+	if (OwnedContent != nullptr)
+	{
+		// Hand the buffer to the request instead of copying it. The streamer allocates a new buffer for the next payload.
+		HttpRequest->SetContent(MoveTemp(*OwnedContent));
+	}
+	else
+	{
+		HttpRequest->SetContent(*SharedContent);
 	}
-	HttpRequest->SetContent(JSONPayloadInUTF8);
 	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|Headers and data prepared"));
-	HttpRequest->OnRequestWillRetry().BindLambda([&](FHttpRequestPtr Request, FHttpResponsePtr Response, float SecondsToRetry)
+	HttpRequest->OnRequestWillRetry().BindLambda([](FHttpRequestPtr Request, FHttpResponsePtr Response, float SecondsToRetry)
 		{
 			if (Request.IsValid())
 			{
 				// Important that this header reflects the current time when we actually submit the request (in the future)
-				HttpRequest->SetHeader(TEXT("X-Client-Clock-Utc-Now"), *FString::Printf(TEXT("%lld"), (int64)(FDateTime::UtcNow().ToUnixTimestamp() + (int64)SecondsToRetry)));
+				Request->SetHeader(TEXT("X-Client-Clock-Utc-Now"), LexToString((int64)(FDateTime::UtcNow().ToUnixTimestamp() + (int64)SecondsToRetry)));
 			}
 		});
 
-	HttpRequest->OnProcessRequestComplete().BindLambda([&](FHttpRequestPtr Request, FHttpResponsePtr Response, bool bWasSuccessful)
+	// The pending payload and connection state are captured by value so that they stay valid for as long as the request might complete,
+	// even after a timeout and after the processor is gone.
+	const bool LocalLogRequests = LogRequests;
+	HttpRequest->OnProcessRequestComplete().BindLambda([Pending, State = ConnectionState, LocalLogRequests](FHttpRequestPtr Request, FHttpResponsePtr Response, bool bWasSuccessful)
 		{
 			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|OnProcessRequestComplete|BEGIN"));
-			if (LogRequests)
+			if (LocalLogRequests)
 			{
 				if (Response.IsValid())
 				{
@@ -1459,70 +2451,102 @@ bool FsparklogsWriteHTTPPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPayl
 			{
 				FString ResponseBody = Response->GetContentAsString();
 				int32 ResponseCode = Response->GetResponseCode();
+				Pending->ResponseCode = ResponseCode;
 				if (EHttpResponseCodes::IsOk(ResponseCode))
 				{
 					// Remember any session affinity cookies for the next request...
 					FString NewCookies = ITLParseHttpResponseCookies(Response);
 					if (!NewCookies.IsEmpty())
 					{
-						SetDataCookieHeader(NewCookies);
+						SetDataCookieHeader(*State, NewCookies);
+					}
+					// Older endpoints never send this, so they keep receiving plain arrays of events
+					if (!State->EndpointAcceptsEnvelope)
+					{
+						TArray<FString> AcceptedFormats;
+						Response->GetHeader(AcceptPayloadFormatHeader).ParseIntoArray(AcceptedFormats, TEXT(","));
+						for (const FString& AcceptedFormat : AcceptedFormats)
+						{
+							if (AcceptedFormat.TrimStartAndEnd().Equals(PayloadFormatCommonEnvelope, ESearchCase::IgnoreCase))
+							{
+								UE_LOG(LogPluginSparkLogs, Log, TEXT("HTTPPayloadProcessor::ProcessPayload: endpoint accepts the common metadata envelope, will send common event data once per payload"));
+								State->EndpointAcceptsEnvelope.AtomicSet(true);
+								break;
+							}
+						}
 					}
+					// The first payload after the connection was (re)established shows how much the connection setup costs
+					State->RecordAck(Pending->StartTime);
 					// Mark that we've successfully processed the request...
-					RequestSucceeded.AtomicSet(true);
+					Pending->RequestSucceeded.AtomicSet(true);
 				}
 				else if (EHttpResponseCodes::TooManyRequests == ResponseCode || EHttpResponseCodes::RequestTimeout == ResponseCode || ResponseCode >= EHttpResponseCodes::ServerError)
 				{
-					UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: Retryable HTTP response: status=%d, msg=%s"), (int)ResponseCode, *ResponseBody.TrimStartAndEnd());
+					// Throttled or overloaded servers can tell us how long to back off
+					Pending->RetryAfterSecs = ITLParseRetryAfterSecs(Response->GetHeader(TEXT("Retry-After")));
+					UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: Retryable HTTP response: status=%d, retry_after=%.3lf, msg=%s"), (int)ResponseCode, Pending->RetryAfterSecs, *ResponseBody.TrimStartAndEnd());
 					// Clear any session affinity cookies in case that is part of the issue...
-					SetDataCookieHeader(TEXT(""));
-					RequestSucceeded.AtomicSet(false);
-					RetryableFailure.AtomicSet(true);
+					SetDataCookieHeader(*State, TEXT(""));
+					Pending->RequestSucceeded.AtomicSet(false);
+					Pending->RetryableFailure.AtomicSet(true);
 				}
 				else if (EHttpResponseCodes::BadRequest == ResponseCode || EHttpResponseCodes::RequestTooLarge == ResponseCode)
 				{
 					// Something about this input was unable to be processed -- drop this input and pretend success so we can continue, but warn about it
 					UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: HTTP response indicates input cannot be processed. Will skip this payload! status=%d, msg=%s"), (int)ResponseCode, *ResponseBody.TrimStartAndEnd());
-					RequestSucceeded.AtomicSet(true);
+					Pending->Dropped.AtomicSet(true);
+					Pending->RequestSucceeded.AtomicSet(true);
 				}
 				else
 				{
 					UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: Non-Retryable HTTP response: status=%d, msg=%s"), (int)ResponseCode, *ResponseBody.TrimStartAndEnd());
-					RequestSucceeded.AtomicSet(false);
-					RetryableFailure.AtomicSet(false);
+					Pending->RequestSucceeded.AtomicSet(false);
+					Pending->RetryableFailure.AtomicSet(false);
 				}
 			}
 			else
 			{
-				TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerPtr = StreamerWeakPtr.Pin();
-				if (StreamerPtr.IsValid())
-				{
-					UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: General HTTP request failure; will retry; retry_seconds=%.3lf"), StreamerPtr->WorkerGetRetrySecs());
-				}
-				RequestSucceeded.AtomicSet(false);
-				RetryableFailure.AtomicSet(true);
+				// The retry interval is chosen (with jitter) by the streamer's worker once the flush fails
+				UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: General HTTP request failure; will retry"));
+				Pending->RequestSucceeded.AtomicSet(false);
+				Pending->RetryableFailure.AtomicSet(true);
 			}
 
 			// Signal that the request has finished (success or failure)
-			RequestEnded.AtomicSet(true);
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|OnProcessRequestComplete|END|RequestEnded=%d"), RequestEnded ? 1 : 0);
+			Pending->MarkEnded();
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|OnProcessRequestComplete|END|RequestEnded=%d"), Pending->RequestEnded ? 1 : 0);
 		});
 
 	// Start the HTTP request
-	double StartTime = FPlatformTime::Seconds();
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|Starting to process request at time=%.3lf"), StartTime);
+	Pending->StartTime = FPlatformTime::Seconds();
+	Pending->HttpRequest = HttpRequest;
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|Starting to process request at time=%.3lf"), Pending->StartTime);
 	if (!HttpRequest->ProcessRequest())
 	{
 		UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: failed to initiate HttpRequest"));
-		RequestSucceeded.AtomicSet(false);
-		RetryableFailure.AtomicSet(true);
+		Pending->RequestSucceeded.AtomicSet(false);
+		Pending->RetryableFailure.AtomicSet(true);
+		Pending->HttpRequest.Reset();
+		Pending->MarkEnded();
 	}
-	else
+	return Pending;
+}
+
+bool FsparklogsWriteHTTPPayloadProcessor::FinishProcessPayload(TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsWriteHTTPPayloadProcessor_FinishProcessPayload);
+	ITL_TRACE_SCOPE(SparkLogs_FinishProcessPayload);
+	bool TimedOut = false;
+	if (Pending->HttpRequest.IsValid())
 	{
-		// Synchronously wait for the request to complete or fail
-		SleepWaitingForHTTPRequest(HttpRequest, RequestEnded, RequestSucceeded, RetryableFailure, StartTime);
+		TimedOut = !SleepWaitingForHTTPRequest(*Pending, StreamerWeakPtr);
+		// Break the reference cycle between the request's completion delegate and the pending payload
+		Pending->HttpRequest.Reset();
 	}
 
 	// If we had a non-retryable failure, then trigger this worker to stop
+	bool RequestSucceeded = !TimedOut && Pending->RequestSucceeded;
+	bool RetryableFailure = TimedOut || Pending->RetryableFailure;
 	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|After request finished|RequestSucceeded=%d|RetryableFailure=%d"), RequestSucceeded ? 1 : 0, RetryableFailure ? 1 : 0);
 	if (!RequestSucceeded && !RetryableFailure)
 	{
@@ -1548,13 +2572,14 @@ void FsparklogsWriteHTTPPayloadProcessor::SetHTTPTimezoneHeader(TSharedRef<IHttp
 	static FString TimezoneHeaderValueUTC(TEXT("UTC"));
 	if (GPrintLogTimes == ELogTimes::Local)
 	{
-		FTimespan LocalOffset = FDateTime::Now() - FDateTime::UtcNow();
-		int32 TotalMinutes = FMath::RoundToInt(LocalOffset.GetTotalMinutes());
-		int32 Hours = FMath::Abs(TotalMinutes) / 60;
-		int32 Minutes = FMath::Abs(TotalMinutes) % 60;
-		const TCHAR* Sign = (TotalMinutes >= 0) ? TEXT("+") : TEXT("-");
-		FString TZOffset = FString::Printf(TEXT("UTC%s%02d:%02d"), Sign, Hours, Minutes);
-		HttpRequest->SetHeader(TimezoneHeader, TZOffset);
+		const double Now = FPlatformTime::Seconds();
+		FScopeLock WriteLock(&DataCriticalSection);
+		if (DataTimezoneHeaderValue.IsEmpty() || Now - DataTimezoneHeaderPlatformTime >= TimezoneHeaderRefreshSecs)
+		{
+			DataTimezoneHeaderValue = ITLFormatTimezoneHeaderValue(FDateTime::Now() - FDateTime::UtcNow());
+			DataTimezoneHeaderPlatformTime = Now;
+		}
+		HttpRequest->SetHeader(TimezoneHeader, DataTimezoneHeaderValue);
 	}
 	else
 	{
@@ -1563,1154 +2588,5963 @@ void FsparklogsWriteHTTPPayloadProcessor::SetHTTPTimezoneHeader(TSharedRef<IHttp
 	}
 }
 
-bool FsparklogsWriteHTTPPayloadProcessor::SleepWaitingForHTTPRequest(TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest, FThreadSafeBool& RequestEnded, FThreadSafeBool& RequestSucceeded, FThreadSafeBool& RetryableFailure, double StartTime)
+void FsparklogsWriteHTTPPayloadProcessor::PreWarm()
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsWriteHTTPPayloadProcessor_PreWarm);
+	// Whatever connection the next payload gets is a new one, so measure its latency again
+	ConnectionState->FirstAckPending.AtomicSet(true);
+	if (ConnectionState->PreWarmInFlight.AtomicSet(true))
+	{
+		return;
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::PreWarm|BEGIN"));
+	TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest = FHttpModule::Get().CreateRequest();
+	HttpRequest->SetURL(*EndpointURI);
+	// Only DNS, TCP and TLS setup matter here, so any response will do and nothing is sent
+	HttpRequest->SetVerb(TEXT("HEAD"));
+	HttpRequest->SetTimeout((double)(TimeoutMillisec.GetValue()) / 1000.0);
+	const double StartTime = FPlatformTime::Seconds();
+	const bool LocalLogRequests = LogRequests;
+	ConnectionState->NumPreWarmsSent.fetch_add(1);
+	HttpRequest->OnProcessRequestComplete().BindLambda([State = ConnectionState, StartTime, LocalLogRequests](FHttpRequestPtr Request, FHttpResponsePtr Response, bool bWasSuccessful)
+		{
+			const double Secs = FPlatformTime::Seconds() - StartTime;
+			if (bWasSuccessful && Response.IsValid())
+			{
+				State->PreWarmSecs.store(Secs);
+			}
+			if (LocalLogRequests)
+			{
+				UE_LOG(LogPluginSparkLogs, Log, TEXT("HTTPPayloadProcessor::PreWarm: RequestComplete: successful=%d, http_status=%d, secs=%.3lf"), bWasSuccessful ? 1 : 0, Response.IsValid() ? (int)(Response->GetResponseCode()) : 0, Secs);
+			}
+			State->PreWarmInFlight.AtomicSet(false);
+		});
+	if (!HttpRequest->ProcessRequest())
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::PreWarm: failed to initiate HttpRequest"));
+		ConnectionState->PreWarmInFlight.AtomicSet(false);
+	}
+}
+
+bool FsparklogsWriteHTTPPayloadProcessor::SleepWaitingForHTTPRequest(FsparklogsPendingPayload& Pending, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
 {
 	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsWriteHTTPPayloadProcessor_SleepWaitingForHTTPRequest);
-	while (!RequestEnded)
+	while (!Pending.RequestEnded)
 	{
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|In loop waiting for request to end|RequestEnded=%d"), RequestEnded ? 1 : 0);
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|In loop waiting for request to end|RequestEnded=%d"), Pending.RequestEnded ? 1 : 0);
 		// TODO: support cancellation in the future if we need to
 		double CurrentTime = FPlatformTime::Seconds();
-		double Elapsed = CurrentTime - StartTime;
+		double Elapsed = CurrentTime - Pending.StartTime;
 		// It's possible the timeout has shortened while we've been waiting, so always use the current timeout value
 		double Timeout = (double)(TimeoutMillisec.GetValue()) / 1000.0;
 		if (Elapsed > Timeout)
 		{
 			UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: Timed out after %.3lf seconds; will retry..."), Elapsed);
-			HttpRequest->CancelRequest();
-			RequestSucceeded.AtomicSet(false);
-			RetryableFailure.AtomicSet(true);
-			return false;
+			Pending.Cancel();
+			break;
+		}
+		// Wait for the completion callback to wake us up. Re-check at least once a second because the timeout can shorten while we wait.
+		Pending.WaitForEnd(FMath::Min(Timeout - Elapsed, 1.0));
+	}
+	if (Pending.Cancelled)
+	{
+		// Timed out or cancelled by another thread (e.g., at shutdown)
+		if (Pending.HttpRequest.IsValid())
+		{
+			Pending.HttpRequest->CancelRequest();
 		}
-		// Capture stats in this sleep to ensure it is counted as an idle scope...
-		FPlatformProcess::Sleep(0.1f);
+		return false;
 	}
 	return true;
 }
 
 FString FsparklogsWriteHTTPPayloadProcessor::GetDataCookieHeader()
 {
-	FScopeLock WriteLock(&DataCriticalSection);
-	return DataCookieHeader;
+	FScopeLock WriteLock(&ConnectionState->CookieCriticalSection);
+	return ConnectionState->CookieHeader;
 }
 
-void FsparklogsWriteHTTPPayloadProcessor::SetDataCookieHeader(const FString& Value)
+void FsparklogsWriteHTTPPayloadProcessor::SetDataCookieHeader(FConnectionState& State, const FString& Value)
 {
-	FScopeLock WriteLock(&DataCriticalSection);
-	DataCookieHeader = Value;
+	FScopeLock WriteLock(&State.CookieCriticalSection);
+	State.CookieHeader = Value;
 }
 
-// =============== FsparklogsStressGenerator ===============================================================================
+// =============== FsparklogsMirrorCursor ===============================================================================
 
-FsparklogsStressGenerator::FsparklogsStressGenerator(TSharedRef<FsparklogsSettings> InSettings)
-	: Settings(InSettings)
-	, Thread(nullptr)
+FsparklogsMirrorCursor::FsparklogsMirrorCursor(const FString& JournalPath)
+	: QueuedOffset(0)
+	, DeliveredOffset(0)
 {
-	check(FPlatformProcess::SupportsMultithreading());
-	FString ThreadName = TEXT("SparkLogs_StressGenerator");
-	FPlatformAtomics::InterlockedExchangePtr((void**)&Thread, FRunnableThread::Create(this, *ThreadName, 0, TPri_BelowNormal));
+	if (JournalPath.IsEmpty())
+	{
+		return;
+	}
+	Journal = MakeUnique<FsparklogsProgressJournal>(JournalPath);
+	int64 Offset = 0;
+	int LastReadLen = 0;
+	TArray<uint8> State;
+	TArray<int> FollowingReadLens;
+	if (Journal->Read(Offset, LastReadLen, State, FollowingReadLens))
+	{
+		QueuedOffset.store(Offset);
+		DeliveredOffset.store(Offset);
+	}
 }
 
-FsparklogsStressGenerator::~FsparklogsStressGenerator()
+FsparklogsMirrorCursor::~FsparklogsMirrorCursor()
 {
-	if (Thread)
-	{
-		delete Thread;
-	}
-	Thread = nullptr;
 }
 
-bool FsparklogsStressGenerator::Init()
+bool FsparklogsMirrorCursor::TryQueue(int64 StartOffset, int64 EndOffset)
 {
+	// Payloads are only queued by the streamer that owns the cursor, and a payload sent again covers exactly the same data
+	if (StartOffset < QueuedOffset.load())
+	{
+		return false;
+	}
+	QueuedOffset.store(EndOffset);
 	return true;
 }
 
-uint32 FsparklogsStressGenerator::Run()
+void FsparklogsMirrorCursor::MarkDelivered(int64 EndOffset)
 {
-	double StressTestGenerateIntervalSecs = Settings->StressTestGenerateIntervalSecs;
-	int StressTestNumEntriesPerTick = Settings->StressTestNumEntriesPerTick;
-	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator starting. StressTestGenerateIntervalSecs=%.3lf, StressTestNumEntriesPerTick=%d"), StressTestGenerateIntervalSecs, StressTestNumEntriesPerTick);
-	while (StopRequestCounter.GetValue() == 0)
+	DeliveredOffset.store(EndOffset);
+	if (Journal.IsValid())
 	{
-		for (int i = 0; i < StressTestNumEntriesPerTick; i++)
-		{
-			UE_LOG(LogEngine, Log, TEXT("FsparklogsStressGenerator|Stress test message is being generated at platform_time=%.3lf, iteration=%d, 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 100 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 200 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 300 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 400"), FPlatformTime::Seconds(), i);
-		}
-		FPlatformProcess::SleepNoStats(StressTestGenerateIntervalSecs);
+		Journal->Write(EndOffset, 0, nullptr, nullptr);
 	}
-	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator stopped..."));
-	return 0;
 }
 
-void FsparklogsStressGenerator::Stop()
+void FsparklogsMirrorCursor::Reset(int64 Offset)
 {
-	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator requesting stop..."));
-	StopRequestCounter.Increment();
+	QueuedOffset.store(Offset);
+	MarkDelivered(Offset);
 }
 
-// =============== FsparklogsReadAndStreamToCloud ===============================================================================
+// =============== FsparklogsPayloadMirror ===============================================================================
 
-void FsparklogsReadAndStreamToCloud::ComputeCommonEventJSON(bool IncludeCommonMetadata, const FString& AppInstanceID, int InstanceIndex, const TMap<FString, FString>* AdditionalAttributes)
+FsparklogsPayloadMirror::FsparklogsPayloadMirror(const FString& InName, TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InProcessor, bool InUncompressed, TSharedRef<FsparklogsSettings> InSettings)
+	: Name(InName)
+	, Processor(InProcessor)
+	, Uncompressed(InUncompressed)
+	, Settings(InSettings)
+	, MaxLagBytes(InSettings->MirrorMaxLagBytes)
+	, Thread(nullptr)
+	, WakeEvent(FPlatformProcess::GetSynchEventFromPool(false))
+	, DeliveredPayloads(0)
+	, DeliveredBytes(0)
+	, DroppedPayloads(0)
+	, FailedAttempts(0)
+	, QueuedBytes(0)
+	, Delivering(false)
 {
-	FString CommonEventJSON;
+	check(FPlatformProcess::SupportsMultithreading());
+	FString ThreadName = FString::Printf(TEXT("SparkLogs_Mirror_%s"), *Name);
+	FPlatformAtomics::InterlockedExchangePtr((void**)&Thread, FRunnableThread::Create(this, *ThreadName, 0, TPri_BelowNormal));
+}
 
-	if (IncludeCommonMetadata)
+FsparklogsPayloadMirror::~FsparklogsPayloadMirror()
+{
+	if (Thread)
 	{
-		FString EffectiveComputerName;
-		if (OverrideComputerName.IsEmpty())
-		{
-			EffectiveComputerName = FPlatformProcess::ComputerName();
-		}
-		else
-		{
-			EffectiveComputerName = OverrideComputerName;
-		}
-
-		CommonEventJSON.Appendf(TEXT("\"hostname\": %s, \"pid\": %d"), *EscapeJsonString(EffectiveComputerName), FPlatformProcess::GetCurrentProcessId());
-		FString ProjectName = FApp::GetProjectName();
-		if (ProjectName.Len() > 0 && ProjectName != "None")
-		{
-			CommonEventJSON.Appendf(TEXT(", \"app\": %s"), *EscapeJsonString(ProjectName));
-		}
+		// Stops and waits for the thread
+		delete Thread;
 	}
+	Thread = nullptr;
+	FPlatformProcess::ReturnSynchEventToPool(WakeEvent);
+	WakeEvent = nullptr;
+}
 
-	if (Settings->AddRandomAppInstanceID && AppInstanceID.Len() > 0)
+void FsparklogsPayloadMirror::Enqueue(const FsparklogsSharedPayload& Payload, TSharedPtr<FsparklogsMirrorCursor, ESPMode::ThreadSafe> Cursor, int64 EndOffset)
+{
 	{
-		if (!CommonEventJSON.IsEmpty())
+		FScopeLock Lock(&QueueCriticalSection);
+		// The payload being delivered is kept, so a mirror that is down still retries with the oldest payload it has. Restarts are never dropped.
+		int NumDropped = 0;
+		for (int i = Delivering ? 1 : 0; i < Queue.Num() && QueuedBytes + Payload.Data->Num() > MaxLagBytes; )
 		{
-			CommonEventJSON.Append(TEXT(", "));
+			if (!Queue[i].Payload.Data.IsValid())
+			{
+				i++;
+				continue;
+			}
+			QueuedBytes -= Queue[i].Payload.Data->Num();
+			Queue.RemoveAt(i);
+			NumDropped++;
 		}
-		CommonEventJSON.Appendf(TEXT("\"app_instance_id\": %s"), *EscapeJsonString(AppInstanceID));
-		if (InstanceIndex > 1)
+		if (NumDropped > 0)
 		{
-			CommonEventJSON.Appendf(TEXT(", \"app_instance_index\": %d"), InstanceIndex);
+			DroppedPayloads.fetch_add(NumDropped);
+			UE_LOG(LogPluginSparkLogs, Verbose, TEXT("Mirror %s fell too far behind, dropped its oldest payloads: num_dropped=%d, max_lag_bytes=%lld"), *Name, NumDropped, MaxLagBytes);
 		}
+		QueuedBytes += Payload.Data->Num();
+		Queue.Add(FQueuedPayload{ Payload, Cursor, EndOffset });
 	}
+	WakeEvent->Trigger();
+}
 
-	// If game ID is set we should always include it regardless, it's required for good analytics data.
-	if (!Settings->AnalyticsGameID.IsEmpty())
+void FsparklogsPayloadMirror::EnqueueRestart(TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe> Cursor)
+{
 	{
-		if (!CommonEventJSON.IsEmpty())
-		{
-			CommonEventJSON.Append(TEXT(", "));
-		}
-		// The standardized field name is "app_id" (more generic as analytics can be used for more than games)
-		CommonEventJSON.Appendf(TEXT("\"app_id\": %s"), *EscapeJsonString(Settings->AnalyticsGameID));
+		FScopeLock Lock(&QueueCriticalSection);
+		Queue.Add(FQueuedPayload{ FsparklogsSharedPayload(), Cursor, 0 });
 	}
+	WakeEvent->Trigger();
+}
 
-	if (nullptr != AdditionalAttributes && AdditionalAttributes->Num() > 0)
+bool FsparklogsPayloadMirror::WaitUntilIdle(double WaitSecs)
+{
+	const double Deadline = FPlatformTime::Seconds() + WaitSecs;
+	const bool OnGameThread = IsInGameThread();
+	double LastTime = FPlatformTime::Seconds();
+	while (true)
 	{
-		for (const TPair<FString, FString>& Pair : *AdditionalAttributes)
 		{
-			if (!CommonEventJSON.IsEmpty())
+			FScopeLock Lock(&QueueCriticalSection);
+			if (Queue.Num() <= 0)
 			{
-				CommonEventJSON.Append(TEXT(","));
+				return true;
 			}
-			CommonEventJSON.Appendf(TEXT("%s:%s"), *EscapeJsonString(Pair.Key), *EscapeJsonString(Pair.Value));
 		}
+		const double Now = FPlatformTime::Seconds();
+		if (Now >= Deadline)
+		{
+			return false;
+		}
+		if (OnGameThread)
+		{
+			// A mirror that ships over HTTP cannot finish a request unless we tick
+			ITLTickGameThreadWhileWaiting(Now - LastTime);
+		}
+		LastTime = Now;
+		FPlatformProcess::SleepNoStats(0.01f);
 	}
-
-	if (!CommonEventJSON.IsEmpty())
-	{
-		UE_LOG(LogPluginSparkLogs, Log, TEXT("Common event JSON computed. unreal_engine_common_event_data={%s}"), *CommonEventJSON);
-		int64 CommonEventJSONLen = FTCHARToUTF8_Convert::ConvertedLength(*CommonEventJSON, CommonEventJSON.Len());
-#if (ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 4))
-		CommonEventJSONData.SetNum(0, EAllowShrinking::No);
-#else
-		CommonEventJSONData.SetNum(0, false);
-#endif
-		CommonEventJSONData.AddUninitialized(CommonEventJSONLen);
-		FTCHARToUTF8_Convert::Convert((ANSICHAR*)CommonEventJSONData.GetData(), CommonEventJSONLen, *CommonEventJSON, CommonEventJSON.Len());
-		WorkerSerializeCommonEventJSON = true;
-	}
-}
-
-FsparklogsReadAndStreamToCloud::FsparklogsReadAndStreamToCloud(int InstanceIndex, const FString& InSourceLogFile, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InPayloadProcessor, int InMaxLineLength, const FString& InOverrideComputerName, const FString& AppInstanceID, const TMap<FString, FString>* AdditionalAttributes)
-	: Settings(InSettings)
-	, PayloadProcessor(InPayloadProcessor)
-	, SourceLogFile(InSourceLogFile)
-	, MaxLineLength(InMaxLineLength)
-	, OverrideComputerName(InOverrideComputerName)
-	, Thread(nullptr)
-	, WorkerShippedLogOffset(0)
-	, WorkerMinNextFlushPlatformTime(0)
-	, WorkerNumConsecutiveFlushFailures(0)
-	, WorkerLastFailedFlushPayloadSize(0)
-	, WorkerSerializeCommonEventJSON(false)
-	, LastFlushPlatformTime(0)
-	, BytesQueuedSinceLastFlush(0)
-{
-	ProgressMarkerPath = ITLGetIndexedStateFileINI(InstanceIndex);
-	ComputeCommonEventJSON(Settings->IncludeCommonMetadata, AppInstanceID, InstanceIndex, AdditionalAttributes);
-
-	WorkerBuffer.AddUninitialized(Settings->BytesPerRequest);
-	int BufferSize = Settings->BytesPerRequest + 4096 + (Settings->BytesPerRequest / 10);
-	WorkerNextPayload.AddUninitialized(BufferSize);
-	WorkerNextEncodedPayload.AddUninitialized(BufferSize);
-	check(MaxLineLength > 0);
-	check(FPlatformProcess::SupportsMultithreading());
-	FString ThreadName = FString::Printf(TEXT("SparkLogs_Reader_%s"), *FPaths::GetBaseFilename(InSourceLogFile));
-	FPlatformAtomics::InterlockedExchangePtr((void**)&Thread, FRunnableThread::Create(this, *ThreadName, 0, TPri_BelowNormal));
 }
 
-FsparklogsReadAndStreamToCloud::~FsparklogsReadAndStreamToCloud()
+void FsparklogsPayloadMirror::GetStats(FStats& OutStats) const
 {
-	if (Thread)
-	{
-		delete Thread;
-	}
-	Thread = nullptr;
+	OutStats.Name = Name;
+	OutStats.DeliveredPayloads = DeliveredPayloads.load();
+	OutStats.DeliveredBytes = DeliveredBytes.load();
+	OutStats.DroppedPayloads = DroppedPayloads.load();
+	OutStats.FailedAttempts = FailedAttempts.load();
+	FScopeLock Lock(&QueueCriticalSection);
+	OutStats.QueuedPayloads = Queue.Num();
+	OutStats.QueuedBytes = QueuedBytes;
 }
 
-bool FsparklogsReadAndStreamToCloud::Init()
+bool FsparklogsPayloadMirror::Init()
 {
 	return true;
 }
 
-uint32 FsparklogsReadAndStreamToCloud::Run()
+uint32 FsparklogsPayloadMirror::Run()
 {
-	WorkerFullyCleanedUp.AtomicSet(false);
-	ReadProgressMarker(WorkerShippedLogOffset, WorkerLastFailedFlushPayloadSize, WorkerOverrideCommonEventJSONData);
-	if (WorkerLastFailedFlushPayloadSize <= 0)
-	{
-		// If we are not in the middle of a pending request, then do not re-use the last state either.
-		WorkerOverrideCommonEventJSONData.Reset();
-	}
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|BEGIN|WorkerShippedLogOffset=%d|WorkerLastFailedFlushPayloadSize=%d|WorkerOverrideCommonEventJSONDataLen=%d"), (int)WorkerShippedLogOffset, WorkerLastFailedFlushPayloadSize, (int)WorkerOverrideCommonEventJSONData.Num());
-	// A pending flush will be processed before stopping
-	while (StopRequestCounter.GetValue() == 0 || FlushRequestCounter.GetValue() > 0)
+	while (StopRequestCounter.GetValue() == 0)
 	{
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|In loop|WorkerLastFlushFailed=%d|FlushRequestCounter=%d|FlushClearMinNextPlatformTime=%d"), WorkerLastFlushFailed ? 1 : 0, (int)FlushRequestCounter.GetValue(), (int)FlushClearMinNextPlatformTime.GetValue());
-		if (FlushClearMinNextPlatformTime.GetValue() > 0)
+		TOptional<FQueuedPayload> Next;
 		{
-			WorkerMinNextFlushPlatformTime = FPlatformTime::Seconds();
-			WorkerNumConsecutiveFlushFailures = 0;
-			FlushClearMinNextPlatformTime.Set(0);
+			FScopeLock Lock(&QueueCriticalSection);
+			if (Queue.Num() > 0)
+			{
+				Next = Queue[0];
+				Delivering = true;
+			}
 		}
-		// Only allow manual flushes if we are not in a retry delay because the last operation failed.
-		if (WorkerLastFlushFailed == false && FlushRequestCounter.GetValue() > 0)
+		if (!Next.IsSet())
 		{
-			int32 NewValue = FlushRequestCounter.Decrement();
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Manual flush requested|FlushRequestCounter=%d"), (int)NewValue);
-			WorkerDoFlush();
+			WakeEvent->Wait(1000);
+			continue;
 		}
-		else if (FPlatformTime::Seconds() >= WorkerMinNextFlushPlatformTime)
+		double RetryAfterSecs = 0.0;
+		const bool Done = WorkerDeliver(Next.GetValue(), RetryAfterSecs);
 		{
-			// If we are waiting on a manual flush, and the retry timer finally expired, it's OK to mark this attempt as processing it.
-			if (FlushRequestCounter.GetValue() > 0)
-			{
-				int32 NewValue = FlushRequestCounter.Decrement();
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Manual flush requested after retry timer expired|FlushRequestCounter=%d"), (int)NewValue);
-			}
-			else
+			FScopeLock Lock(&QueueCriticalSection);
+			if (Done)
 			{
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Periodic flush"));
+				QueuedBytes -= Next->Payload.Data.IsValid() ? Next->Payload.Data->Num() : 0;
+				Queue.RemoveAt(0);
 			}
-			WorkerDoFlush();
+			Delivering = false;
 		}
-		else
+		if (!Done)
 		{
-			// More coarse-grained sleep, we don't need to wake up and do work very often
-			FPlatformProcess::SleepNoStats(0.1f);
+			// Wait before retrying, but wake up right away to stop
+			const double RetryPlatformTime = FPlatformTime::Seconds() + FMath::Max(RetryAfterSecs, Settings->RetryIntervalSecs);
+			while (StopRequestCounter.GetValue() == 0 && FPlatformTime::Seconds() < RetryPlatformTime)
+			{
+				WakeEvent->Wait((uint32)FMath::CeilToInt((RetryPlatformTime - FPlatformTime::Seconds()) * 1000.0));
+			}
 		}
 	}
-	WorkerFullyCleanedUp.AtomicSet(true);
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|END"));
 	return 0;
 }
 
-void FsparklogsReadAndStreamToCloud::Stop()
+void FsparklogsPayloadMirror::Stop()
 {
-	int32 NewValue = StopRequestCounter.Increment();
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Stop|StopRequestCounter=%d"), (int)NewValue);
+	StopRequestCounter.Increment();
+	WakeEvent->Trigger();
+	// Nothing ticks the HTTP module while the thread is being joined, so never wait for a request to time out
+	FScopeLock Lock(&QueueCriticalSection);
+	if (DeliveringPending.IsValid())
+	{
+		DeliveringPending->Cancel();
+	}
 }
 
-bool FsparklogsReadAndStreamToCloud::AccrueWrittenBytes(int N)
+bool FsparklogsPayloadMirror::WorkerDeliver(const FQueuedPayload& Payload, double& OutRetryAfterSecs)
 {
-	int64 Result = N + BytesQueuedSinceLastFlush.fetch_add((int64)N);
-	if (Result >= Settings->UnflushedBytesToAutoFlush)
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsPayloadMirror_WorkerDeliver);
+	if (!Payload.Payload.Data.IsValid())
 	{
-		double Now = FPlatformTime::Seconds();
-		if ((Now - LastFlushPlatformTime.load()) >= Settings->MinIntervalBetweenFlushes)
+		// A restart, recorded once everything queued before it is delivered
+		Payload.Cursor->MarkDelivered(0);
+		return true;
+	}
+	TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending = Processor->BeginProcessSharedPayload(Payload.Payload, nullptr);
+	{
+		FScopeLock Lock(&QueueCriticalSection);
+		DeliveringPending = Pending;
+		if (StopRequestCounter.GetValue() != 0)
 		{
-			// Even though flush hasn't started, we will initiate it, so do not attempt more auto-flushes until the interval has passed again.
-			BytesQueuedSinceLastFlush.store(0);
-			LastFlushPlatformTime.store(Now);
-			RequestFlush();
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|AccrueWrittenBytes|Automatically requesting a flush after the min interval and queued bytes..."));
-			return true;
+			Pending->Cancel();
+		}
+	}
+	const bool Succeeded = Processor->FinishProcessPayload(Pending, nullptr);
+	{
+		FScopeLock Lock(&QueueCriticalSection);
+		DeliveringPending.Reset();
+	}
+	// A payload the sink skipped (e.g., HTTP 400) counts as dropped, not delivered
+	if (Succeeded && !Pending->Cancelled && !Pending->Dropped)
+	{
+		DeliveredPayloads.fetch_add(1);
+		DeliveredBytes.fetch_add(Payload.Payload.OriginalPayloadLen);
+		if (Payload.Cursor.IsValid())
+		{
+			Payload.Cursor->MarkDelivered(Payload.EndOffset);
+		}
+		return true;
+	}
+	FailedAttempts.fetch_add(1);
+	if (Pending->Dropped || !Pending->RetryableFailure)
+	{
+		DroppedPayloads.fetch_add(1);
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("Mirror %s was unable to process a payload and dropped it: http_status=%d, len=%d"), *Name, (int)Pending->ResponseCode, (int)Payload.Payload.Data->Num());
+		if (Payload.Cursor.IsValid())
+		{
+			Payload.Cursor->MarkDelivered(Payload.EndOffset);
 		}
+		return true;
 	}
+	OutRetryAfterSecs = Pending->RetryAfterSecs;
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("MIRROR|WorkerDeliver|Failed, will retry|name=%s|http_status=%d"), *Name, (int)Pending->ResponseCode);
 	return false;
 }
 
-bool FsparklogsReadAndStreamToCloud::RequestFlush()
+// =============== FsparklogsFanOutPayloadProcessor ===============================================================================
+
+FsparklogsFanOutPayloadProcessor::FsparklogsFanOutPayloadProcessor(TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InPrimary)
+	: Primary(InPrimary)
+	, AnyUncompressedMirror(false)
 {
-	// Clear any pending retry timer so we retry immediately
-	WorkerLastFlushFailed.AtomicSet(false);
-	FlushClearMinNextPlatformTime.Increment();
-	// If we've already requested a stop, a flush is impossible
-	if (StopRequestCounter.GetValue() > 0)
+}
+
+void FsparklogsFanOutPayloadProcessor::AddMirror(TUniquePtr<FsparklogsPayloadMirror> Mirror)
+{
+	AnyUncompressedMirror = AnyUncompressedMirror || Mirror->IsUncompressed();
+	Mirrors.Add(MoveTemp(Mirror));
+}
+
+bool FsparklogsFanOutPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	return FinishProcessPayload(BeginProcessPayload(JSONPayloadInUTF8, PayloadLen, OriginalPayloadLen, CompressionMode, StreamerWeakPtr), StreamerWeakPtr);
+}
+
+TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> FsparklogsFanOutPayloadProcessor::BeginProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	return BeginProcessPayloadWithUncompressed(JSONPayloadInUTF8, PayloadLen, OriginalPayloadLen, CompressionMode, nullptr, StreamerWeakPtr);
+}
+
+TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> FsparklogsFanOutPayloadProcessor::BeginProcessPayloadWithUncompressed(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TArray<uint8>* UncompressedPayload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsFanOutPayloadProcessor_BeginProcessPayload);
+	// The mirrors do not wait for the primary to accept the payload, so they keep going while it is unavailable
+	const FsparklogsSharedPayload Encoded = EnqueueForMirrors(JSONPayloadInUTF8, PayloadLen, OriginalPayloadLen, CompressionMode, UncompressedPayload, StreamerWeakPtr);
+	if (Encoded.Data.IsValid())
 	{
-		return false;
+		// The payload buffer now belongs to the mirrors
+		return Primary->BeginProcessSharedPayload(Encoded, StreamerWeakPtr);
 	}
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|RequestFlush|Initiating flush by incrementing counter..."));
-	FlushRequestCounter.Increment();
-	return true;
+	return Primary->BeginProcessPayload(JSONPayloadInUTF8, PayloadLen, OriginalPayloadLen, CompressionMode, StreamerWeakPtr);
 }
 
-bool FsparklogsReadAndStreamToCloud::FlushAndWait(int N, bool ClearRetryTimer, bool InitiateStop, bool OnMainGameThread, double TimeoutSec, bool& OutLastFlushProcessedEverything)
+bool FsparklogsFanOutPayloadProcessor::FinishProcessPayload(TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
 {
-	OutLastFlushProcessedEverything = false;
-	bool WasSuccessful = true;
+	return Primary->FinishProcessPayload(Pending, StreamerWeakPtr);
+}
 
-	// If we've already requested a stop, a flush is impossible
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|StopRequestCounter=%d"), (int)StopRequestCounter.GetValue());
-	if (StopRequestCounter.GetValue() > 0)
+void FsparklogsFanOutPayloadProcessor::CreateMirrorCursors(const FString& JournalPath, TArray<TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>>& OutCursors)
+{
+	OutCursors.Reset();
+	for (const TUniquePtr<FsparklogsPayloadMirror>& Mirror : Mirrors)
 	{
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|stop already requested, exiting with false"));
-		return false;
+		const FString CursorJournalPath = JournalPath.IsEmpty() ? FString() : FPaths::ChangeExtension(JournalPath, Mirror->GetName() + TEXT(".journal"));
+		OutCursors.Add(MakeShared<FsparklogsMirrorCursor, ESPMode::ThreadSafe>(CursorJournalPath));
 	}
+}
 
-	if (ClearRetryTimer)
+void FsparklogsFanOutPayloadProcessor::MirrorPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TArray<uint8>* UncompressedPayload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	EnqueueForMirrors(JSONPayloadInUTF8, PayloadLen, OriginalPayloadLen, CompressionMode, UncompressedPayload, StreamerWeakPtr);
+}
+
+void FsparklogsFanOutPayloadProcessor::RestartMirrors(const TArray<TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>>& Cursors)
+{
+	for (int i = 0; i < Cursors.Num() && i < Mirrors.Num(); i++)
 	{
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Clearing retry timer..."));
-		// Clear any pending retry timer so we retry immediately
-		WorkerLastFlushFailed.AtomicSet(false);
-		FlushClearMinNextPlatformTime.Increment();
+		Cursors[i]->Reset(0);
+		Mirrors[i]->EnqueueRestart(Cursors[i]);
 	}
+}
 
-	for (int i = 0; i < N; i++)
+FsparklogsSharedPayload FsparklogsFanOutPayloadProcessor::EnqueueForMirrors(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TArray<uint8>* UncompressedPayload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+{
+	int64 StartOffset = 0, EndOffset = 0;
+	bool IsEnvelope = false;
+	TArray<TSharedPtr<FsparklogsMirrorCursor, ESPMode::ThreadSafe>> Cursors;
+	Cursors.SetNum(Mirrors.Num());
+	TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = StreamerWeakPtr.Pin();
+	if (Streamer.IsValid())
 	{
-		int StartFlushSuccessOpCounter = FlushSuccessOpCounter.GetValue();
-		int StartFlushOpCounter = FlushOpCounter.GetValue();
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Starting Loop|i=%d|N=%d|FlushSuccessOpCounter=%d|FlushOpCounter=%d"), (int)i, (int)N, (int)StartFlushSuccessOpCounter, (int)StartFlushOpCounter);
-		FlushRequestCounter.Increment();
-		// Last time around, we might initiate a stop
-		if (InitiateStop && i == N-1)
+		Streamer->WorkerGetNextPayloadRange(StartOffset, EndOffset);
+		IsEnvelope = Streamer->WorkerIsNextPayloadEnvelope();
+		const TArray<TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>>& StreamerCursors = Streamer->GetMirrorCursors();
+		for (int i = 0; i < StreamerCursors.Num() && i < Cursors.Num(); i++)
 		{
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Initiating stop..."));
-			Stop();
+			Cursors[i] = StreamerCursors[i];
 		}
-		double StartTime = FPlatformTime::Seconds();
-		double LastTime = StartTime;
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Waiting for request to finish...|StartTime=%.3lf"), StartTime);
-		while (FlushOpCounter.GetValue() == StartFlushOpCounter)
+	}
+	Streamer.Reset();
+
+	// One buffer for all of the mirrors that get the encoded payload, and one for those that get the JSON payload. They take over the
+	// buffers of the streamer (which builds the next payload in new ones), and a retry that every mirror already has is not touched at all.
+	FsparklogsSharedPayload Encoded;
+	Encoded.OriginalPayloadLen = OriginalPayloadLen;
+	Encoded.CompressionMode = CompressionMode;
+	Encoded.IsEnvelope = IsEnvelope;
+	FsparklogsSharedPayload Uncompressed = Encoded;
+	Uncompressed.CompressionMode = ITLCompressionMode::None;
+	for (int i = 0; i < Mirrors.Num(); i++)
+	{
+		if (Cursors[i].IsValid() && !Cursors[i]->TryQueue(StartOffset, EndOffset))
 		{
-			double Now = FPlatformTime::Seconds();
-			if (Now - StartTime > TimeoutSec)
-			{
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Timed out, returning false"));
-				return false;
-			}
-			if (OnMainGameThread)
+			continue;
+		}
+		FsparklogsSharedPayload* Shared = &Encoded;
+		if (Mirrors[i]->IsUncompressed() && CompressionMode != ITLCompressionMode::None)
+		{
+			Shared = &Uncompressed;
+			if (!Uncompressed.Data.IsValid())
 			{
-				// HTTP requests and other things won't be processed unless we tick
-				double DeltaTime = Now - LastTime;
-				FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
-#if ENGINE_MAJOR_VERSION >= 5
-				FTSTicker::GetCoreTicker().Tick(DeltaTime);
-#else
-				FTicker::GetCoreTicker().Tick(DeltaTime);
-#endif
-				FThreadManager::Get().Tick();
-				// NOTE: the game does not normally progress the frame count during shutdown, follow the same logic here
-				// GFrameCounter++;
+				TSharedRef<TArray<uint8>, ESPMode::ThreadSafe> Data = MakeShared<TArray<uint8>, ESPMode::ThreadSafe>();
+				if (UncompressedPayload != nullptr)
+				{
+					*Data = MoveTemp(*UncompressedPayload);
+					UncompressedPayload = nullptr;
+				}
+				else if (!ITLDecompressData(CompressionMode, Encoded.Data.IsValid() ? Encoded.Data->GetData() : JSONPayloadInUTF8.GetData(), PayloadLen, OriginalPayloadLen, *Data))
+				{
+					// Only happens if the caller could not provide the JSON payload. The primary still gets the payload as usual.
+					UE_LOG(LogPluginSparkLogs, Warning, TEXT("FanOutPayloadProcessor: failed to decompress payload for mirrors: mode=%d, len=%d, original_len=%d"), (int)CompressionMode, PayloadLen, OriginalPayloadLen);
+					continue;
+				}
+				Uncompressed.Data = Data;
 			}
-			FPlatformProcess::SleepNoStats(0.005f);
-			LastTime = Now;
 		}
-		WasSuccessful = FlushSuccessOpCounter.GetValue() != StartFlushSuccessOpCounter;
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Finished waiting for request|WasSuccessful=%d|FlushSuccessOpCounter=%d|FlushOpCounter=%d"), WasSuccessful ? 1 : 0, (int)FlushSuccessOpCounter.GetValue(), (int)FlushOpCounter.GetValue());
-	}
-	if (WasSuccessful)
-	{
-		OutLastFlushProcessedEverything = LastFlushProcessedEverything;
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|LastFlushProcessedEverything=%d"), OutLastFlushProcessedEverything ? 1 : 0);
-	}
-	if (InitiateStop) {
-		// Wait for the worker to fully stop, up to the timeout
-		double StartTime = FPlatformTime::Seconds();
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Waiting for thread to stop...|StartTime=%.3lf"), StartTime);
-		while (!WorkerFullyCleanedUp)
+		else if (!Encoded.Data.IsValid())
 		{
-			if (FPlatformTime::Seconds() - StartTime > TimeoutSec)
+			TSharedRef<TArray<uint8>, ESPMode::ThreadSafe> Data = MakeShared<TArray<uint8>, ESPMode::ThreadSafe>();
+			if (PayloadLen == JSONPayloadInUTF8.Num())
 			{
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Timed out waiting for thread to stop"));
-				return false;
+				*Data = MoveTemp(JSONPayloadInUTF8);
 			}
-			FPlatformProcess::SleepNoStats(0.005f);
+			else
+			{
+				Data->Append(JSONPayloadInUTF8.GetData(), PayloadLen);
+			}
+			Encoded.Data = Data;
 		}
+		Mirrors[i]->Enqueue(*Shared, Cursors[i], EndOffset);
 	}
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|END|WasSuccessful=%d"), WasSuccessful ? 1 : 0);
-	return WasSuccessful;
+	return Encoded;
 }
 
-bool FsparklogsReadAndStreamToCloud::ReadProgressMarker(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutProgressState)
+bool FsparklogsFanOutPayloadProcessor::AcceptsCommonMetadataEnvelope()
 {
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|ReadProgressMarker|inifile='%s'|BEGIN"), *ProgressMarkerPath);
-	OutMarker = 0;
-	OutLastReadLen = 0;
-	OutProgressState.Reset();
-	double OutDouble = 0.0;
-	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-	FString OutStringValue, OutLastReadLenStringValue, OutCompressedStateStringValue;
-	bool Result = GConfig->GetString(ITL_CONFIG_SECTION_NAME, ProgressMarkerValue, OutStringValue, ProgressMarkerPath);
-	GConfig->GetString(ITL_CONFIG_SECTION_NAME, ProgressMarkerLastReadLenValue, OutLastReadLenStringValue, ProgressMarkerPath);
-	GConfig->GetString(ITL_CONFIG_SECTION_NAME, ProgressMarkerStateValue, OutCompressedStateStringValue, ProgressMarkerPath);
-	ConfigLock1.Unlock();
-
-	OutStringValue.TrimStartAndEndInline();
-	OutLastReadLenStringValue.TrimStartAndEndInline();
-	OutCompressedStateStringValue.TrimStartAndEndInline();
-	OutMarker = FCString::Atoi64(*OutStringValue);
-	OutLastReadLen = FCString::Atoi(*OutLastReadLenStringValue);
-	FString CompressedStateOriginalLenString, CompressedStateEncodedData;
-	if (OutCompressedStateStringValue.Len() > 0 && OutCompressedStateStringValue.Split(TEXT(":"), &CompressedStateOriginalLenString, &CompressedStateEncodedData))
+	if (!Primary->AcceptsCommonMetadataEnvelope())
 	{
-		bool DecodedSuccess = false;
-		int StateOriginalLen = FCString::Atoi(*CompressedStateOriginalLenString);
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|ReadProgressMarker|decoding progress state|original_len=%d|base64_len=%d"), StateOriginalLen, CompressedStateEncodedData.Len());
-		TArray<uint8> CompressedState;
-		uint32 DecodedSize = FBase64::GetDecodedDataSize(CompressedStateEncodedData);
-		if (StateOriginalLen > 0 && StateOriginalLen < (1024 * 1024) && DecodedSize > 0 && DecodedSize < (1024 * 1024))
-		{
-			CompressedState.Reserve(DecodedSize);
-			OutProgressState.Reserve(StateOriginalLen);
-			if (FBase64::Decode(CompressedStateEncodedData, CompressedState))
-			{
-				if (ITLDecompressData(ITLCompressionMode::LZ4, CompressedState.GetData(), CompressedState.Num(), StateOriginalLen, OutProgressState))
-				{
-					ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|ReadProgressMarker|decoded progress state|original_len=%d|decompressed_len=%d"), StateOriginalLen, OutProgressState.Num());
-					DecodedSuccess = true;
-				}
-			}
-		}
-		if (!DecodedSuccess)
+		return false;
+	}
+	for (const TUniquePtr<FsparklogsPayloadMirror>& Mirror : Mirrors)
+	{
+		if (!Mirror->GetProcessor().AcceptsCommonMetadataEnvelope())
 		{
-			// It's OK just to use only the new state.
-			UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to decode previous progress state (will ignore)."));
-			OutProgressState.Reset();
+			return false;
 		}
 	}
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|ReadProgressMarker|inifile='%s'|Result=%s|MarkerString=%s|Marker=%ld|LastReadLen=%d|ProgressStateLen=%d"), *ProgressMarkerPath, Result ? TEXT("success") : TEXT("failure"), *OutStringValue, OutMarker, OutLastReadLen, (int)OutProgressState.Num());
 	return true;
 }
 
-bool FsparklogsReadAndStreamToCloud::WriteProgressMarker(int64 InMarker, int LastReadLen, const TArray<uint8>* ProgressState)
+bool FsparklogsFanOutPayloadProcessor::WaitForMirrors(double WaitSecs)
 {
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WriteProgressMarker|inifile='%s'|Marker=%lld|LastReadLen=%d"), *ProgressMarkerPath, InMarker, LastReadLen);
-	// TODO: should we use the sqlite plugin instead, maybe it's not as much overhead as writing INI file each time?
-	// Precise to 52+ bits
-	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-	bool WasDisabled = GConfig->AreFileOperationsDisabled();
-	GConfig->EnableFileOperations();
-	GConfig->SetString(ITL_CONFIG_SECTION_NAME, ProgressMarkerValue, *FString::Printf(TEXT("%ld"), InMarker), ProgressMarkerPath);
-	GConfig->SetString(ITL_CONFIG_SECTION_NAME, ProgressMarkerLastReadLenValue, *FString::Printf(TEXT("%ld"), LastReadLen), ProgressMarkerPath);
-	if (ProgressState != nullptr)
+	const double Deadline = FPlatformTime::Seconds() + WaitSecs;
+	bool AllIdle = true;
+	for (const TUniquePtr<FsparklogsPayloadMirror>& Mirror : Mirrors)
 	{
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WriteProgressMarker|starting to save progress state|uncompressed_len=%d"), ProgressState->Num());
-		bool SavedState = false;
-		if (ProgressState->Num() > 0)
-		{
-			// Format is <original_len>:<base_64_encoded_lz4_compressed_state>
-			FString OriginalLenPrefix = FString::Printf(TEXT("%d:"), (int)ProgressState->Num());
-			TArray<uint8> CompressedState;
-			CompressedState.Reserve(ProgressState->Num() + 8);
-			if (ITLCompressData(ITLCompressionMode::LZ4, ProgressState->GetData(), ProgressState->Num(), CompressedState))
-			{
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WriteProgressMarker|saving progress state|compressed_len=%d"), CompressedState.Num());
-				FString Encoded = FBase64::Encode(CompressedState);
-				if (!Encoded.IsEmpty() && Encoded.Len() < (1024 * 64))
-				{
-					FString CombinedState = OriginalLenPrefix + Encoded;
-					ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WriteProgressMarker|saved progress state|value=%s"), *CombinedState);
-					GConfig->SetString(ITL_CONFIG_SECTION_NAME, ProgressMarkerStateValue, *CombinedState, ProgressMarkerPath);
-					SavedState = true;
-				}
-			}
-		}
-		if (!SavedState)
-		{
-			if (ProgressState->Num() > 0)
-			{
-				// Even though we failed to save the state, it's better to clear it out than allow a stale state, so just log a warning.
-				UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to save progress state."));
-			}
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WriteProgressMarker|clearing progress state from INI file"));
-			GConfig->SetString(ITL_CONFIG_SECTION_NAME, ProgressMarkerStateValue, TEXT(""), ProgressMarkerPath);
-		}
+		AllIdle = Mirror->WaitUntilIdle(Deadline - FPlatformTime::Seconds()) && AllIdle;
 	}
-	GConfig->Flush(false, ProgressMarkerPath);
-	if (WasDisabled)
+	return AllIdle;
+}
+
+void FsparklogsFanOutPayloadProcessor::GetMirrorStats(TArray<FsparklogsPayloadMirror::FStats>& OutStats) const
+{
+	OutStats.SetNum(Mirrors.Num());
+	for (int i = 0; i < Mirrors.Num(); i++)
 	{
-		GConfig->DisableFileOperations();
+		Mirrors[i]->GetStats(OutStats[i]);
 	}
-	return true;
 }
 
-void FsparklogsReadAndStreamToCloud::DeleteProgressMarker()
+// =============== FsparklogsBenchmark ===============================================================================
+
+static const TCHAR* BenchmarkMessageMarker = TEXT("[bench:");
+static const ANSICHAR* BenchmarkMessageMarkerUTF8 = "[bench:";
+
+FsparklogsBenchmarkOptions::FsparklogsBenchmarkOptions()
+	: NumThreads(4)
+	, MessagesPerThread(20000)
+	, MinMessageLen(40)
+	, MaxMessageLen(400)
+	, LargeMessagePercent(1.0)
+	, LargeMessageLen(8 * 1024)
+	, UnicodePercent(2.0)
+	, Seed(12345)
 {
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|DeleteProgressMarker|inifile='%s'"), *ProgressMarkerPath);
-	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
-	bool WasDisabled = GConfig->AreFileOperationsDisabled();
-	GConfig->EnableFileOperations();
-	if (!GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, ProgressMarkerValue, ProgressMarkerPath))
+}
+
+void FsparklogsBenchmarkOptions::Parse(const TCHAR* Params)
+{
+	if (Params == nullptr)
 	{
-		GConfig->SetString(ITL_CONFIG_SECTION_NAME, ProgressMarkerValue, TEXT("0"), ProgressMarkerPath);
+		return;
 	}
-	if (!GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, ProgressMarkerStateValue, ProgressMarkerPath))
+	float FloatValue = 0.0f;
+	FParse::Value(Params, TEXT("threads="), NumThreads);
+	FParse::Value(Params, TEXT("messages="), MessagesPerThread);
+	FParse::Value(Params, TEXT("minlen="), MinMessageLen);
+	FParse::Value(Params, TEXT("maxlen="), MaxMessageLen);
+	if (FParse::Value(Params, TEXT("largepct="), FloatValue))
 	{
-		GConfig->SetString(ITL_CONFIG_SECTION_NAME, ProgressMarkerStateValue, TEXT(""), ProgressMarkerPath);
+		LargeMessagePercent = FloatValue;
 	}
-	if (!GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, ProgressMarkerLastReadLenValue, ProgressMarkerPath))
+	FParse::Value(Params, TEXT("largelen="), LargeMessageLen);
+	if (FParse::Value(Params, TEXT("unicodepct="), FloatValue))
 	{
-		GConfig->SetString(ITL_CONFIG_SECTION_NAME, ProgressMarkerLastReadLenValue, TEXT(""), ProgressMarkerPath);
+		UnicodePercent = FloatValue;
 	}
-	GConfig->Flush(false, ProgressMarkerPath);
-	if (WasDisabled)
+	FParse::Value(Params, TEXT("seed="), Seed);
+
+	NumThreads = FMath::Clamp(NumThreads, 1, 64);
+	MessagesPerThread = FMath::Max(MessagesPerThread, 1);
+	MinMessageLen = FMath::Clamp(MinMessageLen, 1, GMaxLineLength / 8);
+	MaxMessageLen = FMath::Clamp(MaxMessageLen, MinMessageLen, GMaxLineLength / 8);
+	LargeMessagePercent = FMath::Clamp(LargeMessagePercent, 0.0, 100.0);
+	LargeMessageLen = FMath::Clamp(LargeMessageLen, 1, GMaxLineLength / 8);
+	UnicodePercent = FMath::Clamp(UnicodePercent, 0.0, 100.0);
+}
+
+void FsparklogsBenchmarkOptions::GenerateMessage(FRandomStream& Random, FString& OutMessage) const
+{
+	// Text that resembles typical log lines, including characters that must be escaped in JSON
+	static const TCHAR* SampleText = TEXT("Player 17 spawned at (1024.50, -33.25, 90.00) in level \"Arena_02\"\tping=45ms path=C:\\Games\\Saved\\Logs ok; ");
+	static const int32 SampleTextLen = FCString::Strlen(SampleText);
+
+	const bool Large = LargeMessagePercent > 0 && (Random.FRand() * 100.0) < LargeMessagePercent;
+	const int32 Len = Large ? LargeMessageLen : Random.RandRange(MinMessageLen, MaxMessageLen);
+	OutMessage.Reset(Len + 1);
+	int32 SampleOffset = Random.RandRange(0, SampleTextLen - 1);
+	while (OutMessage.Len() < Len)
 	{
-		GConfig->DisableFileOperations();
+		if (UnicodePercent > 0 && (Random.FRand() * 100.0) < UnicodePercent)
+		{
+			switch (Random.RandRange(0, 2))
+			{
+				case 0: OutMessage.AppendChar(TEXT('\u00E9')); break;
+				case 1: OutMessage.AppendChar(TEXT('\u4E16')); break;
+				default:
+					if (sizeof(TCHAR) == 2)
+					{
+						// U+1F600 as a UTF-16 surrogate pair
+						OutMessage.AppendChar((TCHAR)0xD83D);
+						OutMessage.AppendChar((TCHAR)0xDE00);
+					}
+					else
+					{
+						OutMessage.AppendChar((TCHAR)0x1F600);
+					}
+					break;
+			}
+		}
+		else
+		{
+			OutMessage.AppendChar(SampleText[SampleOffset]);
+			SampleOffset = (SampleOffset + 1) % SampleTextLen;
+		}
 	}
 }
 
-void FsparklogsReadAndStreamToCloud::GetCommonEventJSON(TArray<uint8>& OutData)
+#if !UE_BUILD_SHIPPING
+FsparklogsBenchmarkResult::FsparklogsBenchmarkResult(const TCHAR* InScenario, int InNumThreads)
+	: Scenario(InScenario)
+	, NumThreads(InNumThreads)
+	, Operations(0)
+	, Bytes(0)
+	, Seconds(0.0)
+	, P50Ms(-1.0)
+	, P90Ms(-1.0)
+	, P99Ms(-1.0)
+	, MaxMs(-1.0)
+	, CompressionRatio(-1.0)
 {
-	OutData = CommonEventJSONData;
 }
 
-bool FindFirstByte(const uint8* Haystack, uint8 Needle, int MaxToSearch, int& OutIndex)
+void FsparklogsBenchmarkResult::SetLatencies(TArray<double>& LatencySecs)
 {
-	OutIndex = -1;
-	for (const uint8* RESTRICT Data = Haystack, *RESTRICT End = Data + MaxToSearch; Data != End; ++Data)
+	if (LatencySecs.Num() <= 0)
 	{
-		if (*Data == Needle)
-		{
-			OutIndex = static_cast<int>(Data - Haystack);
-			return true;
-		}
+		return;
 	}
-	return false;
+	LatencySecs.Sort();
+	auto Percentile = [&LatencySecs](double P)
+	{
+		const int32 Index = FMath::Clamp(FMath::CeilToInt(P * LatencySecs.Num()) - 1, 0, LatencySecs.Num() - 1);
+		return LatencySecs[Index] * 1000.0;
+	};
+	P50Ms = Percentile(0.50);
+	P90Ms = Percentile(0.90);
+	P99Ms = Percentile(0.99);
+	MaxMs = LatencySecs.Last() * 1000.0;
 }
 
-/** Append UTF-8 encoded string data as an escaped JSON string value. Also convert the
-  * special encoded newline (CharInternalNewline) to a real newline. */
-void AppendUTF8AsEscapedJsonString(TITLJSONStringBuilder& Builder, const ANSICHAR* String, int N)
+FString FsparklogsBenchmarkResult::ToJSON() const
 {
-	ANSICHAR ControlFormatBuf[16];
-	ANSICHAR OneCharBuf[2] = {0, 0};
-	Builder.Append("\"");
-	for (const ANSICHAR* RESTRICT Data = String, *RESTRICT End = Data + N; Data != End; ++Data)
+	auto OptionalNumber = [](double Value)
 	{
-		switch (*Data)
-		{
-		case '\"':
-			Builder.Append("\\\"", 2 /* string length */);
-			break;
-		case '\b':
-			Builder.Append("\\b", 2 /* string length */);
-			break;
-		case '\t':
-			Builder.Append("\\t", 2 /* string length */);
-			break;
-		case '\n':
-			Builder.Append("\\n", 2 /* string length */);
-			break;
-		case static_cast<ANSICHAR>(CharInternalNewline):
-			Builder.Append("\\n", 2 /* string length */);
-			break;
-		case '\f':
-			Builder.Append("\\f", 2 /* string length */);
-			break;
-		case '\r':
-			Builder.Append("\\r", 2 /* string length */);
-			break;
-		case '\\':
-			Builder.Append("\\\\", 2 /* string length */);
-			break;
-		default:
-			// Any character 0x20 and above can be included as-is
-			if ((uint8)(*Data) >= static_cast<UTF8CHAR>(0x20))
-			{
-				OneCharBuf[0] = *Data;
-				Builder.Append(OneCharBuf);
-			}
-			else
-			{
-				// Rare control character
-				FCStringAnsi::Snprintf(ControlFormatBuf, sizeof(ControlFormatBuf), "\\u%04x", static_cast<int>(*Data));
-				Builder.Append(ControlFormatBuf);
-			}
-		}
-	}
-	Builder.Append("\"");
+		return (Value < 0) ? FString(TEXT("null")) : FString::Printf(TEXT("%.4lf"), Value);
+	};
+	return FString::Printf(
+		TEXT("{\"scenario\":\"%s\",\"threads\":%d,\"operations\":%lld,\"bytes\":%lld,\"seconds\":%.6lf,\"ops_per_sec\":%.1lf,\"mb_per_sec\":%.3lf,\"p50_ms\":%s,\"p90_ms\":%s,\"p99_ms\":%s,\"max_ms\":%s,\"compression_ratio\":%s,\"kernel\":\"%s\"}"),
+		*Scenario, NumThreads, (long long)Operations, (long long)Bytes, Seconds, GetOpsPerSec(), GetMBPerSec(),
+		*OptionalNumber(P50Ms), *OptionalNumber(P90Ms), *OptionalNumber(P99Ms), *OptionalNumber(MaxMs), *OptionalNumber(CompressionRatio),
+		ITLGetPayloadKernelName());
 }
 
-bool FsparklogsReadAndStreamToCloud::WorkerReadNextPayload(int& OutNumToRead, int64& OutEffectiveShippedLogOffset, int64& OutRemainingBytes)
+/** Local payload sink for benchmarks. Optionally records the log-to-ack latency of every benchmark message in each payload. */
+class FsparklogsBenchmarkSink : public IsparklogsPayloadProcessor
 {
-	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerReadNextPayload);
-
-	OutEffectiveShippedLogOffset = WorkerShippedLogOffset;
+public:
+	/** SendTimes (if any) holds the platform time each of the NumSendTimes benchmark messages was logged, indexed by the number in its marker.
+	  * The logging threads store them while the streamer thread reads them, hence atomic. */
+	FsparklogsBenchmarkSink(const std::atomic<double>* InSendTimes, int64 InNumSendTimes) : SendTimes(InSendTimes), NumSendTimes(InNumSendTimes), NumPayloads(0), NumBytes(0), NumAcked(0) { }
 
-	// Re-open the file. UE doesn't contain cross-platform class that can stay open and refresh the filesize OR to read up to N (but maybe less than N bytes).
-	// The only solution and stay within UE class library is to just re-open the file every flush request. This is actually quite fast on modern platforms.
-	TUniquePtr<IFileHandle> WorkerReader;
-	// Try twice because there can be race conditions with the file not existing and trying to open it...
-	constexpr int MaxRetries = 2;
-	for (int i = 1; true; i++)
+	virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override
 	{
-		WorkerReader.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*SourceLogFile, true));
-		if (WorkerReader != nullptr)
+		const double Now = FPlatformTime::Seconds();
+		NumPayloads.fetch_add(1);
+		NumBytes.fetch_add(OriginalPayloadLen);
+		if (SendTimes == nullptr)
 		{
-			break;
+			return true;
 		}
-		else
+		const uint8* Data = JSONPayloadInUTF8.GetData();
+		int DataLen = PayloadLen;
+		if (CompressionMode != ITLCompressionMode::None)
 		{
-			int ErrorCode = FPlatformMisc::GetLastError();
-			if (!FPaths::FileExists(SourceLogFile))
+			if (!ITLDecompressData(CompressionMode, JSONPayloadInUTF8.GetData(), PayloadLen, OriginalPayloadLen, DecompressedData))
 			{
-				OutEffectiveShippedLogOffset = 0;
-				OutNumToRead = 0;
-				OutRemainingBytes = 0;
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|Logfile does not yet exist, nothing to read|logfile='%s'"), *SourceLogFile);
-				return true;
+				return false;
 			}
-			else
+			Data = DecompressedData.GetData();
+			DataLen = DecompressedData.Num();
+		}
+		const int MarkerLen = FCStringAnsi::Strlen(BenchmarkMessageMarkerUTF8);
+		FScopeLock Lock(&LatenciesCriticalSection);
+		for (int i = 0; i + MarkerLen < DataLen; i++)
+		{
+			if (Data[i] != '[' || FMemory::Memcmp(Data + i, BenchmarkMessageMarkerUTF8, MarkerLen) != 0)
 			{
-				if (i >= MaxRetries)
-				{
-					TCHAR ErrBuffer[2048] = { 0, 0 };
-					UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to open logfile='%s' err=%d msg=%s"), *SourceLogFile, ErrorCode, FPlatformMisc::GetSystemErrorMessage(ErrBuffer, sizeof(ErrBuffer)-2, ErrorCode));
-					return false;
-				}
-				FPlatformProcess::Sleep(0.01f);
+				continue;
+			}
+			int64 Index = 0;
+			for (i += MarkerLen; i < DataLen && Data[i] >= '0' && Data[i] <= '9'; i++)
+			{
+				Index = Index * 10 + (Data[i] - '0');
+			}
+			if (Index < NumSendTimes)
+			{
+				Latencies.Add(Now - SendTimes[Index].load());
+				NumAcked.fetch_add(1);
 			}
 		}
+		return true;
 	}
-	int64 FileSize = WorkerReader->Size();
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|opened log file|last_offset=%ld|current_file_size=%ld|logfile='%s'"), OutEffectiveShippedLogOffset, FileSize, *SourceLogFile);
-	if (OutEffectiveShippedLogOffset > FileSize)
+
+	const std::atomic<double>* SendTimes;
+	int64 NumSendTimes;
+	std::atomic<int64> NumPayloads;
+	std::atomic<int64> NumBytes;
+	std::atomic<int64> NumAcked;
+	FCriticalSection LatenciesCriticalSection;
+	TArray<double> Latencies;
+
+protected:
+	TArray<uint8> DecompressedData;
+};
+
+static int64 ITLGetBenchmarkUTF8Len(const TArray<TArray<FString>>& Messages)
+{
+	int64 Len = 0;
+	for (const TArray<FString>& ThreadMessages : Messages)
 	{
-		UE_LOG(LogPluginSparkLogs, Log, TEXT("STREAMER: Logfile reduced size, re-reading from start: new_size=%ld, previously_processed_to=%ld, logfile='%s'"), FileSize, OutEffectiveShippedLogOffset, *SourceLogFile);
-		OutEffectiveShippedLogOffset = 0;
-		// Don't force a retried read to use the same payload size as last time since the whole file has changed.
-		WorkerLastFailedFlushPayloadSize = 0;
-		WorkerOverrideCommonEventJSONData.Reset();
+		for (const FString& Message : ThreadMessages)
+		{
+			Len += FTCHARToUTF8_Convert::ConvertedLength(*Message, Message.Len());
+		}
 	}
-	// Start at the last known shipped position, read as many bytes as possible up to the max buffer size, and capture log lines into a JSON payload
-	WorkerReader->Seek(OutEffectiveShippedLogOffset);
-	OutRemainingBytes = FileSize - OutEffectiveShippedLogOffset;
-	OutNumToRead = (int)(FMath::Clamp<int64>(OutRemainingBytes, 0, (int64)(WorkerBuffer.Num())));
-	if (WorkerLastFailedFlushPayloadSize > 0 && OutNumToRead > WorkerLastFailedFlushPayloadSize)
+	return Len;
+}
+
+FsparklogsBenchmark::FsparklogsBenchmark(const FsparklogsBenchmarkOptions& InOptions, const FString& InWorkDir)
+	: Options(InOptions)
+	, WorkDir(InWorkDir)
+	, InstanceIndex(FMath::RandRange(100000, 999999))
+	, CreatedWorkDir(false)
+{
+	if (!IFileManager::Get().DirectoryExists(*WorkDir))
 	{
-		// Retried requests always use the same max payload size as last time,
-		// so that any retry has the same data as last time and can be deduplicated in worst-case scenarios.
-		// (e.g., an actual observed scenario where Unreal Engine HTTP plugin was sending requests successfully
-		// but was not processing responses properly and instead timing them out...)
-		OutNumToRead = WorkerLastFailedFlushPayloadSize;
+		CreatedWorkDir = IFileManager::Get().MakeDirectory(*WorkDir, true);
 	}
-	if (OutNumToRead <= 0)
+}
+
+FsparklogsBenchmark::~FsparklogsBenchmark()
+{
+	ClearProgressMarker();
+	if (CreatedWorkDir)
 	{
-		// We've read everything we possibly can already
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|Nothing more can be read|FileSize=%ld|EffectiveShippedLogOffset=%ld"), FileSize, OutEffectiveShippedLogOffset);
-		return true;
+		IFileManager::Get().DeleteDirectory(*WorkDir, false, true);
 	}
+}
 
-	uint8* BufferData = WorkerBuffer.GetData();
-	if (!WorkerReader->Read(BufferData, OutNumToRead))
+bool FsparklogsBenchmark::Run(const FString& Scenario, TArray<FsparklogsBenchmarkResult>& OutResults)
+{
+	const bool All = Scenario.Equals(ScenarioAll, ESearchCase::IgnoreCase);
+	bool Known = All;
+	bool Success = true;
+	struct FScenario { const TCHAR* Name; bool (FsparklogsBenchmark::*Fn)(TArray<FsparklogsBenchmarkResult>&); };
+	const FScenario Scenarios[] = {
+		{ ScenarioSerialize, &FsparklogsBenchmark::RunSerialize },
+		{ ScenarioAnalytics, &FsparklogsBenchmark::RunAnalytics },
+		{ ScenarioPayload, &FsparklogsBenchmark::RunPayload },
+		{ ScenarioCompress, &FsparklogsBenchmark::RunCompress },
+		{ ScenarioEndToEnd, &FsparklogsBenchmark::RunEndToEnd },
+	};
+	for (const FScenario& S : Scenarios)
 	{
-		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to read data: offset=%ld, bytes=%ld, logfile='%s'"), OutEffectiveShippedLogOffset, OutNumToRead, *SourceLogFile);
-		return false;
+		if (All || Scenario.Equals(S.Name, ESearchCase::IgnoreCase))
+		{
+			Known = true;
+			if (!(this->*S.Fn)(OutResults))
+			{
+				UE_LOG(LogPluginSparkLogs, Warning, TEXT("Benchmark scenario failed: %s"), S.Name);
+				Success = false;
+			}
+		}
 	}
-#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|read data into buffer|offset=%ld|data_len=%d|data=%s|logfile='%s'"), OutEffectiveShippedLogOffset, OutNumToRead, *ITLConvertUTF8(BufferData, OutNumToRead), *SourceLogFile);
-#else
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|read data into buffer|offset=%ld|data_len=%d|logfile='%s'"), OutEffectiveShippedLogOffset, OutNumToRead, *SourceLogFile);
-#endif
+	return Known && Success;
+}
+
+bool FsparklogsBenchmark::RunSerialize(TArray<FsparklogsBenchmarkResult>& OutResults)
+{
+	TArray<TArray<FString>> Messages;
+	GenerateThreadMessages(Messages);
+	FsparklogsBenchmarkResult Result(ScenarioSerialize, Options.NumThreads);
+	Result.Operations = (int64)Options.NumThreads * Options.MessagesPerThread;
+	Result.Bytes = ITLGetBenchmarkUTF8Len(Messages);
+	TArray<TArray<double>> ThreadLatencies;
+	ThreadLatencies.SetNum(Options.NumThreads);
+	{
+		FsparklogsOutputDeviceFile Device(*GetScratchLogFile(ScenarioSerialize), nullptr);
+		const FName Category(TEXT("LogSparkLogsBenchmark"));
+		Device.Serialize(TEXT("warm up"), ELogVerbosity::Log, Category, -1.0);
+		const double Start = FPlatformTime::Seconds();
+		RunOnThreads([&](int32 ThreadIndex)
+			{
+				TArray<double>& Latencies = ThreadLatencies[ThreadIndex];
+				Latencies.Reserve(Messages[ThreadIndex].Num());
+				for (const FString& Message : Messages[ThreadIndex])
+				{
+					const double OpStart = FPlatformTime::Seconds();
+					Device.Serialize(*Message, ELogVerbosity::Log, Category, -1.0);
+					Latencies.Add(FPlatformTime::Seconds() - OpStart);
+				}
+			});
+		Device.Flush();
+		Result.Seconds = FPlatformTime::Seconds() - Start;
+		Device.TearDown();
+	}
+	TArray<double> Latencies;
+	for (const TArray<double>& L : ThreadLatencies)
+	{
+		Latencies.Append(L);
+	}
+	Result.SetLatencies(Latencies);
+	OutResults.Add(Result);
 	return true;
 }
 
-bool FsparklogsReadAndStreamToCloud::WorkerBuildNextPayload(int NumToRead, int& OutCapturedOffset, int& OutNumCapturedLines)
+bool FsparklogsBenchmark::RunAnalytics(TArray<FsparklogsBenchmarkResult>& OutResults)
 {
-	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerBuildNextPayload);
-	OutCapturedOffset = 0;
-	const uint8* BufferData = WorkerBuffer.GetData();
-	OutNumCapturedLines = 0;
-	WorkerNextPayload.Reset();
-	WorkerNextPayload.Append("[");
-	int NextOffset = 0;
-	while (NextOffset < NumToRead)
+	// A representative set of typed analytics events per thread (design and resource events, with and without a value)
+	constexpr int NumDistinctEvents = 64;
+	struct FBenchmarkAnalyticsEvent
+	{
+		FString EventID;
+		FString ItemID;
+		double Value;
+		FString Reason;
+	};
+	TArray<TArray<FBenchmarkAnalyticsEvent>> Events;
+	Events.SetNum(Options.NumThreads);
+	for (int ThreadIndex = 0; ThreadIndex < Options.NumThreads; ThreadIndex++)
 	{
-		// Skip the UTF-8 byte order marker (always at the start of the file)
-		if (0 == std::memcmp(BufferData + NextOffset, UTF8ByteOrderMark, sizeof(UTF8ByteOrderMark)))
+		FRandomStream Random(Options.Seed + ThreadIndex);
+		FString Text;
+		for (int i = 0; i < NumDistinctEvents; i++)
 		{
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|skipping UTF8 BOM|offset_before=%d|offset_after=%d"), NextOffset, NextOffset + sizeof(UTF8ByteOrderMark));
-			NextOffset += sizeof(UTF8ByteOrderMark);
-			OutCapturedOffset = NextOffset;
-			continue;
+			Options.GenerateMessage(Random, Text);
+			FBenchmarkAnalyticsEvent& Event = Events[ThreadIndex].AddDefaulted_GetRef();
+			Event.EventID = FString::Printf(TEXT("benchmark:thread%d:event%d"), ThreadIndex, i);
+			Event.ItemID = FString::Printf(TEXT("item%d"), i);
+			Event.Value = Random.FRand() * 1000.0;
+			Event.Reason = Text.Left(Options.MaxMessageLen);
 		}
-		// We only process whole lines. See if we can find the next end of line character.
-		int RemainingBytes = NumToRead - NextOffset;
-		int NumToSearch = FMath::Min(RemainingBytes, MaxLineLength);
-		int FoundIndex = 0;
-		int ExtraToSkip = 1; // skip over the \n char
-		bool HaveLine = FindFirstByte(BufferData + NextOffset, static_cast<uint8>('\n'), NumToSearch, FoundIndex);
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|after newline search|NextOffset=%d|HaveLine=%d|NumToSearch=%d|FoundIndex=%d"), NextOffset, (int)HaveLine, NumToSearch, FoundIndex);
-		if (!HaveLine && NumToSearch == MaxLineLength && RemainingBytes > NumToSearch)
+	}
+	FsparklogsBenchmarkResult Result(ScenarioAnalytics, Options.NumThreads);
+	Result.Operations = (int64)Options.NumThreads * Options.MessagesPerThread;
+	TArray<TArray<double>> ThreadLatencies;
+	ThreadLatencies.SetNum(Options.NumThreads);
+	std::atomic<bool> Failed(false);
+	const FString LogFile = GetScratchLogFile(ScenarioAnalytics);
+	{
+		TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(InstanceIndex));
+		Settings->AnalyticsGameID = TEXT("sparklogs-benchmark");
+		FsparklogsOutputDeviceFile Device(*LogFile, nullptr);
+		FsparklogsAnalyticsProvider Provider(Settings);
+		Provider.SetOutputDevice(&Device);
+		// Starting the session (and generating the user ID) only happens once, so it is not measured
+		if (!Provider.StartSession(TEXT("benchmark"), TArray<FAnalyticsEventAttribute>()))
 		{
-			// Even though we didn't find a line, break the line at the max length and process it
-			// It's unsafe to break a line in the middle of a multi-byte UTF-8, so find a safe break point...
-			ExtraToSkip = 0;
-			FoundIndex = MaxLineLength - 1;
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|no newline found, search for safe breakpoint|NextOffset=%d|FoundIndex=%d"), NextOffset, FoundIndex);
-			while (FoundIndex > 0)
+			Device.TearDown();
+			return false;
+		}
+		const double Start = FPlatformTime::Seconds();
+		RunOnThreads([&](int32 ThreadIndex)
 			{
-				if (*(BufferData + NextOffset + FoundIndex) >= 0x80)
-				{
-					FoundIndex--;
-				}
-				else
+				TArray<double>& Latencies = ThreadLatencies[ThreadIndex];
+				Latencies.Reserve(Options.MessagesPerThread);
+				for (int i = 0; i < Options.MessagesPerThread; i++)
 				{
-					// include this non-multi-byte character and break here
-					FoundIndex++;
-					break;
+					const FBenchmarkAnalyticsEvent& Event = Events[ThreadIndex][i % NumDistinctEvents];
+					const double OpStart = FPlatformTime::Seconds();
+					bool Queued = false;
+					switch (i % 3)
+					{
+					case 0:
+						Queued = Provider.CreateAnalyticsEventDesign(*Event.EventID, Event.Value, *Event.Reason, nullptr);
+						break;
+					case 1:
+						Queued = Provider.CreateAnalyticsEventDesign(*Event.EventID, *Event.Reason, nullptr);
+						break;
+					default:
+						Queued = Provider.CreateAnalyticsEventResource(EsparklogsAnalyticsFlowType::Sink, Event.Value, TEXT("gold"), TEXT("benchmark"), *Event.ItemID, *Event.Reason, nullptr);
+						break;
+					}
+					if (!Queued)
+					{
+						Failed.store(true);
+						return;
+					}
+					Latencies.Add(FPlatformTime::Seconds() - OpStart);
 				}
+			});
+		Device.Flush();
+		Result.Seconds = FPlatformTime::Seconds() - Start;
+		Provider.EndSession(TEXT("benchmark"));
+		Device.TearDown();
+	}
+	Result.Bytes = IFileManager::Get().FileSize(*LogFile);
+	TArray<double> Latencies;
+	for (const TArray<double>& L : ThreadLatencies)
+	{
+		Latencies.Append(L);
+	}
+	Result.SetLatencies(Latencies);
+	OutResults.Add(Result);
+	return !Failed.load();
+}
+
+bool FsparklogsBenchmark::RunPayload(TArray<FsparklogsBenchmarkResult>& OutResults)
+{
+	TArray<TArray<FString>> Messages;
+	GenerateThreadMessages(Messages);
+	const FString LogFile = GetScratchLogFile(ScenarioPayload);
+	{
+		FsparklogsOutputDeviceFile Device(*LogFile, nullptr);
+		const FName Category(TEXT("LogSparkLogsBenchmark"));
+		for (const TArray<FString>& ThreadMessages : Messages)
+		{
+			for (const FString& Message : ThreadMessages)
+			{
+				Device.Serialize(*Message, ELogVerbosity::Log, Category, -1.0);
 			}
-			HaveLine = true;
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|found safe breakpoint|NextOffset=%d|FoundIndex=%d|ExtraToSkip=%d"), NextOffset, FoundIndex, ExtraToSkip);
 		}
-		if (!HaveLine)
+		Device.TearDown();
+	}
+
+	// Measure how quickly the streamer catches up on the whole logfile with no compression
+	TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(InstanceIndex));
+	Settings->IncludeCommonMetadata = false;
+	Settings->CompressionMode = ITLCompressionMode::None;
+	TSharedRef<FsparklogsBenchmarkSink, ESPMode::ThreadSafe> Sink(new FsparklogsBenchmarkSink(nullptr));
+	TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer(new FsparklogsReadAndStreamToCloud(InstanceIndex, LogFile, Settings, Sink, GMaxLineLength, FString(), FString(), nullptr));
+	Streamer->SetWeakThisPtr(Streamer);
+	FsparklogsBenchmarkResult Result(ScenarioPayload, 1);
+	Result.Operations = (int64)Options.NumThreads * Options.MessagesPerThread;
+	Result.Bytes = IFileManager::Get().FileSize(*LogFile);
+	bool Success = true;
+	bool FlushedEverything = false;
+	const double Start = FPlatformTime::Seconds();
+	while (Success && !FlushedEverything)
+	{
+		Success = Streamer->FlushAndWait(1, true, false, false, 60.0, FlushedEverything);
+	}
+	Result.Seconds = FPlatformTime::Seconds() - Start;
+	Streamer->FlushAndWait(1, true, true, false, 10.0, FlushedEverything);
+	Streamer.Reset();
+	ClearProgressMarker();
+	OutResults.Add(Result);
+	return Success;
+}
+
+bool FsparklogsBenchmark::RunCompress(TArray<FsparklogsBenchmarkResult>& OutResults)
+{
+	// Build a full-sized payload the same way the streamer would
+	TArray<TArray<FString>> Messages;
+	GenerateThreadMessages(Messages);
+	TITLJSONStringBuilder Payload;
+	Payload.Reserve(FsparklogsSettings::DefaultBytesPerRequest + 4096);
+	Payload.Append("[", 1);
+	for (int i = 0; Payload.Len() < FsparklogsSettings::DefaultBytesPerRequest; i++)
+	{
+		const FString& Message = Messages[i % Messages.Num()][(i / Messages.Num()) % Options.MessagesPerThread];
+		FTCHARToUTF8 MessageUTF8(*Message, Message.Len());
+		if (i > 0)
 		{
-			// No more complete lines to process, this is enough for now
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|no more lines to process, break"));
-			break;
+			Payload.Append(",", 1);
 		}
-		// Trim newlines control characters of any kind at the end
-		while (FoundIndex > 0)
+		Payload.Append("{\"message\":\"");
+		ITLAppendUTF8AsEscapedJsonString(Payload, (const ANSICHAR*)MessageUTF8.Get(), MessageUTF8.Length());
+		Payload.Append("\"}");
+	}
+	Payload.Append("]", 1);
+
+	constexpr int Iterations = 5;
+	const ITLCompressionMode Modes[] = { ITLCompressionMode::LZ4, ITLCompressionMode::LZ4Frame, ITLCompressionMode::Gzip };
+	const TCHAR* ModeNames[] = { TEXT("compress_lz4"), TEXT("compress_lz4frame"), TEXT("compress_gzip") };
+	TArray<uint8> Compressed, Decompressed;
+	bool Success = true;
+	for (int m = 0; m < UE_ARRAY_COUNT(Modes); m++)
+	{
+		FsparklogsBenchmarkResult Result(ModeNames[m], 1);
+		TArray<double> Latencies;
+		for (int i = 0; i < Iterations; i++)
 		{
-			// We expect the FoundIndex to be the *first* non-newline character, and ExtraToSkip set to the number of newline chars to skip.
-			// Check if the previous character is a newline character, and if so, skip capturing it.
-			uint8 c = *(BufferData + NextOffset + FoundIndex - 1);
-			if (c == '\n' || c == '\r' || c == CharInternalNewline)
-			{
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|character at NextOffset=%d, FoundIndex=%d is newline, will skip it"), NextOffset, FoundIndex);
-				ExtraToSkip++;
-				FoundIndex--;
-			}
-			else
+			const double Start = FPlatformTime::Seconds();
+			if (!ITLCompressData(Modes[m], Payload.GetArray().GetData(), Payload.Len(), Compressed))
 			{
+				Success = false;
 				break;
 			}
+			Latencies.Add(FPlatformTime::Seconds() - Start);
+			Result.Seconds += Latencies.Last();
+			Result.Operations++;
+			Result.Bytes += Payload.Len();
 		}
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|line summary|NextOffset=%d|FoundIndex=%d|ExtraToSkip=%d"), NextOffset, FoundIndex, ExtraToSkip);
-		// Skip blank lines without capturing anything
-		if (FoundIndex <= 0)
-		{
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|skipping blank line..."));
-			if (ExtraToSkip <= 0)
-			{
-				ExtraToSkip = 1;
-			}
-			NextOffset += ExtraToSkip;
-			OutCapturedOffset = NextOffset;
-			continue;
-		}
-		// Capture the data from (BufferData + NextOffset) to (BufferData + NextOffset + FoundIndex)
-		// NOTE: the data in the logfile was already written in UTF-8 format
-		if (OutNumCapturedLines > 0)
+		if (Compressed.Num() > 0)
 		{
-			WorkerNextPayload.Append(",");
+			Result.CompressionRatio = (double)Payload.Len() / (double)Compressed.Num();
 		}
-		WorkerNextPayload.Append("{");
-		if (WorkerOverrideCommonEventJSONData.Num() > 0)
+		// Make sure what we measured is actually valid
+		if (!ITLDecompressData(Modes[m], Compressed.GetData(), Compressed.Num(), Payload.Len(), Decompressed) || Decompressed != Payload.GetArray())
 		{
-			WorkerNextPayload.Append((const ANSICHAR*)(WorkerOverrideCommonEventJSONData.GetData()), WorkerOverrideCommonEventJSONData.Num());
-			WorkerNextPayload.Append(",");
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Benchmark compression round trip failed: %s"), ModeNames[m]);
+			Success = false;
 		}
-		else if (CommonEventJSONData.Num() > 0)
+		Result.SetLatencies(Latencies);
+		OutResults.Add(Result);
+	}
+	return Success;
+}
+
+bool FsparklogsBenchmark::RunEndToEnd(TArray<FsparklogsBenchmarkResult>& OutResults)
+{
+	TArray<TArray<FString>> Messages;
+	GenerateThreadMessages(Messages);
+	const int64 NumMessages = (int64)Options.NumThreads * Options.MessagesPerThread;
+	// Tag each message so the sink can match it up with the time it was logged
+	for (int ThreadIndex = 0; ThreadIndex < Options.NumThreads; ThreadIndex++)
+	{
+		for (int i = 0; i < Options.MessagesPerThread; i++)
 		{
-			WorkerNextPayload.Append((const ANSICHAR*)(CommonEventJSONData.GetData()), CommonEventJSONData.Num());
-			WorkerNextPayload.Append(",");
+			FString& Message = Messages[ThreadIndex][i];
+			Message = FString::Printf(TEXT("%s%d] "), BenchmarkMessageMarker, ThreadIndex * Options.MessagesPerThread + i) + Message;
 		}
-		// If we have raw JSON in the payload extract that portion and append it, setting up just the message text to remain for appending...
-		if (FoundIndex > 2 && *(BufferData + NextOffset) == CharInternalJSONStart)
-		{
-			int FoundJSONEndIndex = 0;
-			if (FindFirstByte(BufferData + NextOffset + 1, CharInternalJSONEnd, FoundIndex - 1, FoundJSONEndIndex))
+	}
+	TUniquePtr<std::atomic<double>[]> SendTimes(new std::atomic<double>[NumMessages]);
+	for (int64 i = 0; i < NumMessages; i++)
+	{
+		SendTimes[i].store(0.0);
+	}
+
+	const FString LogFile = GetScratchLogFile(ScenarioEndToEnd);
+	TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings(InstanceIndex));
+	Settings->IncludeCommonMetadata = false;
+	TSharedRef<FsparklogsBenchmarkSink, ESPMode::ThreadSafe> Sink(new FsparklogsBenchmarkSink(SendTimes.Get(), NumMessages));
+	TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer(new FsparklogsReadAndStreamToCloud(InstanceIndex, LogFile, Settings, Sink, GMaxLineLength, FString(), FString(), nullptr));
+	Streamer->SetWeakThisPtr(Streamer);
+
+	FsparklogsBenchmarkResult Result(ScenarioEndToEnd, Options.NumThreads);
+	Result.Operations = NumMessages;
+	Result.Bytes = ITLGetBenchmarkUTF8Len(Messages);
+	bool Success = true;
+	{
+		FsparklogsOutputDeviceFile Device(*LogFile, Streamer);
+		const FName Category(TEXT("LogSparkLogsBenchmark"));
+		const double Start = FPlatformTime::Seconds();
+		RunOnThreads([&](int32 ThreadIndex)
 			{
-				WorkerNextPayload.Append((const ANSICHAR*)(BufferData + NextOffset + 1), FoundJSONEndIndex);
-				if (FoundJSONEndIndex > 0)
+				for (int i = 0; i < Options.MessagesPerThread; i++)
 				{
-					WorkerNextPayload.Append(",");
+					SendTimes[ThreadIndex * Options.MessagesPerThread + i].store(FPlatformTime::Seconds());
+					Device.Serialize(*Messages[ThreadIndex][i], ELogVerbosity::Log, Category, -1.0);
 				}
-				NextOffset += (FoundJSONEndIndex + 2);
-				FoundIndex -= (FoundJSONEndIndex + 2);
+			});
+		Device.Flush();
+		Streamer->RequestFlush();
+		// Wait for the sink to acknowledge everything (the streamer flushes on its own schedule)
+		const double Deadline = FPlatformTime::Seconds() + 120.0;
+		while (Sink->NumAcked.load() < NumMessages)
+		{
+			if (FPlatformTime::Seconds() > Deadline)
+			{
+				Success = false;
+				break;
 			}
+			FPlatformProcess::SleepNoStats(0.005f);
 		}
-		WorkerNextPayload.Append("\"message\":", 10 /* length of `"message":` */);
-		AppendUTF8AsEscapedJsonString(WorkerNextPayload, (const ANSICHAR*)(BufferData + NextOffset), FoundIndex);
-#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|adding message to payload: %s"), *ITLConvertUTF8(BufferData + NextOffset, FoundIndex));
-#endif
-		WorkerNextPayload.Append("}");
-		OutNumCapturedLines++;
-		NextOffset += FoundIndex + ExtraToSkip;
-		OutCapturedOffset = NextOffset;
+		Result.Seconds = FPlatformTime::Seconds() - Start;
+		Device.TearDown();
 	}
-	WorkerNextPayload.Append("]");
-	return true;
+	bool FlushedEverything = false;
+	Streamer->FlushAndWait(1, true, true, false, 10.0, FlushedEverything);
+	Streamer.Reset();
+	ClearProgressMarker();
+	{
+		FScopeLock Lock(&Sink->LatenciesCriticalSection);
+		Result.SetLatencies(Sink->Latencies);
+	}
+	OutResults.Add(Result);
+	return Success;
 }
 
-bool FsparklogsReadAndStreamToCloud::WorkerCompressPayload()
+FString FsparklogsBenchmark::ResultsToNDJSON(const TArray<FsparklogsBenchmarkResult>& Results)
 {
-	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerCompressPayload);
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerCompressPayload|Begin compressing payload"));
-	bool Success = ITLCompressData(Settings->CompressionMode, (const uint8*)WorkerNextPayload.GetData(), WorkerNextPayload.Len(), WorkerNextEncodedPayload);
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerCompressPayload|Finish compressing payload|success=%d|original_len=%d|compressed_len=%d"), Success ? 1 : 0, (int)WorkerNextPayload.Len(), (int)WorkerNextEncodedPayload.Num());
-	return Success;
+	FString Output;
+	for (const FsparklogsBenchmarkResult& Result : Results)
+	{
+		Output += Result.ToJSON();
+		Output += TEXT("\n");
+	}
+	return Output;
 }
 
-bool FsparklogsReadAndStreamToCloud::WorkerInternalDoFlush(int64& OutNewShippedLogOffset, bool& OutFlushProcessedEverything)
+void FsparklogsBenchmark::RunOnThreads(TFunctionRef<void(int32)> Body) const
 {
-	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerInternalDoFlush);
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|BEGIN"));
-	OutNewShippedLogOffset = WorkerShippedLogOffset;
-	OutFlushProcessedEverything = false;
-	LastFlushPlatformTime.store(FPlatformTime::Seconds());
-	BytesQueuedSinceLastFlush.store(0);
-	
-	int NumToRead = 0;
-	int64 EffectiveShippedLogOffset = WorkerShippedLogOffset, RemainingBytes;
-	if (!WorkerReadNextPayload(NumToRead, EffectiveShippedLogOffset, RemainingBytes))
+	// Unlike ParallelFor, which may run several indices on the same worker, every thread index gets a thread of its own
+	TArray<TFuture<void>> Threads;
+	for (int32 ThreadIndex = 0; ThreadIndex < Options.NumThreads; ThreadIndex++)
 	{
-		return false;
+		Threads.Add(Async(EAsyncExecution::Thread, [Body, ThreadIndex]() { Body(ThreadIndex); }));
 	}
-	if (NumToRead <= 0)
+	for (TFuture<void>& Thread : Threads)
 	{
-		// nothing more to read
-		OutFlushProcessedEverything = true;
-		return true;
+		Thread.Wait();
+	}
+}
+
+void FsparklogsBenchmark::GenerateThreadMessages(TArray<TArray<FString>>& OutMessages) const
+{
+	OutMessages.SetNum(Options.NumThreads);
+	for (int ThreadIndex = 0; ThreadIndex < Options.NumThreads; ThreadIndex++)
+	{
+		FRandomStream Random(Options.Seed + ThreadIndex);
+		TArray<FString>& ThreadMessages = OutMessages[ThreadIndex];
+		ThreadMessages.SetNum(Options.MessagesPerThread);
+		for (FString& Message : ThreadMessages)
+		{
+			Options.GenerateMessage(Random, Message);
+		}
+	}
+}
+
+FString FsparklogsBenchmark::GetScratchLogFile(const TCHAR* Name) const
+{
+	FString Path = FPaths::Combine(WorkDir, FString::Printf(TEXT("benchmark-%d-%s.log"), InstanceIndex, Name));
+	IFileManager::Get().Delete(*Path, false, true, true);
+	return Path;
+}
+
+void FsparklogsBenchmark::ClearProgressMarker() const
+{
+	FString StateIni = ITLGetIndexedStateFileINI(InstanceIndex);
+	if (StateIni != GGameUserSettingsIni)
+	{
+		// Purge the information from the UE INI cache as well or it would be found by later runs
+		GConfig->EmptySection(ITL_CONFIG_SECTION_NAME, StateIni);
+		GConfig->Flush(false, StateIni);
+		GConfig->Remove(StateIni);
+		IFileManager::Get().Delete(*StateIni, false, false, true);
+		IFileManager::Get().Delete(*ITLGetProgressJournalPath(StateIni), false, false, true);
+	}
+}
+
+static void ITLRunBenchmarkCommand(const TArray<FString>& Args)
+{
+	FString Scenario = FsparklogsBenchmark::ScenarioAll;
+	FString Params;
+	FString OutputFile;
+	for (const FString& Arg : Args)
+	{
+		if (Arg.StartsWith(TEXT("out="), ESearchCase::IgnoreCase))
+		{
+			OutputFile = Arg.Mid(4);
+		}
+		else if (Arg.Contains(TEXT("=")))
+		{
+			Params += Arg + TEXT(" ");
+		}
+		else
+		{
+			Scenario = Arg;
+		}
+	}
+	if (OutputFile.IsEmpty())
+	{
+		OutputFile = FPaths::Combine(FPaths::ProjectSavedDir(), FString::Printf(TEXT("sparklogs-benchmark-%s.ndjson"), *FDateTime::UtcNow().ToString(TEXT("%Y%m%d-%H%M%S"))));
+	}
+
+	FsparklogsBenchmarkOptions Options;
+	Options.Parse(*Params);
+	TArray<FsparklogsBenchmarkResult> Results;
+	bool Success = false;
+	{
+		FsparklogsBenchmark Benchmark(Options, FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("sparklogs-benchmark")));
+		Success = Benchmark.Run(Scenario, Results);
+	}
+	for (const FsparklogsBenchmarkResult& Result : Results)
+	{
+		UE_LOG(LogPluginSparkLogs, Display, TEXT("BENCHMARK: %s"), *Result.ToJSON());
+	}
+	FFileHelper::SaveStringToFile(FsparklogsBenchmark::ResultsToNDJSON(Results), *OutputFile, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM);
+	UE_LOG(LogPluginSparkLogs, Display, TEXT("Benchmark %s: scenario=%s, results=%d, output=%s"), Success ? TEXT("finished") : TEXT("FAILED"), *Scenario, Results.Num(), *OutputFile);
+}
+
+static FAutoConsoleCommand ITLBenchmarkCommand(
+	TEXT("sparklogs.Benchmark"),
+	TEXT("Runs the SparkLogs benchmark suite and writes the results as NDJSON. Usage: sparklogs.Benchmark [all|serialize|analytics|payload|compress|e2e] [threads=N] [messages=N] [minlen=N] [maxlen=N] [largepct=P] [largelen=N] [unicodepct=P] [seed=N] [out=path]"),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&ITLRunBenchmarkCommand));
+#endif
+
+// =============== FsparklogsStressGenerator ===============================================================================
+
+FsparklogsStressGenerator::FsparklogsStressGenerator(TSharedRef<FsparklogsSettings> InSettings)
+	: Settings(InSettings)
+	, Thread(nullptr)
+{
+	Options.Parse(*Settings->StressTestMessageOptions);
+	check(FPlatformProcess::SupportsMultithreading());
+	FString ThreadName = TEXT("SparkLogs_StressGenerator");
+	FPlatformAtomics::InterlockedExchangePtr((void**)&Thread, FRunnableThread::Create(this, *ThreadName, 0, TPri_BelowNormal));
+}
+
+FsparklogsStressGenerator::~FsparklogsStressGenerator()
+{
+	if (Thread)
+	{
+		delete Thread;
+	}
+	Thread = nullptr;
+}
+
+bool FsparklogsStressGenerator::Init()
+{
+	return true;
+}
+
+uint32 FsparklogsStressGenerator::Run()
+{
+	double StressTestGenerateIntervalSecs = Settings->StressTestGenerateIntervalSecs;
+	int StressTestNumEntriesPerTick = Settings->StressTestNumEntriesPerTick;
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator starting. StressTestGenerateIntervalSecs=%.3lf, StressTestNumEntriesPerTick=%d, StressTestMessageOptions=%s"), StressTestGenerateIntervalSecs, StressTestNumEntriesPerTick, *Settings->StressTestMessageOptions);
+	FRandomStream Random(Options.Seed);
+	FString Message;
+	while (StopRequestCounter.GetValue() == 0)
+	{
+		for (int i = 0; i < StressTestNumEntriesPerTick; i++)
+		{
+			Options.GenerateMessage(Random, Message);
+			UE_LOG(LogEngine, Log, TEXT("FsparklogsStressGenerator|platform_time=%.3lf|iteration=%d|%s"), FPlatformTime::Seconds(), i, *Message);
+		}
+		FPlatformProcess::SleepNoStats(StressTestGenerateIntervalSecs);
+	}
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator stopped..."));
+	return 0;
+}
+
+void FsparklogsStressGenerator::Stop()
+{
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator requesting stop..."));
+	StopRequestCounter.Increment();
+}
+
+// =============== FsparklogsProgressJournal ===============================================================================
+
+// Record layout (native byte order). The state bytes immediately follow the record and are covered by the checksum.
+constexpr int ITLJournalMagicOffset = 0;
+constexpr int ITLJournalVersionOffset = 4;
+constexpr int ITLJournalRecordSizeOffset = 6;
+constexpr int ITLJournalSequenceOffset = 8;
+constexpr int ITLJournalMarkerOffset = 16;
+constexpr int ITLJournalLastReadLenOffset = 24;
+constexpr int ITLJournalNumFollowingOffset = 28;
+constexpr int ITLJournalFollowingOffset = 32;
+constexpr int ITLJournalStateLenOffset = ITLJournalFollowingOffset + FsparklogsProgressJournal::MaxFollowingReadLens * 4;
+constexpr int ITLJournalStateHashOffset = ITLJournalStateLenOffset + 4;
+constexpr int ITLJournalFlagsOffset = ITLJournalStateHashOffset + 4;
+constexpr int ITLJournalChecksumOffset = ITLJournalFlagsOffset + 4;
+static_assert(ITLJournalChecksumOffset + 4 == FsparklogsProgressJournal::RecordSize, "Progress journal record layout does not match RecordSize");
+// Version 1 records had no flags, so their checksum is where the flags are now
+static_assert(ITLJournalFlagsOffset + 4 == FsparklogsProgressJournal::Version1RecordSize, "Progress journal version 1 record layout does not match Version1RecordSize");
+constexpr uint32 ITLJournalFlagRetryIsEnvelope = 1;
+
+template<typename T> static FORCEINLINE void ITLJournalPut(uint8* Data, int Offset, T Value) { FMemory::Memcpy(Data + Offset, &Value, sizeof(T)); }
+template<typename T> static FORCEINLINE T ITLJournalGet(const uint8* Data, int Offset) { T Value; FMemory::Memcpy(&Value, Data + Offset, sizeof(T)); return Value; }
+
+FsparklogsProgressJournal::FsparklogsProgressJournal(const FString& InPath)
+	: Path(InPath)
+	, SlotSize(0)
+	, Loaded(false)
+	, HasRecord(false)
+	, Sequence(0)
+	, Marker(0)
+	, LastReadLen(0)
+	, RetryIsEnvelope(false)
+	, LastFullFlushPlatformTime(0)
+{
+}
+
+FsparklogsProgressJournal::~FsparklogsProgressJournal()
+{
+	Close();
+}
+
+bool FsparklogsProgressJournal::DecodeSlot(const uint8* Data, int64 Len, uint64& OutSequence, int64& OutMarker, int& OutLastReadLen, TArray<int>& OutFollowingReadLens, bool& OutRetryIsEnvelope, TArray<uint8>& OutState)
+{
+	if (Len < Version1RecordSize || ITLJournalGet<uint32>(Data, ITLJournalMagicOffset) != Magic)
+	{
+		return false;
+	}
+	const uint16 SlotVersion = ITLJournalGet<uint16>(Data, ITLJournalVersionOffset);
+	const int SlotRecordSize = (SlotVersion == Version) ? RecordSize : Version1RecordSize;
+	if ((SlotVersion != Version && SlotVersion != 1) || ITLJournalGet<uint16>(Data, ITLJournalRecordSizeOffset) != SlotRecordSize)
+	{
+		return false;
+	}
+	const int32 NumFollowing = ITLJournalGet<int32>(Data, ITLJournalNumFollowingOffset);
+	const uint32 StateLen = ITLJournalGet<uint32>(Data, ITLJournalStateLenOffset);
+	if (NumFollowing < 0 || NumFollowing > MaxFollowingReadLens || StateLen > (uint32)MaxStateLen || SlotRecordSize + (int64)StateLen > Len)
+	{
+		return false;
+	}
+	const int SlotChecksumOffset = SlotRecordSize - 4;
+	uint32 Checksum = FCrc::MemCrc32(Data, SlotChecksumOffset);
+	Checksum = FCrc::MemCrc32(Data + SlotRecordSize, StateLen, Checksum);
+	if (Checksum != ITLJournalGet<uint32>(Data, SlotChecksumOffset) || FCrc::MemCrc32(Data + SlotRecordSize, StateLen) != ITLJournalGet<uint32>(Data, ITLJournalStateHashOffset))
+	{
+		return false;
+	}
+	OutRetryIsEnvelope = SlotVersion == Version && (ITLJournalGet<uint32>(Data, ITLJournalFlagsOffset) & ITLJournalFlagRetryIsEnvelope) != 0;
+	OutSequence = ITLJournalGet<uint64>(Data, ITLJournalSequenceOffset);
+	OutMarker = ITLJournalGet<int64>(Data, ITLJournalMarkerOffset);
+	OutLastReadLen = ITLJournalGet<int32>(Data, ITLJournalLastReadLenOffset);
+	OutFollowingReadLens.Reset();
+	for (int i = 0; i < NumFollowing; i++)
+	{
+		OutFollowingReadLens.Add(ITLJournalGet<int32>(Data, ITLJournalFollowingOffset + i * 4));
+	}
+	OutState.Reset();
+	OutState.Append(Data + SlotRecordSize, StateLen);
+	return true;
+}
+
+void FsparklogsProgressJournal::LoadIfNeeded()
+{
+	if (Loaded)
+	{
+		return;
+	}
+	Loaded = true;
+	LoadNewestSlot(Path, SlotSize);
+	// A crash while Resize moves the grown journal into place can leave the newest record only in the temporary file
+	const FString TempPath = GetTempPath();
+	if (IFileManager::Get().FileExists(*TempPath))
+	{
+		int64 TempSlotSize = 0;
+		if (LoadNewestSlot(TempPath, TempSlotSize))
+		{
+			SlotSize = TempSlotSize;
+			if (!IFileManager::Get().Move(*Path, *TempPath, true, false, false, true))
+			{
+				UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to recover progress journal: %s"), *Path);
+			}
+		}
+		else
+		{
+			IFileManager::Get().Delete(*TempPath, false, false, true);
+		}
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("JOURNAL|LoadIfNeeded|path='%s'|HasRecord=%d|Sequence=%llu|Marker=%lld|LastReadLen=%d|SlotSize=%lld"), *Path, HasRecord ? 1 : 0, Sequence, Marker, LastReadLen, SlotSize);
+}
+
+bool FsparklogsProgressJournal::LoadNewestSlot(const FString& FilePath, int64& OutSlotSize)
+{
+	TArray<uint8> Contents;
+	if (!IFileManager::Get().FileExists(*FilePath) || !FFileHelper::LoadFileToArray(Contents, *FilePath, FILEREAD_Silent))
+	{
+		return false;
+	}
+	// Both slots always have the same size, which older journals did not record
+	OutSlotSize = Contents.Num() / 2;
+	bool Found = false;
+	TArray<int> SlotFollowingReadLens;
+	TArray<uint8> SlotState;
+	for (int Slot = 0; Slot < 2; Slot++)
+	{
+		const int64 SlotOffset = (int64)Slot * OutSlotSize;
+		uint64 SlotSequence = 0;
+		int64 SlotMarker = 0;
+		int SlotLastReadLen = 0;
+		bool SlotRetryIsEnvelope = false;
+		if (SlotOffset < Contents.Num()
+			&& DecodeSlot(Contents.GetData() + SlotOffset, FMath::Min<int64>(OutSlotSize, Contents.Num() - SlotOffset), SlotSequence, SlotMarker, SlotLastReadLen, SlotFollowingReadLens, SlotRetryIsEnvelope, SlotState)
+			&& (!HasRecord || SlotSequence > Sequence))
+		{
+			HasRecord = true;
+			Found = true;
+			Sequence = SlotSequence;
+			Marker = SlotMarker;
+			LastReadLen = SlotLastReadLen;
+			FollowingReadLens = SlotFollowingReadLens;
+			RetryIsEnvelope = SlotRetryIsEnvelope;
+			State = SlotState;
+		}
+	}
+	return Found;
+}
+
+bool FsparklogsProgressJournal::OpenForWrite()
+{
+	if (Handle.IsValid())
+	{
+		return true;
+	}
+	Handle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Path, true, true));
+	if (!Handle.IsValid())
+	{
+		return false;
+	}
+	// Size the file for both slots up front so that every later write stays within the file
+	const int64 Size = Handle->Size();
+	if (Size < 2 * (int64)SlotSize)
+	{
+		TArray<uint8> Zeros;
+		Zeros.SetNumZeroed(2 * SlotSize - Size);
+		if (!Handle->Seek(Size) || !Handle->Write(Zeros.GetData(), Zeros.Num()))
+		{
+			Handle.Reset();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FsparklogsProgressJournal::Resize(int64 NewSlotSize)
+{
+	// Written completely to another file first, so a crash at worst loses this update (see LoadIfNeeded)
+	Handle.Reset();
+	const FString TempPath = GetTempPath();
+	bool Written = false;
+	{
+		TUniquePtr<IFileHandle> TempHandle(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TempPath, false, false));
+		if (TempHandle.IsValid())
+		{
+			TArray<uint8> Contents;
+			Contents.SetNumZeroed(2 * NewSlotSize);
+			FMemory::Memcpy(Contents.GetData() + (Sequence % 2) * NewSlotSize, WriteBuffer.GetData(), WriteBuffer.Num());
+			Written = TempHandle->Write(Contents.GetData(), Contents.Num()) && TempHandle->Flush(true);
+		}
+	}
+	if (!Written || !IFileManager::Get().Move(*Path, *TempPath, true, false, false, true))
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to write progress journal: %s"), *Path);
+		IFileManager::Get().Delete(*TempPath, false, false, true);
+		return false;
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("JOURNAL|Resize|path='%s'|OldSlotSize=%lld|NewSlotSize=%lld"), *Path, SlotSize, NewSlotSize);
+	SlotSize = NewSlotSize;
+	LastFullFlushPlatformTime = FPlatformTime::Seconds();
+	return true;
+}
+
+int64 FsparklogsProgressJournal::GetSlotSize()
+{
+	FScopeLock Lock(&CriticalSection);
+	LoadIfNeeded();
+	return SlotSize;
+}
+
+bool FsparklogsProgressJournal::Read(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutState, TArray<int>& OutFollowingReadLens)
+{
+	bool IgnoreRetryIsEnvelope = false;
+	return Read(OutMarker, OutLastReadLen, OutState, OutFollowingReadLens, IgnoreRetryIsEnvelope);
+}
+
+bool FsparklogsProgressJournal::Read(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutState, TArray<int>& OutFollowingReadLens, bool& OutRetryIsEnvelope)
+{
+	FScopeLock Lock(&CriticalSection);
+	LoadIfNeeded();
+	OutMarker = Marker;
+	OutLastReadLen = LastReadLen;
+	OutState = State;
+	OutFollowingReadLens = FollowingReadLens;
+	OutRetryIsEnvelope = RetryIsEnvelope;
+	return HasRecord;
+}
+
+bool FsparklogsProgressJournal::Write(int64 InMarker, int InLastReadLen, const TArray<uint8>* InState, const TArray<int>* InFollowingReadLens, bool InRetryIsEnvelope)
+{
+	FScopeLock Lock(&CriticalSection);
+	LoadIfNeeded();
+	if (InState != nullptr)
+	{
+		if (InState->Num() > MaxStateLen)
+		{
+			// Even though we failed to save the state, it's better to clear it out than allow a stale state, so just log a warning.
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to save progress state."));
+			State.Reset();
+		}
+		else
+		{
+			State = *InState;
+		}
+	}
+	Marker = InMarker;
+	LastReadLen = InLastReadLen;
+	FollowingReadLens.Reset();
+	if (InFollowingReadLens != nullptr && InLastReadLen > 0)
+	{
+		for (int i = 0; i < InFollowingReadLens->Num() && i < MaxFollowingReadLens; i++)
+		{
+			FollowingReadLens.Add((*InFollowingReadLens)[i]);
+		}
+	}
+	RetryIsEnvelope = InRetryIsEnvelope && InLastReadLen > 0;
+	HasRecord = true;
+	Sequence++;
+
+	WriteBuffer.SetNumZeroed(RecordSize);
+	WriteBuffer.Append(State);
+	uint8* Data = WriteBuffer.GetData();
+	ITLJournalPut<uint32>(Data, ITLJournalMagicOffset, Magic);
+	ITLJournalPut<uint16>(Data, ITLJournalVersionOffset, Version);
+	ITLJournalPut<uint16>(Data, ITLJournalRecordSizeOffset, (uint16)RecordSize);
+	ITLJournalPut<uint64>(Data, ITLJournalSequenceOffset, Sequence);
+	ITLJournalPut<int64>(Data, ITLJournalMarkerOffset, Marker);
+	ITLJournalPut<int32>(Data, ITLJournalLastReadLenOffset, LastReadLen);
+	ITLJournalPut<int32>(Data, ITLJournalNumFollowingOffset, FollowingReadLens.Num());
+	for (int i = 0; i < FollowingReadLens.Num(); i++)
+	{
+		ITLJournalPut<int32>(Data, ITLJournalFollowingOffset + i * 4, FollowingReadLens[i]);
+	}
+	ITLJournalPut<uint32>(Data, ITLJournalStateLenOffset, (uint32)State.Num());
+	ITLJournalPut<uint32>(Data, ITLJournalStateHashOffset, FCrc::MemCrc32(State.GetData(), State.Num()));
+	ITLJournalPut<uint32>(Data, ITLJournalFlagsOffset, RetryIsEnvelope ? ITLJournalFlagRetryIsEnvelope : 0);
+	uint32 Checksum = FCrc::MemCrc32(Data, ITLJournalChecksumOffset);
+	Checksum = FCrc::MemCrc32(State.GetData(), State.Num(), Checksum);
+	ITLJournalPut<uint32>(Data, ITLJournalChecksumOffset, Checksum);
+
+	const int64 RequiredSlotSize = Align((int64)WriteBuffer.Num(), (int64)SlotAlignment);
+	if (SlotSize < RequiredSlotSize)
+	{
+		// The state outgrew the slots (or the file does not exist yet)
+		return Resize(RequiredSlotSize);
+	}
+	// Alternate slots so that the previous record survives if this write is torn
+	if (!OpenForWrite() || !Handle->Seek((int64)(Sequence % 2) * SlotSize) || !Handle->Write(WriteBuffer.GetData(), WriteBuffer.Num()))
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to write progress journal: %s"), *Path);
+		Handle.Reset();
+		return false;
+	}
+	const double Now = FPlatformTime::Seconds();
+	const bool FullFlush = (Now - LastFullFlushPlatformTime) >= MinFullFlushIntervalSecs;
+	if (FullFlush)
+	{
+		LastFullFlushPlatformTime = Now;
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("JOURNAL|Write|path='%s'|Sequence=%llu|Marker=%lld|LastReadLen=%d|FollowingReadLens=%d|StateLen=%d|FullFlush=%d"), *Path, Sequence, Marker, LastReadLen, FollowingReadLens.Num(), State.Num(), FullFlush ? 1 : 0);
+	return Handle->Flush(FullFlush);
+}
+
+void FsparklogsProgressJournal::Close()
+{
+	FScopeLock Lock(&CriticalSection);
+	if (Handle.IsValid())
+	{
+		Handle->Flush(true);
+		Handle.Reset();
+	}
+}
+
+// =============== FsparklogsTailReader ===============================================================================
+
+FsparklogsTailReader::FsparklogsTailReader(const FString& InPath, bool InAllowMapping)
+	: Path(InPath)
+	, AllowMapping(InAllowMapping)
+	, LastSize(0)
+	, MappedSize(0)
+	, MappingUnavailable(false)
+	, LastReadMapped(false)
+{
+}
+
+FsparklogsTailReader::~FsparklogsTailReader()
+{
+	Close();
+}
+
+FsparklogsTailReader::EStatus FsparklogsTailReader::Refresh(int64& OutFileSize)
+{
+	OutFileSize = 0;
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	if (Handle.IsValid())
+	{
+		const int64 Size = Handle->Size();
+		if (Size < LastSize)
+		{
+			// Truncated. Reopen it so the mapping (if any) never refers to data that is gone.
+			Close();
+		}
+		else if (Size == LastSize)
+		{
+			// A file that was rotated away (or deleted) also stops growing, so make sure the path still refers to the open file.
+			// Growing files are never checked, which is what saves reopening the file for every read.
+			const FFileStatData StatData = PlatformFile.GetStatData(*Path);
+			if (!StatData.bIsValid || StatData.FileSize != Size)
+			{
+				Close();
+			}
+		}
+		if (Handle.IsValid())
+		{
+			LastSize = Size;
+			OutFileSize = Size;
+			return EStatus::Ready;
+		}
+	}
+
+	// Try twice because there can be race conditions with the file not existing and trying to open it...
+	constexpr int MaxRetries = 2;
+	for (int i = 1; true; i++)
+	{
+		Handle.Reset(PlatformFile.OpenRead(*Path, true));
+		if (Handle.IsValid())
+		{
+			break;
+		}
+		int ErrorCode = FPlatformMisc::GetLastError();
+		if (!FPaths::FileExists(Path))
+		{
+			return EStatus::Missing;
+		}
+		if (i >= MaxRetries)
+		{
+			TCHAR ErrBuffer[2048] = { 0, 0 };
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to open logfile='%s' err=%d msg=%s"), *Path, ErrorCode, FPlatformMisc::GetSystemErrorMessage(ErrBuffer, sizeof(ErrBuffer)-2, ErrorCode));
+			return EStatus::Failed;
+		}
+		FPlatformProcess::Sleep(0.01f);
+	}
+	LastSize = FMath::Max<int64>(Handle->Size(), 0);
+	OutFileSize = LastSize;
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|TailReader|opened log file|size=%ld|logfile='%s'"), LastSize, *Path);
+	return EStatus::Ready;
+}
+
+const uint8* FsparklogsTailReader::Read(int64 Offset, int32 Len, uint8* Buffer)
+{
+	LastReadMapped = false;
+	if (!Handle.IsValid() || Offset < 0 || Len < 0 || Offset + Len > LastSize)
+	{
+		return nullptr;
+	}
+	if (AllowMapping && !MappingUnavailable)
+	{
+		if (Offset + Len > MappedSize && LastSize - FMath::Max(Offset, MappedSize) >= MinRemapBytes)
+		{
+			Remap(LastSize);
+		}
+		if (MappedRegion.IsValid() && Offset + Len <= MappedSize)
+		{
+			LastReadMapped = true;
+			return MappedRegion->GetMappedPtr() + Offset;
+		}
+	}
+	if (!Handle->Seek(Offset) || !Handle->Read(Buffer, Len))
+	{
+		return nullptr;
+	}
+	return Buffer;
+}
+
+void FsparklogsTailReader::Close()
+{
+	Unmap();
+	Handle.Reset();
+	LastSize = 0;
+	LastReadMapped = false;
+}
+
+bool FsparklogsTailReader::Remap(int64 FileSize)
+{
+	Unmap();
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+#if (ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 3))
+	// The logfile is still being written to, so it must be shared for writing
+	FOpenMappedResult Result = PlatformFile.OpenMappedEx(*Path, EOpenReadFlags::AllowWrite);
+	if (Result.HasValue())
+	{
+		MappedHandle = Result.StealValue();
+	}
+#else
+	MappedHandle.Reset(PlatformFile.OpenMapped(*Path));
+#endif
+	if (MappedHandle.IsValid())
+	{
+		const int64 BytesToMap = FMath::Min(FileSize, MappedHandle->GetFileSize());
+		if (BytesToMap > 0)
+		{
+			MappedRegion.Reset(MappedHandle->MapRegion(0, BytesToMap));
+		}
+	}
+	if (!MappedRegion.IsValid())
+	{
+		Unmap();
+		MappingUnavailable = true;
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("STREAMER: Logfile cannot be memory mapped, reading it through the file handle instead: logfile='%s'"), *Path);
+		return false;
+	}
+	MappedSize = MappedRegion->GetMappedSize();
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|TailReader|mapped log file|mapped_size=%ld|logfile='%s'"), MappedSize, *Path);
+	return true;
+}
+
+void FsparklogsTailReader::Unmap()
+{
+	// The region must be released before the handle it was mapped from
+	MappedRegion.Reset();
+	MappedHandle.Reset();
+	MappedSize = 0;
+}
+
+// =============== FsparklogsSpool ===============================================================================
+
+FString FsparklogsSpool::GetSegmentPath(const FString& LogFilePath, int64 Number)
+{
+	return FPaths::Combine(FPaths::GetPath(LogFilePath), FString::Printf(TEXT("%s.seg%08lld%s"), *FPaths::GetBaseFilename(LogFilePath), Number, *FPaths::GetExtension(LogFilePath, true)));
+}
+
+FString FsparklogsSpool::GetProtectedMarkerPath(const FString& SegmentPath)
+{
+	return SegmentPath + TEXT(".analytics");
+}
+
+void FsparklogsSpool::FindSegments(const FString& LogFilePath, TArray<FSegment>& OutSegments)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsSpool_FindSegments);
+	OutSegments.Reset();
+	IFileManager& FileManager = IFileManager::Get();
+	const int64 LogFileSize = FileManager.FileSize(*LogFilePath);
+	if (LogFileSize >= 0)
+	{
+		// Nothing is known about what this file holds, and it is always shipped first anyway
+		FSegment& Segment = OutSegments.AddDefaulted_GetRef();
+		Segment.Path = LogFilePath;
+		Segment.Size = LogFileSize;
+		Segment.Protected = true;
+	}
+	const FString Dir = FPaths::GetPath(LogFilePath);
+	const FString Prefix = FPaths::GetBaseFilename(LogFilePath) + TEXT(".seg");
+	const FString Extension = FPaths::GetExtension(LogFilePath, true);
+	TArray<FString> Names;
+	FileManager.FindFiles(Names, *FPaths::Combine(Dir, Prefix + TEXT("*") + Extension), true, false);
+	for (const FString& Name : Names)
+	{
+		const int32 NumDigits = Name.Len() - Prefix.Len() - Extension.Len();
+		if (NumDigits <= 0 || !Name.StartsWith(Prefix) || !Name.EndsWith(Extension))
+		{
+			continue;
+		}
+		const FString Digits = Name.Mid(Prefix.Len(), NumDigits);
+		bool AllDigits = true;
+		for (TCHAR C : Digits)
+		{
+			AllDigits = AllDigits && FChar::IsDigit(C);
+		}
+		if (!AllDigits)
+		{
+			continue;
+		}
+		FSegment Segment;
+		Segment.Path = FPaths::Combine(Dir, Name);
+		Segment.Number = FCString::Atoi64(*Digits);
+		Segment.Size = FileManager.FileSize(*Segment.Path);
+		if (Segment.Number <= 0 || Segment.Size < 0)
+		{
+			continue;
+		}
+		Segment.Protected = FileManager.FileExists(*GetProtectedMarkerPath(Segment.Path));
+		OutSegments.Add(MoveTemp(Segment));
+	}
+	OutSegments.Sort([](const FSegment& A, const FSegment& B) { return A.Number < B.Number; });
+}
+
+bool FsparklogsSpool::HasSegments(const FString& LogFilePath)
+{
+	TArray<FSegment> Segments;
+	FindSegments(LogFilePath, Segments);
+	return Segments.Num() > 0 && Segments.Last().Number > 0;
+}
+
+bool FsparklogsSpool::PurgeSegment(const FSegment& Segment)
+{
+	if (!ITLPurgeFile(Segment.Path) || IFileManager::Get().FileExists(*Segment.Path))
+	{
+		return false;
+	}
+	IFileManager::Get().Delete(*GetProtectedMarkerPath(Segment.Path), false, false, true);
+	return true;
+}
+
+bool FsparklogsSpool::PurgeSegments(const FString& LogFilePath)
+{
+	TArray<FSegment> Segments;
+	FindSegments(LogFilePath, Segments);
+	bool PurgedEverything = true;
+	for (const FSegment& Segment : Segments)
+	{
+		if (Segment.Number > 0)
+		{
+			PurgedEverything = PurgeSegment(Segment) && PurgedEverything;
+		}
+	}
+	return PurgedEverything;
+}
+
+// =============== FsparklogsReadAndStreamToCloud ===============================================================================
+
+void FsparklogsReadAndStreamToCloud::ComputeCommonEventJSON(bool IncludeCommonMetadata, const FString& AppInstanceID, int InstanceIndex, const TMap<FString, FString>* AdditionalAttributes)
+{
+	FString CommonEventJSON;
+
+	if (IncludeCommonMetadata)
+	{
+		FString EffectiveComputerName;
+		if (OverrideComputerName.IsEmpty())
+		{
+			EffectiveComputerName = FPlatformProcess::ComputerName();
+		}
+		else
+		{
+			EffectiveComputerName = OverrideComputerName;
+		}
+
+		const uint32 ProcessId = (OverrideProcessId != 0) ? OverrideProcessId : FPlatformProcess::GetCurrentProcessId();
+		CommonEventJSON.Appendf(TEXT("\"hostname\": %s, \"pid\": %d"), *EscapeJsonString(EffectiveComputerName), ProcessId);
+		FString ProjectName = FApp::GetProjectName();
+		if (ProjectName.Len() > 0 && ProjectName != "None")
+		{
+			CommonEventJSON.Appendf(TEXT(", \"app\": %s"), *EscapeJsonString(ProjectName));
+		}
+	}
+
+	if (Settings->AddRandomAppInstanceID && AppInstanceID.Len() > 0)
+	{
+		if (!CommonEventJSON.IsEmpty())
+		{
+			CommonEventJSON.Append(TEXT(", "));
+		}
+		CommonEventJSON.Appendf(TEXT("\"app_instance_id\": %s"), *EscapeJsonString(AppInstanceID));
+		if (InstanceIndex > 1)
+		{
+			CommonEventJSON.Appendf(TEXT(", \"app_instance_index\": %d"), InstanceIndex);
+		}
+	}
+
+	// If game ID is set we should always include it regardless, it's required for good analytics data.
+	if (!Settings->AnalyticsGameID.IsEmpty())
+	{
+		if (!CommonEventJSON.IsEmpty())
+		{
+			CommonEventJSON.Append(TEXT(", "));
+		}
+		// The standardized field name is "app_id" (more generic as analytics can be used for more than games)
+		CommonEventJSON.Appendf(TEXT("\"app_id\": %s"), *EscapeJsonString(Settings->AnalyticsGameID));
+	}
+
+	if (nullptr != AdditionalAttributes && AdditionalAttributes->Num() > 0)
+	{
+		for (const TPair<FString, FString>& Pair : *AdditionalAttributes)
+		{
+			if (!CommonEventJSON.IsEmpty())
+			{
+				CommonEventJSON.Append(TEXT(","));
+			}
+			CommonEventJSON.Appendf(TEXT("%s:%s"), *EscapeJsonString(Pair.Key), *EscapeJsonString(Pair.Value));
+		}
+	}
+
+	if (!CommonEventJSON.IsEmpty())
+	{
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("Common event JSON computed. unreal_engine_common_event_data={%s}"), *CommonEventJSON);
+		int64 CommonEventJSONLen = FTCHARToUTF8_Convert::ConvertedLength(*CommonEventJSON, CommonEventJSON.Len());
+#if (ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 4))
+		CommonEventJSONData.SetNum(0, EAllowShrinking::No);
+#else
+		CommonEventJSONData.SetNum(0, false);
+#endif
+		CommonEventJSONData.AddUninitialized(CommonEventJSONLen);
+		FTCHARToUTF8_Convert::Convert((ANSICHAR*)CommonEventJSONData.GetData(), CommonEventJSONLen, *CommonEventJSON, CommonEventJSON.Len());
+		WorkerSerializeCommonEventJSON = true;
+	}
+}
+
+FsparklogsReadAndStreamToCloud::FsparklogsReadAndStreamToCloud(int InstanceIndex, const FString& InSourceLogFile, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InPayloadProcessor, int InMaxLineLength, const FString& InOverrideComputerName, const FString& AppInstanceID, const TMap<FString, FString>* AdditionalAttributes, ITLStreamLane InLane, uint32 InOverrideProcessId)
+	: Settings(InSettings)
+	, PayloadProcessor(InPayloadProcessor)
+	, Lane(InLane)
+	, KeepUncompressedPayload(InPayloadProcessor->WantsUncompressedPayload())
+	, SourceLogFile(InSourceLogFile)
+	, MaxLineLength(InMaxLineLength)
+	, OverrideComputerName(InOverrideComputerName)
+	, OverrideProcessId(InOverrideProcessId)
+	, Thread(nullptr)
+	, WorkerWakeEvent(FPlatformProcess::GetSynchEventFromPool(false))
+	, WakeRequestPlatformTime(0)
+	, LastWakeToSendLatencySecs(-1.0)
+	, LastPayloadCompressionRatio(-1.0)
+	, LastPayloadCompressSecs(-1.0)
+	, DroppedBacklogBytes(0)
+	, BufferBytes(0)
+	, AdaptiveBytesPerRequest(InSettings->BytesPerRequest)
+	, LastPayloadBuildSecs(-1.0)
+	, LastPayloadRequestSecs(-1.0)
+	, BacklogBytes(0)
+	, NumFlushRetries(0)
+	, NumDroppedPayloads(0)
+	, LastSuccessfulFlushPlatformTime(0)
+	, WorkerNextPayloadIsEnvelope(false)
+	, WorkerNextPayloadStartOffset(0)
+	, WorkerNextPayloadEndOffset(0)
+	, WorkerPayloadBufferSize(0)
+	, WorkerMaxReadLen(0)
+	, WorkerLastBufferUsePlatformTime(0)
+	, WorkerShippedLogOffset(0)
+	, WorkerLogFileSize(0)
+	, WorkerSpoolBacklogBytes(0)
+	, WorkerNextSpoolScanPlatformTime(0)
+	, WorkerReadingBinaryRecords(false)
+	, WorkerMinNextFlushPlatformTime(0)
+	, WorkerNumConsecutiveFlushFailures(0)
+	, WorkerLastRetrySecs(0)
+	, WorkerRetryAfterSecs(0)
+	, WorkerFlushWakeRequestPlatformTime(0)
+	, WorkerLastFailedFlushPayloadSize(0)
+	, WorkerPayloadsUseEnvelope(false)
+	, WorkerMirrorAheadOffset(0)
+	, WorkerMirrorsResumed(false)
+	, WorkerSerializeCommonEventJSON(false)
+	, LastFlushPlatformTime(0)
+	, BytesQueuedSinceLastFlush(0)
+{
+	ProgressMarkerPath = ITLGetIndexedStateFileINI(InstanceIndex);
+	FString ProgressJournalPath = ITLGetProgressJournalPath(ProgressMarkerPath, Lane);
+	if (!ProgressJournalPath.IsEmpty())
+	{
+		ProgressJournal = MakeUnique<FsparklogsProgressJournal>(ProgressJournalPath);
+	}
+	PayloadProcessor->CreateMirrorCursors(ProgressJournalPath, MirrorCursors);
+	ComputeCommonEventJSON(Settings->IncludeCommonMetadata, AppInstanceID, InstanceIndex, AdditionalAttributes);
+
+	WorkerMaxReadLen = Settings->BytesPerRequest;
+	if (Settings->MemoryBudgetBytes <= 0)
+	{
+		// Kept for the life of the streamer. With a memory budget the buffers are only allocated when there is something to ship.
+		WorkerBuffer.AddUninitialized(WorkerMaxReadLen);
+	}
+	WorkerReadData = WorkerBuffer.GetData();
+	WorkerTailReader = MakeUnique<FsparklogsTailReader>(SourceLogFile, Settings->MapSourceLogFile);
+	// Room for JSON escaping overhead and common metadata. The encoded payload buffer is sized on demand by the compressor.
+	WorkerPayloadBufferSize = Settings->BytesPerRequest + 4096 + (Settings->BytesPerRequest / 10);
+	if (Settings->MemoryBudgetBytes <= 0)
+	{
+		WorkerBuild.Payload.Reserve(WorkerPayloadBufferSize);
+	}
+	WorkerUpdateBufferBytes();
+	check(MaxLineLength > 0);
+	check(FPlatformProcess::SupportsMultithreading());
+	FString ThreadName = FString::Printf(TEXT("SparkLogs_Reader_%s"), *FPaths::GetBaseFilename(InSourceLogFile));
+	FPlatformAtomics::InterlockedExchangePtr((void**)&Thread, FRunnableThread::Create(this, *ThreadName, 0, TPri_BelowNormal));
+}
+
+FsparklogsReadAndStreamToCloud::~FsparklogsReadAndStreamToCloud()
+{
+	if (Thread)
+	{
+		delete Thread;
+	}
+	Thread = nullptr;
+	FPlatformProcess::ReturnSynchEventToPool(WorkerWakeEvent);
+	WorkerWakeEvent = nullptr;
+	DEC_MEMORY_STAT_BY(STAT_SparkLogsStreamerBufferMemory, BufferBytes.load());
+}
+
+bool FsparklogsReadAndStreamToCloud::Init()
+{
+	return true;
+}
+
+uint32 FsparklogsReadAndStreamToCloud::Run()
+{
+	WorkerFullyCleanedUp.AtomicSet(false);
+	ReadProgressMarker(WorkerShippedLogOffset, WorkerLastFailedFlushPayloadSize, WorkerOverrideCommonEventJSONData, WorkerPendingRetryPayloadSizes, WorkerPayloadsUseEnvelope);
+	if (WorkerLastFailedFlushPayloadSize <= 0)
+	{
+		// If we are not in the middle of a pending request, then do not re-use the last state either.
+		WorkerOverrideCommonEventJSONData.Reset();
+		WorkerPendingRetryPayloadSizes.Reset();
+	}
+	// Where the retries recorded by an earlier session end is only known once they were sent again
+	WorkerMirrorAheadOffset = -1;
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|BEGIN|WorkerShippedLogOffset=%d|WorkerLastFailedFlushPayloadSize=%d|WorkerPendingRetryPayloads=%d|WorkerOverrideCommonEventJSONDataLen=%d"), (int)WorkerShippedLogOffset, WorkerLastFailedFlushPayloadSize, (int)WorkerPendingRetryPayloadSizes.Num(), (int)WorkerOverrideCommonEventJSONData.Num());
+	// A pending flush will be processed before stopping
+	while (StopRequestCounter.GetValue() == 0 || FlushRequestCounter.GetValue() > 0)
+	{
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|In loop|WorkerLastFlushFailed=%d|FlushRequestCounter=%d|FlushClearMinNextPlatformTime=%d"), WorkerLastFlushFailed ? 1 : 0, (int)FlushRequestCounter.GetValue(), (int)FlushClearMinNextPlatformTime.GetValue());
+		if (FlushClearMinNextPlatformTime.GetValue() > 0)
+		{
+			WorkerMinNextFlushPlatformTime = FPlatformTime::Seconds();
+			WorkerNumConsecutiveFlushFailures = 0;
+			WorkerLastRetrySecs = 0;
+			FlushClearMinNextPlatformTime.Set(0);
+		}
+		// Only allow manual flushes if we are not in a retry delay because the last operation failed.
+		if (WorkerLastFlushFailed == false && FlushRequestCounter.GetValue() > 0)
+		{
+			int32 NewValue = FlushRequestCounter.Decrement();
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Manual flush requested|FlushRequestCounter=%d"), (int)NewValue);
+			WorkerDoFlush();
+		}
+		else if (FPlatformTime::Seconds() >= WorkerMinNextFlushPlatformTime)
+		{
+			// If we are waiting on a manual flush, and the retry timer finally expired, it's OK to mark this attempt as processing it.
+			if (FlushRequestCounter.GetValue() > 0)
+			{
+				int32 NewValue = FlushRequestCounter.Decrement();
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Manual flush requested after retry timer expired|FlushRequestCounter=%d"), (int)NewValue);
+			}
+			else
+			{
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Periodic flush"));
+			}
+			WorkerDoFlush();
+		}
+		else
+		{
+			// Sleep until the next scheduled flush, or until we are woken up by a flush or stop request.
+			// Mirrors keep getting new data while the retries wait.
+			WorkerMirrorAhead();
+			double WaitSecs = WorkerMinNextFlushPlatformTime - FPlatformTime::Seconds();
+			if (WaitSecs > 0.0)
+			{
+				WorkerWakeEvent->Wait((uint32)FMath::CeilToInt(WaitSecs * 1000.0));
+			}
+		}
+		WorkerReleaseIdleBuffers();
+	}
+	WorkerTailReader->Close();
+	WorkerFullyCleanedUp.AtomicSet(true);
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|END"));
+	return 0;
+}
+
+void FsparklogsReadAndStreamToCloud::Stop()
+{
+	int32 NewValue = StopRequestCounter.Increment();
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Stop|StopRequestCounter=%d"), (int)NewValue);
+	WakeWorker();
+}
+
+void FsparklogsReadAndStreamToCloud::WakeWorker()
+{
+	// Only the earliest outstanding request matters for latency
+	double Expected = 0.0;
+	WakeRequestPlatformTime.compare_exchange_strong(Expected, FPlatformTime::Seconds());
+	WorkerWakeEvent->Trigger();
+}
+
+bool FsparklogsReadAndStreamToCloud::AccrueWrittenBytes(int N)
+{
+	int64 Result = N + BytesQueuedSinceLastFlush.fetch_add((int64)N);
+	if (Result >= GetUnflushedBytesToAutoFlush())
+	{
+		double Now = FPlatformTime::Seconds();
+		if ((Now - LastFlushPlatformTime.load()) >= Settings->MinIntervalBetweenFlushes)
+		{
+			// Even though flush hasn't started, we will initiate it, so do not attempt more auto-flushes until the interval has passed again.
+			BytesQueuedSinceLastFlush.store(0);
+			LastFlushPlatformTime.store(Now);
+			RequestFlush();
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|AccrueWrittenBytes|Automatically requesting a flush after the min interval and queued bytes..."));
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FsparklogsReadAndStreamToCloud::RequestFlush()
+{
+	// Clear any pending retry timer so we retry immediately
+	WorkerLastFlushFailed.AtomicSet(false);
+	FlushClearMinNextPlatformTime.Increment();
+	// If we've already requested a stop, a flush is impossible
+	if (StopRequestCounter.GetValue() > 0)
+	{
+		return false;
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|RequestFlush|Initiating flush by incrementing counter..."));
+	FlushRequestCounter.Increment();
+	WakeWorker();
+	return true;
+}
+
+bool FsparklogsReadAndStreamToCloud::FlushAndWait(int N, bool ClearRetryTimer, bool InitiateStop, bool OnMainGameThread, double TimeoutSec, bool& OutLastFlushProcessedEverything)
+{
+	OutLastFlushProcessedEverything = false;
+	bool WasSuccessful = true;
+
+	// If we've already requested a stop, a flush is impossible
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|StopRequestCounter=%d"), (int)StopRequestCounter.GetValue());
+	if (StopRequestCounter.GetValue() > 0)
+	{
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|stop already requested, exiting with false"));
+		return false;
+	}
+
+	if (ClearRetryTimer)
+	{
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Clearing retry timer..."));
+		// Clear any pending retry timer so we retry immediately
+		WorkerLastFlushFailed.AtomicSet(false);
+		FlushClearMinNextPlatformTime.Increment();
+	}
+
+	for (int i = 0; i < N; i++)
+	{
+		int StartFlushSuccessOpCounter = FlushSuccessOpCounter.GetValue();
+		int StartFlushOpCounter = FlushOpCounter.GetValue();
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Starting Loop|i=%d|N=%d|FlushSuccessOpCounter=%d|FlushOpCounter=%d"), (int)i, (int)N, (int)StartFlushSuccessOpCounter, (int)StartFlushOpCounter);
+		FlushRequestCounter.Increment();
+		// Last time around, we might initiate a stop
+		if (InitiateStop && i == N-1)
+		{
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Initiating stop..."));
+			Stop();
+		}
+		else
+		{
+			WakeWorker();
+		}
+		double StartTime = FPlatformTime::Seconds();
+		double LastTime = StartTime;
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Waiting for request to finish...|StartTime=%.3lf"), StartTime);
+		while (FlushOpCounter.GetValue() == StartFlushOpCounter)
+		{
+			double Now = FPlatformTime::Seconds();
+			if (Now - StartTime > TimeoutSec)
+			{
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Timed out, returning false"));
+				return false;
+			}
+			if (OnMainGameThread)
+			{
+				// HTTP requests and other things won't be processed unless we tick
+				ITLTickGameThreadWhileWaiting(Now - LastTime);
+				// NOTE: the game does not normally progress the frame count during shutdown, follow the same logic here
+				// GFrameCounter++;
+			}
+			FPlatformProcess::SleepNoStats(0.005f);
+			LastTime = Now;
+		}
+		WasSuccessful = FlushSuccessOpCounter.GetValue() != StartFlushSuccessOpCounter;
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Finished waiting for request|WasSuccessful=%d|FlushSuccessOpCounter=%d|FlushOpCounter=%d"), WasSuccessful ? 1 : 0, (int)FlushSuccessOpCounter.GetValue(), (int)FlushOpCounter.GetValue());
+	}
+	if (WasSuccessful)
+	{
+		OutLastFlushProcessedEverything = LastFlushProcessedEverything;
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|LastFlushProcessedEverything=%d"), OutLastFlushProcessedEverything ? 1 : 0);
+	}
+	if (InitiateStop) {
+		// Wait for the worker to fully stop, up to the timeout
+		double StartTime = FPlatformTime::Seconds();
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Waiting for thread to stop...|StartTime=%.3lf"), StartTime);
+		while (!WorkerFullyCleanedUp)
+		{
+			if (FPlatformTime::Seconds() - StartTime > TimeoutSec)
+			{
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Timed out waiting for thread to stop"));
+				return false;
+			}
+			FPlatformProcess::SleepNoStats(0.005f);
+		}
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|END|WasSuccessful=%d"), WasSuccessful ? 1 : 0);
+	return WasSuccessful;
+}
+
+bool FsparklogsReadAndStreamToCloud::FlushUntilDeadline(double DeadlinePlatformTime, bool InitiateStop, bool OnMainGameThread)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_FlushUntilDeadline);
+	bool FlushedEverything = false;
+	// A flush can stop short of the end (e.g., when it reaches MaxInFlightRequests), so keep flushing while there is time left
+	double RemainingSecs = DeadlinePlatformTime - FPlatformTime::Seconds();
+	while (RemainingSecs > 0.0 && !FlushedEverything)
+	{
+		if (!FlushAndWait(1, true, false, OnMainGameThread, RemainingSecs, FlushedEverything))
+		{
+			FlushedEverything = false;
+			break;
+		}
+		RemainingSecs = DeadlinePlatformTime - FPlatformTime::Seconds();
+	}
+	if (InitiateStop)
+	{
+		// The final flush also picks up anything written meanwhile, and the worker finishes its in-flight payloads before stopping
+		bool StopFlushedEverything = false;
+		const double StopWaitSecs = FMath::Max(DeadlinePlatformTime - FPlatformTime::Seconds(), FsparklogsSettings::MinStopWaitSecs);
+		FlushedEverything = FlushAndWait(1, true, true, OnMainGameThread, StopWaitSecs, StopFlushedEverything) && StopFlushedEverything;
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushUntilDeadline|FlushedEverything=%d|InitiateStop=%d|RemainingSecs=%.3lf"), FlushedEverything ? 1 : 0, InitiateStop ? 1 : 0, DeadlinePlatformTime - FPlatformTime::Seconds());
+	return FlushedEverything;
+}
+
+void FsparklogsReadAndStreamToCloud::SyncProgressToDisk()
+{
+	// Progress kept in the INI is flushed every time it is written. The journal is only fully flushed once in a while, unless it is closed (the next write re-opens it).
+	if (ProgressJournal.IsValid())
+	{
+		ProgressJournal->Close();
+	}
+}
+
+bool FsparklogsReadAndStreamToCloud::ReadProgressMarker(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutProgressState)
+{
+	TArray<int> IgnoreFollowingReadLens;
+	return ReadProgressMarker(OutMarker, OutLastReadLen, OutProgressState, IgnoreFollowingReadLens);
+}
+
+bool FsparklogsReadAndStreamToCloud::ReadProgressMarker(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutProgressState, TArray<int>& OutFollowingReadLens)
+{
+	bool IgnoreRetryIsEnvelope = false;
+	return ReadProgressMarker(OutMarker, OutLastReadLen, OutProgressState, OutFollowingReadLens, IgnoreRetryIsEnvelope);
+}
+
+bool FsparklogsReadAndStreamToCloud::ReadProgressMarker(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutProgressState, TArray<int>& OutFollowingReadLens, bool& OutRetryIsEnvelope)
+{
+	if (!ProgressJournal.IsValid())
+	{
+		return ReadLegacyProgressMarker(OutMarker, OutLastReadLen, OutProgressState, OutFollowingReadLens, OutRetryIsEnvelope);
+	}
+	FScopeLock MigrationLock(&ProgressMigrationCriticalSection);
+	if (ProgressJournal->Read(OutMarker, OutLastReadLen, OutProgressState, OutFollowingReadLens, OutRetryIsEnvelope))
+	{
+		return true;
+	}
+	// No journal yet, so pick up where a previous version of the plugin left off in the INI file (only ever done once).
+	ReadLegacyProgressMarker(OutMarker, OutLastReadLen, OutProgressState, OutFollowingReadLens, OutRetryIsEnvelope);
+	if (!ProgressJournal->Write(OutMarker, OutLastReadLen, &OutProgressState, &OutFollowingReadLens, OutRetryIsEnvelope))
+	{
+		return true;
+	}
+	if (OutMarker > 0 || OutLastReadLen > 0 || OutProgressState.Num() > 0)
+	{
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("Migrated progress marker to journal. progress_marker=%lld last_read_len=%d journal='%s'"), OutMarker, OutLastReadLen, *ProgressJournal->GetPath());
+		DeleteLegacyProgressMarker();
+	}
+	return true;
+}
+
+FString FsparklogsReadAndStreamToCloud::GetProgressMarkerKey(const TCHAR* Key) const
+{
+	// The logs lane keeps the original key names so that progress from earlier versions is picked up
+	return Lane == ITLStreamLane::Analytics ? FString(TEXT("Analytics")) + Key : FString(Key);
+}
+
+double FsparklogsReadAndStreamToCloud::GetProcessingIntervalSecs() const
+{
+	return Lane == ITLStreamLane::Analytics ? Settings->AnalyticsProcessingIntervalSecs : Settings->ProcessingIntervalSecs;
+}
+
+int32 FsparklogsReadAndStreamToCloud::GetUnflushedBytesToAutoFlush() const
+{
+	return Lane == ITLStreamLane::Analytics ? Settings->AnalyticsUnflushedBytesToAutoFlush : Settings->UnflushedBytesToAutoFlush;
+}
+
+bool FsparklogsReadAndStreamToCloud::ReadLegacyProgressMarker(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutProgressState, TArray<int>& OutFollowingReadLens, bool& OutRetryIsEnvelope)
+{
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|ReadProgressMarker|inifile='%s'|BEGIN"), *ProgressMarkerPath);
+	OutMarker = 0;
+	OutLastReadLen = 0;
+	OutProgressState.Reset();
+	OutFollowingReadLens.Reset();
+	OutRetryIsEnvelope = false;
+	double OutDouble = 0.0;
+	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
+	bool RetryIsEnvelope = false;
+	GConfig->GetBool(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerRetryEnvelopeValue), RetryIsEnvelope, ProgressMarkerPath);
+	FString OutStringValue, OutLastReadLenStringValue, OutCompressedStateStringValue, OutFollowingReadLensStringValue;
+	bool Result = GConfig->GetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerValue), OutStringValue, ProgressMarkerPath);
+	GConfig->GetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerLastReadLenValue), OutLastReadLenStringValue, ProgressMarkerPath);
+	GConfig->GetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerStateValue), OutCompressedStateStringValue, ProgressMarkerPath);
+	GConfig->GetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerInFlightReadLensValue), OutFollowingReadLensStringValue, ProgressMarkerPath);
+	ConfigLock1.Unlock();
+
+	OutStringValue.TrimStartAndEndInline();
+	OutLastReadLenStringValue.TrimStartAndEndInline();
+	OutCompressedStateStringValue.TrimStartAndEndInline();
+	OutMarker = FCString::Atoi64(*OutStringValue);
+	OutLastReadLen = FCString::Atoi(*OutLastReadLenStringValue);
+	OutRetryIsEnvelope = RetryIsEnvelope && OutLastReadLen > 0;
+	if (OutLastReadLen > 0 && !OutFollowingReadLensStringValue.IsEmpty())
+	{
+		// Format is a comma-separated list of read lengths, in the order the payloads were sent
+		TArray<FString> ReadLenParts;
+		OutFollowingReadLensStringValue.ParseIntoArray(ReadLenParts, TEXT(","));
+		for (FString& Part : ReadLenParts)
+		{
+			Part.TrimStartAndEndInline();
+			int ReadLen = FCString::Atoi(*Part);
+			if (ReadLen <= 0)
+			{
+				// Only an unbroken sequence of sizes is useful for deduplication
+				break;
+			}
+			OutFollowingReadLens.Add(ReadLen);
+		}
+	}
+	FString CompressedStateOriginalLenString, CompressedStateEncodedData;
+	if (OutCompressedStateStringValue.Len() > 0 && OutCompressedStateStringValue.Split(TEXT(":"), &CompressedStateOriginalLenString, &CompressedStateEncodedData))
+	{
+		bool DecodedSuccess = false;
+		int StateOriginalLen = FCString::Atoi(*CompressedStateOriginalLenString);
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|ReadProgressMarker|decoding progress state|original_len=%d|base64_len=%d"), StateOriginalLen, CompressedStateEncodedData.Len());
+		TArray<uint8> CompressedState;
+		uint32 DecodedSize = FBase64::GetDecodedDataSize(CompressedStateEncodedData);
+		if (StateOriginalLen > 0 && StateOriginalLen < (1024 * 1024) && DecodedSize > 0 && DecodedSize < (1024 * 1024))
+		{
+			CompressedState.Reserve(DecodedSize);
+			OutProgressState.Reserve(StateOriginalLen);
+			if (FBase64::Decode(CompressedStateEncodedData, CompressedState))
+			{
+				if (ITLDecompressData(ITLCompressionMode::LZ4, CompressedState.GetData(), CompressedState.Num(), StateOriginalLen, OutProgressState))
+				{
+					ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|ReadProgressMarker|decoded progress state|original_len=%d|decompressed_len=%d"), StateOriginalLen, OutProgressState.Num());
+					DecodedSuccess = true;
+				}
+			}
+		}
+		if (!DecodedSuccess)
+		{
+			// It's OK just to use only the new state.
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to decode previous progress state (will ignore)."));
+			OutProgressState.Reset();
+		}
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|ReadProgressMarker|inifile='%s'|Result=%s|MarkerString=%s|Marker=%ld|LastReadLen=%d|FollowingReadLens=%d|ProgressStateLen=%d"), *ProgressMarkerPath, Result ? TEXT("success") : TEXT("failure"), *OutStringValue, OutMarker, OutLastReadLen, (int)OutFollowingReadLens.Num(), (int)OutProgressState.Num());
+	return true;
+}
+
+bool FsparklogsReadAndStreamToCloud::WriteProgressMarker(int64 InMarker, int LastReadLen, const TArray<uint8>* ProgressState, const TArray<int>* FollowingReadLens, bool RetryIsEnvelope)
+{
+	if (ProgressJournal.IsValid())
+	{
+		return ProgressJournal->Write(InMarker, LastReadLen, ProgressState, FollowingReadLens, RetryIsEnvelope);
+	}
+	return WriteLegacyProgressMarker(InMarker, LastReadLen, ProgressState, FollowingReadLens, RetryIsEnvelope);
+}
+
+bool FsparklogsReadAndStreamToCloud::WriteLegacyProgressMarker(int64 InMarker, int LastReadLen, const TArray<uint8>* ProgressState, const TArray<int>* FollowingReadLens, bool RetryIsEnvelope)
+{
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WriteProgressMarker|inifile='%s'|Marker=%lld|LastReadLen=%d|FollowingReadLens=%d"), *ProgressMarkerPath, InMarker, LastReadLen, FollowingReadLens != nullptr ? (int)FollowingReadLens->Num() : 0);
+	// Precise to 52+ bits
+	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
+	bool WasDisabled = GConfig->AreFileOperationsDisabled();
+	GConfig->EnableFileOperations();
+	GConfig->SetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerValue), *FString::Printf(TEXT("%ld"), InMarker), ProgressMarkerPath);
+	GConfig->SetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerLastReadLenValue), *FString::Printf(TEXT("%ld"), LastReadLen), ProgressMarkerPath);
+	if (FollowingReadLens != nullptr && FollowingReadLens->Num() > 0 && LastReadLen > 0)
+	{
+		FString FollowingReadLensString;
+		for (int ReadLen : *FollowingReadLens)
+		{
+			if (!FollowingReadLensString.IsEmpty())
+			{
+				FollowingReadLensString.AppendChar(TEXT(','));
+			}
+			FollowingReadLensString.AppendInt(ReadLen);
+		}
+		GConfig->SetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerInFlightReadLensValue), *FollowingReadLensString, ProgressMarkerPath);
+	}
+	else
+	{
+		GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerInFlightReadLensValue), ProgressMarkerPath);
+	}
+	if (RetryIsEnvelope && LastReadLen > 0)
+	{
+		GConfig->SetBool(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerRetryEnvelopeValue), true, ProgressMarkerPath);
+	}
+	else
+	{
+		GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerRetryEnvelopeValue), ProgressMarkerPath);
+	}
+	if (ProgressState != nullptr)
+	{
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WriteProgressMarker|starting to save progress state|uncompressed_len=%d"), ProgressState->Num());
+		bool SavedState = false;
+		if (ProgressState->Num() > 0)
+		{
+			// Format is <original_len>:<base_64_encoded_lz4_compressed_state>
+			FString OriginalLenPrefix = FString::Printf(TEXT("%d:"), (int)ProgressState->Num());
+			TArray<uint8> CompressedState;
+			CompressedState.Reserve(ProgressState->Num() + 8);
+			if (ITLCompressData(ITLCompressionMode::LZ4, ProgressState->GetData(), ProgressState->Num(), CompressedState))
+			{
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WriteProgressMarker|saving progress state|compressed_len=%d"), CompressedState.Num());
+				FString Encoded = FBase64::Encode(CompressedState);
+				if (!Encoded.IsEmpty() && Encoded.Len() < (1024 * 64))
+				{
+					FString CombinedState = OriginalLenPrefix + Encoded;
+					ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WriteProgressMarker|saved progress state|value=%s"), *CombinedState);
+					GConfig->SetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerStateValue), *CombinedState, ProgressMarkerPath);
+					SavedState = true;
+				}
+			}
+		}
+		if (!SavedState)
+		{
+			if (ProgressState->Num() > 0)
+			{
+				// Even though we failed to save the state, it's better to clear it out than allow a stale state, so just log a warning.
+				UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to save progress state."));
+			}
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WriteProgressMarker|clearing progress state from INI file"));
+			GConfig->SetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerStateValue), TEXT(""), ProgressMarkerPath);
+		}
+	}
+	GConfig->Flush(false, ProgressMarkerPath);
+	if (WasDisabled)
+	{
+		GConfig->DisableFileOperations();
+	}
+	return true;
+}
+
+void FsparklogsReadAndStreamToCloud::DeleteProgressMarker()
+{
+	if (ProgressJournal.IsValid())
+	{
+		TArray<uint8> EmptyState;
+		ProgressJournal->Write(0, 0, &EmptyState, nullptr);
+	}
+	else
+	{
+		DeleteLegacyProgressMarker();
+	}
+	for (const TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>& Cursor : MirrorCursors)
+	{
+		Cursor->Reset(0);
+	}
+}
+
+void FsparklogsReadAndStreamToCloud::DeleteLegacyProgressMarker()
+{
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|DeleteProgressMarker|inifile='%s'"), *ProgressMarkerPath);
+	FScopeLock ConfigLock1(GetITLPluginConfigCriticalSection().CS.Get());
+	bool WasDisabled = GConfig->AreFileOperationsDisabled();
+	GConfig->EnableFileOperations();
+	if (!GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerValue), ProgressMarkerPath))
+	{
+		GConfig->SetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerValue), TEXT("0"), ProgressMarkerPath);
+	}
+	if (!GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerStateValue), ProgressMarkerPath))
+	{
+		GConfig->SetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerStateValue), TEXT(""), ProgressMarkerPath);
+	}
+	if (!GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerLastReadLenValue), ProgressMarkerPath))
+	{
+		GConfig->SetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerLastReadLenValue), TEXT(""), ProgressMarkerPath);
+	}
+	if (!GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerInFlightReadLensValue), ProgressMarkerPath))
+	{
+		GConfig->SetString(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerInFlightReadLensValue), TEXT(""), ProgressMarkerPath);
+	}
+	GConfig->RemoveKey(ITL_CONFIG_SECTION_NAME, *GetProgressMarkerKey(ProgressMarkerRetryEnvelopeValue), ProgressMarkerPath);
+	GConfig->Flush(false, ProgressMarkerPath);
+	if (WasDisabled)
+	{
+		GConfig->DisableFileOperations();
+	}
+}
+
+void FsparklogsReadAndStreamToCloud::GetCommonEventJSON(TArray<uint8>& OutData)
+{
+	OutData = CommonEventJSONData;
+}
+
+bool ITLFindFirstByteScalar(const uint8* Haystack, uint8 Needle, int MaxToSearch, int& OutIndex)
+{
+	OutIndex = -1;
+	for (const uint8* RESTRICT Data = Haystack, *RESTRICT End = Data + MaxToSearch; Data != End; ++Data)
+	{
+		if (*Data == Needle)
+		{
+			OutIndex = static_cast<int>(Data - Haystack);
+			return true;
+		}
+	}
+	return false;
+}
+
+void ITLAppendUTF8AsEscapedJsonStringScalar(TITLJSONStringBuilder& Builder, const ANSICHAR* String, int N)
+{
+	ANSICHAR ControlFormatBuf[16];
+	ANSICHAR OneCharBuf[2] = {0, 0};
+	Builder.Append("\"");
+	for (const ANSICHAR* RESTRICT Data = String, *RESTRICT End = Data + N; Data != End; ++Data)
+	{
+		switch (*Data)
+		{
+		case '\"':
+			Builder.Append("\\\"", 2 /* string length */);
+			break;
+		case '\b':
+			Builder.Append("\\b", 2 /* string length */);
+			break;
+		case '\t':
+			Builder.Append("\\t", 2 /* string length */);
+			break;
+		case '\n':
+			Builder.Append("\\n", 2 /* string length */);
+			break;
+		case static_cast<ANSICHAR>(CharInternalNewline):
+			Builder.Append("\\n", 2 /* string length */);
+			break;
+		case '\f':
+			Builder.Append("\\f", 2 /* string length */);
+			break;
+		case '\r':
+			Builder.Append("\\r", 2 /* string length */);
+			break;
+		case '\\':
+			Builder.Append("\\\\", 2 /* string length */);
+			break;
+		default:
+			// Any character 0x20 and above can be included as-is
+			if ((uint8)(*Data) >= static_cast<UTF8CHAR>(0x20))
+			{
+				OneCharBuf[0] = *Data;
+				Builder.Append(OneCharBuf);
+			}
+			else
+			{
+				// Rare control character
+				FCStringAnsi::Snprintf(ControlFormatBuf, sizeof(ControlFormatBuf), "\\u%04x", static_cast<int>(*Data));
+				Builder.Append(ControlFormatBuf);
+			}
+		}
+	}
+	Builder.Append("\"");
+}
+
+// Returns a bitmask with one bit set for every byte in the block that matches (the lowest bit is the first byte).
+#if ITL_PAYLOAD_KERNEL_AVX2
+constexpr int ITLPayloadKernelBlockSize = 32;
+static FORCEINLINE uint32 ITLMatchByteMask(const uint8* Data, uint8 Needle)
+{
+	__m256i Block = _mm256_loadu_si256((const __m256i*)Data);
+	return (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(Block, _mm256_set1_epi8((char)Needle)));
+}
+static FORCEINLINE uint32 ITLMatchJsonEscapeMask(const uint8* Data)
+{
+	__m256i Block = _mm256_loadu_si256((const __m256i*)Data);
+	// Unsigned (Block <= 0x1F) catches all control characters, including \n, \r, \t, and CharInternalNewline
+	__m256i Control = _mm256_cmpeq_epi8(_mm256_min_epu8(Block, _mm256_set1_epi8(0x1F)), Block);
+	__m256i Quote = _mm256_cmpeq_epi8(Block, _mm256_set1_epi8('\"'));
+	__m256i Backslash = _mm256_cmpeq_epi8(Block, _mm256_set1_epi8('\\'));
+	return (uint32)_mm256_movemask_epi8(_mm256_or_si256(Control, _mm256_or_si256(Quote, Backslash)));
+}
+#elif ITL_PAYLOAD_KERNEL_SSE2
+constexpr int ITLPayloadKernelBlockSize = 16;
+static FORCEINLINE uint32 ITLMatchByteMask(const uint8* Data, uint8 Needle)
+{
+	__m128i Block = _mm_loadu_si128((const __m128i*)Data);
+	return (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(Block, _mm_set1_epi8((char)Needle)));
+}
+static FORCEINLINE uint32 ITLMatchJsonEscapeMask(const uint8* Data)
+{
+	__m128i Block = _mm_loadu_si128((const __m128i*)Data);
+	// Unsigned (Block <= 0x1F) catches all control characters, including \n, \r, \t, and CharInternalNewline
+	__m128i Control = _mm_cmpeq_epi8(_mm_min_epu8(Block, _mm_set1_epi8(0x1F)), Block);
+	__m128i Quote = _mm_cmpeq_epi8(Block, _mm_set1_epi8('\"'));
+	__m128i Backslash = _mm_cmpeq_epi8(Block, _mm_set1_epi8('\\'));
+	return (uint32)_mm_movemask_epi8(_mm_or_si128(Control, _mm_or_si128(Quote, Backslash)));
+}
+#elif ITL_PAYLOAD_KERNEL_NEON
+constexpr int ITLPayloadKernelBlockSize = 16;
+// NEON has no movemask, so narrow each 8-bit lane result to 4 bits and return a 64-bit mask with 4 bits per byte.
+static FORCEINLINE uint64 ITLNeonMask(uint8x16_t Matches)
+{
+	return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(Matches), 4)), 0);
+}
+static FORCEINLINE uint64 ITLMatchByteMask(const uint8* Data, uint8 Needle)
+{
+	return ITLNeonMask(vceqq_u8(vld1q_u8(Data), vdupq_n_u8(Needle)));
+}
+static FORCEINLINE uint64 ITLMatchJsonEscapeMask(const uint8* Data)
+{
+	uint8x16_t Block = vld1q_u8(Data);
+	uint8x16_t Matches = vorrq_u8(vcltq_u8(Block, vdupq_n_u8(0x20)), vorrq_u8(vceqq_u8(Block, vdupq_n_u8('\"')), vceqq_u8(Block, vdupq_n_u8('\\'))));
+	return ITLNeonMask(Matches);
+}
+#endif
+
+#if ITL_PAYLOAD_KERNEL_NEON
+// 4 bits per byte
+#define ITL_PAYLOAD_KERNEL_FIRST_MATCH(Mask) ((int)(FMath::CountTrailingZeros64(Mask) >> 2))
+#elif ITL_PAYLOAD_KERNEL_AVX2 || ITL_PAYLOAD_KERNEL_SSE2
+#define ITL_PAYLOAD_KERNEL_FIRST_MATCH(Mask) ((int)FMath::CountTrailingZeros(Mask))
+#endif
+
+const TCHAR* ITLGetPayloadKernelName()
+{
+#if ITL_PAYLOAD_KERNEL_AVX2
+	return TEXT("avx2");
+#elif ITL_PAYLOAD_KERNEL_SSE2
+	return TEXT("sse2");
+#elif ITL_PAYLOAD_KERNEL_NEON
+	return TEXT("neon");
+#else
+	return TEXT("scalar");
+#endif
+}
+
+bool ITLFindFirstByte(const uint8* Haystack, uint8 Needle, int MaxToSearch, int& OutIndex)
+{
+#if ITL_PAYLOAD_KERNEL_AVX2 || ITL_PAYLOAD_KERNEL_SSE2 || ITL_PAYLOAD_KERNEL_NEON
+	int Offset = 0;
+	for (; Offset + ITLPayloadKernelBlockSize <= MaxToSearch; Offset += ITLPayloadKernelBlockSize)
+	{
+		auto Mask = ITLMatchByteMask(Haystack + Offset, Needle);
+		if (Mask != 0)
+		{
+			OutIndex = Offset + ITL_PAYLOAD_KERNEL_FIRST_MATCH(Mask);
+			return true;
+		}
+	}
+	// Finish the tail that is smaller than a whole block
+	if (ITLFindFirstByteScalar(Haystack + Offset, Needle, MaxToSearch - Offset, OutIndex))
+	{
+		OutIndex += Offset;
+		return true;
+	}
+	OutIndex = -1;
+	return false;
+#else
+	return ITLFindFirstByteScalar(Haystack, Needle, MaxToSearch, OutIndex);
+#endif
+}
+
+/** Returns the number of bytes at the start of Data that can be copied into a JSON string as-is (stops at the first byte that needs escaping). */
+static FORCEINLINE int ITLCountCleanJsonBytes(const uint8* Data, int N)
+{
+	int Offset = 0;
+#if ITL_PAYLOAD_KERNEL_AVX2 || ITL_PAYLOAD_KERNEL_SSE2 || ITL_PAYLOAD_KERNEL_NEON
+	for (; Offset + ITLPayloadKernelBlockSize <= N; Offset += ITLPayloadKernelBlockSize)
+	{
+		auto Mask = ITLMatchJsonEscapeMask(Data + Offset);
+		if (Mask != 0)
+		{
+			return Offset + ITL_PAYLOAD_KERNEL_FIRST_MATCH(Mask);
+		}
+	}
+#endif
+	for (; Offset < N; ++Offset)
+	{
+		uint8 c = Data[Offset];
+		if (c < 0x20 || c == '\"' || c == '\\')
+		{
+			break;
+		}
+	}
+	return Offset;
+}
+
+void ITLAppendUTF8AsEscapedJsonString(TITLJSONStringBuilder& Builder, const ANSICHAR* String, int N)
+{
+	ANSICHAR ControlFormatBuf[16];
+	Builder.Append("\"");
+	const ANSICHAR* Data = String;
+	const ANSICHAR* End = String + N;
+	while (Data < End)
+	{
+		// Bulk-copy everything up until the next character that needs escaping
+		int NumClean = ITLCountCleanJsonBytes((const uint8*)Data, (int)(End - Data));
+		if (NumClean > 0)
+		{
+			Builder.Append(Data, NumClean);
+			Data += NumClean;
+			if (Data >= End)
+			{
+				break;
+			}
+		}
+		switch (*Data)
+		{
+		case '\"':
+			Builder.Append("\\\"", 2 /* string length */);
+			break;
+		case '\b':
+			Builder.Append("\\b", 2 /* string length */);
+			break;
+		case '\t':
+			Builder.Append("\\t", 2 /* string length */);
+			break;
+		case '\n':
+			Builder.Append("\\n", 2 /* string length */);
+			break;
+		case static_cast<ANSICHAR>(CharInternalNewline):
+			Builder.Append("\\n", 2 /* string length */);
+			break;
+		case '\f':
+			Builder.Append("\\f", 2 /* string length */);
+			break;
+		case '\r':
+			Builder.Append("\\r", 2 /* string length */);
+			break;
+		case '\\':
+			Builder.Append("\\\\", 2 /* string length */);
+			break;
+		default:
+			// Rare control character
+			FCStringAnsi::Snprintf(ControlFormatBuf, sizeof(ControlFormatBuf), "\\u%04x", static_cast<int>(*Data));
+			Builder.Append(ControlFormatBuf);
+		}
+		++Data;
+	}
+	Builder.Append("\"");
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerReadNextPayload(int64 StartOffset, int MaxReadLen, int& OutNumToRead, int64& OutEffectiveShippedLogOffset, int64& OutRemainingBytes)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerReadNextPayload);
+	ITL_TRACE_SCOPE(SparkLogs_WorkerReadNextPayload);
+
+	if (Settings->SpoolSegmentBytes > 0 && !WorkerAdvanceSpool(StartOffset))
+	{
+		// Let the payloads from the end of this segment finish before moving on to the next one
+		OutEffectiveShippedLogOffset = StartOffset;
+		OutNumToRead = 0;
+		OutRemainingBytes = 0;
+		return true;
+	}
+	OutEffectiveShippedLogOffset = StartOffset;
+
+	int64 FileSize = 0;
+	switch (WorkerTailReader->Refresh(FileSize))
+	{
+	case FsparklogsTailReader::EStatus::Missing:
+		WorkerLogFileSize = 0;
+		WorkerRecordFormatPath.Reset();
+		OutEffectiveShippedLogOffset = 0;
+		OutNumToRead = 0;
+		OutRemainingBytes = 0;
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|Logfile does not yet exist, nothing to read|logfile='%s'"), *SourceLogFile);
+		return true;
+	case FsparklogsTailReader::EStatus::Failed:
+		return false;
+	default:
+		break;
+	}
+	WorkerLogFileSize = FileSize;
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|opened log file|last_offset=%ld|current_file_size=%ld|logfile='%s'"), OutEffectiveShippedLogOffset, FileSize, *SourceLogFile);
+	if (OutEffectiveShippedLogOffset > FileSize)
+	{
+		if (StartOffset != WorkerShippedLogOffset)
+		{
+			// A pipelined read past the last acknowledged payload. Let the earlier payloads finish before starting over.
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|Logfile reduced size while payloads are in flight|FileSize=%ld|StartOffset=%ld"), FileSize, StartOffset);
+			OutNumToRead = 0;
+			OutRemainingBytes = 0;
+			return true;
+		}
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("STREAMER: Logfile reduced size, re-reading from start: new_size=%ld, previously_processed_to=%ld, logfile='%s'"), FileSize, OutEffectiveShippedLogOffset, *SourceLogFile);
+		OutEffectiveShippedLogOffset = 0;
+		// Don't force a retried read to use the same payload size as last time since the whole file has changed.
+		MaxReadLen = 0;
+		WorkerLastFailedFlushPayloadSize = 0;
+		WorkerPendingRetryPayloadSizes.Reset();
+		WorkerOverrideCommonEventJSONData.Reset();
+		// The file was replaced, possibly with one in the other format
+		WorkerRecordFormatPath.Reset();
+		WorkerRestartMirrors();
+	}
+	WorkerUpdateRecordFormat(FileSize);
+	// Start at the last known shipped position, read as many bytes as possible up to the max buffer size (or the adaptive size for new payloads), and capture log lines into a JSON payload
+	OutRemainingBytes = FileSize - OutEffectiveShippedLogOffset;
+	const int ReadLimit = MaxReadLen > 0 ? WorkerMaxReadLen : WorkerGetNewPayloadReadLimit();
+	OutNumToRead = (int)(FMath::Clamp<int64>(OutRemainingBytes, 0, (int64)ReadLimit));
+	if (MaxReadLen > 0 && OutNumToRead > MaxReadLen)
+	{
+		// Retried requests always use the same max payload size as last time,
+		// so that any retry has the same data as last time and can be deduplicated in worst-case scenarios.
+		// (e.g., an actual observed scenario where Unreal Engine HTTP plugin was sending requests successfully
+		// but was not processing responses properly and instead timing them out...)
+		OutNumToRead = MaxReadLen;
+	}
+	if (OutNumToRead <= 0)
+	{
+		// We've read everything we possibly can already
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|Nothing more can be read|FileSize=%ld|EffectiveShippedLogOffset=%ld"), FileSize, OutEffectiveShippedLogOffset);
+		return true;
+	}
+
+	const uint8* BufferData = WorkerTailReader->Read(OutEffectiveShippedLogOffset, OutNumToRead, WorkerGetReadBuffer(OutNumToRead));
+	if (BufferData == nullptr)
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to read data: offset=%ld, bytes=%ld, logfile='%s'"), OutEffectiveShippedLogOffset, OutNumToRead, *SourceLogFile);
+		return false;
+	}
+#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|read data into buffer|offset=%ld|data_len=%d|data=%s|logfile='%s'"), OutEffectiveShippedLogOffset, OutNumToRead, *ITLConvertUTF8(BufferData, OutNumToRead), *SourceLogFile);
+#else
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|read data into buffer|offset=%ld|data_len=%d|logfile='%s'"), OutEffectiveShippedLogOffset, OutNumToRead, *SourceLogFile);
+#endif
+	WorkerReadData = BufferData;
+	return true;
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerBuildNextPayload(int NumToRead, int& OutCapturedOffset, int& OutNumCapturedLines)
+{
+	return WorkerBuildPayload(WorkerBuild, WorkerReadData, NumToRead, OutCapturedOffset, OutNumCapturedLines);
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerBuildPayload(FWorkerPayloadBuild& Build, const uint8* BufferData, int NumToRead, int& OutCapturedOffset, int& OutNumCapturedLines)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerBuildNextPayload);
+	ITL_TRACE_SCOPE(SparkLogs_WorkerBuildPayload);
+	const double StartTime = FPlatformTime::Seconds();
+	OutCapturedOffset = 0;
+	OutNumCapturedLines = 0;
+	Build.Payload.Reset();
+	Build.CompressSecs = 0.0;
+	// Block-by-block compression consumes the JSON payload, so it is compressed all at once if the payload processor needs it too
+	const bool StreamingCompression = Settings->CompressionMode == ITLCompressionMode::LZ4Frame && !KeepUncompressedPayload;
+	if (StreamingCompression)
+	{
+		// Each block is compressed as soon as it is complete, so the JSON buffer only has to stage about one block at a time.
+		if (!Build.FrameCompressor.IsValid())
+		{
+			Build.FrameCompressor = MakeUnique<FITLLZ4FrameCompressor>();
+		}
+		Build.Payload.Reserve(FMath::Min(WorkerGetPayloadReserve(NumToRead), 2 * FITLLZ4FrameCompressor::BlockSize));
+		Build.EncodedPayload.Reserve(WorkerGetPayloadReserve(NumToRead));
+		Build.FrameCompressor->BeginFrame(Build.EncodedPayload);
+	}
+	else
+	{
+		// If the last payload buffer was handed off to the payload processor, this allocates a new one (only once per payload)
+		Build.Payload.Reserve(WorkerGetPayloadReserve(NumToRead));
+	}
+	// The override (restored after a crash) takes precedence so that re-sent events keep the metadata of the session that logged them
+	const TArray<uint8>& CommonJSON = (WorkerOverrideCommonEventJSONData.Num() > 0) ? WorkerOverrideCommonEventJSONData : CommonEventJSONData;
+	Build.IsEnvelope = CommonJSON.Num() > 0 && WorkerPayloadsUseEnvelope;
+	if (Build.IsEnvelope)
+	{
+		// Send the common event JSON once, and the destination merges it into every event
+		Build.Payload.Append("{\"common\":{");
+		Build.Payload.Append((const ANSICHAR*)(CommonJSON.GetData()), CommonJSON.Num());
+		Build.Payload.Append("},\"events\":[");
+	}
+	else
+	{
+		Build.Payload.Append("[");
+	}
+	const bool BinaryRecords = WorkerReadingBinaryRecords;
+	if (BinaryRecords && !WorkerAppendBinaryRecords(Build, CommonJSON, BufferData, NumToRead, OutCapturedOffset, OutNumCapturedLines))
+	{
+		return false;
+	}
+	int NextOffset = 0;
+	while (!BinaryRecords && NextOffset < NumToRead)
+	{
+		// Skip the UTF-8 byte order marker (always at the start of the file). Never look past the end of the data, which may be the end of a mapped file.
+		if (NumToRead - NextOffset >= (int)sizeof(UTF8ByteOrderMark) && 0 == std::memcmp(BufferData + NextOffset, UTF8ByteOrderMark, sizeof(UTF8ByteOrderMark)))
+		{
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|skipping UTF8 BOM|offset_before=%d|offset_after=%d"), NextOffset, NextOffset + sizeof(UTF8ByteOrderMark));
+			NextOffset += sizeof(UTF8ByteOrderMark);
+			OutCapturedOffset = NextOffset;
+			continue;
+		}
+		// We only process whole lines. See if we can find the next end of line character.
+		int RemainingBytes = NumToRead - NextOffset;
+		int NumToSearch = FMath::Min(RemainingBytes, MaxLineLength);
+		int FoundIndex = 0;
+		int ExtraToSkip = 1; // skip over the \n char
+		bool HaveLine = ITLFindFirstByte(BufferData + NextOffset, static_cast<uint8>('\n'), NumToSearch, FoundIndex);
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|after newline search|NextOffset=%d|HaveLine=%d|NumToSearch=%d|FoundIndex=%d"), NextOffset, (int)HaveLine, NumToSearch, FoundIndex);
+		if (!HaveLine && NumToSearch == MaxLineLength && RemainingBytes > NumToSearch)
+		{
+			// Even though we didn't find a line, break the line at the max length and process it
+			// It's unsafe to break a line in the middle of a multi-byte UTF-8, so find a safe break point...
+			ExtraToSkip = 0;
+			FoundIndex = MaxLineLength - 1;
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|no newline found, search for safe breakpoint|NextOffset=%d|FoundIndex=%d"), NextOffset, FoundIndex);
+			while (FoundIndex > 0)
+			{
+				if (*(BufferData + NextOffset + FoundIndex) >= 0x80)
+				{
+					FoundIndex--;
+				}
+				else
+				{
+					// include this non-multi-byte character and break here
+					FoundIndex++;
+					break;
+				}
+			}
+			HaveLine = true;
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|found safe breakpoint|NextOffset=%d|FoundIndex=%d|ExtraToSkip=%d"), NextOffset, FoundIndex, ExtraToSkip);
+		}
+		if (!HaveLine)
+		{
+			// No more complete lines to process, this is enough for now
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|no more lines to process, break"));
+			break;
+		}
+		// Trim newlines control characters of any kind at the end
+		while (FoundIndex > 0)
+		{
+			// We expect the FoundIndex to be the *first* non-newline character, and ExtraToSkip set to the number of newline chars to skip.
+			// Check if the previous character is a newline character, and if so, skip capturing it.
+			uint8 c = *(BufferData + NextOffset + FoundIndex - 1);
+			if (c == '\n' || c == '\r' || c == CharInternalNewline)
+			{
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|character at NextOffset=%d, FoundIndex=%d is newline, will skip it"), NextOffset, FoundIndex);
+				ExtraToSkip++;
+				FoundIndex--;
+			}
+			else
+			{
+				break;
+			}
+		}
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|line summary|NextOffset=%d|FoundIndex=%d|ExtraToSkip=%d"), NextOffset, FoundIndex, ExtraToSkip);
+		// Skip blank lines without capturing anything
+		if (FoundIndex <= 0)
+		{
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|skipping blank line..."));
+			if (ExtraToSkip <= 0)
+			{
+				ExtraToSkip = 1;
+			}
+			NextOffset += ExtraToSkip;
+			OutCapturedOffset = NextOffset;
+			continue;
+		}
+		// Capture the data from (BufferData + NextOffset) to (BufferData + NextOffset + FoundIndex)
+		// NOTE: the data in the logfile was already written in UTF-8 format
+		if (OutNumCapturedLines > 0)
+		{
+			Build.Payload.Append(",");
+		}
+		Build.Payload.Append("{");
+		if (!Build.IsEnvelope && CommonJSON.Num() > 0)
+		{
+			Build.Payload.Append((const ANSICHAR*)(CommonJSON.GetData()), CommonJSON.Num());
+			Build.Payload.Append(",");
+		}
+		// If we have raw JSON in the payload extract that portion and append it, setting up just the message text to remain for appending...
+		if (FoundIndex > 2 && *(BufferData + NextOffset) == CharInternalJSONStart)
+		{
+			int FoundJSONEndIndex = 0;
+			if (ITLFindFirstByte(BufferData + NextOffset + 1, CharInternalJSONEnd, FoundIndex - 1, FoundJSONEndIndex))
+			{
+				Build.Payload.Append((const ANSICHAR*)(BufferData + NextOffset + 1), FoundJSONEndIndex);
+				if (FoundJSONEndIndex > 0)
+				{
+					Build.Payload.Append(",");
+				}
+				NextOffset += (FoundJSONEndIndex + 2);
+				FoundIndex -= (FoundJSONEndIndex + 2);
+			}
+		}
+		Build.Payload.Append("\"message\":", 10 /* length of `"message":` */);
+		ITLAppendUTF8AsEscapedJsonString(Build.Payload, (const ANSICHAR*)(BufferData + NextOffset), FoundIndex);
+#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|adding message to payload: %s"), *ITLConvertUTF8(BufferData + NextOffset, FoundIndex));
+#endif
+		Build.Payload.Append("}");
+		OutNumCapturedLines++;
+		NextOffset += FoundIndex + ExtraToSkip;
+		OutCapturedOffset = NextOffset;
+		if (StreamingCompression && Build.Payload.Len() >= FITLLZ4FrameCompressor::BlockSize)
+		{
+			// Overlap compression with building the rest of the payload while the staged data is still hot in cache
+			if (!WorkerCompressCompletedFrameBlocks(Build, false))
+			{
+				return false;
+			}
+		}
+	}
+	Build.Payload.Append(Build.IsEnvelope ? "]}" : "]");
+	// Blocks compressed while building are counted as compression time instead
+	const double BuildSecs = FMath::Max(0.0, FPlatformTime::Seconds() - StartTime - Build.CompressSecs);
+	LastPayloadBuildSecs.store(BuildSecs);
+	SET_FLOAT_STAT(STAT_SparkLogsPayloadBuildTimeMs, BuildSecs * 1000.0);
+	return true;
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerAppendBinaryRecords(FWorkerPayloadBuild& Build, const TArray<uint8>& CommonJSON, const uint8* BufferData, int NumToRead, int& OutCapturedOffset, int& OutNumCapturedLines)
+{
+	const bool StreamingCompression = Settings->CompressionMode == ITLCompressionMode::LZ4Frame && !KeepUncompressedPayload;
+	int NextOffset = 0;
+	while (NextOffset < NumToRead)
+	{
+		const int RemainingBytes = NumToRead - NextOffset;
+		// A signature starts the file and follows every time the device reopens it
+		if (RemainingBytes >= (int)sizeof(ITLBinaryRecordSignature) && 0 == std::memcmp(BufferData + NextOffset, ITLBinaryRecordSignature, sizeof(ITLBinaryRecordSignature)))
+		{
+			NextOffset += sizeof(ITLBinaryRecordSignature);
+			OutCapturedOffset = NextOffset;
+			continue;
+		}
+		FITLBinaryRecordHeader Header;
+		if (RemainingBytes < (int)sizeof(Header))
+		{
+			break;
+		}
+		if (!ITLReadBinaryRecordHeader(BufferData + NextOffset, Header))
+		{
+			// Skip ahead to the next record rather than stall on it. Whatever follows the damage is shipped as usual.
+			const int ResumeOffset = ITLResyncBinaryRecords(BufferData, NumToRead, NextOffset);
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Found a damaged binary record, skipping to the next record: offset_in_read=%d, skipped_bytes=%d, logfile='%s'"), NextOffset, ResumeOffset - NextOffset, *SourceLogFile);
+			NextOffset = ResumeOffset;
+			OutCapturedOffset = NextOffset;
+			continue;
+		}
+		const int RecordLen = (int)(sizeof(Header) + Header.Length);
+		if (RecordLen > RemainingBytes)
+		{
+			// The rest of the record has not been read (or written) yet
+			break;
+		}
+		if (OutNumCapturedLines > 0)
+		{
+			Build.Payload.Append(",");
+		}
+		Build.Payload.Append("{");
+		if (!Build.IsEnvelope && CommonJSON.Num() > 0)
+		{
+			Build.Payload.Append((const ANSICHAR*)(CommonJSON.GetData()), CommonJSON.Num());
+			Build.Payload.Append(",");
+		}
+		// The record already holds the fields of the event exactly as they appear in the payload
+		Build.Payload.Append((const ANSICHAR*)(BufferData + NextOffset + sizeof(Header)), Header.Length);
+		Build.Payload.Append("}");
+		OutNumCapturedLines++;
+		NextOffset += RecordLen;
+		OutCapturedOffset = NextOffset;
+		if (StreamingCompression && Build.Payload.Len() >= FITLLZ4FrameCompressor::BlockSize)
+		{
+			if (!WorkerCompressCompletedFrameBlocks(Build, false))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerUpdateRecordFormat(int64 FileSize)
+{
+	if (WorkerRecordFormatPath == WorkerTailReader->GetPath())
+	{
+		return;
+	}
+	WorkerReadingBinaryRecords = false;
+	if (FileSize < (int64)sizeof(ITLBinaryRecordSignature))
+	{
+		// Decided once the file has enough data. Until then it is read as text, which never captures a signature since it has no newline.
+		return;
+	}
+	uint8 Start[sizeof(ITLBinaryRecordSignature)];
+	const uint8* Data = WorkerTailReader->Read(0, (int32)sizeof(Start), Start);
+	if (Data == nullptr)
+	{
+		return;
+	}
+	WorkerReadingBinaryRecords = 0 == std::memcmp(Data, ITLBinaryRecordSignature, sizeof(ITLBinaryRecordSignature));
+	WorkerRecordFormatPath = WorkerTailReader->GetPath();
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerUpdateRecordFormat|detected format|binary_records=%d|logfile='%s'"), (int)WorkerReadingBinaryRecords, *WorkerRecordFormatPath);
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerCompressPayload()
+{
+	return WorkerCompressPayload(WorkerBuild);
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerCompressPayload(FWorkerPayloadBuild& Build)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerCompressPayload);
+	ITL_TRACE_SCOPE(SparkLogs_WorkerCompressPayload);
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerCompressPayload|Begin compressing payload"));
+	Build.OriginalPayloadLen = Build.Payload.Len();
+	bool Success = true;
+	double StartTime = FPlatformTime::Seconds();
+	if (Settings->CompressionMode == ITLCompressionMode::LZ4Frame && Build.FrameCompressor.IsValid())
+	{
+		// Most of the payload was already compressed while it was being built, only the tail remains.
+		Success = WorkerCompressCompletedFrameBlocks(Build, true);
+		if (Success)
+		{
+			Build.FrameCompressor->EndFrame(Build.EncodedPayload);
+		}
+		Build.OriginalPayloadLen = (int)Build.FrameCompressor->GetFrameInputLen();
+	}
+	else if (Settings->CompressionMode == ITLCompressionMode::None)
+	{
+		// The JSON payload already is the encoded payload. Swap buffers instead of copying, which also recycles the old encoded buffer for the next JSON payload.
+		Swap(Build.EncodedPayload, Build.Payload.GetArray());
+	}
+	else if (Settings->CompressionMode == ITLCompressionMode::Gzip)
+	{
+		if (!Build.GzipCompressor.IsValid())
+		{
+			Build.GzipCompressor = MakeUnique<FITLGzipCompressor>();
+		}
+		Success = Build.GzipCompressor->Compress((const uint8*)Build.Payload.GetData(), Build.Payload.Len(), Build.EncodedPayload);
+	}
+	else
+	{
+		Success = ITLCompressData(Settings->CompressionMode, (const uint8*)Build.Payload.GetData(), Build.Payload.Len(), Build.EncodedPayload);
+	}
+	Build.CompressSecs += FPlatformTime::Seconds() - StartTime;
+	if (Success && Build.EncodedPayload.Num() > 0)
+	{
+		double Ratio = (double)Build.OriginalPayloadLen / (double)Build.EncodedPayload.Num();
+		LastPayloadCompressionRatio.store(Ratio);
+		LastPayloadCompressSecs.store(Build.CompressSecs);
+		SET_FLOAT_STAT(STAT_SparkLogsPayloadCompressionRatio, Ratio);
+		SET_FLOAT_STAT(STAT_SparkLogsPayloadCompressTimeMs, Build.CompressSecs * 1000.0);
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerCompressPayload|Finish compressing payload|success=%d|original_len=%d|compressed_len=%d|compress_secs=%.6lf"), Success ? 1 : 0, Build.OriginalPayloadLen, (int)Build.EncodedPayload.Num(), Build.CompressSecs);
+	return Success;
+}
+
+TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> FsparklogsReadAndStreamToCloud::WorkerBeginProcessPayload(FWorkerPayloadBuild& Build, int64 StartOffset, int CapturedOffset)
+{
+	WorkerNextPayloadIsEnvelope = Build.IsEnvelope;
+	WorkerNextPayloadStartOffset = StartOffset;
+	WorkerNextPayloadEndOffset = StartOffset + CapturedOffset;
+	if (!KeepUncompressedPayload)
+	{
+		return PayloadProcessor->BeginProcessPayload(Build.EncodedPayload, Build.EncodedPayload.Num(), Build.OriginalPayloadLen, Settings->CompressionMode, WeakThisPtr);
+	}
+	// With no compression the encoded payload is the JSON payload (they were swapped), otherwise the JSON buffer still holds it
+	TArray<uint8>* UncompressedPayload = (Settings->CompressionMode == ITLCompressionMode::None) ? nullptr : &Build.Payload.GetArray();
+	return PayloadProcessor->BeginProcessPayloadWithUncompressed(Build.EncodedPayload, Build.EncodedPayload.Num(), Build.OriginalPayloadLen, Settings->CompressionMode, UncompressedPayload, WeakThisPtr);
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerMirrorPayload(FWorkerPayloadBuild& Build, int64 StartOffset, int CapturedOffset)
+{
+	WorkerNextPayloadIsEnvelope = Build.IsEnvelope;
+	WorkerNextPayloadStartOffset = StartOffset;
+	WorkerNextPayloadEndOffset = StartOffset + CapturedOffset;
+	TArray<uint8>* UncompressedPayload = (!KeepUncompressedPayload || Settings->CompressionMode == ITLCompressionMode::None) ? nullptr : &Build.Payload.GetArray();
+	PayloadProcessor->MirrorPayload(Build.EncodedPayload, Build.EncodedPayload.Num(), Build.OriginalPayloadLen, Settings->CompressionMode, UncompressedPayload, WeakThisPtr);
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerMirrorAhead()
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerMirrorAhead);
+	// The payloads that follow restored metadata must not be built until the retries that use it are acknowledged
+	if (MirrorCursors.Num() <= 0 || WorkerLastFailedFlushPayloadSize <= 0 || WorkerMirrorAheadOffset < 0 || WorkerOverrideCommonEventJSONData.Num() > 0)
+	{
+		return;
+	}
+	while (StopRequestCounter.GetValue() == 0 && WorkerPendingRetryPayloadSizes.Num() < FsparklogsProgressJournal::MaxFollowingReadLens
+		&& WorkerMirrorAheadOffset - WorkerShippedLogOffset < (int64)Settings->MirrorMaxLagBytes)
+	{
+		int NumToRead = 0;
+		int64 StartOffset = 0, RemainingBytes = 0;
+		// Never moves on to the next segment of a spooled logfile, or starts over, while the retries are not acknowledged
+		if (!WorkerReadNextPayload(WorkerMirrorAheadOffset, 0, NumToRead, StartOffset, RemainingBytes) || StartOffset != WorkerMirrorAheadOffset || NumToRead <= 0)
+		{
+			break;
+		}
+		int CapturedOffset = 0;
+		int NumCapturedLines = 0;
+		if (!WorkerBuildNextPayload(NumToRead, CapturedOffset, NumCapturedLines) || CapturedOffset <= 0)
+		{
+			break;
+		}
+		if (NumCapturedLines > 0 && !WorkerCompressPayload())
+		{
+			break;
+		}
+		// Recorded before the mirrors get it, so that the destination later gets exactly the same payload even after a crash
+		WorkerPendingRetryPayloadSizes.Add(NumToRead);
+		TArray<int> RetryReadLens;
+		RetryReadLens.Add(WorkerLastFailedFlushPayloadSize);
+		RetryReadLens.Append(WorkerPendingRetryPayloadSizes);
+		WorkerWritePipelinedProgressMarker(WorkerShippedLogOffset, RetryReadLens, nullptr);
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerMirrorAhead|payload is ready to mirror|offset=%ld|num_read=%d|payload_input_size=%d|captured_lines=%d|pending_retries=%d"), StartOffset, NumToRead, CapturedOffset, NumCapturedLines, (int)WorkerPendingRetryPayloadSizes.Num());
+		if (NumCapturedLines > 0)
+		{
+			WorkerMirrorPayload(WorkerBuild, StartOffset, CapturedOffset);
+		}
+		WorkerMirrorAheadOffset = StartOffset + CapturedOffset;
+	}
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerResumeMirrors()
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerResumeMirrors);
+	WorkerMirrorsResumed = true;
+	for (const TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>& Cursor : MirrorCursors)
+	{
+		const int64 Offset = Cursor->GetQueuedOffset();
+		// Ahead is only possible for payloads that are still to be retried, otherwise the progress was reset since
+		const bool Stale = Offset > WorkerShippedLogOffset && WorkerLastFailedFlushPayloadSize <= 0;
+		if (Stale || WorkerShippedLogOffset - Offset > (int64)Settings->MirrorMaxLagBytes)
+		{
+			if (!Stale)
+			{
+				UE_LOG(LogPluginSparkLogs, Log, TEXT("STREAMER: Mirror is too far behind to resend what it missed, skipping it: mirror_offset=%lld, shipped_offset=%lld, logfile='%s'"), Offset, WorkerShippedLogOffset, *SourceLogFile);
+			}
+			Cursor->Reset(WorkerShippedLogOffset);
+		}
+	}
+	while (StopRequestCounter.GetValue() == 0)
+	{
+		// Resend from where the mirror that is furthest behind left off, up to where the next one left off, so every payload goes to as many mirrors as possible
+		int64 From = WorkerShippedLogOffset;
+		for (const TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>& Cursor : MirrorCursors)
+		{
+			From = FMath::Min(From, Cursor->GetQueuedOffset());
+		}
+		if (From >= WorkerShippedLogOffset)
+		{
+			break;
+		}
+		int64 Limit = WorkerShippedLogOffset;
+		for (const TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>& Cursor : MirrorCursors)
+		{
+			if (Cursor->GetQueuedOffset() > From)
+			{
+				Limit = FMath::Min(Limit, Cursor->GetQueuedOffset());
+			}
+		}
+		int NumToRead = 0;
+		int64 StartOffset = 0, RemainingBytes = 0;
+		if (!WorkerReadNextPayload(From, 0, NumToRead, StartOffset, RemainingBytes) || StartOffset != From || NumToRead <= 0)
+		{
+			break;
+		}
+		NumToRead = (int)FMath::Min<int64>(NumToRead, Limit - From);
+		int CapturedOffset = 0;
+		int NumCapturedLines = 0;
+		if (!WorkerBuildNextPayload(NumToRead, CapturedOffset, NumCapturedLines) || CapturedOffset <= 0)
+		{
+			break;
+		}
+		if (NumCapturedLines > 0 && !WorkerCompressPayload())
+		{
+			break;
+		}
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerResumeMirrors|payload is ready to mirror|offset=%ld|num_read=%d|payload_input_size=%d|captured_lines=%d"), StartOffset, NumToRead, CapturedOffset, NumCapturedLines);
+		if (NumCapturedLines > 0)
+		{
+			WorkerMirrorPayload(WorkerBuild, StartOffset, CapturedOffset);
+		}
+		else
+		{
+			// Nothing to deliver, but the mirrors that are this far behind have it now
+			for (const TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>& Cursor : MirrorCursors)
+			{
+				if (Cursor->GetQueuedOffset() == From)
+				{
+					Cursor->Reset(From + CapturedOffset);
+				}
+			}
+		}
+	}
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerRestartMirrors()
+{
+	if (MirrorCursors.Num() > 0)
+	{
+		PayloadProcessor->RestartMirrors(MirrorCursors);
+	}
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerCompressCompletedFrameBlocks(FWorkerPayloadBuild& Build, bool bFinal)
+{
+	TArray<uint8>& Staged = Build.Payload.GetArray();
+	double StartTime = FPlatformTime::Seconds();
+	int Offset = 0;
+	while (Staged.Num() - Offset >= FITLLZ4FrameCompressor::BlockSize || (bFinal && Offset < Staged.Num()))
+	{
+		int BlockLen = FMath::Min(FITLLZ4FrameCompressor::BlockSize, Staged.Num() - Offset);
+		if (!Build.FrameCompressor->CompressBlock(Staged.GetData() + Offset, BlockLen, Build.EncodedPayload))
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Failed to compress LZ4 frame block: block_len=%d, frame_input_len=%lld"), BlockLen, Build.FrameCompressor->GetFrameInputLen());
+			return false;
+		}
+		Offset += BlockLen;
+	}
+	if (Offset > 0)
+	{
+#if (ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 4))
+		Staged.RemoveAt(0, Offset, EAllowShrinking::No);
+#else
+		Staged.RemoveAt(0, Offset, false);
+#endif
+	}
+	if (!bFinal)
+	{
+		// The final blocks are timed by WorkerCompressPayload
+		Build.CompressSecs += FPlatformTime::Seconds() - StartTime;
+	}
+	return true;
+}
+
+int64 FsparklogsReadAndStreamToCloud::WorkerDropExcessBacklog()
+{
+	if (Lane != ITLStreamLane::Logs || Settings->MaxLogBacklogBytes <= 0 || WorkerLastFailedFlushPayloadSize > 0 || WorkerPendingRetryPayloadSizes.Num() > 0)
+	{
+		// Retried payloads must be sent exactly as they were before, so only drop data that was never attempted
+		return 0;
+	}
+	int64 FileSize = 0;
+	if (WorkerTailReader->Refresh(FileSize) != FsparklogsTailReader::EStatus::Ready || WorkerShippedLogOffset > FileSize)
+	{
+		return 0;
+	}
+	const int64 BacklogBytes = FileSize - WorkerShippedLogOffset;
+	if (BacklogBytes <= (int64)Settings->MaxLogBacklogBytes)
+	{
+		return 0;
+	}
+	WorkerUpdateRecordFormat(FileSize);
+	const int64 CutOffset = FileSize - Settings->MaxLogBacklogBytes;
+	int64 NewOffset = WorkerShippedLogOffset;
+	if (WorkerReadingBinaryRecords)
+	{
+		// Records can only be found by walking their headers from a known boundary. Keep the newest data, starting with the last record before the cut point.
+		while (NewOffset < CutOffset)
+		{
+			const int ReadLen = (int)FMath::Min<int64>(FileSize - NewOffset, (int64)WorkerMaxReadLen);
+			const uint8* Data = WorkerTailReader->Read(NewOffset, ReadLen, WorkerGetReadBuffer(ReadLen));
+			if (Data == nullptr)
+			{
+				break;
+			}
+			const int MaxSkipLen = (int)FMath::Min<int64>((int64)ReadLen, CutOffset - NewOffset);
+			int SkipLen = ITLMeasureBinaryRecords(Data, ReadLen, MaxSkipLen);
+			if (SkipLen < MaxSkipLen && ReadLen - SkipLen >= (int)sizeof(FITLBinaryRecordHeader) && ITLIsDamagedBinaryRecord(Data + SkipLen))
+			{
+				// Walk past the damage to the next record (possibly past the cut point, since only damaged data is skipped)
+				SkipLen = ITLResyncBinaryRecords(Data, ReadLen, SkipLen);
+			}
+			if (SkipLen <= 0)
+			{
+				break;
+			}
+			NewOffset += SkipLen;
+		}
+	}
+	else
+	{
+		// Keep the newest data, starting with the first whole line after the cut point
+		const int SearchLen = (int)FMath::Min<int64>((int64)Settings->MaxLogBacklogBytes, (int64)WorkerMaxReadLen);
+		const uint8* Data = WorkerTailReader->Read(CutOffset, SearchLen, WorkerGetReadBuffer(SearchLen));
+		int FoundIndex = 0;
+		if (Data == nullptr || !ITLFindFirstByte(Data, static_cast<uint8>('\n'), SearchLen, FoundIndex))
+		{
+			return 0;
+		}
+		NewOffset = CutOffset + FoundIndex + 1;
+	}
+	if (NewOffset <= WorkerShippedLogOffset)
+	{
+		return 0;
+	}
+	const int64 Dropped = NewOffset - WorkerShippedLogOffset;
+	UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Log backlog is larger than MaxLogBacklogBytes, dropping the oldest logs: dropped_bytes=%lld, backlog_bytes=%lld, max_backlog_bytes=%d, logfile='%s'"), Dropped, BacklogBytes, Settings->MaxLogBacklogBytes, *SourceLogFile);
+	DroppedBacklogBytes.fetch_add(Dropped);
+	WorkerShippedLogOffset = NewOffset;
+	// Record the state along with the new offset if it changed since it was last written, the same as after a successful flush
+	const bool AllowWriteState = WorkerIsAllowedSerializeProgressState() && WorkerOverrideCommonEventJSONData.Num() <= 0;
+	if (WriteProgressMarker(WorkerShippedLogOffset, 0, AllowWriteState ? &CommonEventJSONData : nullptr) && AllowWriteState)
+	{
+		WorkerSerializeCommonEventJSON = false;
+	}
+	return Dropped;
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerAdvanceSpool(int64& InOutStartOffset)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerAdvanceSpool);
+	int64 FileSize = 0;
+	const bool AtEnd = WorkerTailReader->Refresh(FileSize) != FsparklogsTailReader::EStatus::Ready || InOutStartOffset >= FileSize;
+	const double Now = FPlatformTime::Seconds();
+	if (!AtEnd && Now < WorkerNextSpoolScanPlatformTime)
+	{
+		// Still shipping the current segment, which is all that matters until its end
+		return true;
+	}
+	WorkerNextSpoolScanPlatformTime = Now + FsparklogsSpool::ScanIntervalSecs;
+	TArray<FsparklogsSpool::FSegment> Segments;
+	FsparklogsSpool::FindSegments(SourceLogFile, Segments);
+	// Progress is always recorded against the oldest segment. Every segment but the newest is sealed (the device closes a segment before starting the next).
+	while (Segments.Num() > 0)
+	{
+		if (WorkerTailReader->GetPath() != Segments[0].Path)
+		{
+			WorkerTailReader = MakeUnique<FsparklogsTailReader>(Segments[0].Path, Settings->MapSourceLogFile);
+		}
+		if (Segments.Num() == 1 || WorkerTailReader->Refresh(FileSize) != FsparklogsTailReader::EStatus::Ready || InOutStartOffset < FileSize)
+		{
+			break;
+		}
+		if (InOutStartOffset != WorkerShippedLogOffset || WorkerLastFailedFlushPayloadSize > 0 || WorkerPendingRetryPayloadSizes.Num() > 0)
+		{
+			return false;
+		}
+		// Record that the next segment starts from the beginning before deleting this one, so that a crash in between at worst ships it again
+		WriteProgressMarker(0, 0, nullptr);
+		WorkerTailReader->Close();
+		if (!FsparklogsSpool::PurgeSegment(Segments[0]))
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to delete shipped logfile segment: segment='%s'"), *Segments[0].Path);
+			WriteProgressMarker(InOutStartOffset, 0, nullptr);
+			return false;
+		}
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerAdvanceSpool|deleted shipped segment|size=%lld|segment='%s'"), Segments[0].Size, *Segments[0].Path);
+		WorkerShippedLogOffset = 0;
+		InOutStartOffset = 0;
+		WorkerRestartMirrors();
+		Segments.RemoveAt(0);
+	}
+	if (Settings->SpoolMaxDiskBytes > 0)
+	{
+		int64 SpoolBytes = 0;
+		for (const FsparklogsSpool::FSegment& Segment : Segments)
+		{
+			SpoolBytes += Segment.Size;
+		}
+		// Never the segment being shipped or the one being written, and never one that holds analytics events
+		for (int i = 1; i < Segments.Num() - 1 && SpoolBytes > (int64)Settings->SpoolMaxDiskBytes; )
+		{
+			if (Segments[i].Protected || !FsparklogsSpool::PurgeSegment(Segments[i]))
+			{
+				i++;
+				continue;
+			}
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Logfile segments use more than SpoolMaxDiskBytes, dropped the oldest unshipped segment: dropped_bytes=%lld, spool_bytes=%lld, max_disk_bytes=%d, segment='%s'"), Segments[i].Size, SpoolBytes, Settings->SpoolMaxDiskBytes, *Segments[i].Path);
+			DroppedBacklogBytes.fetch_add(Segments[i].Size);
+			SpoolBytes -= Segments[i].Size;
+			Segments.RemoveAt(i);
+		}
+	}
+	WorkerSpoolBacklogBytes = 0;
+	for (int i = 1; i < Segments.Num(); i++)
+	{
+		WorkerSpoolBacklogBytes += Segments[i].Size;
+	}
+	return true;
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerInternalDoFlush(int64& OutNewShippedLogOffset, bool& OutFlushProcessedEverything)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerInternalDoFlush);
+	WorkerDropExcessBacklog();
+	if (WorkerLastFailedFlushPayloadSize <= 0 && WorkerPendingRetryPayloadSizes.Num() <= 0)
+	{
+		// Nothing has to be retried, so new payloads can switch to the format the payload processor accepts now. It can change
+		// while payloads of this flush are in flight, which is why it is only checked here.
+		WorkerPayloadsUseEnvelope = PayloadProcessor->AcceptsCommonMetadataEnvelope();
+	}
+	if (!WorkerMirrorsResumed && MirrorCursors.Num() > 0)
+	{
+		WorkerResumeMirrors();
+	}
+	if (Settings->MaxInFlightRequests > 1 || WorkerPendingRetryPayloadSizes.Num() > 0 || WorkerShouldCatchUp(WorkerShippedLogOffset))
+	{
+		// Pipelined requests also have to be retried the same way they were originally sent, even if pipelining was since disabled.
+		// A large backlog is also sent this way, since its payloads are prepared several at a time.
+		return WorkerInternalDoPipelinedFlush(OutNewShippedLogOffset, OutFlushProcessedEverything);
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|BEGIN"));
+	OutNewShippedLogOffset = WorkerShippedLogOffset;
+	OutFlushProcessedEverything = false;
+	LastFlushPlatformTime.store(FPlatformTime::Seconds());
+	BytesQueuedSinceLastFlush.store(0);
+	
+	int NumToRead = 0;
+	int64 EffectiveShippedLogOffset = WorkerShippedLogOffset, RemainingBytes;
+	if (!WorkerReadNextPayload(WorkerShippedLogOffset, WorkerLastFailedFlushPayloadSize, NumToRead, EffectiveShippedLogOffset, RemainingBytes))
+	{
+		return false;
+	}
+	if (NumToRead <= 0)
+	{
+		// nothing more to read (moving on to the next segment of a spooled logfile resets the shipped offset)
+		OutNewShippedLogOffset = WorkerShippedLogOffset;
+		OutFlushProcessedEverything = true;
+		return true;
 	}
 	
 	int CapturedOffset = 0;
 	int NumCapturedLines = 0;
 	if (!WorkerBuildNextPayload(NumToRead, CapturedOffset, NumCapturedLines))
 	{
-		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to build payload: offset=%ld, payload_input_size=%d, logfile='%s'"), EffectiveShippedLogOffset, CapturedOffset, *SourceLogFile);
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to build payload: offset=%ld, payload_input_size=%d, logfile='%s'"), EffectiveShippedLogOffset, CapturedOffset, *SourceLogFile);
+		return false;
+	}
+
+#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|payload is ready to process|offset=%ld|payload_input_size=%d|captured_lines=%d|data_len=%d|data=%s|logfile='%s'"),
+		EffectiveShippedLogOffset, CapturedOffset, NumCapturedLines, WorkerBuild.Payload.Len(), *ITLConvertUTF8(WorkerBuild.Payload.GetData(), WorkerBuild.Payload.Len()), *SourceLogFile);
+#else
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|payload is ready to process|offset=%ld|payload_input_size=%d|captured_lines=%d|data_len=%d|logfile='%s'"),
+		EffectiveShippedLogOffset, CapturedOffset, NumCapturedLines, WorkerBuild.Payload.Len(), *SourceLogFile);
+#endif
+	if (NumCapturedLines > 0)
+	{
+		if (!WorkerCompressPayload())
+		{
+			UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER: Failed to compress payload: mode=%d"), (int)Settings->CompressionMode);
+			return false;
+		}
+		// Remember that we have a request being attempted (including the size of the read request). This state will be cleared out after a successful request.
+		// We are allowed to write the progress state here if we do not have an overridden state that we are using and we otherwise need to.
+		bool AllowWriteState = WorkerIsAllowedSerializeProgressState() && WorkerOverrideCommonEventJSONData.Num() <= 0;
+		if (WriteProgressMarker(EffectiveShippedLogOffset, NumToRead, AllowWriteState ? &CommonEventJSONData : nullptr, nullptr, WorkerPayloadsUseEnvelope) && AllowWriteState)
+		{
+			WorkerSerializeCommonEventJSON = false;
+		}
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|Begin processing payload"));
+		WorkerRecordWakeToSend();
+		TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending = WorkerBeginProcessPayload(WorkerBuild, EffectiveShippedLogOffset, CapturedOffset);
+		bool Succeeded = PayloadProcessor->FinishProcessPayload(Pending, WeakThisPtr);
+		WorkerRecordPayloadResult(*Pending, Succeeded);
+		if (!Succeeded)
+		{
+			UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER: Failed to process payload: offset=%ld, num_read=%d, payload_input_size=%d, logfile='%s'"), EffectiveShippedLogOffset, NumToRead, CapturedOffset, *SourceLogFile);
+			WorkerLastFailedFlushPayloadSize = NumToRead;
+			WorkerMirrorAheadOffset = EffectiveShippedLogOffset + CapturedOffset;
+			return false;
+		}
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|Finished processing payload|PayloadInputSize=%ld"), CapturedOffset);
+	}
+	int ProcessedOffset = CapturedOffset;
+
+	// If we processed everything up until the end of the file, we captured everything we can.
+	OutNewShippedLogOffset = EffectiveShippedLogOffset + ProcessedOffset;
+	if ((int64)(ProcessedOffset) >= RemainingBytes)
+	{
+		OutFlushProcessedEverything = true;
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|END|FlushProcessedEverything=%d"), OutFlushProcessedEverything);
+	return true;
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerInternalDoPipelinedFlush(int64& OutNewShippedLogOffset, bool& OutFlushProcessedEverything)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerInternalDoPipelinedFlush);
+	const int MaxInFlight = FMath::Max(1, Settings->MaxInFlightRequests);
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoPipelinedFlush|BEGIN|MaxInFlight=%d|WorkerLastFailedFlushPayloadSize=%d|WorkerPendingRetryPayloads=%d"), MaxInFlight, WorkerLastFailedFlushPayloadSize, (int)WorkerPendingRetryPayloadSizes.Num());
+	OutNewShippedLogOffset = WorkerShippedLogOffset;
+	OutFlushProcessedEverything = false;
+	LastFlushPlatformTime.store(FPlatformTime::Seconds());
+	BytesQueuedSinceLastFlush.store(0);
+
+	// Payloads that failed last time must be sent again in the same order with exactly the same read sizes,
+	// so that each retry has the same data as the original attempt and can be deduplicated.
+	TArray<int> RetryReadLens;
+	if (WorkerLastFailedFlushPayloadSize > 0)
+	{
+		RetryReadLens.Add(WorkerLastFailedFlushPayloadSize);
+		RetryReadLens.Append(WorkerPendingRetryPayloadSizes);
+	}
+	int NextRetryIndex = 0;
+	// Read sizes of every payload that has not been acknowledged yet (in flight, and retries not yet sent), oldest first.
+	TArray<int> UnacknowledgedReadLens;
+	auto GetUnacknowledgedReadLens = [this, &RetryReadLens, &NextRetryIndex, &UnacknowledgedReadLens]()
+	{
+		UnacknowledgedReadLens.Reset();
+		for (const FWorkerInFlightPayload& InFlight : WorkerInFlightPayloads)
+		{
+			UnacknowledgedReadLens.Add(InFlight.NumToRead);
+		}
+		for (int i = NextRetryIndex; i < RetryReadLens.Num(); i++)
+		{
+			UnacknowledgedReadLens.Add(RetryReadLens[i]);
+		}
+		return UnacknowledgedReadLens;
+	};
+
+	WorkerInFlightPayloads.Reset();
+	int64 NextReadOffset = WorkerShippedLogOffset;
+	int NumQueued = 0;
+	bool CanQueueMore = true;
+	bool ReadEverything = false;
+	bool Result = true;
+	bool AckFailed = false;
+	bool MarkerStale = false;
+	TArray<int> FailedReadLens;
+	// Payloads of a large backlog that were already built and compressed in parallel, waiting to be sent in order
+	TArray<FWorkerCatchUpPayload> CatchUpPayloads;
+	int NextCatchUpIndex = 0;
+	bool CatchUpDone = false;
+	int64 LastQueuedEndOffset = -1;
+	while (CanQueueMore || WorkerInFlightPayloads.Num() > 0)
+	{
+		// Keep the pipeline full
+		while (CanQueueMore && WorkerInFlightPayloads.Num() < MaxInFlight)
+		{
+			bool IsRetry = NextRetryIndex < RetryReadLens.Num();
+			if (!IsRetry && WorkerOverrideCommonEventJSONData.Num() > 0)
+			{
+				// New data must not use the metadata from the last session. Wait until all of the retried payloads that need it are acknowledged.
+				if (WorkerInFlightPayloads.Num() > 0)
+				{
+					break;
+				}
+				WorkerOverrideCommonEventJSONData.Empty();
+			}
+			if (!IsRetry && StopRequestCounter.GetValue() > 0 && NumQueued >= MaxInFlight)
+			{
+				// Bound the amount of work done while stopping, the rest will ship next session (retries are always sent so their sizes are not lost)
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoPipelinedFlush|stop requested, no longer queueing payloads|NumQueued=%d"), NumQueued);
+				CanQueueMore = false;
+				break;
+			}
+
+			FWorkerInFlightPayload Payload;
+			Payload.NumToRead = 0;
+			Payload.CapturedOffset = 0;
+			Payload.IsRetry = IsRetry;
+			int NumCapturedLines = 0;
+			FWorkerPayloadBuild* SendBuild = &WorkerBuild;
+			if (!IsRetry && !CatchUpDone && (NextCatchUpIndex >= CatchUpPayloads.Num() || CatchUpPayloads[NextCatchUpIndex].StartOffset != NextReadOffset))
+			{
+				// Build and compress the next several payloads at once while there is a large backlog. They are still sent one at a time in order.
+				CatchUpDone = WorkerPrepareCatchUp(NextReadOffset, CatchUpPayloads) <= 0;
+				NextCatchUpIndex = 0;
+			}
+			if (!IsRetry && NextCatchUpIndex < CatchUpPayloads.Num())
+			{
+				const FWorkerCatchUpPayload& CatchUp = CatchUpPayloads[NextCatchUpIndex++];
+				Payload.StartOffset = CatchUp.StartOffset;
+				Payload.NumToRead = CatchUp.NumToRead;
+				Payload.CapturedOffset = CatchUp.CapturedOffset;
+				Payload.RemainingBytes = CatchUp.RemainingBytes;
+				NumCapturedLines = CatchUp.NumCapturedLines;
+				SendBuild = WorkerCatchUpBuilds[CatchUp.BuildIndex].Get();
+				if (!CatchUp.Success)
+				{
+					UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to build or compress payload: offset=%ld, num_read=%d, mode=%d, logfile='%s'"), Payload.StartOffset, Payload.NumToRead, (int)Settings->CompressionMode, *SourceLogFile);
+					Result = false;
+					CanQueueMore = false;
+					break;
+				}
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoPipelinedFlush|catch-up payload is ready to process|offset=%ld|num_read=%d|payload_input_size=%d|captured_lines=%d|data_len=%d|in_flight=%d|logfile='%s'"),
+					Payload.StartOffset, Payload.NumToRead, Payload.CapturedOffset, NumCapturedLines, (int)SendBuild->EncodedPayload.Num(), (int)WorkerInFlightPayloads.Num(), *SourceLogFile);
+			}
+			else
+			{
+				if (!WorkerReadNextPayload(NextReadOffset, IsRetry ? RetryReadLens[NextRetryIndex] : 0, Payload.NumToRead, Payload.StartOffset, Payload.RemainingBytes))
+				{
+					Result = false;
+					CanQueueMore = false;
+					break;
+				}
+				if (Payload.StartOffset != NextReadOffset)
+				{
+					// The logfile was reset and we are starting over, so previous payload sizes no longer apply
+					RetryReadLens.Reset();
+					NextRetryIndex = 0;
+					Payload.IsRetry = false;
+					NextReadOffset = Payload.StartOffset;
+				}
+				if (Payload.NumToRead <= 0)
+				{
+					// nothing more to read
+					ReadEverything = true;
+					CanQueueMore = false;
+					break;
+				}
+
+				if (!WorkerBuildNextPayload(Payload.NumToRead, Payload.CapturedOffset, NumCapturedLines))
+				{
+					UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to build payload: offset=%ld, payload_input_size=%d, logfile='%s'"), Payload.StartOffset, Payload.CapturedOffset, *SourceLogFile);
+					Result = false;
+					CanQueueMore = false;
+					break;
+				}
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoPipelinedFlush|payload is ready to process|offset=%ld|num_read=%d|payload_input_size=%d|captured_lines=%d|data_len=%d|is_retry=%d|in_flight=%d|logfile='%s'"),
+					Payload.StartOffset, Payload.NumToRead, Payload.CapturedOffset, NumCapturedLines, SendBuild->Payload.Len(), Payload.IsRetry ? 1 : 0, (int)WorkerInFlightPayloads.Num(), *SourceLogFile);
+				if (NumCapturedLines > 0 && !WorkerCompressPayload())
+				{
+					UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER: Failed to compress payload: mode=%d"), (int)Settings->CompressionMode);
+					Result = false;
+					CanQueueMore = false;
+					break;
+				}
+			}
+
+			if (Payload.IsRetry)
+			{
+				NextRetryIndex++;
+			}
+			WorkerInFlightPayloads.Add(Payload);
+			NumQueued++;
+			// A payload that only has a partial line is read again from the same offset, so nothing can be read ahead of it
+			LastQueuedEndOffset = Payload.CapturedOffset > 0 ? Payload.StartOffset + Payload.CapturedOffset : -1;
+			if (NumCapturedLines > 0)
+			{
+				// Remember the sizes of all unacknowledged requests before sending this one, so that a failure or crash retries with identical payloads.
+				// We are allowed to write the progress state here if we do not have an overridden state that we are using and we otherwise need to.
+				bool AllowWriteState = WorkerIsAllowedSerializeProgressState() && WorkerOverrideCommonEventJSONData.Num() <= 0;
+				if (WorkerWritePipelinedProgressMarker(WorkerInFlightPayloads[0].StartOffset, GetUnacknowledgedReadLens(), AllowWriteState ? &CommonEventJSONData : nullptr) && AllowWriteState)
+				{
+					WorkerSerializeCommonEventJSON = false;
+				}
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoPipelinedFlush|Begin processing payload"));
+				WorkerRecordWakeToSend();
+				WorkerInFlightPayloads.Last().Pending = WorkerBeginProcessPayload(*SendBuild, Payload.StartOffset, Payload.CapturedOffset);
+			}
+
+			if ((int64)(Payload.CapturedOffset) >= Payload.RemainingBytes)
+			{
+				// We captured everything up until the end of the file
+				ReadEverything = true;
+				CanQueueMore = false;
+			}
+			else if (Payload.CapturedOffset <= 0)
+			{
+				// Only a partial line is available, wait for more data
+				CanQueueMore = false;
+			}
+			else
+			{
+				NextReadOffset = Payload.StartOffset + Payload.CapturedOffset;
+			}
+		}
+
+		if (WorkerInFlightPayloads.Num() <= 0)
+		{
+			break;
+		}
+
+		// Acknowledge the oldest payload. Progress only ever advances past a contiguous run of successful payloads.
+		FWorkerInFlightPayload Head = WorkerInFlightPayloads[0];
+		WorkerInFlightPayloads.RemoveAt(0);
+		bool HeadSucceeded = !Head.Pending.IsValid() || PayloadProcessor->FinishProcessPayload(Head.Pending.ToSharedRef(), WeakThisPtr);
+		if (Head.Pending.IsValid() && !AckFailed)
+		{
+			// Payloads that follow a failure are all retried, so only the first failure counts as a congestion signal
+			WorkerRecordPayloadResult(*Head.Pending, HeadSucceeded);
+		}
+		if (AckFailed)
+		{
+			// Everything after a failure will be retried regardless of outcome, just wait for the remaining requests to finish.
+			continue;
+		}
+		if (!HeadSucceeded)
+		{
+			UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER: Failed to process payload: offset=%ld, num_read=%d, payload_input_size=%d, in_flight=%d, logfile='%s'"), Head.StartOffset, Head.NumToRead, Head.CapturedOffset, (int)WorkerInFlightPayloads.Num(), *SourceLogFile);
+			AckFailed = true;
+			CanQueueMore = false;
+			FailedReadLens.Add(Head.NumToRead);
+			FailedReadLens.Append(GetUnacknowledgedReadLens());
+			continue;
+		}
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoPipelinedFlush|Finished processing payload|offset=%ld|PayloadInputSize=%d"), Head.StartOffset, Head.CapturedOffset);
+		WorkerShippedLogOffset = Head.StartOffset + Head.CapturedOffset;
+		WorkerUpdateBacklog();
+		if (Head.IsRetry)
+		{
+			RetryReadLens.RemoveAt(0);
+			NextRetryIndex--;
+		}
+		if (WorkerInFlightPayloads.Num() > 0)
+		{
+			WorkerWritePipelinedProgressMarker(WorkerShippedLogOffset, GetUnacknowledgedReadLens(), nullptr);
+			MarkerStale = false;
+		}
+		else
+		{
+			// The caller writes the final progress marker on success
+			MarkerStale = true;
+		}
+	}
+
+	if (!AckFailed)
+	{
+		FailedReadLens = GetUnacknowledgedReadLens();
+	}
+	WorkerLastFailedFlushPayloadSize = FailedReadLens.Num() > 0 ? FailedReadLens[0] : 0;
+	WorkerPendingRetryPayloadSizes.Reset();
+	if (FailedReadLens.Num() > 1)
+	{
+		WorkerPendingRetryPayloadSizes.Append(FailedReadLens.GetData() + 1, FailedReadLens.Num() - 1);
+	}
+	OutNewShippedLogOffset = WorkerShippedLogOffset;
+	bool Success = Result && !AckFailed;
+	if (Success && ReadEverything)
+	{
+		// Caught up, so release the memory used to prepare the backlog
+		WorkerCatchUpBuilds.Empty();
+		WorkerCatchUpBuffer.Empty();
+	}
+	if (!Success && (MarkerStale || AckFailed))
+	{
+		WorkerWritePipelinedProgressMarker(WorkerShippedLogOffset, FailedReadLens, nullptr);
+	}
+	// Only known if every payload to retry was sent again, in which case the last one sent is the last one to retry
+	WorkerMirrorAheadOffset = NextRetryIndex >= RetryReadLens.Num() ? LastQueuedEndOffset : -1;
+	OutFlushProcessedEverything = Success && ReadEverything;
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoPipelinedFlush|END|Success=%d|NumQueued=%d|FlushProcessedEverything=%d"), Success ? 1 : 0, NumQueued, OutFlushProcessedEverything ? 1 : 0);
+	return Success;
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerWritePipelinedProgressMarker(int64 InMarker, const TArray<int>& RetryReadLens, const TArray<uint8>* ProgressState)
+{
+	if (RetryReadLens.Num() <= 0)
+	{
+		return WriteProgressMarker(InMarker, 0, ProgressState);
+	}
+	TArray<int> FollowingReadLens(RetryReadLens.GetData() + 1, RetryReadLens.Num() - 1);
+	return WriteProgressMarker(InMarker, RetryReadLens[0], ProgressState, &FollowingReadLens, WorkerPayloadsUseEnvelope);
+}
+
+int FsparklogsReadAndStreamToCloud::WorkerGetCatchUpParallelism()
+{
+	// More payloads than there are cores would only add memory, not speed
+	return FMath::Clamp(FMath::Min(Settings->CatchUpParallelism, FPlatformMisc::NumberOfCoresIncludingHyperthreads()), 1, FsparklogsSettings::MaxCatchUpParallelism);
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerShouldCatchUp(int64 StartOffset)
+{
+	if (WorkerGetCatchUpParallelism() <= 1 || WorkerLastFailedFlushPayloadSize > 0 || WorkerPendingRetryPayloadSizes.Num() > 0 || WorkerOverrideCommonEventJSONData.Num() > 0)
+	{
+		return false;
+	}
+	int64 FileSize = 0;
+	if (WorkerTailReader->Refresh(FileSize) != FsparklogsTailReader::EStatus::Ready || StartOffset > FileSize)
+	{
+		return false;
+	}
+	// Only worth it if there are at least a couple of full payloads waiting
+	return FileSize - StartOffset >= 2 * (int64)(WorkerGetNewPayloadReadLimit());
+}
+
+int FsparklogsReadAndStreamToCloud::WorkerPrepareCatchUp(int64 StartOffset, TArray<FWorkerCatchUpPayload>& OutPayloads)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerPrepareCatchUp);
+	OutPayloads.Reset();
+	const int Parallelism = WorkerGetCatchUpParallelism();
+	const int ChunkLen = WorkerGetNewPayloadReadLimit();
+	if (Parallelism <= 1 || ChunkLen <= 0 || WorkerOverrideCommonEventJSONData.Num() > 0)
+	{
+		return 0;
+	}
+	int64 FileSize = 0;
+	if (WorkerTailReader->Refresh(FileSize) != FsparklogsTailReader::EStatus::Ready || StartOffset > FileSize)
+	{
+		return 0;
+	}
+	const int64 RemainingBytes = FileSize - StartOffset;
+	if (RemainingBytes < 2 * (int64)ChunkLen)
+	{
+		// Close enough to the end of the file that regular payloads keep up
+		return 0;
+	}
+	WorkerUpdateRecordFormat(FileSize);
+	const int SpanLen = (int)FMath::Min<int64>(RemainingBytes, (int64)ChunkLen * Parallelism);
+	if (WorkerCatchUpBuffer.Num() < SpanLen)
+	{
+		WorkerCatchUpBuffer.SetNumUninitialized(SpanLen);
+	}
+	const uint8* SpanData = WorkerTailReader->Read(StartOffset, SpanLen, WorkerCatchUpBuffer.GetData());
+	if (SpanData == nullptr)
+	{
+		// The regular read reports the failure
+		return 0;
+	}
+
+	// Split the span into payloads that each end right after a newline (or a whole record). A payload then contains exactly the same lines as when
+	// it is re-read on its own with the same read size, so a retry after a failure or crash sends identical data.
+	int ChunkStart = 0;
+	while (OutPayloads.Num() < Parallelism && ChunkStart < SpanLen)
+	{
+		int Len = FMath::Min(ChunkLen, SpanLen - ChunkStart);
+		if (WorkerReadingBinaryRecords)
+		{
+			Len = ITLMeasureBinaryRecords(SpanData + ChunkStart, SpanLen - ChunkStart, Len);
+		}
+		while (!WorkerReadingBinaryRecords && Len > 0 && SpanData[ChunkStart + Len - 1] != '\n')
+		{
+			Len--;
+		}
+		if (Len <= 0)
+		{
+			// A single line longer than a whole payload, leave it to the regular path
+			break;
+		}
+		FWorkerCatchUpPayload& Payload = OutPayloads.AddDefaulted_GetRef();
+		Payload.StartOffset = StartOffset + ChunkStart;
+		Payload.NumToRead = Len;
+		Payload.CapturedOffset = 0;
+		Payload.RemainingBytes = FileSize - Payload.StartOffset;
+		Payload.NumCapturedLines = 0;
+		Payload.BuildIndex = OutPayloads.Num() - 1;
+		Payload.Success = false;
+		ChunkStart += Len;
+	}
+	if (OutPayloads.Num() <= 0)
+	{
+		return 0;
+	}
+	while (WorkerCatchUpBuilds.Num() < OutPayloads.Num())
+	{
+		TUniquePtr<FWorkerPayloadBuild> Build = MakeUnique<FWorkerPayloadBuild>();
+		Build->Payload.Reserve(WorkerPayloadBufferSize);
+		WorkerCatchUpBuilds.Add(MoveTemp(Build));
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	ParallelFor(OutPayloads.Num(), [this, SpanData, StartOffset, &OutPayloads](int32 Index)
+	{
+		FWorkerCatchUpPayload& Payload = OutPayloads[Index];
+		FWorkerPayloadBuild& Build = *WorkerCatchUpBuilds[Payload.BuildIndex];
+		Payload.Success = WorkerBuildPayload(Build, SpanData + (Payload.StartOffset - StartOffset), Payload.NumToRead, Payload.CapturedOffset, Payload.NumCapturedLines);
+		if (Payload.Success && Payload.NumCapturedLines > 0)
+		{
+			Payload.Success = WorkerCompressPayload(Build);
+		}
+	});
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerPrepareCatchUp|prepared payloads|offset=%ld|span_len=%d|num_payloads=%d|parallelism=%d|secs=%.6lf|logfile='%s'"),
+		StartOffset, SpanLen, (int)OutPayloads.Num(), Parallelism, FPlatformTime::Seconds() - StartTime, *SourceLogFile);
+	return OutPayloads.Num();
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerDoFlush()
+{
+	ITL_TRACE_SCOPE(SparkLogs_WorkerDoFlush);
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerDoFlush|BEGIN"));
+	// Requests that arrive while this flush is running will be measured against the next flush
+	WorkerFlushWakeRequestPlatformTime = WakeRequestPlatformTime.exchange(0.0);
+	int64 ShippedNewLogOffset = 0;
+	bool FlushProcessedEverything = false;
+	bool Result = WorkerInternalDoFlush(ShippedNewLogOffset, FlushProcessedEverything);
+	if (!Result)
+	{
+		WorkerLastFlushFailed.AtomicSet(true);
+		WorkerMinNextFlushPlatformTime = FPlatformTime::Seconds() + WorkerGetRetrySecs();
+		LastFlushProcessedEverything.AtomicSet(false);
+		// Increment this counter after the retry interval is calculated
+		WorkerNumConsecutiveFlushFailures++;
+		NumFlushRetries.fetch_add(1);
+		INC_DWORD_STAT(STAT_SparkLogsRetriedFlushes);
+		WorkerMirrorAhead();
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerDoFlush|internal flush failed|WorkerMinNextFlushPlatformTime=%.3lf|NumConsecutiveFlushFailures=%d"), WorkerMinNextFlushPlatformTime, WorkerNumConsecutiveFlushFailures);
+	}
+	else
+	{
+		WorkerLastFlushFailed.AtomicSet(false);
+		WorkerNumConsecutiveFlushFailures = 0;
+		WorkerLastRetrySecs = 0;
+		WorkerRetryAfterSecs = 0;
+		WorkerLastFailedFlushPayloadSize = 0;
+		WorkerPendingRetryPayloadSizes.Reset();
+		WorkerShippedLogOffset = ShippedNewLogOffset;
+		WriteProgressMarker(ShippedNewLogOffset, 0, WorkerIsAllowedSerializeProgressState() ? &CommonEventJSONData : nullptr);
+		WorkerSerializeCommonEventJSON = false;
+		WorkerOverrideCommonEventJSONData.Empty();
+		WorkerMinNextFlushPlatformTime = FPlatformTime::Seconds() + GetProcessingIntervalSecs();
+		// Later segments of a spooled logfile are shipped by the next flushes
+		LastFlushProcessedEverything.AtomicSet(FlushProcessedEverything && WorkerSpoolBacklogBytes <= 0);
+		LastSuccessfulFlushPlatformTime.store(FPlatformTime::Seconds());
+		FlushSuccessOpCounter.Increment();
+		INC_DWORD_STAT(STAT_SparkLogsSuccessfulFlushes);
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerDoFlush|internal flush succeeded|ShippedNewLogOffset=%d|WorkerMinNextFlushPlatformTime=%.3lf|FlushProcessedEverything=%d"), (int)ShippedNewLogOffset, WorkerMinNextFlushPlatformTime, FlushProcessedEverything ? 1 : 0);
+	}
+	FlushOpCounter.Increment();
+	WorkerUpdateBacklog();
+	WorkerUpdateBufferBytes();
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerDoFlush|END|Result=%d"), Result ? 1 : 0);
+	return Result;
+}
+
+double FsparklogsReadAndStreamToCloud::WorkerGetRetrySecs()
+{
+	// Decorrelated jitter: each wait is random between half the retry interval and 3x the previous wait, so that many clients that failed
+	// at the same moment (e.g., during an endpoint outage) spread out their retries. Never waits longer than the linear schedule would.
+	const double BaseSecs = Settings->RetryIntervalSecs;
+	const double MaxSecs = FMath::Min(BaseSecs * (WorkerNumConsecutiveFlushFailures + 1), Settings->MaxRetryIntervalSecs);
+	const double LowSecs = BaseSecs * 0.5;
+	const double HighSecs = WorkerLastRetrySecs > 0.0 ? WorkerLastRetrySecs * 3.0 : BaseSecs;
+	double RetrySecs = FMath::Min(FMath::FRandRange(LowSecs, FMath::Max(LowSecs, HighSecs)), MaxSecs);
+	WorkerLastRetrySecs = RetrySecs;
+	if (WorkerRetryAfterSecs > RetrySecs)
+	{
+		// The server asked us to wait longer, but never wait so long that the retry could miss the ingest dedup window
+		RetrySecs = FMath::Min(WorkerRetryAfterSecs, FsparklogsSettings::MaxRetryIntervalSecs);
+	}
+	WorkerRetryAfterSecs = 0;
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerGetRetrySecs=%.3lf"), RetrySecs);
+	return RetrySecs;
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerRecordPayloadResult(const FsparklogsPendingPayload& Pending, bool Succeeded)
+{
+	if (Pending.StartTime > 0.0)
+	{
+		const double RequestSecs = (Pending.EndTime > 0.0 ? Pending.EndTime : FPlatformTime::Seconds()) - Pending.StartTime;
+		LastPayloadRequestSecs.store(RequestSecs);
+		SET_FLOAT_STAT(STAT_SparkLogsHttpRequestTimeMs, RequestSecs * 1000.0);
+	}
+	if (Succeeded && Pending.Dropped)
+	{
+		NumDroppedPayloads.fetch_add(1);
+		INC_DWORD_STAT(STAT_SparkLogsDroppedPayloads);
+	}
+	WorkerAdaptToPayloadResult(Pending, Succeeded);
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerAdaptToPayloadResult(const FsparklogsPendingPayload& Pending, bool Succeeded)
+{
+	if (!Succeeded && Pending.RetryAfterSecs > WorkerRetryAfterSecs)
+	{
+		WorkerRetryAfterSecs = Pending.RetryAfterSecs;
+	}
+	if (!Settings->AdaptiveRequestSizing)
+	{
+		return;
+	}
+	const int MaxLen = WorkerMaxReadLen;
+	const int MinLen = FMath::Min(MaxLen, FsparklogsSettings::MinAdaptiveBytesPerRequest);
+	int Len = FMath::Clamp((int)AdaptiveBytesPerRequest.load(), MinLen, MaxLen);
+	const double EndTime = Pending.EndTime > 0.0 ? Pending.EndTime : FPlatformTime::Seconds();
+	const double LatencySecs = EndTime - Pending.StartTime;
+	if (!Succeeded || LatencySecs > Settings->TargetRequestLatencySecs)
+	{
+		// Multiplicative decrease: back off quickly when the endpoint is throttling (429), failing (5xx), timing out, or slow
+		Len = FMath::Max(MinLen, Len / 2);
+	}
+	else
+	{
+		// Additive increase, measured in bytes on the wire: data that compresses well costs less to send, so more of it can be read per request
+		const double Ratio = LastPayloadCompressionRatio.load();
+		const double StepLen = ((double)MaxLen / 16.0) * FMath::Clamp(Ratio > 0.0 ? Ratio : 1.0, 1.0, 4.0);
+		Len = (int)FMath::Min<int64>((int64)MaxLen, (int64)Len + (int64)StepLen);
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerAdaptToPayloadResult|Succeeded=%d|ResponseCode=%d|LatencySecs=%.3lf|RetryAfterSecs=%.3lf|OldLen=%d|NewLen=%d"), Succeeded ? 1 : 0, Pending.ResponseCode, LatencySecs, Pending.RetryAfterSecs, (int)AdaptiveBytesPerRequest.load(), Len);
+	AdaptiveBytesPerRequest.store(Len);
+}
+
+int FsparklogsReadAndStreamToCloud::WorkerGetNewPayloadReadLimit() const
+{
+	if (!Settings->AdaptiveRequestSizing)
+	{
+		return WorkerMaxReadLen;
+	}
+	return FMath::Clamp((int)AdaptiveBytesPerRequest.load(), FMath::Min(WorkerMaxReadLen, FsparklogsSettings::MinAdaptiveBytesPerRequest), WorkerMaxReadLen);
+}
+
+uint8* FsparklogsReadAndStreamToCloud::WorkerGetReadBuffer(int Len)
+{
+	if (WorkerBuffer.Num() < Len)
+	{
+		// Only grows with a memory budget, in steps so that a slowly growing backlog does not reallocate on every read
+		const int NewLen = FMath::Max(Len, FMath::Min((int)Align(Len, FsparklogsSettings::MemoryBudgetBufferGranularity), WorkerMaxReadLen));
+		WorkerBuffer.SetNumUninitialized(NewLen);
+	}
+	WorkerLastBufferUsePlatformTime = FPlatformTime::Seconds();
+	return WorkerBuffer.GetData();
+}
+
+int FsparklogsReadAndStreamToCloud::WorkerGetPayloadReserve(int NumToRead) const
+{
+	if (Settings->MemoryBudgetBytes <= 0)
+	{
+		return WorkerPayloadBufferSize;
+	}
+	return FMath::Min(WorkerPayloadBufferSize, NumToRead + 4096 + (NumToRead / 10) + CommonEventJSONData.Num());
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerReleaseIdleBuffers()
+{
+	if (Settings->MemoryBudgetBytes <= 0 || WorkerLastBufferUsePlatformTime <= 0.0 || WorkerInFlightPayloads.Num() > 0 || FPlatformTime::Seconds() - WorkerLastBufferUsePlatformTime < Settings->MemoryBudgetIdleReleaseSecs)
+	{
+		return;
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReleaseIdleBuffers|releasing buffers|buffer_bytes=%lld|logfile='%s'"), BufferBytes.load(), *SourceLogFile);
+	WorkerBuffer.Empty();
+	WorkerReadData = nullptr;
+	WorkerBuild.Payload.GetArray().Empty();
+	WorkerBuild.EncodedPayload.Empty();
+	WorkerBuild.FrameCompressor.Reset();
+	WorkerBuild.GzipCompressor.Reset();
+	WorkerCatchUpBuilds.Empty();
+	WorkerCatchUpBuffer.Empty();
+	WorkerLastBufferUsePlatformTime = 0.0;
+	WorkerUpdateBufferBytes();
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerUpdateBufferBytes()
+{
+	int64 Bytes = (int64)WorkerBuffer.GetAllocatedSize() + (int64)WorkerBuild.Payload.GetArray().GetAllocatedSize() + (int64)WorkerBuild.EncodedPayload.GetAllocatedSize() + (int64)WorkerCatchUpBuffer.GetAllocatedSize();
+	for (const TUniquePtr<FWorkerPayloadBuild>& Build : WorkerCatchUpBuilds)
+	{
+		Bytes += (int64)Build->Payload.GetArray().GetAllocatedSize() + (int64)Build->EncodedPayload.GetAllocatedSize();
+	}
+	const int64 PreviousBytes = BufferBytes.exchange(Bytes);
+	if (Bytes >= PreviousBytes)
+	{
+		INC_MEMORY_STAT_BY(STAT_SparkLogsStreamerBufferMemory, Bytes - PreviousBytes);
+	}
+	else
+	{
+		DEC_MEMORY_STAT_BY(STAT_SparkLogsStreamerBufferMemory, PreviousBytes - Bytes);
+	}
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerIsAllowedSerializeProgressState()
+{
+	// NOTE: don't serialize progress state on mobile/console to minimize size of state
+	return WorkerSerializeCommonEventJSON && !ITLIsMobilePlatform() && !ITLIsConsolePlatform();
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerRecordWakeToSend()
+{
+	if (WorkerFlushWakeRequestPlatformTime <= 0.0)
+	{
+		return;
+	}
+	double Latency = FPlatformTime::Seconds() - WorkerFlushWakeRequestPlatformTime;
+	WorkerFlushWakeRequestPlatformTime = 0.0;
+	LastWakeToSendLatencySecs.store(Latency);
+	SET_FLOAT_STAT(STAT_SparkLogsWakeToSendLatencyMs, Latency * 1000.0);
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerRecordWakeToSend|LatencySecs=%.6lf"), Latency);
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerUpdateBacklog()
+{
+	const int64 Backlog = FMath::Max<int64>(0, WorkerLogFileSize - WorkerShippedLogOffset) + WorkerSpoolBacklogBytes;
+	BacklogBytes.store(Backlog);
+	const uint32 BacklogKB = (uint32)FMath::Min<int64>(Backlog / 1024, (int64)MAX_uint32);
+	if (Lane == ITLStreamLane::Analytics)
+	{
+		SET_DWORD_STAT(STAT_SparkLogsAnalyticsBacklogKB, BacklogKB);
+		TRACE_COUNTER_SET(SparkLogsAnalyticsBacklogBytes, Backlog);
+	}
+	else
+	{
+		SET_DWORD_STAT(STAT_SparkLogsLogBacklogKB, BacklogKB);
+		TRACE_COUNTER_SET(SparkLogsLogBacklogBytes, Backlog);
+	}
+}
+
+void FsparklogsReadAndStreamToCloud::GetShipperStats(FsparklogsShipperStats& OutStats) const
+{
+	const double Now = FPlatformTime::Seconds();
+	const double LastFlushTime = LastFlushPlatformTime.load();
+	const double LastSuccessfulFlushTime = LastSuccessfulFlushPlatformTime.load();
+	OutStats.BacklogBytes = BacklogBytes.load();
+	OutStats.BytesQueuedSinceLastFlush = BytesQueuedSinceLastFlush.load();
+	OutStats.SecsSinceLastFlush = LastFlushTime > 0.0 ? Now - LastFlushTime : -1.0;
+	OutStats.SecsSinceLastSuccessfulFlush = LastSuccessfulFlushTime > 0.0 ? Now - LastSuccessfulFlushTime : -1.0;
+	OutStats.LastFlushFailed = WorkerLastFlushFailed;
+	OutStats.NumFlushes = FlushOpCounter.GetValue();
+	OutStats.NumSuccessfulFlushes = FlushSuccessOpCounter.GetValue();
+	OutStats.NumRetries = NumFlushRetries.load();
+	OutStats.NumDroppedPayloads = NumDroppedPayloads.load();
+	OutStats.DroppedBacklogBytes = DroppedBacklogBytes.load();
+	OutStats.BytesPerRequest = Settings->AdaptiveRequestSizing ? AdaptiveBytesPerRequest.load() : Settings->BytesPerRequest;
+	OutStats.LastBuildSecs = LastPayloadBuildSecs.load();
+	OutStats.LastCompressSecs = LastPayloadCompressSecs.load();
+	OutStats.LastRequestSecs = LastPayloadRequestSecs.load();
+	OutStats.LastCompressionRatio = LastPayloadCompressionRatio.load();
+	OutStats.LastWakeToSendLatencySecs = LastWakeToSendLatencySecs.load();
+	OutStats.BufferBytes = BufferBytes.load();
+	OutStats.FirstAckLatencySecs = PayloadProcessor->GetFirstAckLatencySecs();
+	OutStats.PreWarmSecs = PayloadProcessor->GetPreWarmSecs();
+}
+
+// =============== FsparklogsIndexedLockFile ===============================================================================
+
+FsparklogsIndexedLockFile::FsparklogsIndexedLockFile(int MaxAttempts, const FString& BaseFilePath)
+	: AcquiredLockIndex(0)
+{
+	for (int Index = 1; Index < MaxAttempts; Index++)
+	{
+		if (TryAcquire(BaseFilePath, Index))
+		{
+			break;
+		}
+	}
+	if (!AcquiredLockIndex)
+	{
+		LockFileArchive.Reset(nullptr);
+		// Leave AttemptedLockFile so we know the last attempted lockfile
+	}
+}
+
+FsparklogsIndexedLockFile::FsparklogsIndexedLockFile(const FString& BaseFilePath, int LockIndex)
+	: AcquiredLockIndex(0)
+{
+	TryAcquire(BaseFilePath, LockIndex);
+}
+
+FString FsparklogsIndexedLockFile::GetLockFilename(const FString& BaseFilePath, int LockIndex)
+{
+	FString Filename(BaseFilePath);
+	if (LockIndex > 1)
+	{
+		Filename.AppendChar(TEXT('.'));
+		Filename.AppendInt(LockIndex);
+	}
+	Filename.Append(TEXT(".lock"));
+	return Filename;
+}
+
+bool FsparklogsIndexedLockFile::TryAcquire(const FString& BaseFilePath, int LockIndex)
+{
+	AttemptedLockFile = GetLockFilename(BaseFilePath, LockIndex);
+	uint32 Flags = FILEWRITE_Silent | FILEWRITE_Append;
+	FArchive* Ar = IFileManager::Get().CreateFileWriter(*AttemptedLockFile, Flags);
+	if (Ar == nullptr)
+	{
+		return false;
+	}
+	LockFileArchive = TUniquePtr<FArchive>(Ar);
+	AcquiredLockIndex = LockIndex;
+	return true;
+}
+
+FsparklogsIndexedLockFile::~FsparklogsIndexedLockFile()
+{
+	if (LockFileArchive.IsValid())
+	{
+		LockFileArchive->Close();
+		if (!AttemptedLockFile.IsEmpty())
+		{
+			// If this races because another process already acquired the lock, the delete will fail, which is fine.
+			IFileManager::Get().Delete(*AttemptedLockFile, false, false, true);
+		}
+		LockFileArchive.Reset(nullptr);
+	}
+}
+
+// =============== FsparklogsHostAgent ===============================================================================
+
+FsparklogsHostAgent::FsparklogsHostAgent(int InInstanceIndex, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InLogsPayloadProcessor, TSharedPtr<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InAnalyticsPayloadProcessor, int InMaxLineLength, const FString& InOverrideComputerName, const FString& InAppInstanceID, const TMap<FString, FString>* InAdditionalAttributes, const FString& InHostDir)
+	: InstanceIndex(InInstanceIndex)
+	, Settings(InSettings)
+	, LogsPayloadProcessor(InLogsPayloadProcessor)
+	, AnalyticsPayloadProcessor(InAnalyticsPayloadProcessor)
+	, MaxLineLength(InMaxLineLength)
+	, HostDir(InHostDir)
+	, Leader(false)
+	, WorkerWakeEvent(FPlatformProcess::GetSynchEventFromPool(false))
+	, Thread(nullptr)
+{
+	if (HostDir.IsEmpty())
+	{
+		HostDir = FPaths::GetPath(FPaths::ConvertRelativePathToFull(FGenericPlatformOutputDevices::GetAbsoluteLogFilename()));
+	}
+	Self.InstanceIndex = InstanceIndex;
+	Self.ProcessId = FPlatformProcess::GetCurrentProcessId();
+	Self.AppInstanceID = InAppInstanceID;
+	Self.OverrideComputerName = InOverrideComputerName;
+	if (InAdditionalAttributes != nullptr)
+	{
+		Self.AdditionalAttributes = *InAdditionalAttributes;
+	}
+	// Whichever instance is the leader reports this instance's data with these
+	if (!WriteMemberFile(Self))
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("Host agent failed to publish this instance, so its logfiles will only be shipped while it is the leader: member_file='%s'"), *GetMemberFilePath(InstanceIndex));
+	}
+	check(FPlatformProcess::SupportsMultithreading());
+	FString ThreadName = TEXT("SparkLogs_HostAgent");
+	FPlatformAtomics::InterlockedExchangePtr((void**)&Thread, FRunnableThread::Create(this, *ThreadName, 0, TPri_BelowNormal));
+}
+
+FsparklogsHostAgent::~FsparklogsHostAgent()
+{
+	if (Thread)
+	{
+		delete Thread;
+	}
+	Thread = nullptr;
+	FPlatformProcess::ReturnSynchEventToPool(WorkerWakeEvent);
+	WorkerWakeEvent = nullptr;
+}
+
+FString FsparklogsHostAgent::GetHostLockBasePath() const
+{
+	return FPaths::Combine(HostDir, GetITLLogFileName(TEXT("host"), 0, false));
+}
+
+FString FsparklogsHostAgent::GetInstanceLockBasePath() const
+{
+	// The same lockfiles as ITLGetIndexedLockBasePath when HostDir is the directory of the game log
+	return FPaths::Combine(HostDir, GetITLLogFileName(TEXT("ops"), 0, false));
+}
+
+FString FsparklogsHostAgent::GetMemberFilePath(int InInstanceIndex) const
+{
+	return FPaths::Combine(HostDir, GetITLLogFileName(TEXT("member"), InInstanceIndex, false) + TEXT(".txt"));
+}
+
+FString FsparklogsHostAgent::GetLogFilePath(int InInstanceIndex, ITLStreamLane Lane) const
+{
+	return FPaths::Combine(HostDir, GetITLLogFileName(Lane == ITLStreamLane::Analytics ? TEXT("analytics") : TEXT("run"), InInstanceIndex, true));
+}
+
+bool FsparklogsHostAgent::WriteMemberFile(const FMember& Member) const
+{
+	TSharedRef<FJsonObject> Object = MakeShared<FJsonObject>();
+	Object->SetNumberField(TEXT("instance_index"), Member.InstanceIndex);
+	Object->SetNumberField(TEXT("pid"), Member.ProcessId);
+	Object->SetStringField(TEXT("app_instance_id"), Member.AppInstanceID);
+	Object->SetStringField(TEXT("computer_name"), Member.OverrideComputerName);
+	TSharedRef<FJsonObject> Attributes = MakeShared<FJsonObject>();
+	for (const TPair<FString, FString>& Pair : Member.AdditionalAttributes)
+	{
+		Attributes->SetStringField(Pair.Key, Pair.Value);
+	}
+	Object->SetObjectField(TEXT("attributes"), Attributes);
+	FString JSON;
+	TSharedRef<TJsonWriter<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>> Writer = TJsonWriterFactory<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>::Create(&JSON);
+	if (!FJsonSerializer::Serialize(Object, Writer))
+	{
+		return false;
+	}
+	return FFileHelper::SaveStringToFile(JSON, *GetMemberFilePath(Member.InstanceIndex), FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM);
+}
+
+void FsparklogsHostAgent::ReadMemberFiles(TArray<FMember>& OutMembers) const
+{
+	TArray<FString> Filenames;
+	IFileManager::Get().FindFiles(Filenames, *FPaths::Combine(HostDir, GetITLLogFileName(TEXT("member"), 0, false) + TEXT("*.txt")), true, false);
+	for (const FString& Filename : Filenames)
+	{
+		const FString Path = FPaths::Combine(HostDir, Filename);
+		FString Contents;
+		if (!FFileHelper::LoadFileToString(Contents, *Path))
+		{
+			continue;
+		}
+		TSharedPtr<FJsonObject> Object;
+		TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(Contents);
+		if (!FJsonSerializer::Deserialize(Reader, Object) || !Object.IsValid())
+		{
+			// Possibly still being written by an instance that just started, so it is picked up next time
+			continue;
+		}
+		FMember Member;
+		// Also rules out a file that only looks like a member file
+		if (!Object->TryGetNumberField(TEXT("instance_index"), Member.InstanceIndex) || Member.InstanceIndex < 1 || GetMemberFilePath(Member.InstanceIndex) != Path)
+		{
+			continue;
+		}
+		Object->TryGetNumberField(TEXT("pid"), Member.ProcessId);
+		Object->TryGetStringField(TEXT("app_instance_id"), Member.AppInstanceID);
+		Object->TryGetStringField(TEXT("computer_name"), Member.OverrideComputerName);
+		const TSharedPtr<FJsonObject>* Attributes = nullptr;
+		if (Object->TryGetObjectField(TEXT("attributes"), Attributes))
+		{
+			for (const TPair<FString, TSharedPtr<FJsonValue>>& Pair : (*Attributes)->Values)
+			{
+				Member.AdditionalAttributes.Add(Pair.Key, Pair.Value.IsValid() ? Pair.Value->AsString() : FString());
+			}
+		}
+		OutMembers.Add(MoveTemp(Member));
+	}
+}
+
+bool FsparklogsHostAgent::Init()
+{
+	return true;
+}
+
+uint32 FsparklogsHostAgent::Run()
+{
+	while (StopRequestCounter.GetValue() == 0)
+	{
+		if (Leader || WorkerTryBecomeLeader())
+		{
+			WorkerUpdateStreamers();
+		}
+		WorkerWakeEvent->Wait((uint32)FMath::CeilToInt(FsparklogsSettings::HostAgentElectionIntervalSecs * 1000.0));
+	}
+	return 0;
+}
+
+void FsparklogsHostAgent::Stop()
+{
+	StopRequestCounter.Increment();
+	WorkerWakeEvent->Trigger();
+}
+
+bool FsparklogsHostAgent::WorkerTryBecomeLeader()
+{
+	TUniquePtr<FsparklogsIndexedLockFile> Lock = MakeUnique<FsparklogsIndexedLockFile>(GetHostLockBasePath(), 1);
+	if (!Lock->IsLocked())
+	{
+		return false;
+	}
+	HostLock = MoveTemp(Lock);
+	Leader = true;
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("This instance is now the host agent and ships the logfiles of every instance on this host. InstanceIndex=%d"), InstanceIndex);
+	return true;
+}
+
+void FsparklogsHostAgent::WorkerUpdateStreamers()
+{
+	// Only instances that published themselves use the host agent, the others (if any) ship their own logfiles
+	TArray<FMember> Members;
+	ReadMemberFiles(Members);
+	for (const FMember& Member : Members)
+	{
+		if (StopRequestCounter.GetValue() != 0)
+		{
+			break;
+		}
+		const int Index = Member.InstanceIndex;
+		// This instance's data is reported as this process, everything else exactly as its instance published it
+		const FMember& Reported = (Index == InstanceIndex) ? Self : Member;
+		for (ITLStreamLane Lane : { ITLStreamLane::Logs, ITLStreamLane::Analytics })
+		{
+			TSharedPtr<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor = (Lane == ITLStreamLane::Analytics) ? AnalyticsPayloadProcessor : TSharedPtr<IsparklogsPayloadProcessor, ESPMode::ThreadSafe>(LogsPayloadProcessor);
+			const FString LogFilePath = GetLogFilePath(Index, Lane);
+			if (!PayloadProcessor.IsValid() || (!IFileManager::Get().FileExists(*LogFilePath) && (Settings->SpoolSegmentBytes <= 0 || !FsparklogsSpool::HasSegments(LogFilePath))))
+			{
+				continue;
+			}
+			TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Replaced;
+			uint32 ReplacedProcessId = 0;
+			{
+				FScopeLock StreamersLock(&StreamersCriticalSection);
+				if (TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>* Existing = Streamers.Find(LogFilePath))
+				{
+					const FMember* Shipped = StreamerMembers.Find(LogFilePath);
+					if (Shipped == nullptr || (Shipped->ProcessId == Reported.ProcessId && Shipped->AppInstanceID == Reported.AppInstanceID))
+					{
+						continue;
+					}
+					// A new process reclaimed the instance index of one that exited
+					Replaced = *Existing;
+					ReplacedProcessId = Shipped->ProcessId;
+					Streamers.Remove(LogFilePath);
+					StreamerMembers.Remove(LogFilePath);
+				}
+			}
+			if (Replaced.IsValid())
+			{
+				// Ship what the exited process left under its identity. Whatever does not ship in time continues from the progress marker
+				// (retries keep the metadata they were first sent with).
+				UE_LOG(LogPluginSparkLogs, Log, TEXT("Host agent is restarting the streamer of an instance that restarted. logfile=%s InstanceIndex=%d old_pid=%u pid=%u"), *LogFilePath, Index, ReplacedProcessId, Reported.ProcessId);
+				Replaced->FlushUntilDeadline(FPlatformTime::Seconds() + FsparklogsSettings::WaitForFlushToCloudOnShutdown, true, false);
+				Replaced.Reset();
+			}
+			TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer(new FsparklogsReadAndStreamToCloud(Index, LogFilePath, Settings, PayloadProcessor.ToSharedRef(), MaxLineLength, Reported.OverrideComputerName, Reported.AppInstanceID, &Reported.AdditionalAttributes, Lane, (Index == InstanceIndex) ? 0 : Reported.ProcessId));
+			Streamer->SetWeakThisPtr(Streamer);
+			{
+				FScopeLock StreamersLock(&StreamersCriticalSection);
+				Streamers.Add(LogFilePath, Streamer);
+				StreamerMembers.Add(LogFilePath, Reported);
+			}
+			UE_LOG(LogPluginSparkLogs, Log, TEXT("Host agent is shipping logfile=%s InstanceIndex=%d"), *LogFilePath, Index);
+		}
+		if (Index != InstanceIndex)
+		{
+			WorkerPurgeExitedInstance(Index);
+		}
+	}
+}
+
+void FsparklogsHostAgent::WorkerPurgeExitedInstance(int InInstanceIndex)
+{
+	TArray<TPair<FString, TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>>, TInlineAllocator<2>> InstanceStreamers;
+	{
+		FScopeLock StreamersLock(&StreamersCriticalSection);
+		for (ITLStreamLane Lane : { ITLStreamLane::Logs, ITLStreamLane::Analytics })
+		{
+			const FString LogFilePath = GetLogFilePath(InInstanceIndex, Lane);
+			if (TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>* Streamer = Streamers.Find(LogFilePath))
+			{
+				FsparklogsShipperStats Stats;
+				(*Streamer)->GetShipperStats(Stats);
+				if (Stats.BacklogBytes > 0 || Stats.LastFlushFailed || Stats.NumSuccessfulFlushes <= 0)
+				{
+					return;
+				}
+				InstanceStreamers.Add(TPair<FString, TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>>(LogFilePath, *Streamer));
+			}
+		}
+	}
+	if (InstanceStreamers.Num() == 0)
+	{
+		return;
+	}
+	// Holding the instance lock proves the instance exited, and keeps a new instance from using its logfiles until they are purged
+	FsparklogsIndexedLockFile InstanceLock(GetInstanceLockBasePath(), InInstanceIndex);
+	if (!InstanceLock.IsLocked())
+	{
+		return;
+	}
+	bool PurgedEverything = true;
+	for (const TPair<FString, TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>>& Entry : InstanceStreamers)
+	{
+		PurgedEverything = StopAndPurge(Entry.Value, Entry.Key, false, FsparklogsSettings::WaitForFlushToCloudOnShutdown) && PurgedEverything;
+		FScopeLock StreamersLock(&StreamersCriticalSection);
+		Streamers.Remove(Entry.Key);
+		StreamerMembers.Remove(Entry.Key);
+	}
+	if (PurgedEverything)
+	{
+		IFileManager::Get().Delete(*GetMemberFilePath(InInstanceIndex), false, false, true);
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("Host agent purged the logfiles of an instance that exited. InstanceIndex=%d"), InInstanceIndex);
+	}
+}
+
+bool FsparklogsHostAgent::StopAndPurge(TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer, const FString& LogFilePath, bool OnMainGameThread, double TimeoutSecs)
+{
+	if (!Streamer->FlushUntilDeadline(FPlatformTime::Seconds() + TimeoutSecs, true, OnMainGameThread))
+	{
+		// The progress marker is kept, so whichever instance ships this logfile next continues from there
+		return false;
+	}
+	if (!ITLPurgeFile(LogFilePath) || IFileManager::Get().FileExists(*LogFilePath) || !FsparklogsSpool::PurgeSegments(LogFilePath))
+	{
+		return false;
+	}
+	Streamer->DeleteProgressMarker();
+	return true;
+}
+
+void FsparklogsHostAgent::RequestFlush()
+{
+	FScopeLock StreamersLock(&StreamersCriticalSection);
+	for (const TPair<FString, TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>>& Entry : Streamers)
+	{
+		Entry.Value->RequestFlush();
+	}
+}
+
+bool FsparklogsHostAgent::GetShipperStats(int InInstanceIndex, ITLStreamLane Lane, FsparklogsShipperStats& OutStats)
+{
+	FScopeLock StreamersLock(&StreamersCriticalSection);
+	TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>* Streamer = Streamers.Find(GetLogFilePath(InInstanceIndex, Lane));
+	if (Streamer == nullptr)
+	{
+		return false;
+	}
+	(*Streamer)->GetShipperStats(OutStats);
+	return true;
+}
+
+void FsparklogsHostAgent::Shutdown(double TimeoutSecs)
+{
+	Stop();
+	if (Thread)
+	{
+		delete Thread;
+	}
+	Thread = nullptr;
+	if (!Leader)
+	{
+		return;
+	}
+	const double Deadline = FPlatformTime::Seconds() + TimeoutSecs;
+	TMap<FString, TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>> LeaderStreamers;
+	{
+		FScopeLock StreamersLock(&StreamersCriticalSection);
+		LeaderStreamers = MoveTemp(Streamers);
+		Streamers.Reset();
+		StreamerMembers.Reset();
+	}
+	// Start every flush first so they all make progress while waiting on each one
+	for (const TPair<FString, TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>>& Entry : LeaderStreamers)
+	{
+		Entry.Value->RequestFlush();
+	}
+	bool PurgedOwnLogFiles = true;
+	for (const TPair<FString, TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>>& Entry : LeaderStreamers)
+	{
+		const double RemainingSecs = FMath::Max(0.1, Deadline - FPlatformTime::Seconds());
+		const bool IsOwnLogFile = (Entry.Key == GetLogFilePath(InstanceIndex, ITLStreamLane::Logs) || Entry.Key == GetLogFilePath(InstanceIndex, ITLStreamLane::Analytics));
+		if (IsOwnLogFile)
+		{
+			PurgedOwnLogFiles = StopAndPurge(Entry.Value, Entry.Key, IsInGameThread(), RemainingSecs) && PurgedOwnLogFiles;
+		}
+		else
+		{
+			Entry.Value->FlushUntilDeadline(Deadline, true, IsInGameThread());
+		}
+	}
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("Host agent stopped shipping. NumLogFiles=%d, PurgedOwnLogFiles=%s"), LeaderStreamers.Num(), PurgedOwnLogFiles ? TEXT("yes") : TEXT("no"));
+	if (PurgedOwnLogFiles)
+	{
+		IFileManager::Get().Delete(*GetMemberFilePath(InstanceIndex), false, false, true);
+	}
+	// Closes every progress journal before another instance can take over
+	LeaderStreamers.Empty();
+	HostLock.Reset();
+	Leader = false;
+}
+
+// =============== FsparklogsOutputDeviceFile ===============================================================================
+
+/** Lives exactly as long as its logging thread, so whoever drains the rings can tell that a thread will never write into its ring again. */
+struct FITLLogRingThreadToken
+{
+};
+
+/** A lock-free single producer (the owning logging thread), single consumer (whoever holds RingsCriticalSection) ring of raw log records. */
+struct FsparklogsOutputDeviceFile::FLogRing
+{
+	explicit FLogRing(uint32 InCapacity, const TSharedPtr<FITLLogRingThreadToken, ESPMode::ThreadSafe>& InProducerToken) : Capacity(InCapacity), ProducerToken(InProducerToken), Head(0), Tail(0)
+	{
+		Buffer.SetNumUninitialized(InCapacity);
+	}
+	TArray<uint8> Buffer;
+	const uint32 Capacity;
+	/** Becomes invalid once the producer thread has exited */
+	TWeakPtr<FITLLogRingThreadToken, ESPMode::ThreadSafe> ProducerToken;
+	/** Total bytes ever written, only modified by the producer */
+	std::atomic<uint64> Head;
+	uint8 HeadPadding[PLATFORM_CACHE_LINE_SIZE];
+	/** Total bytes ever consumed, only modified by the consumer */
+	std::atomic<uint64> Tail;
+};
+
+/** Each record in a ring is this header followed by the null-terminated message. A Size of 0 marks unused space at the end of the ring. */
+struct FITLLogRingRecordHeader
+{
+	uint32 Size;
+	int32 NumChars;
+	double Time;
+	FName Category;
+	ELogVerbosity::Type Verbosity;
+};
+static constexpr uint32 ITLLogRingRecordAlignment = 8;
+static constexpr uint32 ITLLogRingRecordHeaderSize = Align((uint32)sizeof(FITLLogRingRecordHeader), ITLLogRingRecordAlignment);
+// How often the drain thread writes out queued messages when it is not woken up early
+static constexpr uint32 ITLLogRingDrainIntervalMillisec = 20;
+
+/** The ring the current thread logs into, along with the device and capture session it was registered with. */
+struct FITLThreadLogRingSlot
+{
+	const FsparklogsOutputDeviceFile* Owner = nullptr;
+	uint32 Generation = 0;
+	void* Ring = nullptr;
+	/** Released when the thread exits */
+	TSharedPtr<FITLLogRingThreadToken, ESPMode::ThreadSafe> Token;
+};
+static thread_local FITLThreadLogRingSlot GITLThreadLogRing;
+static std::atomic<uint32> GITLLogRingGeneration(0);
+
+/** Returns the token of the calling thread, creating it on first use. */
+static const TSharedPtr<FITLLogRingThreadToken, ESPMode::ThreadSafe>& ITLGetThreadToken()
+{
+	FITLThreadLogRingSlot& Slot = GITLThreadLogRing;
+	if (!Slot.Token.IsValid())
+	{
+		Slot.Token = MakeShared<FITLLogRingThreadToken, ESPMode::ThreadSafe>();
+	}
+	return Slot.Token;
+}
+
+/** The suppression state of one thread for one device. Only its thread checks lines against it. Others only take the summaries it holds. */
+struct FsparklogsOutputDeviceFile::FThreadSuppression
+{
+	explicit FThreadSuppression(const TSharedPtr<FITLLogRingThreadToken, ESPMode::ThreadSafe>& InOwnerToken) : OwnerToken(InOwnerToken) { }
+	/** Taken by its thread for every line it checks, so it is only contended while summaries are flushed */
+	FCriticalSection CriticalSection;
+	/** Expires once its thread has exited */
+	TWeakPtr<FITLLogRingThreadToken, ESPMode::ThreadSafe> OwnerToken;
+	/** The thread's copy of the device configuration */
+	FSuppressionConfig Config;
+	/** One token bucket for each category and verbosity that is rate limited */
+	TMap<TTuple<FName, uint8>, FRateBucket> RateBuckets;
+	/** Hash of the last line the thread wrote (including its category and verbosity), used to detect repeats */
+	uint64 LastLineHash = 0;
+	/** The last line written, kept so that a line that repeats only once can be written as is */
+	FString LastLineText;
+	FName LastLineCategory;
+	ELogVerbosity::Type LastLineVerbosity = ELogVerbosity::NoLogging;
+	/** The number of times the last line repeated since it was written (or since its repeats were last reported) */
+	int32 NumRepeats = 0;
+	double FirstRepeatTime = 0.0;
+	double LastRepeatTime = 0.0;
+};
+
+/** A suppression state the current thread registered with a device. */
+struct FITLThreadSuppressionSlot
+{
+	const FsparklogsOutputDeviceFile* Owner;
+	uint32 Generation;
+	void* State;
+};
+// A thread rarely logs to more than a couple of devices, and the oldest entry most likely belongs to a device that no longer exists
+static constexpr int32 ITLMaxThreadSuppressionSlots = 4;
+static thread_local TArray<FITLThreadSuppressionSlot, TInlineAllocator<ITLMaxThreadSuppressionSlots>> GITLThreadSuppression;
+static std::atomic<uint32> GITLSuppressionGeneration(0);
+
+/** Counts the calling thread as pushing into its ring while in scope, so stopping capture never races a push that is already underway. */
+struct FITLLogRingProducerScope
+{
+	explicit FITLLogRingProducerScope(std::atomic<int32>& InNumInFlight) : NumInFlight(InNumInFlight)
+	{
+		NumInFlight.fetch_add(1);
+	}
+	~FITLLogRingProducerScope()
+	{
+		NumInFlight.fetch_sub(1);
+	}
+	std::atomic<int32>& NumInFlight;
+};
+
+class FsparklogsOutputDeviceFile::FRingDrainRunnable : public FRunnable
+{
+public:
+	explicit FRingDrainRunnable(FsparklogsOutputDeviceFile& InOwner) : Owner(InOwner) { }
+	virtual uint32 Run() override
+	{
+		while (!Owner.RingDrainStopping.load())
+		{
+			Owner.RingDrainEvent->Wait(ITLLogRingDrainIntervalMillisec);
+			Owner.DrainRings();
+		}
+		return 0;
+	}
+protected:
+	FsparklogsOutputDeviceFile& Owner;
+};
+
+/** Holds the spool lock shared while the async writer is used (only if spooling), so starting the next segment never swaps the writer out from under a write.
+  * Writers must check AsyncWriter again once in scope, since the spool might have replaced it after they last checked. */
+struct FsparklogsOutputDeviceFile::FSpoolWriteScope
+{
+	FsparklogsOutputDeviceFile& Device;
+	const bool Locked;
+
+	FSpoolWriteScope(FsparklogsOutputDeviceFile& InDevice)
+		: Device(InDevice)
+		, Locked(InDevice.SpoolActive.load(std::memory_order_relaxed))
+	{
+		if (Locked)
+		{
+			Device.SpoolLock.ReadLock();
+		}
+	}
+
+	~FSpoolWriteScope()
+	{
+		if (Locked)
+		{
+			Device.SpoolLock.ReadUnlock();
+		}
+	}
+};
+
+FsparklogsOutputDeviceFile::FsparklogsOutputDeviceFile(const TCHAR* InFilename, TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> CloudStreamer)
+: Failed(false)
+, ForceLogFlush(false)
+, AsyncWriter(nullptr)
+, WriterArchive(nullptr)
+, CloudStreamerWeakPtr(CloudStreamer)
+, SuppressionActive(false)
+, SuppressionConfigVersion(0)
+, SuppressionGeneration(GITLSuppressionGeneration.fetch_add(1) + 1)
+, NumSuppressedLines(0)
+, NumBytesWritten(0)
+, NumLinesWritten(0)
+, WriteRateWindowStartTime(FPlatformTime::Seconds())
+, WriteRateWindowStartBytes(0)
+, WriteRateWindowStartLines(0)
+, BytesWrittenPerSec(0.0)
+, LinesWrittenPerSec(0.0)
+, PreBufferActive(false)
+, PreBufferWriting(false)
+, PreBufferedBytes(0)
+, PreBufferMaxBytes(0)
+, NumPreBufferDroppedLines(0)
+, SpoolActive(false)
+, SpoolSegmentBytes(0)
+, SpoolSegmentNumber(0)
+, SpoolSegmentWrittenBytes(0)
+, SpoolSegmentProtected(false)
+, SpoolRollPending(false)
+, SpoolBinaryRecords(false)
+, RingCaptureActive(false)
+, RingCapacity(0)
+, RingGeneration(0)
+, RingProducersInFlight(0)
+, RingDrainDepth(0)
+, RingDrainEvent(nullptr)
+, RingDrainStopping(false)
+, RingDrainThread(nullptr)
+{
+	Filename = InFilename;
+	ForceLogFlush = FParse::Param(FCommandLine::Get(), TEXT("FORCELOGFLUSH"));
+}
+
+FsparklogsOutputDeviceFile::~FsparklogsOutputDeviceFile()
+{
+	TearDown();
+}
+
+void FsparklogsOutputDeviceFile::SetCloudStreamer(TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> CloudStreamer)
+{
+	CloudStreamerWeakPtr = TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(CloudStreamer);
+}
+
+void FsparklogsOutputDeviceFile::TearDown()
+{
+	StopRingCapture();
+	FWriteScopeLock SpoolScope(SpoolLock);
+	if (AsyncWriter)
+	{
+		FAsyncWriter* DeletedAsyncWriter = AsyncWriter;
+		AsyncWriter = nullptr;
+		delete DeletedAsyncWriter;
+	}
+	if (WriterArchive)
+	{
+		FArchive* DeletedWriterArchive = WriterArchive;
+		WriterArchive = nullptr;
+		delete DeletedWriterArchive;
+	}
+	SpoolActive.store(false);
+	Filename = FString();
+}
+
+void FsparklogsOutputDeviceFile::Flush()
+{
+	if (SuppressionActive.load(std::memory_order_relaxed))
+	{
+		FlushSuppressionSummaries();
+	}
+	if (RingCaptureActive.load(std::memory_order_relaxed))
+	{
+		DrainRings();
+	}
+	if (AsyncWriter)
+	{
+		FSpoolWriteScope SpoolScope(*this);
+		if (AsyncWriter)
+		{
+			AsyncWriter->Flush();
+		}
+	}
+}
+
+void FsparklogsOutputDeviceFile::StartSpool(int64 SegmentBytes, bool bBinaryRecords)
+{
+	FWriteScopeLock SpoolScope(SpoolLock);
+	if (SpoolActive.load() || SegmentBytes <= 0 || Filename.IsEmpty())
+	{
+		return;
+	}
+	if (AsyncWriter)
+	{
+		// Anything written from now on goes to the segments
+		delete AsyncWriter;
+		AsyncWriter = nullptr;
+		delete WriterArchive;
+		WriterArchive = nullptr;
+	}
+	// Continue numbering after any segments left by an earlier session, so they are shipped first
+	TArray<FsparklogsSpool::FSegment> Segments;
+	FsparklogsSpool::FindSegments(Filename, Segments);
+	SpoolSegmentNumber = ((Segments.Num() > 0) ? Segments.Last().Number : 0) + 1;
+	SpoolSegmentFilename = FsparklogsSpool::GetSegmentPath(Filename, SpoolSegmentNumber);
+	SpoolSegmentBytes = SegmentBytes;
+	SpoolSegmentWrittenBytes.store(0);
+	SpoolSegmentProtected.store(false);
+	SpoolBinaryRecords.store(bBinaryRecords);
+	SpoolActive.store(true);
+}
+
+void FsparklogsOutputDeviceFile::RollSpoolSegment()
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsOutputDeviceFile_RollSpoolSegment);
+	{
+		FWriteScopeLock SpoolScope(SpoolLock);
+		if (SpoolActive.load() && AsyncWriter != nullptr)
+		{
+			// The segment is completely written out before the next one exists, since the streamer treats every segment but the newest as sealed.
+			AsyncWriter->Flush();
+			const uint32 Flags = FILEWRITE_Silent | FILEWRITE_AllowRead | FILEWRITE_Append;
+			const FString NextFilename = FsparklogsSpool::GetSegmentPath(Filename, SpoolSegmentNumber + 1);
+			FArchive* Ar = IFileManager::Get().CreateFileWriter(*NextFilename, Flags);
+			if (Ar)
+			{
+				// The next writer is in place before the old one is deleted, so AsyncWriter never points at a deleted writer or becomes null,
+				// not even for a thread that logs without taking the lock while crashing.
+				FAsyncWriter* SealedWriter = AsyncWriter;
+				FArchive* SealedArchive = WriterArchive;
+				FAsyncWriter* NextWriter = new FAsyncWriter(*Ar);
+				if (SpoolBinaryRecords.load())
+				{
+					NextWriter->Serialize((void*)ITLBinaryRecordSignature, sizeof(ITLBinaryRecordSignature));
+				}
+				else
+				{
+					NextWriter->Serialize((void*)UTF8ByteOrderMark, sizeof(UTF8ByteOrderMark));
+				}
+				WriterArchive = Ar;
+				AsyncWriter = NextWriter;
+				SpoolSegmentNumber++;
+				SpoolSegmentFilename = NextFilename;
+				SpoolSegmentProtected.store(false);
+				delete SealedWriter;
+				delete SealedArchive;
+			}
+			// Otherwise keep appending to the current segment rather than losing log lines, and try again once it grows by another segment
+		}
+		SpoolSegmentWrittenBytes.store(0);
+	}
+	SpoolRollPending.store(false);
+}
+
+void FsparklogsOutputDeviceFile::MarkSpoolSegmentProtected()
+{
+	if (SpoolActive.load(std::memory_order_relaxed) && !SpoolSegmentProtected.exchange(true))
+	{
+		// Created before the segment can be sealed, so a sealed segment with analytics events is never seen without its marker
+		delete IFileManager::Get().CreateFileWriter(*FsparklogsSpool::GetProtectedMarkerPath(SpoolSegmentFilename), FILEWRITE_Silent);
+	}
+}
+
+bool FsparklogsOutputDeviceFile::StartRingCapture(int32 RingBytes)
+{
+	FScopeLock RingsLock(&RingsCriticalSection);
+	if (RingCaptureActive.load() || RingBytes <= 0 || ForceLogFlush)
+	{
+		// Every line is flushed as soon as it is logged with ForceLogFlush, so it must never wait in a ring
+		return RingCaptureActive.load();
+	}
+	RingCapacity = FMath::RoundUpToPowerOfTwo((uint32)FMath::Max(RingBytes, (int32)(ITLLogRingRecordHeaderSize * 4)));
+	RingGeneration = ++GITLLogRingGeneration;
+	RingDrainStopping.store(false);
+	RingDrainEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	RingDrainRunnable = MakeUnique<FRingDrainRunnable>(*this);
+	RingDrainThread = FRunnableThread::Create(RingDrainRunnable.Get(), TEXT("SparkLogsLogRingDrain"), 0, TPri_BelowNormal);
+	if (RingDrainThread == nullptr)
+	{
+		RingDrainRunnable.Reset();
+		FPlatformProcess::ReturnSynchEventToPool(RingDrainEvent);
+		RingDrainEvent = nullptr;
+		return false;
+	}
+	RingCaptureActive.store(true);
+	return true;
+}
+
+void FsparklogsOutputDeviceFile::StopRingCapture()
+{
+	if (RingDrainThread == nullptr)
+	{
+		return;
+	}
+	// New messages are written directly from now on. Wait for threads already pushing a message (the drain thread keeps making room meanwhile),
+	// so that none of them writes into a ring after the final drain or wakes up the drain thread after its event is returned to the pool.
+	RingCaptureActive.store(false);
+	while (RingProducersInFlight.load() > 0)
+	{
+		FPlatformProcess::YieldThread();
+	}
+	RingDrainStopping.store(true);
+	RingDrainEvent->Trigger();
+	RingDrainThread->WaitForCompletion();
+	delete RingDrainThread;
+	RingDrainThread = nullptr;
+	RingDrainRunnable.Reset();
+	DrainRings();
+	FPlatformProcess::ReturnSynchEventToPool(RingDrainEvent);
+	RingDrainEvent = nullptr;
+	// Nothing can push anymore and threads never use a ring cached for an earlier session, so the rings can go
+	FScopeLock RingsLock(&RingsCriticalSection);
+	Rings.Empty();
+	RingGeneration = 0;
+}
+
+FsparklogsOutputDeviceFile::FLogRing* FsparklogsOutputDeviceFile::GetThreadRing()
+{
+	FITLThreadLogRingSlot& Slot = GITLThreadLogRing;
+	if (Slot.Owner == this && Slot.Generation == RingGeneration)
+	{
+		return (FLogRing*)Slot.Ring;
+	}
+	// First message from this thread in this capture session (the only time a logging thread allocates)
+	FScopeLock RingsLock(&RingsCriticalSection);
+	if (!RingCaptureActive.load())
+	{
+		return nullptr;
+	}
+	FLogRing* Ring = Rings.Add_GetRef(MakeUnique<FLogRing>(RingCapacity, ITLGetThreadToken())).Get();
+	Slot.Owner = this;
+	Slot.Generation = RingGeneration;
+	Slot.Ring = Ring;
+	return Ring;
+}
+
+bool FsparklogsOutputDeviceFile::PushToRing(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time)
+{
+	FITLLogRingProducerScope ProducerScope(RingProducersInFlight);
+	// Checked again after counting this thread as in flight, since capture might have stopped in between
+	if (!RingCaptureActive.load())
+	{
+		return false;
+	}
+	FLogRing* Ring = GetThreadRing();
+	if (Ring == nullptr)
+	{
+		return false;
+	}
+	const int32 NumChars = FCString::Strlen(Data);
+	const uint64 RecordSize = Align((uint64)ITLLogRingRecordHeaderSize + (uint64)(NumChars + 1) * sizeof(TCHAR), (uint64)ITLLogRingRecordAlignment);
+	if (RecordSize > Ring->Capacity / 2)
+	{
+		// Too large to queue. Write out everything queued first so that this thread's messages stay in order, then the caller writes it directly.
+		DrainRings();
+		return false;
+	}
+	uint64 Head = Ring->Head.load(std::memory_order_relaxed);
+	uint32 Offset = (uint32)(Head & (Ring->Capacity - 1));
+	const uint32 Contiguous = Ring->Capacity - Offset;
+	const uint64 Needed = RecordSize + ((Contiguous < RecordSize) ? Contiguous : 0);
+	while (Head + Needed - Ring->Tail.load(std::memory_order_acquire) > Ring->Capacity)
+	{
+		// The ring is full. Make room by draining on this thread, unless this thread is the one draining (e.g., it logged while writing).
+		if (!DrainRings())
+		{
+			return false;
+		}
+	}
+	uint8* Buffer = Ring->Buffer.GetData();
+	if (Contiguous < RecordSize)
+	{
+		// Records are always contiguous, so skip the remaining space at the end of the ring
+		((FITLLogRingRecordHeader*)(Buffer + Offset))->Size = 0;
+		Head += Contiguous;
+		Offset = 0;
+	}
+	FITLLogRingRecordHeader* Header = new (Buffer + Offset) FITLLogRingRecordHeader();
+	Header->Size = (uint32)RecordSize;
+	Header->NumChars = NumChars;
+	// Capture the time now since the line is formatted later (-1 means the formatter would use the current time)
+	Header->Time = (Time >= 0.0) ? Time : (FPlatformTime::Seconds() - GStartTime);
+	Header->Category = Category;
+	Header->Verbosity = Verbosity;
+	FMemory::Memcpy(Buffer + Offset + ITLLogRingRecordHeaderSize, Data, (NumChars + 1) * sizeof(TCHAR));
+	const uint64 UsedBefore = Head - Ring->Tail.load(std::memory_order_relaxed);
+	Ring->Head.store(Head + RecordSize, std::memory_order_release);
+	if (UsedBefore <= Ring->Capacity / 2 && UsedBefore + RecordSize > Ring->Capacity / 2)
+	{
+		// Wake up the drain thread early (only once each time the ring becomes half full) so logging threads rarely have to drain themselves
+		RingDrainEvent->Trigger();
+	}
+	return true;
+}
+
+bool FsparklogsOutputDeviceFile::DrainRings()
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsOutputDeviceFile_DrainRings);
+	ITL_TRACE_SCOPE(SparkLogs_DrainRings);
+	FScopeLock RingsLock(&RingsCriticalSection);
+	if (RingDrainDepth > 0)
+	{
 		return false;
 	}
+	RingDrainDepth++;
+	// Index-based since this thread can register a new ring if it logs something while writing
+	for (int32 RingIndex = 0; RingIndex < Rings.Num(); RingIndex++)
+	{
+		// Checked before draining, so that whatever an exited thread left behind is always written out before its ring is freed
+		const bool ProducerExited = !Rings[RingIndex]->ProducerToken.IsValid();
+		DrainRing(*Rings[RingIndex]);
+		if (ProducerExited)
+		{
+			Rings.RemoveAt(RingIndex);
+			RingIndex--;
+		}
+	}
+	RingDrainDepth--;
+	return true;
+}
+
+int32 FsparklogsOutputDeviceFile::GetNumRings()
+{
+	FScopeLock RingsLock(&RingsCriticalSection);
+	return Rings.Num();
+}
+
+void FsparklogsOutputDeviceFile::DrainRing(FLogRing& Ring)
+{
+	uint64 Tail = Ring.Tail.load(std::memory_order_relaxed);
+	const uint64 Head = Ring.Head.load(std::memory_order_acquire);
+	const uint8* Buffer = Ring.Buffer.GetData();
+	while (Tail < Head)
+	{
+		const uint32 Offset = (uint32)(Tail & (Ring.Capacity - 1));
+		const FITLLogRingRecordHeader* Header = (const FITLLogRingRecordHeader*)(Buffer + Offset);
+		if (Header->Size == 0)
+		{
+			Tail += Ring.Capacity - Offset;
+		}
+		else
+		{
+			if (AsyncWriter)
+			{
+				InternalSerializeLine((const TCHAR*)(Buffer + Offset + ITLLogRingRecordHeaderSize), Header->Verbosity, Header->Category, Header->Time);
+			}
+			Tail += Header->Size;
+		}
+		// Release the space right away so the producer can reuse it
+		Ring.Tail.store(Tail, std::memory_order_release);
+	}
+}
+
+void FsparklogsOutputDeviceFile::Serialize(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time)
+{
+	if (!ShouldLogCategory(Category) || Verbosity == ELogVerbosity::SetColor)
+	{
+		return;
+	}
+
+	static bool WithinCriticalError = false;
+	if (GIsCriticalError && !WithinCriticalError)
+	{
+		WithinCriticalError = true;
+		Serialize(Data, Verbosity, Category, Time);
+		WithinCriticalError = false;
+	}
+	else
+	{
+		if (!WithinCriticalError && PreBufferActive.load(std::memory_order_relaxed) && PreBufferLine(Data, Verbosity, Category, Time))
+		{
+			// Held in memory until the shipping engine is ready
+			return;
+		}
+		if (!AsyncWriter && !Failed)
+		{
+			CreateAsyncWriter();
+		}
+		if (AsyncWriter)
+		{
+			if (WithinCriticalError)
+			{
+				// Minimize unnecessary allocations or processing and just try to log while we possibly still can.
+				// Never waits for the spool lock, since the crashing thread might be the one starting the next segment. Read the writer once instead,
+				// which starting the next segment only replaces after the next one is ready.
+				FAsyncWriter* CrashWriter = AsyncWriter;
+				if (CrashWriter == nullptr)
+				{
+					// The spool just started and has no segment open yet
+				}
+				else if (SpoolBinaryRecords.load(std::memory_order_relaxed))
+				{
+					// Binary records cannot hold unconverted text
+					FsparklogsOutputDeviceFile::InternalAddMessageEvent(*CrashWriter, nullptr, 0, Data, Verbosity, Category, Time, bSuppressEventTag, true);
+				}
+				else
+				{
+					FOutputDeviceHelper::FormatCastAndSerializeLine(*CrashWriter, Data, Verbosity, Category, Time, bSuppressEventTag, bAutoEmitLineTerminator);
+				}
+				// Do not accrue written bytes in this situation
+			}
+			else if (SuppressionActive.load(std::memory_order_relaxed) && ShouldSuppressLine(Data, Verbosity, Category))
+			{
+				// Dropped before any copying or formatting, it is reported later as part of a summary event
+			}
+			else if (!RingCaptureActive.load(std::memory_order_relaxed) || !PushToRing(Data, Verbosity, Category, Time))
+			{
+				InternalSerializeLine(Data, Verbosity, Category, Time);
+			}
+			if (ForceLogFlush)
+			{
+				Flush();
+			}
+		}
+	}
+}
+
+// In general, make logs follow Windows convention
+#if PLATFORM_UNIX
+static const ANSICHAR ITLLineTerminatorUTF8[] = "\r\n";
+#else
+static const ANSICHAR ITLLineTerminatorUTF8[] = LINE_TERMINATOR_ANSI;
+#endif // PLATFORM_UNIX
+constexpr int32 ITLLineTerminatorUTF8Len = UE_ARRAY_COUNT(ITLLineTerminatorUTF8) - 1;
+
+// The maximum number of UTF-8 bytes that a single TCHAR code unit can encode to (surrogate pairs encode to 4 bytes from 2 code units).
+constexpr int32 ITLMaxUTF8BytesPerTCHAR = (sizeof(TCHAR) == 2) ? 3 : 4;
+// Masks a (possibly signed) TCHAR down to its code unit value.
+constexpr uint32 ITLTCHARCodeUnitMask = (sizeof(TCHAR) == 2) ? 0xFFFFu : 0xFFFFFFFFu;
+// Room reserved for the event tag: time and frame, category name and verbosity.
+constexpr int32 ITLMaxLogLineTagUTF8Len = 64 + (NAME_SIZE * ITLMaxUTF8BytesPerTCHAR) + 32;
+
+struct FITLUTF8Fragment
+{
+	const ANSICHAR* Str;
+	int32 Len;
+};
+
+#define ITL_SEVERITY_FRAGMENT(Name) { "\x16" "\"severity\": \"" Name "\"" "\x17", sizeof("\x16" "\"severity\": \"" Name "\"" "\x17") - 1 }
+// Pre-encoded explicit severity JSON (including the JSON start/end markers), indexed by ELogVerbosity. Must match ITLSeverityToString.
+static constexpr FITLUTF8Fragment ITLSeverityFragments[] =
+{
+	ITL_SEVERITY_FRAGMENT("NoLogging"),
+	ITL_SEVERITY_FRAGMENT("Fatal"),
+	ITL_SEVERITY_FRAGMENT("Error"),
+	ITL_SEVERITY_FRAGMENT("Warning"),
+	ITL_SEVERITY_FRAGMENT("Display"),
+	ITL_SEVERITY_FRAGMENT("Info"),
+	ITL_SEVERITY_FRAGMENT("Verbose"),
+	ITL_SEVERITY_FRAGMENT("VeryVerbose"),
+};
+#undef ITL_SEVERITY_FRAGMENT
+
+/** Per-thread scratch used to assemble one UTF-8 encoded event. Grows to the largest event seen on the thread and is never shrunk. */
+static thread_local TArray<ANSICHAR> GITLEventScratch;
+
+/** Returns the calling thread's scratch buffer with room for at least MinLen bytes. */
+static ANSICHAR* ITLGetEventScratch(int32 MinLen)
+{
+	if (GITLEventScratch.Num() < MinLen)
+	{
+		GITLEventScratch.SetNumUninitialized(FMath::RoundUpToPowerOfTwo(FMath::Max(MinLen, 1024)));
+	}
+	return GITLEventScratch.GetData();
+}
+
+/** Per-thread scratch used to convert lines of text into binary records. Grows to the largest write seen on the thread and is never shrunk. */
+static thread_local FITLJSONPayloadBuilder GITLRecordScratch;
+
+/** Returns how many of the N bytes at the start of Data still fit in MaxEscapedLen bytes once escaped as a JSON string (without the quotes).
+  * Never splits a UTF-8 character. */
+static int32 ITLFitEscapedJsonBytes(const uint8* Data, int32 N, int32 MaxEscapedLen)
+{
+	int32 Offset = 0;
+	int32 EscapedLen = 0;
+	while (Offset < N && EscapedLen < MaxEscapedLen)
+	{
+		const int32 NumClean = ITLCountCleanJsonBytes(Data + Offset, FMath::Min(N - Offset, MaxEscapedLen - EscapedLen));
+		Offset += NumClean;
+		EscapedLen += NumClean;
+		if (Offset >= N || EscapedLen >= MaxEscapedLen)
+		{
+			break;
+		}
+		// Escaped like ITLAppendUTF8AsEscapedJsonString does
+		const uint8 c = Data[Offset];
+		const bool ShortEscape = c == '\"' || c == '\\' || c == '\b' || c == '\t' || c == '\n' || c == CharInternalNewline || c == '\f' || c == '\r';
+		const int32 CharEscapedLen = ShortEscape ? 2 : 6;
+		if (EscapedLen + CharEscapedLen > MaxEscapedLen)
+		{
+			break;
+		}
+		Offset++;
+		EscapedLen += CharEscapedLen;
+	}
+	while (Offset > 0 && Offset < N && (Data[Offset] & 0xC0) == 0x80)
+	{
+		Offset--;
+	}
+	return Offset;
+}
+
+/** Converts Len bytes of whole lines, framed as in a text logfile, into binary records in the calling thread's record scratch. Each line is parsed
+  * the same way the streamer parses a line of text, and its message is escaped once here so that the streamer can copy the record as-is.
+  * Messages too long for one record continue in the records that follow. Severity is stored in the header of every record. */
+static void ITLConvertLinesToBinaryRecords(const ANSICHAR* Lines, int32 Len, uint8 Severity)
+{
+	static const ANSICHAR EmptyHeader[sizeof(FITLBinaryRecordHeader)] = {};
+	FITLJSONPayloadBuilder& Out = GITLRecordScratch;
+	Out.Reset();
+	const int64 UTCTicks = FDateTime::UtcNow().GetTicks();
+	int32 Offset = 0;
+	while (Offset < Len)
+	{
+		int32 LineLen = 0;
+		if (!ITLFindFirstByte((const uint8*)(Lines + Offset), static_cast<uint8>('\n'), Len - Offset, LineLen))
+		{
+			LineLen = Len - Offset;
+		}
+		const ANSICHAR* Message = Lines + Offset;
+		Offset += LineLen + 1;
+		while (LineLen > 0 && (Message[LineLen - 1] == '\n' || Message[LineLen - 1] == '\r' || (uint8)Message[LineLen - 1] == CharInternalNewline))
+		{
+			LineLen--;
+		}
+		if (LineLen <= 0)
+		{
+			continue;
+		}
+		const ANSICHAR* RawJSON = nullptr;
+		int32 RawJSONLen = 0;
+		if (LineLen > 2 && (uint8)Message[0] == CharInternalJSONStart)
+		{
+			int32 JSONEndIndex = 0;
+			if (ITLFindFirstByte((const uint8*)(Message + 1), CharInternalJSONEnd, LineLen - 1, JSONEndIndex))
+			{
+				RawJSON = Message + 1;
+				RawJSONLen = JSONEndIndex;
+				Message += JSONEndIndex + 2;
+				LineLen -= JSONEndIndex + 2;
+			}
+		}
+		uint8 Flags = 0;
+		if ((int32)sizeof(FITLBinaryRecordHeader) + RawJSONLen + 64 > ITLMaxBinaryRecordLen)
+		{
+			Flags |= FITLBinaryRecordHeader::FlagJSONDropped;
+			RawJSONLen = 0;
+		}
+		do
+		{
+			const int32 RecordStart = Out.Len();
+			Out.Append(EmptyHeader, sizeof(EmptyHeader));
+			if (RawJSONLen > 0)
+			{
+				Out.Append(RawJSON, RawJSONLen);
+				Out.Append(",", 1);
+			}
+			const int32 MessageOffset = Out.Len() - RecordStart - (int32)sizeof(FITLBinaryRecordHeader);
+			Out.Append("\"message\":", 10 /* length of `"message":` */);
+			const int32 PieceLen = ITLFitEscapedJsonBytes((const uint8*)Message, LineLen, ITLMaxBinaryRecordLen - (Out.Len() - RecordStart) - 2 /* the quotes */);
+			ITLAppendUTF8AsEscapedJsonString(Out, Message, PieceLen);
+			FITLBinaryRecordHeader Header = {};
+			Header.Magic = FITLBinaryRecordHeader::MagicValue;
+			Header.Flags = Flags;
+			Header.Severity = Severity;
+			Header.Length = (uint32)(Out.Len() - RecordStart - (int32)sizeof(FITLBinaryRecordHeader));
+			Header.MessageOffset = (uint32)MessageOffset;
+			Header.UTCTicks = UTCTicks;
+			FMemory::Memcpy(Out.GetArray().GetData() + RecordStart, &Header, sizeof(Header));
+			Message += PieceLen;
+			LineLen -= PieceLen;
+			// Like a line of text broken at the max line length, only the first part keeps the raw JSON
+			RawJSONLen = 0;
+			Flags = FITLBinaryRecordHeader::FlagContinuation;
+		} while (LineLen > 0);
+	}
+}
+
+/** Writes Len bytes of whole lines, framed as in a text logfile, to Output, converted to binary records first if bBinaryRecords.
+  * Severity is the ELogVerbosity of the lines (NoLogging for raw events). Returns the number of bytes written. */
+static int32 ITLSerializeLines(FArchive& Output, ANSICHAR* Lines, int32 Len, bool bBinaryRecords, uint8 Severity)
+{
+	if (!bBinaryRecords)
+	{
+		Output.Serialize(Lines, Len * sizeof(ANSICHAR));
+		return Len;
+	}
+	ITLConvertLinesToBinaryRecords(Lines, Len, Severity);
+	Output.Serialize(GITLRecordScratch.GetArray().GetData(), GITLRecordScratch.Len());
+	return GITLRecordScratch.Len();
+}
+
+/** Encodes Len code units of Src as UTF-8 into Dest in a single pass, optionally mapping '\n' to CharInternalNewline and dropping '\r'.
+  * Dest must have room for Len * ITLMaxUTF8BytesPerTCHAR bytes. Unpaired surrogates are encoded as '?'. Returns the end of the written data. */
+static ANSICHAR* ITLEncodeUTF8(ANSICHAR* Dest, const TCHAR* Src, int32 Len, bool bMapNewlines, bool bDropCarriageReturns)
+{
+	for (int32 i = 0; i < Len; i++)
+	{
+		uint32 C = static_cast<uint32>(Src[i]) & ITLTCHARCodeUnitMask;
+		if (C < 0x80)
+		{
+			if (C == '\n' && bMapNewlines)
+			{
+				C = CharInternalNewline;
+			}
+			else if (C == '\r' && bDropCarriageReturns)
+			{
+				continue;
+			}
+			*Dest++ = static_cast<ANSICHAR>(C);
+		}
+		else if (C < 0x800)
+		{
+			*Dest++ = static_cast<ANSICHAR>(0xC0 | (C >> 6));
+			*Dest++ = static_cast<ANSICHAR>(0x80 | (C & 0x3F));
+		}
+		else
+		{
+			if (C >= 0xD800 && C <= 0xDFFF)
+			{
+				const uint32 Next = (i + 1 < Len) ? static_cast<uint32>(Src[i + 1]) & ITLTCHARCodeUnitMask : 0;
+				if (sizeof(TCHAR) == 2 && C <= 0xDBFF && Next >= 0xDC00 && Next <= 0xDFFF)
+				{
+					C = 0x10000 + ((C - 0xD800) << 10) + (Next - 0xDC00);
+					i++;
+				}
+				else
+				{
+					*Dest++ = '?';
+					continue;
+				}
+			}
+			if (C < 0x10000)
+			{
+				*Dest++ = static_cast<ANSICHAR>(0xE0 | (C >> 12));
+				*Dest++ = static_cast<ANSICHAR>(0x80 | ((C >> 6) & 0x3F));
+				*Dest++ = static_cast<ANSICHAR>(0x80 | (C & 0x3F));
+			}
+			else if (C <= 0x10FFFF)
+			{
+				*Dest++ = static_cast<ANSICHAR>(0xF0 | (C >> 18));
+				*Dest++ = static_cast<ANSICHAR>(0x80 | ((C >> 12) & 0x3F));
+				*Dest++ = static_cast<ANSICHAR>(0x80 | ((C >> 6) & 0x3F));
+				*Dest++ = static_cast<ANSICHAR>(0x80 | (C & 0x3F));
+			}
+			else
+			{
+				*Dest++ = '?';
+			}
+		}
+	}
+	return Dest;
+}
 
-#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|payload is ready to process|offset=%ld|payload_input_size=%d|captured_lines=%d|data_len=%d|data=%s|logfile='%s'"),
-		EffectiveShippedLogOffset, CapturedOffset, NumCapturedLines, WorkerNextPayload.Len(), *ITLConvertUTF8(WorkerNextPayload.GetData(), WorkerNextPayload.Len()), *SourceLogFile);
-#else
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|payload is ready to process|offset=%ld|payload_input_size=%d|captured_lines=%d|data_len=%d|logfile='%s'"),
-		EffectiveShippedLogOffset, CapturedOffset, NumCapturedLines, WorkerNextPayload.Len(), *SourceLogFile);
-#endif
-	if (NumCapturedLines > 0)
+/** If positive, the UTC time (in ticks) that lines formatted on this thread were originally logged, such as when writing pre-buffered lines. */
+static thread_local int64 GITLLogLineTagUtcTicks = 0;
+
+int32 ITLFormatLogLineTagUTF8(ANSICHAR* Dest, ELogVerbosity::Type Verbosity, const class FName& Category, ELogTimes::Type LogTime, const double Time)
+{
+#if ENGINE_MAJOR_VERSION >= 5
+	ANSICHAR* Out = Dest;
+	switch (LogTime)
 	{
-		if (!WorkerCompressPayload())
-		{
-			UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER: Failed to compress payload: mode=%d"), (int)Settings->CompressionMode);
-			return false;
-		}
-		// Remember that we have a request being attempted (including the size of the read request). This state will be cleared out after a successful request.
-		// We are allowed to write the progress state here if we do not have an overridden state that we are using and we otherwise need to.
-		bool AllowWriteState = WorkerIsAllowedSerializeProgressState() && WorkerOverrideCommonEventJSONData.Num() <= 0;
-		if (WriteProgressMarker(EffectiveShippedLogOffset, NumToRead, AllowWriteState ? &CommonEventJSONData : nullptr) && AllowWriteState)
+		case ELogTimes::None:
+			break;
+		case ELogTimes::SinceGStartTime:
 		{
-			WorkerSerializeCommonEventJSON = false;
+			const double RealTime = (Time == -1.0) ? (FPlatformTime::Seconds() - GStartTime) : Time;
+			Out += FCStringAnsi::Snprintf(Out, 64, "[%07.2f][%3llu]", RealTime, (unsigned long long)(GFrameCounter % 1000));
+			break;
 		}
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|Begin processing payload"));
-		if (!PayloadProcessor->ProcessPayload(WorkerNextEncodedPayload, WorkerNextEncodedPayload.Num(), WorkerNextPayload.Len(), Settings->CompressionMode, WeakThisPtr))
+		case ELogTimes::UTC:
+		case ELogTimes::Local:
 		{
-			UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER: Failed to process payload: offset=%ld, num_read=%d, payload_input_size=%d, logfile='%s'"), EffectiveShippedLogOffset, NumToRead, CapturedOffset, *SourceLogFile);
-			WorkerLastFailedFlushPayloadSize = NumToRead;
-			return false;
+			FDateTime DT = (LogTime == ELogTimes::UTC) ? FDateTime::UtcNow() : FDateTime::Now();
+			if (GITLLogLineTagUtcTicks > 0)
+			{
+				DT = (LogTime == ELogTimes::UTC) ? FDateTime(GITLLogLineTagUtcTicks) : FDateTime(GITLLogLineTagUtcTicks) + (DT - FDateTime::UtcNow());
+			}
+			Out += FCStringAnsi::Snprintf(Out, 64, "[%04d.%02d.%02d-%02d.%02d.%02d:%03d][%3llu]",
+				DT.GetYear(), DT.GetMonth(), DT.GetDay(), DT.GetHour(), DT.GetMinute(), DT.GetSecond(), DT.GetMillisecond(),
+				(unsigned long long)(GFrameCounter % 1000));
+			break;
 		}
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|Finished processing payload|PayloadInputSize=%ld"), CapturedOffset);
+		default:
+			// Timecodes are formatted by the engine; use its (allocating) formatter.
+			return -1;
 	}
-	int ProcessedOffset = CapturedOffset;
-
-	// If we processed everything up until the end of the file, we captured everything we can.
-	OutNewShippedLogOffset = EffectiveShippedLogOffset + ProcessedOffset;
-	if ((int64)(ProcessedOffset) >= RemainingBytes)
+	if (GPrintLogCategory && Category != NAME_None)
 	{
-		OutFlushProcessedEverything = true;
+		TCHAR CategoryName[NAME_SIZE];
+		const int32 CategoryLen = static_cast<int32>(Category.ToString(CategoryName, NAME_SIZE));
+		Out = ITLEncodeUTF8(Out, CategoryName, CategoryLen, false, false);
+		*Out++ = ':';
+		*Out++ = ' ';
 	}
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|END|FlushProcessedEverything=%d"), OutFlushProcessedEverything);
-	return true;
+	if (GPrintLogVerbosity && Verbosity != ELogVerbosity::Log)
+	{
+		const TCHAR* VerbosityName = ToString(Verbosity);
+		Out = ITLEncodeUTF8(Out, VerbosityName, FCString::Strlen(VerbosityName), false, false);
+		*Out++ = ':';
+		*Out++ = ' ';
+	}
+	return static_cast<int32>(Out - Dest);
+#else
+	return -1;
+#endif
 }
 
-bool FsparklogsReadAndStreamToCloud::WorkerDoFlush()
+void FsparklogsOutputDeviceFile::InternalSerializeLine(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time)
 {
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerDoFlush|BEGIN"));
-	int64 ShippedNewLogOffset = 0;
-	bool FlushProcessedEverything = false;
-	bool Result = WorkerInternalDoFlush(ShippedNewLogOffset, FlushProcessedEverything);
-	if (!Result)
+	// When writing to our internal log we transform the data in the following ways:
+	// - Convert any multi-line log messages to use CharInternalNewline so that each log event is logged as a single line of text.
+	// - Remove any completely blank lines at the start and end.
+	// - Prepend extra JSON to explicitly specify the log verbosity (overrides what AutoExtract might detect, especially for "Log" level messages where UE does not explicitly log the severity).
+	// This is done in a single pass directly into a per-thread UTF-8 scratch buffer to avoid allocating on every log line.
+	FITLUTF8Fragment ExtraJSON = { nullptr, 0 };
+	if (Verbosity == ELogVerbosity::Log || !GPrintLogVerbosity || bSuppressEventTag)
 	{
-		WorkerLastFlushFailed.AtomicSet(true);
-		WorkerMinNextFlushPlatformTime = FPlatformTime::Seconds() + WorkerGetRetrySecs();
-		LastFlushProcessedEverything.AtomicSet(false);
-		// Increment this counter after the retry interval is calculated
-		WorkerNumConsecutiveFlushFailures++;
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerDoFlush|internal flush failed|WorkerMinNextFlushPlatformTime=%.3lf|NumConsecutiveFlushFailures=%d"), WorkerMinNextFlushPlatformTime, WorkerNumConsecutiveFlushFailures);
+		// Treat UE log severity as authoritative and make sure it's explicitly encoded if it's not already implicitly encoded in the log text.
+		ExtraJSON = ITLSeverityFragments[(Verbosity & ELogVerbosity::VerbosityMask) % UE_ARRAY_COUNT(ITLSeverityFragments)];
 	}
-	else
+
+	// Format the transformed log line instead of the original
+	int32 MessageBytes = 0;
 	{
-		WorkerLastFlushFailed.AtomicSet(false);
-		WorkerNumConsecutiveFlushFailures = 0;
-		WorkerLastFailedFlushPayloadSize = 0;
-		WorkerShippedLogOffset = ShippedNewLogOffset;
-		WriteProgressMarker(ShippedNewLogOffset, 0, WorkerIsAllowedSerializeProgressState() ? &CommonEventJSONData : nullptr);
-		WorkerSerializeCommonEventJSON = false;
-		WorkerOverrideCommonEventJSONData.Empty();
-		WorkerMinNextFlushPlatformTime = FPlatformTime::Seconds() + Settings->ProcessingIntervalSecs;
-		LastFlushProcessedEverything.AtomicSet(FlushProcessedEverything);
-		FlushSuccessOpCounter.Increment();
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerDoFlush|internal flush succeeded|ShippedNewLogOffset=%d|WorkerMinNextFlushPlatformTime=%.3lf|FlushProcessedEverything=%d"), (int)ShippedNewLogOffset, WorkerMinNextFlushPlatformTime, FlushProcessedEverything ? 1 : 0);
+		FSpoolWriteScope SpoolScope(*this);
+		if (AsyncWriter == nullptr)
+		{
+			return;
+		}
+		MessageBytes = FsparklogsOutputDeviceFile::InternalAddMessageEvent(*AsyncWriter, ExtraJSON.Str, ExtraJSON.Len, Data, Verbosity, Category, Time, bSuppressEventTag, SpoolBinaryRecords.load(std::memory_order_relaxed));
 	}
-	FlushOpCounter.Increment();
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerDoFlush|END|Result=%d"), Result ? 1 : 0);
-	return Result;
+	AccrueWrittenBytes(MessageBytes + 32);
 }
 
-double FsparklogsReadAndStreamToCloud::WorkerGetRetrySecs()
+void FsparklogsOutputDeviceFile::Serialize(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category)
 {
-	double RetrySecs = Settings->RetryIntervalSecs * (WorkerNumConsecutiveFlushFailures + 1);
-	if (RetrySecs > Settings->MaxRetryIntervalSecs)
-	{
-		RetrySecs = Settings->MaxRetryIntervalSecs;
-	}
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerGetRetrySecs=%.3lf"), RetrySecs);
-	return RetrySecs;
+	Serialize(Data, Verbosity, Category, -1.0);
 }
 
-bool FsparklogsReadAndStreamToCloud::WorkerIsAllowedSerializeProgressState()
+void FsparklogsOutputDeviceFile::StartPreBuffer(int32 MaxBytes)
 {
-	// NOTE: don't serialize progress state on mobile/console to minimize size of state
-	return WorkerSerializeCommonEventJSON && !ITLIsMobilePlatform() && !ITLIsConsolePlatform();
+	FScopeLock PreBufferLock(&PreBufferCriticalSection);
+	PreBufferMaxBytes = FMath::Max(0, MaxBytes);
+	PreBufferActive.store(true);
 }
 
-// =============== FsparklogsIndexedLockFile ===============================================================================
-
-FsparklogsIndexedLockFile::FsparklogsIndexedLockFile(int MaxAttempts, const FString& BaseFilePath)
-	: AcquiredLockIndex(0)
+int32 FsparklogsOutputDeviceFile::EndPreBuffer(bool bWrite)
 {
-	for (int Index = 1; Index < MaxAttempts; Index++)
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsOutputDeviceFile_EndPreBuffer);
+	// Holding the lock makes lines logged meanwhile by other threads wait, so they are written after the held lines
+	FScopeLock PreBufferLock(&PreBufferCriticalSection);
+	if (!PreBufferActive.load())
+	{
+		return 0;
+	}
+	int32 NumWritten = 0;
+	if (bWrite)
 	{
-		FString Filename(BaseFilePath);
-		if (Index > 1)
+		PreBufferWriting = true;
+		if (!AsyncWriter && !Failed)
 		{
-			Filename.AppendChar(TEXT('.'));
-			Filename.AppendInt(Index);
+			CreateAsyncWriter();
 		}
-		Filename.Append(TEXT(".lock"));
-		AttemptedLockFile = Filename;
-		uint32 Flags = FILEWRITE_Silent | FILEWRITE_Append;
-		FArchive* Ar = IFileManager::Get().CreateFileWriter(*Filename, Flags);
-		if (Ar != nullptr)
+		if (AsyncWriter)
 		{
-			LockFileArchive = TUniquePtr<FArchive>(Ar);
-			AcquiredLockIndex = Index;
-			break;
+			// Not rate limited, the pre-buffer budget already bounds how many lines are held
+			for (const FPreBufferedLine& Line : PreBufferedLines)
+			{
+				GITLLogLineTagUtcTicks = Line.UtcTicks;
+				InternalSerializeLine(*Line.Data, Line.Verbosity, Line.Category, Line.Time);
+				NumWritten++;
+			}
+			GITLLogLineTagUtcTicks = 0;
 		}
+		PreBufferWriting = false;
 	}
-	if (!AcquiredLockIndex)
-	{
-		LockFileArchive.Reset(nullptr);
-		// Leave AttemptedLockFile so we know the last attempted lockfile
-	}
+	PreBufferedLines.Empty();
+	PreBufferedBytes = 0;
+	PreBufferActive.store(false);
+	return NumWritten;
 }
 
-FsparklogsIndexedLockFile::~FsparklogsIndexedLockFile()
+bool FsparklogsOutputDeviceFile::PreBufferLine(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time)
 {
-	if (LockFileArchive.IsValid())
+	FScopeLock PreBufferLock(&PreBufferCriticalSection);
+	if (!PreBufferActive.load(std::memory_order_relaxed) || PreBufferWriting)
 	{
-		LockFileArchive->Close();
-		if (!AttemptedLockFile.IsEmpty())
-		{
-			// If this races because another process already acquired the lock, the delete will fail, which is fine.
-			IFileManager::Get().Delete(*AttemptedLockFile, false, false, true);
-		}
-		LockFileArchive.Reset(nullptr);
+		return false;
 	}
+	const int32 DataLen = FCString::Strlen(Data);
+	const int64 LineBytes = (int64)sizeof(FPreBufferedLine) + (int64)(DataLen + 1) * sizeof(TCHAR);
+	if (PreBufferedBytes + LineBytes > PreBufferMaxBytes)
+	{
+		NumPreBufferDroppedLines.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	PreBufferedBytes += LineBytes;
+	FPreBufferedLine& Line = PreBufferedLines.AddDefaulted_GetRef();
+	Line.Data = FString(DataLen, Data);
+	Line.Category = Category;
+	Line.Verbosity = Verbosity;
+	// Capture the time now since the line is formatted later (-1 means the formatter would use the current time)
+	Line.Time = (Time >= 0.0) ? Time : (FPlatformTime::Seconds() - GStartTime);
+	Line.UtcTicks = FDateTime::UtcNow().GetTicks();
+	return true;
 }
 
-// =============== FsparklogsOutputDeviceFile ===============================================================================
+// A run of repeated lines is reported at least this often, even if the line keeps repeating
+static constexpr double ITLMaxRepeatRunSecs = 5.0;
 
-FsparklogsOutputDeviceFile::FsparklogsOutputDeviceFile(const TCHAR* InFilename, TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> CloudStreamer)
-: Failed(false)
-, ForceLogFlush(false)
-, AsyncWriter(nullptr)
-, WriterArchive(nullptr)
-, CloudStreamerWeakPtr(CloudStreamer)
+/** FNV-1a over the code units of the message, seeded with the category and verbosity. Stops at the terminating null so the message is read once. */
+static FORCEINLINE uint64 ITLHashLogLine(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category)
 {
-	Filename = InFilename;
-	ForceLogFlush = FParse::Param(FCommandLine::Get(), TEXT("FORCELOGFLUSH"));
+	uint64 Hash = 14695981039346656037ULL ^ (((uint64)GetTypeHash(Category) << 8) | (uint64)(Verbosity & ELogVerbosity::VerbosityMask));
+	for (const TCHAR* C = Data; *C; C++)
+	{
+		Hash = (Hash ^ ((uint64)(*C) & ITLTCHARCodeUnitMask)) * 1099511628211ULL;
+	}
+	return Hash;
 }
 
-FsparklogsOutputDeviceFile::~FsparklogsOutputDeviceFile()
+void FsparklogsOutputDeviceFile::SetLogSuppression(double LinesPerSec, int32 BurstLines, bool bCoalesceRepeats)
 {
-	TearDown();
+	FScopeLock SuppressionLock(&SuppressionCriticalSection);
+	SuppressionConfig.DefaultRateLimit.LinesPerSec = LinesPerSec;
+	SuppressionConfig.DefaultRateLimit.BurstLines = FMath::Max(1, BurstLines);
+	SuppressionConfig.CoalesceRepeats = bCoalesceRepeats;
+	UpdateSuppressionConfig();
 }
 
-void FsparklogsOutputDeviceFile::SetCloudStreamer(TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> CloudStreamer)
+void FsparklogsOutputDeviceFile::SetCategoryRateLimit(const class FName& InCategoryName, double LinesPerSec, int32 BurstLines)
 {
-	CloudStreamerWeakPtr = TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(CloudStreamer);
+	FScopeLock SuppressionLock(&SuppressionCriticalSection);
+	FRateLimit& Limit = SuppressionConfig.CategoryRateLimits.FindOrAdd(InCategoryName);
+	Limit.LinesPerSec = LinesPerSec;
+	Limit.BurstLines = FMath::Max(1, BurstLines);
+	UpdateSuppressionConfig();
 }
 
-void FsparklogsOutputDeviceFile::TearDown()
+void FsparklogsOutputDeviceFile::UpdateSuppressionConfig()
 {
-	if (AsyncWriter)
-	{
-		FAsyncWriter* DeletedAsyncWriter = AsyncWriter;
-		AsyncWriter = nullptr;
-		delete DeletedAsyncWriter;
-	}
-	if (WriterArchive)
+	bool Active = SuppressionConfig.CoalesceRepeats || SuppressionConfig.DefaultRateLimit.LinesPerSec > 0.0;
+	for (const TPair<FName, FRateLimit>& CategoryLimit : SuppressionConfig.CategoryRateLimits)
 	{
-		FArchive* DeletedWriterArchive = WriterArchive;
-		WriterArchive = nullptr;
-		delete DeletedWriterArchive;
+		Active = Active || CategoryLimit.Value.LinesPerSec > 0.0;
 	}
-	Filename = FString();
+	// Each thread applies the new limits to its buckets when it checks its next line
+	SuppressionConfig.Version++;
+	SuppressionConfigVersion.store(SuppressionConfig.Version);
+	SuppressionActive.store(Active);
 }
 
-void FsparklogsOutputDeviceFile::Flush()
+FsparklogsOutputDeviceFile::FThreadSuppression* FsparklogsOutputDeviceFile::GetThreadSuppression()
 {
-	if (AsyncWriter)
+	TArray<FITLThreadSuppressionSlot, TInlineAllocator<ITLMaxThreadSuppressionSlots>>& Slots = GITLThreadSuppression;
+	for (const FITLThreadSuppressionSlot& Slot : Slots)
+	{
+		if (Slot.Owner == this && Slot.Generation == SuppressionGeneration)
+		{
+			return (FThreadSuppression*)Slot.State;
+		}
+	}
+	// First line this thread checks against this device (the only time it allocates)
+	FScopeLock SuppressionLock(&SuppressionCriticalSection);
+	FThreadSuppression* State = ThreadSuppressions.Add_GetRef(MakeUnique<FThreadSuppression>(ITLGetThreadToken())).Get();
+	if (Slots.Num() >= ITLMaxThreadSuppressionSlots)
 	{
-		AsyncWriter->Flush();
+		Slots.RemoveAt(0);
 	}
+	Slots.Add({ this, SuppressionGeneration, State });
+	return State;
 }
 
-void FsparklogsOutputDeviceFile::Serialize(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time)
+bool FsparklogsOutputDeviceFile::ShouldSuppressLine(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category)
 {
-	if (!ShouldLogCategory(Category) || Verbosity == ELogVerbosity::SetColor)
+	if ((Verbosity & ELogVerbosity::VerbosityMask) == ELogVerbosity::Fatal)
 	{
-		return;
+		return false;
 	}
-
-	static bool WithinCriticalError = false;
-	if (GIsCriticalError && !WithinCriticalError)
+	FThreadSuppression& State = *GetThreadSuppression();
+	// Copied before taking the lock of the state, since flushing summaries takes both locks in the other order
+	TOptional<FSuppressionConfig> NewConfig;
+	if (State.Config.Version != SuppressionConfigVersion.load())
 	{
-		WithinCriticalError = true;
-		Serialize(Data, Verbosity, Category, Time);
-		WithinCriticalError = false;
+		FScopeLock SuppressionLock(&SuppressionCriticalSection);
+		NewConfig = SuppressionConfig;
 	}
-	else
+	const double Now = FPlatformTime::Seconds();
+	TArray<FSuppressionSummary, TInlineAllocator<2>> Summaries;
+	bool Suppress = false;
 	{
-		if (!AsyncWriter && !Failed)
+		FScopeLock StateLock(&State.CriticalSection);
+		if (NewConfig.IsSet())
 		{
-			CreateAsyncWriter();
+			State.Config = MoveTemp(NewConfig.GetValue());
+			for (TPair<TTuple<FName, uint8>, FRateBucket>& Bucket : State.RateBuckets)
+			{
+				const FRateLimit* CategoryLimit = State.Config.CategoryRateLimits.Find(Bucket.Key.Get<0>());
+				Bucket.Value.Limit = (CategoryLimit != nullptr) ? *CategoryLimit : State.Config.DefaultRateLimit;
+				Bucket.Value.Tokens = FMath::Min(Bucket.Value.Tokens, (double)Bucket.Value.Limit.BurstLines);
+			}
+			if (!State.Config.CoalesceRepeats)
+			{
+				if (State.NumRepeats > 0)
+				{
+					Summaries.Add(TakeRepeatSummary(State));
+				}
+				State.LastLineHash = 0;
+				State.LastLineText.Empty();
+			}
 		}
-		if (AsyncWriter)
+		const bool Coalesce = State.Config.CoalesceRepeats;
+		const uint64 Hash = Coalesce ? ITLHashLogLine(Data, Verbosity, Category) : 0;
+		if (Coalesce && Hash == State.LastLineHash && Category == State.LastLineCategory && Verbosity == State.LastLineVerbosity)
 		{
-			if (WithinCriticalError)
+			if (State.NumRepeats == 0)
 			{
-				// Minimize unnecessary allocations or processing and just try to log while we possibly still can.
-				FOutputDeviceHelper::FormatCastAndSerializeLine(*AsyncWriter, Data, Verbosity, Category, Time, bSuppressEventTag, bAutoEmitLineTerminator);
-				// Do not accrue written bytes in this situation
+				State.FirstRepeatTime = Now;
 			}
-			else
+			State.NumRepeats++;
+			State.LastRepeatTime = Now;
+			Suppress = true;
+			if (Now - State.FirstRepeatTime >= ITLMaxRepeatRunSecs)
+			{
+				// Report long runs periodically so the count is not held back for as long as the line repeats
+				Summaries.Add(TakeRepeatSummary(State));
+			}
+		}
+		else
+		{
+			if (Coalesce)
+			{
+				if (State.NumRepeats > 0)
+				{
+					Summaries.Add(TakeRepeatSummary(State));
+				}
+				State.LastLineHash = Hash;
+				State.LastLineCategory = Category;
+				State.LastLineVerbosity = Verbosity;
+				// Reuses the allocation of the previous line
+				State.LastLineText.Reset();
+				State.LastLineText.Append(Data);
+			}
+			const FRateLimit* CategoryLimit = State.Config.CategoryRateLimits.Find(Category);
+			const FRateLimit& Limit = (CategoryLimit != nullptr) ? *CategoryLimit : State.Config.DefaultRateLimit;
+			if (Limit.LinesPerSec > 0.0)
 			{
-				// When writing to our internal log we transform the data in the following ways:
-				// - Convert any multi-line log messages to use CharInternalNewline so that each log event is logged as a single line of text.
-				// - Remove any completely blank lines at the start and end.
-				// - Prepend extra JSON to explicitly specify the log verbosity (overrides what AutoExtract might detect, especially for "Log" level messages where UE does not explicitly log the severity).
-				FString DataStr = Data;
-				// Replace windows or linux style newlines with a single StrCharInternalNewline character.
-				DataStr.ReplaceCharInline(TEXT('\n'), StrCharInternalNewline[0], ESearchCase::CaseSensitive);
-				DataStr.ReplaceInline(TEXT("\r"), TEXT(""), ESearchCase::CaseSensitive);
-				ITLFStringTrimCharStartEndInline(DataStr, StrCharInternalNewline[0]);
-				FString ExtraJSON;
-				if (Verbosity == ELogVerbosity::Log || !GPrintLogVerbosity || bSuppressEventTag)
+				FRateBucket* Bucket = State.RateBuckets.Find(MakeTuple(Category, (uint8)Verbosity));
+				if (Bucket == nullptr)
+				{
+					// Only allocates the first time the thread logs in a category at a verbosity
+					Bucket = &State.RateBuckets.Add(MakeTuple(Category, (uint8)Verbosity));
+					Bucket->Limit = Limit;
+					Bucket->Tokens = (double)Limit.BurstLines;
+					Bucket->LastRefillTime = Now;
+				}
+				Bucket->Tokens = FMath::Min((double)Bucket->Limit.BurstLines, Bucket->Tokens + (Now - Bucket->LastRefillTime) * Bucket->Limit.LinesPerSec);
+				Bucket->LastRefillTime = Now;
+				if (Bucket->Tokens >= 1.0)
 				{
-					ExtraJSON.Reserve(31);
-					// Treat UE log severity as authoritative and make sure it's explicitly encoded if it's not already implicitly encoded in the log text.
-					if (ExtraJSON.Len() > 0)
+					Bucket->Tokens -= 1.0;
+					if (Bucket->NumSuppressed > 0)
 					{
-						ExtraJSON += ", ";
+						Summaries.Add({ Category, Verbosity, false, Bucket->NumSuppressed, Bucket->FirstSuppressedTime, Bucket->LastSuppressedTime });
+						Bucket->NumSuppressed = 0;
 					}
-					ExtraJSON += "\"severity\": \"";
-					ExtraJSON += ITLSeverityToString(Verbosity);
-					ExtraJSON += "\"";
 				}
+				else
+				{
+					if (Bucket->NumSuppressed == 0)
+					{
+						Bucket->FirstSuppressedTime = Now;
+					}
+					Bucket->NumSuppressed++;
+					Bucket->LastSuppressedTime = Now;
+					Suppress = true;
+					if (Coalesce)
+					{
+						// A dropped line was never written, so the next line cannot be folded into it
+						State.LastLineHash = 0;
+					}
+				}
+			}
+		}
+	}
+	if (Suppress)
+	{
+		NumSuppressedLines.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (Summaries.Num() > 0)
+	{
+		WriteSuppressionSummaries(Summaries);
+	}
+	return Suppress;
+}
 
-				// Format the transformed log line instead of the original
-				FsparklogsOutputDeviceFile::InternalAddMessageEvent(*AsyncWriter, ExtraJSON, *DataStr, Verbosity, Category, Time, bSuppressEventTag);
-				AccrueWrittenBytes(DataStr.Len() + 32);
+void FsparklogsOutputDeviceFile::FlushSuppressionSummaries()
+{
+	TArray<FSuppressionSummary> Summaries;
+	{
+		FScopeLock SuppressionLock(&SuppressionCriticalSection);
+		for (const TUniquePtr<FThreadSuppression>& State : ThreadSuppressions)
+		{
+			FScopeLock StateLock(&State->CriticalSection);
+			if (State->NumRepeats > 0)
+			{
+				Summaries.Add(TakeRepeatSummary(*State));
 			}
-			if (ForceLogFlush)
+			for (TPair<TTuple<FName, uint8>, FRateBucket>& Bucket : State->RateBuckets)
 			{
-				Flush();
+				if (Bucket.Value.NumSuppressed > 0)
+				{
+					Summaries.Add({ Bucket.Key.Get<0>(), (ELogVerbosity::Type)Bucket.Key.Get<1>(), false, Bucket.Value.NumSuppressed, Bucket.Value.FirstSuppressedTime, Bucket.Value.LastSuppressedTime });
+					Bucket.Value.NumSuppressed = 0;
+				}
 			}
 		}
+		// Nothing is left to report for threads that have exited, and they will never check another line
+		ThreadSuppressions.RemoveAll([](const TUniquePtr<FThreadSuppression>& State) { return !State->OwnerToken.IsValid(); });
+	}
+	if (Summaries.Num() > 0)
+	{
+		WriteSuppressionSummaries(Summaries);
 	}
 }
 
-void FsparklogsOutputDeviceFile::Serialize(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category)
+FsparklogsOutputDeviceFile::FSuppressionSummary FsparklogsOutputDeviceFile::TakeRepeatSummary(FThreadSuppression& State)
 {
-	Serialize(Data, Verbosity, Category, -1.0);
+	FSuppressionSummary Summary{ State.LastLineCategory, State.LastLineVerbosity, true, State.NumRepeats, State.FirstRepeatTime, State.LastRepeatTime };
+	if (State.NumRepeats == 1)
+	{
+		// A summary would take as much room as the line itself and be harder to read
+		Summary.RepeatedLine = State.LastLineText;
+		NumSuppressedLines.fetch_sub(1, std::memory_order_relaxed);
+	}
+	State.NumRepeats = 0;
+	return Summary;
 }
 
-void FsparklogsOutputDeviceFile::InternalAddMessageEvent(FArchive& Output, FString& RawJSON, const TCHAR* Message, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time, bool bSuppressEventTag)
+void FsparklogsOutputDeviceFile::WriteSuppressionSummaries(const TArrayView<const FSuppressionSummary> Summaries)
 {
-	// In general, make logs follow Windows convention
-#if PLATFORM_UNIX
-	static const TCHAR* Terminator = TEXT("\r\n");
-#else
-	static const TCHAR* Terminator = LINE_TERMINATOR;
-#endif // PLATFORM_UNIX
-	static const int32 TerminatorLength = FCString::Strlen(Terminator);
-	static const int32 ConvertedTerminatorLength = FTCHARToUTF8_Convert::ConvertedLength(Terminator, TerminatorLength);
-
-	const int32 RawJSONLength = RawJSON.Len();
-	int32 ConvertedRawJSONLength = FTCHARToUTF8_Convert::ConvertedLength(*RawJSON, RawJSONLength);
-	if (ConvertedRawJSONLength > 0)
+	if (!AsyncWriter)
 	{
-		// Add room for the starting and ending marker characters
-		ConvertedRawJSONLength += 2;
+		return;
 	}
-
-	FString EventTag;
-	if (!bSuppressEventTag)
+	if (RingCaptureActive.load(std::memory_order_relaxed))
+	{
+		// Make sure the summary lands after the lines it refers to
+		DrainRings();
+	}
+	const FDateTime UtcNow = FDateTime::UtcNow();
+	const double Now = FPlatformTime::Seconds();
+	for (const FSuppressionSummary& Summary : Summaries)
 	{
-		EventTag = FOutputDeviceHelper::FormatLogLine(Verbosity, Category, nullptr, GPrintLogTimes, Time);
+		if (Summary.IsRepeat && Summary.Count < 2)
+		{
+			int32 LineBytes = 0;
+			{
+				FSpoolWriteScope SpoolScope(*this);
+				if (AsyncWriter == nullptr)
+				{
+					return;
+				}
+				LineBytes = FsparklogsOutputDeviceFile::InternalAddMessageEvent(*AsyncWriter, nullptr, 0, *Summary.RepeatedLine, Summary.Verbosity, Summary.Category, -1.0, bSuppressEventTag, SpoolBinaryRecords.load(std::memory_order_relaxed));
+			}
+			AccrueWrittenBytes(LineBytes + 32);
+			continue;
+		}
+		const FString FirstTimestamp = (UtcNow - FTimespan::FromSeconds(Now - Summary.FirstTime)).ToIso8601();
+		const FString LastTimestamp = (UtcNow - FTimespan::FromSeconds(Now - Summary.LastTime)).ToIso8601();
+		const FString Fields = FString::Printf(TEXT("\"severity\": \"%s\", \"%s_count\": %d, \"%s_first_timestamp\": \"%s\", \"%s_last_timestamp\": \"%s\""),
+			ITLSeverityToString(Summary.Verbosity), Summary.IsRepeat ? TEXT("log_repeat") : TEXT("log_suppressed"), Summary.Count,
+			Summary.IsRepeat ? TEXT("log_repeat") : TEXT("log_suppressed"), *FirstTimestamp,
+			Summary.IsRepeat ? TEXT("log_repeat") : TEXT("log_suppressed"), *LastTimestamp);
+		FTCHARToUTF8 FieldsUTF8(*Fields);
+		TArray<ANSICHAR, TInlineAllocator<256>> Fragment;
+		Fragment.Add((ANSICHAR)CharInternalJSONStart);
+		Fragment.Append((const ANSICHAR*)FieldsUTF8.Get(), FieldsUTF8.Length());
+		Fragment.Add((ANSICHAR)CharInternalJSONEnd);
+		const FString Message = Summary.IsRepeat
+			? FString::Printf(TEXT("Previous message repeated %d more times"), Summary.Count)
+			: FString::Printf(TEXT("Suppressed %d messages that exceeded the log rate limit"), Summary.Count);
+		int32 MessageBytes = 0;
+		{
+			FSpoolWriteScope SpoolScope(*this);
+			if (AsyncWriter == nullptr)
+			{
+				return;
+			}
+			MessageBytes = FsparklogsOutputDeviceFile::InternalAddMessageEvent(*AsyncWriter, Fragment.GetData(), Fragment.Num(), *Message, Summary.Verbosity, Summary.Category, -1.0, bSuppressEventTag, SpoolBinaryRecords.load(std::memory_order_relaxed));
+		}
+		AccrueWrittenBytes(MessageBytes + 32);
 	}
-	const int32 EventTagLength = EventTag.Len();
-	const int32 ConvertedEventTagLength = FTCHARToUTF8_Convert::ConvertedLength(*EventTag, EventTagLength);
+}
 
-	const int32 MessageLength = (Message == nullptr) ? 0 : FCString::Strlen(Message);
-	const int32 ConvertedMessageLength = (Message == nullptr) ? 0 : FTCHARToUTF8_Convert::ConvertedLength(Message, MessageLength);
+int32 FsparklogsOutputDeviceFile::InternalAddMessageEvent(FArchive& Output, const ANSICHAR* RawJSONFragment, int32 RawJSONFragmentLen, const TCHAR* Message, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time, bool bSuppressEventTag, bool bBinaryRecords)
+{
+	// Trim blank lines from the start and end of the message
+	int32 MessageStart = 0;
+	int32 MessageEnd = (Message == nullptr) ? 0 : FCString::Strlen(Message);
+	auto IsBlankLineChar = [](TCHAR c) { return c == TEXT('\n') || c == TEXT('\r') || c == StrCharInternalNewline[0]; };
+	while (MessageStart < MessageEnd && IsBlankLineChar(Message[MessageStart]))
+	{
+		MessageStart++;
+	}
+	while (MessageEnd > MessageStart && IsBlankLineChar(Message[MessageEnd - 1]))
+	{
+		MessageEnd--;
+	}
+	const int32 MessageLength = MessageEnd - MessageStart;
 
-	TArray<ANSICHAR, TInlineAllocator<2 * DEFAULT_STRING_CONVERSION_SIZE>> ConvertedEventData;
-	ConvertedEventData.AddUninitialized(ConvertedRawJSONLength + ConvertedEventTagLength + ConvertedMessageLength + ConvertedTerminatorLength);
-	if (ConvertedRawJSONLength > 0)
+	ANSICHAR* Buffer = ITLGetEventScratch(RawJSONFragmentLen + (bSuppressEventTag ? 0 : ITLMaxLogLineTagUTF8Len) + (MessageLength * ITLMaxUTF8BytesPerTCHAR) + ITLLineTerminatorUTF8Len);
+	ANSICHAR* Out = Buffer;
+	if (RawJSONFragmentLen > 0)
 	{
-		ConvertedEventData.GetData()[0] = CharInternalJSONStart;
-		FTCHARToUTF8_Convert::Convert(ConvertedEventData.GetData() + 1, ConvertedRawJSONLength - 2, *RawJSON, RawJSONLength);
-		ConvertedEventData.GetData()[ConvertedRawJSONLength - 1] = CharInternalJSONEnd;
+		FMemory::Memcpy(Out, RawJSONFragment, RawJSONFragmentLen);
+		Out += RawJSONFragmentLen;
 	}
-	if (ConvertedEventTagLength > 0)
+	if (!bSuppressEventTag)
 	{
-		FTCHARToUTF8_Convert::Convert(ConvertedEventData.GetData() + ConvertedRawJSONLength, ConvertedEventTagLength, *EventTag, EventTagLength);
+		const int32 EventTagLength = ITLFormatLogLineTagUTF8(Out, Verbosity, Category, GPrintLogTimes, Time);
+		if (EventTagLength >= 0)
+		{
+			Out += EventTagLength;
+		}
+		else
+		{
+			const FString EventTag = FOutputDeviceHelper::FormatLogLine(Verbosity, Category, nullptr, GPrintLogTimes, Time);
+			Out = ITLEncodeUTF8(Out, *EventTag, FMath::Min(EventTag.Len(), ITLMaxLogLineTagUTF8Len / ITLMaxUTF8BytesPerTCHAR), false, false);
+		}
 	}
-	if (ConvertedMessageLength > 0)
+	ANSICHAR* MessageOut = Out;
+	Out = ITLEncodeUTF8(Out, Message + MessageStart, MessageLength, true, true);
+	const int32 ConvertedMessageLength = static_cast<int32>(Out - MessageOut);
+	FMemory::Memcpy(Out, ITLLineTerminatorUTF8, ITLLineTerminatorUTF8Len);
+	Out += ITLLineTerminatorUTF8Len;
+
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("OUTPUTDEVICEFILE|InternalAddMessageEvent|Message=%s|RawJSONFragmentLen=%d|ConvertedMessageLen=%d|TotalLen=%d|Converted[0,1,2,3,4,5]=%d,%d,%d,%d,%d,%d"),
+		Message, RawJSONFragmentLen, ConvertedMessageLength, (int)(Out - Buffer),
+		(int)Buffer[0], (int)Buffer[1], (int)Buffer[2], (int)Buffer[3], (int)Buffer[4], (int)Buffer[5]);
+	ITLSerializeLines(Output, Buffer, (int32)(Out - Buffer), bBinaryRecords, (uint8)(Verbosity & ELogVerbosity::VerbosityMask));
+	return ConvertedMessageLength;
+}
+
+bool FsparklogsOutputDeviceFile::AddRawEvent(const TCHAR* RawJSON, const TCHAR* Message)
+{
+	return InternalAddRawEvent(nullptr, 0, nullptr, 0, RawJSON, (RawJSON == nullptr) ? 0 : FCString::Strlen(RawJSON), Message);
+}
+
+/** The most bytes ITLFrameRawEvent can write for an event with the given lengths. */
+static FORCEINLINE int32 ITLMaxFramedRawEventLen(int32 RawJSONUTF8Length, int32 RawJSONLength, int32 MessageLength)
+{
+	// Room for the starting and ending marker characters and the commas between the parts of the JSON
+	return RawJSONUTF8Length + 4 + ((RawJSONLength + MessageLength) * ITLMaxUTF8BytesPerTCHAR) + ITLLineTerminatorUTF8Len;
+}
+
+/** Writes one raw event line (JSON parts as described by InternalAddRawEvent, then the message) to Out. Returns the end of what was written. */
+static ANSICHAR* ITLFrameRawEvent(ANSICHAR* Out, const ANSICHAR* RawJSONPrefix, int32 RawJSONPrefixLen, const ANSICHAR* RawJSONUTF8, int32 RawJSONUTF8Length, const TCHAR* RawJSON, int32 RawJSONLength, const TCHAR* Message, int32 MessageLength)
+{
+	const bool HasJSON = RawJSONPrefixLen > 0 || RawJSONUTF8Length > 0 || RawJSONLength > 0;
+	if (HasJSON)
 	{
-		FTCHARToUTF8_Convert::Convert(ConvertedEventData.GetData() + ConvertedRawJSONLength + ConvertedEventTagLength, ConvertedMessageLength, Message, MessageLength);
+		*Out++ = CharInternalJSONStart;
+		const ANSICHAR* JSONStart = Out;
+		if (RawJSONPrefixLen > 0)
+		{
+			FMemory::Memcpy(Out, RawJSONPrefix, RawJSONPrefixLen);
+			Out += RawJSONPrefixLen;
+		}
+		if (RawJSONUTF8Length > 0)
+		{
+			if (Out > JSONStart)
+			{
+				*Out++ = ',';
+			}
+			FMemory::Memcpy(Out, RawJSONUTF8, RawJSONUTF8Length);
+			Out += RawJSONUTF8Length;
+		}
+		if (RawJSONLength > 0)
+		{
+			if (Out > JSONStart)
+			{
+				*Out++ = ',';
+			}
+			Out = ITLEncodeUTF8(Out, RawJSON, RawJSONLength, false, false);
+		}
+		*Out++ = CharInternalJSONEnd;
 	}
-	FTCHARToUTF8_Convert::Convert(ConvertedEventData.GetData() + ConvertedRawJSONLength + ConvertedEventTagLength + ConvertedMessageLength, ConvertedTerminatorLength, Terminator, TerminatorLength);
-
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("OUTPUTDEVICEFILE|InternalAddMessageEvent|RawJSON=%s|Message=%s|EventTag=%s|ConvertedRawJSONLen=%d|ConvertedMessageLen=%d|ConvertedEventTagLen=%d|ConvertedTerminatorLen=%d|Converted[0,1,2,3,4,5]=%d,%d,%d,%d,%d,%d"),
-		*RawJSON, Message, *EventTag, ConvertedRawJSONLength, ConvertedMessageLength, ConvertedEventTagLength, ConvertedTerminatorLength,
-		(int)ConvertedEventData.GetData()[0], (int)ConvertedEventData.GetData()[1], (int)ConvertedEventData.GetData()[2], (int)ConvertedEventData.GetData()[3], (int)ConvertedEventData.GetData()[4], (int)ConvertedEventData.GetData()[5]);
-	Output.Serialize(ConvertedEventData.GetData(), ConvertedEventData.Num() * sizeof(ANSICHAR));
+	// Any newline characters in the actual message must be replaced with the placeholder character to preserve multi-line log messages.
+	Out = ITLEncodeUTF8(Out, Message, MessageLength, true, false);
+	FMemory::Memcpy(Out, ITLLineTerminatorUTF8, ITLLineTerminatorUTF8Len);
+	return Out + ITLLineTerminatorUTF8Len;
 }
 
-bool FsparklogsOutputDeviceFile::AddRawEvent(const TCHAR* RawJSON, const TCHAR* Message)
+bool FsparklogsOutputDeviceFile::InternalAddRawEvent(const ANSICHAR* RawJSONPrefix, int32 RawJSONPrefixLen, const ANSICHAR* RawJSONUTF8, int32 RawJSONUTF8Length, const TCHAR* RawJSON, int32 RawJSONLength, const TCHAR* Message)
 {
 	if (!AsyncWriter && !Failed)
 	{
@@ -2721,80 +8555,128 @@ bool FsparklogsOutputDeviceFile::AddRawEvent(const TCHAR* RawJSON, const TCHAR*
 		return false;
 	}
 
-	if (RawJSON != nullptr && *RawJSON == 0)
+	if (RawJSON == nullptr)
 	{
-		RawJSON = nullptr;
+		RawJSONLength = 0;
 	}
-	if (Message != nullptr && *Message == 0)
+	const int32 MessageLength = (Message == nullptr) ? 0 : FCString::Strlen(Message);
+
+	if (RawJSONUTF8 == nullptr)
 	{
-		Message = nullptr;
+		RawJSONUTF8Length = 0;
 	}
+	ANSICHAR* Buffer = ITLGetEventScratch(RawJSONPrefixLen + ITLMaxFramedRawEventLen(RawJSONUTF8Length, RawJSONLength, MessageLength));
+	ANSICHAR* Out = ITLFrameRawEvent(Buffer, RawJSONPrefix, RawJSONPrefixLen, RawJSONUTF8, RawJSONUTF8Length, RawJSON, RawJSONLength, Message, MessageLength);
 
-	// In general, make logs follow Windows convention
-#if PLATFORM_UNIX
-	static const TCHAR* Terminator = TEXT("\r\n");
-#else
-	static const TCHAR* Terminator = LINE_TERMINATOR;
-#endif // PLATFORM_UNIX
-	static const int32 TerminatorLength = FCString::Strlen(Terminator);
-	static const int32 ConvertedTerminatorLength = FTCHARToUTF8_Convert::ConvertedLength(Terminator, TerminatorLength);
-
-	const int32 RawJSONLength = (RawJSON == nullptr) ? 0 : FCString::Strlen(RawJSON);
-	int32 ConvertedRawJSONLength = (RawJSON == nullptr) ? 0 : FTCHARToUTF8_Convert::ConvertedLength(RawJSON, RawJSONLength);
-	if (ConvertedRawJSONLength > 0)
+	int32 TotalLength = static_cast<int32>(Out - Buffer);
 	{
-		// Add room for the starting and ending marker characters
-		ConvertedRawJSONLength += 2;
+		FSpoolWriteScope SpoolScope(*this);
+		if (AsyncWriter == nullptr)
+		{
+			return false;
+		}
+		MarkSpoolSegmentProtected();
+		TotalLength = ITLSerializeLines(*AsyncWriter, Buffer, TotalLength, SpoolBinaryRecords.load(std::memory_order_relaxed), ELogVerbosity::NoLogging);
 	}
+	AccrueWrittenBytes(TotalLength * sizeof(ANSICHAR));
+	return true;
+}
 
-	const int32 MessageLength = (Message == nullptr) ? 0 : FCString::Strlen(Message);
-	const int32 ConvertedMessageLength = (Message == nullptr) ? 0 : FTCHARToUTF8_Convert::ConvertedLength(Message, MessageLength);
-
-	TArray<ANSICHAR, TInlineAllocator<2 * DEFAULT_STRING_CONVERSION_SIZE>> ConvertedEventData;
-	ConvertedEventData.AddUninitialized(ConvertedRawJSONLength + ConvertedMessageLength + ConvertedTerminatorLength);
-	if (ConvertedRawJSONLength > 0)
+bool FsparklogsOutputDeviceFile::AddRawEventsUTF8(int32 NumEvents, const ANSICHAR* RawJSONUTF8, const int32* RawJSONEnds, const TCHAR* Messages, const int32* MessageEnds)
+{
+	if (NumEvents <= 0)
+	{
+		return true;
+	}
+	if (!AsyncWriter && !Failed)
 	{
-		ConvertedEventData.GetData()[0] = CharInternalJSONStart;
-		FTCHARToUTF8_Convert::Convert(ConvertedEventData.GetData() + 1, ConvertedRawJSONLength - 2, RawJSON, RawJSONLength);
-		ConvertedEventData.GetData()[ConvertedRawJSONLength - 1] = CharInternalJSONEnd;
+		CreateAsyncWriter();
 	}
-	if (ConvertedMessageLength > 0)
+	if (!AsyncWriter)
 	{
-		FTCHARToUTF8_Convert::Convert(ConvertedEventData.GetData() + ConvertedRawJSONLength, ConvertedMessageLength, Message, MessageLength);
+		return false;
 	}
-	FTCHARToUTF8_Convert::Convert(ConvertedEventData.GetData() + ConvertedRawJSONLength + ConvertedMessageLength, ConvertedTerminatorLength, Terminator, TerminatorLength);
 
-	// Any newline characters in the actual message must be replaced with the placeholder character to preserve multi-line log messages.
-	ANSICHAR* EventDataBuffer = ConvertedEventData.GetData();
-	for (int Index = ConvertedRawJSONLength; Index < (ConvertedRawJSONLength + ConvertedMessageLength); Index++)
+	// Events are framed into the thread's scratch and written together, in chunks of at most this many bytes so a huge batch does not
+	// permanently grow the scratch buffer (a single event larger than this is written on its own).
+	constexpr int32 MaxChunkLength = 1024 * 1024;
+	int32 ChunkFirst = 0;
+	while (ChunkFirst < NumEvents)
 	{
-		if (EventDataBuffer[Index] == '\n')
+		int32 ChunkEnd = ChunkFirst;
+		int32 MaxLength = 0;
+		while (ChunkEnd < NumEvents)
+		{
+			const int32 RawJSONStart = (ChunkEnd > 0) ? RawJSONEnds[ChunkEnd - 1] : 0;
+			const int32 MessageStart = (ChunkEnd > 0) ? MessageEnds[ChunkEnd - 1] : 0;
+			const int32 EventMaxLength = ITLMaxFramedRawEventLen(RawJSONEnds[ChunkEnd] - RawJSONStart, 0, MessageEnds[ChunkEnd] - MessageStart);
+			if (ChunkEnd > ChunkFirst && MaxLength + EventMaxLength > MaxChunkLength)
+			{
+				break;
+			}
+			MaxLength += EventMaxLength;
+			ChunkEnd++;
+		}
+
+		ANSICHAR* Buffer = ITLGetEventScratch(MaxLength);
+		ANSICHAR* Out = Buffer;
+		for (int32 i = ChunkFirst; i < ChunkEnd; ++i)
 		{
-			EventDataBuffer[Index] = CharInternalNewline;
+			const int32 RawJSONStart = (i > 0) ? RawJSONEnds[i - 1] : 0;
+			const int32 MessageStart = (i > 0) ? MessageEnds[i - 1] : 0;
+			Out = ITLFrameRawEvent(Out, nullptr, 0, RawJSONUTF8 + RawJSONStart, RawJSONEnds[i] - RawJSONStart, nullptr, 0, Messages + MessageStart, MessageEnds[i] - MessageStart);
 		}
-	}
 
-	AsyncWriter->Serialize(ConvertedEventData.GetData(), ConvertedEventData.Num() * sizeof(ANSICHAR));
-	AccrueWrittenBytes(ConvertedEventData.Num() * sizeof(ANSICHAR));
+		int32 TotalLength = static_cast<int32>(Out - Buffer);
+		{
+			FSpoolWriteScope SpoolScope(*this);
+			if (AsyncWriter == nullptr)
+			{
+				return false;
+			}
+			MarkSpoolSegmentProtected();
+			TotalLength = ITLSerializeLines(*AsyncWriter, Buffer, TotalLength, SpoolBinaryRecords.load(std::memory_order_relaxed), ELogVerbosity::NoLogging);
+		}
+		AccrueWrittenBytes(TotalLength * sizeof(ANSICHAR), ChunkEnd - ChunkFirst);
+		ChunkFirst = ChunkEnd;
+	}
 	return true;
 }
 
+/** Writes the UTF-8 JSON timestamp field for the current UTC time into Dest (at least 64 bytes). Returns the length written. */
+static int32 ITLFormatUTCNowTimestampField(ANSICHAR* Dest, int32 DestSize)
+{
+	const FDateTime DT = FDateTime::UtcNow();
+	return FCStringAnsi::Snprintf(Dest, DestSize, "\"timestamp\": \"%04d-%02d-%02dT%02d:%02d:%02d.%03dZ\"",
+		DT.GetYear(), DT.GetMonth(), DT.GetDay(), DT.GetHour(), DT.GetMinute(), DT.GetSecond(), DT.GetMillisecond());
+}
+
 bool FsparklogsOutputDeviceFile::AddRawEventWithJSONObject(const FString& RawJSONWithBraces, const TCHAR* Message, bool AddUTCNow)
 {
-	FString TimestampFragment;
-	if (AddUTCNow)
+	ANSICHAR TimestampFragment[64];
+	const int32 TimestampFragmentLen = AddUTCNow ? ITLFormatUTCNowTimestampField(TimestampFragment, UE_ARRAY_COUNT(TimestampFragment)) : 0;
+	const int32 Len = RawJSONWithBraces.Len();
+	if (Len > 2 && RawJSONWithBraces[0] == '{' && RawJSONWithBraces[Len - 1] == '}')
+	{
+		return InternalAddRawEvent(TimestampFragment, TimestampFragmentLen, nullptr, 0, *RawJSONWithBraces + 1, Len - 2, Message);
+	}
+	else
 	{
-		TimestampFragment = TEXT("\"timestamp\": \"") + ITLGetUTCDateTimeAsRFC3339(FDateTime::UtcNow()) + TEXT("\"");
+		return InternalAddRawEvent(TimestampFragment, TimestampFragmentLen, nullptr, 0, nullptr, 0, Message);
 	}
-	if (RawJSONWithBraces.Len() > 2 && RawJSONWithBraces[0] == '{' && RawJSONWithBraces[RawJSONWithBraces.Len()-1] == '}')
+}
+
+bool FsparklogsOutputDeviceFile::AddRawEventWithUTF8JSONObject(const ANSICHAR* RawJSONWithBraces, int32 RawJSONLen, const TCHAR* Message, bool AddUTCNow)
+{
+	ANSICHAR TimestampFragment[64];
+	const int32 TimestampFragmentLen = AddUTCNow ? ITLFormatUTCNowTimestampField(TimestampFragment, UE_ARRAY_COUNT(TimestampFragment)) : 0;
+	if (RawJSONWithBraces != nullptr && RawJSONLen > 2 && RawJSONWithBraces[0] == '{' && RawJSONWithBraces[RawJSONLen - 1] == '}')
 	{
-		TimestampFragment += TEXT(",");
-		FString JSONWithoutBraces = TimestampFragment + RawJSONWithBraces.Mid(1, RawJSONWithBraces.Len() - 2);
-		return AddRawEvent(*JSONWithoutBraces, Message);
+		return InternalAddRawEvent(TimestampFragment, TimestampFragmentLen, RawJSONWithBraces + 1, RawJSONLen - 2, nullptr, 0, Message);
 	}
 	else
 	{
-		return AddRawEvent(*TimestampFragment, Message);
+		return InternalAddRawEvent(TimestampFragment, TimestampFragmentLen, nullptr, 0, nullptr, 0, Message);
 	}
 }
 
@@ -2807,7 +8689,8 @@ bool FsparklogsOutputDeviceFile::CreateAsyncWriter()
 	
 	// Make sure it's a silent filewriter so we don't generate log messages on failure, generating an infinite feedback loop.
 	uint32 Flags = FILEWRITE_Silent | FILEWRITE_AllowRead | FILEWRITE_Append;
-	FArchive* Ar = IFileManager::Get().CreateFileWriter(*Filename, Flags);
+	const FString& WriteFilename = SpoolActive.load(std::memory_order_relaxed) ? SpoolSegmentFilename : Filename;
+	FArchive* Ar = IFileManager::Get().CreateFileWriter(*WriteFilename, Flags);
 	if (!Ar)
 	{
 		Failed = true;
@@ -2816,9 +8699,17 @@ bool FsparklogsOutputDeviceFile::CreateAsyncWriter()
 
 	WriterArchive = Ar;
 	AsyncWriter = new FAsyncWriter(*WriterArchive);
-	// We always write UTF-8 to the logfile, make sure the file is interpreted properly as UTF-8
-	AsyncWriter->Serialize((void*)UTF8ByteOrderMark, sizeof(UTF8ByteOrderMark));
-	IFileManager::Get().SetTimeStamp(*Filename, FDateTime::UtcNow());
+	if (SpoolBinaryRecords.load(std::memory_order_relaxed))
+	{
+		// Tells the streamer that the records that follow are binary, even after reopening a segment with earlier records
+		AsyncWriter->Serialize((void*)ITLBinaryRecordSignature, sizeof(ITLBinaryRecordSignature));
+	}
+	else
+	{
+		// We always write UTF-8 to the logfile, make sure the file is interpreted properly as UTF-8
+		AsyncWriter->Serialize((void*)UTF8ByteOrderMark, sizeof(UTF8ByteOrderMark));
+	}
+	IFileManager::Get().SetTimeStamp(*WriteFilename, FDateTime::UtcNow());
 	Failed = false;
 	return true;
 }
@@ -2832,8 +8723,53 @@ bool FsparklogsOutputDeviceFile::ShouldLogCategory(const class FName& Category)
 #endif
 }
 
-bool FsparklogsOutputDeviceFile::AccrueWrittenBytes(int N)
+void FsparklogsOutputDeviceFile::GetWriteRates(double& OutBytesPerSec, double& OutLinesPerSec) const
 {
+	const double WindowSecs = FPlatformTime::Seconds() - WriteRateWindowStartTime.load(std::memory_order_relaxed);
+	if (WindowSecs >= 2.0 * ITLWriteRateWindowSecs)
+	{
+		// Nothing was written for a while so the last window was never closed, measure the open window instead
+		OutBytesPerSec = (double)(NumBytesWritten.load(std::memory_order_relaxed) - WriteRateWindowStartBytes.load(std::memory_order_relaxed)) / WindowSecs;
+		OutLinesPerSec = (double)(NumLinesWritten.load(std::memory_order_relaxed) - WriteRateWindowStartLines.load(std::memory_order_relaxed)) / WindowSecs;
+		return;
+	}
+	OutBytesPerSec = BytesWrittenPerSec.load(std::memory_order_relaxed);
+	OutLinesPerSec = LinesWrittenPerSec.load(std::memory_order_relaxed);
+}
+
+void FsparklogsOutputDeviceFile::GetShipperStats(FsparklogsShipperStats& OutStats) const
+{
+	OutStats.BytesWritten = GetNumBytesWritten();
+	OutStats.LinesWritten = GetNumLinesWritten();
+	GetWriteRates(OutStats.BytesWrittenPerSec, OutStats.LinesWrittenPerSec);
+	OutStats.NumSuppressedLines = GetNumSuppressedLines();
+}
+
+bool FsparklogsOutputDeviceFile::AccrueWrittenBytes(int N, int NumLines)
+{
+	const int64 TotalBytes = NumBytesWritten.fetch_add(N, std::memory_order_relaxed) + N;
+	const int64 TotalLines = NumLinesWritten.fetch_add(NumLines, std::memory_order_relaxed) + NumLines;
+	if (SpoolActive.load(std::memory_order_relaxed) && SpoolSegmentWrittenBytes.fetch_add(N, std::memory_order_relaxed) + N >= SpoolSegmentBytes && !SpoolRollPending.exchange(true))
+	{
+		// Only the writer that filled the segment starts the next one
+		RollSpoolSegment();
+	}
+	const double Now = FPlatformTime::Seconds();
+	double WindowStartTime = WriteRateWindowStartTime.load(std::memory_order_relaxed);
+	if (Now - WindowStartTime >= ITLWriteRateWindowSecs && WriteRateWindowStartTime.compare_exchange_strong(WindowStartTime, Now))
+	{
+		// Only the thread that starts the next window measures the one that ended
+		const double WindowSecs = Now - WindowStartTime;
+		const double BytesPerSec = (double)(TotalBytes - WriteRateWindowStartBytes.exchange(TotalBytes)) / WindowSecs;
+		const double LinesPerSec = (double)(TotalLines - WriteRateWindowStartLines.exchange(TotalLines)) / WindowSecs;
+		BytesWrittenPerSec.store(BytesPerSec, std::memory_order_relaxed);
+		LinesWrittenPerSec.store(LinesPerSec, std::memory_order_relaxed);
+		SET_FLOAT_STAT(STAT_SparkLogsBytesWrittenPerSec, BytesPerSec);
+		SET_FLOAT_STAT(STAT_SparkLogsLinesWrittenPerSec, LinesPerSec);
+		TRACE_COUNTER_SET(SparkLogsBytesWrittenPerSec, BytesPerSec);
+		TRACE_COUNTER_SET(SparkLogsLinesWrittenPerSec, LinesPerSec);
+	}
+
 	TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> CloudStreamer = CloudStreamerWeakPtr.Pin();
 	if (CloudStreamer.IsValid())
 	{
@@ -2846,6 +8782,257 @@ bool FsparklogsOutputDeviceFile::AccrueWrittenBytes(int N)
 	return false;
 }
 
+// =============== FsparklogsJSONWriterUTF8 ===============================================================================
+
+FsparklogsJSONWriterUTF8::FsparklogsJSONWriterUTF8(TITLJSONStringBuilder& InBuilder)
+	: Builder(InBuilder)
+	, NeedsComma(false)
+{
+	Builder.Reset();
+}
+
+void FsparklogsJSONWriterUTF8::BeginObject(const TCHAR* Key)
+{
+	WriteKey(Key);
+	Builder.Append("{", 1);
+	NeedsComma = false;
+}
+
+void FsparklogsJSONWriterUTF8::EndObject()
+{
+	Builder.Append("}", 1);
+	NeedsComma = true;
+}
+
+void FsparklogsJSONWriterUTF8::BeginArray(const TCHAR* Key)
+{
+	WriteKey(Key);
+	Builder.Append("[", 1);
+	NeedsComma = false;
+}
+
+void FsparklogsJSONWriterUTF8::EndArray()
+{
+	Builder.Append("]", 1);
+	NeedsComma = true;
+}
+
+void FsparklogsJSONWriterUTF8::WriteString(const TCHAR* Key, const TCHAR* Value, int32 ValueLen)
+{
+	WriteKey(Key);
+	WriteEscapedString(Value, ValueLen);
+	NeedsComma = true;
+}
+
+void FsparklogsJSONWriterUTF8::WriteNumber(const TCHAR* Key, double Value)
+{
+	if (!FMath::IsFinite(Value))
+	{
+		WriteNull(Key);
+		return;
+	}
+	WriteKey(Key);
+	ANSICHAR NumberBuf[32];
+	// Same format as the engine's JSON print policy, so whole numbers are written without a fractional part
+	const int32 NumberLen = FCStringAnsi::Snprintf(NumberBuf, UE_ARRAY_COUNT(NumberBuf), "%.17g", Value);
+	Builder.Append(NumberBuf, NumberLen);
+	NeedsComma = true;
+}
+
+void FsparklogsJSONWriterUTF8::WriteBool(const TCHAR* Key, bool Value)
+{
+	WriteKey(Key);
+	if (Value)
+	{
+		Builder.Append("true", 4);
+	}
+	else
+	{
+		Builder.Append("false", 5);
+	}
+	NeedsComma = true;
+}
+
+void FsparklogsJSONWriterUTF8::WriteNull(const TCHAR* Key)
+{
+	WriteKey(Key);
+	Builder.Append("null", 4);
+	NeedsComma = true;
+}
+
+void FsparklogsJSONWriterUTF8::WriteStringArray(const TCHAR* Key, const TArray<FString>& Values, bool SkipEmpty)
+{
+	BeginArray(Key);
+	for (const FString& V : Values)
+	{
+		if (SkipEmpty && V.IsEmpty())
+		{
+			continue;
+		}
+		WriteString(nullptr, V);
+	}
+	EndArray();
+}
+
+void FsparklogsJSONWriterUTF8::WriteRawValue(const TCHAR* Key, const ANSICHAR* JSON, int32 JSONLen)
+{
+	WriteKey(Key);
+	Builder.Append(JSON, JSONLen);
+	NeedsComma = true;
+}
+
+void FsparklogsJSONWriterUTF8::WriteRawFields(const ANSICHAR* JSON, int32 JSONLen)
+{
+	if (JSONLen <= 0)
+	{
+		return;
+	}
+	WriteKey(nullptr);
+	Builder.Append(JSON, JSONLen);
+	NeedsComma = true;
+}
+
+void FsparklogsJSONWriterUTF8::WriteJsonValue(const TCHAR* Key, const TSharedPtr<FJsonValue>& Value)
+{
+	if (!Value.IsValid())
+	{
+		WriteNull(Key);
+		return;
+	}
+	switch (Value->Type)
+	{
+	case EJson::String:
+		WriteString(Key, Value->AsString());
+		break;
+	case EJson::Number:
+		WriteNumber(Key, Value->AsNumber());
+		break;
+	case EJson::Boolean:
+		WriteBool(Key, Value->AsBool());
+		break;
+	case EJson::Array:
+		BeginArray(Key);
+		for (const TSharedPtr<FJsonValue>& Element : Value->AsArray())
+		{
+			WriteJsonValue(nullptr, Element);
+		}
+		EndArray();
+		break;
+	case EJson::Object:
+	{
+		BeginObject(Key);
+		const TSharedPtr<FJsonObject>& Object = Value->AsObject();
+		if (Object.IsValid())
+		{
+			WriteJsonObjectFields(*Object);
+		}
+		EndObject();
+		break;
+	}
+	default:
+		WriteNull(Key);
+		break;
+	}
+}
+
+void FsparklogsJSONWriterUTF8::WriteJsonObjectFields(const FJsonObject& Object)
+{
+	for (auto it = Object.Values.CreateConstIterator(); it; ++it)
+	{
+		WriteJsonValue(*it->Key, it->Value);
+	}
+}
+
+void FsparklogsJSONWriterUTF8::WriteKey(const TCHAR* Key)
+{
+	if (NeedsComma)
+	{
+		Builder.Append(",", 1);
+	}
+	if (Key != nullptr)
+	{
+		WriteEscapedString(Key, FCString::Strlen(Key));
+		Builder.Append(":", 1);
+	}
+}
+
+void FsparklogsJSONWriterUTF8::WriteEscapedString(const TCHAR* S, int32 Len)
+{
+	static const ANSICHAR HexDigits[] = "0123456789abcdef";
+	TArray<uint8>& Data = Builder.GetArray();
+	const int32 Start = Data.Num();
+	// Worst case is every character being a control character escaped as \u00XX, plus the quotes
+	ITLSetNumNoShrink(Data, Start + (Len * 6) + 2);
+	ANSICHAR* Out = reinterpret_cast<ANSICHAR*>(Data.GetData()) + Start;
+	*Out++ = '"';
+	int32 i = 0;
+	while (i < Len)
+	{
+		const uint32 C = static_cast<uint32>(S[i]) & ITLTCHARCodeUnitMask;
+		if (C >= 0x80)
+		{
+			// Encode the whole run of non-ASCII characters at once so surrogate pairs stay together
+			int32 RunEnd = i + 1;
+			while (RunEnd < Len && (static_cast<uint32>(S[RunEnd]) & ITLTCHARCodeUnitMask) >= 0x80)
+			{
+				RunEnd++;
+			}
+			Out = ITLEncodeUTF8(Out, S + i, RunEnd - i, false, false);
+			i = RunEnd;
+			continue;
+		}
+		switch (C)
+		{
+		case '\"':
+			*Out++ = '\\';
+			*Out++ = '\"';
+			break;
+		case '\\':
+			*Out++ = '\\';
+			*Out++ = '\\';
+			break;
+		case '\n':
+			*Out++ = '\\';
+			*Out++ = 'n';
+			break;
+		case '\t':
+			*Out++ = '\\';
+			*Out++ = 't';
+			break;
+		case '\b':
+			*Out++ = '\\';
+			*Out++ = 'b';
+			break;
+		case '\f':
+			*Out++ = '\\';
+			*Out++ = 'f';
+			break;
+		case '\r':
+			*Out++ = '\\';
+			*Out++ = 'r';
+			break;
+		default:
+			if (C < 0x20)
+			{
+				*Out++ = '\\';
+				*Out++ = 'u';
+				*Out++ = '0';
+				*Out++ = '0';
+				*Out++ = HexDigits[C >> 4];
+				*Out++ = HexDigits[C & 0xF];
+			}
+			else
+			{
+				*Out++ = static_cast<ANSICHAR>(C);
+			}
+			break;
+		}
+		i++;
+	}
+	*Out++ = '"';
+	ITLSetNumNoShrink(Data, static_cast<int32>(Out - reinterpret_cast<ANSICHAR*>(Data.GetData())));
+}
+
 // =============== FSparkLogsAnalyticsSessionDescriptor ===============================================================================
 
 FSparkLogsAnalyticsSessionDescriptor::FSparkLogsAnalyticsSessionDescriptor()
@@ -2886,6 +9073,61 @@ bool UsparklogsAnalytics::StartSession() { return FsparklogsModule::GetAnalytics
 bool UsparklogsAnalytics::StartSessionWithReason(const FString& Reason) { return FsparklogsModule::GetAnalyticsProvider()->StartSession(*Reason, TArray<FAnalyticsEventAttribute>()); }
 void UsparklogsAnalytics::EndSession() { FsparklogsModule::GetAnalyticsProvider()->EndSession(); }
 void UsparklogsAnalytics::EndSessionWithReason(const FString& Reason) { FsparklogsModule::GetAnalyticsProvider()->EndSession(*Reason); }
+
+/** The batch opened by UsparklogsAnalytics::BeginBatch (game thread only). */
+static TUniquePtr<FsparklogsAnalyticsBatch> GITLBlueprintAnalyticsBatch;
+/** The generation of the batch opened in C++ that UsparklogsAnalytics::BeginBatch joined instead (0 if none), and how many events it had ever
+  * added at the time (game thread only). Not a pointer, since the joined batch may end and another one take its address before CommitBatch. */
+static uint64 GITLBlueprintJoinedAnalyticsBatchGeneration = 0;
+static int32 GITLBlueprintJoinedAnalyticsBatchStart = 0;
+/** Commits the batch opened by UsparklogsAnalytics::BeginBatch at the end of the frame, so it never stays open while nothing commits it. */
+static FDelegateHandle GITLBlueprintAnalyticsBatchEndFrameHandle;
+
+void UsparklogsAnalytics::BeginBatch()
+{
+	check(IsInGameThread());
+	if (GITLBlueprintAnalyticsBatch.IsValid() || GITLBlueprintJoinedAnalyticsBatchGeneration != 0)
+	{
+		return;
+	}
+	if (FsparklogsAnalyticsBatch* Active = FsparklogsAnalyticsBatch::GetActive())
+	{
+		GITLBlueprintJoinedAnalyticsBatchGeneration = Active->GetGeneration();
+		GITLBlueprintJoinedAnalyticsBatchStart = Active->NumAdded;
+	}
+	else
+	{
+		GITLBlueprintAnalyticsBatch = MakeUnique<FsparklogsAnalyticsBatch>();
+	}
+	GITLBlueprintAnalyticsBatchEndFrameHandle = FCoreDelegates::OnEndFrame.AddLambda([]() { UsparklogsAnalytics::CommitBatch(); });
+}
+
+int32 UsparklogsAnalytics::CommitBatch()
+{
+	check(IsInGameThread());
+	if (GITLBlueprintAnalyticsBatchEndFrameHandle.IsValid())
+	{
+		FCoreDelegates::OnEndFrame.Remove(GITLBlueprintAnalyticsBatchEndFrameHandle);
+		GITLBlueprintAnalyticsBatchEndFrameHandle.Reset();
+	}
+	int32 NumEvents = 0;
+	if (GITLBlueprintAnalyticsBatch.IsValid())
+	{
+		NumEvents = GITLBlueprintAnalyticsBatch->Commit();
+		GITLBlueprintAnalyticsBatch.Reset();
+	}
+	else if (GITLBlueprintJoinedAnalyticsBatchGeneration != 0)
+	{
+		// If the joined batch already ended, it wrote the events itself and they cannot be counted anymore
+		FsparklogsAnalyticsBatch* Active = FsparklogsAnalyticsBatch::GetActive();
+		if (Active != nullptr && Active->GetGeneration() == GITLBlueprintJoinedAnalyticsBatchGeneration)
+		{
+			NumEvents = FMath::Max(0, Active->NumAdded - GITLBlueprintJoinedAnalyticsBatchStart);
+		}
+		GITLBlueprintJoinedAnalyticsBatchGeneration = 0;
+	}
+	return NumEvents;
+}
 FString UsparklogsAnalytics::GetUserID() { return FsparklogsModule::GetAnalyticsProvider()->GetUserID(); }
 void UsparklogsAnalytics::SetUserID(const FString& UserID) { return FsparklogsModule::GetAnalyticsProvider()->SetUserID(UserID); }
 FString UsparklogsAnalytics::GetSessionID() { return FsparklogsModule::GetAnalyticsProvider()->GetSessionID(); }
@@ -3732,37 +9974,116 @@ bool UsparklogsAnalytics::AddLog(EsparklogsSeverity Severity, const TCHAR* Messa
 
 bool UsparklogsAnalytics::AddLog(EsparklogsSeverity Severity, const TCHAR* Message, TSharedPtr<FJsonObject> CustomAttrs, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
 {
-	return FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, Message, nullptr, CustomAttrs, OverrideSession);
+	return FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, Message, nullptr, CustomAttrs, OverrideSession);
+}
+
+bool UsparklogsAnalytics::AddLog(EsparklogsSeverity Severity, const TCHAR* Message, const TCHAR* Reason, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
+{
+	return FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, Message, Reason, nullptr, OverrideSession);
+}
+
+bool UsparklogsAnalytics::AddLog(EsparklogsSeverity Severity, const TCHAR* Message, const TCHAR* Reason, TSharedPtr<FJsonObject> CustomAttrs, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
+{
+	return FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, Message, Reason, CustomAttrs, OverrideSession);
+}
+
+void UsparklogsAnalytics::RecordLog(EsparklogsSeverity Severity, const FString& Message)
+{
+	FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, *Message, nullptr, nullptr);
+}
+
+void UsparklogsAnalytics::RecordLogWithAttr(EsparklogsSeverity Severity, const FString& Message, const TArray<FsparklogsAnalyticsAttribute>& CustomAttrs)
+{
+	FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, *Message, nullptr, CustomAttrs);
+}
+
+void UsparklogsAnalytics::RecordLogWithReason(EsparklogsSeverity Severity, const FString& Message, const FString& Reason)
+{
+	FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, *Message, *Reason, nullptr);
+}
+
+void UsparklogsAnalytics::RecordLogWithReasonWithAttr(EsparklogsSeverity Severity, const FString& Message, const FString& Reason, const TArray<FsparklogsAnalyticsAttribute>& CustomAttrs)
+{
+	FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, *Message, *Reason, CustomAttrs);
+}
+
+// =============== FsparklogsAnalyticsAggregator ===============================================================================
+
+FsparklogsAnalyticsAggregator::FsparklogsAnalyticsAggregator()
+	: WindowStartedPlatformTime(0.0)
+{
 }
 
-bool UsparklogsAnalytics::AddLog(EsparklogsSeverity Severity, const TCHAR* Message, const TCHAR* Reason, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
+void FsparklogsAnalyticsAggregator::Add(const FRollup& Event, double WindowSecs, int32 MaxKeys, TArray<FRollup>& OutDue)
 {
-	return FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, Message, Reason, nullptr, OverrideSession);
+	const FString Key = GetKey(Event);
+	const double Now = FPlatformTime::Seconds();
+	FScopeLock Lock(&CriticalSection);
+	if (Rollups.Num() > 0 && (Now - WindowStartedPlatformTime >= WindowSecs || (Rollups.Num() >= MaxKeys && !Rollups.Contains(Key))))
+	{
+		MoveAllTo(OutDue);
+	}
+	if (Rollups.Num() <= 0)
+	{
+		WindowStartedPlatformTime = Now;
+	}
+	FRollup* Existing = Rollups.Find(Key);
+	if (Existing == nullptr)
+	{
+		FRollup& Added = Rollups.Add(Key, Event);
+		Added.Started = FDateTime::UtcNow();
+		return;
+	}
+	Existing->HasValue = Existing->HasValue || Event.HasValue;
+	Existing->Sum += Event.Sum;
+	Existing->Count += Event.Count;
 }
 
-bool UsparklogsAnalytics::AddLog(EsparklogsSeverity Severity, const TCHAR* Message, const TCHAR* Reason, TSharedPtr<FJsonObject> CustomAttrs, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
+void FsparklogsAnalyticsAggregator::TakeAll(TArray<FRollup>& OutRollups)
 {
-	return FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, Message, Reason, CustomAttrs, OverrideSession);
+	FScopeLock Lock(&CriticalSection);
+	MoveAllTo(OutRollups);
 }
 
-void UsparklogsAnalytics::RecordLog(EsparklogsSeverity Severity, const FString& Message)
+void FsparklogsAnalyticsAggregator::TakeDue(double WindowSecs, TArray<FRollup>& OutDue)
 {
-	FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, *Message, nullptr, nullptr);
+	const double Now = FPlatformTime::Seconds();
+	FScopeLock Lock(&CriticalSection);
+	if (Rollups.Num() > 0 && Now - WindowStartedPlatformTime >= WindowSecs)
+	{
+		MoveAllTo(OutDue);
+	}
 }
 
-void UsparklogsAnalytics::RecordLogWithAttr(EsparklogsSeverity Severity, const FString& Message, const TArray<FsparklogsAnalyticsAttribute>& CustomAttrs)
+int32 FsparklogsAnalyticsAggregator::Num() const
 {
-	FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, *Message, nullptr, CustomAttrs);
+	FScopeLock Lock(&CriticalSection);
+	return Rollups.Num();
 }
 
-void UsparklogsAnalytics::RecordLogWithReason(EsparklogsSeverity Severity, const FString& Message, const FString& Reason)
+void FsparklogsAnalyticsAggregator::MoveAllTo(TArray<FRollup>& OutRollups)
 {
-	FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, *Message, *Reason, nullptr);
+	OutRollups.Reserve(OutRollups.Num() + Rollups.Num());
+	for (TPair<FString, FRollup>& Pair : Rollups)
+	{
+		OutRollups.Add(MoveTemp(Pair.Value));
+	}
+	Rollups.Reset();
 }
 
-void UsparklogsAnalytics::RecordLogWithReasonWithAttr(EsparklogsSeverity Severity, const FString& Message, const FString& Reason, const TArray<FsparklogsAnalyticsAttribute>& CustomAttrs)
+FString FsparklogsAnalyticsAggregator::GetKey(const FRollup& Event)
 {
-	FsparklogsModule::GetAnalyticsProvider()->CreateAnalyticsEventLog(Severity, *Message, *Reason, CustomAttrs);
+	// The event ID already holds the flow type, currency and item of resource events
+	FString Key;
+	Key.Reserve(Event.SessionID.Len() + Event.EventID.Len() + Event.Reason.Len() + 16);
+	Key += Event.EventType;
+	Key += TEXT("\n");
+	Key += Event.SessionID;
+	Key += TEXT("\n");
+	Key += Event.EventID;
+	Key += TEXT("\n");
+	Key += Event.Reason;
+	return Key;
 }
 
 // =============== FsparklogsAnalyticsProvider ===============================================================================
@@ -3771,11 +10092,15 @@ const TCHAR* const FsparklogsAnalyticsProvider::RecordProgressDelimiters[2] = {
 
 FsparklogsAnalyticsProvider::FsparklogsAnalyticsProvider(TSharedRef<FsparklogsSettings> InSettings)
 	: Settings(InSettings)
+	, OutputDevice(nullptr)
 	, SessionStarted(ITLEmptyDateTime)
 	, SessionNumber(0)
 	, MetaAttributes(new FJsonObject())
+	, PublishedState(MakeShared<FAnalyticsStateSnapshot, ESPMode::ThreadSafe>())
 {
+	FScopeLock WriteLock(&DataCriticalSection);
 	SetupDefaultMetaAttributes();
+	PublishStateSnapshot();
 }
 
 FsparklogsAnalyticsProvider::~FsparklogsAnalyticsProvider()
@@ -3792,37 +10117,24 @@ bool FsparklogsAnalyticsProvider::CreateAnalyticsEventPurchase(const TCHAR* Item
 	{
 		return false;
 	}
-	TSharedPtr<FJsonObject> Data(new FJsonObject());
-	FString EventID;
-	TArray<TSharedPtr<FJsonValue>> EventIDParts;
-	if (ItemCategory != nullptr && *ItemCategory != 0)
+	const bool HasItemCategory = ItemCategory != nullptr && *ItemCategory != 0;
+	const bool HasItemId = ItemId != nullptr && *ItemId != 0;
+	if (!HasItemCategory)
 	{
-		EventID = ItemCategory;
-		Data->SetStringField(PurchaseFieldItemCategory, ItemCategory);
-		EventIDParts.Add(TSharedPtr<FJsonValue>(new FJsonValueString(ItemCategory)));
+		ItemCategory = TEXT("");
 	}
-	else
+	if (!HasItemId)
 	{
-		ItemCategory = TEXT("");
+		ItemId = TEXT("");
 	}
-	if (ItemId != nullptr && *ItemId != 0)
+	FString EventID(ItemCategory);
+	if (HasItemId)
 	{
 		if (!EventID.IsEmpty())
 		{
 			EventID += ItemSeparator;
 		}
 		EventID += ItemId;
-		Data->SetStringField(PurchaseFieldItemId, ItemId);
-		EventIDParts.Add(TSharedPtr<FJsonValue>(new FJsonValueString(ItemId)));
-	}
-	else
-	{
-		ItemId = TEXT("");
-	}
-	if (!EventID.IsEmpty())
-	{
-		Data->SetStringField(PurchaseFieldEventId, EventID);
-		Data->SetArrayField(PurchaseFieldEventIdParts, EventIDParts);
 	}
 	if (RealCurrencyCode == nullptr || *RealCurrencyCode == 0)
 	{
@@ -3830,38 +10142,57 @@ bool FsparklogsAnalyticsProvider::CreateAnalyticsEventPurchase(const TCHAR* Item
 	}
 	FString RealCurrencyCodeStr(RealCurrencyCode);
 	RealCurrencyCodeStr.ToUpperInline();
-	Data->SetStringField(PurchaseFieldCurrency, RealCurrencyCodeStr);
-	Data->SetNumberField(PurchaseFieldAmount, Amount);
 	int TransactionNumber = Settings->GetTransactionNumber(true);
-	if (TransactionNumber > 0)
-	{
-		Data->SetNumberField(PurchaseFieldTransactionNumber, (double)TransactionNumber);
-	}
 	FDateTime FirstPurchased = Settings->GetAnalyticsFirstPurchased();
 	if (FirstPurchased == ITLEmptyDateTime)
 	{
 		FirstPurchased = FDateTime::UtcNow();
 		Settings->SetAnalyticsFirstPurchased(FirstPurchased);
 	}
-	if (FirstPurchased != ITLEmptyDateTime)
+	if (Reason == nullptr)
 	{
-		Data->SetStringField(PurchaseFieldFirstPurchased, ITLGetUTCDateTimeAsRFC3339(FirstPurchased));
+		Reason = TEXT("");
 	}
-	if (Reason != nullptr && *Reason != 0)
+
+	FsparklogsJSONWriterUTF8 Writer = BeginTypedAnalyticsEvent();
+	if (HasItemCategory)
 	{
-		Data->SetStringField(PurchaseFieldReason, Reason);
+		Writer.WriteString(PurchaseFieldItemCategory, ItemCategory);
 	}
-	else
+	if (HasItemId)
 	{
-		Reason = TEXT("");
+		Writer.WriteString(PurchaseFieldItemId, ItemId);
 	}
-	if (CustomAttrs.IsValid() && CustomAttrs->Values.Num() > 0)
+	if (!EventID.IsEmpty())
+	{
+		Writer.WriteString(PurchaseFieldEventId, EventID);
+		Writer.BeginArray(PurchaseFieldEventIdParts);
+		if (HasItemCategory)
+		{
+			Writer.WriteString(nullptr, ItemCategory);
+		}
+		if (HasItemId)
+		{
+			Writer.WriteString(nullptr, ItemId);
+		}
+		Writer.EndArray();
+	}
+	Writer.WriteString(PurchaseFieldCurrency, RealCurrencyCodeStr);
+	Writer.WriteNumber(PurchaseFieldAmount, Amount);
+	if (TransactionNumber > 0)
 	{
-		Data->SetObjectField(StandardFieldCustom, CustomAttrs);
+		Writer.WriteNumber(PurchaseFieldTransactionNumber, (double)TransactionNumber);
 	}
-	FinalizeAnalyticsEvent(EventTypePurchase, OverrideSession, Data);
-	FString DefaultMessage = FString::Printf(TEXT("%s: %s: purchase of item made; item_category=`%s` item_id=`%s` currency=`%s` amount=%.2f reason=`%s`"), MessageHeader, EventTypePurchase, ItemCategory, ItemId, RealCurrencyCode, Amount, Reason);
-	return FsparklogsModule::GetModule().AddRawAnalyticsEvent(Data, *CalculateFinalMessage(DefaultMessage, IncludeDefaultMessage, ExtraMessage), nullptr, IncludeDefaultMessage, false);
+	if (FirstPurchased != ITLEmptyDateTime)
+	{
+		Writer.WriteString(PurchaseFieldFirstPurchased, ITLGetUTCDateTimeAsRFC3339(FirstPurchased));
+	}
+	if (*Reason != 0)
+	{
+		Writer.WriteString(PurchaseFieldReason, Reason);
+	}
+	FString DefaultMessage = IncludeDefaultMessage ? FString::Printf(TEXT("%s: %s: purchase of item made; item_category=`%s` item_id=`%s` currency=`%s` amount=%.2f reason=`%s`"), MessageHeader, EventTypePurchase, ItemCategory, ItemId, RealCurrencyCode, Amount, Reason) : FString();
+	return QueueTypedAnalyticsEvent(Writer, EventTypePurchase, CustomAttrs, OverrideSession, *CalculateFinalMessage(DefaultMessage, IncludeDefaultMessage, ExtraMessage), IncludeDefaultMessage);
 }
 
 bool FsparklogsAnalyticsProvider::CreateAnalyticsEventPurchase(const TCHAR* ItemCategory, const TCHAR* ItemId, const TCHAR* RealCurrencyCode, double Amount, const TCHAR* Reason, const TArray<FsparklogsAnalyticsAttribute>& CustomAttrs, bool IncludeDefaultMessage, const TCHAR* ExtraMessage, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
@@ -3896,54 +10227,53 @@ bool FsparklogsAnalyticsProvider::CreateAnalyticsEventResource(EsparklogsAnalyti
 		Amount = -AmountAbs;
 	}
 
-	TSharedPtr<FJsonObject> Data(new FJsonObject());
 	FString FlowTypeStr = UEnum::GetDisplayValueAsText(FlowType).ToString();
-	Data->SetStringField(ResourceFieldFlowType, FlowTypeStr);
-	Data->SetStringField(ResourceFieldVirtualCurrency, VirtualCurrency);
 	FString EventID = (FlowTypeStr + ItemSeparator) + VirtualCurrency;
-	TArray<TSharedPtr<FJsonValue>> EventIDParts;
-	EventIDParts.Add(TSharedPtr<FJsonValue>(new FJsonValueString(FlowTypeStr)));
-	EventIDParts.Add(TSharedPtr<FJsonValue>(new FJsonValueString(VirtualCurrency)));
-	if (ItemCategory != nullptr && *ItemCategory != 0)
+	const bool HasItemCategory = ItemCategory != nullptr && *ItemCategory != 0;
+	const bool HasItemId = ItemId != nullptr && *ItemId != 0;
+	if (HasItemCategory)
 	{
 		EventID += ItemSeparator;
 		EventID += ItemCategory;
-		Data->SetStringField(ResourceFieldItemCategory, ItemCategory);
-		EventIDParts.Add(TSharedPtr<FJsonValue>(new FJsonValueString(ItemCategory)));
 	}
 	else
 	{
 		ItemCategory = TEXT("");
 	}
-	if (ItemId != nullptr && *ItemId != 0)
+	if (HasItemId)
 	{
 		EventID += ItemSeparator;
 		EventID += ItemId;
-		Data->SetStringField(ResourceFieldItemId, ItemId);
-		EventIDParts.Add(TSharedPtr<FJsonValue>(new FJsonValueString(ItemId)));
 	}
 	else
 	{
 		ItemId = TEXT("");
 	}
-	Data->SetStringField(ResourceFieldEventId, EventID);
-	Data->SetArrayField(ResourceFieldEventIdParts, EventIDParts);
-	Data->SetNumberField(ResourceFieldAmount, Amount);
-	if (Reason != nullptr && *Reason != 0)
-	{
-		Data->SetStringField(ResourceFieldReason, Reason);
-	}
-	else
+	if (Reason == nullptr)
 	{
 		Reason = TEXT("");
 	}
-	if (CustomAttrs.IsValid() && CustomAttrs->Values.Num() > 0)
+
+	if (CanAggregateEvent(CustomAttrs, ExtraMessage))
 	{
-		Data->SetObjectField(StandardFieldCustom, CustomAttrs);
+		FsparklogsAnalyticsAggregator::FRollup Event;
+		Event.EventType = EventTypeResource;
+		Event.EventID = MoveTemp(EventID);
+		Event.Reason = Reason;
+		Event.FlowType = MoveTemp(FlowTypeStr);
+		Event.VirtualCurrency = VirtualCurrency;
+		Event.ItemCategory = ItemCategory;
+		Event.ItemId = ItemId;
+		Event.HasValue = true;
+		Event.Sum = Amount;
+		AggregateEvent(Event, OverrideSession);
+		return true;
 	}
-	FinalizeAnalyticsEvent(EventTypeResource, OverrideSession, Data);
-	FString DefaultMessage = FString::Printf(TEXT("%s: %s: flow_type=%s virtual_currency=`%s` item_category=`%s` item_id=`%s` amount=%f reason=`%s`"), MessageHeader, EventTypeResource, *FlowTypeStr, VirtualCurrency, ItemCategory, ItemId, Amount, Reason);
-	return FsparklogsModule::GetModule().AddRawAnalyticsEvent(Data, *CalculateFinalMessage(DefaultMessage, IncludeDefaultMessage, ExtraMessage), nullptr, IncludeDefaultMessage, false);
+
+	FsparklogsJSONWriterUTF8 Writer = BeginTypedAnalyticsEvent();
+	WriteResourceFields(Writer, FlowTypeStr, VirtualCurrency, ItemCategory, ItemId, EventID, Amount, Reason);
+	FString DefaultMessage = IncludeDefaultMessage ? FString::Printf(TEXT("%s: %s: flow_type=%s virtual_currency=`%s` item_category=`%s` item_id=`%s` amount=%f reason=`%s`"), MessageHeader, EventTypeResource, *FlowTypeStr, VirtualCurrency, ItemCategory, ItemId, Amount, Reason) : FString();
+	return QueueTypedAnalyticsEvent(Writer, EventTypeResource, CustomAttrs, OverrideSession, *CalculateFinalMessage(DefaultMessage, IncludeDefaultMessage, ExtraMessage), IncludeDefaultMessage);
 }
 
 bool FsparklogsAnalyticsProvider::CreateAnalyticsEventResource(EsparklogsAnalyticsFlowType FlowType, double Amount, const TCHAR* VirtualCurrency, const TCHAR* ItemCategory, const TCHAR* ItemId, const TCHAR* Reason, const TArray<FsparklogsAnalyticsAttribute>& CustomAttrs, bool IncludeDefaultMessage, const TCHAR* ExtraMessage, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
@@ -4089,47 +10419,49 @@ bool FsparklogsAnalyticsProvider::CreateAnalyticsEventProgression(EsparklogsAnal
 
 	FString StatusStr = UEnum::GetDisplayValueAsText(Status).ToString();
 	FString EventId = StatusStr + ItemSeparator + Tiers;
-	TArray<TSharedPtr<FJsonValue>> EventIdParts;
-	EventIdParts.Add(TSharedPtr<FJsonValue>(new FJsonValueString(StatusStr)));
-	for (int i = 0; i < PArray.Num(); i++)
+	if (Reason == nullptr)
 	{
-		EventIdParts.Add(TSharedPtr<FJsonValue>(new FJsonValueString(PArray[i])));
+		Reason = TEXT("");
 	}
-	TSharedPtr<FJsonObject> Data(new FJsonObject());
-	Data->SetStringField(DesignFieldEventId, EventId);
-	Data->SetArrayField(DesignFieldEventIdParts, EventIdParts);
-	Data->SetStringField(ProgressionFieldStatus, StatusStr);
-	Data->SetStringField(ProgressionFieldTiersString, Tiers);
-	Data->SetField(ProgressionFieldTiersArray, ConvertNonEmptyStringArrayToJSON(PArray));
+
+	FsparklogsJSONWriterUTF8 Writer = BeginTypedAnalyticsEvent();
+	Writer.WriteString(DesignFieldEventId, EventId);
+	Writer.BeginArray(DesignFieldEventIdParts);
+	Writer.WriteString(nullptr, StatusStr);
+	for (const FString& P : PArray)
+	{
+		Writer.WriteString(nullptr, P);
+	}
+	Writer.EndArray();
+	Writer.WriteString(ProgressionFieldStatus, StatusStr);
+	Writer.WriteString(ProgressionFieldTiersString, Tiers);
+	Writer.WriteStringArray(ProgressionFieldTiersArray, PArray, true);
+	TCHAR TierField[32];
 	for (int i=0; i<PArray.Num(); i++)
 	{
 		const FString& P = PArray[i];
 		if (!P.IsEmpty())
 		{
-			Data->SetStringField(FString::Printf(TEXT("%s%d"), ProgressionFieldTierPrefix, i+1), P);
+			FCString::Snprintf(TierField, UE_ARRAY_COUNT(TierField), TEXT("%s%d"), ProgressionFieldTierPrefix, i+1);
+			Writer.WriteString(TierField, P);
 		}
 	}
 	if (Value != nullptr)
 	{
-		Data->SetNumberField(ProgressionFieldValue, *Value);
-	}
-	Data->SetNumberField(ProgressionFieldAttempt, (double)AttemptNumber);
-	if (Reason != nullptr && *Reason != 0)
-	{
-		Data->SetStringField(ProgressionFieldReason, FString(Reason));
+		Writer.WriteNumber(ProgressionFieldValue, *Value);
 	}
-	else
+	Writer.WriteNumber(ProgressionFieldAttempt, (double)AttemptNumber);
+	if (*Reason != 0)
 	{
-		Reason = TEXT("");
+		Writer.WriteString(ProgressionFieldReason, Reason);
 	}
-	if (CustomAttrs.IsValid() && CustomAttrs->Values.Num() > 0)
+	FString DefaultMessage;
+	if (IncludeDefaultMessage)
 	{
-		Data->SetObjectField(StandardFieldCustom, CustomAttrs);
+		FString ValueDesc = Value == nullptr ? FString() : FString::Printf(TEXT(" value=%f"), *Value);
+		DefaultMessage = FString::Printf(TEXT("%s: %s: event_id=`%s`%s reason=`%s`"), MessageHeader, EventTypeProgression, *EventId, *ValueDesc, Reason);
 	}
-	FinalizeAnalyticsEvent(EventTypeProgression, OverrideSession, Data);
-	FString ValueDesc = Value == nullptr ? FString() : FString::Printf(TEXT(" value=%f"), *Value);
-	FString DefaultMessage = FString::Printf(TEXT("%s: %s: event_id=`%s`%s reason=`%s`"), MessageHeader, EventTypeProgression, *EventId, *ValueDesc, Reason);
-	return FsparklogsModule::GetModule().AddRawAnalyticsEvent(Data, *CalculateFinalMessage(DefaultMessage, IncludeDefaultMessage, ExtraMessage), nullptr, IncludeDefaultMessage, false);
+	return QueueTypedAnalyticsEvent(Writer, EventTypeProgression, CustomAttrs, OverrideSession, *CalculateFinalMessage(DefaultMessage, IncludeDefaultMessage, ExtraMessage), IncludeDefaultMessage);
 }
 
 bool FsparklogsAnalyticsProvider::CreateAnalyticsEventDesign(const TCHAR* EventId, double Value, const TCHAR* Reason, TSharedPtr<FJsonObject> CustomAttrs, bool IncludeDefaultMessage, const TCHAR* ExtraMessage, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
@@ -4189,34 +10521,31 @@ bool FsparklogsAnalyticsProvider::CreateAnalyticsEventDesign(const TArray<FStrin
 	{
 		return false;
 	}
-	TSharedPtr<FJsonObject> Data(new FJsonObject());
-	Data->SetStringField(DesignFieldEventId, EventId);
-	TArray<TSharedPtr<FJsonValue>> EventIdPartsJson;
-	for (const FString& Part : EventIDParts)
-	{
-		EventIdPartsJson.Add(TSharedPtr<FJsonValue>(new FJsonValueString(Part)));
-	}
-	Data->SetArrayField(DesignFieldEventIdParts, EventIdPartsJson);
-	if (Value != nullptr)
-	{
-		Data->SetNumberField(DesignFieldValue, *Value);
-	}
-	if (Reason != nullptr && *Reason != 0)
+	if (Reason == nullptr)
 	{
-		Data->SetStringField(DesignFieldReason, Reason);
+		Reason = TEXT("");
 	}
-	else
+	if (CanAggregateEvent(CustomAttrs, ExtraMessage))
 	{
-		Reason = TEXT("");
+		FsparklogsAnalyticsAggregator::FRollup Event;
+		Event.EventType = EventTypeDesign;
+		Event.EventID = MoveTemp(EventId);
+		Event.Reason = Reason;
+		Event.EventIDParts = EventIDParts;
+		Event.HasValue = Value != nullptr;
+		Event.Sum = Value != nullptr ? *Value : 0.0;
+		AggregateEvent(Event, OverrideSession);
+		return true;
 	}
-	if (CustomAttrs.IsValid() && CustomAttrs->Values.Num() > 0)
+	FsparklogsJSONWriterUTF8 Writer = BeginTypedAnalyticsEvent();
+	WriteDesignFields(Writer, EventId, EventIDParts, Value, Reason);
+	FString DefaultMessage;
+	if (IncludeDefaultMessage)
 	{
-		Data->SetObjectField(StandardFieldCustom, CustomAttrs);
+		FString ValueDesc = Value == nullptr ? FString() : FString::Printf(TEXT(" value=%f"), *Value);
+		DefaultMessage = FString::Printf(TEXT("%s: %s: event_id=`%s`%s reason=`%s`"), MessageHeader, EventTypeDesign, *EventId, *ValueDesc, Reason);
 	}
-	FinalizeAnalyticsEvent(EventTypeDesign, OverrideSession, Data);
-	FString ValueDesc = Value == nullptr ? FString() : FString::Printf(TEXT(" value=%f"), *Value);
-	FString DefaultMessage = FString::Printf(TEXT("%s: %s: event_id=`%s`%s reason=`%s`"), MessageHeader, EventTypeDesign, *EventId, *ValueDesc, Reason);
-	return FsparklogsModule::GetModule().AddRawAnalyticsEvent(Data, *CalculateFinalMessage(DefaultMessage, IncludeDefaultMessage, ExtraMessage), nullptr, IncludeDefaultMessage, false);
+	return QueueTypedAnalyticsEvent(Writer, EventTypeDesign, CustomAttrs, OverrideSession, *CalculateFinalMessage(DefaultMessage, IncludeDefaultMessage, ExtraMessage), IncludeDefaultMessage);
 }
 
 bool FsparklogsAnalyticsProvider::CreateAnalyticsEventAd(const TCHAR* AdProvider, const TCHAR* AdPlacement, EsparklogsAnalyticsAdType AdType, EsparklogsAnalyticsAdAction AdAction, EsparklogsAnalyticsAdFailReason AdFailReason, const TCHAR* RevenueCurrency, double Revenue, double DurationSecs, int Count, const TCHAR* Reason, TSharedPtr<FJsonObject> CustomAttrs, bool IncludeDefaultMessage, const TCHAR* ExtraMessage, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
@@ -4248,62 +10577,57 @@ bool FsparklogsAnalyticsProvider::CreateAnalyticsEventAd(const TCHAR* AdProvider
 	}
 	FString EventId = FlattenEventIDs(EventIDParts);
 
-	TSharedPtr<FJsonObject> Data(new FJsonObject());
-	Data->SetStringField(AdFieldEventId, EventId);
-	TArray<TSharedPtr<FJsonValue>> EventIdPartsJson;
-	for (const FString& Part : EventIDParts)
+	if (Count < 1)
+	{
+		Count = 1;
+	}
+	if (Reason == nullptr)
 	{
-		EventIdPartsJson.Add(TSharedPtr<FJsonValue>(new FJsonValueString(Part)));
+		Reason = TEXT("");
 	}
-	Data->SetArrayField(AdFieldEventIdParts, EventIdPartsJson);
-	Data->SetStringField(AdFieldProvider, AdProvider);
-	Data->SetStringField(AdFieldPlacement, AdPlacement);
+
+	FsparklogsJSONWriterUTF8 Writer = BeginTypedAnalyticsEvent();
+	Writer.WriteString(AdFieldEventId, EventId);
+	Writer.WriteStringArray(AdFieldEventIdParts, EventIDParts, false);
+	Writer.WriteString(AdFieldProvider, AdProvider);
+	Writer.WriteString(AdFieldPlacement, AdPlacement);
 	if (AdType != nullptr && *AdType != 0)
 	{
-		Data->SetStringField(AdFieldType, AdType);
+		Writer.WriteString(AdFieldType, AdType);
 	}
 	if (AdAction != nullptr && *AdAction != 0)
 	{
-		Data->SetStringField(AdFieldAction, AdAction);
+		Writer.WriteString(AdFieldAction, AdAction);
 	}
 	if (AdFailReason != nullptr && *AdFailReason != 0)
 	{
-		Data->SetStringField(AdFieldFailReason, AdFailReason);
+		Writer.WriteString(AdFieldFailReason, AdFailReason);
 	}
 	if (RevenueCurrency != nullptr && *RevenueCurrency != 0)
 	{
-		Data->SetStringField(AdFieldCurrency, RevenueCurrency);
+		Writer.WriteString(AdFieldCurrency, RevenueCurrency);
 	}
 	if ((RevenueCurrency != nullptr && *RevenueCurrency != 0) || Revenue > 0)
 	{
-		Data->SetNumberField(AdFieldRevenue, Revenue);
+		Writer.WriteNumber(AdFieldRevenue, Revenue);
 	}
 	if (DurationSecs > 0.0)
 	{
-		Data->SetNumberField(AdFieldDurationSecs, DurationSecs);
-	}
-	if (Count < 1)
-	{
-		Count = 1;
-	}
-	Data->SetNumberField(AdFieldCount, (double)Count);
-	if (Reason != nullptr && *Reason != 0)
-	{
-		Data->SetStringField(AdFieldReason, Reason);
+		Writer.WriteNumber(AdFieldDurationSecs, DurationSecs);
 	}
-	else
+	Writer.WriteNumber(AdFieldCount, (double)Count);
+	if (*Reason != 0)
 	{
-		Reason = TEXT("");
+		Writer.WriteString(AdFieldReason, Reason);
 	}
-	if (CustomAttrs.IsValid() && CustomAttrs->Values.Num() > 0)
+	FString DefaultMessage;
+	if (IncludeDefaultMessage)
 	{
-		Data->SetObjectField(StandardFieldCustom, CustomAttrs);
+		DefaultMessage = FString::Printf(TEXT("%s: %s: event_id=`%s` ad_provider=`%s` ad_placement=`%s` ad_type=`%s` ad_action=`%s` ad_fail_reason=`%s` currency=`%s` revenue=%f duration_secs=%f count=%d reason=`%s`"),
+			MessageHeader, EventTypeAd, *EventId, AdProvider == nullptr ? TEXT("") : AdProvider, AdPlacement == nullptr ? TEXT("") : AdPlacement, AdType == nullptr ? TEXT("") : AdType, AdAction == nullptr ? TEXT("") : AdAction, AdFailReason == nullptr ? TEXT("") : AdFailReason, RevenueCurrency == nullptr ? TEXT("") : RevenueCurrency, Revenue, DurationSecs, Count, Reason
+		);
 	}
-	FinalizeAnalyticsEvent(EventTypeAd, OverrideSession, Data);
-	FString DefaultMessage = FString::Printf(TEXT("%s: %s: event_id=`%s` ad_provider=`%s` ad_placement=`%s` ad_type=`%s` ad_action=`%s` ad_fail_reason=`%s` currency=`%s` revenue=%f duration_secs=%f count=%d reason=`%s`"),
-		MessageHeader, EventTypeAd, *EventId, AdProvider == nullptr ? TEXT("") : AdProvider, AdPlacement == nullptr ? TEXT("") : AdPlacement, AdType == nullptr ? TEXT("") : AdType, AdAction == nullptr ? TEXT("") : AdAction, AdFailReason == nullptr ? TEXT("") : AdFailReason, RevenueCurrency == nullptr ? TEXT("") : RevenueCurrency, Revenue, DurationSecs, Count, Reason
-	);
-	return FsparklogsModule::GetModule().AddRawAnalyticsEvent(Data, *CalculateFinalMessage(DefaultMessage, IncludeDefaultMessage, ExtraMessage), nullptr, IncludeDefaultMessage, false);
+	return QueueTypedAnalyticsEvent(Writer, EventTypeAd, CustomAttrs, OverrideSession, *CalculateFinalMessage(DefaultMessage, IncludeDefaultMessage, ExtraMessage), IncludeDefaultMessage);
 }
 
 bool FsparklogsAnalyticsProvider::CreateAnalyticsEventLog(EsparklogsSeverity Severity, const TCHAR* Message, const TCHAR* Reason, TSharedPtr<FJsonObject> CustomAttrs, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
@@ -4316,19 +10640,12 @@ bool FsparklogsAnalyticsProvider::CreateAnalyticsEventLog(EsparklogsSeverity Sev
 	{
 		return false;
 	}
-	TSharedPtr<FJsonObject> RootData(new FJsonObject());
-	RootData->SetStringField(LogFieldSeverity, UEnum::GetDisplayValueAsText(Severity).ToString());
-	TSharedPtr<FJsonObject> Data(new FJsonObject());
+	FsparklogsJSONWriterUTF8 Writer = BeginTypedAnalyticsEvent(LogFieldSeverity, UEnum::GetDisplayValueAsText(Severity).ToString());
 	if (Reason != nullptr && *Reason != 0)
 	{
-		Data->SetStringField(LogFieldReason, Reason);
-	}
-	if (CustomAttrs.IsValid() && CustomAttrs->Values.Num() > 0)
-	{
-		Data->SetObjectField(StandardFieldCustom, CustomAttrs);
+		Writer.WriteString(LogFieldReason, Reason);
 	}
-	FinalizeAnalyticsEvent(EventTypeLog, OverrideSession, Data);
-	return FsparklogsModule::GetModule().AddRawAnalyticsEvent(Data, Message, RootData, false, false);
+	return QueueTypedAnalyticsEvent(Writer, EventTypeLog, CustomAttrs, OverrideSession, Message, false);
 }
 
 bool FsparklogsAnalyticsProvider::CreateAnalyticsEventLog(EsparklogsSeverity Severity, const TCHAR* Message, const TCHAR* Reason, const TArray<FsparklogsAnalyticsAttribute>& CustomAttrs, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
@@ -4353,6 +10670,11 @@ bool FsparklogsAnalyticsProvider::StartSession(const TCHAR* Reason, const TArray
 	{
 		return false;
 	}
+	if (!GetStateSnapshot()->SessionID.IsEmpty())
+	{
+		// Session already started (the common case for every event), treat as success without taking the lock
+		return true;
+	}
 	FScopeLock WriteLock(&DataCriticalSection);
 	if (!CurrentSessionID.IsEmpty())
 	{
@@ -4362,16 +10684,17 @@ bool FsparklogsAnalyticsProvider::StartSession(const TCHAR* Reason, const TArray
 	CurrentSessionID = ITLGenerateNewRandomID();
 	SessionStarted = FDateTime::UtcNow();
 	SessionNumber = Settings->GetSessionNumber(true);
+	PublishStateSnapshot();
 	TSharedPtr<FJsonObject> Data(new FJsonObject());
 	if (Reason != nullptr)
 	{
 		Data->SetStringField(SessionStartFieldReason, Reason);
 	}
-	InternalFinalizeAnalyticsEvent(EventTypeSessionStart, nullptr, Data);
+	InternalFinalizeAnalyticsEvent(*GetStateSnapshot(), EventTypeSessionStart, nullptr, Data);
 	FString SessionID = CurrentSessionID;
 	WriteLock.Unlock();
 	Settings->MarkStartOfAnalyticsSession(SessionID, SessionStarted);
-	return FsparklogsModule::GetModule().AddRawAnalyticsEvent(Data, *FString::Printf(TEXT("%s: %s: started new session. session_id=`%s`"), MessageHeader, EventTypeSessionStart, *SessionID), nullptr, false, true);
+	return QueueSessionAnalyticsEvent(Data, *FString::Printf(TEXT("%s: %s: started new session. session_id=`%s`"), MessageHeader, EventTypeSessionStart, *SessionID));
 }
 
 void FsparklogsAnalyticsProvider::EndSession()
@@ -4390,6 +10713,8 @@ void FsparklogsAnalyticsProvider::DoEndSession(const TCHAR* Reason, FDateTime Se
 	{
 		return;
 	}
+	// Rollups are stamped with the session when they are written, so write them while it is still active
+	FlushAggregatedEvents();
 	FScopeLock WriteLock(&DataCriticalSection);
 	if (CurrentSessionID.IsEmpty())
 	{
@@ -4413,14 +10738,15 @@ void FsparklogsAnalyticsProvider::DoEndSession(const TCHAR* Reason, FDateTime Se
 	{
 		Reason = TEXT("");
 	}
-	InternalFinalizeAnalyticsEvent(EventTypeSessionEnd, nullptr, Data);
+	InternalFinalizeAnalyticsEvent(*GetStateSnapshot(), EventTypeSessionEnd, nullptr, Data);
 
 	// Now reset the session data, release write lock, and send the data
 	CurrentSessionID.Reset();
 	SessionStarted = ITLEmptyDateTime;
 	SessionNumber = 0;
+	PublishStateSnapshot();
 	WriteLock.Unlock();
-	FsparklogsModule::GetModule().AddRawAnalyticsEvent(Data, *FString::Printf(TEXT("%s: %s: session ended. session_id=`%s` reason=`%s`"), MessageHeader, EventTypeSessionEnd, *SessionID, Reason), nullptr, false, true);
+	QueueSessionAnalyticsEvent(Data, *FString::Printf(TEXT("%s: %s: session ended. session_id=`%s` reason=`%s`"), MessageHeader, EventTypeSessionEnd, *SessionID, Reason));
 	// The app might end or go inactive soon, try to get the data to the cloud asap...
 	FsparklogsModule::GetModule().Flush();
 	Settings->MarkEndOfAnalyticsSession();
@@ -4428,20 +10754,19 @@ void FsparklogsAnalyticsProvider::DoEndSession(const TCHAR* Reason, FDateTime Se
 
 FString FsparklogsAnalyticsProvider::GetSessionID() const
 {
-	FScopeLock ReadLock(&DataCriticalSection);
-	return CurrentSessionID;
+	return GetStateSnapshot()->SessionID;
 }
 
 FSparkLogsAnalyticsSessionDescriptor FsparklogsAnalyticsProvider::GetSessionDescriptor()
 {
-	FScopeLock ReadLock(&DataCriticalSection);
-	if (CurrentSessionID.IsEmpty())
+	TSharedRef<const FAnalyticsStateSnapshot, ESPMode::ThreadSafe> State = GetStateSnapshot();
+	if (State->SessionID.IsEmpty())
 	{
 		return FSparkLogsAnalyticsSessionDescriptor();
 	}
 	else
 	{
-		return FSparkLogsAnalyticsSessionDescriptor(*CurrentSessionID, SessionNumber, SessionStarted, *Settings->GetEffectiveAnalyticsUserID());
+		return FSparkLogsAnalyticsSessionDescriptor(*State->SessionID, State->SessionNumber, State->SessionStarted, *Settings->GetEffectiveAnalyticsUserID());
 	}
 }
 
@@ -4456,6 +10781,7 @@ bool FsparklogsAnalyticsProvider::SetSessionID(const FString& InSessionID)
 	AutoCleanupSession(TEXT("session ID is explicitly changing"));
 	FScopeLock WriteLock(&DataCriticalSection);
 	CurrentSessionID = InSessionID;
+	PublishStateSnapshot();
 	return true;
 }
 
@@ -4465,6 +10791,7 @@ void FsparklogsAnalyticsProvider::FlushEvents()
 	{
 		return;
 	}
+	FlushAggregatedEvents();
 	FsparklogsModule::GetModule().Flush();
 }
 
@@ -4490,6 +10817,7 @@ void FsparklogsAnalyticsProvider::SetBuildInfo(const FString& InBuildInfo)
 	FAnalyticsEventAttribute Attr(MetaFieldBuild, InBuildInfo);
 	FScopeLock WriteLock(&DataCriticalSection);
 	AddAnalyticsEventAttributeToJsonObject(MetaAttributes, Attr, 1);
+	PublishStateSnapshot();
 }
 
 void FsparklogsAnalyticsProvider::SetGender(const FString& InGender)
@@ -4497,6 +10825,7 @@ void FsparklogsAnalyticsProvider::SetGender(const FString& InGender)
 	FAnalyticsEventAttribute Attr(MetaFieldGender, InGender);
 	FScopeLock WriteLock(&DataCriticalSection);
 	AddAnalyticsEventAttributeToJsonObject(MetaAttributes, Attr, 1);
+	PublishStateSnapshot();
 }
 
 void FsparklogsAnalyticsProvider::SetLocation(const FString& InLocation)
@@ -4504,6 +10833,7 @@ void FsparklogsAnalyticsProvider::SetLocation(const FString& InLocation)
 	FAnalyticsEventAttribute Attr(MetaFieldLocation, InLocation);
 	FScopeLock WriteLock(&DataCriticalSection);
 	AddAnalyticsEventAttributeToJsonObject(MetaAttributes, Attr, 1);
+	PublishStateSnapshot();
 }
 
 void FsparklogsAnalyticsProvider::SetAge(const int32 InAge)
@@ -4511,6 +10841,7 @@ void FsparklogsAnalyticsProvider::SetAge(const int32 InAge)
 	FAnalyticsEventAttribute Attr(MetaFieldAge, InAge);
 	FScopeLock WriteLock(&DataCriticalSection);
 	AddAnalyticsEventAttributeToJsonObject(MetaAttributes, Attr, 1);
+	PublishStateSnapshot();
 }
 
 void FsparklogsAnalyticsProvider::RecordEvent(const FString& EventName, const TArray<FAnalyticsEventAttribute>& Attributes)
@@ -4698,12 +11029,12 @@ void FsparklogsAnalyticsProvider::RecordProgress(const FString& ProgressType, co
 
 FAnalyticsEventAttribute FsparklogsAnalyticsProvider::GetDefaultEventAttribute(int AttributeIndex) const
 {
-	FScopeLock ReadLock(&DataCriticalSection);
-	if (AttributeIndex < 0 || AttributeIndex >= MetaAttributes->Values.Num())
+	TSharedRef<const FAnalyticsStateSnapshot, ESPMode::ThreadSafe> State = GetStateSnapshot();
+	if (AttributeIndex < 0 || AttributeIndex >= State->MetaAttributes->Values.Num())
 	{
 		return FAnalyticsEventAttribute();
 	}
-	auto it = MetaAttributes->Values.CreateConstIterator();
+	auto it = State->MetaAttributes->Values.CreateConstIterator();
 	for (int i = 0; i < AttributeIndex && it; i++)
 	{
 		++it;
@@ -4715,7 +11046,7 @@ FAnalyticsEventAttribute FsparklogsAnalyticsProvider::GetDefaultEventAttribute(i
 	return ConvertJsonValueToEventAttribute(it->Key, it->Value);
 }
 
-FAnalyticsEventAttribute FsparklogsAnalyticsProvider::ConvertJsonValueToEventAttribute(const FString& Key, TSharedPtr<FJsonValue> Value)
+FAnalyticsEventAttribute FsparklogsAnalyticsProvider::ConvertJsonValueToEventAttribute(const FString& Key, const TSharedPtr<FJsonValue>& Value)
 {
 	if (!Value.IsValid())
 	{
@@ -4746,16 +11077,15 @@ TSharedRef<FJsonValueArray> FsparklogsAnalyticsProvider::ConvertNonEmptyStringAr
 
 int32 FsparklogsAnalyticsProvider::GetDefaultEventAttributeCount() const
 {
-	FScopeLock ReadLock(&DataCriticalSection);
-	return MetaAttributes->Values.Num();
+	return GetStateSnapshot()->MetaAttributes->Values.Num();
 }
 
 TArray<FAnalyticsEventAttribute> FsparklogsAnalyticsProvider::GetDefaultEventAttributesSafe() const
 {
-	FScopeLock ReadLock(&DataCriticalSection);
+	TSharedRef<const FAnalyticsStateSnapshot, ESPMode::ThreadSafe> State = GetStateSnapshot();
 	TArray<FAnalyticsEventAttribute> Ret;
-	Ret.Reserve(MetaAttributes->Values.Num());
-	for (auto it = MetaAttributes->Values.CreateConstIterator(); it; ++it)
+	Ret.Reserve(State->MetaAttributes->Values.Num());
+	for (auto it = State->MetaAttributes->Values.CreateConstIterator(); it; ++it)
 	{
 		auto Attr = ConvertJsonValueToEventAttribute(it->Key, it->Value);
 		if (Attr.GetName().IsEmpty())
@@ -4773,6 +11103,7 @@ void FsparklogsAnalyticsProvider::SetDefaultEventAttributes(TArray<FAnalyticsEve
 	AddAnalyticsEventAttributesToJsonObject(NewMeta, Attributes);
 	FScopeLock WriteLock(&DataCriticalSection);
 	MetaAttributes = NewMeta;
+	PublishStateSnapshot();
 }
 
 bool FsparklogsAnalyticsProvider::AutoStartSessionBeforeEvent()
@@ -4810,136 +11141,450 @@ void FsparklogsAnalyticsProvider::CheckForStaleSessionAtStartup()
 		CurrentSessionID = LastSessionID;
 		SessionStarted = LastSessionStarted;
 		SessionNumber = LastSessionNumber;
+		PublishStateSnapshot();
 		WriteLock.Unlock();
 		// end the session with the effective end time matching the time of last analytics event in that session
 		DoEndSession(TEXT("stale session found at next game activation"), LastWrittenEvent);
 		Settings->MarkEndOfAnalyticsSession();
 	}
-}
+}
+
+void FsparklogsAnalyticsProvider::GetAnalyticsEventData(FString& OutSessionID, FDateTime& OutSessionStarted, int& OutSessionNumber, TSharedPtr<FJsonObject>& OutMetaAttributes) const
+{
+	TSharedRef<const FAnalyticsStateSnapshot, ESPMode::ThreadSafe> State = GetStateSnapshot();
+	OutSessionID = State->SessionID;
+	OutSessionStarted = State->SessionStarted;
+	OutSessionNumber = State->SessionNumber;
+	// The caller owns the returned object and may modify it, so it cannot share the snapshot's
+	OutMetaAttributes = CopyMetaAttributes(*State);
+}
+
+void FsparklogsAnalyticsProvider::SetMetaAttribute(const FString& Field, const TSharedPtr<FJsonValue> Value)
+{
+	FScopeLock WriteLock(&DataCriticalSection);
+	MetaAttributes->SetField(Field, Value);
+	PublishStateSnapshot();
+}
+
+int FsparklogsAnalyticsProvider::GetSessionNumber()
+{
+	return GetStateSnapshot()->SessionNumber;
+}
+
+void FsparklogsAnalyticsProvider::SetSessionNumber(int N)
+{
+	// This should really only be used on the server
+	FScopeLock WriteLock(&DataCriticalSection);
+	SessionNumber = N;
+	PublishStateSnapshot();
+}
+
+FDateTime FsparklogsAnalyticsProvider::GetSessionStarted()
+{
+	return GetStateSnapshot()->SessionStarted;
+}
+
+void FsparklogsAnalyticsProvider::SetSessionStarted(FDateTime DT)
+{
+	// This should really only be used on the server
+	FScopeLock WriteLock(&DataCriticalSection);
+	SessionStarted = DT;
+	PublishStateSnapshot();
+}
+
+TArray<FString> FsparklogsAnalyticsProvider::GetUserTags()
+{
+	return GetStateSnapshot()->UserTags;
+}
+
+void FsparklogsAnalyticsProvider::SetUserTags(const TArray<FString>& Tags)
+{
+	FScopeLock WriteLock(&DataCriticalSection);
+	UserTags = Tags;
+	UserTags.StableSort();
+	PublishStateSnapshot();
+}
+
+void FsparklogsAnalyticsProvider::FinalizeAnalyticsEvent(const TCHAR* EventType, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession, TSharedPtr<FJsonObject>& Object)
+{
+	InternalFinalizeAnalyticsEvent(*GetEventStateSnapshot(), EventType, OverrideSession, Object);
+}
+
+void FsparklogsAnalyticsProvider::InternalFinalizeAnalyticsEvent(const FAnalyticsStateSnapshot& State, const TCHAR* EventType, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession, TSharedPtr<FJsonObject>& Object)
+{
+	if (!Object.IsValid())
+	{
+		Object = TSharedPtr<FJsonObject>(new FJsonObject());
+	}
+
+	if (EventType != nullptr)
+	{
+		Object->SetStringField(StandardFieldEventType, EventType);
+	}
+
+	FString GameID = Settings->AnalyticsGameID;
+	FString UserID = Settings->GetEffectiveAnalyticsUserID();
+	FString PlayerID = Settings->GetEffectiveAnalyticsPlayerID();
+	FString EffectiveSessionID = State.SessionID;
+	FDateTime EffectiveSessionStarted = State.SessionStarted;
+	int EffectiveSessionNumber = State.SessionNumber;
+
+	if (OverrideSession != nullptr)
+	{
+		EffectiveSessionID = OverrideSession->SessionID;
+		EffectiveSessionNumber = OverrideSession->SessionNumber;
+		EffectiveSessionStarted = OverrideSession->SessionStarted;
+		UserID = OverrideSession->UserID;
+		PlayerID = FsparklogsSettings::CalculatePlayerID(GameID, UserID);
+	}
+	if (EffectiveSessionID.IsEmpty() || GameID.IsEmpty() || UserID.IsEmpty() || PlayerID.IsEmpty())
+	{
+		// We cannot send an analytics event without a valid session ID, game ID, user ID, and player ID
+		Object.Reset();
+		return;
+	}
+
+	Object->SetStringField(StandardFieldSessionId, EffectiveSessionID);
+	if (EffectiveSessionNumber > 0)
+	{
+		Object->SetNumberField(StandardFieldSessionNumber, (double)EffectiveSessionNumber);
+	}
+	if (EffectiveSessionStarted != ITLEmptyDateTime)
+	{
+		Object->SetStringField(StandardFieldSessionStarted, ITLGetUTCDateTimeAsRFC3339(EffectiveSessionStarted));
+	}
+	Object->SetStringField(StandardFieldSessionType, GetITLLaunchConfiguration(false));
+	Object->SetStringField(StandardFieldAppId, GameID);
+	if (!State.FlattenedUserTags.IsEmpty())
+	{
+		Object->SetStringField(StandardFieldUserTags, State.FlattenedUserTags);
+		Object->SetField(StandardFieldUserTagsArray, ConvertNonEmptyStringArrayToJSON(State.UserTags));
+	}
+	Object->SetStringField(StandardFieldUserId, UserID);
+	Object->SetStringField(StandardFieldPlayerId, PlayerID);
+
+	FDateTime InstallTime = Settings->GetEffectiveAnalyticsInstallTime();
+	Object->SetStringField(StandardFieldFirstInstalled, ITLGetUTCDateTimeAsRFC3339(InstallTime));
+
+	// Each event gets its own copy, since the caller might still modify the event
+	Object->SetObjectField(StandardFieldMeta, CopyMetaAttributes(State));
+}
+
+bool FsparklogsAnalyticsProvider::WriteStandardAnalyticsFields(FsparklogsJSONWriterUTF8& Writer, const TCHAR* EventType, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
+{
+	FsparklogsAnalyticsBatch* Batch = FsparklogsAnalyticsBatch::GetActive();
+	if (Batch == nullptr || OverrideSession != nullptr)
+	{
+		return WriteStandardAnalyticsFieldsFromState(Writer, *GetEventStateSnapshot(), EventType, OverrideSession);
+	}
+	// Everything after the event type is the same for every event in the batch, so only encode it once
+	if (Batch->StandardFieldsUTF8.Len() <= 0)
+	{
+		FsparklogsJSONWriterUTF8 FieldsWriter(Batch->StandardFieldsUTF8);
+		if (!WriteStandardAnalyticsFieldsFromState(FieldsWriter, *GetEventStateSnapshot(), nullptr, nullptr))
+		{
+			Batch->StandardFieldsUTF8.Reset();
+			return false;
+		}
+	}
+	if (EventType != nullptr)
+	{
+		Writer.WriteString(StandardFieldEventType, EventType);
+	}
+	Writer.WriteRawFields(Batch->StandardFieldsUTF8.GetData(), Batch->StandardFieldsUTF8.Len());
+	return true;
+}
+
+bool FsparklogsAnalyticsProvider::WriteStandardAnalyticsFieldsFromState(FsparklogsJSONWriterUTF8& Writer, const FAnalyticsStateSnapshot& State, const TCHAR* EventType, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
+{
+	FString GameID = Settings->AnalyticsGameID;
+	FString UserID = Settings->GetEffectiveAnalyticsUserID();
+	FString PlayerID = Settings->GetEffectiveAnalyticsPlayerID();
+	const FString* EffectiveSessionID = &State.SessionID;
+	FDateTime EffectiveSessionStarted = State.SessionStarted;
+	int EffectiveSessionNumber = State.SessionNumber;
+	if (OverrideSession != nullptr)
+	{
+		EffectiveSessionID = &OverrideSession->SessionID;
+		EffectiveSessionNumber = OverrideSession->SessionNumber;
+		EffectiveSessionStarted = OverrideSession->SessionStarted;
+		UserID = OverrideSession->UserID;
+		PlayerID = FsparklogsSettings::CalculatePlayerID(GameID, UserID);
+	}
+	if (EffectiveSessionID->IsEmpty() || GameID.IsEmpty() || UserID.IsEmpty() || PlayerID.IsEmpty())
+	{
+		// We cannot send an analytics event without a valid session ID, game ID, user ID, and player ID
+		return false;
+	}
+
+	// Same fields in the same order as InternalFinalizeAnalyticsEvent
+	if (EventType != nullptr)
+	{
+		Writer.WriteString(StandardFieldEventType, EventType);
+	}
+	Writer.WriteString(StandardFieldSessionId, *EffectiveSessionID);
+	if (EffectiveSessionNumber > 0)
+	{
+		Writer.WriteNumber(StandardFieldSessionNumber, (double)EffectiveSessionNumber);
+	}
+	if (EffectiveSessionStarted != ITLEmptyDateTime)
+	{
+		Writer.WriteString(StandardFieldSessionStarted, ITLGetUTCDateTimeAsRFC3339(EffectiveSessionStarted));
+	}
+	Writer.WriteString(StandardFieldSessionType, GetITLLaunchConfiguration(false));
+	Writer.WriteString(StandardFieldAppId, GameID);
+	if (!State.FlattenedUserTags.IsEmpty())
+	{
+		Writer.WriteString(StandardFieldUserTags, State.FlattenedUserTags);
+		Writer.WriteStringArray(StandardFieldUserTagsArray, State.UserTags, true);
+	}
+	Writer.WriteString(StandardFieldUserId, UserID);
+	Writer.WriteString(StandardFieldPlayerId, PlayerID);
+	Writer.WriteString(StandardFieldFirstInstalled, ITLGetUTCDateTimeAsRFC3339(Settings->GetEffectiveAnalyticsInstallTime()));
 
-void FsparklogsAnalyticsProvider::GetAnalyticsEventData(FString& OutSessionID, FDateTime& OutSessionStarted, int& OutSessionNumber, TSharedPtr<FJsonObject>& OutMetaAttributes) const
-{
-	FScopeLock ReadLock(&DataCriticalSection);
-	OutSessionID = CurrentSessionID;
-	OutSessionStarted = SessionStarted;
-	OutSessionNumber = SessionNumber;
-	OutMetaAttributes = TSharedPtr<FJsonObject>(new FJsonObject(*MetaAttributes));
+	Writer.WriteRawValue(StandardFieldMeta, State.MetaAttributesUTF8.GetData(), State.MetaAttributesUTF8.Len());
+	return true;
 }
 
-void FsparklogsAnalyticsProvider::SetMetaAttribute(const FString& Field, const TSharedPtr<FJsonValue> Value)
+TSharedRef<const FsparklogsAnalyticsProvider::FAnalyticsStateSnapshot, ESPMode::ThreadSafe> FsparklogsAnalyticsProvider::GetStateSnapshot() const
 {
-	FScopeLock WriteLock(&DataCriticalSection);
-	MetaAttributes->SetField(Field, Value);
+	FReadScopeLock ReadLock(PublishedStateLock);
+	return PublishedState;
 }
 
-int FsparklogsAnalyticsProvider::GetSessionNumber()
+TSharedRef<const FsparklogsAnalyticsProvider::FAnalyticsStateSnapshot, ESPMode::ThreadSafe> FsparklogsAnalyticsProvider::GetEventStateSnapshot() const
 {
-	FScopeLock ReadLock(&DataCriticalSection);
-	return SessionNumber;
+	FsparklogsAnalyticsBatch* Batch = FsparklogsAnalyticsBatch::GetActive();
+	if (Batch == nullptr)
+	{
+		return GetStateSnapshot();
+	}
+	if (!Batch->StateSnapshot.IsValid())
+	{
+		Batch->StateSnapshot = GetStateSnapshot();
+	}
+	return Batch->StateSnapshot.ToSharedRef();
 }
 
-void FsparklogsAnalyticsProvider::SetSessionNumber(int N)
+TSharedRef<FJsonObject> FsparklogsAnalyticsProvider::CopyMetaAttributes(const FAnalyticsStateSnapshot& State)
 {
-	// This should really only be used on the server
-	FScopeLock WriteLock(&DataCriticalSection);
-	SessionNumber = N;
+	// Decoded from the JSON encoding rather than copied from MetaAttributes, so the copy shares no nested objects with the snapshot: the caller may
+	// modify the copy while other threads read the snapshot, and the TMap of FJsonObject is not safe to modify while it is being read
+	TSharedPtr<FJsonObject> Meta;
+	TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(ITLConvertUTF8(State.MetaAttributesUTF8.GetData(), State.MetaAttributesUTF8.Len()));
+	if (!FJsonSerializer::Deserialize(Reader, Meta) || !Meta.IsValid())
+	{
+		return MakeShared<FJsonObject>();
+	}
+	return Meta.ToSharedRef();
 }
 
-FDateTime FsparklogsAnalyticsProvider::GetSessionStarted()
+void FsparklogsAnalyticsProvider::PublishStateSnapshot()
 {
-	FScopeLock ReadLock(&DataCriticalSection);
-	return SessionStarted;
+	// Build the new snapshot completely before publishing it; readers holding the previous one keep it alive until they are done.
+	TSharedRef<FAnalyticsStateSnapshot, ESPMode::ThreadSafe> State = MakeShared<FAnalyticsStateSnapshot, ESPMode::ThreadSafe>();
+	State->SessionID = CurrentSessionID;
+	State->SessionStarted = SessionStarted;
+	State->SessionNumber = SessionNumber;
+	FsparklogsJSONWriterUTF8 MetaWriter(State->MetaAttributesUTF8);
+	MetaWriter.BeginObject();
+	MetaWriter.WriteJsonObjectFields(*MetaAttributes);
+	MetaWriter.EndObject();
+	// Built from its own decoded copy, so it shares no values with MetaAttributes, which keeps changing
+	State->MetaAttributes = MakeShared<FJsonObject, ESPMode::ThreadSafe>(MoveTemp(CopyMetaAttributes(*State).Get()));
+	State->UserTags = UserTags;
+	State->FlattenedUserTags = FlattenEventIDs(UserTags);
+
+	{
+		FWriteScopeLock WriteLock(PublishedStateLock);
+		PublishedState = State;
+	}
+	// Events recorded after this change (e.g., the session start event) must not be stamped with what the batch cached earlier
+	if (FsparklogsAnalyticsBatch* Batch = FsparklogsAnalyticsBatch::GetActive())
+	{
+		Batch->InvalidateStateSnapshot();
+	}
 }
 
-void FsparklogsAnalyticsProvider::SetSessionStarted(FDateTime DT)
+/** Per-thread buffer that typed analytics events are written into. Grows to the largest event seen on the thread and is never shrunk. */
+static thread_local TITLJSONStringBuilder GITLTypedAnalyticsEventBuffer;
+
+FsparklogsJSONWriterUTF8 FsparklogsAnalyticsProvider::BeginTypedAnalyticsEvent(const TCHAR* RootFieldName, const FString& RootFieldValue)
 {
-	// This should really only be used on the server
-	FScopeLock WriteLock(&DataCriticalSection);
-	SessionStarted = DT;
+	FsparklogsJSONWriterUTF8 Writer(GITLTypedAnalyticsEventBuffer);
+	Writer.BeginObject();
+	if (RootFieldName != nullptr)
+	{
+		Writer.WriteString(RootFieldName, RootFieldValue);
+	}
+	Writer.BeginObject(RootAnalyticsFieldName);
+	return Writer;
 }
 
-TArray<FString> FsparklogsAnalyticsProvider::GetUserTags()
+bool FsparklogsAnalyticsProvider::QueueSessionAnalyticsEvent(TSharedPtr<FJsonObject> Data, const TCHAR* LogMessage)
 {
-	FScopeLock ReadLock(&DataCriticalSection);
-	return UserTags;
+	if (OutputDevice == nullptr)
+	{
+		return FsparklogsModule::GetModule().AddRawAnalyticsEvent(Data, LogMessage, nullptr, false, true);
+	}
+	FString OutputJson;
+	if (!FsparklogsModule::FormatRawAnalyticsEvent(Data, nullptr, false, OutputJson))
+	{
+		return false;
+	}
+	return OutputDevice->AddRawEventWithJSONObject(OutputJson, LogMessage, true);
 }
 
-void FsparklogsAnalyticsProvider::SetUserTags(const TArray<FString>& Tags)
+bool FsparklogsAnalyticsProvider::QueueTypedAnalyticsEvent(FsparklogsJSONWriterUTF8& Writer, const TCHAR* EventType, TSharedPtr<FJsonObject> CustomAttrs, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession, const TCHAR* LogMessage, bool ForceDisableAutoExtract)
 {
-	FScopeLock WriteLock(&DataCriticalSection);
-	UserTags = Tags;
-	UserTags.StableSort();
+	if (CustomAttrs.IsValid() && CustomAttrs->Values.Num() > 0)
+	{
+		Writer.BeginObject(StandardFieldCustom);
+		Writer.WriteJsonObjectFields(*CustomAttrs);
+		Writer.EndObject();
+	}
+	if (!WriteStandardAnalyticsFields(Writer, EventType, OverrideSession))
+	{
+		return false;
+	}
+	Writer.EndObject();
+	if (ForceDisableAutoExtract)
+	{
+		Writer.WriteBool(FsparklogsModule::OverrideAutoExtractDisabled, true);
+	}
+	Writer.EndObject();
+	if (OutputDevice != nullptr)
+	{
+		return OutputDevice->AddRawEventWithUTF8JSONObject(Writer.GetData(), Writer.Len(), LogMessage, true);
+	}
+	return FsparklogsModule::GetModule().AddRawAnalyticsEventUTF8(Writer.GetData(), Writer.Len(), LogMessage, false);
 }
 
-void FsparklogsAnalyticsProvider::FinalizeAnalyticsEvent(const TCHAR* EventType, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession, TSharedPtr<FJsonObject>& Object)
+bool FsparklogsAnalyticsProvider::CanAggregateEvent(TSharedPtr<FJsonObject> CustomAttrs, const TCHAR* ExtraMessage) const
 {
-	FScopeLock ReadLock(&DataCriticalSection);
-	InternalFinalizeAnalyticsEvent(EventType, OverrideSession, Object);
+	// Custom attributes and messages can be different for every event, so they cannot be summed up
+	return Settings->AnalyticsAggregationWindowSecs > 0.0 && (!CustomAttrs.IsValid() || CustomAttrs->Values.Num() <= 0) && (ExtraMessage == nullptr || *ExtraMessage == 0);
 }
 
-void FsparklogsAnalyticsProvider::InternalFinalizeAnalyticsEvent(const TCHAR* EventType, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession, TSharedPtr<FJsonObject>& Object)
+void FsparklogsAnalyticsProvider::AggregateEvent(FsparklogsAnalyticsAggregator::FRollup& Event, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession)
 {
-	if (!Object.IsValid())
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsAnalyticsProvider_AggregateEvent);
+	if (OverrideSession != nullptr && !OverrideSession->SessionID.IsEmpty())
 	{
-		Object = TSharedPtr<FJsonObject>(new FJsonObject());
+		Event.SessionID = OverrideSession->SessionID;
+		Event.OverrideSession = *OverrideSession;
 	}
-
-	if (EventType != nullptr)
+	else
 	{
-		Object->SetStringField(StandardFieldEventType, EventType);
+		Event.SessionID = GetEventStateSnapshot()->SessionID;
 	}
+	Event.Count = 1;
+	TArray<FsparklogsAnalyticsAggregator::FRollup> Due;
+	Aggregator.Add(Event, Settings->AnalyticsAggregationWindowSecs, Settings->AnalyticsAggregationMaxKeys, Due);
+	WriteRollupEvents(Due);
+}
 
-	TArray<FString> UserTagsArray = GetUserTags();
-	FString FlattenedUserTags = FlattenEventIDs(UserTagsArray);
+void FsparklogsAnalyticsProvider::FlushAggregatedEvents()
+{
+	TArray<FsparklogsAnalyticsAggregator::FRollup> Rollups;
+	Aggregator.TakeAll(Rollups);
+	WriteRollupEvents(Rollups);
+}
 
-	FString GameID = Settings->AnalyticsGameID;
-	FString UserID = Settings->GetEffectiveAnalyticsUserID();
-	FString PlayerID = Settings->GetEffectiveAnalyticsPlayerID();
-	FString EffectiveSessionID = CurrentSessionID;
-	FDateTime EffectiveSessionStarted = SessionStarted;
-	int EffectiveSessionNumber = SessionNumber;
-	TSharedPtr<FJsonObject> EffectiveMetaAttributes(new FJsonObject(*MetaAttributes));
+void FsparklogsAnalyticsProvider::FlushAggregatedEventsIfDue()
+{
+	TArray<FsparklogsAnalyticsAggregator::FRollup> Due;
+	Aggregator.TakeDue(Settings->AnalyticsAggregationWindowSecs, Due);
+	WriteRollupEvents(Due);
+}
 
-	if (OverrideSession != nullptr)
+void FsparklogsAnalyticsProvider::WriteRollupEvents(const TArray<FsparklogsAnalyticsAggregator::FRollup>& Rollups)
+{
+	if (Rollups.Num() <= 0)
 	{
-		EffectiveSessionID = OverrideSession->SessionID;
-		EffectiveSessionNumber = OverrideSession->SessionNumber;
-		EffectiveSessionStarted = OverrideSession->SessionStarted;
-		UserID = OverrideSession->UserID;
-		PlayerID = FsparklogsSettings::CalculatePlayerID(GameID, UserID);
+		return;
 	}
-	if (EffectiveSessionID.IsEmpty() || GameID.IsEmpty() || UserID.IsEmpty() || PlayerID.IsEmpty())
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsAnalyticsProvider_WriteRollupEvents);
+	// All rollups share one write to the log
+	FsparklogsAnalyticsBatch Batch;
+	const FString CurrentSessionIDSnapshot = GetSessionID();
+	for (const FsparklogsAnalyticsAggregator::FRollup& Rollup : Rollups)
 	{
-		// We cannot send an analytics event without a valid session ID, game ID, user ID, and player ID
-		Object.Reset();
-		return;
+		const FSparkLogsAnalyticsSessionDescriptor* OverrideSession = Rollup.OverrideSession.GetPtrOrNull();
+		FSparkLogsAnalyticsSessionDescriptor PastSession;
+		if (OverrideSession == nullptr && Rollup.SessionID != CurrentSessionIDSnapshot)
+		{
+			// The session changed since the events were recorded (without ending, e.g., on a dedicated server). Events recorded before any
+			// session started keep their empty session rather than being stamped with the current one, exactly as if they were written one by one.
+			PastSession = FSparkLogsAnalyticsSessionDescriptor(*Rollup.SessionID, *Settings->GetEffectiveAnalyticsUserID());
+			OverrideSession = &PastSession;
+		}
+		FsparklogsJSONWriterUTF8 Writer = BeginTypedAnalyticsEvent();
+		const double* Value = Rollup.HasValue ? &Rollup.Sum : nullptr;
+		if (Rollup.EventType == EventTypeResource)
+		{
+			WriteResourceFields(Writer, Rollup.FlowType, *Rollup.VirtualCurrency, *Rollup.ItemCategory, *Rollup.ItemId, Rollup.EventID, Rollup.Sum, *Rollup.Reason);
+		}
+		else
+		{
+			WriteDesignFields(Writer, Rollup.EventID, Rollup.EventIDParts, Value, *Rollup.Reason);
+		}
+		Writer.WriteNumber(RollupFieldCount, (double)Rollup.Count);
+		Writer.WriteString(RollupFieldStarted, ITLGetUTCDateTimeAsRFC3339(Rollup.Started));
+		FString ValueDesc = Value == nullptr ? FString() : FString::Printf(TEXT(" sum=%f"), *Value);
+		FString Message = FString::Printf(TEXT("%s: %s: rollup of %lld events: event_id=`%s`%s reason=`%s`"), MessageHeader, Rollup.EventType, Rollup.Count, *Rollup.EventID, *ValueDesc, *Rollup.Reason);
+		if (!QueueTypedAnalyticsEvent(Writer, Rollup.EventType, nullptr, OverrideSession, *Message, true))
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Unable to write an analytics rollup event, dropping the events it sums up: event_type=%s, event_id='%s', count=%lld, session_id='%s'"), Rollup.EventType, *Rollup.EventID, Rollup.Count, *Rollup.SessionID);
+		}
 	}
+}
 
-	Object->SetStringField(StandardFieldSessionId, EffectiveSessionID);
-	if (EffectiveSessionNumber > 0)
+void FsparklogsAnalyticsProvider::WriteResourceFields(FsparklogsJSONWriterUTF8& Writer, const FString& FlowTypeStr, const TCHAR* VirtualCurrency, const TCHAR* ItemCategory, const TCHAR* ItemId, const FString& EventID, double Amount, const TCHAR* Reason)
+{
+	const bool HasItemCategory = *ItemCategory != 0;
+	const bool HasItemId = *ItemId != 0;
+	Writer.WriteString(ResourceFieldFlowType, FlowTypeStr);
+	Writer.WriteString(ResourceFieldVirtualCurrency, VirtualCurrency);
+	if (HasItemCategory)
 	{
-		Object->SetNumberField(StandardFieldSessionNumber, (double)EffectiveSessionNumber);
+		Writer.WriteString(ResourceFieldItemCategory, ItemCategory);
 	}
-	if (EffectiveSessionStarted != ITLEmptyDateTime)
+	if (HasItemId)
 	{
-		Object->SetStringField(StandardFieldSessionStarted, ITLGetUTCDateTimeAsRFC3339(EffectiveSessionStarted));
+		Writer.WriteString(ResourceFieldItemId, ItemId);
 	}
-	Object->SetStringField(StandardFieldSessionType, GetITLLaunchConfiguration(false));
-	Object->SetStringField(StandardFieldAppId, GameID);
-	if (!FlattenedUserTags.IsEmpty())
+	Writer.WriteString(ResourceFieldEventId, EventID);
+	Writer.BeginArray(ResourceFieldEventIdParts);
+	Writer.WriteString(nullptr, FlowTypeStr);
+	Writer.WriteString(nullptr, VirtualCurrency);
+	if (HasItemCategory)
 	{
-		Object->SetStringField(StandardFieldUserTags, FlattenedUserTags);
-		Object->SetField(StandardFieldUserTagsArray, ConvertNonEmptyStringArrayToJSON(UserTagsArray));
+		Writer.WriteString(nullptr, ItemCategory);
 	}
-	Object->SetStringField(StandardFieldUserId, UserID);
-	Object->SetStringField(StandardFieldPlayerId, PlayerID);
-
-	FDateTime InstallTime = Settings->GetEffectiveAnalyticsInstallTime();
-	Object->SetStringField(StandardFieldFirstInstalled, ITLGetUTCDateTimeAsRFC3339(InstallTime));
+	if (HasItemId)
+	{
+		Writer.WriteString(nullptr, ItemId);
+	}
+	Writer.EndArray();
+	Writer.WriteNumber(ResourceFieldAmount, Amount);
+	if (*Reason != 0)
+	{
+		Writer.WriteString(ResourceFieldReason, Reason);
+	}
+}
 
-	if (EffectiveMetaAttributes.IsValid())
+void FsparklogsAnalyticsProvider::WriteDesignFields(FsparklogsJSONWriterUTF8& Writer, const FString& EventId, const TArray<FString>& EventIDParts, const double* Value, const TCHAR* Reason)
+{
+	Writer.WriteString(DesignFieldEventId, EventId);
+	Writer.WriteStringArray(DesignFieldEventIdParts, EventIDParts, false);
+	if (Value != nullptr)
+	{
+		Writer.WriteNumber(DesignFieldValue, *Value);
+	}
+	if (*Reason != 0)
 	{
-		Object->SetObjectField(StandardFieldMeta, EffectiveMetaAttributes);
+		Writer.WriteString(DesignFieldReason, Reason);
 	}
 }
 
@@ -5069,13 +11714,97 @@ void FsparklogsAnalyticsProvider::SetupDefaultMetaAttributes()
 	}
 }
 
+// =============== FsparklogsAnalyticsBatch ===============================================================================
+
+/** The outermost batch that is active on the calling thread, if any. */
+static thread_local FsparklogsAnalyticsBatch* GITLActiveAnalyticsBatch = nullptr;
+/** The generation of the next batch created on any thread. */
+static std::atomic<uint64> GITLNextAnalyticsBatchGeneration(1);
+
+FsparklogsAnalyticsBatch::FsparklogsAnalyticsBatch()
+	: NumAdded(0)
+	, Generation(GITLNextAnalyticsBatchGeneration.fetch_add(1))
+{
+	if (GITLActiveAnalyticsBatch == nullptr)
+	{
+		GITLActiveAnalyticsBatch = this;
+	}
+}
+
+FsparklogsAnalyticsBatch::~FsparklogsAnalyticsBatch()
+{
+	if (IsOutermost())
+	{
+		Commit();
+		GITLActiveAnalyticsBatch = nullptr;
+	}
+}
+
+FsparklogsAnalyticsBatch* FsparklogsAnalyticsBatch::GetActive()
+{
+	return GITLActiveAnalyticsBatch;
+}
+
+int32 FsparklogsAnalyticsBatch::Commit()
+{
+	if (!IsOutermost())
+	{
+		return 0;
+	}
+	const int32 NumEvents = Num();
+	if (NumEvents > 0 && FsparklogsModule::IsModuleLoaded())
+	{
+		FsparklogsModule::GetModule().WriteAnalyticsBatch(*this);
+	}
+	Reset();
+	return NumEvents;
+}
+
+void FsparklogsAnalyticsBatch::Add(const ANSICHAR* RawJSONWithBraces, int32 RawJSONLen, const TCHAR* Message)
+{
+	// Same layout that FsparklogsOutputDeviceFile::AddRawEventWithUTF8JSONObject writes for a single event
+	ANSICHAR TimestampFragment[64];
+	const int32 TimestampFragmentLen = ITLFormatUTCNowTimestampField(TimestampFragment, UE_ARRAY_COUNT(TimestampFragment));
+	RawJSON.Append(TimestampFragment, TimestampFragmentLen);
+	if (RawJSONWithBraces != nullptr && RawJSONLen > 2 && RawJSONWithBraces[0] == '{' && RawJSONWithBraces[RawJSONLen - 1] == '}')
+	{
+		RawJSON.Append(",", 1);
+		RawJSON.Append(RawJSONWithBraces + 1, RawJSONLen - 2);
+	}
+	RawJSONEnds.Add(RawJSON.Len());
+	if (Message != nullptr)
+	{
+		Messages.Append(Message, FCString::Strlen(Message));
+	}
+	MessageEnds.Add(Messages.Num());
+	NumAdded++;
+}
+
+void FsparklogsAnalyticsBatch::Reset()
+{
+	RawJSON.Reset();
+	RawJSONEnds.Reset();
+	Messages.Reset();
+	MessageEnds.Reset();
+	InvalidateStateSnapshot();
+}
+
+void FsparklogsAnalyticsBatch::InvalidateStateSnapshot()
+{
+	StateSnapshot.Reset();
+	StandardFieldsUTF8.Reset();
+}
+
 // =============== FsparklogsModule ===============================================================================
 
 TSharedPtr<FsparklogsAnalyticsProvider> FsparklogsModule::AnalyticsProvider;
 
 FsparklogsModule::FsparklogsModule()
 	: EngineActive(false)
+	, AsyncStartupPending(false)
+	, NumStartupAnalyticsEventsDropped(0)
 	, Settings(new FsparklogsSettings(GetITLPluginIndexedLock().IndexedLockFile->GetLockIndex()))
+	, AnalyticsLaneActive(false)
 {
 	AppInstanceID = ITLGenerateRandomAlphaNumID(24);
 }
@@ -5085,6 +11814,11 @@ void FsparklogsModule::StartupModule()
 	FCoreDelegates::OnPostEngineInit.AddRaw(this, &FsparklogsModule::OnPostEngineInit);
 	FCoreDelegates::ApplicationWillEnterBackgroundDelegate.AddRaw(this, &FsparklogsModule::OnAppEnterBackground);
 	FCoreDelegates::ApplicationHasEnteredForegroundDelegate.AddRaw(this, &FsparklogsModule::OnAppEnterForeground);
+#if ENGINE_MAJOR_VERSION >= 5
+	TickHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FsparklogsModule::OnTick));
+#else
+	TickHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FsparklogsModule::OnTick));
+#endif
 
 	UE_LOG(LogPluginSparkLogs, Display, TEXT("SparkLogsPlugin is starting up! Build_Version=%s SettingsConfiguration=%s InstanceIndex=%d"), *ITLGetPluginVersion(), GetITLLaunchConfiguration(true), GetITLPluginIndexedLock().IndexedLockFile->GetLockIndex());
 
@@ -5122,6 +11856,12 @@ void FsparklogsModule::StartupModule()
 		}
 	}
 
+	Settings->LoadStartupSettings();
+	if (Settings->AutoStart && Settings->AsyncStartup && FPlatformProcess::SupportsMultithreading())
+	{
+		BeginAsyncStartup();
+		return;
+	}
 	Settings->LoadSettings();
 	if (Settings->AutoStart)
 	{
@@ -5134,42 +11874,227 @@ void FsparklogsModule::StartupModule()
 	}
 }
 
+void FsparklogsModule::BeginAsyncStartup()
+{
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("AsyncStartup is enabled. Starting the shipping engine in the background. StartupPreBufferBytes=%d"), (int)Settings->StartupPreBufferBytes);
+	// Create the analytics provider singleton here so it is never raced by the game thread
+	GetAnalyticsProvider();
+	// Analytics events recorded while the engine starts read these settings, so they must not change on the background task
+	FSparkLogsEngineOptions DefaultOptions;
+	LoadSettingsForStartup(DefaultOptions);
+	AsyncStartupPending = true;
+	FsparklogsOutputDeviceFile* GameLogDevice = GetITLInternalGameLog(nullptr).LogDevice.Get();
+	GameLogDevice->StartPreBuffer(Settings->StartupPreBufferBytes);
+	GLog->AddOutputDevice(GameLogDevice);
+	// Delegates are not thread-safe, so bind here instead of on the background task (does nothing if the engine does not start)
+	FCoreDelegates::OnEnginePreExit.AddRaw(this, &FsparklogsModule::OnEnginePreExit);
+	AsyncStartupTask = Async(EAsyncExecution::ThreadPool, [this, DefaultOptions]()
+	{
+		InternalStartShippingEngine(DefaultOptions, false);
+		FinishAsyncStartup();
+	});
+}
+
+void FsparklogsModule::FinishAsyncStartup()
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsModule_FinishAsyncStartup);
+	FsparklogsOutputDeviceFile* GameLogDevice = GetITLInternalGameLog(nullptr).LogDevice.Get();
+	const bool KeepLogs = EngineActive && Settings->CollectLogs;
+	const int32 NumLinesWritten = GameLogDevice->EndPreBuffer(KeepLogs);
+	if (!KeepLogs)
+	{
+		GLog->RemoveOutputDevice(GameLogDevice);
+	}
+
+	int32 NumEventsWritten = 0;
+	int32 NumEventsDropped = 0;
+	{
+		FScopeLock StartupAnalyticsLock(&StartupAnalyticsCriticalSection);
+		if (EngineActive && Settings->CollectAnalytics && StartupAnalyticsJSONEnds.Num() > 0)
+		{
+			NumEventsWritten = StartupAnalyticsJSONEnds.Num();
+			Settings->MarkLastWrittenAnalyticsEvent();
+			GetAnalyticsLogDevice()->AddRawEventsUTF8(NumEventsWritten, StartupAnalyticsJSON.GetData(), StartupAnalyticsJSONEnds.GetData(), StartupAnalyticsMessages.GetData(), StartupAnalyticsMessageEnds.GetData());
+		}
+		NumEventsDropped = NumStartupAnalyticsEventsDropped;
+		StartupAnalyticsJSON.Empty();
+		StartupAnalyticsJSONEnds.Empty();
+		StartupAnalyticsMessages.Empty();
+		StartupAnalyticsMessageEnds.Empty();
+		NumStartupAnalyticsEventsDropped = 0;
+		// Cleared under the lock so that no event can be held after the held events are written
+		AsyncStartupPending = false;
+	}
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("Finished starting in the background. Activated=%s, EarlyLogLinesWritten=%d, EarlyLogLinesDropped=%lld, EarlyAnalyticsEventsWritten=%d, EarlyAnalyticsEventsDropped=%d"), EngineActive ? TEXT("yes") : TEXT("no"), NumLinesWritten, (long long)GameLogDevice->GetNumPreBufferDroppedLines(), NumEventsWritten, NumEventsDropped);
+}
+
+bool FsparklogsModule::HoldStartupAnalyticsEvents(const FsparklogsAnalyticsBatch& Batch)
+{
+	FScopeLock StartupAnalyticsLock(&StartupAnalyticsCriticalSection);
+	if (!AsyncStartupPending)
+	{
+		return false;
+	}
+	const int32 NumEvents = Batch.Num();
+	if (StartupAnalyticsJSON.Num() + Batch.RawJSON.Len() > Settings->StartupPreBufferBytes)
+	{
+		NumStartupAnalyticsEventsDropped += NumEvents;
+		return true;
+	}
+	const int32 BaseJSON = StartupAnalyticsJSON.Num();
+	const int32 BaseMessages = StartupAnalyticsMessages.Num();
+	StartupAnalyticsJSON.Append(Batch.RawJSON.GetData(), Batch.RawJSON.Len());
+	StartupAnalyticsMessages.Append(Batch.Messages);
+	for (int32 i = 0; i < NumEvents; i++)
+	{
+		StartupAnalyticsJSONEnds.Add(BaseJSON + Batch.RawJSONEnds[i]);
+		StartupAnalyticsMessageEnds.Add(BaseMessages + Batch.MessageEnds[i]);
+	}
+	return true;
+}
+
 void FsparklogsModule::ShutdownModule()
 {
 	FCoreDelegates::ApplicationWillEnterBackgroundDelegate.RemoveAll(this);
 	FCoreDelegates::ApplicationHasEnteredForegroundDelegate.RemoveAll(this);
 	FCoreDelegates::OnPostEngineInit.RemoveAll(this);
 	FCoreDelegates::OnEnginePreExit.RemoveAll(this);
+#if ENGINE_MAJOR_VERSION >= 5
+	FTSTicker::GetCoreTicker().RemoveTicker(TickHandle);
+#else
+	FTicker::GetCoreTicker().RemoveTicker(TickHandle);
+#endif
 	if (UObjectInitialized())
 	{
 		UnregisterSettings();
 	}
-	// Just in case it was not called earlier...
-	StopShippingEngine();
-	GetITLPluginIndexedLock().IndexedLockFile.Reset(nullptr);
-}
-
-TSharedPtr<IAnalyticsProvider> FsparklogsModule::CreateAnalyticsProvider(const FAnalyticsProviderConfigurationDelegate& GetConfigValue) const
-{
-	return GetAnalyticsProvider();
+	// Just in case it was not called earlier...
+	StopShippingEngine();
+	Settings->FlushAnalyticsState();
+	GetITLPluginIndexedLock().IndexedLockFile.Reset(nullptr);
+}
+
+TSharedPtr<IAnalyticsProvider> FsparklogsModule::CreateAnalyticsProvider(const FAnalyticsProviderConfigurationDelegate& GetConfigValue) const
+{
+	return GetAnalyticsProvider();
+}
+
+TSharedPtr<FsparklogsAnalyticsProvider> FsparklogsModule::GetAnalyticsProvider()
+{
+	if (!AnalyticsProvider.IsValid())
+	{
+		AnalyticsProvider = TSharedPtr<FsparklogsAnalyticsProvider>(new FsparklogsAnalyticsProvider(FsparklogsModule::GetModule().Settings));
+	}
+	return AnalyticsProvider;
+}
+
+bool FsparklogsModule::AddRawAnalyticsEvent(TSharedPtr<FJsonObject> RawAnalyticsData, const TCHAR* LogMessage, TSharedPtr<FJsonObject> CustomRootFields, bool ForceDisableAutoExtract, bool ForceDebugLogEvent)
+{
+	if (!RawAnalyticsData.IsValid() || (!AsyncStartupPending && (!EngineActive || !Settings->CollectAnalytics)))
+	{
+		return false;
+	}
+
+	FString OutputJson;
+	if (!FormatRawAnalyticsEvent(RawAnalyticsData, CustomRootFields, ForceDisableAutoExtract, OutputJson))
+	{
+		return false;
+	}
+	if ((!AsyncStartupPending && Settings->DebugLogForAnalyticsEvents) || ForceDebugLogEvent)
+	{
+		if (LogMessage != nullptr)
+		{
+			UE_LOG(LogPluginSparkLogs, Display, TEXT("%s: %s %s"), DebugForAnalyticsEventsPrefix, LogMessage, *OutputJson);
+		}
+		else
+		{
+			UE_LOG(LogPluginSparkLogs, Display, TEXT("%s: %s"), DebugForAnalyticsEventsPrefix, *OutputJson);
+		}
+	}
+	if (FsparklogsAnalyticsBatch* Batch = FsparklogsAnalyticsBatch::GetActive())
+	{
+		FTCHARToUTF8 OutputJsonUTF8(*OutputJson, OutputJson.Len());
+		Batch->Add(OutputJsonUTF8.Get(), OutputJsonUTF8.Length(), LogMessage);
+		return true;
+	}
+	if (AsyncStartupPending)
+	{
+		// Settings are still loading, so the event is held until the engine is ready (committing the batch holds it)
+		FTCHARToUTF8 OutputJsonUTF8(*OutputJson, OutputJson.Len());
+		FsparklogsAnalyticsBatch StartupBatch;
+		StartupBatch.Add(OutputJsonUTF8.Get(), OutputJsonUTF8.Length(), LogMessage);
+		return StartupBatch.Commit() > 0;
+	}
+	Settings->MarkLastWrittenAnalyticsEvent();
+	return GetAnalyticsLogDevice()->AddRawEventWithJSONObject(OutputJson, LogMessage, true);
+}
+
+bool FsparklogsModule::AddRawAnalyticsEventUTF8(const ANSICHAR* RawAnalyticsJSON, int32 RawAnalyticsJSONLen, const TCHAR* LogMessage, bool ForceDebugLogEvent)
+{
+	if (RawAnalyticsJSON == nullptr || RawAnalyticsJSONLen <= 0 || (!AsyncStartupPending && (!EngineActive || !Settings->CollectAnalytics)))
+	{
+		return false;
+	}
+
+	if ((!AsyncStartupPending && Settings->DebugLogForAnalyticsEvents) || ForceDebugLogEvent)
+	{
+		FUTF8ToTCHAR OutputJsonConverted(RawAnalyticsJSON, RawAnalyticsJSONLen);
+		const FString OutputJson(OutputJsonConverted.Length(), OutputJsonConverted.Get());
+		if (LogMessage != nullptr)
+		{
+			UE_LOG(LogPluginSparkLogs, Display, TEXT("%s: %s %s"), DebugForAnalyticsEventsPrefix, LogMessage, *OutputJson);
+		}
+		else
+		{
+			UE_LOG(LogPluginSparkLogs, Display, TEXT("%s: %s"), DebugForAnalyticsEventsPrefix, *OutputJson);
+		}
+	}
+	if (FsparklogsAnalyticsBatch* Batch = FsparklogsAnalyticsBatch::GetActive())
+	{
+		Batch->Add(RawAnalyticsJSON, RawAnalyticsJSONLen, LogMessage);
+		return true;
+	}
+	if (AsyncStartupPending)
+	{
+		// Settings are still loading, so the event is held until the engine is ready (committing the batch holds it)
+		FsparklogsAnalyticsBatch StartupBatch;
+		StartupBatch.Add(RawAnalyticsJSON, RawAnalyticsJSONLen, LogMessage);
+		return StartupBatch.Commit() > 0;
+	}
+	Settings->MarkLastWrittenAnalyticsEvent();
+	return GetAnalyticsLogDevice()->AddRawEventWithUTF8JSONObject(RawAnalyticsJSON, RawAnalyticsJSONLen, LogMessage, true);
 }
 
-TSharedPtr<FsparklogsAnalyticsProvider> FsparklogsModule::GetAnalyticsProvider()
+bool FsparklogsModule::WriteAnalyticsBatch(const FsparklogsAnalyticsBatch& Batch)
 {
-	if (!AnalyticsProvider.IsValid())
+	if (AsyncStartupPending && HoldStartupAnalyticsEvents(Batch))
 	{
-		AnalyticsProvider = TSharedPtr<FsparklogsAnalyticsProvider>(new FsparklogsAnalyticsProvider(FsparklogsModule::GetModule().Settings));
+		return true;
 	}
-	return AnalyticsProvider;
+	if (!EngineActive || !Settings->CollectAnalytics)
+	{
+		return false;
+	}
+	if (Batch.Num() <= 0)
+	{
+		return true;
+	}
+	Settings->MarkLastWrittenAnalyticsEvent();
+	return GetAnalyticsLogDevice()->AddRawEventsUTF8(Batch.Num(), Batch.RawJSON.GetData(), Batch.RawJSONEnds.GetData(), Batch.Messages.GetData(), Batch.MessageEnds.GetData());
 }
 
-bool FsparklogsModule::AddRawAnalyticsEvent(TSharedPtr<FJsonObject> RawAnalyticsData, const TCHAR* LogMessage, TSharedPtr<FJsonObject> CustomRootFields, bool ForceDisableAutoExtract, bool ForceDebugLogEvent)
+FsparklogsOutputDeviceFile* FsparklogsModule::GetAnalyticsLogDevice()
 {
-	if (!EngineActive || !Settings->CollectAnalytics || !RawAnalyticsData.IsValid())
+	if (AnalyticsLaneActive.load())
 	{
-		return false;
+		return GetITLInternalAnalyticsLog(nullptr).LogDevice.Get();
 	}
+	// Nothing ships the analytics logfile (e.g., analytics collection was off when the engine started), so the events would never leave it
+	return GetITLInternalGameLog(nullptr).LogDevice.Get();
+}
 
+bool FsparklogsModule::FormatRawAnalyticsEvent(TSharedPtr<FJsonObject> RawAnalyticsData, TSharedPtr<FJsonObject> CustomRootFields, bool ForceDisableAutoExtract, FString& OutJSON)
+{
 	TSharedRef<FJsonObject> RootEvent(new FJsonObject());
 	if (CustomRootFields.IsValid())
 	{
@@ -5183,27 +12108,14 @@ bool FsparklogsModule::AddRawAnalyticsEvent(TSharedPtr<FJsonObject> RawAnalytics
 	{
 		RootEvent->SetBoolField(OverrideAutoExtractDisabled, true);
 	}
-	FString OutputJson;
 	TSharedRef<TJsonWriter<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>> Writer =
-		TJsonWriterFactory<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>::Create(&OutputJson);
+		TJsonWriterFactory<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>::Create(&OutJSON);
 	if (!FJsonSerializer::Serialize(RootEvent, Writer))
 	{
 		return false;
 	}
 	Writer->Close();
-	if (Settings->DebugLogForAnalyticsEvents || ForceDebugLogEvent)
-	{
-		if (LogMessage != nullptr)
-		{
-			UE_LOG(LogPluginSparkLogs, Display, TEXT("%s: %s %s"), DebugForAnalyticsEventsPrefix, LogMessage, *OutputJson);
-		}
-		else
-		{
-			UE_LOG(LogPluginSparkLogs, Display, TEXT("%s: %s"), DebugForAnalyticsEventsPrefix, *OutputJson);
-		}
-	}
-	Settings->MarkLastWrittenAnalyticsEvent();
-	return GetITLInternalGameLog(nullptr).LogDevice->AddRawEventWithJSONObject(OutputJson, LogMessage, true);
+	return true;
 }
 
 FString FsparklogsModule::GetAppInstanceID()
@@ -5211,8 +12123,35 @@ FString FsparklogsModule::GetAppInstanceID()
 	return AppInstanceID;
 }
 
+void FsparklogsModule::LoadSettingsForStartup(const FSparkLogsEngineOptions& options)
+{
+	Settings->LoadSettings();
+
+	// Lock in the application install date early even if analytics is not necessarily enabled yet
+	Settings->GetEffectiveAnalyticsInstallTime();
+
+	if (options.OverrideAnalyticsUserID.Len() > 0)
+	{
+		Settings->SetUserID(*options.OverrideAnalyticsUserID);
+	}
+	if (options.UserTags.Num() > 0)
+	{
+		GetAnalyticsProvider()->SetUserTags(options.UserTags);
+	}
+}
+
 bool FsparklogsModule::StartShippingEngine(const FSparkLogsEngineOptions& options)
 {
+	return InternalStartShippingEngine(options, true);
+}
+
+bool FsparklogsModule::InternalStartShippingEngine(const FSparkLogsEngineOptions& options, bool LoadCurrentSettings)
+{
+	if (AsyncStartupPending && IsInGameThread())
+	{
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("Event shipping engine is still starting in the background. Ignoring call to StartShippingEngine."));
+		return true;
+	}
 	if (EngineActive)
 	{
 		UE_LOG(LogPluginSparkLogs, Log, TEXT("Event shipping engine is already active. Ignoring call to StartShippingEngine."));
@@ -5228,18 +12167,9 @@ bool FsparklogsModule::StartShippingEngine(const FSparkLogsEngineOptions& option
 	}
 
 	// Always make sure that we're using current settings
-	Settings->LoadSettings();
-
-	// Lock in the application install date early even if analytics is not necessarily enabled yet
-	Settings->GetEffectiveAnalyticsInstallTime();
-
-	if (options.OverrideAnalyticsUserID.Len() > 0)
-	{
-		Settings->SetUserID(*options.OverrideAnalyticsUserID);
-	}
-	if (options.UserTags.Num() > 0)
+	if (LoadCurrentSettings)
 	{
-		GetAnalyticsProvider()->SetUserTags(options.UserTags);
+		LoadSettingsForStartup(options);
 	}
 
 	FString EffectiveTargetCurrency = Settings->AnalyticsTargetCurrency;
@@ -5313,41 +12243,44 @@ bool FsparklogsModule::StartShippingEngine(const FSparkLogsEngineOptions& option
 	}
 
 	float DiceRoll = options.AlwaysStart ? 10000.0 : FMath::FRandRange(0.0, 100.0);
-	EngineActive = DiceRoll < Settings->ActivationPercentage;
-	if (EngineActive)
+	// The engine only becomes active once the streamers exist
+	const bool Activated = DiceRoll < Settings->ActivationPercentage;
+	if (Activated)
 	{
 		// Log all plugin messages to the ITL operations log
 		FOutputDeviceFile* OpsLogDevice = GetITLInternalOpsLog().LogDevice.Get();
 		ITLLogFileSimpleRotateIfTooLarge(OpsLogDevice, OpsLogDevice->GetFilename(), (int64)(1024 * 1024) * 5);
 		GLog->AddOutputDevice(OpsLogDevice);
+		if (Settings->SpoolSegmentBytes > 0)
+		{
+			// Both logfiles are written as segments that are deleted once shipped
+			GetITLInternalGameLog(nullptr).LogDevice->StartSpool(Settings->SpoolSegmentBytes, Settings->SpoolBinaryRecords);
+			GetITLInternalAnalyticsLog(nullptr).LogDevice->StartSpool(Settings->SpoolSegmentBytes, Settings->SpoolBinaryRecords);
+		}
 		if (EffectiveCollectLogs)
 		{
 			// Log all engine messages to an internal log just for this plugin, which we will then read from the file as we push log data to the cloud
+			if (Settings->LogCaptureRingBytes > 0)
+			{
+				GetITLInternalGameLog(nullptr).LogDevice->StartRingCapture(Settings->LogCaptureRingBytes);
+			}
+			// Keep a storm of log lines from one category from filling the logfile and being shipped at full cost
+			GetITLInternalGameLog(nullptr).LogDevice->SetLogSuppression(Settings->LogRateLimitLinesPerSec, Settings->LogRateLimitBurstLines, Settings->CoalesceRepeatedLogLines);
 			GLog->AddOutputDevice(GetITLInternalGameLog(nullptr).LogDevice.Get());
 		}
 	}
 
-	UE_LOG(LogPluginSparkLogs, Log, TEXT("Starting up: LaunchConfiguration=%s, HttpEndpointURI=%s, AgentID=%s, ActivationPercentage=%lf, DiceRoll=%f, Activated=%s, CollectLogs=%s, CollectAnalytics=%s"), GetITLLaunchConfiguration(true), *EffectiveHttpEndpointURI, *EffectiveAgentID, Settings->ActivationPercentage, DiceRoll, EngineActive ? TEXT("yes") : TEXT("no"), EffectiveCollectLogs ? TEXT("yes") : TEXT("no"), EffectiveCollectAnalytics ? TEXT("yes") : TEXT("no"));
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("Starting up: LaunchConfiguration=%s, HttpEndpointURI=%s, AgentID=%s, ActivationPercentage=%lf, DiceRoll=%f, Activated=%s, CollectLogs=%s, CollectAnalytics=%s"), GetITLLaunchConfiguration(true), *EffectiveHttpEndpointURI, *EffectiveAgentID, Settings->ActivationPercentage, DiceRoll, Activated ? TEXT("yes") : TEXT("no"), EffectiveCollectLogs ? TEXT("yes") : TEXT("no"), EffectiveCollectAnalytics ? TEXT("yes") : TEXT("no"));
 	if (!EffectiveCollectLogs && !EffectiveCollectAnalytics)
 	{
 		UE_LOG(LogPluginSparkLogs, Log, TEXT("Log collection and analytics collection are both disabled. No reason to start engine."));
+		EngineActive = Activated;
 		return false;
 	}
 
-	if (EngineActive)
+	if (Activated)
 	{
-		UE_LOG(LogPluginSparkLogs, Log, TEXT("Ingestion parameters: RequestTimeoutSecs=%lf, BytesPerRequest=%d, ProcessingIntervalSecs=%lf, RetryIntervalSecs=%lf, UnflushedBytesToAutoFlush=%d, MinIntervalBetweenFlushes=%lf"), Settings->RequestTimeoutSecs, Settings->BytesPerRequest, Settings->ProcessingIntervalSecs, Settings->RetryIntervalSecs, (int)Settings->UnflushedBytesToAutoFlush, Settings->MinIntervalBetweenFlushes);
-		if (EffectiveCollectAnalytics)
-		{
-			UE_LOG(LogPluginSparkLogs, Log, TEXT("Analytics collection is active. GameID='%s' UserID='%s' PlayerID='%s' DebugLogAllAnalyticsEvents=%s"), *Settings->AnalyticsGameID, *Settings->GetEffectiveAnalyticsUserID(), *Settings->GetEffectiveAnalyticsPlayerID(), Settings->DebugLogForAnalyticsEvents ? TEXT("true") : TEXT("false"));
-			// Make sure analytics provider singleton is created and make sure any previously open session from a prior game instance is cleaned up...
-			GetAnalyticsProvider()->CheckForStaleSessionAtStartup();
-			if (ITLIsMobilePlatform() && Settings->AnalyticsMobileAutoSessionStart)
-			{
-				GetAnalyticsProvider()->StartSession(TEXT("automatically started at app start"), TArray<FAnalyticsEventAttribute>());
-			}
-		}
-		
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("Ingestion parameters: RequestTimeoutSecs=%lf, BytesPerRequest=%d, ProcessingIntervalSecs=%lf, RetryIntervalSecs=%lf, MaxInFlightRequests=%d, CatchUpParallelism=%d, UnflushedBytesToAutoFlush=%d, MinIntervalBetweenFlushes=%lf"), Settings->RequestTimeoutSecs, Settings->BytesPerRequest, Settings->ProcessingIntervalSecs, Settings->RetryIntervalSecs, (int)Settings->MaxInFlightRequests, (int)Settings->CatchUpParallelism, (int)Settings->UnflushedBytesToAutoFlush, Settings->MinIntervalBetweenFlushes);
 		FString SourceLogFile = GetITLInternalGameLog(nullptr).LogFilePath;
 		FString AuthorizationHeader;
 		if (EffectiveHttpAuthorizationHeaderValue.IsEmpty())
@@ -5359,86 +12292,152 @@ bool FsparklogsModule::StartShippingEngine(const FSparkLogsEngineOptions& option
 			AuthorizationHeader = EffectiveHttpAuthorizationHeaderValue;
 		}
 		CloudPayloadProcessor = TSharedPtr<FsparklogsWriteHTTPPayloadProcessor, ESPMode::ThreadSafe>(new FsparklogsWriteHTTPPayloadProcessor(EffectiveHttpEndpointURI, AuthorizationHeader, Settings->RequestTimeoutSecs, Settings->DebugLogRequests, EffectiveTargetCurrency));
-		CloudStreamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(InstanceIndex, SourceLogFile, Settings, CloudPayloadProcessor.ToSharedRef(), GMaxLineLength, options.OverrideComputerName, AppInstanceID, &options.AdditionalAttributes));
-		CloudStreamer->SetWeakThisPtr(CloudStreamer);
-
-		int64 StartingProgressMarker = 0;
-		int StartingLastReadLen = 0;
-		TArray<uint8> IgnoreProgressState;
-		CloudStreamer->ReadProgressMarker(StartingProgressMarker, StartingLastReadLen, IgnoreProgressState);
-		if (StartingProgressMarker > 0)
+		// Sharing requires the progress journal, since the INI cache of another process would not see progress recorded by this one
+		if (Settings->HostAgent && !ITLGetProgressJournalPath(ITLGetIndexedStateFileINI(InstanceIndex), ITLStreamLane::Logs).IsEmpty())
+		{
+			if (EffectiveCollectAnalytics && Settings->AnalyticsLane)
+			{
+				AnalyticsPayloadProcessor = TSharedPtr<FsparklogsWriteHTTPPayloadProcessor, ESPMode::ThreadSafe>(new FsparklogsWriteHTTPPayloadProcessor(EffectiveHttpEndpointURI, AuthorizationHeader, Settings->RequestTimeoutSecs, Settings->DebugLogRequests, EffectiveTargetCurrency));
+			}
+			UE_LOG(LogPluginSparkLogs, Log, TEXT("Host agent is enabled. One instance on this host ships the logfiles of every instance."));
+			TSharedPtr<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> HostAnalyticsPayloadProcessor;
+			if (AnalyticsPayloadProcessor.IsValid())
+			{
+				HostAnalyticsPayloadProcessor = WithMirrors(AnalyticsPayloadProcessor.ToSharedRef(), ITLStreamLane::Analytics);
+			}
+			HostAgent = MakeUnique<FsparklogsHostAgent>(InstanceIndex, Settings, WithMirrors(CloudPayloadProcessor.ToSharedRef(), ITLStreamLane::Logs), HostAnalyticsPayloadProcessor, GMaxLineLength, options.OverrideComputerName, AppInstanceID, &options.AdditionalAttributes);
+		}
+		else
 		{
-			UE_LOG(LogPluginSparkLogs, Log, TEXT("Resuming ingestion. progress_marker=%ld last_read_len=%d"), StartingProgressMarker, StartingLastReadLen);
+			CloudStreamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(InstanceIndex, SourceLogFile, Settings, WithMirrors(CloudPayloadProcessor.ToSharedRef(), ITLStreamLane::Logs), GMaxLineLength, options.OverrideComputerName, AppInstanceID, &options.AdditionalAttributes));
+			CloudStreamer->SetWeakThisPtr(CloudStreamer);
+
+			int64 StartingProgressMarker = 0;
+			int StartingLastReadLen = 0;
+			TArray<uint8> IgnoreProgressState;
+			CloudStreamer->ReadProgressMarker(StartingProgressMarker, StartingLastReadLen, IgnoreProgressState);
+			if (StartingProgressMarker > 0)
+			{
+				UE_LOG(LogPluginSparkLogs, Log, TEXT("Resuming ingestion. progress_marker=%ld last_read_len=%d"), StartingProgressMarker, StartingLastReadLen);
+			}
+
+			if (EffectiveCollectAnalytics && Settings->AnalyticsLane)
+			{
+				// Analytics events ship from their own logfile on their own schedule, so they are never stuck behind a backlog of logs
+				UE_LOG(LogPluginSparkLogs, Log, TEXT("Analytics events have their own lane: AnalyticsProcessingIntervalSecs=%lf, AnalyticsUnflushedBytesToAutoFlush=%d, MaxLogBacklogBytes=%d"), Settings->AnalyticsProcessingIntervalSecs, (int)Settings->AnalyticsUnflushedBytesToAutoFlush, (int)Settings->MaxLogBacklogBytes);
+				AnalyticsPayloadProcessor = TSharedPtr<FsparklogsWriteHTTPPayloadProcessor, ESPMode::ThreadSafe>(new FsparklogsWriteHTTPPayloadProcessor(EffectiveHttpEndpointURI, AuthorizationHeader, Settings->RequestTimeoutSecs, Settings->DebugLogRequests, EffectiveTargetCurrency));
+				AnalyticsStreamer = TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>(new FsparklogsReadAndStreamToCloud(InstanceIndex, GetITLInternalAnalyticsLog(nullptr).LogFilePath, Settings, WithMirrors(AnalyticsPayloadProcessor.ToSharedRef(), ITLStreamLane::Analytics), GMaxLineLength, options.OverrideComputerName, AppInstanceID, &options.AdditionalAttributes, ITLStreamLane::Analytics));
+				AnalyticsStreamer->SetWeakThisPtr(AnalyticsStreamer);
+				GetITLInternalAnalyticsLog(AnalyticsStreamer).LogDevice->SetCloudStreamer(AnalyticsStreamer);
+			}
 		}
 
-		FCoreDelegates::OnEnginePreExit.AddRaw(this, &FsparklogsModule::OnEnginePreExit);
+		AnalyticsLaneActive = AnalyticsPayloadProcessor.IsValid();
+
+		// Open the connections now rather than in the middle of the first flush
+		PreWarmConnections();
+
+		if (IsInGameThread() && !FCoreDelegates::OnEnginePreExit.IsBoundToObject(this))
+		{
+			FCoreDelegates::OnEnginePreExit.AddRaw(this, &FsparklogsModule::OnEnginePreExit);
+		}
 		GetITLInternalGameLog(CloudStreamer).LogDevice->SetCloudStreamer(CloudStreamer);
 
 		if (Settings->StressTestGenerateIntervalSecs > 0)
 		{
 			StressGenerator = MakeUnique<FsparklogsStressGenerator>(Settings);
 		}
+
+		EngineActive = true;
+		if (EffectiveCollectAnalytics)
+		{
+			UE_LOG(LogPluginSparkLogs, Log, TEXT("Analytics collection is active. GameID='%s' UserID='%s' PlayerID='%s' DebugLogAllAnalyticsEvents=%s"), *Settings->AnalyticsGameID, *Settings->GetEffectiveAnalyticsUserID(), *Settings->GetEffectiveAnalyticsPlayerID(), Settings->DebugLogForAnalyticsEvents ? TEXT("true") : TEXT("false"));
+			// Make sure analytics provider singleton is created and make sure any previously open session from a prior game instance is cleaned up...
+			GetAnalyticsProvider()->CheckForStaleSessionAtStartup();
+			if (ITLIsMobilePlatform() && Settings->AnalyticsMobileAutoSessionStart)
+			{
+				GetAnalyticsProvider()->StartSession(TEXT("automatically started at app start"), TArray<FAnalyticsEventAttribute>());
+			}
+		}
 	}
 	return EngineActive;
 }
 
 void FsparklogsModule::StopShippingEngine()
 {
-	if (EngineActive || CloudStreamer.IsValid())
+	if (AsyncStartupTask.IsValid())
 	{
-		UE_LOG(LogPluginSparkLogs, Log, TEXT("Shutting down and flushing data to cloud..."));
-		// If an analytics session is active then end it
+		// Let the background startup finish so that it does not race the shutdown
+		AsyncStartupTask.Wait();
+		AsyncStartupTask.Reset();
+	}
+	if (EngineActive || CloudStreamer.IsValid() || AnalyticsStreamer.IsValid() || HostAgent.IsValid())
+	{
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("Shutting down and flushing data to cloud... budget_secs=%.3lf"), Settings->ShutdownFlushBudgetSecs);
+		const double Deadline = FPlatformTime::Seconds() + Settings->ShutdownFlushBudgetSecs;
+		// Write out anything still collected in a blueprint batch, then if an analytics session is active end it
+		if (IsInGameThread())
+		{
+			UsparklogsAnalytics::CommitBatch();
+		}
+		GetAnalyticsProvider()->FlushAggregatedEvents();
 		GetAnalyticsProvider()->EndSession(TEXT("automatically ended at app exit"));
-		
-		GLog->Flush();
+		// However long shipping takes below, everything written so far is on disk for the next launch
+		SyncToDisk();
 		if (StressGenerator.IsValid())
 		{
 			StressGenerator->Stop();
 		}
-		if (CloudStreamer.IsValid())
+		// Set the retry interval to something short so we don't delay shutting down the game...
+		Settings->RetryIntervalSecs = 0.5;
+		if (HostAgent.IsValid())
 		{
-			if (CloudPayloadProcessor.IsValid())
-			{
-				// Set the retry interval to something short so we don't delay shutting down the game...
-				Settings->RetryIntervalSecs = 0.5;
-				// When the engine is shutting down, wait no more than 11 seconds to flush the final log request
-				CloudPayloadProcessor->SetTimeoutSecs(FMath::Min(Settings->RequestTimeoutSecs, 11.0));
-			}
-			FsparklogsOutputDeviceFile* LogDevice = GetITLInternalGameLog(nullptr).LogDevice.Get();
-			FString LogDeviceFilename = LogDevice->GetFilename();
-			LogDevice->Flush();
-			bool LastFlushProcessedEverything = false;
-			if (CloudStreamer->FlushAndWait(2, true, true, true, FsparklogsSettings::WaitForFlushToCloudOnShutdown, LastFlushProcessedEverything))
+			for (FsparklogsOutputDeviceFile* LogDevice : { GetITLInternalAnalyticsLog(nullptr).LogDevice.Get(), GetITLInternalGameLog(nullptr).LogDevice.Get() })
 			{
-				FString LogFilePath = GetITLInternalGameLog(nullptr).LogFilePath;
-				UE_LOG(LogPluginSparkLogs, Log, TEXT("Flushed data successfully. LastFlushedEverything=%d"), (int)LastFlushProcessedEverything);
-				// Purge this plugin's logfile and delete the progress marker (fully flushed shutdown should start with an empty log next game session).
+				// Nothing more is written by this instance, so the leader (this instance or another) can ship everything and purge the logfiles
+				LogDevice->Flush();
 				GLog->RemoveOutputDevice(LogDevice);
 				LogDevice->TearDown();
-				if (LastFlushProcessedEverything)
-				{
-					bool Purged = ITLPurgeFile(LogDeviceFilename);
-					if (Purged && !IFileManager::Get().FileExists(*LogDeviceFilename))
-					{
-						CloudStreamer->DeleteProgressMarker();
-						UE_LOG(LogPluginSparkLogs, Log, TEXT("All data fully shipped. Removed progress marker and local logfile %s"), *LogFilePath);
-					}
-					else
-					{
-						UE_LOG(LogPluginSparkLogs, Log, TEXT("All data fully shipped. However, failed to remove local logfile %s so keeping progress marker."), *LogFilePath);
-					}
-				}
 			}
-			else
+			for (FsparklogsWriteHTTPPayloadProcessor* PayloadProcessor : { AnalyticsPayloadProcessor.Get(), CloudPayloadProcessor.Get() })
 			{
-				UE_LOG(LogPluginSparkLogs, Log, TEXT("Flush failed or timed out during shutdown."));
-				GLog->RemoveOutputDevice(LogDevice);
-				LogDevice->TearDown();
-				// NOTE: the progress marker would not have been updated, so we'll keep trying the next time
-				// the game engine starts right from where we left off, so we shouldn't lose anything.
+				SetDeadlineRequestTimeout(PayloadProcessor, Deadline);
 			}
+			HostAgent->Shutdown(FMath::Max(Deadline - FPlatformTime::Seconds(), FsparklogsSettings::MinStopWaitSecs));
+			HostAgent.Reset();
+		}
+		if (AnalyticsStreamer.IsValid())
+		{
+			// Analytics events go first so that a large backlog of logs cannot use up the time available to ship them
+			SetDeadlineRequestTimeout(AnalyticsPayloadProcessor.Get(), Deadline);
+			FlushAndPurgeOnShutdown(AnalyticsStreamer, GetITLInternalAnalyticsLog(nullptr).LogDevice.Get(), GetITLInternalAnalyticsLog(nullptr).LogFilePath, Deadline);
+			AnalyticsStreamer.Reset();
+		}
+		if (CloudStreamer.IsValid())
+		{
+			SetDeadlineRequestTimeout(CloudPayloadProcessor.Get(), Deadline);
+			FlushAndPurgeOnShutdown(CloudStreamer, GetITLInternalGameLog(nullptr).LogDevice.Get(), GetITLInternalGameLog(nullptr).LogFilePath, Deadline);
 			CloudStreamer.Reset();
 		}
+		for (const TSharedRef<FsparklogsWriteHTTPPayloadProcessor, ESPMode::ThreadSafe>& PayloadProcessor : MirrorHTTPPayloadProcessors)
+		{
+			SetDeadlineRequestTimeout(&PayloadProcessor.Get(), Deadline);
+		}
+		for (const TSharedRef<FsparklogsFanOutPayloadProcessor, ESPMode::ThreadSafe>& FanOut : FanOutPayloadProcessors)
+		{
+			// Mirrors are best-effort, so they only get what is left of the shutdown budget to catch up
+			FanOut->WaitForMirrors(Deadline - FPlatformTime::Seconds());
+			TArray<FsparklogsPayloadMirror::FStats> MirrorStats;
+			FanOut->GetMirrorStats(MirrorStats);
+			for (const FsparklogsPayloadMirror::FStats& Stats : MirrorStats)
+			{
+				UE_LOG(LogPluginSparkLogs, Log, TEXT("Mirror %s stopped: delivered_payloads=%lld, delivered_bytes=%lld, dropped_payloads=%lld, failed_attempts=%lld, payloads_left=%d"), *Stats.Name, Stats.DeliveredPayloads, Stats.DeliveredBytes, Stats.DroppedPayloads, Stats.FailedAttempts, Stats.QueuedPayloads);
+			}
+		}
+		// Stopping the mirrors cancels whatever they still have in flight instead of waiting for it
+		FanOutPayloadProcessors.Reset();
+		MirrorHTTPPayloadProcessors.Reset();
+		AnalyticsPayloadProcessor.Reset();
 		CloudPayloadProcessor.Reset();
 		StressGenerator.Reset();
 		UE_LOG(LogPluginSparkLogs, Log, TEXT("Shutdown."));
@@ -5446,13 +12445,56 @@ void FsparklogsModule::StopShippingEngine()
 	}
 }
 
+void FsparklogsModule::FlushAndPurgeOnShutdown(TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer, FsparklogsOutputDeviceFile* LogDevice, const FString& LogFilePath, double DeadlinePlatformTime)
+{
+	FString LogDeviceFilename = LogDevice->GetFilename();
+	LogDevice->Flush();
+	const bool ProcessedEverything = Streamer->FlushUntilDeadline(DeadlinePlatformTime, true, true);
+	GLog->RemoveOutputDevice(LogDevice);
+	LogDevice->TearDown();
+	if (ProcessedEverything)
+	{
+		// Purge this plugin's logfile and delete the progress marker (fully flushed shutdown should start with an empty log next game session).
+		bool Purged = ITLPurgeFile(LogDeviceFilename) && FsparklogsSpool::PurgeSegments(LogFilePath);
+		if (Purged && !IFileManager::Get().FileExists(*LogDeviceFilename))
+		{
+			Streamer->DeleteProgressMarker();
+			UE_LOG(LogPluginSparkLogs, Log, TEXT("All data fully shipped. Removed progress marker and local logfile %s"), *LogFilePath);
+		}
+		else
+		{
+			UE_LOG(LogPluginSparkLogs, Log, TEXT("All data fully shipped. However, failed to remove local logfile %s so keeping progress marker."), *LogFilePath);
+		}
+	}
+	else
+	{
+		FsparklogsShipperStats Stats;
+		Streamer->GetShipperStats(Stats);
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("Flush failed or did not finish within the shutdown budget, the rest ships on the next launch. bytes_left=%lld, logfile=%s"), Stats.BacklogBytes, *LogFilePath);
+		// NOTE: the progress marker reflects what was shipped, so we'll keep trying the next time
+		// the game engine starts right from where we left off, so we shouldn't lose anything.
+	}
+}
+
 void FsparklogsModule::OnAppEnterBackground()
 {
 	if (ITLIsMobilePlatform() && Settings->AnalyticsMobileAutoSessionEnd)
 	{
 		GetAnalyticsProvider()->EndSession(TEXT("automatically ended"));
 	}
-	Flush();
+	// The app may never come back from the background, so don't leave anything in memory
+	GetAnalyticsProvider()->FlushAggregatedEvents();
+	Settings->FlushAnalyticsState();
+	if (Settings->BackgroundFlushBudgetSecs > 0.0)
+	{
+		// Ship what we can before the OS suspends (or kills) the app
+		FsparklogsDeadlineFlushResult Result;
+		FlushWithDeadline(Settings->BackgroundFlushBudgetSecs, Result);
+	}
+	else
+	{
+		Flush();
+	}
 }
 
 void FsparklogsModule::OnAppEnterForeground()
@@ -5461,11 +12503,94 @@ void FsparklogsModule::OnAppEnterForeground()
 	{
 		GetAnalyticsProvider()->StartSession(TEXT("automatically started at app activation"), TArray<FAnalyticsEventAttribute>());
 	}
+	// Connections are usually closed while in the background, so open a new one before the next flush needs it
+	if (EngineActive && !AsyncStartupPending)
+	{
+		PreWarmConnections();
+	}
+}
+
+void FsparklogsModule::PreWarmConnections()
+{
+	if (!Settings->PreWarmConnection)
+	{
+		return;
+	}
+	if (CloudPayloadProcessor.IsValid())
+	{
+		CloudPayloadProcessor->PreWarm();
+	}
+	if (AnalyticsPayloadProcessor.IsValid())
+	{
+		AnalyticsPayloadProcessor->PreWarm();
+	}
+}
+
+TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> FsparklogsModule::WithMirrors(TSharedRef<FsparklogsWriteHTTPPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor, ITLStreamLane Lane)
+{
+	if (Settings->MirrorHTTPEndpointURI.IsEmpty() && Settings->MirrorNDJSONFilePath.IsEmpty())
+	{
+		return PayloadProcessor;
+	}
+	const TCHAR* LaneName = (Lane == ITLStreamLane::Analytics) ? TEXT("analytics") : TEXT("logs");
+	TSharedRef<FsparklogsFanOutPayloadProcessor, ESPMode::ThreadSafe> FanOut(new FsparklogsFanOutPayloadProcessor(PayloadProcessor));
+	if (!Settings->MirrorHTTPEndpointURI.IsEmpty())
+	{
+		// A local sidecar gets plain JSON: it does not need to save bandwidth and may not support every compression mode
+		TSharedRef<FsparklogsWriteHTTPPayloadProcessor, ESPMode::ThreadSafe> Processor(new FsparklogsWriteHTTPPayloadProcessor(Settings->MirrorHTTPEndpointURI, FString(), Settings->RequestTimeoutSecs, Settings->DebugLogRequests, FString()));
+		MirrorHTTPPayloadProcessors.Add(Processor);
+		FanOut->AddMirror(MakeUnique<FsparklogsPayloadMirror>(FString::Printf(TEXT("%s_http"), LaneName), Processor, true, Settings));
+	}
+	if (!Settings->MirrorNDJSONFilePath.IsEmpty())
+	{
+		FString Path = Settings->MirrorNDJSONFilePath;
+		if (Lane == ITLStreamLane::Analytics)
+		{
+			Path = FPaths::Combine(FPaths::GetPath(Path), FPaths::GetBaseFilename(Path) + TEXT("-analytics") + FPaths::GetExtension(Path, true));
+		}
+		TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> Processor(new FsparklogsWriteNDJSONPayloadProcessor(Path));
+		FanOut->AddMirror(MakeUnique<FsparklogsPayloadMirror>(FString::Printf(TEXT("%s_ndjson"), LaneName), Processor, true, Settings));
+	}
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("Mirroring %s payloads: http_endpoint=%s, ndjson_file=%s, max_lag_bytes=%d"), LaneName, *Settings->MirrorHTTPEndpointURI, *Settings->MirrorNDJSONFilePath, (int)Settings->MirrorMaxLagBytes);
+	FanOutPayloadProcessors.Add(FanOut);
+	return FanOut;
+}
+
+bool FsparklogsModule::GetShipperStats(ITLStreamLane Lane, FsparklogsShipperStats& OutStats)
+{
+	OutStats = FsparklogsShipperStats();
+	if (!EngineActive || AsyncStartupPending)
+	{
+		return false;
+	}
+	const bool IsAnalyticsLane = (Lane == ITLStreamLane::Analytics);
+	if (HostAgent.IsValid())
+	{
+		if (!HostAgent->GetShipperStats(GetITLPluginIndexedLock().IndexedLockFile->GetLockIndex(), Lane, OutStats))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer = IsAnalyticsLane ? AnalyticsStreamer : CloudStreamer;
+		if (!Streamer.IsValid())
+		{
+			return false;
+		}
+		Streamer->GetShipperStats(OutStats);
+	}
+	FsparklogsOutputDeviceFile* LogDevice = IsAnalyticsLane ? GetITLInternalAnalyticsLog(nullptr).LogDevice.Get() : GetITLInternalGameLog(nullptr).LogDevice.Get();
+	if (LogDevice != nullptr)
+	{
+		LogDevice->GetShipperStats(OutStats);
+	}
+	return true;
 }
 
 void FsparklogsModule::Flush()
 {
-	if (!EngineActive)
+	if (!EngineActive || AsyncStartupPending)
 	{
 		return;
 	}
@@ -5479,6 +12604,97 @@ void FsparklogsModule::Flush()
 		}
 		CloudStreamer->RequestFlush();
 	}
+	if (AnalyticsStreamer.IsValid())
+	{
+		GetITLInternalAnalyticsLog(nullptr).LogDevice->Flush();
+		AnalyticsStreamer->RequestFlush();
+	}
+	if (HostAgent.IsValid())
+	{
+		GetITLInternalGameLog(nullptr).LogDevice->Flush();
+		GetITLInternalAnalyticsLog(nullptr).LogDevice->Flush();
+		HostAgent->RequestFlush();
+	}
+}
+
+bool FsparklogsModule::FlushWithDeadline(double BudgetSecs, FsparklogsDeadlineFlushResult& OutResult)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsModule_FlushWithDeadline);
+	OutResult = FsparklogsDeadlineFlushResult();
+	if (!EngineActive || AsyncStartupPending)
+	{
+		return false;
+	}
+	const double StartTime = FPlatformTime::Seconds();
+	const double Deadline = StartTime + FMath::Max(BudgetSecs, 0.0);
+	SyncToDisk();
+	bool ShippedEverything = true;
+	if (HostAgent.IsValid())
+	{
+		HostAgent->RequestFlush();
+		ShippedEverything = false;
+	}
+	auto FlushLane = [&](FsparklogsReadAndStreamToCloud* Streamer, FsparklogsWriteHTTPPayloadProcessor* PayloadProcessor)
+	{
+		if (Streamer == nullptr)
+		{
+			return;
+		}
+		SetDeadlineRequestTimeout(PayloadProcessor, Deadline);
+		ShippedEverything = Streamer->FlushUntilDeadline(Deadline, false, IsInGameThread()) && ShippedEverything;
+		if (PayloadProcessor != nullptr)
+		{
+			PayloadProcessor->SetTimeoutSecs(Settings->RequestTimeoutSecs);
+		}
+	};
+	// Analytics events go first so that a large backlog of logs cannot use up the time available to ship them
+	FlushLane(AnalyticsStreamer.Get(), AnalyticsPayloadProcessor.Get());
+	FlushLane(CloudStreamer.Get(), CloudPayloadProcessor.Get());
+	FsparklogsShipperStats Stats;
+	if (AnalyticsStreamer.IsValid())
+	{
+		AnalyticsStreamer->GetShipperStats(Stats);
+		OutResult.AnalyticsBytesLeft = Stats.BacklogBytes;
+	}
+	if (CloudStreamer.IsValid())
+	{
+		CloudStreamer->GetShipperStats(Stats);
+		OutResult.LogsBytesLeft = Stats.BacklogBytes;
+	}
+	OutResult.ShippedEverything = ShippedEverything;
+	OutResult.ElapsedSecs = FPlatformTime::Seconds() - StartTime;
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("Flush with deadline finished: shipped_everything=%s, elapsed_secs=%.3lf, budget_secs=%.3lf, analytics_bytes_left=%lld, logs_bytes_left=%lld"), ShippedEverything ? TEXT("yes") : TEXT("no"), OutResult.ElapsedSecs, BudgetSecs, OutResult.AnalyticsBytesLeft, OutResult.LogsBytesLeft);
+	return ShippedEverything;
+}
+
+void FsparklogsModule::SyncToDisk()
+{
+	Settings->FlushAnalyticsState();
+	GLog->Flush();
+	for (FsparklogsOutputDeviceFile* LogDevice : { GetITLInternalAnalyticsLog(nullptr).LogDevice.Get(), GetITLInternalGameLog(nullptr).LogDevice.Get() })
+	{
+		if (LogDevice != nullptr)
+		{
+			LogDevice->Flush();
+		}
+	}
+	for (FsparklogsReadAndStreamToCloud* Streamer : { AnalyticsStreamer.Get(), CloudStreamer.Get() })
+	{
+		if (Streamer != nullptr)
+		{
+			Streamer->SyncProgressToDisk();
+		}
+	}
+}
+
+void FsparklogsModule::SetDeadlineRequestTimeout(FsparklogsWriteHTTPPayloadProcessor* PayloadProcessor, double DeadlinePlatformTime)
+{
+	if (PayloadProcessor == nullptr)
+	{
+		return;
+	}
+	const double MaxTimeoutSecs = FMath::Min(Settings->RequestTimeoutSecs, FsparklogsSettings::MaxDeadlineRequestTimeoutSecs);
+	PayloadProcessor->SetTimeoutSecs(FMath::Clamp(DeadlinePlatformTime - FPlatformTime::Seconds(), FsparklogsSettings::MinStopWaitSecs, MaxTimeoutSecs));
 }
 
 void FsparklogsModule::OnPostEngineInit()
@@ -5490,6 +12706,19 @@ void FsparklogsModule::OnPostEngineInit()
 	}
 }
 
+bool FsparklogsModule::OnTick(float DeltaTime)
+{
+	// Both are cheap unless something is due
+	Settings->FlushAnalyticsStateIfDue();
+	// Otherwise a window of summed up analytics events would only end once a later event arrives, which might be much later or never.
+	// Without a provider nothing is summed up, and creating it here could race its creation elsewhere.
+	if (AnalyticsProvider.IsValid())
+	{
+		AnalyticsProvider->FlushAggregatedEventsIfDue();
+	}
+	return true;
+}
+
 void FsparklogsModule::OnEnginePreExit()
 {
 	UE_LOG(LogPluginSparkLogs, Log, TEXT("OnEnginePreExit. Will shutdown the log shipping engine..."));
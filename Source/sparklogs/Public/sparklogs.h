@@ -10,6 +10,9 @@
 #include "Interfaces/IAnalyticsProvider.h"
 #include "Interfaces/IAnalyticsProviderModule.h"
 #include "HAL/Runnable.h"
+#include "HAL/Event.h"
+#include "Async/Future.h"
+#include "Containers/Ticker.h"
 #include "Interfaces/IHttpResponse.h"
 #include "HttpModule.h"
 #include "Misc/OutputDeviceFile.h"
@@ -44,6 +47,10 @@ SPARKLOGS_API bool ITLFStringTrimCharStartEndInline(FString & s, TCHAR c);
 /** Returns a text encoding of the given severity that will be a severity level recognized by the SparkLogs cloud. */
 SPARKLOGS_API const TCHAR* ITLSeverityToString(ELogVerbosity::Type Verbosity);
 
+/** Writes the standard UE log line tag (time, frame, category and verbosity, as FOutputDeviceHelper::FormatLogLine would) as UTF-8 to Dest without
+  * allocating. Dest must have room for NAME_SIZE * 4 + 96 bytes. Returns the number of bytes written, or -1 if the engine formatter must be used instead. */
+SPARKLOGS_API int32 ITLFormatLogLineTagUTF8(ANSICHAR* Dest, ELogVerbosity::Type Verbosity, const class FName& Category, ELogTimes::Type LogTime, const double Time);
+
 /** Calculates the OS platform name (windows/linux/...) and major OS version number (leaves out build info or other misc version info) */
 SPARKLOGS_API void ITLGetOSPlatformVersion(FString & OutPlatform, FString & OutMajorVersion);
 
@@ -72,6 +79,16 @@ SPARKLOGS_API bool ITLIsManagedFileWrapperPlatform();
   * Cookie header on a new HTTP request. It strips all optional fields from cookies and just adds the name=value for each cookie. */
 SPARKLOGS_API FString ITLParseHttpResponseCookies(FHttpResponsePtr Response);
 
+/** Parses the value of a Retry-After HTTP header (either a number of seconds or an HTTP date) and returns how many seconds from now to wait.
+  * Returns 0 if the value is empty, invalid, or already in the past. */
+SPARKLOGS_API double ITLParseRetryAfterSecs(const FString& HeaderValue);
+
+/** Returns the value of the X-Timezone HTTP header for the given offset of local time from UTC (e.g., UTC-05:00). */
+SPARKLOGS_API FString ITLFormatTimezoneHeaderValue(const FTimespan& LocalOffset);
+
+/** Ticks what the game thread normally would (e.g., so HTTP requests complete) while it is blocked waiting. Only call on the game thread. */
+SPARKLOGS_API void ITLTickGameThreadWhileWaiting(double DeltaTime);
+
 /** Returns a unique field name that does not already have a value in the given JSON object, based on the base field name.
   * Appends a number to the base name and iterates forward from there. Can optionally start searching farther along. */
 SPARKLOGS_API FString ITLCalcUniqueFieldName(const TSharedPtr<FJsonObject> Object, const FString& BaseName, int HintStartingNum);
@@ -90,7 +107,18 @@ enum class SPARKLOGS_API ITLCompressionMode
 {
 	Default = 0,
 	LZ4 = 0,
-	None = 1
+	None = 1,
+	LZ4Frame = 2,
+	Gzip = 3
+};
+
+/** Which data a streamer ships. Each lane has its own logfile, progress marker, flush cadence, and metrics. */
+enum class SPARKLOGS_API ITLStreamLane
+{
+	/** Engine log messages (plus analytics events if they do not have their own lane). */
+	Logs = 0,
+	/** Analytics events only, shipped with priority so that log volume never delays them. */
+	Analytics = 1
 };
 
 /** The type of user ID to use for analytics. */
@@ -104,12 +132,68 @@ enum class SPARKLOGS_API ITLAnalyticsUserIDType
 SPARKLOGS_API bool ITLCompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen, TArray<uint8>& OutData);
 /** Decompress data with the given compression mode. */
 SPARKLOGS_API bool ITLDecompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen, int InOriginalDataLen, TArray<uint8>& OutData);
+
+/**
+ * Incrementally compresses data into a standard LZ4 frame made of linked blocks, so that a payload can be
+ * compressed block-by-block while it is still being built. The compression state is reused between frames.
+ */
+class SPARKLOGS_API FITLLZ4FrameCompressor
+{
+public:
+	/** Maximum amount of uncompressed data in a single block. */
+	static constexpr int BlockSize = 64 * 1024;
+
+	FITLLZ4FrameCompressor();
+	~FITLLZ4FrameCompressor();
+	FITLLZ4FrameCompressor(const FITLLZ4FrameCompressor&) = delete;
+	FITLLZ4FrameCompressor& operator=(const FITLLZ4FrameCompressor&) = delete;
+
+	/** Resets the compression state and replaces the contents of OutData with a new frame header. */
+	void BeginFrame(TArray<uint8>& OutData);
+	/** Compresses the next block of data (at most BlockSize bytes) and appends it to OutData. InData may be reused by the caller afterwards. */
+	bool CompressBlock(const uint8* InData, int InDataLen, TArray<uint8>& OutData);
+	/** Appends the end of frame marker to OutData. */
+	void EndFrame(TArray<uint8>& OutData);
+	/** Total number of uncompressed bytes compressed into the current frame. */
+	int64 GetFrameInputLen() const { return FrameInputLen; }
+
+protected:
+	/** Opaque LZ4 streaming state. */
+	void* Stream;
+	/** Holds the most recent history so later blocks can reference it even after the caller reuses its input buffer. */
+	TArray<uint8> Dictionary;
+	int64 FrameInputLen;
+};
+
+/** Compresses data in the gzip format (zlib deflate), reusing the same compression context for every call. */
+class SPARKLOGS_API FITLGzipCompressor
+{
+public:
+	FITLGzipCompressor(int InLevel = 6);
+	~FITLGzipCompressor();
+	FITLGzipCompressor(const FITLGzipCompressor&) = delete;
+	FITLGzipCompressor& operator=(const FITLGzipCompressor&) = delete;
+
+	/** Replaces the contents of OutData with InData compressed as a single gzip member. */
+	bool Compress(const uint8* InData, int InDataLen, TArray<uint8>& OutData);
+
+protected:
+	/** Opaque zlib stream state, initialized on first use. */
+	void* ZStream;
+	bool ZStreamInitialized;
+	int Level;
+};
+
 SPARKLOGS_API FString ITLGenerateNewRandomID();
 SPARKLOGS_API FString ITLGenerateRandomAlphaNumID(int Length);
 
 /** Returns path to the INI file that is safe to store instance-specific data in. */
 SPARKLOGS_API FString ITLGetIndexedStateFileINI(int InstanceIndex);
 
+/** Returns the path of the binary progress journal of the given lane that goes with the given state INI file, or an empty string if progress must be
+  * kept in the INI file itself (when the state INI is the game user settings INI on platforms with managed storage). */
+SPARKLOGS_API FString ITLGetProgressJournalPath(const FString& StateFileINI, ITLStreamLane Lane = ITLStreamLane::Logs);
+
 /**
  * Manages plugin settings.
  */
@@ -132,6 +216,69 @@ public:
 	static constexpr int DefaultBytesPerRequest = 3 * 1024 * 1024;
 	static constexpr int MinBytesPerRequest = 1024 * 128;
 	static constexpr int MaxBytesPerRequest = 1024 * 1024 * 6;
+	static constexpr int DefaultMaxInFlightRequests = 1;
+	static constexpr int MinMaxInFlightRequests = 1;
+	static constexpr int MaxMaxInFlightRequests = 8;
+	static constexpr bool DefaultAdaptiveRequestSizing = true;
+	// Adaptive request sizing never shrinks requests below this (or BytesPerRequest if that is smaller)
+	static constexpr int MinAdaptiveBytesPerRequest = 1024 * 64;
+	static constexpr double DefaultTargetRequestLatencySecs = 5.0;
+	static constexpr double MinTargetRequestLatencySecs = 0.5;
+	static constexpr int DefaultLogCaptureRingBytes = 0;
+	static constexpr int MinLogCaptureRingBytes = 1024 * 16;
+	static constexpr int MaxLogCaptureRingBytes = 1024 * 1024 * 4;
+	static constexpr bool DefaultMapSourceLogFile = true;
+	static constexpr int DefaultCatchUpParallelism = 4;
+	static constexpr int MinCatchUpParallelism = 1;
+	static constexpr int MaxCatchUpParallelism = 16;
+	static constexpr bool DefaultAnalyticsLane = true;
+	static constexpr double DefaultAnalyticsProcessingIntervalSecs = 1.0;
+	static constexpr double MinAnalyticsProcessingIntervalSecs = 0.25;
+	static constexpr int DefaultAnalyticsUnflushedBytesToAutoFlush = 1024 * 4;
+	static constexpr int MinAnalyticsUnflushedBytesToAutoFlush = 1024;
+	static constexpr int DefaultMaxLogBacklogBytes = 0;
+	static constexpr double DefaultLogRateLimitLinesPerSec = 0.0;
+	static constexpr int DefaultLogRateLimitBurstLines = 200;
+	static constexpr int MinLogRateLimitBurstLines = 1;
+	static constexpr bool DefaultCoalesceRepeatedLogLines = false;
+	static constexpr bool DefaultAsyncStartup = false;
+	static constexpr int DefaultStartupPreBufferBytes = 1024 * 1024;
+	static constexpr int MinStartupPreBufferBytes = 1024 * 16;
+	static constexpr int MaxStartupPreBufferBytes = 1024 * 1024 * 16;
+	static constexpr bool DefaultHostAgent = false;
+	/** With HostAgent, how often an instance that is not the leader tries to take over, and how often the leader looks for new instances. */
+	static constexpr double HostAgentElectionIntervalSecs = 5.0;
+	static constexpr int MinMaxLogBacklogBytes = 1024 * 1024;
+	static constexpr int DefaultSpoolSegmentBytes = 0;
+	static constexpr int MinSpoolSegmentBytes = 1024 * 256;
+	static constexpr int MaxSpoolSegmentBytes = 1024 * 1024 * 1024;
+	static constexpr int DefaultSpoolMaxDiskBytes = 0;
+	static constexpr bool DefaultSpoolBinaryRecords = false;
+	static constexpr int DefaultMemoryBudgetBytes = 0;
+	static constexpr int MinMemoryBudgetBytes = 1024 * 512;
+	/** With MemoryBudgetBytes, the streamer memory needed for each byte read into one payload: the read buffer, the JSON payload and the encoded payload. */
+	static constexpr int MemoryBudgetBytesPerReadByte = 3;
+	/** With MemoryBudgetBytes, the step in which the read buffer of a streamer grows. */
+	static constexpr int MemoryBudgetBufferGranularity = 1024 * 64;
+	static constexpr double DefaultMemoryBudgetIdleReleaseSecs = 30.0;
+	static constexpr double MinMemoryBudgetIdleReleaseSecs = 1.0;
+	static constexpr bool DefaultPreWarmConnection = true;
+	static constexpr double MinShutdownFlushBudgetSecs = 1.0;
+	static constexpr double MaxShutdownFlushBudgetSecs = 120.0;
+	static constexpr double DefaultBackgroundFlushBudgetSecs = 0.0;
+	static constexpr double MaxBackgroundFlushBudgetSecs = 30.0;
+	static constexpr double DefaultAnalyticsAggregationWindowSecs = 0.0;
+	static constexpr double MaxAnalyticsAggregationWindowSecs = 60.0 * 60.0;
+	static constexpr int DefaultAnalyticsAggregationMaxKeys = 10000;
+	static constexpr int MinAnalyticsAggregationMaxKeys = 1;
+	static constexpr int MaxAnalyticsAggregationMaxKeys = 1000000;
+	static constexpr int DefaultMirrorMaxLagBytes = 1024 * 1024 * 16;
+	static constexpr int MinMirrorMaxLagBytes = 1024 * 64;
+	static constexpr int MaxMirrorMaxLagBytes = 1024 * 1024 * 512;
+	/** How long a streamer is given to finish its in-flight payloads and stop, even once a flush deadline has passed. */
+	static constexpr double MinStopWaitSecs = 1.0;
+	/** The most time a single request may take while flushing under a deadline. */
+	static constexpr double MaxDeadlineRequestTimeoutSecs = 11.0;
 	static constexpr int DefaultUnflushedBytesToAutoFlush = 1024 * 128;
 	static constexpr int MinUnflushedBytesToAutoFlush = 1024 * 16;
 	static constexpr double MinMinIntervalBetweenFlushes = 1.0;
@@ -141,6 +288,7 @@ public:
 	// This should not be longer than 5 minutes, because the ingest dedup cache expires a few minutes later
 	static constexpr double MaxRetryIntervalSecs = 5 * 60;
 	static constexpr double WaitForFlushToCloudOnShutdown = 16.0;
+	static constexpr double DefaultShutdownFlushBudgetSecs = WaitForFlushToCloudOnShutdown;
 	static constexpr bool DefaultIncludeCommonMetadata = true;
 	static constexpr bool DefaultDebugLogRequests = false;
 	static constexpr bool DefaultAutoStart = true;
@@ -169,6 +317,12 @@ public:
 	static constexpr const TCHAR* AnalyticsLastSessionStarted = TEXT("AnalyticsLastSessionStarted");
 	static constexpr const TCHAR* AnalyticsLastWrittenKey = TEXT("AnalyticsLastWritten");
 	static constexpr const TCHAR* AnalyticsFirstPurchasedKey = TEXT("AnalyticsFirstPurchased");
+	/** How often the last written analytics event timestamp is updated. Together with AnalyticsStateFlushIntervalSecs this bounds how stale it can be after a crash. */
+	static constexpr double AnalyticsLastWrittenUpdateIntervalSecs = 2.5;
+	/** The longest time that analytics state changes (session number, last written event, etc) are held in memory before being written. */
+	static constexpr double AnalyticsStateFlushIntervalSecs = 2.5;
+	/** How many transaction numbers are reserved each time the reservation in the INI runs out (see GetTransactionNumber). */
+	static constexpr int AnalyticsTransactionNumbersReserved = 64;
 
 	/** The game ID to use for analytics. If set, will also be added to log events. */
 	FString AnalyticsGameID;
@@ -205,6 +359,75 @@ public:
 	double ProcessingIntervalSecs;
 	/** The amount of time to wait after a failed request before retrying. */
 	double RetryIntervalSecs;
+	/** The maximum number of payloads that can be in flight at once. Payloads are acknowledged in order. 1 disables pipelining. */
+	int32 MaxInFlightRequests;
+	/** Whether the amount of data read for each new request adapts to the endpoint: it grows while requests are acknowledged quickly, and halves after slow requests or failures. BytesPerRequest is the upper limit. */
+	bool AdaptiveRequestSizing;
+	/** With AdaptiveRequestSizing, requests that take longer than this to be acknowledged shrink the size of the requests that follow. */
+	double TargetRequestLatencySecs;
+	/** If positive, log messages are captured into per-thread lock-free rings of this many bytes and written to the logfile by a dedicated thread. 0 formats and writes on the logging thread. */
+	int32 LogCaptureRingBytes;
+	/** Whether or not the streamer may memory map the logfile (where supported) to build payloads straight from the mapped pages. */
+	bool MapSourceLogFile;
+	/** When there is a backlog of at least two chunks to ship, how many chunks are built and compressed at once on the task graph. 1 disables. */
+	int32 CatchUpParallelism;
+	/** Whether analytics events are written to their own logfile and shipped by a separate streamer, so that log volume and log retries never delay them. */
+	bool AnalyticsLane;
+	/** Desired seconds between attempts to ship analytics events when they have their own lane. */
+	double AnalyticsProcessingIntervalSecs;
+	/** Like UnflushedBytesToAutoFlush, but for the analytics lane. */
+	int32 AnalyticsUnflushedBytesToAutoFlush;
+	/** If positive, the oldest unshipped log data is dropped whenever more than this many bytes of logs are waiting to ship. Never applies to the analytics lane. */
+	int32 MaxLogBacklogBytes;
+	/** If positive, each log category can write at most this many lines per second at each verbosity from each thread (after a burst of LogRateLimitBurstLines). Extra lines are dropped and counted. */
+	double LogRateLimitLinesPerSec;
+	/** With LogRateLimitLinesPerSec, how many lines a category can write at once before the rate limit applies. */
+	int32 LogRateLimitBurstLines;
+	/** Whether identical consecutive log lines of one thread are folded into the first line plus one event with the repeat count and first/last timestamps.
+	  * A line that repeats only once is written as is. Off by default. */
+	bool CoalesceRepeatedLogLines;
+	/** Whether the module only installs the logfile device during engine startup (holding early log lines and analytics events in memory),
+	  * and does everything else to start the shipping engine on a background task. Only applies when AutoStart is enabled. */
+	bool AsyncStartup;
+	/** With AsyncStartup, the most bytes of early log lines (and separately, of analytics events) held in memory until the shipping engine has started. */
+	int32 StartupPreBufferBytes;
+	/** Whether one elected instance on this host ships the logfiles of every instance (see FsparklogsHostAgent), instead of each instance shipping its own. */
+	bool HostAgent;
+	/** If positive, each logfile is written as a series of segments of about this many bytes, and each segment is deleted once it has been shipped (see FsparklogsSpool). */
+	int32 SpoolSegmentBytes;
+	/** With SpoolSegmentBytes, if positive, the most disk space the segments of one logfile should use. The oldest unshipped segments without analytics events are dropped first. */
+	int32 SpoolMaxDiskBytes;
+	/** With SpoolSegmentBytes, whether segments are written as length-prefixed binary records holding already escaped messages instead of lines of text.
+	  * The streamer then copies each record into a payload as-is. Segments written this way are not human readable. */
+	bool SpoolBinaryRecords;
+	/** If positive, the most memory each streamer should use for its buffers. They are allocated on demand (sized to the data actually read) and released
+	  * after MemoryBudgetIdleReleaseSecs with nothing to ship. BytesPerRequest and MaxInFlightRequests are capped to fit, and backlogs are not built in parallel. */
+	int32 MemoryBudgetBytes;
+	/** With MemoryBudgetBytes, how long a streamer must have had nothing to ship before it releases its buffers. */
+	double MemoryBudgetIdleReleaseSecs;
+	/** Whether to open the connection to the HTTP endpoint ahead of time (when the engine starts and when the app enters the foreground),
+	  * so that the first payload does not pay for DNS, TCP and TLS setup in the middle of a flush. */
+	bool PreWarmConnection;
+	/** The most time to spend shipping data when the shipping engine stops (e.g., at engine exit). Whatever is not shipped in time ships on the next launch. */
+	double ShutdownFlushBudgetSecs;
+	/** If positive, when the app enters the background the logfiles and progress are flushed and data is shipped (analytics first) for at most this long,
+	  * blocking the game thread. Otherwise a flush is only requested. Whatever is not shipped in time ships when the app returns or on the next launch. */
+	double BackgroundFlushBudgetSecs;
+	/** If positive, resource and design events without custom attributes or an extra message are not written one by one. Instead their amounts (values)
+	  * and counts are summed per session, event ID and reason, and one rollup event per key is written once this many seconds have passed since the
+	  * first event of the window (checked at the next such event and every frame by the module's ticker), or when events
+	  * are flushed, a session ends or the engine stops. */
+	double AnalyticsAggregationWindowSecs;
+	/** With AnalyticsAggregationWindowSecs, the most keys summed up at once. The window ends early if an event with a new key would exceed this. */
+	int32 AnalyticsAggregationMaxKeys;
+	/** If set, every payload shipped is also POSTed as plain JSON to this HTTP endpoint (e.g., a local Vector sidecar at http://localhost:9880/).
+	  * It keeps its own progress, see FsparklogsFanOutPayloadProcessor for how far it may fall behind and when it drops payloads. */
+	FString MirrorHTTPEndpointURI;
+	/** If set, every payload shipped is also appended as plain JSON to this file (analytics payloads to the same name with an -analytics suffix). */
+	FString MirrorNDJSONFilePath;
+	/** With a mirror, the most payload bytes it may fall behind the fastest destination, and the most the streamer reads ahead for it while the cloud is
+	  * unavailable. Beyond that its oldest payloads are dropped, so it never holds back shipping to the cloud. */
+	int32 MirrorMaxLagBytes;
 	/** If there are at least this many unflushed bytes and it's been at least MinIntervalBetweenFlushes time, it will automatically trigger a flush. */
 	int32 UnflushedBytesToAutoFlush;
 	/** The minimum amount of time between automatic size-triggered flushes */
@@ -226,12 +449,19 @@ public:
 	double StressTestGenerateIntervalSecs;
 	/** The number of log entries to generate every generation interval. */
 	int StressTestNumEntriesPerTick;
+	/** Overrides for the synthetic messages that are generated, in the format accepted by FsparklogsBenchmarkOptions::Parse. */
+	FString StressTestMessageOptions;
 
 	FsparklogsSettings(int InInstanceIndex);
+	/** Writes any analytics state changes still held in memory. */
+	~FsparklogsSettings();
 
 	/** Loads the settings from the game engine INI section appropriate for this launch configuration (editor, client, server, etc). */
 	void LoadSettings();
 
+	/** Loads only the settings that decide how the module starts up (AutoStart, AsyncStartup, StartupPreBufferBytes, and HostAgent). Much cheaper than LoadSettings. */
+	void LoadStartupSettings();
+
 	/** Gets the effective HTTP endpoint URI (either using the overridden HTTP endpoint URI if non-empty, or using the HttpEndpointURI if configured, or the CloudRegion). Returns empty if not configured. */
 	FString GetEffectiveHttpEndpointURI(const FString& OverrideHTTPEndpointURI);
 
@@ -253,17 +483,21 @@ public:
 	/** Thread-safe. Returns the session number since the app was first installed. Optionally increment the session number. */
 	int GetSessionNumber(bool Increment);
 
-	/** Thread-safe. Returns the transaction number since the app was first installed. Optionally increment the transaction number. */
+	/** Thread-safe. Returns the transaction number since the app was first installed. Optionally increment the transaction number.
+	  * The INI holds a reservation of the next AnalyticsTransactionNumbersReserved numbers, written before any of them is returned, so a crash
+	  * can skip numbers but never hand one out again. The reservation is released when the settings are destroyed or reloaded.
+	  */
 	int GetTransactionNumber(bool Increment);
 
 	/** Thread-safe. Returns the UTC timestamp when the first purchase was made. */
 	FDateTime GetAnalyticsFirstPurchased();
 
-	/** Thread-safe. Sets the timestamp when the first purchase was made. */
+	/** Thread-safe. Sets the timestamp when the first purchase was made. Written right away, so a crash never makes a later purchase look like the first. */
 	void SetAnalyticsFirstPurchased(FDateTime T);
 
 	/** Thread-safe. Returns the attempt number for the given event ID (case insensitive) since the app was first installed.
 	  * Optionally increment the attempt number and/or optionally delete it (will still return last (possibly incremented) value).
+	  * Changes are written right away, so a crash never hands out an attempt number again.
 	  */
 	int GetAttemptNumber(const FString& EventID, bool Increment, bool DeleteAfter);
 
@@ -283,6 +517,19 @@ public:
 	/** Gets info about the last recorded analytics session. OutSessionID will be empty if no info is available. */
 	void GetLastAnalyticsSessionStartInfo(FString& OutSessionID, FDateTime& OutSessionStarted);
 
+	/** Thread-safe. Returns whether any analytics state changes are held in memory and not yet written to the INI file. */
+	bool HasPendingAnalyticsState();
+
+	/**
+	  * Thread-safe. Writes any analytics state changes held in memory to the INI file. Changes to session boundaries, the user ID, the
+	  * install time, the first purchase, attempt numbers and transaction number reservations are written right away; everything else is
+	  * written behind by the module's ticker (see FlushAnalyticsStateIfDue), when the app enters the background, and at shutdown.
+	  */
+	void FlushAnalyticsState();
+
+	/** Thread-safe. Writes the analytics state changes held in memory if the oldest is at least AnalyticsStateFlushIntervalSecs old. Cheap otherwise. */
+	void FlushAnalyticsStateIfDue();
+
 protected:
 	int InstanceIndex;
 	FString InstanceSettingsIni;
@@ -292,9 +539,25 @@ protected:
 	FDateTime CachedAnalyticsInstallTime;
 	int CachedAnalyticsSessionNumber;
 	int CachedAnalyticsTransactionNumber;
+	/** The highest transaction number written to the INI, which may be returned without writing anything (see GetTransactionNumber) */
+	int ReservedAnalyticsTransactionNumber;
 	FDateTime CachedAnalyticsFirstPurchased;
 	TMap<FString, int> CachedAnalyticsAttemptNumber;
 	FDateTime CachedAnalyticsLastEvent;
+	/** Analytics state INI keys changed since the last flush, and their new values (unset means remove the key). Guarded by CachedCriticalSection. */
+	TMap<FString, TOptional<FString>> PendingAnalyticsState;
+	/** When PendingAnalyticsState must be written by (platform time), or 0 if nothing is pending. */
+	std::atomic<double> AnalyticsStateFlushDeadline;
+	FCriticalSection AnalyticsStateFlushCriticalSection;
+
+	/** Records the transaction number returned last as the one in the INI, so that the numbers reserved after it are not skipped. Must hold CachedCriticalSection. */
+	void ReleaseTransactionNumberReservation();
+	/** Records a change to an analytics state INI key (nullptr removes the key). Must hold CachedCriticalSection. */
+	void QueueAnalyticsState(const FString& Key, const FString* Value);
+	void QueueAnalyticsState(const FString& Key, int Value);
+	/** Reads an analytics state INI key, including any change not yet written. Must hold CachedCriticalSection. */
+	bool GetAnalyticsState(const FString& Key, FString& OutValue);
+	bool GetAnalyticsState(const FString& Key, int& OutValue);
 
 	/** Enforces constraints upon any loaded setting values. */
 	void EnforceConstraints();
@@ -522,6 +785,122 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Retry Interval in Seconds")
 	float ServerRetryIntervalSecs = FsparklogsSettings::DefaultRetryIntervalSecs;
 
+	// The maximum number of HTTP requests that can be in flight at once. Requests are acknowledged in order. 1 disables pipelining.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Max In-Flight Requests")
+	int32 ServerMaxInFlightRequests = FsparklogsSettings::DefaultMaxInFlightRequests;
+
+	// Whether the amount of log data sent in each request adapts to how the endpoint is keeping up. Requests grow (up to Bytes Per Request) while they are acknowledged quickly, and shrink by half after slow requests, throttling (HTTP 429) or server errors. Retries always resend exactly the same data.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Adaptive Request Sizing")
+	bool ServerAdaptiveRequestSizing = FsparklogsSettings::DefaultAdaptiveRequestSizing;
+
+	// With adaptive request sizing, requests that take longer than this many seconds to be acknowledged shrink the size of the requests that follow.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Target Request Latency Secs")
+	float ServerTargetRequestLatencySecs = FsparklogsSettings::DefaultTargetRequestLatencySecs;
+
+	// If positive, the size in bytes of a per-thread ring used to capture log messages without locking or formatting on the logging thread. A dedicated thread formats and writes them to the logfile in batches. Log timestamps that use wall clock time reflect when the line is written (normally within a few milliseconds). 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Log Capture Ring Bytes")
+	int32 ServerLogCaptureRingBytes = FsparklogsSettings::DefaultLogCaptureRingBytes;
+
+	// Whether or not the logfile may be memory mapped (where supported by the platform) so that a large backlog of log data is read without copying it. Smaller reads of newly written data always use the open file handle.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Map Source Logfile")
+	bool ServerMapSourceLogFile = FsparklogsSettings::DefaultMapSourceLogFile;
+
+	// When catching up on a backlog of logs (e.g., after being offline), the number of payloads built and compressed at once on other cores. Payloads are still sent in order. 1 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Catch Up Parallelism")
+	int32 ServerCatchUpParallelism = FsparklogsSettings::DefaultCatchUpParallelism;
+
+	// Whether analytics events are written to their own logfile and shipped by a separate high priority streamer with its own flush cadence, so that a flood of logs (or log requests being retried) never delays them.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Analytics Lane")
+	bool ServerAnalyticsLane = FsparklogsSettings::DefaultAnalyticsLane;
+
+	// When analytics events have their own lane, the desired number of seconds between attempts to ship them.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Analytics Processing Interval Secs")
+	float ServerAnalyticsProcessingIntervalSecs = FsparklogsSettings::DefaultAnalyticsProcessingIntervalSecs;
+
+	// When analytics events have their own lane, if there are at least this many unflushed bytes of analytics events and it's been at least MinIntervalBetweenFlushes time, it will automatically trigger a flush.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Analytics Unflushed Bytes To Auto Flush")
+	int32 ServerAnalyticsUnflushedBytesToAutoFlush = FsparklogsSettings::DefaultAnalyticsUnflushedBytesToAutoFlush;
+
+	// If positive, whenever more than this many bytes of logs are waiting to be shipped (e.g., during a log storm or a long outage), the oldest logs are dropped. Analytics events in their own lane are never dropped. 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Max Log Backlog Bytes")
+	int32 ServerMaxLogBacklogBytes = FsparklogsSettings::DefaultMaxLogBacklogBytes;
+
+	// If positive, each log category can write at most this many lines per second at each verbosity level from each thread, so that one misbehaving system cannot flood the logs. Dropped lines are counted and reported in a single event. Fatal errors are never dropped. 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Log Rate Limit Lines Per Sec")
+	float ServerLogRateLimitLinesPerSec = FsparklogsSettings::DefaultLogRateLimitLinesPerSec;
+
+	// With a log rate limit, how many lines a category can write in a burst before the rate limit applies.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Log Rate Limit Burst Lines")
+	int32 ServerLogRateLimitBurstLines = FsparklogsSettings::DefaultLogRateLimitBurstLines;
+
+	// Whether identical consecutive log lines of one thread are written once, followed by a single event with the number of repeats and the time of the first and last repeat. A line that repeats only once is written as is.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Coalesce Repeated Log Lines")
+	bool ServerCoalesceRepeatedLogLines = FsparklogsSettings::DefaultCoalesceRepeatedLogLines;
+
+	// If enabled (and Auto Start is enabled), engine startup only installs the logfile device, and the rest of starting the shipping engine (loading settings, computing common metadata, checking for a stale analytics session, starting threads) happens on a background task so it does not delay the first frame. Log lines and analytics events from before it is ready are held in memory and written once it is.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Async Startup")
+	bool ServerAsyncStartup = FsparklogsSettings::DefaultAsyncStartup;
+
+	// With Async Startup, the most bytes of early log lines (and separately, of analytics events) held in memory until the shipping engine is ready. Anything more is dropped and counted.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Startup Pre-Buffer Bytes")
+	int32 ServerStartupPreBufferBytes = FsparklogsSettings::DefaultStartupPreBufferBytes;
+
+	// If enabled, one elected instance on this host ships the logfiles of every instance on this host (each with its own progress), over one set of connections to the endpoint. The others only write their logfiles, and one of them takes over within a few seconds if the leader exits. Useful when running many server processes per host.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Host Agent")
+	bool ServerHostAgent = FsparklogsSettings::DefaultHostAgent;
+
+	// If positive, the plugin's logfiles are written as a series of segments of about this many bytes each (instead of one ever-growing file), and each segment is deleted as soon as it has been shipped. 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Spool Segment Bytes")
+	int32 ServerSpoolSegmentBytes = FsparklogsSettings::DefaultSpoolSegmentBytes;
+
+	// With Spool Segment Bytes, if positive, the most disk space the segments of one logfile should use (e.g., during a long outage). The oldest unshipped segments are dropped first, but segments holding analytics events, the segment being shipped, and the segment being written are never dropped. 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Spool Max Disk Bytes")
+	int32 ServerSpoolMaxDiskBytes = FsparklogsSettings::DefaultSpoolMaxDiskBytes;
+
+	// With Spool Segment Bytes, whether segments are written as length-prefixed binary records that hold each message already escaped, instead of lines of text. Shipping them takes less CPU, but the segments are no longer human readable. The logfile itself (without spooling) is always text.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Spool Binary Records")
+	bool ServerSpoolBinaryRecords = FsparklogsSettings::DefaultSpoolBinaryRecords;
+
+	// If positive, the most memory (in bytes) each log shipper should use for its buffers, e.g. on consoles and mobile. Buffers are allocated only when there is data to ship, sized to that data, and released after Memory Budget Idle Release Secs with nothing to ship. Bytes Per Request and Max In Flight Requests are lowered to fit, and large backlogs are not prepared in parallel. 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Memory Budget Bytes")
+	int32 ServerMemoryBudgetBytes = FsparklogsSettings::DefaultMemoryBudgetBytes;
+
+	// With Memory Budget Bytes, how many seconds a log shipper must have had nothing to ship before it releases its buffers.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Memory Budget Idle Release Secs")
+	float ServerMemoryBudgetIdleReleaseSecs = FsparklogsSettings::DefaultMemoryBudgetIdleReleaseSecs;
+
+	// Whether to open the connection to the HTTP endpoint when the engine starts and when the app enters the foreground, so the first payload does not pay for connection setup in the middle of a flush.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Pre Warm Connection")
+	bool ServerPreWarmConnection = FsparklogsSettings::DefaultPreWarmConnection;
+
+	// The most seconds to spend shipping data when the shipping engine stops (e.g., at engine exit). Whatever is not shipped in time ships on the next launch.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Shutdown Flush Budget Secs")
+	float ServerShutdownFlushBudgetSecs = FsparklogsSettings::DefaultShutdownFlushBudgetSecs;
+
+	// If positive, the most seconds to block the game thread shipping data (analytics first) when the app enters the background (e.g., on mobile). 0 only requests a flush.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Background Flush Budget Secs")
+	float ServerBackgroundFlushBudgetSecs = FsparklogsSettings::DefaultBackgroundFlushBudgetSecs;
+
+	// If positive, resource and design events without custom attributes or an extra message are summed per session, event ID and reason, and one rollup event per key is written for every window of this many seconds (and when events are flushed or a session ends).
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Analytics Aggregation Window Secs")
+	float ServerAnalyticsAggregationWindowSecs = FsparklogsSettings::DefaultAnalyticsAggregationWindowSecs;
+
+	// With Analytics Aggregation Window Secs, the most keys summed up at once. The window ends early if an event with a new key would exceed this.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Analytics Aggregation Max Keys")
+	int32 ServerAnalyticsAggregationMaxKeys = FsparklogsSettings::DefaultAnalyticsAggregationMaxKeys;
+
+	// If set, every payload is also POSTed as plain JSON to this HTTP endpoint, e.g., a local Vector sidecar at http://localhost:9880/ (see Examples/local-elasticsearch-kibana). It is built and compressed only once. The mirror keeps its own progress, so it gets what it missed after a restart or while the cloud is unavailable (up to Mirror Max Lag Bytes).
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Mirror HTTP Endpoint URI")
+	FString ServerMirrorHTTPEndpointURI;
+
+	// If set, every payload is also appended as plain JSON to this local file (analytics payloads to the same name with an -analytics suffix).
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Mirror NDJSON File Path")
+	FString ServerMirrorNDJSONFilePath;
+
+	// With a mirror, the most payload bytes it may fall behind the fastest destination (or get ahead of the cloud while it is unavailable). Beyond that its oldest payloads are dropped, so a slow or unavailable mirror never holds back shipping to the cloud.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Mirror Max Lag Bytes")
+	int32 ServerMirrorMaxLagBytes = FsparklogsSettings::DefaultMirrorMaxLagBytes;
+
 	// If there are at least this many unflushed bytes and it's been at least MinIntervalBetweenFlushes time, it will automatically trigger a flush.
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Unflushed Bytes To Auto Flush")
 	int32 ServerUnflushedBytesToAutoFlush = FsparklogsSettings::DefaultUnflushedBytesToAutoFlush;
@@ -538,7 +917,7 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Debug Log for Analytics Events")
 	bool ServerDebugLogForAnalyticsEvents = FsparklogsSettings::DefaultServerDebugLogForAnalyticsEvents;
 
-	// How to compress the payload. Use 'lz4' or 'none'. Defaults to lz4. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload.
+	// How to compress the payload. Use 'lz4', 'lz4frame', 'gzip' or 'none'. Defaults to lz4. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload. 'lz4frame' compresses the payload incrementally while it is being built (the destination must accept Content-Encoding lz4-frame). 'gzip' uses more CPU but sends fewer bytes, which can be better for metered mobile connections.
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Compression Mode")
 	FString ServerCompressionMode;
 
@@ -560,6 +939,122 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Retry Interval in Seconds")
 	float EditorRetryIntervalSecs = FsparklogsSettings::DefaultRetryIntervalSecs;
 
+	// The maximum number of HTTP requests that can be in flight at once. Requests are acknowledged in order. 1 disables pipelining. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Max In-Flight Requests")
+	int32 EditorMaxInFlightRequests = FsparklogsSettings::DefaultMaxInFlightRequests;
+
+	// Whether the amount of log data sent in each request adapts to how the endpoint is keeping up. Requests grow (up to Bytes Per Request) while they are acknowledged quickly, and shrink by half after slow requests, throttling (HTTP 429) or server errors. Retries always resend exactly the same data. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Adaptive Request Sizing")
+	bool EditorAdaptiveRequestSizing = FsparklogsSettings::DefaultAdaptiveRequestSizing;
+
+	// With adaptive request sizing, requests that take longer than this many seconds to be acknowledged shrink the size of the requests that follow. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Target Request Latency Secs")
+	float EditorTargetRequestLatencySecs = FsparklogsSettings::DefaultTargetRequestLatencySecs;
+
+	// If positive, the size in bytes of a per-thread ring used to capture log messages without locking or formatting on the logging thread. A dedicated thread formats and writes them to the logfile in batches. Log timestamps that use wall clock time reflect when the line is written (normally within a few milliseconds). 0 disables. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Log Capture Ring Bytes")
+	int32 EditorLogCaptureRingBytes = FsparklogsSettings::DefaultLogCaptureRingBytes;
+
+	// Whether or not the logfile may be memory mapped (where supported by the platform) so that a large backlog of log data is read without copying it. Smaller reads of newly written data always use the open file handle.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", DisplayName = "Map Source Logfile")
+	bool EditorMapSourceLogFile = FsparklogsSettings::DefaultMapSourceLogFile;
+
+	// When catching up on a backlog of logs (e.g., after being offline), the number of payloads built and compressed at once on other cores. Payloads are still sent in order. 1 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", DisplayName = "Catch Up Parallelism")
+	int32 EditorCatchUpParallelism = FsparklogsSettings::DefaultCatchUpParallelism;
+
+	// Whether analytics events are written to their own logfile and shipped by a separate high priority streamer with its own flush cadence, so that a flood of logs (or log requests being retried) never delays them.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", DisplayName = "Analytics Lane")
+	bool EditorAnalyticsLane = FsparklogsSettings::DefaultAnalyticsLane;
+
+	// When analytics events have their own lane, the desired number of seconds between attempts to ship them.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", DisplayName = "Analytics Processing Interval Secs")
+	float EditorAnalyticsProcessingIntervalSecs = FsparklogsSettings::DefaultAnalyticsProcessingIntervalSecs;
+
+	// When analytics events have their own lane, if there are at least this many unflushed bytes of analytics events and it's been at least MinIntervalBetweenFlushes time, it will automatically trigger a flush.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", DisplayName = "Analytics Unflushed Bytes To Auto Flush")
+	int32 EditorAnalyticsUnflushedBytesToAutoFlush = FsparklogsSettings::DefaultAnalyticsUnflushedBytesToAutoFlush;
+
+	// If positive, whenever more than this many bytes of logs are waiting to be shipped (e.g., during a log storm or a long outage), the oldest logs are dropped. Analytics events in their own lane are never dropped. 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", DisplayName = "Max Log Backlog Bytes")
+	int32 EditorMaxLogBacklogBytes = FsparklogsSettings::DefaultMaxLogBacklogBytes;
+
+	// If positive, each log category can write at most this many lines per second at each verbosity level from each thread, so that one misbehaving system cannot flood the logs. Dropped lines are counted and reported in a single event. Fatal errors are never dropped. 0 disables. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Log Rate Limit Lines Per Sec")
+	float EditorLogRateLimitLinesPerSec = FsparklogsSettings::DefaultLogRateLimitLinesPerSec;
+
+	// With a log rate limit, how many lines a category can write in a burst before the rate limit applies. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Log Rate Limit Burst Lines")
+	int32 EditorLogRateLimitBurstLines = FsparklogsSettings::DefaultLogRateLimitBurstLines;
+
+	// Whether identical consecutive log lines of one thread are written once, followed by a single event with the number of repeats and the time of the first and last repeat. A line that repeats only once is written as is. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Coalesce Repeated Log Lines")
+	bool EditorCoalesceRepeatedLogLines = FsparklogsSettings::DefaultCoalesceRepeatedLogLines;
+
+	// If enabled (and Auto Start is enabled), engine startup only installs the logfile device, and the rest of starting the shipping engine (loading settings, computing common metadata, checking for a stale analytics session, starting threads) happens on a background task so it does not delay the first frame. Log lines and analytics events from before it is ready are held in memory and written once it is. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Async Startup")
+	bool EditorAsyncStartup = FsparklogsSettings::DefaultAsyncStartup;
+
+	// With Async Startup, the most bytes of early log lines (and separately, of analytics events) held in memory until the shipping engine is ready. Anything more is dropped and counted. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Startup Pre-Buffer Bytes")
+	int32 EditorStartupPreBufferBytes = FsparklogsSettings::DefaultStartupPreBufferBytes;
+
+	// If enabled, one elected instance on this host ships the logfiles of every instance on this host (each with its own progress), over one set of connections to the endpoint. The others only write their logfiles, and one of them takes over within a few seconds if the leader exits. Useful when running many server processes per host. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Host Agent")
+	bool EditorHostAgent = FsparklogsSettings::DefaultHostAgent;
+
+	// If positive, the plugin's logfiles are written as a series of segments of about this many bytes each (instead of one ever-growing file), and each segment is deleted as soon as it has been shipped. 0 disables. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Spool Segment Bytes")
+	int32 EditorSpoolSegmentBytes = FsparklogsSettings::DefaultSpoolSegmentBytes;
+
+	// With Spool Segment Bytes, if positive, the most disk space the segments of one logfile should use (e.g., during a long outage). The oldest unshipped segments are dropped first, but segments holding analytics events, the segment being shipped, and the segment being written are never dropped. 0 disables. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Spool Max Disk Bytes")
+	int32 EditorSpoolMaxDiskBytes = FsparklogsSettings::DefaultSpoolMaxDiskBytes;
+
+	// With Spool Segment Bytes, whether segments are written as length-prefixed binary records that hold each message already escaped, instead of lines of text. Shipping them takes less CPU, but the segments are no longer human readable. The logfile itself (without spooling) is always text. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Spool Binary Records")
+	bool EditorSpoolBinaryRecords = FsparklogsSettings::DefaultSpoolBinaryRecords;
+
+	// If positive, the most memory (in bytes) each log shipper should use for its buffers, e.g. on consoles and mobile. Buffers are allocated only when there is data to ship, sized to that data, and released after Memory Budget Idle Release Secs with nothing to ship. Bytes Per Request and Max In Flight Requests are lowered to fit, and large backlogs are not prepared in parallel. 0 disables. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Memory Budget Bytes")
+	int32 EditorMemoryBudgetBytes = FsparklogsSettings::DefaultMemoryBudgetBytes;
+
+	// With Memory Budget Bytes, how many seconds a log shipper must have had nothing to ship before it releases its buffers. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Memory Budget Idle Release Secs")
+	float EditorMemoryBudgetIdleReleaseSecs = FsparklogsSettings::DefaultMemoryBudgetIdleReleaseSecs;
+
+	// Whether to open the connection to the HTTP endpoint when the engine starts and when the app enters the foreground, so the first payload does not pay for connection setup in the middle of a flush. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Pre Warm Connection")
+	bool EditorPreWarmConnection = FsparklogsSettings::DefaultPreWarmConnection;
+
+	// The most seconds to spend shipping data when the shipping engine stops (e.g., at engine exit). Whatever is not shipped in time ships on the next launch. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Shutdown Flush Budget Secs")
+	float EditorShutdownFlushBudgetSecs = FsparklogsSettings::DefaultShutdownFlushBudgetSecs;
+
+	// If positive, the most seconds to block the game thread shipping data (analytics first) when the app enters the background (e.g., on mobile). 0 only requests a flush. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Background Flush Budget Secs")
+	float EditorBackgroundFlushBudgetSecs = FsparklogsSettings::DefaultBackgroundFlushBudgetSecs;
+
+	// If positive, resource and design events without custom attributes or an extra message are summed per session, event ID and reason, and one rollup event per key is written for every window of this many seconds (and when events are flushed or a session ends). [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Analytics Aggregation Window Secs")
+	float EditorAnalyticsAggregationWindowSecs = FsparklogsSettings::DefaultAnalyticsAggregationWindowSecs;
+
+	// With Analytics Aggregation Window Secs, the most keys summed up at once. The window ends early if an event with a new key would exceed this. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Analytics Aggregation Max Keys")
+	int32 EditorAnalyticsAggregationMaxKeys = FsparklogsSettings::DefaultAnalyticsAggregationMaxKeys;
+
+	// If set, every payload is also POSTed as plain JSON to this HTTP endpoint, e.g., a local Vector sidecar at http://localhost:9880/ (see Examples/local-elasticsearch-kibana). It is built and compressed only once. The mirror keeps its own progress, so it gets what it missed after a restart or while the cloud is unavailable (up to Mirror Max Lag Bytes). [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Mirror HTTP Endpoint URI")
+	FString EditorMirrorHTTPEndpointURI;
+
+	// If set, every payload is also appended as plain JSON to this local file (analytics payloads to the same name with an -analytics suffix). [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Mirror NDJSON File Path")
+	FString EditorMirrorNDJSONFilePath;
+
+	// With a mirror, the most payload bytes it may fall behind the fastest destination (or get ahead of the cloud while it is unavailable). Beyond that its oldest payloads are dropped, so a slow or unavailable mirror never holds back shipping to the cloud. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Mirror Max Lag Bytes")
+	int32 EditorMirrorMaxLagBytes = FsparklogsSettings::DefaultMirrorMaxLagBytes;
+
 	// If there are at least this many unflushed bytes and it's been at least MinIntervalBetweenFlushes time, it will automatically trigger a flush. [EDITOR RESTART REQUIRED]
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", DisplayName = "Unflushed Bytes To Auto Flush")
 	int32 EditorUnflushedBytesToAutoFlush = FsparklogsSettings::DefaultUnflushedBytesToAutoFlush;
@@ -576,7 +1071,7 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Debug Log for Analytics Events")
 	bool EditorDebugLogForAnalyticsEvents = FsparklogsSettings::DefaultEditorDebugLogForAnalyticsEvents;
 
-	// How to compress the payload. Use 'lz4' or 'none'. Defaults to lz4. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload. [EDITOR RESTART REQUIRED]
+	// How to compress the payload. Use 'lz4', 'lz4frame', 'gzip' or 'none'. Defaults to lz4. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload. 'lz4frame' compresses the payload incrementally while it is being built (the destination must accept Content-Encoding lz4-frame). 'gzip' uses more CPU but sends fewer bytes, which can be better for metered mobile connections. [EDITOR RESTART REQUIRED]
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Compression Mode")
 	FString EditorCompressionMode;
 
@@ -598,6 +1093,122 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Retry Interval in Seconds")
 	float ClientRetryIntervalSecs = FsparklogsSettings::DefaultRetryIntervalSecs;
 
+	// The maximum number of HTTP requests that can be in flight at once. Requests are acknowledged in order. 1 disables pipelining.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Max In-Flight Requests")
+	int32 ClientMaxInFlightRequests = FsparklogsSettings::DefaultMaxInFlightRequests;
+
+	// Whether the amount of log data sent in each request adapts to how the endpoint is keeping up. Requests grow (up to Bytes Per Request) while they are acknowledged quickly, and shrink by half after slow requests, throttling (HTTP 429) or server errors. Retries always resend exactly the same data.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Adaptive Request Sizing")
+	bool ClientAdaptiveRequestSizing = FsparklogsSettings::DefaultAdaptiveRequestSizing;
+
+	// With adaptive request sizing, requests that take longer than this many seconds to be acknowledged shrink the size of the requests that follow.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Target Request Latency Secs")
+	float ClientTargetRequestLatencySecs = FsparklogsSettings::DefaultTargetRequestLatencySecs;
+
+	// If positive, the size in bytes of a per-thread ring used to capture log messages without locking or formatting on the logging thread. A dedicated thread formats and writes them to the logfile in batches. Log timestamps that use wall clock time reflect when the line is written (normally within a few milliseconds). 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Log Capture Ring Bytes")
+	int32 ClientLogCaptureRingBytes = FsparklogsSettings::DefaultLogCaptureRingBytes;
+
+	// Whether or not the logfile may be memory mapped (where supported by the platform) so that a large backlog of log data is read without copying it. Smaller reads of newly written data always use the open file handle.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Map Source Logfile")
+	bool ClientMapSourceLogFile = FsparklogsSettings::DefaultMapSourceLogFile;
+
+	// When catching up on a backlog of logs (e.g., after being offline), the number of payloads built and compressed at once on other cores. Payloads are still sent in order. 1 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Catch Up Parallelism")
+	int32 ClientCatchUpParallelism = FsparklogsSettings::DefaultCatchUpParallelism;
+
+	// Whether analytics events are written to their own logfile and shipped by a separate high priority streamer with its own flush cadence, so that a flood of logs (or log requests being retried) never delays them.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Analytics Lane")
+	bool ClientAnalyticsLane = FsparklogsSettings::DefaultAnalyticsLane;
+
+	// When analytics events have their own lane, the desired number of seconds between attempts to ship them.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Analytics Processing Interval Secs")
+	float ClientAnalyticsProcessingIntervalSecs = FsparklogsSettings::DefaultAnalyticsProcessingIntervalSecs;
+
+	// When analytics events have their own lane, if there are at least this many unflushed bytes of analytics events and it's been at least MinIntervalBetweenFlushes time, it will automatically trigger a flush.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Analytics Unflushed Bytes To Auto Flush")
+	int32 ClientAnalyticsUnflushedBytesToAutoFlush = FsparklogsSettings::DefaultAnalyticsUnflushedBytesToAutoFlush;
+
+	// If positive, whenever more than this many bytes of logs are waiting to be shipped (e.g., during a log storm or a long outage), the oldest logs are dropped. Analytics events in their own lane are never dropped. 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Max Log Backlog Bytes")
+	int32 ClientMaxLogBacklogBytes = FsparklogsSettings::DefaultMaxLogBacklogBytes;
+
+	// If positive, each log category can write at most this many lines per second at each verbosity level from each thread, so that one misbehaving system cannot flood the logs. Dropped lines are counted and reported in a single event. Fatal errors are never dropped. 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Log Rate Limit Lines Per Sec")
+	float ClientLogRateLimitLinesPerSec = FsparklogsSettings::DefaultLogRateLimitLinesPerSec;
+
+	// With a log rate limit, how many lines a category can write in a burst before the rate limit applies.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Log Rate Limit Burst Lines")
+	int32 ClientLogRateLimitBurstLines = FsparklogsSettings::DefaultLogRateLimitBurstLines;
+
+	// Whether identical consecutive log lines of one thread are written once, followed by a single event with the number of repeats and the time of the first and last repeat. A line that repeats only once is written as is.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Coalesce Repeated Log Lines")
+	bool ClientCoalesceRepeatedLogLines = FsparklogsSettings::DefaultCoalesceRepeatedLogLines;
+
+	// If enabled (and Auto Start is enabled), engine startup only installs the logfile device, and the rest of starting the shipping engine (loading settings, computing common metadata, checking for a stale analytics session, starting threads) happens on a background task so it does not delay the first frame. Log lines and analytics events from before it is ready are held in memory and written once it is.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Async Startup")
+	bool ClientAsyncStartup = FsparklogsSettings::DefaultAsyncStartup;
+
+	// With Async Startup, the most bytes of early log lines (and separately, of analytics events) held in memory until the shipping engine is ready. Anything more is dropped and counted.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Startup Pre-Buffer Bytes")
+	int32 ClientStartupPreBufferBytes = FsparklogsSettings::DefaultStartupPreBufferBytes;
+
+	// If enabled, one elected instance on this host ships the logfiles of every instance on this host (each with its own progress), over one set of connections to the endpoint. The others only write their logfiles, and one of them takes over within a few seconds if the leader exits. Useful when running many server processes per host.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Host Agent")
+	bool ClientHostAgent = FsparklogsSettings::DefaultHostAgent;
+
+	// If positive, the plugin's logfiles are written as a series of segments of about this many bytes each (instead of one ever-growing file), and each segment is deleted as soon as it has been shipped. 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Spool Segment Bytes")
+	int32 ClientSpoolSegmentBytes = FsparklogsSettings::DefaultSpoolSegmentBytes;
+
+	// With Spool Segment Bytes, if positive, the most disk space the segments of one logfile should use (e.g., during a long outage). The oldest unshipped segments are dropped first, but segments holding analytics events, the segment being shipped, and the segment being written are never dropped. 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Spool Max Disk Bytes")
+	int32 ClientSpoolMaxDiskBytes = FsparklogsSettings::DefaultSpoolMaxDiskBytes;
+
+	// With Spool Segment Bytes, whether segments are written as length-prefixed binary records that hold each message already escaped, instead of lines of text. Shipping them takes less CPU, but the segments are no longer human readable. The logfile itself (without spooling) is always text.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Spool Binary Records")
+	bool ClientSpoolBinaryRecords = FsparklogsSettings::DefaultSpoolBinaryRecords;
+
+	// If positive, the most memory (in bytes) each log shipper should use for its buffers, e.g. on consoles and mobile. Buffers are allocated only when there is data to ship, sized to that data, and released after Memory Budget Idle Release Secs with nothing to ship. Bytes Per Request and Max In Flight Requests are lowered to fit, and large backlogs are not prepared in parallel. 0 disables.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Memory Budget Bytes")
+	int32 ClientMemoryBudgetBytes = FsparklogsSettings::DefaultMemoryBudgetBytes;
+
+	// With Memory Budget Bytes, how many seconds a log shipper must have had nothing to ship before it releases its buffers.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Memory Budget Idle Release Secs")
+	float ClientMemoryBudgetIdleReleaseSecs = FsparklogsSettings::DefaultMemoryBudgetIdleReleaseSecs;
+
+	// Whether to open the connection to the HTTP endpoint when the engine starts and when the app enters the foreground, so the first payload does not pay for connection setup in the middle of a flush.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Pre Warm Connection")
+	bool ClientPreWarmConnection = FsparklogsSettings::DefaultPreWarmConnection;
+
+	// The most seconds to spend shipping data when the shipping engine stops (e.g., at engine exit). Whatever is not shipped in time ships on the next launch.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Shutdown Flush Budget Secs")
+	float ClientShutdownFlushBudgetSecs = FsparklogsSettings::DefaultShutdownFlushBudgetSecs;
+
+	// If positive, the most seconds to block the game thread shipping data (analytics first) when the app enters the background (e.g., on mobile). 0 only requests a flush.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Background Flush Budget Secs")
+	float ClientBackgroundFlushBudgetSecs = FsparklogsSettings::DefaultBackgroundFlushBudgetSecs;
+
+	// If positive, resource and design events without custom attributes or an extra message are summed per session, event ID and reason, and one rollup event per key is written for every window of this many seconds (and when events are flushed or a session ends).
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Analytics Aggregation Window Secs")
+	float ClientAnalyticsAggregationWindowSecs = FsparklogsSettings::DefaultAnalyticsAggregationWindowSecs;
+
+	// With Analytics Aggregation Window Secs, the most keys summed up at once. The window ends early if an event with a new key would exceed this.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Analytics Aggregation Max Keys")
+	int32 ClientAnalyticsAggregationMaxKeys = FsparklogsSettings::DefaultAnalyticsAggregationMaxKeys;
+
+	// If set, every payload is also POSTed as plain JSON to this HTTP endpoint, e.g., a local Vector sidecar at http://localhost:9880/ (see Examples/local-elasticsearch-kibana). It is built and compressed only once. The mirror keeps its own progress, so it gets what it missed after a restart or while the cloud is unavailable (up to Mirror Max Lag Bytes).
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Mirror HTTP Endpoint URI")
+	FString ClientMirrorHTTPEndpointURI;
+
+	// If set, every payload is also appended as plain JSON to this local file (analytics payloads to the same name with an -analytics suffix).
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Mirror NDJSON File Path")
+	FString ClientMirrorNDJSONFilePath;
+
+	// With a mirror, the most payload bytes it may fall behind the fastest destination (or get ahead of the cloud while it is unavailable). Beyond that its oldest payloads are dropped, so a slow or unavailable mirror never holds back shipping to the cloud.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Mirror Max Lag Bytes")
+	int32 ClientMirrorMaxLagBytes = FsparklogsSettings::DefaultMirrorMaxLagBytes;
+
 	// If there are at least this many unflushed bytes and it's been at least MinIntervalBetweenFlushes time, it will automatically trigger a flush.
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Unflushed Bytes To Auto Flush")
 	int32 ClientUnflushedBytesToAutoFlush = FsparklogsSettings::DefaultUnflushedBytesToAutoFlush;
@@ -614,7 +1225,7 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Debug Log for Analytics Events")
 	bool ClientDebugLogForAnalyticsEvents = FsparklogsSettings::DefaultClientDebugLogForAnalyticsEvents;
 
-	// How to compress the payload. Use 'lz4' or 'none'. Defaults to lz4. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload.
+	// How to compress the payload. Use 'lz4', 'lz4frame', 'gzip' or 'none'. Defaults to lz4. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload. 'lz4frame' compresses the payload incrementally while it is being built (the destination must accept Content-Encoding lz4-frame). 'gzip' uses more CPU but sends fewer bytes, which can be better for metered mobile connections.
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Compression Mode")
 	FString ClientCompressionMode;
 
@@ -624,6 +1235,63 @@ public:
 };
 
 class SPARKLOGS_API FsparklogsReadAndStreamToCloud;
+class SPARKLOGS_API FsparklogsMirrorCursor;
+class SPARKLOGS_API FsparklogsProgressJournal;
+
+/** A payload handed to several sinks at once (see FsparklogsFanOutPayloadProcessor). The data is shared, so it must not be modified. */
+struct FsparklogsSharedPayload
+{
+	TSharedPtr<const TArray<uint8>, ESPMode::ThreadSafe> Data;
+	int OriginalPayloadLen = 0;
+	ITLCompressionMode CompressionMode = ITLCompressionMode::None;
+	/** Whether the payload uses the common metadata envelope format instead of a plain array of events */
+	bool IsEnvelope = false;
+};
+
+/**
+ * Tracks a payload that was handed to a payload processor but that may not have finished processing yet.
+ * The completion state can be updated from any thread.
+ */
+class SPARKLOGS_API FsparklogsPendingPayload
+{
+public:
+	FsparklogsPendingPayload();
+	~FsparklogsPendingPayload();
+	FsparklogsPendingPayload(const FsparklogsPendingPayload&) = delete;
+	FsparklogsPendingPayload& operator=(const FsparklogsPendingPayload&) = delete;
+
+	/** Thread-safe. Marks processing as finished (after the outcome has been recorded) and wakes up anyone waiting for it. */
+	void MarkEnded();
+	/** Waits up to WaitSecs for processing to finish without polling. Returns true if processing has finished. */
+	bool WaitForEnd(double WaitSecs);
+	/** Thread-safe. Gives up on the payload: records a retryable failure and marks processing as finished, so whoever waits for it returns right away. */
+	void Cancel();
+
+	/** Set to true once processing has finished (success or failure). Use MarkEnded to set this. */
+	FThreadSafeBool RequestEnded;
+	/** Whether or not the payload was processed successfully */
+	FThreadSafeBool RequestSucceeded;
+	/** If processing failed, whether or not the failure can be retried */
+	FThreadSafeBool RetryableFailure;
+	/** The platform time when processing started */
+	double StartTime;
+	/** The platform time when processing finished (or 0 if it has not finished) */
+	double EndTime;
+	/** The HTTP status code of the response (or 0 if there was no response) */
+	int32 ResponseCode;
+	/** If positive, the server asked to wait at least this many seconds before trying again (e.g., using a Retry-After header) */
+	double RetryAfterSecs;
+	/** Whether the endpoint was unable to process the payload (e.g., 400 or 413), so it was skipped instead of retried */
+	FThreadSafeBool Dropped;
+	/** Whether the payload was given up on (see Cancel), so a completion that arrives later must be ignored */
+	FThreadSafeBool Cancelled;
+	/** The HTTP request that is processing this payload (if any). Cleared once the payload is finished. */
+	TSharedPtr<IHttpRequest, ESPMode::ThreadSafe> HttpRequest;
+
+protected:
+	/** Triggered once processing has finished */
+	FEvent* EndedEvent;
+};
 
 /**
  * An interface that takes a (potentially compressed) JSON log payload from the WORKER thread of the streamer, and processes it.
@@ -632,8 +1300,43 @@ class SPARKLOGS_API IsparklogsPayloadProcessor
 {
 public:
 	virtual ~IsparklogsPayloadProcessor() = default;
-	/** Processes the JSON payload, and returns true on success or false on failure. */
+	/** Processes the JSON payload, and returns true on success or false on failure.
+	  * The processor may take ownership of the payload buffer by moving from it (e.g., MoveTemp) to avoid copying; the caller re-reserves it as needed. */
 	virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) = 0;
+	/** Starts processing the JSON payload and returns an object that tracks its completion. The payload buffer can be reused (or moved from) by the caller once this returns.
+	  * Processors that can have several payloads in flight at once should override this. The default implementation processes the payload synchronously. */
+	virtual TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> BeginProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr);
+	/** Waits for a payload started with BeginProcessPayload to finish, and returns true on success or false on failure. */
+	virtual bool FinishProcessPayload(TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr);
+	/** Thread-safe. Whether the processor also needs the JSON payload before compression (see BeginProcessPayloadWithUncompressed). Defaults to false.
+	  * The streamer then keeps the JSON payload until the payload is handed over, instead of compressing it block-by-block while it is built. */
+	virtual bool WantsUncompressedPayload() { return false; }
+	/** Like BeginProcessPayload, but also passes the JSON payload before compression (OriginalPayloadLen bytes), which the processor may move from.
+	  * UncompressedPayload is nullptr if the caller does not have it, or with compression mode None (the payload is the JSON payload). The default implementation ignores it. */
+	virtual TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> BeginProcessPayloadWithUncompressed(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TArray<uint8>* UncompressedPayload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr)
+	{
+		return BeginProcessPayload(JSONPayloadInUTF8, PayloadLen, OriginalPayloadLen, CompressionMode, StreamerWeakPtr);
+	}
+	/** Like BeginProcessPayload, for a payload that other sinks share, so it is read in place (StreamerWeakPtr is null for mirrors). The default
+	  * implementation processes a copy, processors that do not need to own the buffer should override this. */
+	virtual TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> BeginProcessSharedPayload(const FsparklogsSharedPayload& Payload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr);
+	/** Creates the cursors that track how far each mirror got in the logfile of a streamer (see FsparklogsFanOutPayloadProcessor), recording
+	  * their progress next to the streamer's progress journal at JournalPath (if not empty). Defaults to no mirrors. */
+	virtual void CreateMirrorCursors(const FString& JournalPath, TArray<TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>>& OutCursors) { }
+	/** Like BeginProcessPayloadWithUncompressed, but only hands the payload to the mirrors that do not have it yet, not to the destination itself.
+	  * The streamer uses this to keep mirrors going while the destination is unavailable, and to resend what a mirror missed. Defaults to doing nothing. */
+	virtual void MirrorPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TArray<uint8>* UncompressedPayload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) { }
+	/** The logfile of the streamer that owns Cursors started over (it was reset, or shipping moved on to the next segment). Defaults to doing nothing. */
+	virtual void RestartMirrors(const TArray<TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>>& Cursors) { }
+	/** Thread-safe. Whether the destination accepts payloads in the common metadata envelope format, where the common event JSON is sent once per
+	  * payload as {"common":{...},"events":[...]} and merged into each event by the destination. Defaults to false (a plain array of events). */
+	virtual bool AcceptsCommonMetadataEnvelope() { return false; }
+	/** Thread-safe. Prepares the destination ahead of the next payload (e.g., by opening a connection) without waiting for it. Defaults to doing nothing. */
+	virtual void PreWarm() { }
+	/** Thread-safe. Time from sending the first payload acknowledged since the processor was created or last pre-warmed until its response, or -1 if unknown. */
+	virtual double GetFirstAckLatencySecs() const { return -1.0; }
+	/** Thread-safe. Time the last pre-warm took to get a response, or -1 if unknown. */
+	virtual double GetPreWarmSecs() const { return -1.0; }
 };
 
 /** A payload processor that writes the data to a local file (for DEBUG purposes only). */
@@ -644,9 +1347,14 @@ protected:
 public:
 	FsparklogsWriteNDJSONPayloadProcessor(FString InOutputFilePath);
 	virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override;
+	virtual TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> BeginProcessSharedPayload(const FsparklogsSharedPayload& Payload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override;
+
+protected:
+	/** Appends the payload to the file as one line of JSON. */
+	bool WritePayload(const uint8* PayloadData, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode);
 };
 
-/** A payload processor that synchronously POSTs the data to an HTTP(S) endpoint. */
+/** A payload processor that POSTs the data to an HTTP(S) endpoint. Several requests can be in flight at once. */
 class SPARKLOGS_API FsparklogsWriteHTTPPayloadProcessor : public IsparklogsPayloadProcessor
 {
 protected:
@@ -656,37 +1364,456 @@ protected:
 	FThreadSafeCounter TimeoutMillisec;
 	bool LogRequests;
 
+	/** Headers that are the same for every request, built once. */
+	TArray<TPair<FString, FString>> StaticHeaders;
+
+	/** How often to recalculate the local timezone offset (it only changes with daylight saving time). */
+	static constexpr double TimezoneHeaderRefreshSecs = 60.0;
+
+	/**
+	 * State of the connection to the endpoint. Shared with the completion callbacks of requests, since those can outlive the processor
+	 * (e.g., a request that timed out completes after the processor was destroyed). Callbacks must only touch this, never the processor.
+	 */
+	struct FConnectionState
+	{
+		/** Whether a pre-warm request has been sent and has not yet completed */
+		FThreadSafeBool PreWarmInFlight;
+		/** Whether the next acknowledged payload is the first since the processor was created or last pre-warmed */
+		FThreadSafeBool FirstAckPending = true;
+		std::atomic<double> FirstAckLatencySecs{ -1.0 };
+		std::atomic<double> PreWarmSecs{ -1.0 };
+		/** The number of pre-warm requests sent */
+		std::atomic<int64> NumPreWarmsSent{ 0 };
+		/** Set once the endpoint has advertised that it can merge the common metadata envelope format. */
+		FThreadSafeBool EndpointAcceptsEnvelope;
+
+		// Protects access to any of data below this declaration.
+		mutable FCriticalSection CookieCriticalSection;
+		/** The session affinity cookies to send with the next request */
+		FString CookieHeader;
+
+		/** Records the latency of a payload sent at RequestStartTime that was acknowledged, if it is the first since the processor was created or last pre-warmed. */
+		void RecordAck(double RequestStartTime)
+		{
+			if (FirstAckPending.AtomicSet(false))
+			{
+				FirstAckLatencySecs.store(FPlatformTime::Seconds() - RequestStartTime);
+			}
+		}
+	};
+	TSharedRef<FConnectionState, ESPMode::ThreadSafe> ConnectionState;
+
 	// Protects access to any of data below this declaration.
 	mutable FCriticalSection DataCriticalSection;
-	FString DataCookieHeader;
+	FString DataTimezoneHeaderValue;
+	double DataTimezoneHeaderPlatformTime = 0.0;
 
 public:
 	FsparklogsWriteHTTPPayloadProcessor(const FString& InEndpointURI, const FString& InAuthorizationHeader, double InTimeoutSecs, bool InLogRequests, const FString& InTargetCurrency);
 	virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override;
+	virtual TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> BeginProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override;
+	virtual TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> BeginProcessSharedPayload(const FsparklogsSharedPayload& Payload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override;
+	virtual bool FinishProcessPayload(TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override;
+	virtual bool AcceptsCommonMetadataEnvelope() override { return ConnectionState->EndpointAcceptsEnvelope; }
+	/** Sends a HEAD request to the endpoint so that the HTTP backend has a connection ready to reuse for the next payload. Does nothing if one is already in flight. */
+	virtual void PreWarm() override;
+	virtual double GetFirstAckLatencySecs() const override { return ConnectionState->FirstAckLatencySecs.load(); }
+	virtual double GetPreWarmSecs() const override { return ConnectionState->PreWarmSecs.load(); }
+	/** Thread-safe. Whether a pre-warm request has been sent and has not yet completed. */
+	bool IsPreWarmInFlight() const { return ConnectionState->PreWarmInFlight; }
+	/** Thread-safe. The number of pre-warm requests sent so far. */
+	int64 GetNumPreWarmsSent() const { return ConnectionState->NumPreWarmsSent.load(); }
 	void SetTimeoutSecs(double InTimeoutSecs);
 
 protected:
+	/** Starts the request for a payload. Moves from OwnedContent if it is set, otherwise the request gets a copy of SharedContent. */
+	TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> BeginRequest(TArray<uint8>* OwnedContent, const TArray<uint8>* SharedContent, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, bool IsEnvelope);
 	/** Sets an HTTP header to communicate proper timezone information */
 	void SetHTTPTimezoneHeader(TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest);
-	/** Wait for the HTTP request to complete. Returns false on timeout or true if the request completed. */
-	bool SleepWaitingForHTTPRequest(TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest, FThreadSafeBool& RequestEnded, FThreadSafeBool& RequestSucceeded, FThreadSafeBool& RetryableFailure, double StartTime);
+	/** Wait for the HTTP request of the pending payload to complete, meanwhile writing behind the streamer's overdue analytics state.
+	  * Returns false on timeout or true if the request completed. */
+	bool SleepWaitingForHTTPRequest(FsparklogsPendingPayload& Pending, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr);
 
 	/** Thread-safe. Gets the current Cookie Header value. */
 	FString GetDataCookieHeader();
 
 	/** Thread-safe. Sets the value of the Cookie header. */
-	void SetDataCookieHeader(const FString& Value);
+	static void SetDataCookieHeader(FConnectionState& State, const FString& Value);
+};
+
+/**
+ * How far one mirror got in the logfile of one streamer: the end offset of the last payload queued for it, and of the last one it delivered
+ * (or dropped). The delivered offset is recorded in a progress journal of its own, so that after a restart the streamer can resend what the
+ * mirror had not delivered yet and skip what it already has (see FsparklogsFanOutPayloadProcessor).
+ */
+class SPARKLOGS_API FsparklogsMirrorCursor
+{
+public:
+	/** Without a JournalPath, progress is only kept in memory. */
+	FsparklogsMirrorCursor(const FString& JournalPath);
+	~FsparklogsMirrorCursor();
+
+	/** Thread-safe. Records that the payload with the data from StartOffset to EndOffset is queued for the mirror. Returns false if it already has it. */
+	bool TryQueue(int64 StartOffset, int64 EndOffset);
+	/** Thread-safe. Records that the mirror delivered (or dropped) the data before EndOffset. */
+	void MarkDelivered(int64 EndOffset);
+	/** Thread-safe. Records that the mirror has the data before Offset, e.g., when it starts over or skips what is too far behind. */
+	void Reset(int64 Offset);
+	int64 GetQueuedOffset() const { return QueuedOffset.load(); }
+	int64 GetDeliveredOffset() const { return DeliveredOffset.load(); }
+
+protected:
+	TUniquePtr<FsparklogsProgressJournal> Journal;
+	std::atomic<int64> QueuedOffset;
+	std::atomic<int64> DeliveredOffset;
+};
+
+/**
+ * Delivers payloads to a payload processor on its own thread, in order and with its own retries (see FsparklogsFanOutPayloadProcessor).
+ * Holds at most MirrorMaxLagBytes of queued payloads: beyond that the oldest queued payloads are dropped, so a slow or unavailable sink
+ * never holds back the others. Payloads are shared with the other sinks and handed to the processor without copying.
+ */
+class SPARKLOGS_API FsparklogsPayloadMirror : public FRunnable
+{
+public:
+	/** Delivery progress of a mirror. */
+	struct FStats
+	{
+		FString Name;
+		/** How far the mirror got in the stream of payloads: the payloads (and their JSON bytes) delivered so far */
+		int64 DeliveredPayloads = 0;
+		int64 DeliveredBytes = 0;
+		/** Payloads dropped because the mirror fell too far behind or because the sink was unable to process them */
+		int64 DroppedPayloads = 0;
+		/** Attempts that failed (retryable failures are retried) */
+		int64 FailedAttempts = 0;
+		/** Payloads waiting to be delivered (including the one being delivered) and their size */
+		int32 QueuedPayloads = 0;
+		int64 QueuedBytes = 0;
+	};
+
+	/** If Uncompressed, the sink gets the JSON payload (with compression mode None) instead of the encoded payload. */
+	FsparklogsPayloadMirror(const FString& InName, TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InProcessor, bool InUncompressed, TSharedRef<FsparklogsSettings> InSettings);
+	~FsparklogsPayloadMirror();
+
+	/** Thread-safe. Queues a payload to deliver, dropping the oldest queued payloads if it would fall too far behind. Once it is delivered
+	  * (or dropped because the sink is unable to process it) the cursor, if any, records EndOffset. */
+	void Enqueue(const FsparklogsSharedPayload& Payload, TSharedPtr<FsparklogsMirrorCursor, ESPMode::ThreadSafe> Cursor, int64 EndOffset);
+	/** Thread-safe. Queues a reset of the cursor to the start of the logfile, which it records once everything queued before it is delivered. */
+	void EnqueueRestart(TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe> Cursor);
+	/** Thread-safe. Waits up to WaitSecs for everything queued to be delivered (or dropped). Returns true if nothing is left in the queue.
+	  * On the game thread it ticks while it waits, so that HTTP requests can complete. */
+	bool WaitUntilIdle(double WaitSecs);
+	/** Thread-safe. Gets the delivery progress. */
+	void GetStats(FStats& OutStats) const;
+	const FString& GetName() const { return Name; }
+	bool IsUncompressed() const { return Uncompressed; }
+	IsparklogsPayloadProcessor& GetProcessor() const { return *Processor; }
+
+	//~ Begin FRunnable Interface
+	virtual bool Init() override;
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	//~ End FRunnable Interface
+
+protected:
+	struct FQueuedPayload
+	{
+		/** No data for a queued restart of the cursor */
+		FsparklogsSharedPayload Payload;
+		TSharedPtr<FsparklogsMirrorCursor, ESPMode::ThreadSafe> Cursor;
+		int64 EndOffset;
+	};
+
+	FString Name;
+	TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> Processor;
+	bool Uncompressed;
+	TSharedRef<FsparklogsSettings> Settings;
+	int64 MaxLagBytes;
+	volatile FRunnableThread* Thread;
+	/** Non-zero stops this thread */
+	FThreadSafeCounter StopRequestCounter;
+	/** Triggered when a payload is queued or a stop is requested */
+	FEvent* WakeEvent;
+
+	std::atomic<int64> DeliveredPayloads;
+	std::atomic<int64> DeliveredBytes;
+	std::atomic<int64> DroppedPayloads;
+	std::atomic<int64> FailedAttempts;
+
+	// Protects access to any of data below this declaration.
+	mutable FCriticalSection QueueCriticalSection;
+	/** Payloads to deliver, oldest first. The first one stays queued while it is being delivered. */
+	TArray<FQueuedPayload> Queue;
+	/** The size of everything in Queue */
+	int64 QueuedBytes;
+	/** Whether the first queued payload is being delivered (so it cannot be dropped) */
+	bool Delivering;
+	/** The payload the processor is working on, so that stopping can cancel it instead of waiting for it to time out */
+	TSharedPtr<FsparklogsPendingPayload, ESPMode::ThreadSafe> DeliveringPending;
+
+	/** [WORKER] Delivers the given payload once. Returns true if it is done with (delivered, or permanently rejected and dropped). */
+	bool WorkerDeliver(const FQueuedPayload& Payload, double& OutRetryAfterSecs);
+};
+
+/**
+ * A payload processor that sends every payload to a primary processor and mirrors it to other sinks (e.g., a local Vector sidecar or an
+ * NDJSON archive), so the payload is read, built and compressed only once. Each mirror gets the payload as soon as the streamer hands it to
+ * the primary, and delivers it with its own queue and retries (see FsparklogsPayloadMirror). The primary decides the outcome, so the progress
+ * marker and retries of the streamer follow the primary, but each mirror keeps its own progress in every logfile (see FsparklogsMirrorCursor):
+ * a payload the streamer sends again is not mirrored again, while the primary is unavailable the streamer keeps reading ahead for the mirrors
+ * (up to MirrorMaxLagBytes past the primary's progress), and after a restart it resends to each mirror what it had not delivered (up to
+ * MirrorMaxLagBytes behind). A mirror still drops payloads once it falls more than MirrorMaxLagBytes behind the fastest sink, and when its
+ * sink permanently rejects one. Payloads that are handed over without a streamer are mirrored every time.
+ */
+class SPARKLOGS_API FsparklogsFanOutPayloadProcessor : public IsparklogsPayloadProcessor
+{
+public:
+	FsparklogsFanOutPayloadProcessor(TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InPrimary);
+	/** Not thread-safe: add every mirror before the processor is handed to a streamer. */
+	void AddMirror(TUniquePtr<FsparklogsPayloadMirror> Mirror);
+	int32 NumMirrors() const { return Mirrors.Num(); }
+
+	virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override;
+	virtual TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> BeginProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override;
+	virtual TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> BeginProcessPayloadWithUncompressed(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TArray<uint8>* UncompressedPayload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override;
+	virtual bool FinishProcessPayload(TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override;
+	virtual bool WantsUncompressedPayload() override { return AnyUncompressedMirror; }
+	/** Only if the primary and every mirror accept it, since all of them get the same payload. */
+	virtual bool AcceptsCommonMetadataEnvelope() override;
+	virtual void PreWarm() override { Primary->PreWarm(); }
+	virtual double GetFirstAckLatencySecs() const override { return Primary->GetFirstAckLatencySecs(); }
+	virtual double GetPreWarmSecs() const override { return Primary->GetPreWarmSecs(); }
+	/** One cursor per mirror, in the order the mirrors were added, each with a journal named after the mirror next to JournalPath. */
+	virtual void CreateMirrorCursors(const FString& JournalPath, TArray<TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>>& OutCursors) override;
+	virtual void MirrorPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TArray<uint8>* UncompressedPayload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr) override;
+	virtual void RestartMirrors(const TArray<TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>>& Cursors) override;
+
+	/** Thread-safe. Waits up to WaitSecs for every mirror to deliver what it has queued. Returns true if nothing is left in any queue.
+	  * On the game thread it ticks while it waits, so that HTTP requests can complete. */
+	bool WaitForMirrors(double WaitSecs);
+	/** Thread-safe. Gets the delivery progress of every mirror. */
+	void GetMirrorStats(TArray<FsparklogsPayloadMirror::FStats>& OutStats) const;
+
+protected:
+	TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> Primary;
+	TArray<TUniquePtr<FsparklogsPayloadMirror>> Mirrors;
+	bool AnyUncompressedMirror;
+
+	/** Queues the payload for every mirror whose cursor (from the streamer, if any) does not have it yet, sharing one buffer between them.
+	  * The buffers are moved from instead of copied, so the encoded payload is returned once the mirrors took it (no data if they did not). */
+	FsparklogsSharedPayload EnqueueForMirrors(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, TArray<uint8>* UncompressedPayload, TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> StreamerWeakPtr);
+};
+
+/**
+ * Append-only UTF-8 buffer used to build JSON payloads. Backed by a TArray so that a finished payload can be handed off
+ * without copying (swapped or moved into the encoded payload / HTTP request). Reset keeps the allocation for reuse.
+ */
+class SPARKLOGS_API FITLJSONPayloadBuilder
+{
+public:
+	FITLJSONPayloadBuilder() { }
+
+	/** Clears the contents but keeps the allocation. */
+	void Reset() { Data.Reset(); }
+	/** Makes sure there is room for at least N bytes in total without reallocating. */
+	void Reserve(int N) { Data.Reserve(N); }
+	int Len() const { return Data.Num(); }
+	const ANSICHAR* GetData() const { return (const ANSICHAR*)Data.GetData(); }
+	/** The underlying buffer. Can be swapped or moved from to take ownership of the built payload. */
+	TArray<uint8>& GetArray() { return Data; }
+	const TArray<uint8>& GetArray() const { return Data; }
+
+	FITLJSONPayloadBuilder& Append(const ANSICHAR* String, int N)
+	{
+		Data.Append((const uint8*)String, N);
+		return *this;
+	}
+	FITLJSONPayloadBuilder& Append(const ANSICHAR* String)
+	{
+		return Append(String, FCStringAnsi::Strlen(String));
+	}
+
+protected:
+	TArray<uint8> Data;
+};
+
+using TITLJSONStringBuilder = FITLJSONPayloadBuilder;
+
+/** Finds the first occurrence of Needle in up to MaxToSearch bytes of Haystack. Uses SIMD when available. Returns false if not found. */
+SPARKLOGS_API bool ITLFindFirstByte(const uint8* Haystack, uint8 Needle, int MaxToSearch, int& OutIndex);
+/** Byte-at-a-time reference version of ITLFindFirstByte. */
+SPARKLOGS_API bool ITLFindFirstByteScalar(const uint8* Haystack, uint8 Needle, int MaxToSearch, int& OutIndex);
+/** Append UTF-8 encoded string data as an escaped JSON string value, bulk-copying runs that need no escaping. Uses SIMD when available.
+  * Also converts the special encoded newline (CharInternalNewline) to a real newline. */
+SPARKLOGS_API void ITLAppendUTF8AsEscapedJsonString(TITLJSONStringBuilder& Builder, const ANSICHAR* String, int N);
+/** Byte-at-a-time reference version of ITLAppendUTF8AsEscapedJsonString. */
+SPARKLOGS_API void ITLAppendUTF8AsEscapedJsonStringScalar(TITLJSONStringBuilder& Builder, const ANSICHAR* String, int N);
+/** Returns the name of the SIMD instruction set used by the payload building kernels (or "scalar"). */
+SPARKLOGS_API const TCHAR* ITLGetPayloadKernelName();
+
+/**
+ * Streams condensed JSON straight into a UTF-8 builder without building an FJsonObject first. The output is byte-for-byte
+ * what FJsonSerializer produces with TCondensedJsonPrintPolicy for the same fields written in the same order.
+ * Values inside an object take a Key; array elements pass a nullptr Key. Nesting is not validated.
+ */
+class SPARKLOGS_API FsparklogsJSONWriterUTF8
+{
+public:
+	/** Writes into InBuilder, which is reset (keeping its allocation). */
+	explicit FsparklogsJSONWriterUTF8(TITLJSONStringBuilder& InBuilder);
+
+	void BeginObject(const TCHAR* Key = nullptr);
+	void EndObject();
+	void BeginArray(const TCHAR* Key = nullptr);
+	void EndArray();
+
+	void WriteString(const TCHAR* Key, const TCHAR* Value, int32 ValueLen);
+	void WriteString(const TCHAR* Key, const TCHAR* Value) { WriteString(Key, Value, (Value == nullptr) ? 0 : FCString::Strlen(Value)); }
+	void WriteString(const TCHAR* Key, const FString& Value) { WriteString(Key, *Value, Value.Len()); }
+	/** Numbers are written with 17 significant digits like the engine does. Non-finite numbers are written as null. */
+	void WriteNumber(const TCHAR* Key, double Value);
+	void WriteBool(const TCHAR* Key, bool Value);
+	void WriteNull(const TCHAR* Key);
+	/** Writes an array of strings, optionally skipping empty ones. */
+	void WriteStringArray(const TCHAR* Key, const TArray<FString>& Values, bool SkipEmpty);
+	/** Writes already encoded UTF-8 JSON (e.g., the output of another writer) as the value. */
+	void WriteRawValue(const TCHAR* Key, const ANSICHAR* JSON, int32 JSONLen);
+	/** Writes already encoded UTF-8 "key":value pairs (separated by commas) into the object that is currently open. */
+	void WriteRawFields(const ANSICHAR* JSON, int32 JSONLen);
+	/** Recursively writes any JSON value from the generic DOM. Null pointers are written as null. */
+	void WriteJsonValue(const TCHAR* Key, const TSharedPtr<FJsonValue>& Value);
+	/** Writes every field of Object into the object that is currently open. */
+	void WriteJsonObjectFields(const FJsonObject& Object);
+
+	const ANSICHAR* GetData() const { return Builder.GetData(); }
+	int32 Len() const { return Builder.Len(); }
+
+protected:
+	TITLJSONStringBuilder& Builder;
+	/** Whether the next value in the current object/array must be preceded by a comma. */
+	bool NeedsComma;
+
+	/** Writes the separating comma (if needed) and the escaped key (if any). */
+	void WriteKey(const TCHAR* Key);
+	/** Appends S as a quoted, escaped JSON string in a single pass. */
+	void WriteEscapedString(const TCHAR* S, int32 Len);
+};
+
+/** Controls the synthetic log messages and the load generated by FsparklogsBenchmark and FsparklogsStressGenerator. */
+struct SPARKLOGS_API FsparklogsBenchmarkOptions
+{
+	/** The number of threads that generate load at the same time. */
+	int NumThreads;
+	/** The number of messages (or events) that each thread generates per scenario. */
+	int MessagesPerThread;
+	/** Message lengths (in characters) are uniformly distributed between MinMessageLen and MaxMessageLen... */
+	int MinMessageLen;
+	int MaxMessageLen;
+	/** ...except for this percentage of messages, which are LargeMessageLen characters long. */
+	double LargeMessagePercent;
+	int LargeMessageLen;
+	/** The percentage of characters that are non-ASCII (an even mix of 2, 3 and 4 byte UTF-8, the latter being surrogate pairs in UTF-16). */
+	double UnicodePercent;
+	/** Seed for the random message generator, so that runs are repeatable. */
+	int32 Seed;
+
+	FsparklogsBenchmarkOptions();
+
+	/** Applies any overrides in the form "threads=8 messages=20000 minlen=40 maxlen=400 largepct=1 largelen=8192 unicodepct=5 seed=1". */
+	void Parse(const TCHAR* Params);
+	/** Generates one synthetic log message using the configured size distribution and Unicode mix. */
+	void GenerateMessage(FRandomStream& Random, FString& OutMessage) const;
 };
 
-using TITLJSONStringBuilder = TAnsiStringBuilder<4 * 1024>;
+// The benchmark is a development tool only, so it is not part of shipping builds (the synthetic messages above are, for the stress generator)
+#if !UE_BUILD_SHIPPING
+/** The measurements taken by one benchmark scenario. */
+struct SPARKLOGS_API FsparklogsBenchmarkResult
+{
+	FString Scenario;
+	int NumThreads;
+	/** The number of operations (lines, events, payloads...) processed. */
+	int64 Operations;
+	/** The number of bytes of input processed. */
+	int64 Bytes;
+	double Seconds;
+	/** Latency percentiles of individual operations in milliseconds, or negative if not measured. */
+	double P50Ms;
+	double P90Ms;
+	double P99Ms;
+	double MaxMs;
+	/** Original size / compressed size, or negative if not applicable. */
+	double CompressionRatio;
+
+	FsparklogsBenchmarkResult(const TCHAR* InScenario, int InNumThreads);
+
+	double GetOpsPerSec() const { return Seconds > 0 ? (double)Operations / Seconds : 0.0; }
+	double GetMBPerSec() const { return Seconds > 0 ? ((double)Bytes / (1024.0 * 1024.0)) / Seconds : 0.0; }
+	/** Computes the latency percentiles from the given samples (in seconds). Sorts the samples. */
+	void SetLatencies(TArray<double>& LatencySecs);
+	/** Returns the result as a single line JSON object. */
+	FString ToJSON() const;
+};
 
 /**
- * Background thread that generates fake log entries to stress the logging system.
+ * Measures the throughput and latency of the logging pipeline so that regressions can be caught between releases.
+ * Scenarios: serialize (lines/sec through FsparklogsOutputDeviceFile::Serialize), analytics (cost of creating typed analytics events),
+ * payload (MB/s of reading the logfile and building payloads), compress (MB/s per compression mode), and e2e (log-to-ack latency
+ * against a local sink). Runnable from the sparklogs.Benchmarks automation tests or the sparklogs.Benchmark console command. Writes scratch files
+ * to WorkDir. Not available in shipping builds.
+ */
+class SPARKLOGS_API FsparklogsBenchmark
+{
+public:
+	static constexpr const TCHAR* ScenarioAll = TEXT("all");
+	static constexpr const TCHAR* ScenarioSerialize = TEXT("serialize");
+	static constexpr const TCHAR* ScenarioAnalytics = TEXT("analytics");
+	static constexpr const TCHAR* ScenarioPayload = TEXT("payload");
+	static constexpr const TCHAR* ScenarioCompress = TEXT("compress");
+	static constexpr const TCHAR* ScenarioEndToEnd = TEXT("e2e");
+
+	FsparklogsBenchmark(const FsparklogsBenchmarkOptions& InOptions, const FString& InWorkDir);
+	~FsparklogsBenchmark();
+
+	/** Runs the named scenario (or all of them) and appends the results. Returns false if the scenario is unknown or failed. */
+	bool Run(const FString& Scenario, TArray<FsparklogsBenchmarkResult>& OutResults);
+
+	bool RunSerialize(TArray<FsparklogsBenchmarkResult>& OutResults);
+	bool RunAnalytics(TArray<FsparklogsBenchmarkResult>& OutResults);
+	bool RunPayload(TArray<FsparklogsBenchmarkResult>& OutResults);
+	bool RunCompress(TArray<FsparklogsBenchmarkResult>& OutResults);
+	bool RunEndToEnd(TArray<FsparklogsBenchmarkResult>& OutResults);
+
+	/** Returns the results as newline-delimited JSON (one object per line). */
+	static FString ResultsToNDJSON(const TArray<FsparklogsBenchmarkResult>& Results);
+
+protected:
+	FsparklogsBenchmarkOptions Options;
+	FString WorkDir;
+	/** Used for the progress marker of any streamers created by the benchmark. */
+	int InstanceIndex;
+	bool CreatedWorkDir;
+
+	/** Runs Body(ThreadIndex) on NumThreads threads of their own and waits for all of them, so that every thread index runs concurrently. */
+	void RunOnThreads(TFunctionRef<void(int32)> Body) const;
+	/** Pre-generates the messages for each thread so that generating them is not measured. */
+	void GenerateThreadMessages(TArray<TArray<FString>>& OutMessages) const;
+	/** Returns the path of a new (empty) scratch logfile. */
+	FString GetScratchLogFile(const TCHAR* Name) const;
+	/** Removes any progress marker written by streamers created by the benchmark. */
+	void ClearProgressMarker() const;
+};
+#endif
+
+/**
+ * Background thread that generates synthetic log entries (see FsparklogsBenchmarkOptions) to stress the logging system.
  */
 class SPARKLOGS_API FsparklogsStressGenerator : public FRunnable
 {
 protected:
 	TSharedRef<FsparklogsSettings> Settings;
+	FsparklogsBenchmarkOptions Options;
 	volatile FRunnableThread* Thread;
 	/** Non-zero stops this thread */
 	FThreadSafeCounter StopRequestCounter;
@@ -702,6 +1829,234 @@ public:
 	//~ End FRunnable Interface
 };
 
+/**
+ * Compact binary journal of streaming progress: the shipped logfile offset, the read length of the pending request (and any pipelined
+ * requests after it), and the progress state (common event JSON). The file has two equally sized slots that are written alternately, each
+ * with a sequence number and a checksum over the record and state, so a torn write can only lose the latest update. Slots are sized for the
+ * record and state, and grow (by replacing the file) only when a larger state is written. Writes go through a persistent file handle and
+ * are fully flushed to disk at most once every MinFullFlushIntervalSecs (and always on close). Records written by version 1 (which had no
+ * flags) are still read.
+ */
+class SPARKLOGS_API FsparklogsProgressJournal
+{
+public:
+	static constexpr uint32 Magic = 0x4A504C53; // "SLPJ"
+	static constexpr uint16 Version = 2;
+	static constexpr int MaxFollowingReadLens = 16;
+	static constexpr int MaxStateLen = 64 * 1024;
+	static constexpr int RecordSize = 112;
+	static constexpr int Version1RecordSize = 108;
+	/** Slots are sized in multiples of this */
+	static constexpr int SlotAlignment = 512;
+	static constexpr double MinFullFlushIntervalSecs = 1.0;
+
+	FsparklogsProgressJournal(const FString& InPath);
+	~FsparklogsProgressJournal();
+
+	/** Thread-safe. Returns the latest valid record, reading the file on first use. Returns false if the journal has no valid record. */
+	bool Read(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutState, TArray<int>& OutFollowingReadLens);
+	/** Thread-safe. Same as above, also returning whether the payloads to retry (see InRetryIsEnvelope) use the common metadata envelope format. */
+	bool Read(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutState, TArray<int>& OutFollowingReadLens, bool& OutRetryIsEnvelope);
+	/** Thread-safe. Records new progress. If State is null the previously recorded state is kept. InRetryIsEnvelope records the payload format
+	  * of the requests whose read lengths are recorded, so that retries can be sent exactly like the original attempts. Returns false on failure. */
+	bool Write(int64 InMarker, int InLastReadLen, const TArray<uint8>* InState, const TArray<int>* InFollowingReadLens, bool InRetryIsEnvelope = false);
+	/** Thread-safe. Fully flushes and closes the file. It will be re-opened by the next write. */
+	void Close();
+
+	const FString& GetPath() const { return Path; }
+	/** Thread-safe. The size of each slot in the file, or 0 if the file does not exist yet. */
+	int64 GetSlotSize();
+
+protected:
+	FString Path;
+	FCriticalSection CriticalSection;
+	TUniquePtr<class IFileHandle> Handle;
+	/** The size of each slot in the file, or 0 if the file does not exist yet. */
+	int64 SlotSize;
+	bool Loaded;
+	bool HasRecord;
+	uint64 Sequence;
+	int64 Marker;
+	int LastReadLen;
+	TArray<int> FollowingReadLens;
+	bool RetryIsEnvelope;
+	TArray<uint8> State;
+	double LastFullFlushPlatformTime;
+	/** Record and state being written, reused between writes. */
+	TArray<uint8> WriteBuffer;
+
+	/** Reads the newest valid slot from disk if not yet done, recovering from a crash during Resize. Must hold CriticalSection. */
+	void LoadIfNeeded();
+	/** Takes the newest valid slot of the file if it is newer than the record already loaded. Returns true if it did. Must hold CriticalSection. */
+	bool LoadNewestSlot(const FString& FilePath, int64& OutSlotSize);
+	/** Where Resize writes the resized journal before it moves it into place */
+	FString GetTempPath() const { return Path + TEXT(".tmp"); }
+	/** Opens the file for writing, sizing it for both slots. Must hold CriticalSection. */
+	bool OpenForWrite();
+	/** Replaces the file with one that has slots of NewSlotSize bytes and only holds the record in WriteBuffer. Must hold CriticalSection. */
+	bool Resize(int64 NewSlotSize);
+	/** Decodes one slot. Returns false if it does not hold a valid record. */
+	static bool DecodeSlot(const uint8* Data, int64 Len, uint64& OutSequence, int64& OutMarker, int& OutLastReadLen, TArray<int>& OutFollowingReadLens, bool& OutRetryIsEnvelope, TArray<uint8>& OutState);
+};
+
+/**
+ * Follows a logfile that is being appended to, keeping it open between reads instead of reopening it for every read.
+ * The file is reopened when it was truncated (its size went down) or replaced, e.g. rotated away (checked whenever it stops growing).
+ * If mapping is allowed and the platform supports it, a large backlog of data is returned straight from the mapped file without
+ * a copy. Newly appended data beyond the mapping is read through the open handle until at least MinRemapBytes more are available.
+ */
+class SPARKLOGS_API FsparklogsTailReader
+{
+public:
+	/** The least amount of unmapped data that makes it worthwhile to map the file again instead of reading the data into a buffer. */
+	static constexpr int64 MinRemapBytes = 1024 * 1024;
+
+	enum class EStatus
+	{
+		Ready,
+		/** The file does not exist (yet). */
+		Missing,
+		Failed
+	};
+
+	FsparklogsTailReader(const FString& InPath, bool InAllowMapping);
+	~FsparklogsTailReader();
+
+	/** Opens the file if needed (reopening it if it was truncated or replaced) and gets its current size. */
+	EStatus Refresh(int64& OutFileSize);
+	/** Returns Len bytes of the file starting at Offset, which must be within the size returned by the last Refresh. The data is either in
+	  * the mapped file or read into Buffer (which must have room for Len bytes), and stays valid until the next call. Returns nullptr on failure. */
+	const uint8* Read(int64 Offset, int32 Len, uint8* Buffer);
+	/** Closes the file and any mapping. The next Refresh reopens it. */
+	void Close();
+
+	bool IsOpen() const { return Handle.IsValid(); }
+	/** Whether the data returned by the last Read came straight from the mapped file. */
+	bool LastReadWasMapped() const { return LastReadMapped; }
+	const FString& GetPath() const { return Path; }
+
+protected:
+	FString Path;
+	bool AllowMapping;
+	TUniquePtr<class IFileHandle> Handle;
+	/** The size of the file at the last Refresh. */
+	int64 LastSize;
+	TUniquePtr<class IMappedFileHandle> MappedHandle;
+	TUniquePtr<class IMappedFileRegion> MappedRegion;
+	/** The number of bytes from the start of the file that are mapped (0 if not mapped). */
+	int64 MappedSize;
+	/** Set once mapping failed, so reads stop trying to map the file. */
+	bool MappingUnavailable;
+	bool LastReadMapped;
+
+	/** Maps the first FileSize bytes of the file, replacing any previous mapping. Returns false if the file could not be mapped. */
+	bool Remap(int64 FileSize);
+	void Unmap();
+};
+
+/**
+ * Names and finds the segments of a spooled logfile (see FsparklogsSettings::SpoolSegmentBytes). The output device writes numbered segments
+ * next to the logfile, and starts the next one once the current one reaches the segment size. The streamer ships the oldest segment first,
+ * and deletes it once it has been fully shipped and a newer segment exists. A segment that holds analytics events has an empty marker file.
+ */
+class SPARKLOGS_API FsparklogsSpool
+{
+public:
+	/** How often the streamer looks for new segments (and checks the disk budget) while the segment it ships is still growing. */
+	static constexpr double ScanIntervalSecs = 1.0;
+
+	struct FSegment
+	{
+		FString Path;
+		/** 0 for the logfile itself (e.g., left from before spooling was enabled), which always comes first. */
+		int64 Number = 0;
+		int64 Size = 0;
+		/** Whether the segment may hold analytics events, so it is never dropped to stay within the disk budget. */
+		bool Protected = false;
+	};
+
+	/** Returns the path of segment Number of the logfile. */
+	static FString GetSegmentPath(const FString& LogFilePath, int64 Number);
+	/** Returns the path of the marker file that protects a segment. */
+	static FString GetProtectedMarkerPath(const FString& SegmentPath);
+	/** Finds the logfile (if it exists) and all of its segments, oldest first. */
+	static void FindSegments(const FString& LogFilePath, TArray<FSegment>& OutSegments);
+	/** Whether the logfile has any segments. */
+	static bool HasSegments(const FString& LogFilePath);
+	/** Deletes one segment and its marker. Returns false if the segment could not be removed. */
+	static bool PurgeSegment(const FSegment& Segment);
+	/** Deletes every segment of the logfile (but not the logfile itself). Returns false if any could not be removed. */
+	static bool PurgeSegments(const FString& LogFilePath);
+};
+
+/**
+ * A snapshot of the shipping pipeline for one lane, e.g., so that a health endpoint can report how far behind shipping is.
+ * Times are in seconds, and values that were never measured are negative.
+ */
+struct SPARKLOGS_API FsparklogsShipperStats
+{
+	/** Bytes of the logfile that were written but not yet shipped (as of the last payload that was acknowledged) */
+	int64 BacklogBytes = 0;
+	/** Bytes written to the logfile since the last flush started */
+	int64 BytesQueuedSinceLastFlush = 0;
+	/** Seconds since the last flush started */
+	double SecsSinceLastFlush = -1.0;
+	/** Seconds since the last flush succeeded */
+	double SecsSinceLastSuccessfulFlush = -1.0;
+	/** Whether the most recent flush failed (and will be retried) */
+	bool LastFlushFailed = false;
+	/** The number of flushes that finished (success or fail) */
+	int32 NumFlushes = 0;
+	/** The number of flushes that succeeded */
+	int32 NumSuccessfulFlushes = 0;
+	/** The number of flushes that failed and were scheduled to be retried */
+	int64 NumRetries = 0;
+	/** The number of payloads the endpoint was unable to process (e.g., 400 or 413) that were skipped */
+	int64 NumDroppedPayloads = 0;
+	/** The number of logfile bytes skipped without shipping because the backlog exceeded MaxLogBacklogBytes */
+	int64 DroppedBacklogBytes = 0;
+	/** The most bytes that will be read for the next new payload */
+	int32 BytesPerRequest = 0;
+	/** Time to build the last payload (not including compression) */
+	double LastBuildSecs = -1.0;
+	/** Time to compress the last payload */
+	double LastCompressSecs = -1.0;
+	/** Time from sending the last acknowledged payload until its response */
+	double LastRequestSecs = -1.0;
+	/** Original size / compressed size of the last payload */
+	double LastCompressionRatio = -1.0;
+	/** Time between the last flush or stop request and the worker sending a payload in response */
+	double LastWakeToSendLatencySecs = -1.0;
+	/** Total bytes written to the logfile by this process (including an estimate of the per-line overhead) */
+	int64 BytesWritten = 0;
+	/** Total lines written to the logfile by this process */
+	int64 LinesWritten = 0;
+	/** Recent rate of writes to the logfile */
+	double BytesWrittenPerSec = 0.0;
+	double LinesWrittenPerSec = 0.0;
+	/** Lines that were not written because they repeated the previous line or exceeded a rate limit */
+	int64 NumSuppressedLines = 0;
+	/** Bytes of memory currently held by the streamer for its read and payload buffers */
+	int64 BufferBytes = 0;
+	/** Time from sending the first payload acknowledged since the connection was last warmed up (or the engine started) until its response */
+	double FirstAckLatencySecs = -1.0;
+	/** Time the last pre-warm of the connection took to get a response */
+	double PreWarmSecs = -1.0;
+};
+
+/** What a deadline-bounded flush (see FsparklogsModule::FlushWithDeadline) shipped, and what was left for later. */
+struct SPARKLOGS_API FsparklogsDeadlineFlushResult
+{
+	/** Whether everything written so far was shipped before the deadline */
+	bool ShippedEverything = false;
+	/** Bytes of analytics events that were not shipped (they ship later, e.g. on the next launch) */
+	int64 AnalyticsBytesLeft = 0;
+	/** Bytes of logs that were not shipped */
+	int64 LogsBytesLeft = 0;
+	/** How long the flush took */
+	double ElapsedSecs = 0.0;
+};
+
 /**
 * On a background thread, reads data from a logfile on disk and streams to the cloud.
 */
@@ -711,17 +2066,31 @@ public:
 	static constexpr const TCHAR* ProgressMarkerValue = TEXT("ShippedLogOffset");
 	static constexpr const TCHAR* ProgressMarkerStateValue = TEXT("ShippedLogState");
 	static constexpr const TCHAR* ProgressMarkerLastReadLenValue = TEXT("ShippedLogLastReadLen");
+	static constexpr const TCHAR* ProgressMarkerInFlightReadLensValue = TEXT("ShippedLogInFlightReadLens");
+	static constexpr const TCHAR* ProgressMarkerRetryEnvelopeValue = TEXT("ShippedLogRetryEnvelope");
 
 protected:
 	TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> WeakThisPtr;
 	TSharedRef<FsparklogsSettings> Settings;
 	TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor;
+	/** Which data this streamer ships. Decides the flush cadence and where progress is recorded. */
+	ITLStreamLane Lane;
+	/** Whether the payload processor also needs the JSON payload before compression (see IsparklogsPayloadProcessor::WantsUncompressedPayload). */
+	bool KeepUncompressedPayload;
 	FString ProgressMarkerPath;
+	/** Where progress is recorded, unless progress must be kept in the INI file at ProgressMarkerPath (see ITLGetProgressJournalPath). */
+	TUniquePtr<FsparklogsProgressJournal> ProgressJournal;
+	/** How far each mirror of the payload processor got in this logfile (see IsparklogsPayloadProcessor::CreateMirrorCursors). */
+	TArray<TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>> MirrorCursors;
+	/** Makes migrating progress from the INI file to the journal happen only once. */
+	FCriticalSection ProgressMigrationCriticalSection;
 	FString SourceLogFile;
 	int MaxLineLength;
 
 	/** If non-empty, will override the computer name */
 	FString OverrideComputerName;
+	/** If non-zero, will override the process ID (e.g., when shipping the logfile of another process) */
+	uint32 OverrideProcessId;
 	/** JSON object fragment that is common to all log events (hostname, project name, etc.) */
 	TArray<uint8> CommonEventJSONData;
 	/** WORKER thread */
@@ -732,6 +2101,34 @@ protected:
 	FThreadSafeCounter FlushRequestCounter;
 	/** Non-zero indicates to immediately clear the minimum retry counter */
 	FThreadSafeCounter FlushClearMinNextPlatformTime;
+	/** Wakes up the worker thread when there is new work to do (flush or stop requested) */
+	FEvent* WorkerWakeEvent;
+	/** The platform time of the earliest wakeup request that has not yet resulted in a send (or 0 if none) */
+	std::atomic<double> WakeRequestPlatformTime;
+	/** The measured time between the last wakeup request and the worker sending the first payload in response (or -1 if never measured) */
+	std::atomic<double> LastWakeToSendLatencySecs;
+	/** The compression ratio (original size / compressed size) achieved for the last payload (or -1 if none yet) */
+	std::atomic<double> LastPayloadCompressionRatio;
+	/** The time it took to compress the last payload (or -1 if none yet) */
+	std::atomic<double> LastPayloadCompressSecs;
+	/** The total number of bytes of the logfile that were dropped without being shipped because the backlog was too large */
+	std::atomic<int64> DroppedBacklogBytes;
+	/** The bytes of memory held by the read and payload buffers. Only updated by the WORKER. */
+	std::atomic<int64> BufferBytes;
+	/** The most bytes that will be read for the next new payload when adaptive request sizing is enabled. Only updated by the WORKER. */
+	std::atomic<int32> AdaptiveBytesPerRequest;
+	/** The time spent building the last payload, not including compression (or -1 if none yet) */
+	std::atomic<double> LastPayloadBuildSecs;
+	/** The time from sending the last acknowledged payload until its response (or -1 if none yet) */
+	std::atomic<double> LastPayloadRequestSecs;
+	/** The bytes of the logfile that are not yet acknowledged, as of the last payload that was acknowledged. Only updated by the WORKER. */
+	std::atomic<int64> BacklogBytes;
+	/** The number of flushes that failed and were scheduled to be retried */
+	std::atomic<int64> NumFlushRetries;
+	/** The number of payloads the endpoint was unable to process that were skipped */
+	std::atomic<int64> NumDroppedPayloads;
+	/** The time of the last successful flush (or 0 if we have never successfully flushed). */
+	std::atomic<double> LastSuccessfulFlushPlatformTime;
 	/** The number of times we've finished a flush to cloud (success or fail) */
 	FThreadSafeCounter FlushOpCounter;
 	/** The number of times we've successfully finished a flush to cloud */
@@ -740,20 +2137,94 @@ protected:
 	FThreadSafeBool LastFlushProcessedEverything;
 	/** Whether or not the worker fully cleaned up */
 	FThreadSafeBool WorkerFullyCleanedUp;
-	/** [WORKER] buffer to hold data for current chunk being processed. Will be BytesPerRequest in size. */
+	/** [WORKER] buffer to hold data for current chunk being processed (unless it is read straight from the mapped logfile). Will be BytesPerRequest in size. */
 	TArray<uint8> WorkerBuffer;
-	/** [WORKER] string buffer that holds JSON data for next payload to deliver to the cloud. Will be BytesPerRequest in size. */
-	TITLJSONStringBuilder WorkerNextPayload;
-	/** [WORKER] byte buffer that holds the encoded data for the next payload. Can vary in size based on compression mode. */
-	TArray<uint8> WorkerNextEncodedPayload;
+	/** [WORKER] The data for the current chunk, either WorkerBuffer or the mapped logfile. Valid until the next read. */
+	const uint8* WorkerReadData;
+	/** [WORKER] Keeps the logfile open between reads. */
+	TUniquePtr<FsparklogsTailReader> WorkerTailReader;
+	/** [WORKER] The buffers and compression state used to build and encode one payload. Different builds can be used on different threads at once. */
+	struct FWorkerPayloadBuild
+	{
+		/** JSON data for the payload to deliver to the cloud. Reserved up to WorkerPayloadBufferSize. */
+		TITLJSONStringBuilder Payload;
+		/** The encoded data for the payload. Can vary in size based on compression mode.
+		  * With no compression this is swapped with the JSON buffer instead of copied. The payload processor may move from it. */
+		TArray<uint8> EncodedPayload;
+		/** The length of the JSON payload (before compression) that is in EncodedPayload. */
+		int OriginalPayloadLen = 0;
+		/** Whether the payload uses the common metadata envelope format instead of a plain array of events. */
+		bool IsEnvelope = false;
+		/** Time spent compressing the payload (including any blocks compressed while building it). */
+		double CompressSecs = 0.0;
+		/** Used to compress the payload block-by-block while it is being built when the compression mode is LZ4Frame. Created on first use. */
+		TUniquePtr<FITLLZ4FrameCompressor> FrameCompressor;
+		/** Persistent compression context used when the compression mode is Gzip. Created on first use. */
+		TUniquePtr<FITLGzipCompressor> GzipCompressor;
+	};
+	/** [WORKER] Builds the next payload to deliver to the cloud. */
+	FWorkerPayloadBuild WorkerBuild;
+	/** [WORKER] Whether the payload most recently handed to the payload processor uses the common metadata envelope format. */
+	bool WorkerNextPayloadIsEnvelope;
+	/** [WORKER] Where the data of the payload most recently handed to the payload processor starts and ends in the logfile. */
+	int64 WorkerNextPayloadStartOffset;
+	int64 WorkerNextPayloadEndOffset;
+	/** [WORKER] The capacity to reserve for the JSON payload so that building it never needs to reallocate. */
+	int WorkerPayloadBufferSize;
+	/** [WORKER] The most bytes read for one payload. Without a memory budget WorkerBuffer always has this size, with one it grows to what is actually read. */
+	int WorkerMaxReadLen;
+	/** [WORKER] With a memory budget, when the buffers were last needed (0 once they were released). */
+	double WorkerLastBufferUsePlatformTime;
+
+	/** [WORKER] A payload that was built ahead of time while catching up on a backlog, waiting to be sent in order. */
+	struct FWorkerCatchUpPayload
+	{
+		int64 StartOffset;
+		int NumToRead;
+		int CapturedOffset;
+		int64 RemainingBytes;
+		int NumCapturedLines;
+		/** Index into WorkerCatchUpBuilds */
+		int BuildIndex;
+		bool Success;
+	};
+	/** [WORKER] One build per payload that can be built at once while catching up. Released once caught up. */
+	TArray<TUniquePtr<FWorkerPayloadBuild>> WorkerCatchUpBuilds;
+	/** [WORKER] Holds the data of all payloads being built at once while catching up (unless the logfile is mapped). Released once caught up. */
+	TArray<uint8> WorkerCatchUpBuffer;
 	/** [WORKER] The offset where we next need to start processing data in the logfile. */
 	int64 WorkerShippedLogOffset;
+	/** [WORKER] The size of the logfile the last time it was read. */
+	int64 WorkerLogFileSize;
+	/** [WORKER] With a spooled logfile, the total size of the segments after the one being shipped. */
+	int64 WorkerSpoolBacklogBytes;
+	/** [WORKER] With a spooled logfile, when to next look for new segments while the segment being shipped is still growing. */
+	double WorkerNextSpoolScanPlatformTime;
+	/** [WORKER] The path of the file whose format was last detected, and whether it is written as binary records instead of lines of text. */
+	FString WorkerRecordFormatPath;
+	bool WorkerReadingBinaryRecords;
 	/** [WORKER] If non-zero, the minimum time when we can attempt to flush to cloud again automatically. Useful to wait longer to retry after a failure. */
 	double WorkerMinNextFlushPlatformTime;
 	/** [WORKER] The number of consecutive flush failures we've had in a row. */
 	int WorkerNumConsecutiveFlushFailures;
+	/** [WORKER] The last wait before retrying a failed flush (or 0 if the last flush succeeded). */
+	double WorkerLastRetrySecs;
+	/** [WORKER] The longest wait any server asked for (e.g., with a Retry-After header) since the last flush attempt, or 0 if none. */
+	double WorkerRetryAfterSecs;
+	/** [WORKER] The platform time of the wakeup request that the current flush is responding to (or 0 if none) */
+	double WorkerFlushWakeRequestPlatformTime;
 	/** [WORKER] The payload size of the request the last time we failed to flush. */
 	int WorkerLastFailedFlushPayloadSize;
+	/** [WORKER] The payload sizes of any pipelined requests that followed the last failed request (oldest first). Retries re-use these exact sizes. */
+	TArray<int> WorkerPendingRetryPayloadSizes;
+	/** [WORKER] Whether payloads are built with the common metadata envelope format. Recorded in the progress marker along with the payload sizes to retry,
+	  * and only switched to what the payload processor accepts when no payload is waiting to be retried, so that a retry always sends the same bytes. */
+	bool WorkerPayloadsUseEnvelope;
+	/** [WORKER] Where the data after the last payload that is waiting to be retried starts (or -1 if not known, e.g., for retries recorded
+	  * by an earlier session), so that mirrors can be given the payloads that follow while the retries keep failing (see WorkerMirrorAhead). */
+	int64 WorkerMirrorAheadOffset;
+	/** [WORKER] Whether the mirrors were given what they missed before this session (see WorkerResumeMirrors). */
+	bool WorkerMirrorsResumed;
 	/** [WORKER] Indicates if we need to save the common metadata payload after the next successful request (expensive so only do once after common metadata changes). */
 	bool WorkerSerializeCommonEventJSON;
 	/** [WORKER] Overrides the common event JSON data to use (will be the data from the last session for the first payload if we crashed last time). */
@@ -761,6 +2232,25 @@ protected:
 	/** Whether or not the next flush platform time is because of a failure. */
 	FThreadSafeBool WorkerLastFlushFailed;
 
+	/** [WORKER] A pipelined payload that has been handed to the payload processor but not yet acknowledged. */
+	struct FWorkerInFlightPayload
+	{
+		/** Offset in the logfile where the data for this payload starts */
+		int64 StartOffset;
+		/** The number of bytes that were read from the logfile to build this payload */
+		int NumToRead;
+		/** The number of bytes that this payload captured (progress advances by this much on success) */
+		int CapturedOffset;
+		/** The number of bytes that remained in the logfile (from StartOffset) when this payload was read */
+		int64 RemainingBytes;
+		/** Whether or not this payload is a retry that must use the same size as a previous attempt */
+		bool IsRetry;
+		/** Completion state, or null if the payload had no events and nothing needed to be sent */
+		TSharedPtr<FsparklogsPendingPayload, ESPMode::ThreadSafe> Pending;
+	};
+	/** [WORKER] Pipelined payloads that have not yet been acknowledged (oldest first). */
+	TArray<FWorkerInFlightPayload> WorkerInFlightPayloads;
+
 	/** The time of the initiation of the last flush (or 0 if we have never flushed). */
 	std::atomic<double> LastFlushPlatformTime;
 	/** The amount of bytes queued up since last flush. */
@@ -770,7 +2260,7 @@ protected:
 
 public:
 
-	FsparklogsReadAndStreamToCloud(int InstanceIndex, const FString& SourceLogFile, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InPayloadProcessor, int InMaxLineLength, const FString& InOverrideComputerName, const FString& AppInstanceID, const TMap<FString, FString>* AdditionalAttributes);
+	FsparklogsReadAndStreamToCloud(int InstanceIndex, const FString& SourceLogFile, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InPayloadProcessor, int InMaxLineLength, const FString& InOverrideComputerName, const FString& AppInstanceID, const TMap<FString, FString>* AdditionalAttributes, ITLStreamLane InLane = ITLStreamLane::Logs, uint32 InOverrideProcessId = 0);
 	~FsparklogsReadAndStreamToCloud();
 
 	// After constructing this object you must give it a weak pointer to itself before running it. Needed to pass to payload processor.
@@ -794,32 +2284,150 @@ public:
 	/** Initiate Flush up to N times, optionally clear retry timer to try again immediately, optionally initiate Stop, and wait up through a timeout for each flush to complete. Returns false on timeout or if the flush failed. */
 	virtual bool FlushAndWait(int N, bool ClearRetryTimer, bool InitiateStop, bool OnMainGameThread, double TimeoutSec, bool& OutLastFlushProcessedEverything);
 
+	/** Flushes (clearing the retry timer) until everything has been processed or DeadlinePlatformTime passes, then optionally stops the worker
+	  * (allowing at least MinStopWaitSecs for that). Returns true if everything was processed. */
+	virtual bool FlushUntilDeadline(double DeadlinePlatformTime, bool InitiateStop, bool OnMainGameThread);
+
+	/** Thread-safe. Makes sure the progress recorded so far is fully written to disk. */
+	virtual void SyncProgressToDisk();
+
 	/** Read the progress marker. Returns false on failure. */
 	virtual bool ReadProgressMarker(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutProgressState);
-	/** Writes the progress marker. Returns false on failure. */
-	virtual bool WriteProgressMarker(int64 InMarker, int LastReadLen, const TArray<uint8>* ProgressState);
+	/** Read the progress marker, including the read lengths of any pipelined requests that followed the request at the marker. Returns false on failure. */
+	virtual bool ReadProgressMarker(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutProgressState, TArray<int>& OutFollowingReadLens);
+	/** Same as above, also returning whether the requests to retry used the common metadata envelope format. */
+	virtual bool ReadProgressMarker(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutProgressState, TArray<int>& OutFollowingReadLens, bool& OutRetryIsEnvelope);
+	/** Writes the progress marker. Optionally records the read lengths of pipelined requests that follow the one at the marker, and whether all of
+	  * these requests use the common metadata envelope format. Returns false on failure. */
+	virtual bool WriteProgressMarker(int64 InMarker, int LastReadLen, const TArray<uint8>* ProgressState, const TArray<int>* FollowingReadLens = nullptr, bool RetryIsEnvelope = false);
 	/** Delete the progress marker */
 	virtual void DeleteProgressMarker();
 
+protected:
+	/** Reads the progress marker from the INI file (the only store before the progress journal, and still used where there is no journal). */
+	bool ReadLegacyProgressMarker(int64& OutMarker, int& OutLastReadLen, TArray<uint8>& OutProgressState, TArray<int>& OutFollowingReadLens, bool& OutRetryIsEnvelope);
+	/** Writes the progress marker to the INI file. */
+	bool WriteLegacyProgressMarker(int64 InMarker, int LastReadLen, const TArray<uint8>* ProgressState, const TArray<int>* FollowingReadLens, bool RetryIsEnvelope);
+	/** Removes the progress marker from the INI file. */
+	void DeleteLegacyProgressMarker();
+	/** Returns the INI key that stores the given progress marker value for this lane. */
+	FString GetProgressMarkerKey(const TCHAR* Key) const;
+	/** The desired seconds between attempts to read and process a chunk in this lane. */
+	double GetProcessingIntervalSecs() const;
+	/** The number of unflushed bytes that triggers an automatic flush in this lane. */
+	int32 GetUnflushedBytesToAutoFlush() const;
+
+public:
+
 	/** Gets the common event JSON data that has been computed (may be empty) */
 	virtual void GetCommonEventJSON(TArray<uint8>& OutData);
 
-	/** [WORKER] Returns the number of seconds to wait during a flush retry based on the number of consecutive failures. */
+	/** [WORKER] Returns the number of seconds to wait during a flush retry based on the number of consecutive failures.
+	  * Uses decorrelated jitter so that many clients that failed at once do not retry at once, and honors any wait the server asked for. */
 	virtual double WorkerGetRetrySecs();
+	/** [WORKER] Records the timing and outcome of a payload that was sent and is acknowledged or failed, then adapts to it (see WorkerAdaptToPayloadResult). */
+	virtual void WorkerRecordPayloadResult(const FsparklogsPendingPayload& Pending, bool Succeeded);
+	/** [WORKER] Adjusts the size of new payloads (additive increase, multiplicative decrease) after a payload that was sent is acknowledged or fails. */
+	virtual void WorkerAdaptToPayloadResult(const FsparklogsPendingPayload& Pending, bool Succeeded);
+	/** [WORKER] The most bytes to read for a new payload (retries always re-read the recorded size instead). */
+	int WorkerGetNewPayloadReadLimit() const;
+
+	/** Thread-safe. Returns the time between the last flush or stop request and the worker sending a payload in response, or a negative value if never measured. */
+	double GetLastWakeToSendLatencySecs() const { return LastWakeToSendLatencySecs.load(); }
+	/** [WORKER] Whether the payload most recently built uses the common metadata envelope format. Payload processors can call this from BeginProcessPayload. */
+	bool WorkerIsNextPayloadEnvelope() const { return WorkerNextPayloadIsEnvelope; }
+	/** [WORKER] Where the data of the payload most recently built starts and ends in the logfile. Payload processors can call this from BeginProcessPayload. */
+	void WorkerGetNextPayloadRange(int64& OutStartOffset, int64& OutEndOffset) const { OutStartOffset = WorkerNextPayloadStartOffset; OutEndOffset = WorkerNextPayloadEndOffset; }
+	/** How far each mirror of the payload processor got in this logfile. Payload processors can call this from BeginProcessPayload. */
+	const TArray<TSharedRef<FsparklogsMirrorCursor, ESPMode::ThreadSafe>>& GetMirrorCursors() const { return MirrorCursors; }
+	/** Thread-safe. Returns the compression ratio (original size / compressed size) achieved for the last payload, or a negative value if none yet. */
+	double GetLastPayloadCompressionRatio() const { return LastPayloadCompressionRatio.load(); }
+	/** Thread-safe. Returns the time spent compressing the last payload, or a negative value if none yet. */
+	double GetLastPayloadCompressSecs() const { return LastPayloadCompressSecs.load(); }
+	/** Thread-safe. Returns the total number of logfile bytes dropped without shipping because the backlog exceeded MaxLogBacklogBytes. */
+	int64 GetDroppedBacklogBytes() const { return DroppedBacklogBytes.load(); }
+	/** Thread-safe. Returns the bytes of memory held by the read and payload buffers (as of the end of the last flush, or of releasing idle buffers). */
+	int64 GetBufferBytes() const { return BufferBytes.load(); }
+	/** Thread-safe. Returns the most bytes that will be read for the next new payload when adaptive request sizing is enabled. */
+	int32 GetAdaptiveBytesPerRequest() const { return AdaptiveBytesPerRequest.load(); }
+	/** Thread-safe. Returns the bytes of the logfile that are not yet shipped, as of the last payload that was acknowledged. */
+	int64 GetBacklogBytes() const { return BacklogBytes.load(); }
+	/** Thread-safe. Fills in the streamer's part of a snapshot of the shipping pipeline (everything except what the output device measures). */
+	virtual void GetShipperStats(FsparklogsShipperStats& OutStats) const;
+	/** Returns which data this streamer ships. */
+	ITLStreamLane GetLane() const { return Lane; }
 
 protected:
-	/** [WORKER] Re-opens the logfile and reads more data into the work buffer. */
-	virtual bool WorkerReadNextPayload(int& OutNumToRead, int64& OutEffectiveShippedLogOffset, int64& OutRemainingBytes);
-	/** [WORKER] Build the JSON payload from as much of the data in WorkerBuffer as possible, up to NumToRead bytes. Sets OutCapturedOffset to the number of bytes captured into the payload. Returns false on failure. Do not call directly. */
+	/** [WORKER] Reads more data from the logfile (into the work buffer unless it is mapped), starting at StartOffset, and points WorkerReadData at it. If MaxReadLen is positive, reads no more than that many bytes. */
+	virtual bool WorkerReadNextPayload(int64 StartOffset, int MaxReadLen, int& OutNumToRead, int64& OutEffectiveShippedLogOffset, int64& OutRemainingBytes);
+	/** [WORKER] Build the JSON payload from as much of the data in WorkerReadData as possible, up to NumToRead bytes. Sets OutCapturedOffset to the number of bytes captured into the payload. Returns false on failure. Do not call directly. */
 	virtual bool WorkerBuildNextPayload(int NumToRead, int& OutCapturedOffset, int& OutNumCapturedLines);
-	/** [WORKER] Compress the current payload in WorkerNextPayload and store in WorkerNextEncodedPayload. */
+	/** [WORKER] Like WorkerBuildNextPayload, but builds from BufferData into the given build. Can run for different builds on several threads at once. */
+	virtual bool WorkerBuildPayload(FWorkerPayloadBuild& Build, const uint8* BufferData, int NumToRead, int& OutCapturedOffset, int& OutNumCapturedLines);
+	/** [WORKER] For WorkerBuildPayload with a file written as binary records, appends each whole record in BufferData to the build's payload as an event. */
+	virtual bool WorkerAppendBinaryRecords(FWorkerPayloadBuild& Build, const TArray<uint8>& CommonJSON, const uint8* BufferData, int NumToRead, int& OutCapturedOffset, int& OutNumCapturedLines);
+	/** [WORKER] Detects whether the file the tail reader points at is written as binary records (once it has enough data), see WorkerReadingBinaryRecords. */
+	virtual void WorkerUpdateRecordFormat(int64 FileSize);
+	/** [WORKER] Returns WorkerBuffer with room for at least Len bytes (up to WorkerMaxReadLen), growing it in steps if needed with a memory budget. */
+	virtual uint8* WorkerGetReadBuffer(int Len);
+	/** [WORKER] The capacity to reserve for the JSON payload built from NumToRead bytes. */
+	virtual int WorkerGetPayloadReserve(int NumToRead) const;
+	/** [WORKER] With a memory budget, releases the read and payload buffers once nothing needed them for MemoryBudgetIdleReleaseSecs. */
+	virtual void WorkerReleaseIdleBuffers();
+	/** [WORKER] Measures the memory held by the read and payload buffers into BufferBytes (and the streamer buffer memory stat). */
+	virtual void WorkerUpdateBufferBytes();
+	/** [WORKER] Hands the encoded payload of the build (and its JSON payload, if the payload processor wants it) to the payload processor.
+	  * The payload holds the data from StartOffset up to StartOffset + CapturedOffset. */
+	virtual TSharedRef<FsparklogsPendingPayload, ESPMode::ThreadSafe> WorkerBeginProcessPayload(FWorkerPayloadBuild& Build, int64 StartOffset, int CapturedOffset);
+	/** [WORKER] Like WorkerBeginProcessPayload, but only hands the payload to the mirrors of the payload processor (see IsparklogsPayloadProcessor::MirrorPayload). */
+	virtual void WorkerMirrorPayload(FWorkerPayloadBuild& Build, int64 StartOffset, int CapturedOffset);
+	/** [WORKER] While the payloads to retry keep failing, builds the data that follows them into payloads for the mirrors, up to MirrorMaxLagBytes
+	  * past WorkerShippedLogOffset. Their read lengths are added to the payloads to retry, so the payload processor later gets exactly the same payloads. */
+	virtual void WorkerMirrorAhead();
+	/** [WORKER] Once per session, resends to each mirror the data before WorkerShippedLogOffset that it had not delivered (if it is no more than
+	  * MirrorMaxLagBytes behind, otherwise that data is skipped). */
+	virtual void WorkerResumeMirrors();
+	/** [WORKER] The logfile started over, so the mirrors do too. */
+	virtual void WorkerRestartMirrors();
+	/** [WORKER] Compress the current payload in WorkerBuild. */
 	virtual bool WorkerCompressPayload();
+	/** [WORKER] Compress the JSON payload of the given build and store it in its encoded payload. Can run for different builds on several threads at once. */
+	virtual bool WorkerCompressPayload(FWorkerPayloadBuild& Build);
+	/** [WORKER] Compresses all complete blocks of the build's JSON payload into the LZ4 frame in its encoded payload and removes them from the JSON payload.
+	  * If bFinal is true, also compresses any remaining partial block. */
+	virtual bool WorkerCompressCompletedFrameBlocks(FWorkerPayloadBuild& Build, bool bFinal);
+	/** [WORKER] The number of payloads to build at once while catching up on a backlog (1 if catching up is disabled). */
+	virtual int WorkerGetCatchUpParallelism();
+	/** [WORKER] Whether the data after StartOffset is a backlog large enough to build several payloads at once. */
+	virtual bool WorkerShouldCatchUp(int64 StartOffset);
+	/** [WORKER] If catching up on a backlog, splits the data after StartOffset at line (or record) boundaries into payloads of up to BytesPerRequest,
+	  * builds and compresses them in parallel on the task graph, and returns them (in order) in OutPayloads. Returns the number of payloads prepared. */
+	virtual int WorkerPrepareCatchUp(int64 StartOffset, TArray<FWorkerCatchUpPayload>& OutPayloads);
+	/** [WORKER] If the unshipped part of the logfile is larger than MaxLogBacklogBytes (logs lane only, and not while retrying), skips ahead so that
+	  * only the newest MaxLogBacklogBytes (starting at a line or record boundary) remain to ship. Returns the number of bytes dropped. */
+	virtual int64 WorkerDropExcessBacklog();
+	/** [WORKER] With a spooled logfile (SpoolSegmentBytes), points the tail reader at the oldest segment. Sealed segments that were fully shipped are deleted
+	  * first (resetting InOutStartOffset to the start of the next one), and the oldest unprotected segments over SpoolMaxDiskBytes are dropped.
+	  * Returns false if the end of a sealed segment was reached while payloads from it are still in flight or waiting to be retried. */
+	virtual bool WorkerAdvanceSpool(int64& InOutStartOffset);
 	/** [WORKER] Does the actual work for the flush operation, returns true on success. Does not update progress marker or thread state. Do not call directly. */
 	virtual bool WorkerInternalDoFlush(int64& OutNewShippedLogOffset, bool& OutFlushProcessedEverything);
+	/** [WORKER] Like WorkerInternalDoFlush, but keeps up to MaxInFlightRequests payloads in flight until all available data is shipped.
+	  * Acknowledges payloads in order and advances WorkerShippedLogOffset and the progress marker past each contiguous success. Do not call directly. */
+	virtual bool WorkerInternalDoPipelinedFlush(int64& OutNewShippedLogOffset, bool& OutFlushProcessedEverything);
+	/** [WORKER] Writes the progress marker at the given offset along with the read lengths of all payloads that must be retried with the same size. */
+	virtual bool WorkerWritePipelinedProgressMarker(int64 InMarker, const TArray<int>& RetryReadLens, const TArray<uint8>* ProgressState);
 	/** [WORKER] Attempts to flush any newly available logs to the cloud. Response for updating flush op counters, LastFlushProcessedEverything, and MinNextFlushPlatformTime state. Returns false on failure. Only call from worker thread. */
 	virtual bool WorkerDoFlush();
 	/** [WORKER] Returns true if we're allowed to serialize the progress state. */
 	virtual bool WorkerIsAllowedSerializeProgressState();
+	/** [WORKER] Records the latency between the pending wakeup request (if any) and now, when the first payload is about to be sent. */
+	virtual void WorkerRecordWakeToSend();
+	/** [WORKER] Updates the backlog from the last known logfile size and WorkerShippedLogOffset. */
+	virtual void WorkerUpdateBacklog();
+
+	/** Thread-safe. Records the time of a wakeup request and wakes up the worker thread. */
+	void WakeWorker();
 };
 
 /**
@@ -831,8 +2439,13 @@ class SPARKLOGS_API FsparklogsIndexedLockFile
 {
 public:
 	FsparklogsIndexedLockFile(int MaxAttempts, const FString& BaseFilePath);
+	/** Attempts to acquire only the given lock index (e.g., to make sure that no process is using it while it is held). */
+	FsparklogsIndexedLockFile(const FString& BaseFilePath, int LockIndex);
 	~FsparklogsIndexedLockFile();
 
+	/** Returns the lockfile for the given lock index. */
+	static FString GetLockFilename(const FString& BaseFilePath, int LockIndex);
+
 	bool IsLocked() { return LockFileArchive.IsValid() && AcquiredLockIndex > 0; }
 	int GetLockIndex() { return LockFileArchive.IsValid() ? AcquiredLockIndex : 0; }
 	FString GetAttemptedLockFile() { return AttemptedLockFile; }
@@ -841,6 +2454,106 @@ protected:
 	TUniquePtr<FArchive> LockFileArchive;
 	int AcquiredLockIndex;
 	FString AttemptedLockFile;
+
+	/** Attempts to acquire the given lock index. Returns true on success. */
+	bool TryAcquire(const FString& BaseFilePath, int LockIndex);
+};
+
+/**
+ * With FsparklogsSettings::HostAgent, ships the logfiles of every plugin instance on this host from one elected instance. Every
+ * instance runs one of these and publishes (in its member file) what the leader needs to report its data as that instance: its process
+ * and app instance IDs, its computer name override and its additional attributes. The instance that holds
+ * the host lockfile is the leader: it streams each published instance's logfiles, each with its own progress marker, through one
+ * payload processor per lane (so requests share connections). Once an instance has exited and everything from it has shipped, the
+ * leader purges its logfiles while holding that instance's lock. The other instances only write their logfiles and try to take over
+ * every HostAgentElectionIntervalSecs, so shipping resumes from the recorded progress soon after the leader exits.
+ */
+class SPARKLOGS_API FsparklogsHostAgent : public FRunnable
+{
+public:
+	/** InHostDir is where the instances on this host keep their logfiles, lockfiles and member files. Defaults to the directory of the game log. */
+	FsparklogsHostAgent(int InInstanceIndex, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InLogsPayloadProcessor, TSharedPtr<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> InAnalyticsPayloadProcessor, int InMaxLineLength, const FString& InOverrideComputerName, const FString& InAppInstanceID, const TMap<FString, FString>* InAdditionalAttributes, const FString& InHostDir = FString());
+	~FsparklogsHostAgent();
+
+	/** Returns the base path of the host lockfile that the leader holds. */
+	FString GetHostLockBasePath() const;
+	/** Returns the base path of the lockfiles that each running instance holds for its instance index. */
+	FString GetInstanceLockBasePath() const;
+	/** Returns the file through which the given instance publishes what the leader reports its data with. */
+	FString GetMemberFilePath(int InstanceIndex) const;
+	/** Returns the logfile of the given instance for the given lane. */
+	FString GetLogFilePath(int InstanceIndex, ITLStreamLane Lane) const;
+
+	/** Thread-safe. Whether this instance currently ships the logfiles of every instance on this host. */
+	bool IsLeader() const { return Leader.load(); }
+
+	/** Thread-safe. Requests a flush of every logfile this instance ships. Does nothing if this instance is not the leader. */
+	void RequestFlush();
+
+	/** Thread-safe. Fills OutStats for the logfile of the given instance and lane. Returns false if this instance does not ship it. */
+	bool GetShipperStats(int InInstanceIndex, ITLStreamLane Lane, FsparklogsShipperStats& OutStats);
+
+	/** Stops trying to become the leader. If this instance is the leader, flushes every logfile it ships (waiting up to TimeoutSecs in total),
+	  * purges this instance's logfiles if everything shipped, and then releases the host lockfile so that another instance takes over.
+	  * Nothing more should be written to this instance's logfiles before calling this. */
+	void Shutdown(double TimeoutSecs);
+
+	//~ Begin FRunnable Interface
+	virtual bool Init();
+	virtual uint32 Run();
+	virtual void Stop();
+	//~ End FRunnable Interface
+
+protected:
+	/** What one instance publishes in its member file. */
+	struct FMember
+	{
+		int InstanceIndex = 0;
+		uint32 ProcessId = 0;
+		FString AppInstanceID;
+		FString OverrideComputerName;
+		TMap<FString, FString> AdditionalAttributes;
+	};
+
+	int InstanceIndex;
+	TSharedRef<FsparklogsSettings> Settings;
+	TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> LogsPayloadProcessor;
+	/** Only valid if analytics events have their own lane */
+	TSharedPtr<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> AnalyticsPayloadProcessor;
+	int MaxLineLength;
+	FString HostDir;
+	/** What this instance published in its member file */
+	FMember Self;
+	/** Set while this instance holds the host lockfile */
+	std::atomic<bool> Leader;
+	/** [WORKER] The host lockfile, held while this instance is the leader */
+	TUniquePtr<FsparklogsIndexedLockFile> HostLock;
+	/** Protects Streamers */
+	FCriticalSection StreamersCriticalSection;
+	/** The streamer of every logfile this instance ships, keyed by logfile path */
+	TMap<FString, TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe>> Streamers;
+	/** What each of the Streamers reports its data as, keyed by logfile path */
+	TMap<FString, FMember> StreamerMembers;
+	/** Wakes up the worker thread early to stop */
+	FEvent* WorkerWakeEvent;
+	/** WORKER thread */
+	volatile FRunnableThread* Thread;
+	/** Non-zero stops this thread */
+	FThreadSafeCounter StopRequestCounter;
+
+	/** Writes the member file of the given instance. Returns true on success. */
+	bool WriteMemberFile(const FMember& Member) const;
+	/** Reads every member file in HostDir into OutMembers, skipping any that cannot be read. */
+	void ReadMemberFiles(TArray<FMember>& OutMembers) const;
+	/** [WORKER] Tries to acquire the host lockfile. Returns true if this instance is now the leader. */
+	bool WorkerTryBecomeLeader();
+	/** [WORKER] Starts streaming the logfiles of every published instance that are not yet streamed, and purges those of exited instances.
+	  * If an instance restarted and reclaimed its index, its streamers are drained and re-created to report the new process. */
+	void WorkerUpdateStreamers();
+	/** [WORKER] If the given instance has exited and everything from it has shipped, stops streaming and purges its logfiles. */
+	void WorkerPurgeExitedInstance(int InInstanceIndex);
+	/** Stops the streamer (after one last flush) and purges its logfile and progress marker if everything shipped. Returns true if purged. */
+	bool StopAndPurge(TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer, const FString& LogFilePath, bool OnMainGameThread, double TimeoutSecs);
 };
 
 /**
@@ -892,6 +2605,30 @@ public:
 	/** Add a category name to the "always logged" filter. */
 	void AddAlwaysLoggedCategory(const class FName& InCategoryName) { AlwaysLoggedCategories.Add(InCategoryName); }
 
+	/** Thread-safe. Configures log storm suppression for all categories. If LinesPerSec is positive, each category can write at most that many lines
+	  * per second at each verbosity from each thread after a burst of BurstLines. If bCoalesceRepeats, identical consecutive lines of one thread are
+	  * written once followed by one event with the repeat count (or by the line itself if it only repeated once). Fatal messages are never suppressed.
+	  * Every thread keeps its own limits and repeats, so that checking a line never contends with other logging threads. */
+	void SetLogSuppression(double LinesPerSec, int32 BurstLines, bool bCoalesceRepeats);
+
+	/** Thread-safe. Overrides the rate limit for one category. A LinesPerSec of zero or less means the category is never rate limited. */
+	void SetCategoryRateLimit(const class FName& InCategoryName, double LinesPerSec, int32 BurstLines);
+
+	/** Thread-safe. The total number of log lines that were not written because they repeated the previous line or exceeded a rate limit. */
+	int64 GetNumSuppressedLines() const { return NumSuppressedLines.load(std::memory_order_relaxed); }
+
+	/** Thread-safe. The total bytes written to the file (including an estimate of the per-line overhead). */
+	int64 GetNumBytesWritten() const { return NumBytesWritten.load(std::memory_order_relaxed); }
+
+	/** Thread-safe. The total number of lines (events) written to the file. */
+	int64 GetNumLinesWritten() const { return NumLinesWritten.load(std::memory_order_relaxed); }
+
+	/** Thread-safe. Returns the rates of writes to the file, measured over the last window of about a second. */
+	void GetWriteRates(double& OutBytesPerSec, double& OutLinesPerSec) const;
+
+	/** Thread-safe. Fills in the output device's part of a snapshot of the shipping pipeline. */
+	void GetShipperStats(FsparklogsShipperStats& OutStats) const;
+
 	/** Thread safe method to add one new event to the queue. Raw JSON can be specified (should be the contents of an
 	  * encoded JSON object, but *without* the surrounding {}) as well as optional raw message text. You should include
 	  * in the RawJSON a timestamp field with the time of the message, or a timestamp at the start of the message field.
@@ -903,7 +2640,58 @@ public:
 	  */
 	bool AddRawEventWithJSONObject(const FString& RawJSONWithBraces, const TCHAR* Message, bool AddUTCNow);
 
+	/** Similar to AddRawEventWithJSONObject but RawJSONWithBraces is already UTF-8 encoded, so it is copied as-is. */
+	bool AddRawEventWithUTF8JSONObject(const ANSICHAR* RawJSONWithBraces, int32 RawJSONLen, const TCHAR* Message, bool AddUTCNow);
+
+	/** Thread safe method to add NumEvents raw events with a single write to the file. The UTF-8 JSON of event i (formatted like AddRawEvent, without
+	  * the surrounding {}) is RawJSONUTF8[RawJSONEnds[i-1] .. RawJSONEnds[i]) and its message is Messages[MessageEnds[i-1] .. MessageEnds[i]),
+	  * where the range of the first event starts at 0. Very large batches are written in chunks of about 1 MiB. Returns true on success. */
+	bool AddRawEventsUTF8(int32 NumEvents, const ANSICHAR* RawJSONUTF8, const int32* RawJSONEnds, const TCHAR* Messages, const int32* MessageEnds);
+
+	/** Starts capturing log messages into per-thread lock-free rings of RingBytes each (rounded up to a power of two). Logging threads only copy
+	  * the raw message into their ring, and a dedicated thread formats, converts and appends them to the file in batches.
+	  * Should be called before the device is added to GLog. Never starts with -FORCELOGFLUSH, since every line is written out right away anyway.
+	  * Returns true if capture is active. */
+	bool StartRingCapture(int32 RingBytes);
+
+	/** Whether log messages are currently captured into per-thread rings. */
+	bool IsRingCaptureActive() const { return RingCaptureActive.load(std::memory_order_relaxed); }
+
+	/** Thread-safe. Writes out all messages queued in the per-thread rings, then frees the rings of threads that have exited.
+	  * Returns false if this thread is already draining the rings. */
+	bool DrainRings();
+
+	/** Thread-safe. The number of per-thread rings currently allocated. */
+	int32 GetNumRings();
+
+	/** Starts holding log lines in memory instead of writing them to the file, such as while the shipping engine starts in the background.
+	  * Once MaxBytes are held, further lines are dropped and counted. Should be called before the device is added to GLog. */
+	void StartPreBuffer(int32 MaxBytes);
+
+	/** Thread-safe. Stops holding log lines in memory. If bWrite, the held lines are first written to the file with the time they were
+	  * originally logged, otherwise they are discarded. Lines logged meanwhile wait so that order is kept. Returns the number of lines written. */
+	int32 EndPreBuffer(bool bWrite);
+
+	/** Whether log lines are currently held in memory instead of written to the file. */
+	bool IsPreBuffering() const { return PreBufferActive.load(std::memory_order_relaxed); }
+
+	/** Thread-safe. The number of log lines that were dropped because the pre-buffer was full. */
+	int64 GetNumPreBufferDroppedLines() const { return NumPreBufferDroppedLines.load(std::memory_order_relaxed); }
+
+	/** Writes the file as a series of numbered segments next to it (see FsparklogsSpool), starting the next segment once the current one has about
+	  * SegmentBytes. Numbering continues after any segments left by an earlier session. If bBinaryRecords, the segments are written as binary records
+	  * (see FsparklogsSettings::SpoolBinaryRecords) instead of lines of text. Should be called before the device is added to GLog. */
+	void StartSpool(int64 SegmentBytes, bool bBinaryRecords = false);
+
+	/** Whether the file is written as a series of segments. */
+	bool IsSpoolActive() const { return SpoolActive.load(std::memory_order_relaxed); }
+
 protected:
+	struct FLogRing;
+	class FRingDrainRunnable;
+	struct FSpoolWriteScope;
+	struct FThreadSuppression;
+
 	/** Whether or not we've hit a failure that causes future writes to fail. */
 	bool Failed;
 	/** Whether or not to force a log flush after every log message. */
@@ -916,11 +2704,165 @@ protected:
 	FArchive* WriterArchive;
 	/** The categories that are always logged to the file, even if (!ALLOW_LOG_FILE || NO_LOGGING). */
 	TSet<FName> AlwaysLoggedCategories;
+
+	/** A rate limit for the lines of one category */
+	struct FRateLimit
+	{
+		double LinesPerSec = 0.0;
+		int32 BurstLines = 0;
+	};
+	/** Token bucket that limits the lines one thread writes in one category at one verbosity */
+	struct FRateBucket
+	{
+		FRateLimit Limit;
+		double Tokens = 0.0;
+		double LastRefillTime = 0.0;
+		int32 NumSuppressed = 0;
+		double FirstSuppressedTime = 0.0;
+		double LastSuppressedTime = 0.0;
+	};
+	/** Describes lines that were suppressed, written as one event once the run of suppressed lines ends */
+	struct FSuppressionSummary
+	{
+		FName Category;
+		ELogVerbosity::Type Verbosity;
+		bool IsRepeat;
+		int32 Count;
+		double FirstTime;
+		double LastTime;
+		/** For a line that repeated only once, the line itself, which is written instead of a summary */
+		FString RepeatedLine;
+	};
+	/** How lines are suppressed. Each thread checks its lines against its own copy. */
+	struct FSuppressionConfig
+	{
+		/** Changes whenever the configuration does */
+		uint32 Version = 0;
+		/** The rate limit for categories without an override */
+		FRateLimit DefaultRateLimit;
+		/** Per-category rate limit overrides */
+		TMap<FName, FRateLimit> CategoryRateLimits;
+		/** Whether identical consecutive lines of a thread are coalesced */
+		bool CoalesceRepeats = false;
+	};
+	/** Whether any suppression is configured. Checked without locking so that the default path costs nothing. */
+	std::atomic<bool> SuppressionActive;
+	/** Protects SuppressionConfig and ThreadSuppressions. Only taken by a logging thread for its first line and after the configuration changed. */
+	FCriticalSection SuppressionCriticalSection;
+	FSuppressionConfig SuppressionConfig;
+	/** The version of SuppressionConfig, so that threads can tell that their copy is stale without locking */
+	std::atomic<uint32> SuppressionConfigVersion;
+	/** Identifies this device, so threads can tell that a suppression state they cached belongs to a device that no longer exists. */
+	const uint32 SuppressionGeneration;
+	/** The suppression state of each thread that checked a line. A state is freed once its thread has exited and its summaries are written. */
+	TArray<TUniquePtr<FThreadSuppression>> ThreadSuppressions;
+	/** Total number of lines that were suppressed */
+	std::atomic<int64> NumSuppressedLines;
+	/** Total bytes and lines written */
+	std::atomic<int64> NumBytesWritten;
+	std::atomic<int64> NumLinesWritten;
+	/** When the current window for measuring write rates started, and the totals at that time */
+	std::atomic<double> WriteRateWindowStartTime;
+	std::atomic<int64> WriteRateWindowStartBytes;
+	std::atomic<int64> WriteRateWindowStartLines;
+	/** The write rates measured over the last complete window */
+	std::atomic<double> BytesWrittenPerSec;
+	std::atomic<double> LinesWrittenPerSec;
+	/** A log line held in memory while pre-buffering */
+	struct FPreBufferedLine
+	{
+		FString Data;
+		FName Category;
+		ELogVerbosity::Type Verbosity;
+		double Time;
+		/** The UTC time the line was logged, in ticks */
+		int64 UtcTicks;
+	};
+	/** Whether log lines are held in memory instead of written to the file. Checked without locking so that the default path costs nothing. */
+	std::atomic<bool> PreBufferActive;
+	/** Set while the held lines are being written, so that anything the writing thread logs meanwhile is written directly. */
+	bool PreBufferWriting;
+	/** Protects the pre-buffer state */
+	FCriticalSection PreBufferCriticalSection;
+	TArray<FPreBufferedLine> PreBufferedLines;
+	/** The approximate memory used by PreBufferedLines, and the most it may use */
+	int64 PreBufferedBytes;
+	int64 PreBufferMaxBytes;
+	/** Total number of lines dropped because the pre-buffer was full */
+	std::atomic<int64> NumPreBufferDroppedLines;
+	/** Whether the file is written as a series of segments. Checked without locking so that the default path costs nothing. */
+	std::atomic<bool> SpoolActive;
+	/** Held shared by writers while they use the async writer, and exclusively while replacing the writer to start the next segment */
+	FRWLock SpoolLock;
+	/** The size at which the next segment is started */
+	int64 SpoolSegmentBytes;
+	/** The number and path of the segment being written (guarded by SpoolLock) */
+	int64 SpoolSegmentNumber;
+	FString SpoolSegmentFilename;
+	/** Bytes written to the current segment */
+	std::atomic<int64> SpoolSegmentWrittenBytes;
+	/** Whether the current segment was marked as holding analytics events */
+	std::atomic<bool> SpoolSegmentProtected;
+	/** Set by the writer that filled the current segment until the next segment is started */
+	std::atomic<bool> SpoolRollPending;
+	/** Whether the segments are written as binary records instead of lines of text */
+	std::atomic<bool> SpoolBinaryRecords;
 	/** The weak reference to the streamer that will accrue bytes for auto-flushing. */
 	TWeakPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> CloudStreamerWeakPtr;
-
-	/** Writes out the given message event, potentially with a common message tag (e.g., date/time and verbosity/category), potentially with the ExtraJSON at the front. */
-	static void InternalAddMessageEvent(FArchive& Output, FString& RawJSON, const TCHAR* Message, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time, bool bSuppressEventTag);
+	/** Whether logging threads push messages into their ring instead of writing them directly. */
+	std::atomic<bool> RingCaptureActive;
+	/** The size of each per-thread ring in bytes (a power of two). */
+	uint32 RingCapacity;
+	/** Identifies this capture session, so threads can tell that a ring they cached belongs to an earlier session. */
+	uint32 RingGeneration;
+	/** Protects Rings and serializes draining them. */
+	FCriticalSection RingsCriticalSection;
+	/** The rings registered by logging threads in this capture session. A ring is freed once its thread has exited, or when capture stops. */
+	TArray<TUniquePtr<FLogRing>> Rings;
+	/** The number of logging threads currently inside PushToRing. Stopping waits for this to drop to zero before the final drain. */
+	std::atomic<int32> RingProducersInFlight;
+	/** Non-zero while a thread is draining the rings (guarded by RingsCriticalSection). */
+	int32 RingDrainDepth;
+	/** Wakes up the drain thread early when a ring is filling up. */
+	FEvent* RingDrainEvent;
+	/** Tells the drain thread to exit. */
+	std::atomic<bool> RingDrainStopping;
+	TUniquePtr<FRingDrainRunnable> RingDrainRunnable;
+	FRunnableThread* RingDrainThread;
+
+	/** Returns the ring for the calling thread, registering a new one if needed. Returns nullptr if ring capture is not active. */
+	FLogRing* GetThreadRing();
+	/** Copies the raw message into the calling thread's ring. Returns false if the message must be written directly instead. */
+	bool PushToRing(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time);
+	/** Writes out all messages queued in one ring. Must hold RingsCriticalSection. */
+	void DrainRing(FLogRing& Ring);
+	/** Waits for logging threads still pushing a message, stops the drain thread, writes out everything still queued and frees the rings. */
+	void StopRingCapture();
+	/** Returns true if the line must not be written because it repeats the previous line of this thread or exceeds its rate limit. Writes out
+	  * summaries of any earlier suppressed lines that should now be reported. */
+	bool ShouldSuppressLine(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category);
+	/** Returns the suppression state of the calling thread, registering a new one if needed. */
+	FThreadSuppression* GetThreadSuppression();
+	/** Recomputes whether suppression is active and publishes a new version of the configuration. Must hold SuppressionCriticalSection. */
+	void UpdateSuppressionConfig();
+	/** Writes one event for each summary of suppressed lines. Must not hold SuppressionCriticalSection. */
+	void WriteSuppressionSummaries(const TArrayView<const FSuppressionSummary> Summaries);
+	/** Writes out summaries for all suppressed lines that have not been reported yet. */
+	void FlushSuppressionSummaries();
+	/** Returns the summary of the repeats of the last line of the thread (which must have repeated) and resets the count. Must hold the CriticalSection of the state. */
+	FSuppressionSummary TakeRepeatSummary(FThreadSuppression& State);
+	/** Transforms the message to a single line with explicit severity and writes it to the file. */
+	void InternalSerializeLine(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time);
+	/** If pre-buffering, holds the line in memory (or drops it if the pre-buffer is full) and returns true. Returns false if the line should be written as usual. */
+	bool PreBufferLine(const TCHAR* Data, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time);
+
+	/** Writes out the given message event, potentially with a common message tag (e.g., date/time and verbosity/category), potentially with the
+	  * already UTF-8 encoded RawJSONFragment (including its start/end markers) at the front, as binary records if bBinaryRecords.
+	  * Returns the number of bytes the message encoded to. */
+	static int32 InternalAddMessageEvent(FArchive& Output, const ANSICHAR* RawJSONFragment, int32 RawJSONFragmentLen, const TCHAR* Message, ELogVerbosity::Type Verbosity, const class FName& Category, const double Time, bool bSuppressEventTag, bool bBinaryRecords);
+
+	/** Writes out one raw event whose JSON is the UTF-8 RawJSONPrefix (if any), then the UTF-8 RawJSONUTF8 (if any), then RawJSONLength characters of RawJSON. */
+	bool InternalAddRawEvent(const ANSICHAR* RawJSONPrefix, int32 RawJSONPrefixLen, const ANSICHAR* RawJSONUTF8, int32 RawJSONUTF8Length, const TCHAR* RawJSON, int32 RawJSONLength, const TCHAR* Message);
 
 	/** If the writer is not yet created, attempts to create it. On failure, sets Failed to True and returns false. */
 	bool CreateAsyncWriter();
@@ -931,8 +2873,14 @@ protected:
 	  */
 	bool ShouldLogCategory(const class FName& InCategoryName);
 
-	/** Accrue N bytes to the cloud streamer if possible. */
-	bool AccrueWrittenBytes(int N);
+	/** Records that N bytes of NumLines lines were written, and accrues them to the cloud streamer if possible. */
+	bool AccrueWrittenBytes(int N, int NumLines = 1);
+
+	/** Writes out the current segment and swaps in a writer for the next one, or keeps the current one if the next cannot be opened. Must not hold SpoolLock. */
+	void RollSpoolSegment();
+
+	/** Creates the marker that keeps the current segment from being dropped, if not done yet. Must hold SpoolLock shared. */
+	void MarkSpoolSegmentProtected();
 };
 
 /** Uniquely identifies an analytics session. Pass this information from a client to a server
@@ -1095,6 +3043,17 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "SparkLogs")
 	static void EndSessionWithReason(const FString& Reason);
 
+	/** Game thread only. Collects all analytics events recorded from now on until CommitBatch is called (at the latest at the end of the frame),
+	  * then writes them all at once stamped with the same session and common attributes (see FsparklogsAnalyticsBatch). If a batch is already
+	  * open, does nothing. If a batch opened in C++ is active, the events join it instead and are written when that batch commits. */
+	UFUNCTION(BlueprintCallable, Category = "SparkLogs")
+	static void BeginBatch();
+
+	/** Game thread only. Writes all analytics events collected since BeginBatch and closes the batch. Returns the number of events written,
+	  * or if the batch joined a batch opened in C++, the number of events recorded since BeginBatch (which that batch writes when it commits). */
+	UFUNCTION(BlueprintCallable, Category = "SparkLogs")
+	static int32 CommitBatch();
+
 	/** Gets the current user ID */
 	UFUNCTION(BlueprintCallable, Category = "SparkLogs")
 	static FString GetUserID();
@@ -1501,6 +3460,64 @@ public:
 	static void RecordLogWithReasonWithAttr(EsparklogsSeverity Severity, const FString& Message, const FString& Reason, const TArray<FsparklogsAnalyticsAttribute>& CustomAttrs);
 };
 
+/**
+ * Sums up counter-like analytics events (resource and design) per session, event ID and reason over a time window,
+ * so that one rollup event per key can be written instead of every event. Thread-safe.
+ */
+class SPARKLOGS_API FsparklogsAnalyticsAggregator
+{
+public:
+	struct FRollup
+	{
+		// EventTypeResource or EventTypeDesign
+		const TCHAR* EventType;
+		// The session the events were recorded for
+		FString SessionID;
+		FString EventID;
+		FString Reason;
+		// Design events only
+		TArray<FString> EventIDParts;
+		// Resource events only
+		FString FlowType;
+		FString VirtualCurrency;
+		FString ItemCategory;
+		FString ItemId;
+		// Set if the events were recorded for an explicit session (e.g., for a player on a dedicated server)
+		TOptional<FSparkLogsAnalyticsSessionDescriptor> OverrideSession;
+		// False if none of the events had a value (design events without a value are only counted)
+		bool HasValue;
+		double Sum;
+		int64 Count;
+		// When the first event of this rollup was added (UTC)
+		FDateTime Started;
+
+		FRollup() : EventType(nullptr), HasValue(false), Sum(0.0), Count(0), Started(ITLEmptyDateTime) { }
+	};
+
+	FsparklogsAnalyticsAggregator();
+
+	/** Adds one event (with Count 1 and Sum set to its amount) to the rollup for its session, event ID and reason. If the window that started with the
+	  * first pending event is at least WindowSecs old, or a new key would exceed MaxKeys, all pending rollups are first moved to OutDue, to be written now. */
+	void Add(const FRollup& Event, double WindowSecs, int32 MaxKeys, TArray<FRollup>& OutDue);
+	/** Moves all pending rollups to OutRollups. */
+	void TakeAll(TArray<FRollup>& OutRollups);
+	/** Moves all pending rollups to OutDue if the window that started with the first pending event is at least WindowSecs old. */
+	void TakeDue(double WindowSecs, TArray<FRollup>& OutDue);
+	/** Returns the number of pending rollups. */
+	int32 Num() const;
+
+protected:
+	// Returns the key that identifies the rollup the given event belongs to.
+	static FString GetKey(const FRollup& Event);
+	// Must hold CriticalSection. Moves all pending rollups to OutRollups.
+	void MoveAllTo(TArray<FRollup>& OutRollups);
+
+	mutable FCriticalSection CriticalSection;
+	TMap<FString, FRollup> Rollups;
+	// When the first pending rollup was added
+	double WindowStartedPlatformTime;
+};
+
 /**
  * Analytics interface implementation that sends data to the sparklogs module.
  * Typically you would use the UsparklogsAnalytics class rather than this
@@ -1600,6 +3617,9 @@ public:
 	static constexpr const TCHAR* AdFieldCount = TEXT("count");
 	static constexpr const TCHAR* AdFieldReason = TEXT("reason");
 
+	static constexpr const TCHAR* RollupFieldCount = TEXT("rollup_count");
+	static constexpr const TCHAR* RollupFieldStarted = TEXT("rollup_started");
+
 	static constexpr const TCHAR* LogFieldSeverity = TEXT("severity");
 	static constexpr const TCHAR* LogFieldReason = TEXT("reason");
 
@@ -1729,20 +3749,32 @@ public:
 	  * 
 	  * If a session is NOT active or if there is no game ID or user ID, it will forcefully set Object to nullptr (so the event cannot be sent) unless you specify OverrideSession.
 	  * If OverrideSession is not nullptr/empty then you can override the session ID/number/start/user ID (useful on the server).
+	  * The meta object added to Object is shared with other events and must not be modified.
 	  */
 	void FinalizeAnalyticsEvent(const TCHAR* EventType, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession, TSharedPtr<FJsonObject>& Object);
 
+	/** Thread-safe. Writes one rollup event for every key summed up so far by AnalyticsAggregationWindowSecs. */
+	void FlushAggregatedEvents();
+	/** Thread-safe. Like FlushAggregatedEvents, but only if the current window has ended. Cheap otherwise. Lets windows end even if no further event arrives. */
+	void FlushAggregatedEventsIfDue();
+
+	/** Not thread-safe: set it before any event is queued. Writes every event (including session events) straight to Device instead of through
+	  * the module, e.g., so that benchmarks can measure the typed event path against a scratch logfile. Device must outlive the provider. */
+	void SetOutputDevice(FsparklogsOutputDeviceFile* Device) { OutputDevice = Device; }
+
 public:
 	static void AddAnalyticsEventAttributeToJsonObject(const TSharedPtr<FJsonObject> Object, const FAnalyticsEventAttribute& Attr, int AttrNumber);
 	static void AddAnalyticsEventAttributesToJsonObject(const TSharedPtr<FJsonObject> Object, const TArray<FAnalyticsEventAttribute>& EventAttrs);
 	static void AddAnalyticsEventAttributeToJsonObject(const TSharedPtr<FJsonObject> Object, const FsparklogsAnalyticsAttribute& Attr, int AttrNumber);
 	static void AddAnalyticsEventAttributesToJsonObject(const TSharedPtr<FJsonObject> Object, const TArray<FsparklogsAnalyticsAttribute>& EventAttrs);
-	static FAnalyticsEventAttribute ConvertJsonValueToEventAttribute(const FString& Key, TSharedPtr<FJsonValue> Value);
+	static FAnalyticsEventAttribute ConvertJsonValueToEventAttribute(const FString& Key, const TSharedPtr<FJsonValue>& Value);
 	// Returns a JSON array value that contains the strings from the given array. Ignores empty string values in the array.
 	static TSharedRef<FJsonValueArray> ConvertNonEmptyStringArrayToJSON(const TArray<FString>& A);
 
 protected:
 	TSharedRef<FsparklogsSettings> Settings;
+	// If set, events are written here instead of through the module (see SetOutputDevice).
+	FsparklogsOutputDeviceFile* OutputDevice;
 
 	// Protects access to any of data below this declaration.
 	mutable FCriticalSection DataCriticalSection;
@@ -1759,14 +3791,75 @@ protected:
 	// The current tags associated with this user
 	TArray<FString> UserTags;
 
+	// Sums up resource and design events when AnalyticsAggregationWindowSecs is set. Has its own lock.
+	FsparklogsAnalyticsAggregator Aggregator;
+
+	// Immutable copy of the session, meta attribute and user tag state above that every analytics event is stamped with.
+	struct FAnalyticsStateSnapshot
+	{
+		FString SessionID;
+		FDateTime SessionStarted;
+		int SessionNumber;
+		// Never modified after the snapshot is published and shares no values with the provider, so any thread can read it.
+		// Only read it in place, never hand out its values: whoever gets them (the caller or the streamer) may modify the objects while other
+		// threads read them, and the TMap of FJsonObject is not safe to modify while it is being read. Use CopyMetaAttributes instead.
+		TSharedRef<const FJsonObject, ESPMode::ThreadSafe> MetaAttributes;
+		// UTF-8 JSON encoding of MetaAttributes.
+		TITLJSONStringBuilder MetaAttributesUTF8;
+		TArray<FString> UserTags;
+		FString FlattenedUserTags;
+
+		FAnalyticsStateSnapshot() : SessionStarted(ITLEmptyDateTime), SessionNumber(0), MetaAttributes(MakeShared<FJsonObject, ESPMode::ThreadSafe>()) { }
+	};
+	// Only guards swapping/copying the PublishedState pointer, so readers never wait on the (much longer) DataCriticalSection.
+	mutable FRWLock PublishedStateLock;
+	// The latest snapshot. Replaced (never modified) whenever the state guarded by DataCriticalSection changes.
+	TSharedRef<const FAnalyticsStateSnapshot, ESPMode::ThreadSafe> PublishedState;
+
+	// Thread-safe. Returns the latest published snapshot of the session, meta attribute and user tag state.
+	TSharedRef<const FAnalyticsStateSnapshot, ESPMode::ThreadSafe> GetStateSnapshot() const;
+	// Must hold DataCriticalSection. Publishes a new snapshot after any change to the session, meta attributes or user tags.
+	void PublishStateSnapshot();
+	// Returns the snapshot new events are stamped with: the one cached by the calling thread's active batch (if any), otherwise the latest one.
+	TSharedRef<const FAnalyticsStateSnapshot, ESPMode::ThreadSafe> GetEventStateSnapshot() const;
+	// Thread-safe. Returns a new copy of the meta attributes in the snapshot, which the caller owns and may modify.
+	static TSharedRef<FJsonObject> CopyMetaAttributes(const FAnalyticsStateSnapshot& State);
+
 	// Does the work to end the session, using the given date/time (in UTC) as the session end date.
 	void DoEndSession(const TCHAR* Reason, FDateTime SessionEnded);
 
 	// Not thread-safe (hold lock if needed). Setup defaults for meta attributes.
 	void SetupDefaultMetaAttributes();
 
-	// Like FinalizeAnalyticsEvent but will assume the critical section is ALREADY LOCKED!
-	void InternalFinalizeAnalyticsEvent(const TCHAR* EventType, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession, TSharedPtr<FJsonObject>& Object);
+	// Like FinalizeAnalyticsEvent, but stamps the event with the given snapshot of the state.
+	void InternalFinalizeAnalyticsEvent(const FAnalyticsStateSnapshot& State, const TCHAR* EventType, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession, TSharedPtr<FJsonObject>& Object);
+
+	// Like FinalizeAnalyticsEvent but writes the standard fields into the object currently open in Writer.
+	// Returns false (without writing anything) if the event cannot be sent.
+	// While a batch is active, the fields after the event type are encoded once and reused for every event in the batch.
+	bool WriteStandardAnalyticsFields(FsparklogsJSONWriterUTF8& Writer, const TCHAR* EventType, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession);
+	// Writes the standard fields stamped from the given snapshot. The event type field is skipped if EventType is nullptr.
+	bool WriteStandardAnalyticsFieldsFromState(FsparklogsJSONWriterUTF8& Writer, const FAnalyticsStateSnapshot& State, const TCHAR* EventType, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession);
+
+	// Returns a writer into the calling thread's typed event buffer, with the root object and the g_analytics object opened.
+	// Optionally writes one custom string field at the root first (e.g., the severity of a log event).
+	static FsparklogsJSONWriterUTF8 BeginTypedAnalyticsEvent(const TCHAR* RootFieldName = nullptr, const FString& RootFieldValue = FString());
+
+	// Writes a session event (already finalized) to OutputDevice, if set, or through the module.
+	bool QueueSessionAnalyticsEvent(TSharedPtr<FJsonObject> Data, const TCHAR* LogMessage);
+	// Writes custom attributes and the standard fields, closes the event started by BeginTypedAnalyticsEvent and queues it.
+	bool QueueTypedAnalyticsEvent(FsparklogsJSONWriterUTF8& Writer, const TCHAR* EventType, TSharedPtr<FJsonObject> CustomAttrs, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession, const TCHAR* LogMessage, bool ForceDisableAutoExtract);
+
+	// Returns true if the event should be summed up by the aggregator rather than written as-is.
+	bool CanAggregateEvent(TSharedPtr<FJsonObject> CustomAttrs, const TCHAR* ExtraMessage) const;
+	// Adds the event to the aggregator (stamping it with the event's session) and writes any rollups that are due.
+	void AggregateEvent(FsparklogsAnalyticsAggregator::FRollup& Event, const FSparkLogsAnalyticsSessionDescriptor* OverrideSession);
+	// Writes the given rollups as events of their type, with the sum as the amount (value) and the number of events summed up.
+	void WriteRollupEvents(const TArray<FsparklogsAnalyticsAggregator::FRollup>& Rollups);
+	// Writes the fields of a resource event. ItemCategory and ItemId are skipped if empty.
+	static void WriteResourceFields(FsparklogsJSONWriterUTF8& Writer, const FString& FlowTypeStr, const TCHAR* VirtualCurrency, const TCHAR* ItemCategory, const TCHAR* ItemId, const FString& EventID, double Amount, const TCHAR* Reason);
+	// Writes the fields of a design event. The value is skipped if nullptr.
+	static void WriteDesignFields(FsparklogsJSONWriterUTF8& Writer, const FString& EventId, const TArray<FString>& EventIDParts, const double* Value, const TCHAR* Reason);
 
 	// Forms the final message that should be used given a default message, an extra message, and whether or not the default should be included.
 	FString CalculateFinalMessage(const FString& DefaultMessage, bool IncludeDefaultMessage, const TCHAR* ExtraMessage);
@@ -1777,6 +3870,78 @@ protected:
 	static FString GetProgressionEventID(const TArray<FString>& PArray);
 	// Flattens an array of IDs into an Event ID
 	static FString FlattenEventIDs(const TArray<FString>& A);
+
+	friend class FsparklogsAnalyticsBatch;
+};
+
+/**
+ * Collects the analytics events recorded on the calling thread while it is in scope and writes them all to the log with a single write
+ * when it is committed (at the latest when it goes out of scope). Every event in the batch is stamped with the same snapshot of the
+ * session, meta attributes and user tags, and the standard fields are only encoded once for the whole batch.
+ *
+ * Any analytics event can be recorded as usual (e.g., UsparklogsAnalytics::AddDesign or FsparklogsModule::AddRawAnalyticsEvent).
+ * A batch started while another batch is already active on the same thread joins the outer batch, and the events are written
+ * when the outer batch is committed. Batches must be destroyed in the reverse order they were created.
+ *
+ *     {
+ *         FsparklogsAnalyticsBatch Batch;
+ *         for (const FItem& Item : Items) { UsparklogsAnalytics::AddResource(...); }
+ *     } // all of the events are written here
+ */
+class SPARKLOGS_API FsparklogsAnalyticsBatch
+{
+public:
+	FsparklogsAnalyticsBatch();
+	~FsparklogsAnalyticsBatch();
+
+	FsparklogsAnalyticsBatch(const FsparklogsAnalyticsBatch&) = delete;
+	FsparklogsAnalyticsBatch& operator=(const FsparklogsAnalyticsBatch&) = delete;
+
+	/** Returns the batch that events recorded on the calling thread are added to, or nullptr if none is active. */
+	static FsparklogsAnalyticsBatch* GetActive();
+
+	/** Whether this batch collects events itself (false if it joined an outer batch). */
+	bool IsOutermost() const { return GetActive() == this; }
+
+	/** Unique to this batch among all batches ever created, so that it can be recognized later without keeping a pointer to it
+	  * (another batch may reuse its address once it is gone). */
+	uint64 GetGeneration() const { return Generation; }
+
+	/** Writes all events collected so far and starts collecting again with a fresh snapshot. Returns the number of events written.
+	  * Does nothing (and returns 0) if this batch joined an outer batch. */
+	int32 Commit();
+
+	/** The number of events collected and not yet written. */
+	int32 Num() const { return RawJSONEnds.Num(); }
+
+	/** Adds one analytics event, where RawJSONWithBraces is the complete UTF-8 JSON root object of the event. The current UTC time is added as its timestamp. */
+	void Add(const ANSICHAR* RawJSONWithBraces, int32 RawJSONLen, const TCHAR* Message);
+
+protected:
+	/** The UTF-8 JSON (without the surrounding {}) of all collected events, back to back. */
+	TITLJSONStringBuilder RawJSON;
+	/** The end offset in RawJSON of each event. */
+	TArray<int32> RawJSONEnds;
+	/** The log messages of all collected events, back to back. */
+	TArray<TCHAR> Messages;
+	/** The end offset in Messages of each event. */
+	TArray<int32> MessageEnds;
+	/** The snapshot that events in this batch are stamped with. Taken when the first event is finalized. */
+	TSharedPtr<const FsparklogsAnalyticsProvider::FAnalyticsStateSnapshot, ESPMode::ThreadSafe> StateSnapshot;
+	/** The encoded standard fields (after the event type) shared by all events in this batch stamped from StateSnapshot. */
+	TITLJSONStringBuilder StandardFieldsUTF8;
+	/** The number of events ever added, including those already written. */
+	int32 NumAdded;
+	const uint64 Generation;
+
+	/** Clears the collected events and the cached snapshot. */
+	void Reset();
+	/** Forgets the cached snapshot, e.g., after the calling thread changed the session, so the next event takes a fresh one. */
+	void InvalidateStateSnapshot();
+
+	friend class FsparklogsAnalyticsProvider;
+	friend class FsparklogsModule;
+	friend class UsparklogsAnalytics;
 };
 
 enum class SPARKLOGS_API ESparkLogsOverrideBool {
@@ -1887,6 +4052,17 @@ public:
 	  * If analytics is not enabled, returns false. Returns true if the data was queued. */
 	virtual bool AddRawAnalyticsEvent(TSharedPtr<FJsonObject> RawAnalyticsData, const TCHAR* LogMessage, TSharedPtr<FJsonObject> CustomRootFields, bool ForceDisableAutoExtract, bool ForceDebugLogEvent);
 
+	/** Thread-safe. Like AddRawAnalyticsEvent, but RawAnalyticsJSON is the complete, already UTF-8 encoded root JSON object (including g_analytics).
+	  * Used by the analytics provider to queue the standard event types without building an FJsonObject. */
+	virtual bool AddRawAnalyticsEventUTF8(const ANSICHAR* RawAnalyticsJSON, int32 RawAnalyticsJSONLen, const TCHAR* LogMessage, bool ForceDebugLogEvent);
+
+	/** Thread-safe. Writes all events collected by the batch with a single write. Typically called through FsparklogsAnalyticsBatch::Commit.
+	  * If analytics is not enabled, returns false. Returns true if the data was queued. */
+	virtual bool WriteAnalyticsBatch(const FsparklogsAnalyticsBatch& Batch);
+
+	/** Formats the raw analytics event (plus any custom root fields) as the JSON object that AddRawAnalyticsEvent queues. Returns false on failure. */
+	static bool FormatRawAnalyticsEvent(TSharedPtr<FJsonObject> RawAnalyticsData, TSharedPtr<FJsonObject> CustomRootFields, bool ForceDisableAutoExtract, FString& OutJSON);
+
 	/** Returns the random app_instance_id used for this run of the engine.
 	  * There may be multiple game engine analytics sessions during a single game instance.
 	  * This is available after the module has started (even before the shipping
@@ -1909,6 +4085,19 @@ public:
 	/** Triggers an immediate flush of queued log/analytics events to attempt to be sent to the cloud. Does not wait for this to finish. */
 	void Flush();
 
+	/** Writes the logfiles and shipping progress to disk, then ships queued analytics events and then logs until BudgetSecs have passed (or everything is shipped).
+	  * Blocks the calling thread for about BudgetSecs at most (ticking HTTP when called from the game thread). The shipping engine keeps running.
+	  * With HostAgent, another instance may be shipping, so only a flush is requested. Returns true if everything was shipped. */
+	bool FlushWithDeadline(double BudgetSecs, FsparklogsDeadlineFlushResult& OutResult);
+
+	/** Fills OutStats with a snapshot of the shipping pipeline for the given lane (e.g., so that a server health endpoint can report shipper lag).
+	  * Call from the game thread. Returns false if the shipping engine is not active, or if the lane does not have its own streamer
+	  * (or, with HostAgent, if another instance on this host currently ships it). */
+	bool GetShipperStats(ITLStreamLane Lane, FsparklogsShipperStats& OutStats);
+
+	/** Whether the shipping engine is still starting up on a background task (see FsparklogsSettings::AsyncStartup). */
+	bool IsStartingUp() const { return AsyncStartupPending.load(); }
+
 protected:
 	/** Called by the engine after it has fully initialized. */
 	void OnPostEngineInit();
@@ -1918,18 +4107,76 @@ protected:
 	void OnAppEnterBackground();
 	/** Called by the engine when the app has entered the foreground on mobile. */
 	void OnAppEnterForeground();
+	/** Pre-warms the connections of the HTTP payload processors (if enabled). */
+	void PreWarmConnections();
+	/** Called by the core ticker every frame. Writes behind analytics state changes and ends windows of summed up analytics events that are due. */
+	bool OnTick(float DeltaTime);
+	/** Returns the payload processor a streamer of the given lane should use: the given one, or a fan-out to it and the configured mirrors. */
+	TSharedRef<IsparklogsPayloadProcessor, ESPMode::ThreadSafe> WithMirrors(TSharedRef<FsparklogsWriteHTTPPayloadProcessor, ESPMode::ThreadSafe> PayloadProcessor, ITLStreamLane Lane);
+	/** Flushes the logfiles and the shipping progress (including analytics state) to disk. Cheap compared to shipping. */
+	void SyncToDisk();
+	/** Sets the request timeout of the payload processor so that a request started now does not run (much) past the deadline. */
+	void SetDeadlineRequestTimeout(FsparklogsWriteHTTPPayloadProcessor* PayloadProcessor, double DeadlinePlatformTime);
 
 private:
 	/** Singleton analytics provider */
 	static TSharedPtr<FsparklogsAnalyticsProvider> AnalyticsProvider;
 
 	FString AppInstanceID;
-	bool EngineActive;
+	std::atomic<bool> EngineActive;
+	/** Set while the shipping engine is starting up on a background task. Analytics events recorded meanwhile are held in memory. */
+	std::atomic<bool> AsyncStartupPending;
+	/** The background task that starts the shipping engine with AsyncStartup */
+	TFuture<void> AsyncStartupTask;
+	/** Protects the analytics events held in memory during AsyncStartup */
+	FCriticalSection StartupAnalyticsCriticalSection;
+	/** Analytics events recorded during AsyncStartup, in the layout of FsparklogsOutputDeviceFile::AddRawEventsUTF8 (each already has its timestamp). */
+	TArray<ANSICHAR> StartupAnalyticsJSON;
+	TArray<int32> StartupAnalyticsJSONEnds;
+	TArray<TCHAR> StartupAnalyticsMessages;
+	TArray<int32> StartupAnalyticsMessageEnds;
+	/** The number of analytics events dropped during AsyncStartup because too many were held in memory */
+	int32 NumStartupAnalyticsEventsDropped;
 	TSharedRef<FsparklogsSettings> Settings;
+#if ENGINE_MAJOR_VERSION >= 5
+	FTSTicker::FDelegateHandle TickHandle;
+#else
+	FDelegateHandle TickHandle;
+#endif
 	TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> CloudStreamer;
 	TUniquePtr<FsparklogsStressGenerator> StressGenerator;
 	/** The payload processor that sends data to the cloud */
 	TSharedPtr<FsparklogsWriteHTTPPayloadProcessor, ESPMode::ThreadSafe> CloudPayloadProcessor;
+	/** Ships analytics events from their own logfile when they have their own lane (see FsparklogsSettings::AnalyticsLane) */
+	TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> AnalyticsStreamer;
+	/** The payload processor that sends analytics events to the cloud when they have their own lane */
+	TSharedPtr<FsparklogsWriteHTTPPayloadProcessor, ESPMode::ThreadSafe> AnalyticsPayloadProcessor;
+	/** Whether the analytics logfile is shipped (by AnalyticsStreamer or HostAgent). Set before EngineActive, so writers can read it without locking. */
+	std::atomic<bool> AnalyticsLaneActive;
+	/** Ships the logfiles of every instance on this host instead of CloudStreamer and AnalyticsStreamer (see FsparklogsSettings::HostAgent) */
+	TUniquePtr<FsparklogsHostAgent> HostAgent;
+	/** Mirror the payloads of the cloud payload processors when mirrors are configured (see FsparklogsSettings::MirrorHTTPEndpointURI) */
+	TArray<TSharedRef<FsparklogsFanOutPayloadProcessor, ESPMode::ThreadSafe>> FanOutPayloadProcessors;
+	/** The HTTP processors of the mirrors, so that their requests can be held to the shutdown deadline */
+	TArray<TSharedRef<FsparklogsWriteHTTPPayloadProcessor, ESPMode::ThreadSafe>> MirrorHTTPPayloadProcessors;
+
+	/** Returns the device that analytics events are written to (their own logfile if something ships it, otherwise the game logfile). */
+	FsparklogsOutputDeviceFile* GetAnalyticsLogDevice();
+	/** Starts the shipping engine (see StartShippingEngine). Unless LoadCurrentSettings, the caller already loaded the settings on the game thread. */
+	bool InternalStartShippingEngine(const FSparkLogsEngineOptions& options, bool LoadCurrentSettings);
+	/** Loads the settings and what StartShippingEngine keeps from them before anything reads them: the install time, the user ID and the user tags. */
+	void LoadSettingsForStartup(const FSparkLogsEngineOptions& options);
+	/**
+	 * With AsyncStartup, loads the settings, installs the game logfile device holding early log lines in memory, then starts the shipping engine on a background task.
+	 * Settings are loaded on the game thread first, so that events recorded while the engine starts are finalized with the right settings without racing the load.
+	 */
+	void BeginAsyncStartup();
+	/** Runs at the end of the AsyncStartup background task. Writes (or discards, if the engine did not start) the log lines and analytics events held in memory. */
+	void FinishAsyncStartup();
+	/** During AsyncStartup, holds the events of the batch in memory and returns true. Returns false if the events should be written as usual. */
+	bool HoldStartupAnalyticsEvents(const FsparklogsAnalyticsBatch& Batch);
+	/** Flushes everything the streamer has not yet shipped from the logfile written by LogDevice, then removes the device, and purges the logfile if everything shipped. */
+	void FlushAndPurgeOnShutdown(TSharedPtr<FsparklogsReadAndStreamToCloud, ESPMode::ThreadSafe> Streamer, FsparklogsOutputDeviceFile* LogDevice, const FString& LogFilePath, double DeadlinePlatformTime);
 
 	void RegisterSettings();
 	void UnregisterSettings();
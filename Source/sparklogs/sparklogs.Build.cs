@@ -24,7 +24,7 @@ public class sparklogs : ModuleRules
             }
 			);
 
-		//AddEngineThirdPartyPrivateStaticDependencies(Target, "zlib");
+		AddEngineThirdPartyPrivateStaticDependencies(Target, "zlib");
 		
 		PublicDependencyModuleNames.AddRange(
 			new string[]